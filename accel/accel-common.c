@@ -33,10 +33,18 @@
 #include "accel-softmmu.h"
 #endif /* !CONFIG_USER_ONLY */
 
+static void accel_class_init(ObjectClass *oc, void *data)
+{
+#ifndef CONFIG_USER_ONLY
+    accel_softmmu_class_init(oc);
+#endif
+}
+
 static const TypeInfo accel_type = {
     .name = TYPE_ACCEL,
     .parent = TYPE_OBJECT,
     .class_size = sizeof(AccelClass),
+    .class_init = accel_class_init,
     .instance_size = sizeof(AccelState),
 };
 
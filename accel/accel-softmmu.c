@@ -27,6 +27,8 @@
 #include "qemu/accel.h"
 #include "hw/boards.h"
 #include "sysemu/cpus.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
 
 #include "accel-softmmu.h"
 
@@ -86,6 +88,72 @@ void accel_init_ops_interfaces(AccelClass *ac)
     cpus_register_accel(ops);
 }
 
+typedef struct HaltPollParamInfo {
+    const char *name;
+    ptrdiff_t offset; /* field's byte offset in AccelState struct */
+} HaltPollParamInfo;
+
+static HaltPollParamInfo halt_poll_max_ns_info = {
+    "halt-poll-max-ns", offsetof(AccelState, halt_poll_max_ns),
+};
+static HaltPollParamInfo halt_poll_grow_info = {
+    "halt-poll-grow", offsetof(AccelState, halt_poll_grow),
+};
+static HaltPollParamInfo halt_poll_shrink_info = {
+    "halt-poll-shrink", offsetof(AccelState, halt_poll_shrink),
+};
+
+static void accel_get_halt_poll_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    HaltPollParamInfo *info = opaque;
+    int64_t *field = (void *)obj + info->offset;
+
+    visit_type_int64(v, name, field, errp);
+}
+
+static void accel_set_halt_poll_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    HaltPollParamInfo *info = opaque;
+    int64_t *field = (void *)obj + info->offset;
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value < 0) {
+        error_setg(errp, "%s value must be in range [0, %" PRId64 "]",
+                   info->name, INT64_MAX);
+        return;
+    }
+
+    qatomic_set(field, value);
+}
+
+void accel_softmmu_class_init(ObjectClass *oc)
+{
+    object_class_property_add(oc, "halt-poll-max-ns", "int",
+                              accel_get_halt_poll_param,
+                              accel_set_halt_poll_param,
+                              NULL, &halt_poll_max_ns_info);
+    object_class_property_set_description(oc, "halt-poll-max-ns",
+        "Maximum time a halted vCPU busy waits for a wakeup, 0 to disable");
+    object_class_property_add(oc, "halt-poll-grow", "int",
+                              accel_get_halt_poll_param,
+                              accel_set_halt_poll_param,
+                              NULL, &halt_poll_grow_info);
+    object_class_property_set_description(oc, "halt-poll-grow",
+        "Multiplier for the halt polling time, 0 for the default");
+    object_class_property_add(oc, "halt-poll-shrink", "int",
+                              accel_get_halt_poll_param,
+                              accel_set_halt_poll_param,
+                              NULL, &halt_poll_shrink_info);
+    object_class_property_set_description(oc, "halt-poll-shrink",
+        "Divisor for the halt polling time, 0 to reset it instead");
+}
+
 static const TypeInfo accel_ops_type_info = {
     .name = TYPE_ACCEL_OPS,
     .parent = TYPE_OBJECT,
@@ -11,5 +11,6 @@
 #define ACCEL_SOFTMMU_H
 
 void accel_init_ops_interfaces(AccelClass *ac);
+void accel_softmmu_class_init(ObjectClass *oc);
 
 #endif /* ACCEL_SOFTMMU_H */
@@ -20,6 +20,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/cpus.h"
 #include "qemu/guest-random.h"
+#include "qemu/thread-placement.h"
 #include "qapi/error.h"
 
 #include "kvm-cpus.h"
@@ -72,6 +73,7 @@ static void kvm_start_vcpu_thread(CPUState *cpu)
              cpu->cpu_index);
     qemu_thread_create(cpu->thread, thread_name, kvm_vcpu_thread_fn,
                        cpu, QEMU_THREAD_JOINABLE);
+    qemu_thread_place(cpu->thread, THREAD_PLACEMENT_ROLE_VCPU);
 }
 
 static void kvm_accel_ops_class_init(ObjectClass *oc, void *data)
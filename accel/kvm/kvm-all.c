@@ -96,8 +96,14 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    uint32_t reap_interval;   /* current ms between two reaper passes */
+    uint32_t ring_full_count; /* ring full exits since last reaper pass */
+    uint32_t reap_max;        /* max GFNs of a ring since last reaper pass */
 };
 
+/* Lower bound of the adaptive reap interval, in ms */
+#define KVM_DIRTY_RING_REAP_INTERVAL_MIN 10
+
 struct KVMState
 {
     AccelState parent_obj;
@@ -136,6 +142,8 @@ struct KVMState
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
+    /* Dynamic MSI routes, least recently used first */
+    QTAILQ_HEAD(, KVMMSIRoute) msi_lru;
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
@@ -148,6 +156,8 @@ struct KVMState
     } *as;
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
+    uint32_t kvm_dirty_ring_reap_interval; /* Max ms between two reaps */
+    uint32_t kvm_dirty_log_threads; /* Threads fetching the dirty bitmaps */
     struct KVMDirtyRingReaper reaper;
 };
 
@@ -200,6 +210,16 @@ static QemuMutex kml_slots_lock;
 #define kvm_slots_lock()    qemu_mutex_lock(&kml_slots_lock)
 #define kvm_slots_unlock()  qemu_mutex_unlock(&kml_slots_lock)
 
+/*
+ * KVM cannot replace several memslots atomically.  While a transaction
+ * removes ranges that it adds back, vCPUs are kept out of KVM_RUN so that
+ * they do not see the ranges disappear.
+ */
+static bool kvm_memslots_updating;
+static int kvm_vcpus_in_run;
+static QemuEvent kvm_vcpus_out_event;
+static QemuEvent kvm_memslots_done_event;
+
 static void kvm_slot_init_dirty_bitmap(KVMSlot *mem);
 
 static inline void kvm_resample_fd_remove(int gsi)
@@ -674,7 +694,11 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     d.slot = slot->slot | (slot->as_id << 16);
     ret = kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d);
 
-    if (ret == -ENOENT) {
+    if (ret == 0) {
+        slot->dirty_pages += bitmap_count_one(slot->dirty_bmap,
+                                              slot->memory_size /
+                                              qemu_real_host_page_size);
+    } else if (ret == -ENOENT) {
         /* kernel does not have dirty bitmap in this slot */
         ret = 0;
     }
@@ -705,6 +729,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
     }
 
     set_bit(offset, mem->dirty_bmap);
+    mem->dirty_pages++;
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -743,6 +768,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
         count++;
     }
     cpu->kvm_fetch_index = fetch;
+    cpu->dirty_pages += count;
 
     return count;
 }
@@ -753,12 +779,21 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
     int ret;
     CPUState *cpu;
     uint64_t total = 0;
+    uint32_t max = 0;
     int64_t stamp;
 
     stamp = get_clock();
 
     CPU_FOREACH(cpu) {
-        total += kvm_dirty_ring_reap_one(s, cpu);
+        uint32_t count = kvm_dirty_ring_reap_one(s, cpu);
+
+        total += count;
+        max = MAX(max, count);
+    }
+
+    /* Let the reaper thread know how full the rings were */
+    if (max > qatomic_read(&s->reaper.reap_max)) {
+        qatomic_set(&s->reaper.reap_max, max);
     }
 
     if (total) {
@@ -885,13 +920,95 @@ static void kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
     }
 }
 
+typedef struct KVMDirtyLogJob {
+    KVMState *s;
+    KVMSlot **slots;
+    int nr_slots;
+    int next;           /* next slot to sync, taken atomically */
+} KVMDirtyLogJob;
+
+static void kvm_dirty_log_job_run(KVMDirtyLogJob *job)
+{
+    int i;
+
+    while ((i = qatomic_fetch_inc(&job->next)) < job->nr_slots) {
+        KVMSlot *mem = job->slots[i];
+
+        if (kvm_slot_get_dirty_log(job->s, mem)) {
+            kvm_slot_sync_dirty_pages(mem);
+        }
+    }
+}
+
+static void *kvm_dirty_log_thread(void *opaque)
+{
+    rcu_register_thread();
+    kvm_dirty_log_job_run(opaque);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * kvm_physical_sync_all_dirty_bitmaps - Sync the dirty bitmaps of all slots
+ *
+ * Fetching the bitmap of a large slot takes long, so the slots are shared
+ * out between up to KVMState.kvm_dirty_log_threads threads, the caller
+ * included.
+ *
+ * NOTE: caller must be with kml->slots_lock held.
+ */
+static void kvm_physical_sync_all_dirty_bitmaps(KVMMemoryListener *kml)
+{
+    KVMState *s = kvm_state;
+    g_autofree KVMSlot **slots = g_new(KVMSlot *, s->nr_slots);
+    g_autofree QemuThread *threads = NULL;
+    KVMDirtyLogJob job = { .s = s, .slots = slots };
+    int64_t start_ns = get_clock();
+    int i, nr_threads;
+
+    for (i = 0; i < s->nr_slots; i++) {
+        KVMSlot *mem = &kml->slots[i];
+
+        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+            slots[job.nr_slots++] = mem;
+        }
+    }
+
+    nr_threads = MIN(s->kvm_dirty_log_threads, job.nr_slots);
+    if (nr_threads > 1) {
+        threads = g_new(QemuThread, nr_threads - 1);
+        for (i = 0; i < nr_threads - 1; i++) {
+            qemu_thread_create(&threads[i], "kvm-dirty-log",
+                               kvm_dirty_log_thread, &job,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    kvm_dirty_log_job_run(&job);
+
+    for (i = 0; i < nr_threads - 1; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    trace_kvm_physical_sync_all_dirty_bitmaps(kml->as_id, job.nr_slots,
+                                              MAX(nr_threads, 1),
+                                              get_clock() - start_ns);
+}
+
 /* Alignment requirement for KVM_CLEAR_DIRTY_LOG - 64 pages */
 #define KVM_CLEAR_LOG_SHIFT  6
 #define KVM_CLEAR_LOG_ALIGN  (qemu_real_host_page_size << KVM_CLEAR_LOG_SHIFT)
 #define KVM_CLEAR_LOG_MASK   (-KVM_CLEAR_LOG_ALIGN)
 
-static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
-                                  uint64_t size)
+/*
+ * KVM_CLEAR_DIRTY_LOG write protects each page whose bit is set with the
+ * MMU lock held, so clearing many dirty pages at once stalls the faults of
+ * the vCPUs.  Ranges with more dirty pages than this are split.
+ */
+#define KVM_CLEAR_LOG_MAX_DIRTY  (16 * 1024)
+
+static int kvm_log_clear_range(KVMSlot *mem, int as_id, uint64_t start,
+                               uint64_t size)
 {
     KVMState *s = kvm_state;
     uint64_t end, bmap_start, start_delta, bmap_npages;
@@ -997,6 +1114,42 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
     return ret;
 }
 
+/*
+ * Clear a range with a single ioctl while the guest dirties little memory
+ * there, and in pieces of about KVM_CLEAR_LOG_MAX_DIRTY dirty pages while
+ * it is hot.
+ */
+static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
+                                  uint64_t size)
+{
+    uint64_t psize = qemu_real_host_page_size;
+    uint64_t dirty, chunk, len;
+    int ret = 0;
+
+    /* We should never do log_clear before log_sync */
+    assert(mem->dirty_bmap);
+    dirty = bitmap_count_one_with_offset(mem->dirty_bmap, start / psize,
+                                         size / psize);
+    if (dirty <= KVM_CLEAR_LOG_MAX_DIRTY) {
+        return kvm_log_clear_range(mem, as_id, start, size);
+    }
+
+    chunk = ROUND_UP(size / DIV_ROUND_UP(dirty, KVM_CLEAR_LOG_MAX_DIRTY),
+                     KVM_CLEAR_LOG_ALIGN);
+    trace_kvm_log_clear_split(mem->slot, start, size, dirty, chunk);
+
+    while (size && !ret) {
+        /* All pieces but the last end on an aligned page of the slot */
+        len = MIN(size, QEMU_ALIGN_DOWN(start + chunk, KVM_CLEAR_LOG_ALIGN) -
+                        start);
+        ret = kvm_log_clear_range(mem, as_id, start, len);
+        start += len;
+        size -= len;
+    }
+
+    return ret;
+}
+
 
 /**
  * kvm_physical_log_clear - Clear the kernel's dirty bitmap for range
@@ -1400,6 +1553,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             g_free(mem->dirty_bmap);
             mem->dirty_bmap = NULL;
             mem->memory_size = 0;
+            mem->dirty_pages = 0;
             mem->flags = 0;
             err = kvm_set_user_memory_region(kml, mem, false);
             if (err) {
@@ -1440,6 +1594,33 @@ out:
     kvm_slots_unlock();
 }
 
+/*
+ * Reap more often when the rings fill up between two passes of the
+ * reaper, so that the vCPUs don't have to exit to userspace and wait
+ * for the BQL to get their ring emptied, and less often when they stay
+ * mostly empty.  The interval never exceeds the configured one.
+ */
+static void kvm_dirty_ring_reaper_adapt(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint32_t full = qatomic_xchg(&r->ring_full_count, 0);
+    uint32_t max = qatomic_xchg(&r->reap_max, 0);
+    uint32_t min_interval = MIN(KVM_DIRTY_RING_REAP_INTERVAL_MIN,
+                                s->kvm_dirty_ring_reap_interval);
+    uint32_t interval = r->reap_interval;
+
+    if (full || max > s->kvm_dirty_ring_size / 2) {
+        interval = MAX(interval / 2, min_interval);
+    } else if (max < s->kvm_dirty_ring_size / 8) {
+        interval = MIN(interval * 2, s->kvm_dirty_ring_reap_interval);
+    }
+
+    if (interval != r->reap_interval) {
+        trace_kvm_dirty_ring_reaper_interval(interval, full, max);
+        r->reap_interval = interval;
+    }
+}
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
@@ -1452,10 +1633,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        g_usleep(r->reap_interval * 1000ULL);
 
         trace_kvm_dirty_ring_reaper("wakeup");
         r->reaper_state = KVM_DIRTY_RING_REAPER_REAPING;
@@ -1464,6 +1642,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
         kvm_dirty_ring_reap(s);
         qemu_mutex_unlock_iothread();
 
+        kvm_dirty_ring_reaper_adapt(s);
         r->reaper_iteration++;
     }
 
@@ -1478,6 +1657,7 @@ static int kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
 
+    r->reap_interval = s->kvm_dirty_ring_reap_interval;
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
@@ -1489,18 +1669,205 @@ static void kvm_region_add(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMMemoryUpdate *update = g_new0(KVMMemoryUpdate, 1);
 
     memory_region_ref(section->mr);
-    kvm_set_phys_mem(kml, section, true);
+    update->section = *section;
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_add, update, next);
 }
 
 static void kvm_region_del(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMMemoryUpdate *update = g_new0(KVMMemoryUpdate, 1);
+
+    update->section = *section;
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, update, next);
+}
+
+static void kvm_vcpu_run_begin(void)
+{
+    for (;;) {
+        qatomic_inc(&kvm_vcpus_in_run);
+        /* Pairs with the barrier in kvm_memslots_update_begin() */
+        smp_mb();
+        if (likely(!qatomic_read(&kvm_memslots_updating))) {
+            return;
+        }
+        if (qatomic_fetch_dec(&kvm_vcpus_in_run) == 1) {
+            qemu_event_set(&kvm_vcpus_out_event);
+        }
+        qemu_event_wait(&kvm_memslots_done_event);
+    }
+}
+
+static void kvm_vcpu_run_end(void)
+{
+    if (qatomic_fetch_dec(&kvm_vcpus_in_run) == 1 &&
+        qatomic_read(&kvm_memslots_updating)) {
+        qemu_event_set(&kvm_vcpus_out_event);
+    }
+}
+
+/* Kick all vCPUs out of KVM_RUN, and keep them out until the update ends */
+static void kvm_memslots_update_begin(void)
+{
+    CPUState *cpu;
+
+    qemu_event_reset(&kvm_memslots_done_event);
+    qatomic_set(&kvm_memslots_updating, true);
+    smp_mb();
+
+    CPU_FOREACH(cpu) {
+        if (cpu != current_cpu && cpu->created) {
+            qemu_cpu_kick(cpu);
+        }
+    }
+
+    for (;;) {
+        qemu_event_reset(&kvm_vcpus_out_event);
+        if (!qatomic_read(&kvm_vcpus_in_run)) {
+            break;
+        }
+        qemu_event_wait(&kvm_vcpus_out_event);
+    }
+}
+
+static void kvm_memslots_update_end(void)
+{
+    qatomic_set(&kvm_memslots_updating, false);
+    qemu_event_set(&kvm_memslots_done_event);
+}
+
+/*
+ * Return true if both sections are mapped by the same slots, so that
+ * removing one and adding the other would leave the slots unchanged.
+ */
+static bool kvm_section_same_slots(MemoryRegionSection *a,
+                                   MemoryRegionSection *b)
+{
+    hwaddr start_a, start_b, size, offset_a, offset_b;
+
+    if (!memory_region_is_ram(a->mr) || !memory_region_is_ram(b->mr) ||
+        kvm_mem_flags(a->mr) != kvm_mem_flags(b->mr)) {
+        return false;
+    }
+
+    size = kvm_align_section(a, &start_a);
+    if (!size || size != kvm_align_section(b, &start_b) ||
+        start_a != start_b) {
+        return false;
+    }
+
+    offset_a = a->offset_within_region + start_a -
+        a->offset_within_address_space;
+    offset_b = b->offset_within_region + start_b -
+        b->offset_within_address_space;
+    return memory_region_get_ram_ptr(a->mr) + offset_a ==
+               memory_region_get_ram_ptr(b->mr) + offset_b &&
+           memory_region_get_ram_addr(a->mr) + offset_a ==
+               memory_region_get_ram_addr(b->mr) + offset_b;
+}
+
+/* Whether kvm_set_phys_mem() has slots to change for the section */
+static bool kvm_section_has_slots(MemoryRegionSection *section)
+{
+    MemoryRegion *mr = section->mr;
+
+    return memory_region_is_ram(mr) ||
+           ((mr->readonly || mr->rom_device) && kvm_readonly_mem_allowed);
+}
+
+static bool kvm_sections_overlap(MemoryRegionSection *a,
+                                 MemoryRegionSection *b)
+{
+    Int128 end_a = int128_add(int128_make64(a->offset_within_address_space),
+                              a->size);
+    Int128 end_b = int128_add(int128_make64(b->offset_within_address_space),
+                              b->size);
 
-    kvm_set_phys_mem(kml, section, false);
-    memory_region_unref(section->mr);
+    return int128_lt(int128_make64(a->offset_within_address_space), end_b) &&
+           int128_lt(int128_make64(b->offset_within_address_space), end_a);
+}
+
+/*
+ * Apply all the section changes of a transaction at once.  Sections that
+ * are removed and added back with the same slots, as happens when the
+ * regions above them change, keep their slots untouched.  All removals
+ * are done before the additions, and if any range is removed and added
+ * back, vCPUs are kept out of the guest meanwhile.
+ */
+static void kvm_region_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
+                                          listener);
+    KVMMemoryUpdate *del, *add, *next_del, *next_add;
+    int64_t start_ns = get_clock();
+    int dels = 0, adds = 0, kept = 0;
+    bool inhibit = false;
+
+    if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
+        QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        return;
+    }
+
+    QSIMPLEQ_FOREACH_SAFE(del, &kml->transaction_del, next, next_del) {
+        QSIMPLEQ_FOREACH_SAFE(add, &kml->transaction_add, next, next_add) {
+            if (kvm_section_same_slots(&del->section, &add->section)) {
+                QSIMPLEQ_REMOVE(&kml->transaction_del, del,
+                                KVMMemoryUpdate, next);
+                QSIMPLEQ_REMOVE(&kml->transaction_add, add,
+                                KVMMemoryUpdate, next);
+                memory_region_unref(del->section.mr);
+                g_free(del);
+                g_free(add);
+                kept++;
+                break;
+            }
+        }
+    }
+
+    QSIMPLEQ_FOREACH(del, &kml->transaction_del, next) {
+        if (!kvm_section_has_slots(&del->section)) {
+            continue;
+        }
+        QSIMPLEQ_FOREACH(add, &kml->transaction_add, next) {
+            if (kvm_section_has_slots(&add->section) &&
+                kvm_sections_overlap(&del->section, &add->section)) {
+                inhibit = true;
+                break;
+            }
+        }
+    }
+
+    if (inhibit) {
+        kvm_memslots_update_begin();
+    }
+
+    while (!QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        del = QSIMPLEQ_FIRST(&kml->transaction_del);
+        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_del, next);
+        kvm_set_phys_mem(kml, &del->section, false);
+        memory_region_unref(del->section.mr);
+        g_free(del);
+        dels++;
+    }
+
+    while (!QSIMPLEQ_EMPTY(&kml->transaction_add)) {
+        add = QSIMPLEQ_FIRST(&kml->transaction_add);
+        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_add, next);
+        kvm_set_phys_mem(kml, &add->section, true);
+        g_free(add);
+        adds++;
+    }
+
+    if (inhibit) {
+        kvm_memslots_update_end();
+    }
+
+    trace_kvm_region_commit(kml->as_id, dels, adds, kept, inhibit,
+                            get_clock() - start_ns);
 }
 
 static void kvm_log_sync(MemoryListener *listener,
@@ -1513,6 +1880,16 @@ static void kvm_log_sync(MemoryListener *listener,
     kvm_slots_unlock();
 }
 
+static void kvm_log_sync_all(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
+                                          listener);
+
+    kvm_slots_lock();
+    kvm_physical_sync_all_dirty_bitmaps(kml);
+    kvm_slots_unlock();
+}
+
 static void kvm_log_sync_global(MemoryListener *l)
 {
     KVMMemoryListener *kml = container_of(l, KVMMemoryListener, listener);
@@ -1644,8 +2021,12 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
         kml->slots[i].slot = i;
     }
 
+    QSIMPLEQ_INIT(&kml->transaction_add);
+    QSIMPLEQ_INIT(&kml->transaction_del);
+
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
+    kml->listener.commit = kvm_region_commit;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
     kml->listener.priority = 10;
@@ -1654,6 +2035,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
         kml->listener.log_sync_global = kvm_log_sync_global;
     } else {
         kml->listener.log_sync = kvm_log_sync;
+        kml->listener.log_sync_global = kvm_log_sync_all;
         kml->listener.log_clear = kvm_log_clear;
     }
 
@@ -1696,6 +2078,7 @@ int kvm_set_irq(KVMState *s, int irq, int level)
 typedef struct KVMMSIRoute {
     struct kvm_irq_routing_entry kroute;
     QTAILQ_ENTRY(KVMMSIRoute) entry;
+    QTAILQ_ENTRY(KVMMSIRoute) lru;
 } KVMMSIRoute;
 
 static void set_gsi(KVMState *s, unsigned int gsi)
@@ -1726,6 +2109,7 @@ void kvm_init_irq_routing(KVMState *s)
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
             QTAILQ_INIT(&s->msi_hashtab[i]);
         }
+        QTAILQ_INIT(&s->msi_lru);
     }
 
     kvm_arch_init_irq_routing(s);
@@ -1854,18 +2238,32 @@ static unsigned int kvm_hash_msi(uint32_t data)
     return data & 0xff;
 }
 
-static void kvm_flush_dynamic_msi_routes(KVMState *s)
+static void kvm_unlink_msi_route(KVMState *s, KVMMSIRoute *route)
 {
-    KVMMSIRoute *route, *next;
-    unsigned int hash;
+    unsigned int hash = kvm_hash_msi(cpu_to_le32(route->kroute.u.msi.data));
 
-    for (hash = 0; hash < KVM_MSI_HASHTAB_SIZE; hash++) {
-        QTAILQ_FOREACH_SAFE(route, &s->msi_hashtab[hash], entry, next) {
-            kvm_irqchip_release_virq(s, route->kroute.gsi);
-            QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
-            g_free(route);
-        }
+    QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
+    QTAILQ_REMOVE(&s->msi_lru, route, lru);
+}
+
+/*
+ * Free the route entry of the least recently used dynamic MSI route.
+ * Routes that are still being hit stay cached, so a guest with more
+ * vectors than route entries does not rebuild the whole cache every
+ * time the table fills up.
+ */
+static void kvm_evict_dynamic_msi_route(KVMState *s)
+{
+    KVMMSIRoute *route = QTAILQ_FIRST(&s->msi_lru);
+
+    if (!route) {
+        return;
     }
+
+    trace_kvm_irqchip_evict_msi_route(route->kroute.gsi);
+    kvm_unlink_msi_route(s, route);
+    kvm_irqchip_release_virq(s, route->kroute.gsi);
+    g_free(route);
 }
 
 static int kvm_irqchip_get_virq(KVMState *s)
@@ -1876,10 +2274,10 @@ static int kvm_irqchip_get_virq(KVMState *s)
      * PIC and IOAPIC share the first 16 GSI numbers, thus the available
      * GSI numbers are more than the number of IRQ route. Allocating a GSI
      * number can succeed even though a new route entry cannot be added.
-     * When this happens, flush dynamic MSI entries to free IRQ route entries.
+     * When this happens, evict a dynamic MSI entry to free an IRQ route entry.
      */
     if (!kvm_direct_msi_allowed && s->irq_routes->nr == s->gsi_count) {
-        kvm_flush_dynamic_msi_routes(s);
+        kvm_evict_dynamic_msi_route(s);
     }
 
     /* Return the lowest unused GSI in the bitmap */
@@ -1922,7 +2320,32 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
     }
 
     route = kvm_lookup_msi_route(s, msg);
-    if (!route) {
+    if (route) {
+        if (route != QTAILQ_LAST(&s->msi_lru)) {
+            QTAILQ_REMOVE(&s->msi_lru, route, lru);
+            QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
+        }
+    } else if (s->irq_routes->nr == s->gsi_count &&
+               !QTAILQ_EMPTY(&s->msi_lru)) {
+        /*
+         * The routing table is full: retarget the least recently used
+         * route in place instead of releasing it and allocating a new
+         * GSI, so that only one routing table update is needed.
+         */
+        route = QTAILQ_FIRST(&s->msi_lru);
+        trace_kvm_irqchip_evict_msi_route(route->kroute.gsi);
+        kvm_unlink_msi_route(s, route);
+
+        route->kroute.u.msi.address_lo = (uint32_t)msg.address;
+        route->kroute.u.msi.address_hi = msg.address >> 32;
+        route->kroute.u.msi.data = le32_to_cpu(msg.data);
+        kvm_update_routing_entry(s, &route->kroute);
+        kvm_irqchip_commit_routes(s);
+
+        QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
+                           entry);
+        QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
+    } else {
         int virq;
 
         virq = kvm_irqchip_get_virq(s);
@@ -1943,6 +2366,7 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
 
         QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
                            entry);
+        QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
     }
 
     assert(route->kroute.type == KVM_IRQ_ROUTING_MSI);
@@ -2315,6 +2739,8 @@ static int kvm_init(MachineState *ms)
     uint64_t dirty_log_manual_caps;
 
     qemu_mutex_init(&kml_slots_lock);
+    qemu_event_init(&kvm_vcpus_out_event, false);
+    qemu_event_init(&kvm_memslots_done_event, false);
 
     s = KVM_STATE(ms->accelerator);
 
@@ -2834,7 +3260,9 @@ int kvm_cpu_exec(CPUState *cpu)
          */
         smp_rmb();
 
+        kvm_vcpu_run_begin();
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
+        kvm_vcpu_run_end();
 
         attrs = kvm_arch_post_run(cpu, run);
 
@@ -2914,6 +3342,7 @@ int kvm_cpu_exec(CPUState *cpu)
              * still full.  Got kicked by KVM_RESET_DIRTY_RINGS.
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qatomic_inc(&kvm_state->reaper.ring_full_count);
             qemu_mutex_lock_iothread();
             kvm_dirty_ring_reap(kvm_state);
             qemu_mutex_unlock_iothread();
@@ -3089,6 +3518,34 @@ bool kvm_has_sync_mmu(void)
     return kvm_state->sync_mmu;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state->kvm_dirty_ring_size != 0;
+}
+
+void kvm_dirty_page_counts(KVMDirtyPageCountFn *fn, void *opaque)
+{
+    KVMState *s = kvm_state;
+    int i, j;
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_as; i++) {
+        KVMMemoryListener *kml = s->as[i].ml;
+
+        if (!kml) {
+            continue;
+        }
+        for (j = 0; j < s->nr_slots; j++) {
+            KVMSlot *mem = &kml->slots[j];
+
+            if (mem->memory_size) {
+                fn(mem->ram, mem->memory_size, mem->dirty_pages, opaque);
+            }
+        }
+    }
+    kvm_slots_unlock();
+}
+
 int kvm_has_vcpu_events(void)
 {
     return kvm_state->vcpu_events;
@@ -3597,6 +4054,78 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reap_interval(Object *obj, Visitor *v,
+                                             const char *name, void *opaque,
+                                             Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reap_interval;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reap_interval(Object *obj, Visitor *v,
+                                             const char *name, void *opaque,
+                                             Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "dirty-ring-reap-interval must be positive.");
+        return;
+    }
+
+    s->kvm_dirty_ring_reap_interval = value;
+}
+
+static void kvm_get_dirty_log_threads(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_log_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_log_threads(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "dirty-log-threads must be positive.");
+        return;
+    }
+
+    s->kvm_dirty_log_threads = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3608,6 +4137,8 @@ static void kvm_accel_instance_init(Object *obj)
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
+    s->kvm_dirty_ring_reap_interval = 1000;
+    s->kvm_dirty_log_threads = 4;
 }
 
 static void kvm_accel_class_init(ObjectClass *oc, void *data)
@@ -3635,6 +4166,20 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
+
+    object_class_property_add(oc, "dirty-ring-reap-interval", "uint32",
+        kvm_get_dirty_ring_reap_interval, kvm_set_dirty_ring_reap_interval,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reap-interval",
+        "Maximum interval in ms between two collections of the KVM dirty "
+        "rings (default: 1000)");
+
+    object_class_property_add(oc, "dirty-log-threads", "uint32",
+        kvm_get_dirty_log_threads, kvm_set_dirty_log_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-log-threads",
+        "Number of threads fetching the KVM dirty bitmaps of the memory "
+        "slots (default: 4)");
 }
 
 static const TypeInfo kvm_accel_type = {
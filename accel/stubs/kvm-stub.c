@@ -44,6 +44,15 @@ bool kvm_has_sync_mmu(void)
     return false;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
+void kvm_dirty_page_counts(KVMDirtyPageCountFn *fn, void *opaque)
+{
+}
+
 int kvm_has_many_ioeventfds(void)
 {
     return 0;
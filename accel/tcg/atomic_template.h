@@ -60,6 +60,36 @@
 # define ABI_TYPE  uint32_t
 #endif
 
+/*
+ * atomic_mmu_lookup lets misaligned 2 and 4 byte accesses through if they
+ * fit in an aligned 64-bit word.  Emulate them with a cmpxchg loop on that
+ * word: OLD is set to the current value, in memory byte order, and EXPR
+ * computes the value to store from it.
+ */
+#if (DATA_SIZE == 2 || DATA_SIZE == 4) && defined(CONFIG_ATOMIC64)
+# define ATOMIC_UNALIGNED(HADDR) \
+    unlikely((uintptr_t)(HADDR) & (DATA_SIZE - 1))
+# define ATOMIC_WIDE_RMW(HADDR, OLD, EXPR)                          \
+    do {                                                            \
+        uint64_t *wptr_ = (uint64_t *)((uintptr_t)(HADDR) & ~7);    \
+        int sh_ = atomic_widen_shift(HADDR, DATA_SIZE);             \
+        uint64_t mask_ = MAKE_64BIT_MASK(sh_, DATA_SIZE * 8);       \
+        uint64_t wold_, wnew_, wcmp_;                               \
+        smp_mb();                                                   \
+        wcmp_ = qatomic_read__nocheck(wptr_);                       \
+        do {                                                        \
+            wold_ = wcmp_;                                          \
+            OLD = (DATA_TYPE)(wold_ >> sh_);                        \
+            wnew_ = (uint64_t)(DATA_TYPE)(EXPR) << sh_;             \
+            wnew_ |= wold_ & ~mask_;                                \
+            wcmp_ = qatomic_cmpxchg__nocheck(wptr_, wold_, wnew_);  \
+        } while (wcmp_ != wold_);                                   \
+    } while (0)
+#else
+# define ATOMIC_UNALIGNED(HADDR)  false
+# define ATOMIC_WIDE_RMW(HADDR, OLD, EXPR)  g_assert_not_reached()
+#endif
+
 /* Define host-endian atomic operations.  Note that END is used within
    the ATOMIC_NAME macro, and redefined below.  */
 #if DATA_SIZE == 1
@@ -80,11 +110,15 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_rmw_pre(env, addr, info);
+    if (ATOMIC_UNALIGNED(haddr)) {
+        ATOMIC_WIDE_RMW(haddr, ret, ret == cmpv ? newv : ret);
+    } else {
 #if DATA_SIZE == 16
-    ret = atomic16_cmpxchg(haddr, cmpv, newv);
+        ret = atomic16_cmpxchg(haddr, cmpv, newv);
 #else
-    ret = qatomic_cmpxchg__nocheck(haddr, cmpv, newv);
+        ret = qatomic_cmpxchg__nocheck(haddr, cmpv, newv);
 #endif
+    }
     ATOMIC_MMU_CLEANUP;
     atomic_trace_rmw_post(env, addr, info);
     return ret;
@@ -131,13 +165,18 @@ ABI_TYPE ATOMIC_NAME(xchg)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_rmw_pre(env, addr, info);
-    ret = qatomic_xchg__nocheck(haddr, val);
+    if (ATOMIC_UNALIGNED(haddr)) {
+        ATOMIC_WIDE_RMW(haddr, ret, val);
+    } else {
+        ret = qatomic_xchg__nocheck(haddr, val);
+    }
     ATOMIC_MMU_CLEANUP;
     atomic_trace_rmw_post(env, addr, info);
     return ret;
 }
 
-#define GEN_ATOMIC_HELPER(X)                                        \
+/* FN and NEW are only used for the widened misaligned case.  */
+#define GEN_ATOMIC_HELPER(X, FN, NEW)                               \
 ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,       \
                         ABI_TYPE val EXTRA_ARGS)                    \
 {                                                                   \
@@ -147,20 +186,35 @@ ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,       \
     uint16_t info = trace_mem_build_info(SHIFT, false, 0, false,    \
                                          ATOMIC_MMU_IDX);           \
     atomic_trace_rmw_pre(env, addr, info);                          \
-    ret = qatomic_##X(haddr, val);                                  \
+    if (ATOMIC_UNALIGNED(haddr)) {                                  \
+        ATOMIC_WIDE_RMW(haddr, ret, FN(ret, val));                  \
+        if (NEW) {                                                  \
+            ret = FN(ret, val);                                     \
+        }                                                           \
+    } else {                                                        \
+        ret = qatomic_##X(haddr, val);                              \
+    }                                                               \
     ATOMIC_MMU_CLEANUP;                                             \
     atomic_trace_rmw_post(env, addr, info);                         \
     return ret;                                                     \
 }
 
-GEN_ATOMIC_HELPER(fetch_add)
-GEN_ATOMIC_HELPER(fetch_and)
-GEN_ATOMIC_HELPER(fetch_or)
-GEN_ATOMIC_HELPER(fetch_xor)
-GEN_ATOMIC_HELPER(add_fetch)
-GEN_ATOMIC_HELPER(and_fetch)
-GEN_ATOMIC_HELPER(or_fetch)
-GEN_ATOMIC_HELPER(xor_fetch)
+#define ADD(X, Y)   (X + Y)
+#define AND(X, Y)   (X & Y)
+#define OR(X, Y)    (X | Y)
+#define XOR(X, Y)   (X ^ Y)
+GEN_ATOMIC_HELPER(fetch_add, ADD, false)
+GEN_ATOMIC_HELPER(fetch_and, AND, false)
+GEN_ATOMIC_HELPER(fetch_or, OR, false)
+GEN_ATOMIC_HELPER(fetch_xor, XOR, false)
+GEN_ATOMIC_HELPER(add_fetch, ADD, true)
+GEN_ATOMIC_HELPER(and_fetch, AND, true)
+GEN_ATOMIC_HELPER(or_fetch, OR, true)
+GEN_ATOMIC_HELPER(xor_fetch, XOR, true)
+#undef ADD
+#undef AND
+#undef OR
+#undef XOR
 
 #undef GEN_ATOMIC_HELPER
 
@@ -181,12 +235,17 @@ ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,       \
     uint16_t info = trace_mem_build_info(SHIFT, false, 0, false,    \
                                          ATOMIC_MMU_IDX);           \
     atomic_trace_rmw_pre(env, addr, info);                          \
-    smp_mb();                                                       \
-    cmp = qatomic_read__nocheck(haddr);                             \
-    do {                                                            \
-        old = cmp; new = FN(old, val);                              \
-        cmp = qatomic_cmpxchg__nocheck(haddr, old, new);            \
-    } while (cmp != old);                                           \
+    if (ATOMIC_UNALIGNED(haddr)) {                                  \
+        ATOMIC_WIDE_RMW(haddr, old, FN(old, val));                  \
+        new = FN(old, val);                                         \
+    } else {                                                        \
+        smp_mb();                                                   \
+        cmp = qatomic_read__nocheck(haddr);                         \
+        do {                                                        \
+            old = cmp; new = FN(old, val);                          \
+            cmp = qatomic_cmpxchg__nocheck(haddr, old, new);        \
+        } while (cmp != old);                                       \
+    }                                                               \
     ATOMIC_MMU_CLEANUP;                                             \
     atomic_trace_rmw_post(env, addr, info);                         \
     return RET;                                                     \
@@ -227,11 +286,16 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_rmw_pre(env, addr, info);
+    if (ATOMIC_UNALIGNED(haddr)) {
+        ATOMIC_WIDE_RMW(haddr, ret,
+                        ret == BSWAP(cmpv) ? (DATA_TYPE)BSWAP(newv) : ret);
+    } else {
 #if DATA_SIZE == 16
-    ret = atomic16_cmpxchg(haddr, BSWAP(cmpv), BSWAP(newv));
+        ret = atomic16_cmpxchg(haddr, BSWAP(cmpv), BSWAP(newv));
 #else
-    ret = qatomic_cmpxchg__nocheck(haddr, BSWAP(cmpv), BSWAP(newv));
+        ret = qatomic_cmpxchg__nocheck(haddr, BSWAP(cmpv), BSWAP(newv));
 #endif
+    }
     ATOMIC_MMU_CLEANUP;
     atomic_trace_rmw_post(env, addr, info);
     return BSWAP(ret);
@@ -280,13 +344,18 @@ ABI_TYPE ATOMIC_NAME(xchg)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_rmw_pre(env, addr, info);
-    ret = qatomic_xchg__nocheck(haddr, BSWAP(val));
+    if (ATOMIC_UNALIGNED(haddr)) {
+        ATOMIC_WIDE_RMW(haddr, ret, BSWAP(val));
+    } else {
+        ret = qatomic_xchg__nocheck(haddr, BSWAP(val));
+    }
     ATOMIC_MMU_CLEANUP;
     atomic_trace_rmw_post(env, addr, info);
     return BSWAP(ret);
 }
 
-#define GEN_ATOMIC_HELPER(X)                                        \
+/* FN and NEW are only used for the widened misaligned case.  */
+#define GEN_ATOMIC_HELPER(X, FN, NEW)                               \
 ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,       \
                         ABI_TYPE val EXTRA_ARGS)                    \
 {                                                                   \
@@ -296,18 +365,31 @@ ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,       \
     uint16_t info = trace_mem_build_info(SHIFT, false, MO_BSWAP,    \
                                          false, ATOMIC_MMU_IDX);    \
     atomic_trace_rmw_pre(env, addr, info);                          \
-    ret = qatomic_##X(haddr, BSWAP(val));                           \
+    if (ATOMIC_UNALIGNED(haddr)) {                                  \
+        ATOMIC_WIDE_RMW(haddr, ret, FN(ret, BSWAP(val)));           \
+        if (NEW) {                                                  \
+            ret = FN(ret, BSWAP(val));                              \
+        }                                                           \
+    } else {                                                        \
+        ret = qatomic_##X(haddr, BSWAP(val));                       \
+    }                                                               \
     ATOMIC_MMU_CLEANUP;                                             \
     atomic_trace_rmw_post(env, addr, info);                         \
     return BSWAP(ret);                                              \
 }
 
-GEN_ATOMIC_HELPER(fetch_and)
-GEN_ATOMIC_HELPER(fetch_or)
-GEN_ATOMIC_HELPER(fetch_xor)
-GEN_ATOMIC_HELPER(and_fetch)
-GEN_ATOMIC_HELPER(or_fetch)
-GEN_ATOMIC_HELPER(xor_fetch)
+#define AND(X, Y)   (X & Y)
+#define OR(X, Y)    (X | Y)
+#define XOR(X, Y)   (X ^ Y)
+GEN_ATOMIC_HELPER(fetch_and, AND, false)
+GEN_ATOMIC_HELPER(fetch_or, OR, false)
+GEN_ATOMIC_HELPER(fetch_xor, XOR, false)
+GEN_ATOMIC_HELPER(and_fetch, AND, true)
+GEN_ATOMIC_HELPER(or_fetch, OR, true)
+GEN_ATOMIC_HELPER(xor_fetch, XOR, true)
+#undef AND
+#undef OR
+#undef XOR
 
 #undef GEN_ATOMIC_HELPER
 
@@ -328,12 +410,18 @@ ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,       \
     uint16_t info = trace_mem_build_info(SHIFT, false, MO_BSWAP,    \
                                          false, ATOMIC_MMU_IDX);    \
     atomic_trace_rmw_pre(env, addr, info);                          \
-    smp_mb();                                                       \
-    ldn = qatomic_read__nocheck(haddr);                             \
-    do {                                                            \
-        ldo = ldn; old = BSWAP(ldo); new = FN(old, val);            \
-        ldn = qatomic_cmpxchg__nocheck(haddr, ldo, BSWAP(new));     \
-    } while (ldo != ldn);                                           \
+    if (ATOMIC_UNALIGNED(haddr)) {                                  \
+        ATOMIC_WIDE_RMW(haddr, ldo,                                 \
+                        BSWAP(FN((XDATA_TYPE)BSWAP(ldo), val)));    \
+        old = BSWAP(ldo); new = FN(old, val);                       \
+    } else {                                                        \
+        smp_mb();                                                   \
+        ldn = qatomic_read__nocheck(haddr);                         \
+        do {                                                        \
+            ldo = ldn; old = BSWAP(ldo); new = FN(old, val);        \
+            ldn = qatomic_cmpxchg__nocheck(haddr, ldo, BSWAP(new)); \
+        } while (ldo != ldn);                                       \
+    }                                                               \
     ATOMIC_MMU_CLEANUP;                                             \
     atomic_trace_rmw_post(env, addr, info);                         \
     return RET;                                                     \
@@ -362,6 +450,8 @@ GEN_ATOMIC_HELPER_FN(add_fetch, ADD, DATA_TYPE, new)
 #undef END
 #endif /* DATA_SIZE > 1 */
 
+#undef ATOMIC_UNALIGNED
+#undef ATOMIC_WIDE_RMW
 #undef BSWAP
 #undef ABI_TYPE
 #undef DATA_TYPE
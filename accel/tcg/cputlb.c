@@ -28,6 +28,7 @@
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
+#include "sysemu/stats.h"
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
@@ -235,6 +236,8 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
+    memset(desc->large_pages, 0, sizeof(desc->large_pages));
+    desc->lpindex = 0;
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
@@ -303,23 +306,171 @@ void tlb_destroy(CPUState *cpu)
     }
 }
 
-/* flush_all_helper: run fn across all cpus
+typedef CPUTLBPendingRange TLBFlushRangeData;
+
+static void tlb_flush_by_mmuidx_async_work(CPUState *cpu,
+                                           run_on_cpu_data data);
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d);
+
+/*
+ * Flushes of another vCPU's TLB are not queued as one work item each.
+ * They are merged into the pending flushes of the target vCPU, which
+ * runs all of them from a single work item.  Guests that invalidate
+ * every page they unmap on every vCPU would otherwise queue, and
+ * allocate, one item per page and per vCPU.
+ */
+static void tlb_flush_pending_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+    CPUTLBPending p;
+    unsigned int i;
+
+    qemu_spin_lock(&c->lock);
+    p = c->pending;
+    c->pending.queued = false;
+    c->pending.full_idxmap = 0;
+    c->pending.nr_ranges = 0;
+    qemu_spin_unlock(&c->lock);
+
+    if (p.full_idxmap) {
+        tlb_flush_by_mmuidx_async_work(cpu,
+                                       RUN_ON_CPU_HOST_INT(p.full_idxmap));
+    }
+    for (i = 0; i < p.nr_ranges; i++) {
+        TLBFlushRangeData d = p.range[i];
+
+        d.idxmap &= ~p.full_idxmap;
+        if (d.idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, d);
+        }
+    }
+}
+
+static void tlb_pending_add_range(CPUTLBPending *p,
+                                  const TLBFlushRangeData *r)
+{
+    target_ulong end = r->addr + r->len;
+    unsigned int i;
+
+    /* Merge with an overlapping or adjacent range of the same kind */
+    for (i = 0; end > r->addr && i < p->nr_ranges; i++) {
+        CPUTLBPendingRange *e = &p->range[i];
+        target_ulong e_end = e->addr + e->len;
+
+        if (e->idxmap == r->idxmap && e->bits == r->bits &&
+            e_end > e->addr && r->addr <= e_end && e->addr <= end) {
+            target_ulong addr = MIN(e->addr, r->addr);
+
+            e->len = MAX(e_end, end) - addr;
+            e->addr = addr;
+            return;
+        }
+    }
+
+    if (p->nr_ranges < CPU_TLB_PENDING_RANGES) {
+        p->range[p->nr_ranges++] = *r;
+        return;
+    }
+
+    /* Too many disjoint ranges, flush their mmu_idx completely */
+    p->full_idxmap |= r->idxmap;
+    for (i = 0; i < p->nr_ranges; i++) {
+        p->full_idxmap |= p->range[i].idxmap;
+    }
+    p->nr_ranges = 0;
+}
+
+/*
+ * Queue on @cpu a flush of the mmu_idx in @full_idxmap, and of @range
+ * if not NULL.
+ */
+static void tlb_queue_flush(CPUState *cpu, uint16_t full_idxmap,
+                            const TLBFlushRangeData *range)
+{
+    CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+    CPUTLBPending *p = &c->pending;
+    bool queued;
+
+    qemu_spin_lock(&c->lock);
+    p->full_idxmap |= full_idxmap;
+    if (range && (range->idxmap & ~p->full_idxmap)) {
+        tlb_pending_add_range(p, range);
+    }
+    queued = p->queued;
+    p->queued = true;
+    qemu_spin_unlock(&c->lock);
+
+    if (queued) {
+        qatomic_set(&c->batched_flush_count, c->batched_flush_count + 1);
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_pending_work, RUN_ON_CPU_NULL);
+    }
+}
+
+/*
+ * flush_all_helper: queue a flush on all cpus but @src
  *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
+ * Returns true if there is any such cpu.
  */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
+static bool flush_all_helper(CPUState *src, uint16_t full_idxmap,
+                             const TLBFlushRangeData *range)
 {
     CPUState *cpu;
+    bool queued = false;
 
     CPU_FOREACH(cpu) {
         if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
+            tlb_queue_flush(cpu, full_idxmap, range);
+            queued = true;
         }
     }
+    return queued;
+}
+
+/*
+ * Run @fn on @src for one of the *_all_cpus_synced() functions.
+ *
+ * Usually @fn is queued as "safe" work and the loop exited, creating a
+ * synchronisation point where all queued work will be finished before
+ * execution starts again.  Targets that only need the flushes to be
+ * complete at their next barrier flush @src now, and leave that
+ * synchronisation point to tlb_flush_sync().  A stream of broadcast
+ * invalidations then costs a single exclusive section.
+ */
+static void flush_synced_src(CPUState *src, bool remote, run_on_cpu_func fn,
+                             run_on_cpu_data d)
+{
+    if (CPU_GET_CLASS(src)->tcg_ops->tlb_sync_at_barrier) {
+        fn(src, d);
+        if (remote) {
+            env_tlb((CPUArchState *)src->env_ptr)->c.sync_pending = true;
+        }
+    } else {
+        async_safe_run_on_cpu(src, fn, d);
+    }
+}
+
+static void tlb_flush_sync_work(CPUState *cpu, run_on_cpu_data data)
+{
+    /* Nothing to do, being run in an exclusive section is enough */
+}
+
+void tlb_flush_sync(CPUState *cpu, uintptr_t retaddr)
+{
+    CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+
+    if (!c->sync_pending) {
+        return;
+    }
+
+    /*
+     * Restart the barrier once all vCPUs have left their TBs, and thus
+     * will run the pending flushes before they execute more code.
+     */
+    c->sync_pending = false;
+    async_safe_run_on_cpu(cpu, tlb_flush_sync_work, RUN_ON_CPU_NULL);
+    cpu_loop_exit_restore(cpu, retaddr);
 }
 
 void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
@@ -339,6 +490,54 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+static const StatsDescriptor tlb_stats[] = {
+    { "full-flushes", STATS_TYPE_CUMULATIVE },
+    { "part-flushes", STATS_TYPE_CUMULATIVE },
+    { "elided-flushes", STATS_TYPE_CUMULATIVE },
+    { "batched-flushes", STATS_TYPE_CUMULATIVE },
+};
+
+static void tlb_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *targets, strList *names, Error **errp)
+{
+    CPUState *cpu;
+
+    if (target != STATS_TARGET_VCPU) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+        g_autofree char *path = object_get_canonical_path(OBJECT(cpu));
+        StatsList *stats = NULL;
+
+        if (!apply_str_list_filter(path, targets)) {
+            continue;
+        }
+        stats_add_value(&stats, names, "full-flushes",
+                        qatomic_read(&c->full_flush_count));
+        stats_add_value(&stats, names, "part-flushes",
+                        qatomic_read(&c->part_flush_count));
+        stats_add_value(&stats, names, "elided-flushes",
+                        qatomic_read(&c->elide_flush_count));
+        stats_add_value(&stats, names, "batched-flushes",
+                        qatomic_read(&c->batched_flush_count));
+        stats_add_result(result, STATS_PROVIDER_TCG, path, stats);
+    }
+}
+
+static void tlb_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    stats_add_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU,
+                     tlb_stats, ARRAY_SIZE(tlb_stats));
+}
+
+void tlb_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_TCG, tlb_stats_cb,
+                        tlb_stats_schemas_cb);
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -385,8 +584,7 @@ void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
 
     if (cpu->created && !qemu_cpu_is_self(cpu)) {
-        async_run_on_cpu(cpu, tlb_flush_by_mmuidx_async_work,
-                         RUN_ON_CPU_HOST_INT(idxmap));
+        tlb_queue_flush(cpu, idxmap, NULL);
     } else {
         tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(idxmap));
     }
@@ -403,7 +601,7 @@ void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    flush_all_helper(src_cpu, idxmap, NULL);
     fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -416,10 +614,12 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 {
     const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
 
+    bool remote;
+
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    remote = flush_all_helper(src_cpu, idxmap, NULL);
+    flush_synced_src(src_cpu, remote, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -493,6 +693,61 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+/*
+ * Flush all target pages of the large page @lp, comparing addresses under
+ * @mask.  Returns false, without flushing anything, if @lp has more target
+ * pages than the tlb has entries: flushing the whole tlb is cheaper then.
+ */
+static bool tlb_flush_large_page_locked(CPUArchState *env, int midx,
+                                        CPUTLBLargePage *lp, target_ulong mask)
+{
+    size_t n_entries = tlb_n_entries(&env_tlb(env)->f[midx]);
+    target_ulong i;
+
+    if ((lp->size >> TARGET_PAGE_BITS) > n_entries) {
+        return false;
+    }
+
+    for (i = 0; i < lp->size; i += TARGET_PAGE_SIZE) {
+        target_ulong page = lp->vaddr + i;
+
+        if (tlb_flush_entry_mask_locked(tlb_entry(env, midx, page),
+                                        page, mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+        tlb_flush_vtlb_page_mask_locked(env, midx, page, mask);
+    }
+    lp->size = 0;
+    return true;
+}
+
+/*
+ * Flush the recorded large pages that overlap [addr, addr + len) under
+ * @mask.  Returns false if the whole tlb must be flushed instead.
+ */
+static bool tlb_flush_large_pages_locked(CPUArchState *env, int midx,
+                                         target_ulong addr, target_ulong len,
+                                         target_ulong mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    target_ulong first = addr & mask;
+    target_ulong last = (addr + len - 1) & mask;
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &d->large_pages[i];
+
+        if (lp->size &&
+            (lp->vaddr & mask) <= last &&
+            first <= ((lp->vaddr + lp->size - 1) & mask)) {
+            if (!tlb_flush_large_page_locked(env, midx, lp, mask)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
@@ -500,7 +755,8 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
     target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
 
     /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
+    if ((page & lp_mask) == lp_addr ||
+        !tlb_flush_large_pages_locked(env, midx, page, TARGET_PAGE_SIZE, -1)) {
         tlb_debug("forcing full flush midx %d ("
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   midx, lp_addr, lp_mask);
@@ -597,22 +853,12 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
+        TLBFlushRangeData d = {
+            addr, TARGET_PAGE_SIZE, idxmap, TARGET_LONG_BITS
+        };
 
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_queue_flush(cpu, 0, &d);
     }
 }
 
@@ -624,34 +870,18 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
                                        uint16_t idxmap)
 {
+    TLBFlushRangeData d;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-    }
+    d.addr = addr;
+    d.len = TARGET_PAGE_SIZE;
+    d.idxmap = idxmap;
+    d.bits = TARGET_LONG_BITS;
+    flush_all_helper(src_cpu, 0, &d);
 
     tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
 }
@@ -665,40 +895,34 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               target_ulong addr,
                                               uint16_t idxmap)
 {
+    TLBFlushRangeData r;
+    bool remote;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    r.addr = addr;
+    r.len = TARGET_PAGE_SIZE;
+    r.idxmap = idxmap;
+    r.bits = TARGET_LONG_BITS;
+    remote = flush_all_helper(src_cpu, 0, &r);
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * See tlb_flush_page_by_mmuidx_async_1 for details.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
+        flush_synced_src(src_cpu, remote, tlb_flush_page_by_mmuidx_async_1,
                          RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
+        flush_synced_src(src_cpu, remote, tlb_flush_page_by_mmuidx_async_2,
+                         RUN_ON_CPU_HOST_PTR(d));
     }
 }
 
@@ -746,6 +970,13 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
         return;
     }
 
+    if (!tlb_flush_large_pages_locked(env, midx, addr, len, mask)) {
+        tlb_debug("forcing full flush midx %d (large page in "
+                  TARGET_FMT_lx "+" TARGET_FMT_lx ")\n", midx, addr, len);
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
     for (target_ulong i = 0; i < len; i += TARGET_PAGE_SIZE) {
         target_ulong page = addr + i;
         CPUTLBEntry *entry = tlb_entry(env, midx, page);
@@ -757,13 +988,6 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
     }
 }
 
-typedef struct {
-    target_ulong addr;
-    target_ulong len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -825,10 +1049,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_queue_flush(cpu, 0, &d);
     }
 }
 
@@ -843,7 +1064,6 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
                                         uint16_t idxmap, unsigned bits)
 {
     TLBFlushRangeData d;
-    CPUState *dst_cpu;
 
     /*
      * If all bits are significant, and len is small,
@@ -865,16 +1085,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
+    flush_all_helper(src_cpu, 0, &d);
     tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
 }
 
@@ -892,8 +1103,8 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                uint16_t idxmap,
                                                unsigned bits)
 {
-    TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
+    TLBFlushRangeData d;
+    bool remote;
 
     /*
      * If all bits are significant, and len is small,
@@ -915,18 +1126,9 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
-    p = g_memdup(&d, sizeof(d));
-    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
-                          RUN_ON_CPU_HOST_PTR(p));
+    remote = flush_all_helper(src_cpu, 0, &d);
+    flush_synced_src(src_cpu, remote, tlb_flush_range_by_mmuidx_async_1,
+                     RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
 }
 
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
@@ -1064,8 +1266,8 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               target_ulong vaddr, target_ulong size)
+static void tlb_add_large_page_region(CPUArchState *env, int mmu_idx,
+                                      target_ulong vaddr, target_ulong size)
 {
     target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
     target_ulong lp_mask = ~(size - 1);
@@ -1086,6 +1288,90 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Record the large page that the target page at @vaddr belongs to.  While
+ * it is recorded, it is flushed precisely and tlb_fill_large_page() can
+ * refill its other target pages.  The page that it displaces from
+ * large_pages is added to the region that is flushed as a whole.
+ */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, hwaddr paddr,
+                               MemTxAttrs attrs, int prot, target_ulong size)
+{
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong lp_vaddr = vaddr & ~(size - 1);
+    CPUTLBLargePage *lp = NULL;
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        if (desc->large_pages[i].size == size &&
+            desc->large_pages[i].vaddr == lp_vaddr) {
+            lp = &desc->large_pages[i];
+            break;
+        }
+    }
+    if (!lp) {
+        lp = &desc->large_pages[desc->lpindex++ % CPU_TLB_LARGE_PAGES];
+        if (lp->size) {
+            tlb_add_large_page_region(env, mmu_idx, lp->vaddr, lp->size);
+        }
+    }
+
+    /* Writes that must be checked every time cannot be refilled from here */
+    if (prot & PAGE_WRITE_INV) {
+        prot &= ~(PAGE_WRITE | PAGE_WRITE_INV);
+    }
+
+    *lp = (CPUTLBLargePage) {
+        .vaddr = lp_vaddr,
+        .size = size,
+        .paddr = (paddr & TARGET_PAGE_MASK) -
+                 ((vaddr & TARGET_PAGE_MASK) - lp_vaddr),
+        .attrs = attrs,
+        .prot = prot,
+    };
+}
+
+/*
+ * Refill the tlb entry for @addr from a recorded large page, if there is
+ * one that covers @addr and permits @access_type.  The target has already
+ * translated the large page, so its page tables need not be walked again.
+ * Returns true on success.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, target_ulong addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    int need_prot;
+    int i;
+
+    switch (access_type) {
+    case MMU_DATA_STORE:
+        need_prot = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        need_prot = PAGE_EXEC;
+        break;
+    default:
+        need_prot = PAGE_READ;
+        break;
+    }
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        /* Copy it, tlb_set_page_with_attrs() will update the entry */
+        CPUTLBLargePage lp = desc->large_pages[i];
+
+        if (lp.size && page - lp.vaddr < lp.size && (lp.prot & need_prot)) {
+            tlb_set_page_with_attrs(cpu, page, lp.paddr + (page - lp.vaddr),
+                                    lp.attrs, lp.prot, mmu_idx, lp.size);
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
  * supplied size is only used by tlb_flush_page.
@@ -1117,7 +1403,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     if (size <= TARGET_PAGE_SIZE) {
         sz = TARGET_PAGE_SIZE;
     } else {
-        tlb_add_large_page(env, mmu_idx, vaddr, size);
+        tlb_add_large_page(env, mmu_idx, vaddr, paddr, attrs, prot, size);
         sz = size;
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
@@ -1297,6 +1583,10 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1352,7 +1642,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         cpu_io_recompile(cpu, retaddr);
     }
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1413,7 +1703,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
      */
     save_iotlb_data(cpu, iotlbentry->addr, section, mr_offset);
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1599,7 +1889,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                        mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -1771,11 +2062,13 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     }
 
     /* Enforce qemu required alignment.  */
-    if (unlikely(addr & (size - 1))) {
+    if (unlikely(addr & (size - 1)) &&
+        !atomic_unaligned_widenable(addr, size)) {
         /* We get here if guest alignment was not requested,
            or was not enforced by cpu_unaligned_access above.
-           We might widen the access and emulate, but for now
-           mark an exception and exit the cpu loop.  */
+           Accesses within an aligned 8-byte word are widened and
+           emulated by atomic_template.h; for the others mark an
+           exception and exit the cpu loop.  */
         goto stop_the_world;
     }
 
@@ -18,5 +18,20 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
+void tb_profile_sample(CPUState *cpu, TranslationBlock *tb);
+
+/*
+ * A misaligned atomic operation that does not cross an aligned 8-byte
+ * word is emulated by atomic_template.h with a cmpxchg loop on that word,
+ * instead of stopping all other vCPUs.
+ */
+static inline bool atomic_unaligned_widenable(target_ulong addr, int size)
+{
+#ifdef CONFIG_ATOMIC64
+    return size < 8 && (addr & 7) + size <= 8;
+#else
+    return false;
+#endif
+}
 
 #endif /* ACCEL_TCG_INTERNAL_H */
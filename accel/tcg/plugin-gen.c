@@ -74,6 +74,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -125,20 +126,69 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Compute in @ptr the address of the current vCPU's entry, i.e.
+ * base + cpu_index * stride.  Both the base (in the initial value of
+ * @ptr) and the stride (the second operand of the multiplication) are
+ * filled in later.  For plain pointers the stride is 0.
+ */
+static void gen_empty_entry_addr(TCGv_ptr ptr, TCGv_i32 cpu_index)
+{
+    TCGv_i32 cpu_offset = tcg_temp_new_i32();
+    TCGv_ptr cpu_offset_as_ptr = tcg_temp_new_ptr();
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_mul_i32(cpu_offset, cpu_index, cpu_index);
+    tcg_gen_ext_i32_ptr(cpu_offset_as_ptr, cpu_offset);
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset_as_ptr);
+
+    tcg_temp_free_ptr(cpu_offset_as_ptr);
+    tcg_temp_free_i32(cpu_offset);
+}
+
+static void gen_empty_cond_cb(void)
+{
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+    TCGLabel *after_cb = gen_new_label();
+    TCGv_ptr udata;
+
+    gen_empty_entry_addr(ptr, cpu_index);
+    tcg_gen_ld_i64(val, ptr, 0);
+    /* the operand, the condition and the label are replaced later */
+    tcg_gen_brcond_i64(TCG_COND_EQ, val, val, after_cb);
+    /* temps do not survive the branch, so set up the call after it */
+    udata = tcg_const_ptr(NULL); /* will be overwritten later */
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+    gen_set_label(after_cb);
+
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_i32(cpu_index);
+}
+
+/*
+ * The empty inline cb is an add; stores replace the load and the add
+ * with a move when filling it in.
  */
 static void gen_empty_inline_cb(void)
 {
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
     TCGv_i64 val = tcg_temp_new_i64();
     TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
 
+    gen_empty_entry_addr(ptr, cpu_index);
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
     tcg_gen_addi_i64(val, val, 0xdeadface);
     tcg_gen_st_i64(val, ptr, 0);
     tcg_temp_free_ptr(ptr);
     tcg_temp_free_i64(val);
+    tcg_temp_free_i32(cpu_index);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -196,6 +246,8 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        /* after the inline ops, so that conditions see their result */
+        gen_wrapped(from, PLUGIN_GEN_CB_COND, gen_empty_cond_cb);
         break;
     default:
         g_assert_not_reached();
@@ -371,6 +423,91 @@ static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
     return op;
 }
 
+/* the empty inline cb adds; turn its add_i64 into a move of @v */
+static TCGOp *copy_add_i64_as_movi(TCGOp **begin_op, TCGOp *op, uint64_t v)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        *begin_op = QTAILQ_NEXT(*begin_op, link);
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_add2_i32);
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i32);
+        op->args[0] = (*begin_op)->args[0];
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v));
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i32);
+        op->args[0] = (*begin_op)->args[1];
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+    } else {
+        *begin_op = QTAILQ_NEXT(*begin_op, link);
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_add_i64);
+        op = tcg_op_insert_after(tcg_ctx, op, INDEX_op_mov_i64);
+        op->args[0] = (*begin_op)->args[0];
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+    }
+    return op;
+}
+
+static void skip_ld_i64(TCGOp **begin_op)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        /* 2x ld_i32 */
+        *begin_op = QTAILQ_NEXT(*begin_op, link);
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_ld_i32);
+        *begin_op = QTAILQ_NEXT(*begin_op, link);
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_ld_i32);
+    } else {
+        *begin_op = QTAILQ_NEXT(*begin_op, link);
+        tcg_debug_assert((*begin_op)->opc == INDEX_op_ld_i64);
+    }
+}
+
+/* copy the ops of gen_empty_entry_addr(), filling in @stride */
+static TCGOp *copy_entry_addr(TCGOp **begin_op, TCGOp *op, size_t stride)
+{
+    /* ld_i32 */
+    op = copy_op(begin_op, op, INDEX_op_ld_i32);
+
+    /* mul_i32 */
+    op = copy_op(begin_op, op, INDEX_op_mul_i32);
+    op->args[2] = tcgv_i32_arg(tcg_constant_i32(stride));
+
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* ext_i32_ptr == mov_i32, add_ptr == add_i32 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        /* ext_i32_ptr == ext_i32_i64, add_ptr == add_i64 */
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_brcondi_i64(TCGOp **begin_op, TCGOp *op, TCGCond cond,
+                               uint64_t v, TCGLabel *l)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        op = copy_op(begin_op, op, INDEX_op_brcond2_i32);
+        op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+        op->args[3] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+        op->args[4] = cond;
+        op->args[5] = label_arg(l);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_brcond_i64);
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+        op->args[2] = cond;
+        op->args[3] = label_arg(l);
+    }
+    l->refs++;
+    return op;
+}
+
+static TCGOp *copy_set_label(TCGOp **begin_op, TCGOp *op, TCGLabel *l)
+{
+    op = copy_op(begin_op, op, INDEX_op_set_label);
+    op->args[0] = label_arg(l);
+    l->present = 1;
+    return op;
+}
+
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -447,14 +584,35 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
+    size_t stride = 0;
+    void *ptr = cb->userp;
+
+    if (entry.score) {
+        ptr = qemu_plugin_u64_base(entry, &stride);
+    }
+
     /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    op = copy_const_ptr(&begin_op, op, ptr);
 
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
+    /* add the offset of the vCPU's entry */
+    op = copy_entry_addr(&begin_op, op, stride);
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        /* ld_i64 */
+        op = copy_ld_i64(&begin_op, op);
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+        /* add_i64 */
+        op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        skip_ld_i64(&begin_op);
+        op = copy_add_i64_as_movi(&begin_op, op, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
 
     /* st_i64 */
     op = copy_st_i64(&begin_op, op);
@@ -462,18 +620,93 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
+static TCGCond plugin_cond_to_tcg_cond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* NEVER and ALWAYS are dealt with at registration time */
+        g_assert_not_reached();
+    }
+}
+
+static TCGOp *append_cond_cb(const struct qemu_plugin_dyn_cb *cb,
+                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
+{
+    TCGCond cond = tcg_invert_cond(plugin_cond_to_tcg_cond(cb->cond.cond));
+    TCGLabel *after_cb = gen_new_label();
+    size_t stride;
+    void *ptr = qemu_plugin_u64_base(cb->cond.entry, &stride);
+
+    /* const_ptr */
+    op = copy_const_ptr(&begin_op, op, ptr);
+
+    /* add the offset of the vCPU's entry */
+    op = copy_entry_addr(&begin_op, op, stride);
+
+    /* ld_i64 */
+    op = copy_ld_i64(&begin_op, op);
+
+    /* skip the call if the condition does not hold */
+    op = copy_brcondi_i64(&begin_op, op, cond, cb->cond.imm, after_cb);
+
+    /* const_ptr */
+    op = copy_const_ptr(&begin_op, op, cb->userp);
+
+    /* ld_i32 */
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+    /* call */
+    op = copy_call(&begin_op, op, HELPER(plugin_vcpu_udata_cb),
+                   cb->f.vcpu_udata, cb_idx);
+
+    /* set_label */
+    op = copy_set_label(&begin_op, op, after_cb);
+
+    return op;
+}
+
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
     enum plugin_gen_cb type = begin_op->args[1];
+    void *func = cb->f.vcpu_udata;
+    void *udata = cb->userp;
 
     tcg_debug_assert(type == PLUGIN_GEN_CB_MEM);
 
+    /*
+     * Branching around the call would end the TCG basic block while
+     * the temps of the guest access are still live, so filtered
+     * callbacks go through a wrapper instead.  It needs a copy of @cb
+     * that outlives this TB's translation; it is freed on the next code
+     * cache flush.
+     */
+    if (cb->mem.filtered) {
+        GArray *arr = g_array_sized_new(false, false, sizeof(*cb), 1);
+
+        g_array_append_vals(arr, cb, 1);
+        qemu_plugin_add_dyn_cb_arr(arr);
+        func = qemu_plugin_vcpu_mem_filtered_cb;
+        udata = arr->data;
+    }
+
     /* const_i32 == mov_i32 ("info", so it remains as is) */
     op = copy_op(&begin_op, op, INDEX_op_mov_i32);
 
     /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    op = copy_const_ptr(&begin_op, op, udata);
 
     /* copy the ld_i32, but note that we only have to copy it once */
     begin_op = QTAILQ_NEXT(begin_op, link);
@@ -489,7 +722,7 @@ static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
     if (type == PLUGIN_GEN_CB_MEM) {
         /* call */
         op = copy_call(&begin_op, op, HELPER(plugin_vcpu_mem_cb),
-                       cb->f.vcpu_udata, cb_idx);
+                       func, cb_idx);
     }
 
     return op;
@@ -553,6 +786,12 @@ inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
     inject_cb_type(cbs, begin_op, append_inline_cb, ok);
 }
 
+static void
+inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_cb_type(cbs, begin_op, append_cond_cb, op_ok);
+}
+
 static void
 inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
 {
@@ -660,6 +899,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond(const struct qemu_plugin_tb *ptb,
+                               TCGOp *begin_op)
+{
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -676,6 +921,13 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond(const struct qemu_plugin_tb *ptb,
+                                 TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -722,6 +974,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_tb_inline(ptb, begin_op);
             return;
+        case PLUGIN_GEN_CB_COND:
+            plugin_gen_tb_cond(ptb, begin_op);
+            return;
         default:
             g_assert_not_reached();
         }
@@ -733,6 +988,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_insn_inline(ptb, begin_op, insn_idx);
             return;
+        case PLUGIN_GEN_CB_COND:
+            plugin_gen_insn_cond(ptb, begin_op, insn_idx);
+            return;
         case PLUGIN_GEN_ENABLE_MEM_HELPER:
             plugin_gen_enable_mem_helper(ptb, begin_op, insn_idx);
             return;
@@ -798,6 +1056,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND:
+                type = "cond";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
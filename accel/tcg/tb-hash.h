@@ -59,6 +59,19 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 
 #endif /* CONFIG_SOFTMMU */
 
+/*
+ * The jump cache is 2-way set associative: the two entries of a set are
+ * adjacent, so a set never straddles the TB_JMP_PAGE_SIZE entries that
+ * TLB invalidation clears for a page.  The most recently used TB of a set
+ * is kept in its first way.
+ */
+#define TB_JMP_CACHE_WAYS 2
+
+static inline unsigned int tb_jmp_cache_hash_set(target_ulong pc)
+{
+    return tb_jmp_cache_hash_func(pc) & ~(TB_JMP_CACHE_WAYS - 1);
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc, uint32_t flags,
                       uint32_t cf_mask, uint32_t trace_vcpu_dstate)
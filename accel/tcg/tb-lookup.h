@@ -16,6 +16,27 @@
 #include "exec/exec-all.h"
 #include "tb-hash.h"
 
+/* Insert @tb into the set @hash of the jump cache, evicting its LRU way */
+static inline void tb_jmp_cache_insert(CPUState *cpu, uint32_t hash,
+                                       TranslationBlock *tb)
+{
+    qatomic_set(&cpu->tb_jmp_cache[hash + 1],
+                qatomic_read(&cpu->tb_jmp_cache[hash]));
+    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+}
+
+static inline bool tb_lookup_match(CPUState *cpu, TranslationBlock *tb,
+                                   target_ulong pc, target_ulong cs_base,
+                                   uint32_t flags, uint32_t cflags)
+{
+    return tb &&
+           tb->pc == pc &&
+           tb->cs_base == cs_base &&
+           tb->flags == flags &&
+           tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+           tb_cflags(tb) == cflags;
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
@@ -27,22 +48,26 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(pc);
+    qatomic_set(&cpu->tb_lookups, cpu->tb_lookups + 1);
+    hash = tb_jmp_cache_hash_set(pc);
     tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
+    if (likely(tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags))) {
+        return tb;
+    }
 
-    if (likely(tb &&
-               tb->pc == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               tb_cflags(tb) == cflags)) {
+    tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash + 1]);
+    if (tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags)) {
+        /* Swap the ways, so that the first one remains the MRU */
+        tb_jmp_cache_insert(cpu, hash, tb);
         return tb;
     }
+
+    qatomic_set(&cpu->tb_jmp_cache_misses, cpu->tb_jmp_cache_misses + 1);
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
     }
-    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_insert(cpu, hash, tb);
     return tb;
 }
 
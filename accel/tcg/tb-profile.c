@@ -0,0 +1,192 @@
+/*
+ * Sampling profiler for translated code
+ *
+ * Every TB_PROFILE_PERIOD_MS, a thread asks each running vCPU to leave
+ * the chain of translated blocks, the same way cpu_exit() does.  The
+ * vCPU then notes the TB it was about to execute, i.e. the one where it
+ * was running when the request arrived, rounded to the next TB boundary.
+ * The translated code is not instrumented, so when the profiler is on it
+ * costs one exit from the code cache per vCPU and period.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/qemu-print.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "hw/core/cpu.h"
+#include "exec/exec-all.h"
+#include "internal.h"
+
+#define TB_PROFILE_PERIOD_MS 1
+
+typedef struct TBProfileEntry {
+    uint64_t pc;
+    uint64_t samples;
+} TBProfileEntry;
+
+static QemuMutex tbp_lock;
+/* the fields below are protected by tbp_lock */
+static GHashTable *tbp_table;
+static uint64_t tbp_samples;
+static uint64_t tbp_idle_samples;
+static bool tbp_enabled;
+static QemuThread tbp_thread;
+static QemuSemaphore tbp_stop;
+
+static void __attribute__((__constructor__)) tb_profile_init(void)
+{
+    qemu_mutex_init(&tbp_lock);
+    qemu_sem_init(&tbp_stop, 0);
+    tbp_table = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                      NULL, g_free);
+}
+
+static void *tb_profile_thread(void *opaque)
+{
+    rcu_register_thread();
+
+    while (qemu_sem_timedwait(&tbp_stop, TB_PROFILE_PERIOD_MS) < 0) {
+        uint64_t idle = 0;
+        CPUState *cpu;
+
+        rcu_read_lock();
+        CPU_FOREACH(cpu) {
+            if (!qatomic_read(&cpu->running)) {
+                idle++;
+                continue;
+            }
+            qatomic_set(&cpu->tb_profile_pending, true);
+            /* pairs with the barrier in cpu_handle_interrupt() */
+            smp_wmb();
+            qatomic_set(&cpu_neg(cpu)->icount_decr.u16.high, -1);
+        }
+        rcu_read_unlock();
+
+        qemu_mutex_lock(&tbp_lock);
+        tbp_idle_samples += idle;
+        qemu_mutex_unlock(&tbp_lock);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Called by a vCPU that left the code cache for a sample, before @tb */
+void tb_profile_sample(CPUState *cpu, TranslationBlock *tb)
+{
+    uint64_t pc = tb->pc;
+    TBProfileEntry *e;
+
+    qatomic_set(&cpu->tb_profile_pending, false);
+
+    qemu_mutex_lock(&tbp_lock);
+    e = g_hash_table_lookup(tbp_table, &pc);
+    if (!e) {
+        e = g_new0(TBProfileEntry, 1);
+        e->pc = pc;
+        g_hash_table_insert(tbp_table, &e->pc, e);
+    }
+    e->samples++;
+    tbp_samples++;
+    qemu_mutex_unlock(&tbp_lock);
+}
+
+bool tb_profile_is_enabled(void)
+{
+    bool ret;
+
+    qemu_mutex_lock(&tbp_lock);
+    ret = tbp_enabled;
+    qemu_mutex_unlock(&tbp_lock);
+    return ret;
+}
+
+void tb_profile_enable(void)
+{
+    qemu_mutex_lock(&tbp_lock);
+    if (!tbp_enabled) {
+        tbp_enabled = true;
+        qemu_thread_create(&tbp_thread, "tb-profile", tb_profile_thread,
+                           NULL, QEMU_THREAD_JOINABLE);
+    }
+    qemu_mutex_unlock(&tbp_lock);
+}
+
+void tb_profile_disable(void)
+{
+    qemu_mutex_lock(&tbp_lock);
+    if (!tbp_enabled) {
+        qemu_mutex_unlock(&tbp_lock);
+        return;
+    }
+    tbp_enabled = false;
+    qemu_mutex_unlock(&tbp_lock);
+
+    /* the thread takes tbp_lock, so join it without holding the lock */
+    qemu_sem_post(&tbp_stop);
+    qemu_thread_join(&tbp_thread);
+}
+
+void tb_profile_reset(void)
+{
+    qemu_mutex_lock(&tbp_lock);
+    g_hash_table_remove_all(tbp_table);
+    tbp_samples = 0;
+    tbp_idle_samples = 0;
+    qemu_mutex_unlock(&tbp_lock);
+}
+
+static gint tb_profile_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const TBProfileEntry *a = *(const TBProfileEntry **)ap;
+    const TBProfileEntry *b = *(const TBProfileEntry **)bp;
+
+    if (a->samples != b->samples) {
+        return a->samples > b->samples ? -1 : 1;
+    }
+    return a->pc < b->pc ? -1 : a->pc > b->pc;
+}
+
+/*
+ * Print the @max guest PCs with the most samples, in the layout of
+ * "perf report --stdio".  Each sample stands for TB_PROFILE_PERIOD_MS
+ * of host time spent by a vCPU in the TB starting at that PC.
+ */
+void tb_profile_report(size_t max)
+{
+    GPtrArray *entries;
+    GHashTableIter iter;
+    TBProfileEntry *e;
+    uint64_t samples, idle;
+    size_t i;
+
+    qemu_mutex_lock(&tbp_lock);
+    samples = tbp_samples;
+    idle = tbp_idle_samples;
+    entries = g_ptr_array_sized_new(g_hash_table_size(tbp_table));
+    g_hash_table_iter_init(&iter, tbp_table);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        TBProfileEntry *copy = g_memdup(e, sizeof(*e));
+
+        g_ptr_array_add(entries, copy);
+    }
+    qemu_mutex_unlock(&tbp_lock);
+
+    g_ptr_array_sort(entries, tb_profile_cmp);
+
+    qemu_printf("# Samples: %" PRIu64 " (%" PRIu64 " more while idle), "
+                "period %d ms\n", samples, idle, TB_PROFILE_PERIOD_MS);
+    qemu_printf("#\n# Overhead      Samples   Host time (ms)  Guest PC\n");
+    for (i = 0; i < entries->len && i < max; i++) {
+        e = g_ptr_array_index(entries, i);
+        qemu_printf("  %7.2f%%  %11" PRIu64 "  %15" PRIu64 "  0x%016"
+                    PRIx64 "\n", 100.0 * e->samples / samples, e->samples,
+                    e->samples * TB_PROFILE_PERIOD_MS, e->pc);
+    }
+
+    g_ptr_array_set_free_func(entries, g_free);
+    g_ptr_array_free(entries, true);
+}
@@ -35,6 +35,43 @@
 #include "tcg-accel-ops-icount.h"
 #include "tcg-accel-ops-rr.h"
 
+/*
+ * Looking up a deadline locks and walks every timer list of the clock,
+ * and is done before each slice of execution.  Cache the absolute expiry
+ * time until a timer is armed earlier than it or until it passes.  If the
+ * soonest timer is removed or delayed meanwhile, the slice merely ends
+ * early and the next lookup refreshes the cache.  Only the round-robin
+ * vCPU thread uses this.
+ */
+static struct {
+    bool valid;
+    unsigned gen;
+    int64_t expire;     /* INT64_MAX if no timer is pending */
+} icount_deadline_cache[QEMU_CLOCK_MAX];
+
+static int64_t icount_clock_deadline(QEMUClockType type)
+{
+    unsigned gen = qemu_clock_deadline_gen(type);
+    int64_t now = qemu_clock_get_ns(type);
+    int64_t deadline;
+
+    if (icount_deadline_cache[type].valid &&
+        icount_deadline_cache[type].gen == gen &&
+        icount_deadline_cache[type].expire > now) {
+        if (icount_deadline_cache[type].expire == INT64_MAX) {
+            return -1;
+        }
+        return icount_deadline_cache[type].expire - now;
+    }
+
+    deadline = qemu_clock_deadline_ns_all(type, QEMU_TIMER_ATTR_ALL);
+    icount_deadline_cache[type].valid = true;
+    icount_deadline_cache[type].gen = gen;
+    icount_deadline_cache[type].expire = deadline < 0 ? INT64_MAX
+                                                      : now + deadline;
+    return deadline;
+}
+
 static int64_t icount_get_limit(void)
 {
     int64_t deadline;
@@ -44,12 +81,10 @@ static int64_t icount_get_limit(void)
          * Include all the timers, because they may need an attention.
          * Too long CPU execution may create unnecessary delay in UI.
          */
-        deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
-                                              QEMU_TIMER_ATTR_ALL);
+        deadline = icount_clock_deadline(QEMU_CLOCK_VIRTUAL);
         /* Check realtime timers, because they help with input processing */
         deadline = qemu_soonest_timeout(deadline,
-                qemu_clock_deadline_ns_all(QEMU_CLOCK_REALTIME,
-                                           QEMU_TIMER_ATTR_ALL));
+                icount_clock_deadline(QEMU_CLOCK_REALTIME));
 
         /*
          * Maintain prior (possibly buggy) behaviour where if no deadline
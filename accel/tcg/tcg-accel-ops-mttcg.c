@@ -29,6 +29,7 @@
 #include "sysemu/replay.h"
 #include "qemu/main-loop.h"
 #include "qemu/guest-random.h"
+#include "qemu/thread-placement.h"
 #include "exec/exec-all.h"
 #include "hw/boards.h"
 
@@ -126,6 +127,7 @@ void mttcg_start_vcpu_thread(CPUState *cpu)
 
     qemu_thread_create(cpu->thread, thread_name, mttcg_cpu_thread_fn,
                        cpu, QEMU_THREAD_JOINABLE);
+    qemu_thread_place(cpu->thread, THREAD_PLACEMENT_ROLE_VCPU);
 
 #ifdef _WIN32
     cpu->hThread = qemu_thread_get_handle(cpu->thread);
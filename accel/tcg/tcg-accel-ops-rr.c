@@ -29,6 +29,7 @@
 #include "sysemu/replay.h"
 #include "qemu/main-loop.h"
 #include "qemu/guest-random.h"
+#include "qemu/thread-placement.h"
 #include "exec/exec-all.h"
 
 #include "tcg-accel-ops.h"
@@ -280,6 +281,7 @@ void rr_start_vcpu_thread(CPUState *cpu)
         qemu_thread_create(cpu->thread, thread_name,
                            rr_cpu_thread_fn,
                            cpu, QEMU_THREAD_JOINABLE);
+        qemu_thread_place(cpu->thread, THREAD_PLACEMENT_ROLE_VCPU);
 
         single_tcg_halt_cond = cpu->halt_cond;
         single_tcg_cpu_thread = cpu->thread;
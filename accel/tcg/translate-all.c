@@ -57,6 +57,7 @@
 #include "sysemu/tcg.h"
 #include "qapi/error.h"
 #include "hw/core/tcg-cpu-ops.h"
+#include "tcg/perf.h"
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
@@ -1174,9 +1175,16 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+/*
+ * Invalidate @tb.  If @rm_from_page_list, also remove it from the lists of
+ * its pages, except from @unlinked_pd (if not NULL): that list is being
+ * walked by the caller, which unlinks @tb from it in place.
+ *
+ * Returns false if @tb had already been invalidated.
+ */
+static bool do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  PageDesc *unlinked_pd)
 {
-    CPUState *cpu;
     PageDesc *p;
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -1194,28 +1202,31 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     h = tb_hash_func(phys_pc, tb->pc, tb->flags, orig_cflags,
                      tb->trace_vcpu_dstate);
     if (!qht_remove(&tb_ctx.htable, tb, h)) {
-        return;
+        return false;
     }
 
     /* remove the TB from the page list */
     if (rm_from_page_list) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
-        tb_page_remove(p, tb);
+        if (p != unlinked_pd) {
+            tb_page_remove(p, tb);
+        }
         invalidate_page_bitmap(p);
         if (tb->page_addr[1] != -1) {
             p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
-            tb_page_remove(p, tb);
+            if (p != unlinked_pd) {
+                tb_page_remove(p, tb);
+            }
             invalidate_page_bitmap(p);
         }
     }
 
-    /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
-    CPU_FOREACH(cpu) {
-        if (qatomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            qatomic_set(&cpu->tb_jmp_cache[h], NULL);
-        }
-    }
+    /*
+     * The TB is left in the vCPUs' jump caches: CF_INVALID makes
+     * tb_lookup() treat it as a miss, and its memory is not reused
+     * before tb_flush(), which clears all jump caches.  Scanning every
+     * vCPU here would make invalidation cost O(vCPUs) per TB.
+     */
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -1226,13 +1237,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 
     qatomic_set(&tcg_ctx->tb_phys_invalidate_count,
                tcg_ctx->tb_phys_invalidate_count + 1);
-}
-
-static void tb_phys_invalidate__locked(TranslationBlock *tb)
-{
-    qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
-    qemu_thread_jit_execute();
+    return true;
 }
 
 /* invalidate one TB
@@ -1243,10 +1248,10 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb->page_addr[0] != -1) {
         page_lock_tb(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, NULL);
         page_unlock_tb(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, NULL);
     }
 }
 
@@ -1416,6 +1421,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
+    TCGGenStats *stats = &tcg_ctx->gen_stats;
+    int64_t gen_start = get_clock();
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
@@ -1550,6 +1557,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    qatomic_set(&stats->tb_count, stats->tb_count + 1);
+    qatomic_set(&stats->guest_insns, stats->guest_insns + tb->icount);
+    qatomic_set(&stats->guest_bytes, stats->guest_bytes + tb->size);
+    qatomic_set(&stats->host_bytes, stats->host_bytes + gen_code_size);
+    qatomic_set(&stats->helper_calls,
+                stats->helper_calls + tcg_ctx->gen_nb_calls);
+    qatomic_set_u64(&stats->gen_time_ns,
+                    stats->gen_time_ns + get_clock() - gen_start);
+
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     qatomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
@@ -1629,6 +1645,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
+    perf_report_code(pc, tb->tc.ptr, gen_code_size);
 
     /* init jump list */
     qemu_spin_init(&tb->jmp_lock);
@@ -1694,6 +1711,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     tb_page_addr_t tb_start, tb_end;
+    uintptr_t *pprev;
     int n;
 #ifdef TARGET_HAS_PRECISE_SMC
     CPUState *cpu = current_cpu;
@@ -1714,9 +1732,13 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     }
 #endif
 
-    /* we remove all the TBs in the range [start, end[ */
-    /* XXX: see if in some cases it could be faster to invalidate all
-       the code */
+    /*
+     * We remove all the TBs in the range [start, end[.  They are unlinked
+     * from @p's list as we walk it, so that removing all of a page's TBs
+     * does not have to search the list once per TB.
+     */
+    qemu_thread_jit_write();
+    pprev = &p->first_tb;
     PAGE_FOR_EACH_TB(p, tb, n) {
         assert_page_locked(p);
         /* NOTE: this is subtle as a TB may span two physical pages */
@@ -1751,9 +1773,14 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
                                      &current_flags);
             }
 #endif /* TARGET_HAS_PRECISE_SMC */
-            tb_phys_invalidate__locked(tb);
+            if (do_tb_phys_invalidate(tb, true, p)) {
+                *pprev = tb->page_next[n];
+                continue;
+            }
         }
+        pprev = &tb->page_next[n];
     }
+    qemu_thread_jit_execute();
 #if !defined(CONFIG_USER_ONLY)
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
@@ -1970,6 +1997,36 @@ void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
     }
 }
 
+/*
+ * Write the translation and TB lookup counters to @f as a single JSON
+ * object, for tools that compare runs.  Lookups that miss the per-vCPU
+ * jump cache go to the TB hash table; those that miss there too end up
+ * in tb_gen_code().
+ */
+void dump_exec_stats_json(FILE *f)
+{
+    TCGGenStats gen;
+    size_t lookups = 0, misses = 0;
+    CPUState *cpu;
+
+    tcg_gen_stats(&gen);
+    CPU_FOREACH(cpu) {
+        lookups += qatomic_read(&cpu->tb_lookups);
+        misses += qatomic_read(&cpu->tb_jmp_cache_misses);
+    }
+
+    fprintf(f, "{\"tb-lookups\": %zu, \"tb-jmp-cache-misses\": %zu, "
+            "\"tb-translations\": %zu, \"translate-ns\": %" PRIu64 ", "
+            "\"guest-insns-translated\": %zu, "
+            "\"guest-bytes-translated\": %zu, \"host-bytes\": %zu, "
+            "\"helper-calls-translated\": %zu, \"tb-flushes\": %u, "
+            "\"tb-invalidations\": %zu}\n",
+            lookups, misses, gen.tb_count, gen.gen_time_ns, gen.guest_insns,
+            gen.guest_bytes, gen.host_bytes, gen.helper_calls,
+            qatomic_read(&tb_ctx.tb_flush_count),
+            tcg_tb_phys_invalidate_count());
+}
+
 #ifndef CONFIG_USER_ONLY
 /*
  * In deterministic execution mode, instructions doing device I/Os
@@ -2088,6 +2145,17 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static size_t tb_jmp_cache_miss_count(void)
+{
+    CPUState *cpu;
+    size_t misses = 0;
+
+    CPU_FOREACH(cpu) {
+        misses += qatomic_read(&cpu->tb_jmp_cache_misses);
+    }
+    return misses;
+}
+
 void dump_exec_info(void)
 {
     struct tb_tree_stats tst = {};
@@ -2130,6 +2198,8 @@ void dump_exec_info(void)
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
+    qemu_printf("TB jmp cache misses %zu\n", tb_jmp_cache_miss_count());
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
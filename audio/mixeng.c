@@ -339,6 +339,377 @@ f_sample *mixeng_clip_float[2] = {
     clip_natural_float_from_stereo,
 };
 
+static void mixeng_mix_int(struct st_sample *dst, const struct st_sample *src,
+                           int samples)
+{
+    while (samples--) {
+        dst->l += src->l;
+        dst->r += src->r;
+        dst++;
+        src++;
+    }
+}
+
+/* Mixes voices running at the rate of the backend */
+static void (*mixeng_mix)(struct st_sample *dst, const struct st_sample *src,
+                          int samples) = mixeng_mix_int;
+
+#if defined(CONFIG_AVX2_OPT) && !defined(FLOAT_MIXENG)
+/*
+ * AVX2 versions of the conversions of native endian S16, S32 and F32
+ * samples, and of the mixing.  They give the same results as the
+ * generic versions: samples are 64-bit integers holding 32-bit values,
+ * and the float conversions go through double precision, where these
+ * values are exact.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* 2^52 + 2^51: adding it to a double below 2^51 leaves its integer part */
+#define MIXENG_DOUBLE_MAGIC 0x1.8p52
+
+static inline __m256i mixeng_clamp_avx2(__m256i v)
+{
+    const __m256i max = _mm256_set1_epi64x(INT32_MAX);
+    const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+
+    v = _mm256_blendv_epi8(v, max, _mm256_cmpgt_epi64(v, max));
+    return _mm256_blendv_epi8(v, min, _mm256_cmpgt_epi64(min, v));
+}
+
+/* Clamp four samples to 32 bits and narrow them */
+static inline __m128i mixeng_narrow_avx2(__m256i v)
+{
+    const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    v = _mm256_permutevar8x32_epi32(mixeng_clamp_avx2(v), idx);
+    return _mm256_castsi256_si128(v);
+}
+
+/* Sum the channels of the four frames in @a and @b, in order */
+static inline __m256i mixeng_downmix_avx2(__m256i a, __m256i b)
+{
+    __m256i sum = _mm256_add_epi64(_mm256_unpacklo_epi64(a, b),
+                                   _mm256_unpackhi_epi64(a, b));
+
+    return _mm256_permute4x64_epi64(sum, 0xd8);
+}
+
+static inline __m256d mixeng_int64_to_pd_avx2(__m256i v)
+{
+    const __m256d magic = _mm256_set1_pd(MIXENG_DOUBLE_MAGIC);
+
+    v = _mm256_add_epi64(v, _mm256_castpd_si256(magic));
+    return _mm256_sub_pd(_mm256_castsi256_pd(v), magic);
+}
+
+static inline __m256i mixeng_pd_to_int64_avx2(__m256d v)
+{
+    const __m256d magic = _mm256_set1_pd(MIXENG_DOUBLE_MAGIC);
+
+    v = _mm256_round_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    v = _mm256_add_pd(v, magic);
+    return _mm256_sub_epi64(_mm256_castpd_si256(v),
+                            _mm256_castpd_si256(magic));
+}
+
+static void conv_natural_int16_t_to_stereo_avx2(struct st_sample *dst,
+                                                const void *src, int samples)
+{
+    const int16_t *in = src;
+    int64_t *out = (int64_t *)dst;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_cvtepi16_epi64(_mm_loadl_epi64((void *)(in + i)));
+
+        _mm256_storeu_si256((void *)(out + i), _mm256_slli_epi64(v, 16));
+    }
+    for (; i < n; i++) {
+        out[i] = (int64_t)in[i] << 16;
+    }
+}
+
+static void conv_natural_int16_t_to_mono_avx2(struct st_sample *dst,
+                                              const void *src, int samples)
+{
+    const int16_t *in = src;
+    int64_t *out = (int64_t *)dst;
+    int i;
+
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m256i v = _mm256_cvtepi16_epi64(_mm_loadl_epi64((void *)(in + i)));
+
+        v = _mm256_slli_epi64(v, 16);
+        _mm256_storeu_si256((void *)(out + 2 * i),
+                            _mm256_permute4x64_epi64(v, 0x50));
+        _mm256_storeu_si256((void *)(out + 2 * i + 4),
+                            _mm256_permute4x64_epi64(v, 0xfa));
+    }
+    for (; i < samples; i++) {
+        dst[i].l = dst[i].r = (int64_t)in[i] << 16;
+    }
+}
+
+static void conv_natural_int32_t_to_stereo_avx2(struct st_sample *dst,
+                                                const void *src, int samples)
+{
+    const int32_t *in = src;
+    int64_t *out = (int64_t *)dst;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((void *)(in + i));
+
+        _mm256_storeu_si256((void *)(out + i), _mm256_cvtepi32_epi64(v));
+    }
+    for (; i < n; i++) {
+        out[i] = in[i];
+    }
+}
+
+static void conv_natural_int32_t_to_mono_avx2(struct st_sample *dst,
+                                              const void *src, int samples)
+{
+    const int32_t *in = src;
+    int64_t *out = (int64_t *)dst;
+    int i;
+
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m256i v = _mm256_cvtepi32_epi64(_mm_loadu_si128((void *)(in + i)));
+
+        _mm256_storeu_si256((void *)(out + 2 * i),
+                            _mm256_permute4x64_epi64(v, 0x50));
+        _mm256_storeu_si256((void *)(out + 2 * i + 4),
+                            _mm256_permute4x64_epi64(v, 0xfa));
+    }
+    for (; i < samples; i++) {
+        dst[i].l = dst[i].r = in[i];
+    }
+}
+
+static void conv_natural_float_to_stereo_avx2(struct st_sample *dst,
+                                              const void *src, int samples)
+{
+    const __m256d scale = _mm256_set1_pd(float_scale);
+    const float *in = src;
+    int64_t *out = (int64_t *)dst;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_cvtps_pd(_mm_loadu_ps(in + i));
+
+        v = _mm256_mul_pd(v, scale);
+        _mm256_storeu_si256((void *)(out + i), mixeng_pd_to_int64_avx2(v));
+    }
+    for (; i < n; i++) {
+        out[i] = CONV_NATURAL_FLOAT(in[i]);
+    }
+}
+
+static void conv_natural_float_to_mono_avx2(struct st_sample *dst,
+                                            const void *src, int samples)
+{
+    const __m256d scale = _mm256_set1_pd(float_scale);
+    const float *in = src;
+    int64_t *out = (int64_t *)dst;
+    int i;
+
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m256d v = _mm256_cvtps_pd(_mm_loadu_ps(in + i));
+        __m256i w = mixeng_pd_to_int64_avx2(_mm256_mul_pd(v, scale));
+
+        _mm256_storeu_si256((void *)(out + 2 * i),
+                            _mm256_permute4x64_epi64(w, 0x50));
+        _mm256_storeu_si256((void *)(out + 2 * i + 4),
+                            _mm256_permute4x64_epi64(w, 0xfa));
+    }
+    for (; i < samples; i++) {
+        dst[i].l = dst[i].r = CONV_NATURAL_FLOAT(in[i]);
+    }
+}
+
+static void clip_natural_int16_t_from_stereo_avx2(void *dst,
+                                                  const struct st_sample *src,
+                                                  int samples)
+{
+    const int64_t *in = (const int64_t *)src;
+    int16_t *out = dst;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((void *)(in + i));
+        __m128i w = _mm_srai_epi32(mixeng_narrow_avx2(v), 16);
+
+        _mm_storel_epi64((void *)(out + i), _mm_packs_epi32(w, w));
+    }
+    for (; i < n; i++) {
+        out[i] = MAX(MIN(in[i], INT32_MAX), INT32_MIN) >> 16;
+    }
+}
+
+static void clip_natural_int16_t_from_mono_avx2(void *dst,
+                                                const struct st_sample *src,
+                                                int samples)
+{
+    const int64_t *in = (const int64_t *)src;
+    int16_t *out = dst;
+    int i;
+
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m256i a = _mm256_loadu_si256((void *)(in + 2 * i));
+        __m256i b = _mm256_loadu_si256((void *)(in + 2 * i + 4));
+        __m128i w = mixeng_narrow_avx2(mixeng_downmix_avx2(a, b));
+
+        w = _mm_srai_epi32(w, 16);
+        _mm_storel_epi64((void *)(out + i), _mm_packs_epi32(w, w));
+    }
+    for (; i < samples; i++) {
+        int64_t v = src[i].l + src[i].r;
+
+        out[i] = MAX(MIN(v, INT32_MAX), INT32_MIN) >> 16;
+    }
+}
+
+static void clip_natural_int32_t_from_stereo_avx2(void *dst,
+                                                  const struct st_sample *src,
+                                                  int samples)
+{
+    const int64_t *in = (const int64_t *)src;
+    int32_t *out = dst;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((void *)(in + i));
+
+        _mm_storeu_si128((void *)(out + i), mixeng_narrow_avx2(v));
+    }
+    for (; i < n; i++) {
+        out[i] = MAX(MIN(in[i], INT32_MAX), INT32_MIN);
+    }
+}
+
+static void clip_natural_int32_t_from_mono_avx2(void *dst,
+                                                const struct st_sample *src,
+                                                int samples)
+{
+    const int64_t *in = (const int64_t *)src;
+    int32_t *out = dst;
+    int i;
+
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m256i a = _mm256_loadu_si256((void *)(in + 2 * i));
+        __m256i b = _mm256_loadu_si256((void *)(in + 2 * i + 4));
+
+        _mm_storeu_si128((void *)(out + i),
+                         mixeng_narrow_avx2(mixeng_downmix_avx2(a, b)));
+    }
+    for (; i < samples; i++) {
+        int64_t v = src[i].l + src[i].r;
+
+        out[i] = MAX(MIN(v, INT32_MAX), INT32_MIN);
+    }
+}
+
+static void clip_natural_float_from_stereo_avx2(void *dst,
+                                                const struct st_sample *src,
+                                                int samples)
+{
+    const __m128 scale = _mm_set1_ps(1.f / float_scale);
+    const int64_t *in = (const int64_t *)src;
+    float *out = dst;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((void *)(in + i));
+        __m128 f = _mm256_cvtpd_ps(mixeng_int64_to_pd_avx2(v));
+
+        _mm_storeu_ps(out + i, _mm_mul_ps(f, scale));
+    }
+    for (; i < n; i++) {
+        out[i] = CLIP_NATURAL_FLOAT(in[i]);
+    }
+}
+
+static void clip_natural_float_from_mono_avx2(void *dst,
+                                              const struct st_sample *src,
+                                              int samples)
+{
+    const __m128 scale = _mm_set1_ps(1.f / float_scale);
+    const int64_t *in = (const int64_t *)src;
+    float *out = dst;
+    int i;
+
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m256i a = _mm256_loadu_si256((void *)(in + 2 * i));
+        __m256i b = _mm256_loadu_si256((void *)(in + 2 * i + 4));
+        __m256d d = mixeng_int64_to_pd_avx2(mixeng_downmix_avx2(a, b));
+
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm256_cvtpd_ps(d), scale));
+    }
+    for (; i < samples; i++) {
+        out[i] = CLIP_NATURAL_FLOAT(src[i].l + src[i].r);
+    }
+}
+
+static void mixeng_mix_avx2(struct st_sample *dst, const struct st_sample *src,
+                            int samples)
+{
+    int64_t *out = (int64_t *)dst;
+    const int64_t *in = (const int64_t *)src;
+    int i, n = samples * 2;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((void *)(out + i));
+        __m256i b = _mm256_loadu_si256((void *)(in + i));
+
+        _mm256_storeu_si256((void *)(out + i), _mm256_add_epi64(a, b));
+    }
+    for (; i < n; i++) {
+        out[i] += in[i];
+    }
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) mixeng_init_accel(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d, bv;
+
+    if (max < 7) {
+        return;
+    }
+    __cpuid(1, a, b, c, d);
+
+    /* We must check that AVX is not just available, but usable.  */
+    if (!(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+        return;
+    }
+    __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+    __cpuid_count(7, 0, a, b, c, d);
+    if ((bv & 0x6) != 0x6 || !(b & bit_AVX2)) {
+        return;
+    }
+
+    mixeng_conv[0][1][0][1] = conv_natural_int16_t_to_mono_avx2;
+    mixeng_conv[1][1][0][1] = conv_natural_int16_t_to_stereo_avx2;
+    mixeng_conv[0][1][0][2] = conv_natural_int32_t_to_mono_avx2;
+    mixeng_conv[1][1][0][2] = conv_natural_int32_t_to_stereo_avx2;
+    mixeng_clip[0][1][0][1] = clip_natural_int16_t_from_mono_avx2;
+    mixeng_clip[1][1][0][1] = clip_natural_int16_t_from_stereo_avx2;
+    mixeng_clip[0][1][0][2] = clip_natural_int32_t_from_mono_avx2;
+    mixeng_clip[1][1][0][2] = clip_natural_int32_t_from_stereo_avx2;
+    mixeng_conv_float[0] = conv_natural_float_to_mono_avx2;
+    mixeng_conv_float[1] = conv_natural_float_to_stereo_avx2;
+    mixeng_clip_float[0] = clip_natural_float_from_mono_avx2;
+    mixeng_clip_float[1] = clip_natural_float_from_stereo_avx2;
+    mixeng_mix = mixeng_mix_avx2;
+}
+#endif /* CONFIG_AVX2_OPT && !FLOAT_MIXENG */
+
 void audio_sample_to_uint64(const void *samples, int pos,
                             uint64_t *left, uint64_t *right)
 {
@@ -434,10 +805,12 @@ void *st_rate_start (int inrate, int outrate)
 
 #define NAME st_rate_flow_mix
 #define OP(a, b) a += b
+#define OP_N(dst, src, n) mixeng_mix(dst, src, n)
 #include "rate_template.h"
 
 #define NAME st_rate_flow
 #define OP(a, b) a = b
+#define OP_N(dst, src, n) memcpy(dst, src, (n) * sizeof(struct st_sample))
 #include "rate_template.h"
 
 void st_rate_stop (void *opaque)
@@ -19,9 +19,11 @@
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
+#include "qemu/timeline.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
+#include <numa.h>
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_DEFAULT != MPOL_DEFAULT);
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_PREFERRED != MPOL_PREFERRED);
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_BIND != MPOL_BIND);
@@ -203,6 +205,61 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+/*
+ * Preallocate @sz bytes at @ptr.  When the backend is bound to host nodes,
+ * the preallocation threads run on the CPUs of those nodes, so that pages
+ * are cleared by CPUs close to them.
+ */
+static void host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         void *ptr, uint64_t sz, bool async,
+                                         Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    unsigned long *cpus = NULL;
+    unsigned long ncpus = 0;
+    int64_t start_ns;
+
+#ifdef CONFIG_NUMA
+    if (backend->policy != MPOL_DEFAULT && numa_available() >= 0) {
+        struct bitmask *mask = numa_allocate_cpumask();
+        unsigned long node, cpu;
+
+        ncpus = numa_num_possible_cpus();
+        cpus = bitmap_new(ncpus);
+        for (node = find_first_bit(backend->host_nodes, MAX_NODES);
+             node < MAX_NODES;
+             node = find_next_bit(backend->host_nodes, MAX_NODES, node + 1)) {
+            if (numa_node_to_cpus(node, mask) < 0) {
+                continue;
+            }
+            for (cpu = 0; cpu < ncpus; cpu++) {
+                if (numa_bitmask_isbitset(mask, cpu)) {
+                    set_bit(cpu, cpus);
+                }
+            }
+        }
+        numa_free_cpumask(mask);
+
+        /* Nodes with memory but no CPUs: leave the threads unbound */
+        if (bitmap_empty(cpus, ncpus)) {
+            g_free(cpus);
+            cpus = NULL;
+        }
+    }
+#endif
+
+    start_ns = timeline_start();
+    os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, cpus, ncpus,
+                    async, errp);
+    if (!async) {
+        g_autofree char *path =
+            object_get_canonical_path_component(OBJECT(backend));
+
+        timeline_record("prealloc", path, start_ns);
+    }
+    g_free(cpus);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -227,11 +284,10 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, &local_err);
+        host_memory_backend_prealloc(backend, ptr, sz, false, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -390,10 +446,15 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
         /* Preallocate memory after the NUMA policy has been instantiated.
          * This is necessary to guarantee memory is allocated with
          * specified NUMA policy in place.
+         *
+         * Until the machine is ready, let the preallocation run alongside
+         * the creation of the rest of the machine; qemu_machine_creation_done()
+         * waits for it.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            backend->prealloc_threads, &local_err);
+            host_memory_backend_prealloc(backend, ptr, sz,
+                                         !phase_check(PHASE_MACHINE_READY),
+                                         &local_err);
             if (local_err) {
                 goto out;
             }
@@ -0,0 +1,390 @@
+/*
+ * QEMU thread placement object
+ *
+ * Pins QEMU threads of a given role (vCPUs, IOThreads, migration...)
+ * to a set of host CPUs.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "qemu/thread-placement.h"
+#include "qapi/error.h"
+#include "qapi/qapi-builtin-visit.h"
+#include "qapi/visitor.h"
+#include "qom/object_interfaces.h"
+#include "qom/object.h"
+#include "sysemu/numa.h"
+#include "trace.h"
+
+#define TYPE_THREAD_PLACEMENT "thread-placement"
+
+OBJECT_DECLARE_SIMPLE_TYPE(ThreadPlacement, THREAD_PLACEMENT)
+
+/* host-cpus is a list of uint16 */
+#define THREAD_PLACEMENT_MAX_CPUS (UINT16_MAX + 1)
+
+struct ThreadPlacement {
+    Object parent_obj;
+
+    ThreadPlacementRole role;
+    DECLARE_BITMAP(host_cpus, THREAD_PLACEMENT_MAX_CPUS);
+    DECLARE_BITMAP(host_nodes, MAX_NODES);
+    bool avoid_smt_siblings;
+
+    bool registered;
+    /* CPUs allowed for the threads, host_cpus plus the host_nodes' CPUs */
+    unsigned long *cpus;
+    unsigned long nr_cpus;
+    /* With avoid-smt-siblings, the CPUs in the order they are handed out */
+    uint16_t *order;
+    unsigned int order_len;
+    unsigned int next;
+};
+
+/*
+ * Parse a sysfs CPU list such as "0-3,8,10-11" into @cpus.  CPUs that do
+ * not fit in THREAD_PLACEMENT_MAX_CPUS are ignored.
+ */
+static bool thread_placement_read_cpulist(const char *path,
+                                          unsigned long *cpus, Error **errp)
+{
+    g_autofree char *contents = NULL;
+    g_autoptr(GError) gerr = NULL;
+    const char *p;
+
+    if (!g_file_get_contents(path, &contents, NULL, &gerr)) {
+        error_setg(errp, "cannot read %s: %s", path, gerr->message);
+        return false;
+    }
+
+    p = g_strstrip(contents);
+    while (*p) {
+        unsigned long first, last;
+        const char *end;
+
+        if (qemu_strtoul(p, &end, 10, &first) < 0) {
+            goto invalid;
+        }
+        last = first;
+        if (*end == '-' && qemu_strtoul(end + 1, &end, 10, &last) < 0) {
+            goto invalid;
+        }
+        if (last < first || (*end && *end != ',')) {
+            goto invalid;
+        }
+        if (first < THREAD_PLACEMENT_MAX_CPUS) {
+            last = MIN(last, THREAD_PLACEMENT_MAX_CPUS - 1);
+            bitmap_set(cpus, first, last - first + 1);
+        }
+        p = *end ? end + 1 : end;
+    }
+    return true;
+
+invalid:
+    error_setg(errp, "cannot parse CPU list in %s", path);
+    return false;
+}
+
+/*
+ * Order the allowed CPUs so that the first SMT thread of every core comes
+ * before any second thread, and so on.  Handing the CPUs out in this order
+ * only puts two QEMU threads on the same core once every core has one.
+ */
+static bool thread_placement_order_cpus(ThreadPlacement *tp, Error **errp)
+{
+    g_autofree unsigned long *todo = bitmap_new(tp->nr_cpus);
+    g_autofree unsigned long *siblings = NULL;
+    unsigned long cpu;
+
+    tp->order = g_new(uint16_t, bitmap_count_one(tp->cpus, tp->nr_cpus));
+    tp->order_len = 0;
+    bitmap_copy(todo, tp->cpus, tp->nr_cpus);
+    siblings = bitmap_new(THREAD_PLACEMENT_MAX_CPUS);
+
+    while (!bitmap_empty(todo, tp->nr_cpus)) {
+        g_autofree unsigned long *round = bitmap_new(tp->nr_cpus);
+
+        /* Take the lowest remaining CPU of each core */
+        for (cpu = find_first_bit(todo, tp->nr_cpus); cpu < tp->nr_cpus;
+             cpu = find_next_bit(todo, tp->nr_cpus, cpu + 1)) {
+            g_autofree char *path = NULL;
+
+            /* A sibling of this CPU was already taken in this round */
+            if (test_bit(cpu, round)) {
+                continue;
+            }
+
+            path = g_strdup_printf(
+                "/sys/devices/system/cpu/cpu%lu/topology/thread_siblings_list",
+                cpu);
+            bitmap_zero(siblings, THREAD_PLACEMENT_MAX_CPUS);
+            if (!thread_placement_read_cpulist(path, siblings, errp)) {
+                return false;
+            }
+            bitmap_and(siblings, siblings, todo, tp->nr_cpus);
+            bitmap_or(round, round, siblings, tp->nr_cpus);
+            clear_bit(cpu, todo);
+            tp->order[tp->order_len++] = cpu;
+        }
+    }
+    return true;
+}
+
+static void thread_placement_place(QemuThread *thread, void *opaque)
+{
+    ThreadPlacement *tp = opaque;
+    const char *role = ThreadPlacementRole_str(tp->role);
+    int ret;
+
+    if (tp->avoid_smt_siblings) {
+        g_autofree unsigned long *cpu = bitmap_new(tp->nr_cpus);
+        uint16_t host_cpu = tp->order[tp->next];
+
+        tp->next = (tp->next + 1) % tp->order_len;
+        set_bit(host_cpu, cpu);
+        ret = qemu_thread_set_affinity(thread, cpu, tp->nr_cpus);
+        trace_thread_placement_pin(role, host_cpu, ret);
+    } else {
+        ret = qemu_thread_set_affinity(thread, tp->cpus, tp->nr_cpus);
+        trace_thread_placement_pin(role, -1, ret);
+    }
+
+    if (ret < 0) {
+        /* Not fatal, the thread simply runs unpinned */
+        warn_report_once("thread-placement: cannot set affinity of %s "
+                         "thread: %s", role, strerror(-ret));
+    }
+}
+
+static bool thread_placement_check_change(ThreadPlacement *tp,
+                                          const char *name, Error **errp)
+{
+    if (tp->registered) {
+        error_setg(errp, "cannot change property '%s' of %s", name,
+                   TYPE_THREAD_PLACEMENT);
+        return false;
+    }
+    return true;
+}
+
+static int thread_placement_get_role(Object *obj, Error **errp)
+{
+    return THREAD_PLACEMENT(obj)->role;
+}
+
+static void thread_placement_set_role(Object *obj, int value, Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    if (thread_placement_check_change(tp, "role", errp)) {
+        tp->role = value;
+    }
+}
+
+static void thread_placement_get_list(unsigned long *bitmap,
+                                      unsigned long nbits, Visitor *v,
+                                      const char *name, Error **errp)
+{
+    uint16List *list = NULL;
+    uint16List **tail = &list;
+    unsigned long value;
+
+    for (value = find_first_bit(bitmap, nbits); value < nbits;
+         value = find_next_bit(bitmap, nbits, value + 1)) {
+        QAPI_LIST_APPEND(tail, value);
+    }
+
+    visit_type_uint16List(v, name, &list, errp);
+    qapi_free_uint16List(list);
+}
+
+static void thread_placement_set_list(unsigned long *bitmap,
+                                      unsigned long nbits, Visitor *v,
+                                      const char *name, Error **errp)
+{
+    uint16List *l, *list = NULL;
+
+    if (!visit_type_uint16List(v, name, &list, errp)) {
+        return;
+    }
+
+    for (l = list; l; l = l->next) {
+        if (l->value >= nbits) {
+            error_setg(errp, "Invalid %s value: %d", name, l->value);
+            goto out;
+        }
+    }
+
+    bitmap_zero(bitmap, nbits);
+    for (l = list; l; l = l->next) {
+        set_bit(l->value, bitmap);
+    }
+
+out:
+    qapi_free_uint16List(list);
+}
+
+static void thread_placement_get_host_cpus(Object *obj, Visitor *v,
+                                           const char *name, void *opaque,
+                                           Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    thread_placement_get_list(tp->host_cpus, THREAD_PLACEMENT_MAX_CPUS,
+                              v, name, errp);
+}
+
+static void thread_placement_set_host_cpus(Object *obj, Visitor *v,
+                                           const char *name, void *opaque,
+                                           Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    if (thread_placement_check_change(tp, name, errp)) {
+        thread_placement_set_list(tp->host_cpus, THREAD_PLACEMENT_MAX_CPUS,
+                                  v, name, errp);
+    }
+}
+
+static void thread_placement_get_host_nodes(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    thread_placement_get_list(tp->host_nodes, MAX_NODES, v, name, errp);
+}
+
+static void thread_placement_set_host_nodes(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    if (thread_placement_check_change(tp, name, errp)) {
+        thread_placement_set_list(tp->host_nodes, MAX_NODES, v, name, errp);
+    }
+}
+
+static bool thread_placement_get_avoid_smt_siblings(Object *obj,
+                                                    Error **errp)
+{
+    return THREAD_PLACEMENT(obj)->avoid_smt_siblings;
+}
+
+static void thread_placement_set_avoid_smt_siblings(Object *obj, bool value,
+                                                    Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    if (thread_placement_check_change(tp, "avoid-smt-siblings", errp)) {
+        tp->avoid_smt_siblings = value;
+    }
+}
+
+static void thread_placement_complete(UserCreatable *uc, Error **errp)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(uc);
+    g_autofree unsigned long *cpus = bitmap_new(THREAD_PLACEMENT_MAX_CPUS);
+    unsigned long node;
+
+    bitmap_copy(cpus, tp->host_cpus, THREAD_PLACEMENT_MAX_CPUS);
+    for (node = find_first_bit(tp->host_nodes, MAX_NODES); node < MAX_NODES;
+         node = find_next_bit(tp->host_nodes, MAX_NODES, node + 1)) {
+        g_autofree char *path = g_strdup_printf(
+            "/sys/devices/system/node/node%lu/cpulist", node);
+
+        if (!thread_placement_read_cpulist(path, cpus, errp)) {
+            return;
+        }
+    }
+
+    if (bitmap_empty(cpus, THREAD_PLACEMENT_MAX_CPUS)) {
+        error_setg(errp, "thread-placement: no host CPUs selected; "
+                   "set 'host-cpus' or 'host-nodes'");
+        return;
+    }
+
+    tp->nr_cpus = find_last_bit(cpus, THREAD_PLACEMENT_MAX_CPUS) + 1;
+    tp->cpus = bitmap_new(tp->nr_cpus);
+    bitmap_copy(tp->cpus, cpus, tp->nr_cpus);
+
+    if (tp->avoid_smt_siblings && !thread_placement_order_cpus(tp, errp)) {
+        return;
+    }
+
+    if (!qemu_thread_placement_register(tp->role, thread_placement_place,
+                                        tp)) {
+        error_setg(errp, "thread placement for '%s' threads is already "
+                   "configured", ThreadPlacementRole_str(tp->role));
+        return;
+    }
+    tp->registered = true;
+}
+
+static void thread_placement_finalize(Object *obj)
+{
+    ThreadPlacement *tp = THREAD_PLACEMENT(obj);
+
+    if (tp->registered) {
+        qemu_thread_placement_unregister(tp->role, tp);
+    }
+    g_free(tp->cpus);
+    g_free(tp->order);
+}
+
+static void thread_placement_class_init(ObjectClass *oc, void *data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
+
+    ucc->complete = thread_placement_complete;
+
+    object_class_property_add_enum(oc, "role", "ThreadPlacementRole",
+                                   &ThreadPlacementRole_lookup,
+                                   thread_placement_get_role,
+                                   thread_placement_set_role);
+    object_class_property_set_description(oc, "role",
+        "The kind of threads to place");
+    object_class_property_add(oc, "host-cpus", "int",
+                              thread_placement_get_host_cpus,
+                              thread_placement_set_host_cpus,
+                              NULL, NULL);
+    object_class_property_set_description(oc, "host-cpus",
+        "The list of host CPUs the threads may run on");
+    object_class_property_add(oc, "host-nodes", "int",
+                              thread_placement_get_host_nodes,
+                              thread_placement_set_host_nodes,
+                              NULL, NULL);
+    object_class_property_set_description(oc, "host-nodes",
+        "The list of NUMA host nodes whose CPUs the threads may run on");
+    object_class_property_add_bool(oc, "avoid-smt-siblings",
+                                   thread_placement_get_avoid_smt_siblings,
+                                   thread_placement_set_avoid_smt_siblings);
+    object_class_property_set_description(oc, "avoid-smt-siblings",
+        "Pin each thread to its own physical core while cores are left");
+}
+
+static const TypeInfo thread_placement_info = {
+    .name = TYPE_THREAD_PLACEMENT,
+    .parent = TYPE_OBJECT,
+    .class_init = thread_placement_class_init,
+    .instance_size = sizeof(ThreadPlacement),
+    .instance_finalize = thread_placement_finalize,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    }
+};
+
+static void register_types(void)
+{
+    type_register_static(&thread_placement_info);
+}
+
+type_init(register_types);
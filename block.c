@@ -49,6 +49,7 @@
 #include "qemu/timer.h"
 #include "qemu/cutils.h"
 #include "qemu/id.h"
+#include "qemu/range.h"
 #include "block/coroutines.h"
 
 #ifdef CONFIG_BSD
@@ -399,8 +400,12 @@ BlockDriverState *bdrv_new(void)
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
+    qemu_co_queue_init(&bs->untracked_queue);
     qemu_co_queue_init(&bs->flush_queue);
 
+    qemu_mutex_init(&bs->bsc_modify_lock);
+    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
     }
@@ -4643,6 +4648,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->total_sectors = 0;
     bs->encrypted = false;
     bs->sg = false;
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
     qobject_unref(bs->options);
     qobject_unref(bs->explicit_options);
     bs->options = NULL;
@@ -5016,6 +5022,8 @@ static void bdrv_delete(BlockDriverState *bs)
 
     bdrv_close(bs);
 
+    qemu_mutex_destroy(&bs->bsc_modify_lock);
+    g_free(bs->block_status_cache);
     g_free(bs);
 }
 
@@ -6161,6 +6169,9 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
      * of the image is tried.
      */
     if (bs->open_flags & BDRV_O_INACTIVE) {
+        /* Another process may have written to the image */
+        bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
         bs->open_flags &= ~BDRV_O_INACTIVE;
         ret = bdrv_refresh_perms(bs, errp);
         if (ret < 0) {
@@ -7620,3 +7631,64 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
 {
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
+
+/*
+ * Returns true if [offset, offset + bytes) overlaps with the cached
+ * data region.  Must be called under an RCU read guard.
+ */
+static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
+                                           int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
+
+    /* qatomic_read() because valid may be cleared by an invalidation */
+    return qatomic_read(&bsc->valid) &&
+        ranges_overlap(offset, bytes, bsc->data_start,
+                       bsc->data_end - bsc->data_start);
+}
+
+bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
+{
+    BdrvBlockStatusCache *bsc;
+    bool overlaps;
+
+    RCU_READ_LOCK_GUARD();
+
+    bsc = qatomic_rcu_read(&bs->block_status_cache);
+    overlaps = bdrv_bsc_range_overlaps_locked(bs, offset, 1);
+    if (overlaps && pnum) {
+        *pnum = bsc->data_end - offset;
+    }
+
+    return overlaps;
+}
+
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes)
+{
+    RCU_READ_LOCK_GUARD();
+
+    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes)) {
+        qatomic_set(&qatomic_rcu_read(&bs->block_status_cache)->valid, false);
+    }
+}
+
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
+    BdrvBlockStatusCache *old_bsc;
+
+    *new_bsc = (BdrvBlockStatusCache) {
+        .valid = true,
+        .data_start = offset,
+        .data_end = offset + bytes,
+    };
+
+    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+
+    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
+    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
+    if (old_bsc) {
+        g_free_rcu(old_bsc, rcu);
+    }
+}
@@ -27,6 +27,7 @@
 #include "block/accounting.h"
 #include "block/block_int.h"
 #include "qemu/timer.h"
+#include "qemu/units.h"
 #include "sysemu/qtest.h"
 
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
@@ -53,6 +54,7 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    g_free(stats->hdr);
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -180,6 +182,139 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
         g_free(hist->boundaries);
         memset(hist, 0, sizeof(*hist));
     }
+    block_hdr_histograms_enable(stats, false);
+}
+
+/*
+ * Enabling resets the log-linear histograms.  They are allocated and
+ * freed under @lock because requests in an iothread account into them.
+ */
+void block_hdr_histograms_enable(BlockAcctStats *stats, bool enable)
+{
+    BlockHdrHistograms *hdr = enable ? g_new0(BlockHdrHistograms, 1) : NULL;
+
+    WITH_QEMU_LOCK_GUARD(&stats->lock) {
+        g_free(stats->hdr);
+        qatomic_set(&stats->hdr, hdr);
+    }
+}
+
+static unsigned block_hdr_histogram_index(int64_t latency_ns)
+{
+    unsigned shift;
+
+    if (latency_ns < (1LL << BLOCK_HDR_MIN_SHIFT)) {
+        return 0;
+    }
+    shift = 63 - clz64(latency_ns);
+    if (shift >= BLOCK_HDR_MAX_SHIFT) {
+        return BLOCK_HDR_NBINS - 1;
+    }
+    return 1 + ((shift - BLOCK_HDR_MIN_SHIFT) << BLOCK_HDR_SUB_BITS) +
+           ((latency_ns >> (shift - BLOCK_HDR_SUB_BITS)) &
+            ((1 << BLOCK_HDR_SUB_BITS) - 1));
+}
+
+/* The upper bound of bin @i, which is the lower bound of bin @i + 1 */
+static uint64_t block_hdr_histogram_boundary(unsigned i)
+{
+    unsigned shift = BLOCK_HDR_MIN_SHIFT + (i >> BLOCK_HDR_SUB_BITS);
+    uint64_t sub = i & ((1 << BLOCK_HDR_SUB_BITS) - 1);
+
+    return (1ULL << shift) + (sub << (shift - BLOCK_HDR_SUB_BITS));
+}
+
+/* The BLOCK_HDR_NBINS - 1 boundaries, to be freed with g_free() */
+uint64_t *block_hdr_histogram_boundaries(void)
+{
+    uint64_t *boundaries = g_new(uint64_t, BLOCK_HDR_NBINS - 1);
+    unsigned i;
+
+    for (i = 0; i < BLOCK_HDR_NBINS - 1; i++) {
+        boundaries[i] = block_hdr_histogram_boundary(i);
+    }
+    return boundaries;
+}
+
+/*
+ * Return an upper bound of the @permille-th permille of the latencies
+ * in @bins, or 0 if @bins is empty.  The last bin is unbounded, so its
+ * lower bound is returned instead.
+ */
+uint64_t block_hdr_histogram_percentile(const uint64_t *bins,
+                                        unsigned permille)
+{
+    uint64_t total = 0, rank, count = 0;
+    unsigned i;
+
+    for (i = 0; i < BLOCK_HDR_NBINS; i++) {
+        total += bins[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    rank = DIV_ROUND_UP(total * permille, 1000);
+    for (i = 0; i < BLOCK_HDR_NBINS - 2; i++) {
+        count += bins[i];
+        if (count >= rank) {
+            break;
+        }
+    }
+    return block_hdr_histogram_boundary(i);
+}
+
+static enum BlockAcctSize block_acct_size(int64_t bytes)
+{
+    if (bytes <= 4 * KiB) {
+        return BLOCK_ACCT_SIZE_SMALL;
+    } else if (bytes <= 64 * KiB) {
+        return BLOCK_ACCT_SIZE_MEDIUM;
+    } else if (bytes <= MiB) {
+        return BLOCK_ACCT_SIZE_LARGE;
+    }
+    return BLOCK_ACCT_SIZE_HUGE;
+}
+
+/* Called with @lock held */
+static void block_hdr_histogram_account(BlockAcctStats *stats,
+                                        enum BlockAcctType type,
+                                        int64_t bytes,
+                                        enum BlockAcctStage stage,
+                                        int64_t latency_ns)
+{
+    if (stats->hdr) {
+        stats->hdr->bins[type][block_acct_size(bytes)][stage]
+                   [block_hdr_histogram_index(latency_ns)]++;
+    }
+}
+
+/*
+ * Return the start time of a stage of a request, or 0 if the log-linear
+ * histograms are disabled, so that no clock is read for nothing.
+ */
+int64_t block_acct_stage_start(BlockAcctStats *stats)
+{
+    if (!qatomic_read(&stats->hdr)) {
+        return 0;
+    }
+    return qemu_clock_get_ns(clock_type);
+}
+
+void block_acct_stage_done(BlockAcctStats *stats, enum BlockAcctType type,
+                           int64_t bytes, enum BlockAcctStage stage,
+                           int64_t start_ns)
+{
+    int64_t latency_ns;
+
+    if (!start_ns) {
+        return;
+    }
+
+    latency_ns = qemu_clock_get_ns(clock_type) - start_ns;
+    WITH_QEMU_LOCK_GUARD(&stats->lock) {
+        block_hdr_histogram_account(stats, type, bytes, stage, latency_ns);
+    }
 }
 
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
@@ -209,6 +344,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
         block_latency_histogram_account(&stats->latency_histogram[cookie->type],
                                         latency_ns);
+        block_hdr_histogram_account(stats, cookie->type, cookie->bytes,
+                                    BLOCK_ACCT_STAGE_TOTAL, latency_ns);
 
         if (!failed || stats->account_failed) {
             stats->total_time_ns[cookie->type] += latency_ns;
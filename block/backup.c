@@ -30,6 +30,7 @@
 #include "block/backup-top.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_MAX_SHARDS 16
 
 typedef struct BackupBlockJob {
     BlockJob common;
@@ -50,7 +51,8 @@ typedef struct BackupBlockJob {
     BlockCopyState *bcs;
 
     bool wait;
-    BlockCopyCallState *bg_bcs_call;
+    BlockCopyCallState *bg_bcs_calls[BACKUP_MAX_SHARDS];
+    int nb_bg_bcs_calls;
 } BackupBlockJob;
 
 static const BlockJobDriver backup_job_driver;
@@ -147,59 +149,136 @@ static void coroutine_fn backup_block_copy_callback(void *opaque)
     }
 }
 
+/*
+ * Start the background block-copy calls.  With x-perf.shards > 1, the image
+ * is split into that many disjoint regions that are searched for dirty
+ * clusters and copied by one call each, sharing the workers between them.
+ */
+static void coroutine_fn backup_start_calls(BackupBlockJob *job)
+{
+    int64_t len = QEMU_ALIGN_UP(job->len, job->cluster_size);
+    int shards = job->perf.shards ?: 1;
+    int64_t shard_len = QEMU_ALIGN_UP(DIV_ROUND_UP(len, shards),
+                                      job->cluster_size);
+    int max_workers = MAX(job->perf.max_workers / shards, 1);
+    int64_t offset = 0;
+
+    assert(!job->nb_bg_bcs_calls);
+    do {
+        job->bg_bcs_calls[job->nb_bg_bcs_calls++] =
+            block_copy_async(job->bcs, offset, MIN(shard_len, len - offset),
+                             max_workers, job->perf.max_chunk,
+                             backup_block_copy_callback, job);
+        offset += shard_len;
+    } while (offset < len);
+}
+
+static bool backup_calls_finished(BackupBlockJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nb_bg_bcs_calls; i++) {
+        if (!block_copy_call_finished(job->bg_bcs_calls[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool backup_calls_succeeded(BackupBlockJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nb_bg_bcs_calls; i++) {
+        if (!block_copy_call_succeeded(job->bg_bcs_calls[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static BlockCopyCallState *backup_failed_call(BackupBlockJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nb_bg_bcs_calls; i++) {
+        if (block_copy_call_failed(job->bg_bcs_calls[i])) {
+            return job->bg_bcs_calls[i];
+        }
+    }
+    return NULL;
+}
+
+/* Cancel all unfinished calls and wait for them to finish */
+static void coroutine_fn backup_cancel_calls(BackupBlockJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nb_bg_bcs_calls; i++) {
+        if (!block_copy_call_finished(job->bg_bcs_calls[i])) {
+            block_copy_call_cancel(job->bg_bcs_calls[i]);
+        }
+    }
+
+    /*
+     * Note that we can't use job_yield() here, as it doesn't work for
+     * cancelled job.
+     */
+    while (!backup_calls_finished(job)) {
+        job->wait = true;
+        qemu_coroutine_yield();
+    }
+}
+
+static void backup_free_calls(BackupBlockJob *job)
+{
+    while (job->nb_bg_bcs_calls) {
+        block_copy_call_free(job->bg_bcs_calls[--job->nb_bg_bcs_calls]);
+    }
+}
+
 static int coroutine_fn backup_loop(BackupBlockJob *job)
 {
-    BlockCopyCallState *s = NULL;
+    BlockCopyCallState *s;
     int ret = 0;
     bool error_is_read;
     BlockErrorAction act;
 
     while (true) { /* retry loop */
-        job->bg_bcs_call = s = block_copy_async(job->bcs, 0,
-                QEMU_ALIGN_UP(job->len, job->cluster_size),
-                job->perf.max_workers, job->perf.max_chunk,
-                backup_block_copy_callback, job);
+        backup_start_calls(job);
 
-        while (!block_copy_call_finished(s) &&
+        while (!backup_calls_finished(job) &&
                !job_is_cancelled(&job->common.job))
         {
             job_yield(&job->common.job);
         }
 
-        if (!block_copy_call_finished(s)) {
+        if (!backup_calls_finished(job)) {
             assert(job_is_cancelled(&job->common.job));
-            /*
-             * Note that we can't use job_yield() here, as it doesn't work for
-             * cancelled job.
-             */
-            block_copy_call_cancel(s);
-            job->wait = true;
-            qemu_coroutine_yield();
-            assert(block_copy_call_finished(s));
+            backup_cancel_calls(job);
             ret = 0;
             goto out;
         }
 
         if (job_is_cancelled(&job->common.job) ||
-            block_copy_call_succeeded(s))
+            backup_calls_succeeded(job))
         {
             ret = 0;
             goto out;
         }
 
-        if (block_copy_call_cancelled(s)) {
+        s = backup_failed_call(job);
+        if (!s) {
             /*
-             * Job is not cancelled but only block-copy call. This is possible
+             * Job is not cancelled but only block-copy calls. This is possible
              * after job pause. Now the pause is finished, start new block-copy
              * iteration.
              */
-            block_copy_call_free(s);
+            backup_free_calls(job);
             continue;
         }
 
-        /* The only remaining case is failed block-copy call. */
-        assert(block_copy_call_failed(s));
-
+        /* The only remaining case is a failed block-copy call. */
         ret = block_copy_call_status(s, &error_is_read);
         act = backup_error_action(job, error_is_read, -ret);
         switch (act) {
@@ -219,12 +298,11 @@ static int coroutine_fn backup_loop(BackupBlockJob *job)
             abort();
         }
 
-        block_copy_call_free(s);
+        backup_free_calls(job);
     }
 
 out:
-    block_copy_call_free(s);
-    job->bg_bcs_call = NULL;
+    backup_free_calls(job);
     return ret;
 }
 
@@ -308,11 +386,7 @@ static void coroutine_fn backup_pause(Job *job)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
 
-    if (s->bg_bcs_call && !block_copy_call_finished(s->bg_bcs_call)) {
-        block_copy_call_cancel(s->bg_bcs_call);
-        s->wait = true;
-        qemu_coroutine_yield();
-    }
+    backup_cancel_calls(s);
 }
 
 static void coroutine_fn backup_set_speed(BlockJob *job, int64_t speed)
@@ -324,9 +398,11 @@ static void coroutine_fn backup_set_speed(BlockJob *job, int64_t speed)
      * don't yet have s->bcs.
      */
     if (s->bcs) {
+        int i;
+
         block_copy_set_speed(s->bcs, speed);
-        if (s->bg_bcs_call) {
-            block_copy_kick(s->bg_bcs_call);
+        for (i = 0; i < s->nb_bg_bcs_calls; i++) {
+            block_copy_kick(s->bg_bcs_calls[i]);
         }
     }
 }
@@ -465,6 +541,18 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (perf->shards < 0 || perf->shards > BACKUP_MAX_SHARDS) {
+        error_setg(errp, "shards must be between 0 (which means 1) and %d",
+                   BACKUP_MAX_SHARDS);
+        return NULL;
+    }
+
+    if (perf->weight < 0 || perf->weight > UINT32_MAX) {
+        error_setg(errp, "weight must be zero (which means default) or "
+                   "positive");
+        return NULL;
+    }
+
     if (perf->max_chunk && perf->max_chunk < cluster_size) {
         error_setg(errp, "Required max-chunk (%" PRIi64 ") is less than backup "
                    "cluster size (%" PRIi64 ")", perf->max_chunk, cluster_size);
@@ -551,6 +639,9 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
 
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
+    if (perf->weight) {
+        block_copy_set_weight(bcs, perf->weight);
+    }
 
     /* Required permissions are already taken by backup-top target */
     block_job_add_bdrv(&job->common, "target", target, 0, BLK_PERM_ALL,
@@ -1201,6 +1201,7 @@ blk_do_preadv(BlockBackend *blk, int64_t offset, unsigned int bytes,
               QEMUIOVector *qiov, BdrvRequestFlags flags)
 {
     int ret;
+    int64_t start_ns;
     BlockDriverState *bs;
 
     blk_wait_while_drained(blk);
@@ -1218,11 +1219,17 @@ blk_do_preadv(BlockBackend *blk, int64_t offset, unsigned int bytes,
 
     /* throttling disk I/O */
     if (blk->public.throttle_group_member.throttle_state) {
+        start_ns = block_acct_stage_start(&blk->stats);
         throttle_group_co_io_limits_intercept(&blk->public.throttle_group_member,
                 bytes, false);
+        block_acct_stage_done(&blk->stats, BLOCK_ACCT_READ, bytes,
+                              BLOCK_ACCT_STAGE_THROTTLE, start_ns);
     }
 
+    start_ns = block_acct_stage_start(&blk->stats);
     ret = bdrv_co_preadv(blk->root, offset, bytes, qiov, flags);
+    block_acct_stage_done(&blk->stats, BLOCK_ACCT_READ, bytes,
+                          BLOCK_ACCT_STAGE_DRIVER, start_ns);
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1247,6 +1254,7 @@ blk_do_pwritev_part(BlockBackend *blk, int64_t offset, unsigned int bytes,
                     BdrvRequestFlags flags)
 {
     int ret;
+    int64_t start_ns;
     BlockDriverState *bs;
 
     blk_wait_while_drained(blk);
@@ -1263,16 +1271,22 @@ blk_do_pwritev_part(BlockBackend *blk, int64_t offset, unsigned int bytes,
     bdrv_inc_in_flight(bs);
     /* throttling disk I/O */
     if (blk->public.throttle_group_member.throttle_state) {
+        start_ns = block_acct_stage_start(&blk->stats);
         throttle_group_co_io_limits_intercept(&blk->public.throttle_group_member,
                 bytes, true);
+        block_acct_stage_done(&blk->stats, BLOCK_ACCT_WRITE, bytes,
+                              BLOCK_ACCT_STAGE_THROTTLE, start_ns);
     }
 
     if (!blk->enable_write_cache) {
         flags |= BDRV_REQ_FUA;
     }
 
+    start_ns = block_acct_stage_start(&blk->stats);
     ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov, qiov_offset,
                                flags);
+    block_acct_stage_done(&blk->stats, BLOCK_ACCT_WRITE, bytes,
+                          BLOCK_ACCT_STAGE_DRIVER, start_ns);
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -27,6 +27,8 @@
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
+#define BLOCK_COPY_CBW_BACKOFF_NS 1000000ULL /* ns */
+#define BLOCK_COPY_DEFAULT_WEIGHT 100
 
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
@@ -156,8 +158,99 @@ typedef struct BlockCopyState {
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+
+    /* Protected by block_copy_sched.lock */
+    uint64_t speed; /* set by block_copy_set_speed() */
+    uint32_t weight;
+    int background_calls; /* running block-copy calls that are rate limited */
+    QLIST_ENTRY(BlockCopyState) sched_list;
 } BlockCopyState;
 
+/*
+ * State shared by all BlockCopyState instances, which may be in different
+ * AioContexts.
+ *
+ * Calls that ignore the rate limit are copy-before-write operations that
+ * block a guest write.  While any of them is running, background copies
+ * back off before they start a new task.
+ *
+ * If a global speed is set, it is divided between the states that have
+ * background calls running, in proportion to their weight.  A state's own
+ * speed still applies if it is lower than its share.
+ */
+static struct {
+    QemuMutex lock;
+    uint64_t speed;
+    uint64_t active_weight;
+    QLIST_HEAD(, BlockCopyState) states;
+    int cbw_in_flight; /* atomic */
+} block_copy_sched;
+
+static void __attribute__((__constructor__)) block_copy_sched_init(void)
+{
+    qemu_mutex_init(&block_copy_sched.lock);
+    QLIST_INIT(&block_copy_sched.states);
+}
+
+/* Called with block_copy_sched.lock held */
+static void block_copy_sched_update_speed(BlockCopyState *s)
+{
+    uint64_t speed = s->speed;
+
+    if (block_copy_sched.speed && s->background_calls) {
+        uint64_t share = (double)block_copy_sched.speed * s->weight /
+                         block_copy_sched.active_weight;
+
+        speed = MIN_NON_ZERO(speed, MAX(share, 1));
+    }
+    ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
+}
+
+/* Called with block_copy_sched.lock held */
+static void block_copy_sched_update_all(void)
+{
+    BlockCopyState *s;
+
+    QLIST_FOREACH(s, &block_copy_sched.states, sched_list) {
+        if (s->background_calls) {
+            block_copy_sched_update_speed(s);
+        }
+    }
+}
+
+static void block_copy_sched_call_start(BlockCopyCallState *call_state)
+{
+    BlockCopyState *s = call_state->s;
+
+    if (call_state->ignore_ratelimit) {
+        qatomic_inc(&block_copy_sched.cbw_in_flight);
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&block_copy_sched.lock);
+    if (!s->background_calls++) {
+        block_copy_sched.active_weight += s->weight;
+        block_copy_sched_update_all();
+    }
+}
+
+static void block_copy_sched_call_end(BlockCopyCallState *call_state)
+{
+    BlockCopyState *s = call_state->s;
+
+    if (call_state->ignore_ratelimit) {
+        qatomic_dec(&block_copy_sched.cbw_in_flight);
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&block_copy_sched.lock);
+    if (!--s->background_calls) {
+        block_copy_sched.active_weight -= s->weight;
+        block_copy_sched_update_speed(s);
+        block_copy_sched_update_all();
+    }
+}
+
 /* Called with lock held */
 static BlockCopyTask *find_conflicting_task(BlockCopyState *s,
                                             int64_t offset, int64_t bytes)
@@ -302,6 +395,11 @@ void block_copy_state_free(BlockCopyState *s)
         return;
     }
 
+    WITH_QEMU_LOCK_GUARD(&block_copy_sched.lock) {
+        assert(!s->background_calls);
+        QLIST_REMOVE(s, sched_list);
+    }
+
     ratelimit_destroy(&s->rate_limit);
     bdrv_release_dirty_bitmap(s->copy_bitmap);
     shres_destroy(s->mem);
@@ -341,6 +439,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
+        .weight = BLOCK_COPY_DEFAULT_WEIGHT,
     };
 
     if (s->max_transfer < cluster_size) {
@@ -367,6 +466,10 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     QLIST_INIT(&s->tasks);
     QLIST_INIT(&s->calls);
 
+    WITH_QEMU_LOCK_GUARD(&block_copy_sched.lock) {
+        QLIST_INSERT_HEAD(&block_copy_sched.states, s, sched_list);
+    }
+
     return s;
 }
 
@@ -672,6 +775,14 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         BlockCopyTask *task;
         int64_t status_bytes;
 
+        if (!call_state->ignore_ratelimit &&
+            qatomic_read(&block_copy_sched.cbw_in_flight)) {
+            trace_block_copy_cbw_backoff(s, offset);
+            qemu_co_sleep_ns_wakeable(&call_state->sleep, QEMU_CLOCK_REALTIME,
+                                      BLOCK_COPY_CBW_BACKOFF_NS);
+            continue;
+        }
+
         task = block_copy_task_create(s, call_state, offset, bytes);
         if (!task) {
             /* No more dirty bits in the bitmap */
@@ -777,6 +888,8 @@ static int coroutine_fn block_copy_common(BlockCopyCallState *call_state)
     QLIST_INSERT_HEAD(&s->calls, call_state, list);
     qemu_co_mutex_unlock(&s->lock);
 
+    block_copy_sched_call_start(call_state);
+
     do {
         ret = block_copy_dirty_clusters(call_state);
 
@@ -818,6 +931,8 @@ static int coroutine_fn block_copy_common(BlockCopyCallState *call_state)
          */
     } while (ret > 0 && !qatomic_read(&call_state->cancelled));
 
+    block_copy_sched_call_end(call_state);
+
     qatomic_store_release(&call_state->finished, true);
 
     if (call_state->cb) {
@@ -940,7 +1055,10 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
-    ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
+    WITH_QEMU_LOCK_GUARD(&block_copy_sched.lock) {
+        s->speed = speed;
+        block_copy_sched_update_speed(s);
+    }
 
     /*
      * Note: it's good to kick all call states from here, but it should be done
@@ -949,3 +1067,23 @@ void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
      * only one call_state by hand.
      */
 }
+
+void block_copy_set_weight(BlockCopyState *s, uint32_t weight)
+{
+    assert(weight > 0);
+
+    QEMU_LOCK_GUARD(&block_copy_sched.lock);
+    if (s->background_calls) {
+        block_copy_sched.active_weight += weight;
+        block_copy_sched.active_weight -= s->weight;
+    }
+    s->weight = weight;
+    block_copy_sched_update_all();
+}
+
+void block_copy_set_global_speed(uint64_t speed)
+{
+    QEMU_LOCK_GUARD(&block_copy_sched.lock);
+    block_copy_sched.speed = speed;
+    block_copy_sched_update_all();
+}
@@ -21,6 +21,7 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/ratelimit.h"
 #include "sysemu/block-backend.h"
+#include "block/aio_task.h"
 
 enum {
     /*
@@ -29,8 +30,20 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Number of chunks that are copied in parallel */
+    COMMIT_MAX_WORKERS = 8,
 };
 
+/* A chunk that failed to be copied in the background */
+typedef struct CommitFailedChunk {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    bool error_in_source;
+    QSIMPLEQ_ENTRY(CommitFailedChunk) next;
+} CommitFailedChunk;
+
 typedef struct CommitBlockJob {
     BlockJob common;
     BlockDriverState *commit_top_bs;
@@ -42,6 +55,10 @@ typedef struct CommitBlockJob {
     bool base_read_only;
     bool chain_frozen;
     char *backing_file_str;
+
+    /* Chunks that failed, and those to copy again after resuming */
+    QSIMPLEQ_HEAD(, CommitFailedChunk) failed;
+    QSIMPLEQ_HEAD(, CommitFailedChunk) retry;
 } CommitBlockJob;
 
 static int commit_prepare(Job *job)
@@ -112,14 +129,112 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
+typedef struct CommitTask {
+    AioTask task;
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} CommitTask;
+
+static int coroutine_fn commit_task_entry(AioTask *task)
+{
+    CommitTask *t = container_of(task, CommitTask, task);
+    CommitBlockJob *s = t->s;
+    QEMU_AUTO_VFREE void *buf = blk_blockalign(s->top, t->bytes);
+    bool error_in_source = true;
+    int ret;
+
+    assert(t->bytes < SIZE_MAX);
+
+    ret = blk_co_pread(s->top, t->offset, t->bytes, buf, 0);
+    if (ret >= 0) {
+        /* Don't allocate data clusters in the base for zeroes */
+        if (buffer_is_zero(buf, t->bytes)) {
+            ret = blk_co_pwrite_zeroes(s->base, t->offset, t->bytes, 0);
+        } else {
+            ret = blk_co_pwrite(s->base, t->offset, t->bytes, buf, 0);
+        }
+        if (ret < 0) {
+            error_in_source = false;
+        }
+    }
+
+    if (ret < 0) {
+        CommitFailedChunk *c = g_new(CommitFailedChunk, 1);
+
+        *c = (CommitFailedChunk) {
+            .offset = t->offset,
+            .bytes = t->bytes,
+            .ret = ret,
+            .error_in_source = error_in_source,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failed, c, next);
+        return ret;
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    return 0;
+}
+
+static void coroutine_fn commit_copy_chunk(CommitBlockJob *s,
+                                           AioTaskPool *pool,
+                                           int64_t offset, int64_t bytes)
+{
+    CommitTask *t = g_new(CommitTask, 1);
+
+    *t = (CommitTask) {
+        .task.func = commit_task_entry,
+        .s = s,
+        .offset = offset,
+        .bytes = bytes,
+    };
+    aio_task_pool_start_task(pool, &t->task);
+}
+
+/*
+ * Apply the error policy to the chunks that failed in the background.
+ * Chunks that aren't reported are copied again once the job is resumed.
+ * Returns the error to report, or 0 if the job goes on.
+ */
+static int coroutine_fn commit_handle_failed(CommitBlockJob *s,
+                                             AioTaskPool *pool)
+{
+    CommitFailedChunk *c;
+    int ret = 0;
+
+    aio_task_pool_wait_all(pool);
+
+    while ((c = QSIMPLEQ_FIRST(&s->failed))) {
+        BlockErrorAction action;
+
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        if (ret < 0) {
+            g_free(c);
+            continue;
+        }
+
+        action = block_job_error_action(&s->common, s->on_error,
+                                        c->error_in_source, -c->ret);
+        if (action == BLOCK_ERROR_ACTION_REPORT) {
+            ret = c->ret;
+            g_free(c);
+        } else {
+            QSIMPLEQ_INSERT_TAIL(&s->retry, c, next);
+        }
+    }
+
+    return ret;
+}
+
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
-    int64_t offset;
+    AioTaskPool *pool;
+    CommitFailedChunk *c;
+    int64_t offset = 0;
     uint64_t delay_ns = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    QEMU_AUTO_VFREE void *buf = NULL;
     int64_t len, base_len;
 
     len = blk_getlength(s->top);
@@ -140,57 +255,94 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    QSIMPLEQ_INIT(&s->failed);
+    QSIMPLEQ_INIT(&s->retry);
+
+    /*
+     * Chunks are copied by up to COMMIT_MAX_WORKERS tasks, while this
+     * coroutine looks up the allocation status of the next ones.
+     */
+    pool = aio_task_pool_new(COMMIT_MAX_WORKERS);
 
-    for (offset = 0; offset < len; offset += n) {
+    while (true) {
         bool copy;
-        bool error_in_source = true;
+
+        if (!QSIMPLEQ_EMPTY(&s->failed)) {
+            ret = commit_handle_failed(s, pool);
+            if (ret < 0) {
+                break;
+            }
+        }
+
+        if (offset >= len && QSIMPLEQ_EMPTY(&s->retry)) {
+            /* The last chunks may still fail */
+            aio_task_pool_wait_all(pool);
+            if (QSIMPLEQ_EMPTY(&s->failed)) {
+                ret = 0;
+                break;
+            }
+            continue;
+        }
 
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.  Chunks that are still
+         * being copied are requests on our BlockBackends, which draining
+         * waits for.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
+            ret = 0;
             break;
         }
+
+        c = QSIMPLEQ_FIRST(&s->retry);
+        if (c) {
+            QSIMPLEQ_REMOVE_HEAD(&s->retry, next);
+            commit_copy_chunk(s, pool, c->offset, c->bytes);
+            delay_ns = block_job_ratelimit_get_delay(&s->common, c->bytes);
+            g_free(c);
+            continue;
+        }
+
         /* Copy if allocated above the base */
         ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay, true,
                                       offset, COMMIT_BUFFER_SIZE, &n);
         copy = (ret > 0);
         trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            assert(n < SIZE_MAX);
-
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
-            if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
-                }
-            }
-        }
         if (ret < 0) {
             BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error,
-                                       error_in_source, -ret);
+                block_job_error_action(&s->common, s->on_error, true, -ret);
             if (action == BLOCK_ERROR_ACTION_REPORT) {
-                return ret;
+                break;
             } else {
-                n = 0;
                 continue;
             }
         }
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
 
         if (copy) {
+            commit_copy_chunk(s, pool, offset, n);
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
+            /* Publish progress */
+            job_progress_update(&s->common.job, n);
             delay_ns = 0;
         }
+        offset += n;
     }
 
-    return 0;
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+
+    while ((c = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(c);
+    }
+    while ((c = QSIMPLEQ_FIRST(&s->retry))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->retry, next);
+        g_free(c);
+    }
+
+    return ret;
 }
 
 static const BlockJobDriver commit_job_driver = {
@@ -22,6 +22,8 @@
 
 #include "block/block_int.h"
 #include "block/qdict.h"
+#include "block/aio_task.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -31,13 +33,26 @@
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "crypto.h"
 
+/* Number of ciphers, i.e. of chunks that are encrypted in parallel */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+/* Number of chunks of a request that are in flight */
+#define BLOCK_CRYPTO_MAX_WORKERS 8
+/* Requests are split in chunks of this size */
+#define BLOCK_CRYPTO_CHUNK_SIZE (256 * KiB)
+
 typedef struct BlockCrypto BlockCrypto;
 
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
+
+    /* Limits the jobs in the thread pool to the number of ciphers */
+    CoMutex lock;
+    CoQueue thread_task_queue;
+    int nb_threads;
 };
 
 
@@ -274,6 +289,9 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     bs->supported_write_flags = BDRV_REQ_FUA &
         bs->file->bs->supported_write_flags;
 
+    qemu_co_mutex_init(&crypto->lock);
+    qemu_co_queue_init(&crypto->thread_task_queue);
+
     opts = qemu_opts_create(opts_spec, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         goto cleanup;
@@ -294,7 +312,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -390,65 +408,172 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
     return 0;
 }
 
+typedef struct BlockCryptoEncDecData {
+    QCryptoBlock *block;
+    uint64_t offset;
+    QEMUIOVector *qiov;
+    bool encrypt;
+} BlockCryptoEncDecData;
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+    uint64_t offset = data->offset;
+    int i;
+
+    for (i = 0; i < data->qiov->niov; i++) {
+        struct iovec *iov = &data->qiov->iov[i];
+        int ret;
+
+        if (data->encrypt) {
+            ret = qcrypto_block_encrypt(data->block, offset, iov->iov_base,
+                                        iov->iov_len, NULL);
+        } else {
+            ret = qcrypto_block_decrypt(data->block, offset, iov->iov_base,
+                                        iov->iov_len, NULL);
+        }
+        if (ret < 0) {
+            return -EIO;
+        }
+        offset += iov->iov_len;
+    }
+    return 0;
+}
+
 /*
- * 1 MB bounce buffer gives good performance / memory tradeoff
- * when using cache=none|directsync.
+ * Encrypt or decrypt in place the sectors at @offset, whose data is in
+ * @qiov.  Each element of @qiov must be a whole number of sectors.  The
+ * work is done in the thread pool, so that the chunks of a request, or
+ * concurrent requests, use all the ciphers of the block.
  */
-#define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
-
-static coroutine_fn int
-block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
-                       QEMUIOVector *qiov, int flags)
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset,
+                       QEMUIOVector *qiov, bool encrypt)
 {
     BlockCrypto *crypto = bs->opaque;
-    uint64_t cur_bytes; /* number of bytes in current iteration */
-    uint64_t bytes_done = 0;
-    uint8_t *cipher_data = NULL;
-    QEMUIOVector hd_qiov;
-    int ret = 0;
-    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
-    uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    BlockCryptoEncDecData arg = {
+        .block = crypto->block,
+        .offset = offset,
+        .qiov = qiov,
+        .encrypt = encrypt,
+    };
+    int ret;
 
-    assert(!flags);
-    assert(payload_offset < INT64_MAX);
-    assert(QEMU_IS_ALIGNED(offset, sector_size));
-    assert(QEMU_IS_ALIGNED(bytes, sector_size));
+    qemu_co_mutex_lock(&crypto->lock);
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, &crypto->lock);
+    }
+    crypto->nb_threads++;
+    qemu_co_mutex_unlock(&crypto->lock);
 
-    qemu_iovec_init(&hd_qiov, qiov->niov);
+    ret = thread_pool_submit_co(pool, block_crypto_encdec_pool_func, &arg);
 
-    /* Bounce buffer because we don't wish to expose cipher text
-     * in qiov which points to guest memory.
-     */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
-    if (cipher_data == NULL) {
-        ret = -ENOMEM;
-        goto cleanup;
-    }
+    qemu_co_mutex_lock(&crypto->lock);
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+    qemu_co_mutex_unlock(&crypto->lock);
 
-    while (bytes) {
-        cur_bytes = MIN(bytes, BLOCK_CRYPTO_MAX_IO_SIZE);
+    return ret;
+}
 
-        qemu_iovec_reset(&hd_qiov);
-        qemu_iovec_add(&hd_qiov, cipher_data, cur_bytes);
+static bool block_crypto_qiov_sector_aligned(QEMUIOVector *qiov,
+                                             uint64_t sector_size)
+{
+    int i;
 
-        ret = bdrv_co_preadv(bs->file, payload_offset + offset + bytes_done,
-                             cur_bytes, &hd_qiov, 0);
-        if (ret < 0) {
-            goto cleanup;
+    for (i = 0; i < qiov->niov; i++) {
+        if (!QEMU_IS_ALIGNED(qiov->iov[i].iov_len, sector_size)) {
+            return false;
         }
+    }
+    return true;
+}
+
+typedef struct BlockCryptoAioTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+    int flags;
+} BlockCryptoAioTask;
+
+static coroutine_fn int block_crypto_add_task(BlockDriverState *bs,
+                                              AioTaskPool *pool,
+                                              AioTaskFunc func,
+                                              uint64_t offset,
+                                              uint64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              size_t qiov_offset,
+                                              int flags)
+{
+    BlockCryptoAioTask local_task;
+    BlockCryptoAioTask *task = pool ? g_new(BlockCryptoAioTask, 1)
+                                    : &local_task;
+
+    *task = (BlockCryptoAioTask) {
+        .task.func = func,
+        .bs = bs,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+        .flags = flags,
+    };
+
+    if (!pool) {
+        return func(&task->task);
+    }
+
+    aio_task_pool_start_task(pool, &task->task);
+
+    return 0;
+}
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+static coroutine_fn int block_crypto_co_preadv_task_entry(AioTask *task)
+{
+    BlockCryptoAioTask *t = container_of(task, BlockCryptoAioTask, task);
+    BlockDriverState *bs = t->bs;
+    BlockCrypto *crypto = bs->opaque;
+    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
+    uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
+    uint8_t *cipher_data = NULL;
+    QEMUIOVector hd_qiov;
+    int ret;
+
+    qemu_iovec_init_slice(&hd_qiov, t->qiov, t->qiov_offset, t->bytes);
+
+    /*
+     * Decrypt in place in the guest buffer when it is made of whole
+     * sectors.  The guest can only see the cipher text of the sectors
+     * that it is reading, and only until they are decrypted.
+     */
+    if (!block_crypto_qiov_sector_aligned(&hd_qiov, sector_size)) {
+        cipher_data = qemu_try_blockalign(bs->file->bs, t->bytes);
+        if (cipher_data == NULL) {
+            ret = -ENOMEM;
             goto cleanup;
         }
+        qemu_iovec_destroy(&hd_qiov);
+        qemu_iovec_init_buf(&hd_qiov, cipher_data, t->bytes);
+    }
 
-        qemu_iovec_from_buf(qiov, bytes_done, cipher_data, cur_bytes);
+    ret = bdrv_co_preadv(bs->file, payload_offset + t->offset, t->bytes,
+                         &hd_qiov, 0);
+    if (ret < 0) {
+        goto cleanup;
+    }
 
-        bytes -= cur_bytes;
-        bytes_done += cur_bytes;
+    ret = block_crypto_co_encdec(bs, t->offset, &hd_qiov, false);
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    if (cipher_data) {
+        qemu_iovec_from_buf(t->qiov, t->qiov_offset, cipher_data, t->bytes);
     }
 
  cleanup:
@@ -458,69 +583,108 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     return ret;
 }
 
-
-static coroutine_fn int
-block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
-                        QEMUIOVector *qiov, int flags)
+static coroutine_fn int block_crypto_co_pwritev_task_entry(AioTask *task)
 {
+    BlockCryptoAioTask *t = container_of(task, BlockCryptoAioTask, task);
+    BlockDriverState *bs = t->bs;
     BlockCrypto *crypto = bs->opaque;
-    uint64_t cur_bytes; /* number of bytes in current iteration */
-    uint64_t bytes_done = 0;
-    uint8_t *cipher_data = NULL;
-    QEMUIOVector hd_qiov;
-    int ret = 0;
-    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
     uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
-
-    assert(!(flags & ~BDRV_REQ_FUA));
-    assert(payload_offset < INT64_MAX);
-    assert(QEMU_IS_ALIGNED(offset, sector_size));
-    assert(QEMU_IS_ALIGNED(bytes, sector_size));
-
-    qemu_iovec_init(&hd_qiov, qiov->niov);
+    uint8_t *cipher_data;
+    QEMUIOVector hd_qiov;
+    int ret;
 
     /* Bounce buffer because we're not permitted to touch
      * contents of qiov - it points to guest memory.
      */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
+    cipher_data = qemu_try_blockalign(bs->file->bs, t->bytes);
     if (cipher_data == NULL) {
-        ret = -ENOMEM;
+        return -ENOMEM;
+    }
+
+    qemu_iovec_to_buf(t->qiov, t->qiov_offset, cipher_data, t->bytes);
+    qemu_iovec_init_buf(&hd_qiov, cipher_data, t->bytes);
+
+    ret = block_crypto_co_encdec(bs, t->offset, &hd_qiov, true);
+    if (ret < 0) {
         goto cleanup;
     }
 
-    while (bytes) {
-        cur_bytes = MIN(bytes, BLOCK_CRYPTO_MAX_IO_SIZE);
+    ret = bdrv_co_pwritev(bs->file, payload_offset + t->offset, t->bytes,
+                          &hd_qiov, t->flags);
 
-        qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
+ cleanup:
+    qemu_vfree(cipher_data);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
-            goto cleanup;
-        }
+    return ret;
+}
 
-        qemu_iovec_reset(&hd_qiov);
-        qemu_iovec_add(&hd_qiov, cipher_data, cur_bytes);
+/*
+ * Requests are split in chunks that go through an AioTaskPool, so that
+ * the chunks are encrypted or decrypted in parallel, and the encryption
+ * of a chunk overlaps with the I/O of the previous ones.
+ */
+static coroutine_fn int
+block_crypto_co_rw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
+                   QEMUIOVector *qiov, int flags, AioTaskFunc func)
+{
+    BlockCrypto *crypto = bs->opaque;
+    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
+    uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
+    uint64_t cur_bytes; /* number of bytes in current iteration */
+    uint64_t bytes_done = 0;
+    AioTaskPool *aio = NULL;
+    int ret = 0;
 
-        ret = bdrv_co_pwritev(bs->file, payload_offset + offset + bytes_done,
-                              cur_bytes, &hd_qiov, flags);
+    assert(payload_offset < INT64_MAX);
+    assert(QEMU_IS_ALIGNED(offset, sector_size));
+    assert(QEMU_IS_ALIGNED(bytes, sector_size));
+
+    while (bytes && aio_task_pool_status(aio) == 0) {
+        cur_bytes = MIN(bytes, BLOCK_CRYPTO_CHUNK_SIZE);
+
+        if (!aio && cur_bytes != bytes) {
+            aio = aio_task_pool_new(BLOCK_CRYPTO_MAX_WORKERS);
+        }
+        ret = block_crypto_add_task(bs, aio, func, offset + bytes_done,
+                                    cur_bytes, qiov, bytes_done, flags);
         if (ret < 0) {
-            goto cleanup;
+            break;
         }
 
         bytes -= cur_bytes;
         bytes_done += cur_bytes;
     }
 
- cleanup:
-    qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    if (aio) {
+        aio_task_pool_wait_all(aio);
+        if (ret == 0) {
+            ret = aio_task_pool_status(aio);
+        }
+        g_free(aio);
+    }
 
     return ret;
 }
 
+static coroutine_fn int
+block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
+                       QEMUIOVector *qiov, int flags)
+{
+    assert(!flags);
+    return block_crypto_co_rw(bs, offset, bytes, qiov, 0,
+                              block_crypto_co_preadv_task_entry);
+}
+
+
+static coroutine_fn int
+block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
+                        QEMUIOVector *qiov, int flags)
+{
+    assert(!(flags & ~BDRV_REQ_FUA));
+    return block_crypto_co_rw(bs, offset, bytes, qiov, flags,
+                              block_crypto_co_pwritev_task_entry);
+}
+
 static void block_crypto_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     BlockCrypto *crypto = bs->opaque;
@@ -33,6 +33,7 @@
 #include "crypto/secret.h"
 #include <curl/curl.h>
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "trace.h"
 
 // #define DEBUG_VERBOSE
@@ -40,7 +41,8 @@
 #define PROTOCOLS (CURLPROTO_HTTP | CURLPROTO_HTTPS | \
                    CURLPROTO_FTP | CURLPROTO_FTPS)
 
-#define CURL_NUM_STATES 8
+/* With HTTP/2, these are streams multiplexed over a single connection */
+#define CURL_NUM_STATES 16
 #define CURL_NUM_ACB    8
 #define CURL_TIMEOUT_MAX 10000
 
@@ -56,6 +58,8 @@
 #define CURL_BLOCK_OPT_PROXY_PASSWORD_SECRET "proxy-password-secret"
 
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
+/* Sequential reads double the readahead up to this, or to the option */
+#define CURL_READAHEAD_MAX (8 * MiB)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
 #define CURL_BLOCK_OPT_TIMEOUT_DEFAULT 5
 
@@ -103,6 +107,10 @@ typedef struct BDRVCURLState {
     GHashTable *sockets; /* GINT_TO_POINTER(fd) -> socket */
     char *url;
     size_t readahead_size;
+    /* Current readahead, which grows while the reads are sequential */
+    size_t cur_readahead;
+    /* End of the last read, to detect sequential reads */
+    uint64_t next_offset;
     bool sslverify;
     uint64_t timeout;
     char *cookie;
@@ -260,9 +268,12 @@ read_end:
     return size * nmemb;
 }
 
-/* Called with s->mutex held.  */
-static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
-                          CURLAIOCB *acb)
+/*
+ * Called with s->mutex held.  Returns the state whose buffer has or will
+ * have the data for @acb, or NULL.
+ */
+static CURLState *curl_find_buf(BDRVCURLState *s, uint64_t start,
+                                uint64_t len, CURLAIOCB *acb)
 {
     int i;
     uint64_t end = start + len;
@@ -276,7 +287,8 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
 
         if (!state->orig_buf)
             continue;
-        if (!state->buf_off)
+        /* A transfer without data yet can still take waiting requests */
+        if (!state->buf_off && !state->in_use)
             continue;
 
         // Does the existing buffer cover our section?
@@ -292,7 +304,7 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
                 qemu_iovec_memset(acb->qiov, clamped_len, 0, len - clamped_len);
             }
             acb->ret = 0;
-            return true;
+            return state;
         }
 
         // Wait for unfinished chunks
@@ -310,13 +322,64 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
             for (j=0; j<CURL_NUM_ACB; j++) {
                 if (!state->acb[j]) {
                     state->acb[j] = acb;
-                    return true;
+                    return state;
                 }
             }
         }
     }
 
-    return false;
+    return NULL;
+}
+
+/* Called with s->mutex held.  */
+static void curl_complete_acb(BDRVCURLState *s, CURLState *state, int i,
+                              bool error)
+{
+    CURLAIOCB *acb = state->acb[i];
+
+    if (!error) {
+        /* Assert that we have read all data */
+        assert(state->buf_off >= acb->end);
+
+        qemu_iovec_from_buf(acb->qiov, 0,
+                            state->orig_buf + acb->start,
+                            acb->end - acb->start);
+
+        if (acb->end - acb->start < acb->bytes) {
+            size_t offset = acb->end - acb->start;
+            qemu_iovec_memset(acb->qiov, offset, 0,
+                              acb->bytes - offset);
+        }
+    }
+
+    acb->ret = error ? -EIO : 0;
+    state->acb[i] = NULL;
+    qemu_mutex_unlock(&s->mutex);
+    aio_co_wake(acb->co);
+    qemu_mutex_lock(&s->mutex);
+}
+
+/*
+ * Called with s->mutex held.  Complete the requests whose data has
+ * arrived, without waiting for the end of the transfer, which also
+ * includes the readahead.
+ */
+static void curl_complete_ready_acbs(BDRVCURLState *s)
+{
+    int i, j;
+
+    for (i = 0; i < CURL_NUM_STATES; i++) {
+        CURLState *state = &s->states[i];
+
+        if (!state->in_use) {
+            continue;
+        }
+        for (j = 0; j < CURL_NUM_ACB; j++) {
+            if (state->acb[j] && state->acb[j]->end <= state->buf_off) {
+                curl_complete_acb(s, state, j, false);
+            }
+        }
+    }
 }
 
 /* Called with s->mutex held.  */
@@ -324,6 +387,8 @@ static void curl_multi_check_completion(BDRVCURLState *s)
 {
     int msgs_in_queue;
 
+    curl_complete_ready_acbs(s);
+
     /* Try to find done transfers, so we can free the easy
      * handle again. */
     for (;;) {
@@ -357,32 +422,9 @@ static void curl_multi_check_completion(BDRVCURLState *s)
             }
 
             for (i = 0; i < CURL_NUM_ACB; i++) {
-                CURLAIOCB *acb = state->acb[i];
-
-                if (acb == NULL) {
-                    continue;
-                }
-
-                if (!error) {
-                    /* Assert that we have read all data */
-                    assert(state->buf_off >= acb->end);
-
-                    qemu_iovec_from_buf(acb->qiov, 0,
-                                        state->orig_buf + acb->start,
-                                        acb->end - acb->start);
-
-                    if (acb->end - acb->start < acb->bytes) {
-                        size_t offset = acb->end - acb->start;
-                        qemu_iovec_memset(acb->qiov, offset, 0,
-                                          acb->bytes - offset);
-                    }
+                if (state->acb[i]) {
+                    curl_complete_acb(s, state, i, error);
                 }
-
-                acb->ret = error ? -EIO : 0;
-                state->acb[i] = NULL;
-                qemu_mutex_unlock(&s->mutex);
-                aio_co_wake(acb->co);
-                qemu_mutex_lock(&s->mutex);
             }
 
             curl_clean_state(state);
@@ -476,6 +518,18 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
         curl_easy_setopt(state->curl, CURLOPT_ERRORBUFFER, state->errmsg);
         curl_easy_setopt(state->curl, CURLOPT_FAILONERROR, 1);
 
+        /*
+         * Prefer HTTP/2 for https, and wait for an existing connection
+         * to multiplex the transfer onto rather than opening a new one.
+         */
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+        curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
         if (s->username) {
             curl_easy_setopt(state->curl, CURLOPT_USERNAME, s->username);
         }
@@ -576,6 +630,9 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 }
 
 static QemuOptsList runtime_opts = {
@@ -679,6 +736,7 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
                    s->readahead_size);
         goto out_noclean;
     }
+    s->cur_readahead = s->readahead_size;
 
     s->timeout = qemu_opt_get_number(opts, CURL_BLOCK_OPT_TIMEOUT,
                                      CURL_BLOCK_OPT_TIMEOUT_DEFAULT);
@@ -827,21 +885,116 @@ out_noclean:
     return -EINVAL;
 }
 
+/*
+ * Called with s->mutex held.  Start fetching @len bytes at @start into
+ * @state, on behalf of @acb if it is not NULL.
+ */
+static int curl_start_transfer(BDRVCURLState *s, CURLState *state,
+                               uint64_t start, uint64_t len, CURLAIOCB *acb)
+{
+    uint64_t end;
+    int running;
+
+    if (curl_init_state(s, state) < 0) {
+        curl_clean_state(state);
+        return -EIO;
+    }
+
+    state->buf_off = 0;
+    g_free(state->orig_buf);
+    state->buf_start = start;
+    state->buf_len = len;
+    end = start + state->buf_len - 1;
+    state->orig_buf = g_try_malloc(state->buf_len);
+    if (state->buf_len && state->orig_buf == NULL) {
+        curl_clean_state(state);
+        return -ENOMEM;
+    }
+    state->acb[0] = acb;
+
+    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
+    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
+
+    if (curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
+        state->acb[0] = NULL;
+        curl_clean_state(state);
+        return -EIO;
+    }
+
+    /* Tell curl it needs to kick things off */
+    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    return 0;
+}
+
+/*
+ * Called with s->mutex held.  When a sequential read gets close to the
+ * end of what @state fetches, start fetching the next chunk in the
+ * background, so that the reader does not wait for a round trip.
+ */
+static void curl_prefetch(BDRVCURLState *s, CURLState *state)
+{
+    uint64_t start = state->buf_start + state->buf_len;
+    uint64_t len;
+    CURLState *next;
+    int i;
+
+    if (start >= s->len ||
+        start - s->next_offset >= s->cur_readahead / 2) {
+        return;
+    }
+
+    for (i = 0; i < CURL_NUM_STATES; i++) {
+        CURLState *other = &s->states[i];
+
+        if (other->orig_buf && start >= other->buf_start &&
+            start < other->buf_start + other->buf_len) {
+            return;
+        }
+    }
+
+    next = curl_find_state(s);
+    if (!next) {
+        return;
+    }
+
+    len = MIN(s->cur_readahead, s->len - start);
+    trace_curl_prefetch(start, len);
+    curl_start_transfer(s, next, start, len, NULL);
+}
+
 static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
 {
     CURLState *state;
-    int running;
 
     BDRVCURLState *s = bs->opaque;
 
     uint64_t start = acb->offset;
-    uint64_t end;
+    bool sequential;
+    int ret;
 
     qemu_mutex_lock(&s->mutex);
 
+    /*
+     * Grow the readahead while the guest reads sequentially, and start
+     * over with the configured size as soon as it seeks.
+     */
+    sequential = start == s->next_offset;
+    if (sequential) {
+        s->cur_readahead = MIN(s->cur_readahead * 2,
+                               MAX(s->readahead_size, CURL_READAHEAD_MAX));
+    } else {
+        s->cur_readahead = s->readahead_size;
+    }
+    s->next_offset = start + acb->bytes;
+    trace_curl_readahead(start, sequential, s->cur_readahead);
+
     // In case we have the requested data already (e.g. read-ahead),
     // we can just call the callback and be done.
-    if (curl_find_buf(s, start, acb->bytes, acb)) {
+    state = curl_find_buf(s, start, acb->bytes, acb);
+    if (state) {
+        if (sequential) {
+            curl_prefetch(s, state);
+        }
         goto out;
     }
 
@@ -854,42 +1007,17 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
         qemu_co_queue_wait(&s->free_state_waitq, &s->mutex);
     }
 
-    if (curl_init_state(s, state) < 0) {
-        curl_clean_state(state);
-        acb->ret = -EIO;
-        goto out;
-    }
-
     acb->start = 0;
     acb->end = MIN(acb->bytes, s->len - start);
 
-    state->buf_off = 0;
-    g_free(state->orig_buf);
-    state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
-    end = start + state->buf_len - 1;
-    state->orig_buf = g_try_malloc(state->buf_len);
-    if (state->buf_len && state->orig_buf == NULL) {
-        curl_clean_state(state);
-        acb->ret = -ENOMEM;
+    ret = curl_start_transfer(s, state, start,
+                              MIN(acb->end + s->cur_readahead,
+                                  s->len - start), acb);
+    if (ret < 0) {
+        acb->ret = ret;
         goto out;
     }
-    state->acb[0] = acb;
-
-    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
     trace_curl_setup_preadv(acb->bytes, start, state->range);
-    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
-
-    if (curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
-        state->acb[0] = NULL;
-        acb->ret = -EIO;
-
-        curl_clean_state(state);
-        goto out;
-    }
-
-    /* Tell curl it needs to kick things off */
-    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
 
 out:
     qemu_mutex_unlock(&s->mutex);
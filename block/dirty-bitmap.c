@@ -729,6 +729,22 @@ void bdrv_dirty_bitmap_deserialize_ones(BdrvDirtyBitmap *bitmap,
     hbitmap_deserialize_ones(bitmap->bitmap, offset, bytes, finish);
 }
 
+size_t bdrv_dirty_bitmap_serialize_runs(const BdrvDirtyBitmap *bitmap,
+                                        uint8_t *buf, size_t size,
+                                        uint64_t offset, uint64_t bytes)
+{
+    return hbitmap_serialize_runs(bitmap->bitmap, buf, size, offset, bytes);
+}
+
+int bdrv_dirty_bitmap_deserialize_runs(BdrvDirtyBitmap *bitmap,
+                                       const uint8_t *buf, size_t size,
+                                       uint64_t offset, uint64_t bytes,
+                                       bool finish)
+{
+    return hbitmap_deserialize_runs(bitmap->bitmap, buf, size, offset, bytes,
+                                    finish);
+}
+
 void bdrv_dirty_bitmap_deserialize_finish(BdrvDirtyBitmap *bitmap)
 {
     hbitmap_deserialize_finish(bitmap->bitmap);
@@ -26,6 +26,7 @@
 #include "block/qapi.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
+#include "qemu/coroutine.h"
 #include "sysemu/block-backend.h"
 
 #include <fuse.h>
@@ -35,19 +36,34 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/* Maximum number of requests that are processed concurrently */
+#define FUSE_MAX_IN_FLIGHT 64
+
 
 typedef struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
     bool mounted, fd_handler_set_up;
 
+    /* Number of requests currently being processed in coroutines */
+    int in_flight;
+    /* Request buffers that are not in use, kept around for reuse */
+    void *free_bufs[FUSE_MAX_IN_FLIGHT];
+    int nb_free_bufs;
+    /* Serializes resizing the image */
+    CoMutex resize_lock;
+
     char *mountpoint;
     bool writable;
     bool growable;
 } FuseExport;
 
+typedef struct FuseRequest {
+    FuseExport *exp;
+    struct fuse_buf buf;
+} FuseRequest;
+
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
 
@@ -117,6 +133,7 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+    qemu_co_mutex_init(&exp->resize_lock);
 
     ret = setup_fuse_export(exp, args->mountpoint, errp);
     if (ret < 0) {
@@ -193,6 +210,61 @@ fail:
     return ret;
 }
 
+/**
+ * Install the FD handler, unless FUSE_MAX_IN_FLIGHT requests are being
+ * processed already; in that case, stop reading new requests until one
+ * of them settles.
+ */
+static void fuse_export_update_fd_handler(FuseExport *exp)
+{
+    if (!exp->fd_handler_set_up) {
+        return;
+    }
+
+    aio_set_fd_handler(exp->common.ctx,
+                       fuse_session_fd(exp->fuse_session), true,
+                       exp->in_flight < FUSE_MAX_IN_FLIGHT ?
+                       read_from_fuse_export : NULL,
+                       NULL, NULL, exp);
+}
+
+/**
+ * Return a request buffer to @exp's pool (or free it if the pool is full).
+ */
+static void fuse_put_request_buf(FuseExport *exp, void *mem)
+{
+    if (!mem) {
+        return;
+    }
+
+    if (exp->nb_free_bufs < FUSE_MAX_IN_FLIGHT) {
+        exp->free_bufs[exp->nb_free_bufs++] = mem;
+    } else {
+        free(mem);
+    }
+}
+
+/**
+ * Process a single request.  The request handlers issue their block layer
+ * requests from this coroutine, so they yield instead of blocking the
+ * event loop, and so other requests can be processed in the meantime.
+ */
+static void coroutine_fn co_process_fuse_request(void *opaque)
+{
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->exp;
+
+    fuse_session_process_buf(exp->fuse_session, &r->buf);
+
+    fuse_put_request_buf(exp, r->buf.mem);
+    g_free(r);
+
+    if (exp->in_flight-- == FUSE_MAX_IN_FLIGHT) {
+        fuse_export_update_fd_handler(exp);
+    }
+    blk_exp_unref(&exp->common);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
@@ -200,21 +272,34 @@ fail:
 static void read_from_fuse_export(void *opaque)
 {
     FuseExport *exp = opaque;
+    FuseRequest *r;
+    Coroutine *co;
     int ret;
 
-    blk_exp_ref(&exp->common);
+    r = g_new0(FuseRequest, 1);
+    r->exp = exp;
+    if (exp->nb_free_bufs > 0) {
+        /* libfuse allocates a new buffer itself if this is NULL */
+        r->buf.mem = exp->free_bufs[--exp->nb_free_bufs];
+    }
 
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &r->buf);
     } while (ret == -EINTR);
     if (ret < 0) {
-        goto out;
+        fuse_put_request_buf(exp, r->buf.mem);
+        g_free(r);
+        return;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    /* Released by co_process_fuse_request() */
+    blk_exp_ref(&exp->common);
+    if (++exp->in_flight == FUSE_MAX_IN_FLIGHT) {
+        fuse_export_update_fd_handler(exp);
+    }
 
-out:
-    blk_exp_unref(&exp->common);
+    co = qemu_coroutine_create(co_process_fuse_request, r);
+    qemu_coroutine_enter(co);
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
@@ -253,7 +338,9 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    while (exp->nb_free_bufs > 0) {
+        free(exp->free_bufs[--exp->nb_free_bufs]);
+    }
     g_free(exp->mountpoint);
 }
 
@@ -353,6 +440,9 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
+/**
+ * Resize the exported image.  The caller must hold exp->resize_lock.
+ */
 static int fuse_do_truncate(const FuseExport *exp, int64_t size,
                             bool req_zero_write, PreallocMode prealloc)
 {
@@ -405,7 +495,9 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
         return;
     }
 
+    qemu_co_mutex_lock(&exp->resize_lock);
     ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+    qemu_co_mutex_unlock(&exp->resize_lock);
     if (ret < 0) {
         fuse_reply_err(req, -ret);
         return;
@@ -503,7 +595,15 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 
     if (offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            qemu_co_mutex_lock(&exp->resize_lock);
+            /* Some concurrent request may have grown the image already */
+            length = blk_getlength(exp->common.blk);
+            ret = length < 0 ? length : 0;
+            if (ret == 0 && offset + size > length) {
+                ret = fuse_do_truncate(exp, offset + size, true,
+                                       PREALLOC_MODE_OFF);
+            }
+            qemu_co_mutex_unlock(&exp->resize_lock);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
@@ -537,10 +637,13 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         return;
     }
 
+    /* Keep the length stable, as it decides whether to resize the image */
+    qemu_co_mutex_lock(&exp->resize_lock);
+
     blk_len = blk_getlength(exp->common.blk);
     if (blk_len < 0) {
-        fuse_reply_err(req, -blk_len);
-        return;
+        ret = blk_len;
+        goto out;
     }
 
     if (mode & FALLOC_FL_KEEP_SIZE) {
@@ -549,8 +652,8 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 
     if (mode & FALLOC_FL_PUNCH_HOLE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE)) {
-            fuse_reply_err(req, EINVAL);
-            return;
+            ret = -EINVAL;
+            goto out;
         }
 
         do {
@@ -566,8 +669,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
             ret = fuse_do_truncate(exp, offset + length, false,
                                    PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                goto out;
             }
         }
 
@@ -582,16 +684,15 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     } else if (!mode) {
         /* We can only fallocate at the EOF with a truncate */
         if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
+            ret = -EOPNOTSUPP;
+            goto out;
         }
 
         if (offset > blk_len) {
             /* No preallocation needed here */
             ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                goto out;
             }
         }
 
@@ -601,6 +702,8 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         ret = -EOPNOTSUPP;
     }
 
+out:
+    qemu_co_mutex_unlock(&exp->resize_lock);
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
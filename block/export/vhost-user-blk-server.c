@@ -16,6 +16,7 @@
 #include "qemu/vhost-user-server.h"
 #include "vhost-user-blk-server.h"
 #include "qapi/error.h"
+#include "qemu/bitmap.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
 #include "util/block-helpers.h"
@@ -44,6 +45,7 @@ typedef struct VuBlkReq {
     struct virtio_blk_outhdr out;
     VuServer *server;
     struct VuVirtq *vq;
+    int vq_idx;
 } VuBlkReq;
 
 /* vhost user block device */
@@ -54,15 +56,53 @@ typedef struct {
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
     bool writable;
+
+    /*
+     * Virtqueues with completed requests that the client has not been
+     * notified about yet, and whether vu_blk_notify_bh() is scheduled.
+     */
+    uint16_t num_queues;
+    unsigned long *notify_pending;
+    bool notify_scheduled;
 } VuBlkExport;
 
+/*
+ * Notify the client about all requests that were completed since the last
+ * call, with one interrupt per virtqueue instead of one per request.
+ */
+static void vu_blk_notify_bh(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    VuServer *server = &vexp->vu_server;
+    long i;
+
+    vexp->notify_scheduled = false;
+    for (i = find_first_bit(vexp->notify_pending, vexp->num_queues);
+         i < vexp->num_queues;
+         i = find_next_bit(vexp->notify_pending, vexp->num_queues, i + 1)) {
+        clear_bit(i, vexp->notify_pending);
+        if (server->sioc) {
+            vu_queue_notify(&server->vu_dev, vu_get_queue(&server->vu_dev, i));
+        }
+    }
+
+    blk_exp_unref(&vexp->export);
+}
+
 static void vu_blk_req_complete(VuBlkReq *req)
 {
     VuDev *vu_dev = &req->server->vu_dev;
+    VuBlkExport *vexp = container_of(req->server, VuBlkExport, vu_server);
 
     /* IO size with 1 extra status byte */
     vu_queue_push(vu_dev, req->vq, &req->elem, req->size + 1);
-    vu_queue_notify(vu_dev, req->vq);
+
+    set_bit(req->vq_idx, vexp->notify_pending);
+    if (!vexp->notify_scheduled) {
+        vexp->notify_scheduled = true;
+        blk_exp_ref(&vexp->export);
+        aio_bh_schedule_oneshot(vexp->export.ctx, vu_blk_notify_bh, vexp);
+    }
 
     free(req);
 }
@@ -307,6 +347,7 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 
         req->server = server;
         req->vq = vq;
+        req->vq_idx = idx;
 
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
@@ -502,6 +543,8 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
 
     vu_blk_initialize_config(blk_bs(exp->blk), &vexp->blkcfg,
                              logical_block_size, num_queues);
+    vexp->num_queues = num_queues;
+    vexp->notify_pending = bitmap_new(num_queues);
 
     blk_add_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                  vexp);
@@ -510,6 +553,7 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                  num_queues, &vu_blk_iface, errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
+        g_free(vexp->notify_pending);
         return -EADDRNOTAVAIL;
     }
 
@@ -522,6 +566,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
 
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
+    g_free(vexp->notify_pending);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
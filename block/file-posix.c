@@ -133,6 +133,22 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/* A discard waiting for a batch that it was merged into */
+typedef struct RawDiscardWaiter {
+    Coroutine *co;
+    int ret;
+    QSIMPLEQ_ENTRY(RawDiscardWaiter) next;
+} RawDiscardWaiter;
+
+typedef struct RawDiscardBatch {
+    int64_t offset;
+    int64_t bytes;
+    QSIMPLEQ_HEAD(, RawDiscardWaiter) waiters;
+} RawDiscardBatch;
+
+/* Discards are merged up to this size */
+#define RAW_DISCARD_BATCH_MAX (1 * GiB)
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -161,6 +177,11 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+#ifdef CONFIG_LINUX_IO_URING
+    /* Options of the own ring, used instead of the AioContext's if set */
+    LuringSetup luring_setup;
+    LuringState *luring;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -172,6 +193,9 @@ typedef struct BDRVRawState {
         uint64_t discard_bytes_ok;
     } stats;
 
+    /* Discards being collected for a single call, see raw_do_pdiscard() */
+    RawDiscardBatch *discard_batch;
+
     PRManager *pr_mgr;
 } BDRVRawState;
 
@@ -192,6 +216,31 @@ static int fd_open(BlockDriverState *bs)
     return -EIO;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static LuringState *raw_luring(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    return s->luring ?: aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+}
+
+/*
+ * Returns the ring that fallocate() calls go through instead of the thread
+ * pool, or NULL.
+ */
+static LuringState *raw_luring_fallocate(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio;
+
+    if (!s->use_linux_io_uring) {
+        return NULL;
+    }
+    aio = raw_luring(bs);
+    return luring_has_fallocate(aio) ? aio : NULL;
+}
+#endif
+
 static int64_t raw_getlength(BlockDriverState *bs);
 
 typedef struct RawPosixAIOData {
@@ -551,6 +600,25 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "submit io_uring requests from a kernel thread "
+                    "(default: off)",
+        },
+        {
+            .name = "sq-cpu",
+            .type = QEMU_OPT_NUMBER,
+            .help = "host CPU of the sqpoll kernel thread",
+        },
+        {
+            .name = "iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll io_uring completions, requires cache.direct=on "
+                    "(default: off)",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -606,6 +674,11 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->luring_setup = (LuringSetup) {
+        .sqpoll = qemu_opt_get_bool(opts, "sqpoll", false),
+        .sq_cpu = qemu_opt_get_number(opts, "sq-cpu", -1),
+        .iopoll = qemu_opt_get_bool(opts, "iopoll", false),
+    };
 #endif
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
@@ -701,7 +774,35 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
+    if ((s->luring_setup.sqpoll || s->luring_setup.iopoll) &&
+        !s->use_linux_io_uring) {
+        error_setg(errp, "sqpoll and iopoll require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->luring_setup.sq_cpu != -1 &&
+        (!s->luring_setup.sqpoll || s->luring_setup.sq_cpu < 0)) {
+        error_setg(errp, "sq-cpu must be a CPU number, and requires "
+                   "sqpoll=on");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->luring_setup.iopoll && !(s->open_flags & O_DIRECT)) {
+        error_setg(errp, "iopoll=on requires cache.direct=on, which was not "
+                         "specified.");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->luring_setup.sqpoll || s->luring_setup.iopoll) {
+        /* The ring of the AioContext is shared, these need their own */
+        s->luring = luring_init_setup(&s->luring_setup, errp);
+        if (!s->luring) {
+            error_prepend(errp, "Unable to use io_uring: ");
+            ret = -EINVAL;
+            goto fail;
+        }
+        luring_attach_aio_context(s->luring, bdrv_get_aio_context(bs));
+    } else if (s->use_linux_io_uring) {
         if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
@@ -794,6 +895,13 @@ fail:
     if (ret < 0 && s->fd != -1) {
         qemu_close(s->fd);
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret < 0 && s->luring) {
+        luring_detach_aio_context(s->luring, bdrv_get_aio_context(bs));
+        luring_cleanup(s->luring);
+        s->luring = NULL;
+    }
+#endif
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
     }
@@ -2026,7 +2134,7 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_luring(bs);
         assert(qiov->size == bytes);
         return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
 #endif
@@ -2080,7 +2188,7 @@ static void raw_aio_plug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_luring(bs);
         luring_io_plug(bs, aio);
     }
 #endif
@@ -2097,7 +2205,7 @@ static void raw_aio_unplug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_luring(bs);
         luring_io_unplug(bs, aio);
     }
 #endif
@@ -2121,14 +2229,44 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+    /* Polled rings can't flush */
+    if (s->use_linux_io_uring && !s->luring_setup.iopoll) {
+        LuringState *aio = raw_luring(bs);
         return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+/*
+ * Forget the io_uring state of @fd before it is closed, or before the
+ * requests of @bs move to another AioContext.
+ */
+static void raw_aio_unregister_fd(BlockDriverState *bs, int fd)
+{
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring && fd >= 0) {
+        LuringState *aio = raw_luring(bs);
+        luring_unregister_fd(aio, fd);
+    }
+#endif
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+#ifdef CONFIG_LINUX_IO_URING
+    /* The own ring moves along with bs, its files stay valid */
+    if (s->luring) {
+        luring_detach_aio_context(s->luring, bdrv_get_aio_context(bs));
+        return;
+    }
+#endif
+    raw_aio_unregister_fd(bs, s->fd);
+}
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
@@ -2144,7 +2282,9 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
     }
 #endif
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
+    if (s->luring) {
+        luring_attach_aio_context(s->luring, new_context);
+    } else if (s->use_linux_io_uring) {
         Error *local_err = NULL;
         if (!aio_setup_linux_io_uring(new_context, &local_err)) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
@@ -2155,14 +2295,44 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #endif
 }
 
+static void raw_register_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = raw_luring(bs);
+        luring_register_buf(aio, host, size);
+    }
+#endif
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host)
+{
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = raw_luring(bs);
+        luring_unregister_buf(aio, host);
+    }
+#endif
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
+        raw_aio_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = -1;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->luring) {
+        luring_detach_aio_context(s->luring, bdrv_get_aio_context(bs));
+        luring_cleanup(s->luring);
+        s->luring = NULL;
+    }
+#endif
 }
 
 /**
@@ -2917,12 +3087,28 @@ static void raw_account_discard(BDRVRawState *s, uint64_t nbytes, int ret)
     }
 }
 
-static coroutine_fn int
-raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
+static int coroutine_fn
+raw_co_submit_discard(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                      bool blkdev)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
-    int ret;
+
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    LuringState *aio = blkdev ? NULL : raw_luring_fallocate(bs);
+
+    if (aio && s->has_discard) {
+        int ret = luring_co_fallocate(bs, aio, s->fd,
+                                      FALLOC_FL_PUNCH_HOLE |
+                                      FALLOC_FL_KEEP_SIZE,
+                                      offset, bytes);
+        ret = translate_err(ret);
+        if (ret == -ENOTSUP) {
+            s->has_discard = false;
+        }
+        return ret;
+    }
+#endif
 
     acb = (RawPosixAIOData) {
         .bs             = bs,
@@ -2936,7 +3122,64 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
         acb.aio_type |= QEMU_AIO_BLKDEV;
     }
 
-    ret = raw_thread_pool_submit(bs, handle_aiocb_discard, &acb);
+    return raw_thread_pool_submit(bs, handle_aiocb_discard, &acb);
+}
+
+/*
+ * Guests that run fstrim or mount with online discard send floods of small
+ * discards, many of them adjacent.  The first discard waits for one
+ * iteration of the event loop, and the discards submitted meanwhile that
+ * extend its range are merged into it, so that they all complete with a
+ * single fallocate() or BLKDISCARD.
+ */
+static coroutine_fn int
+raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
+{
+    BDRVRawState *s = bs->opaque;
+    RawDiscardBatch *batch = s->discard_batch;
+    RawDiscardWaiter *waiter;
+    int ret;
+
+    if (batch && batch->bytes + bytes <= RAW_DISCARD_BATCH_MAX &&
+        (offset == batch->offset + batch->bytes ||
+         offset + bytes == batch->offset)) {
+        RawDiscardWaiter w = {
+            .co = qemu_coroutine_self(),
+        };
+
+        batch->offset = MIN(batch->offset, offset);
+        batch->bytes += bytes;
+        QSIMPLEQ_INSERT_TAIL(&batch->waiters, &w, next);
+        qemu_coroutine_yield();
+        raw_account_discard(s, bytes, w.ret);
+        return w.ret;
+    }
+
+    if (!batch) {
+        RawDiscardBatch new_batch = {
+            .offset = offset,
+            .bytes = bytes,
+            .waiters = QSIMPLEQ_HEAD_INITIALIZER(new_batch.waiters),
+        };
+
+        s->discard_batch = &new_batch;
+        aio_co_schedule(bdrv_get_aio_context(bs), qemu_coroutine_self());
+        qemu_coroutine_yield();
+        s->discard_batch = NULL;
+
+        trace_file_discard_batch(bs, new_batch.offset, new_batch.bytes);
+        ret = raw_co_submit_discard(bs, new_batch.offset, new_batch.bytes,
+                                    blkdev);
+        while ((waiter = QSIMPLEQ_FIRST(&new_batch.waiters))) {
+            QSIMPLEQ_REMOVE_HEAD(&new_batch.waiters, next);
+            waiter->ret = ret;
+            aio_co_wake(waiter->co);
+        }
+    } else {
+        /* Not adjacent to the batch being collected */
+        ret = raw_co_submit_discard(bs, offset, bytes, blkdev);
+    }
+
     raw_account_discard(s, bytes, ret);
     return ret;
 }
@@ -2947,6 +3190,54 @@ raw_co_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
     return raw_do_pdiscard(bs, offset, bytes, false);
 }
 
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+/*
+ * Try the fallocate() modes that handle_aiocb_write_zeroes_unmap() and
+ * handle_aiocb_write_zeroes() start with for regular files through the
+ * ring.  Returns -ENOTSUP if the thread pool must handle the request,
+ * which also takes care of the remaining fallbacks.
+ */
+static int coroutine_fn
+raw_co_luring_write_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
+                           BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio = raw_luring_fallocate(bs);
+    int ret;
+
+    if (!aio) {
+        return -ENOTSUP;
+    }
+
+    if (flags & BDRV_REQ_MAY_UNMAP) {
+        ret = luring_co_fallocate(bs, aio, s->fd,
+                                  FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                  offset, bytes);
+        switch (ret) {
+        case -ENOTSUP:
+        case -EOPNOTSUPP:
+        case -EINVAL:
+        case -EBUSY:
+            break;
+        default:
+            return ret;
+        }
+    }
+
+#ifdef CONFIG_FALLOCATE_ZERO_RANGE
+    if (s->has_write_zeroes) {
+        ret = luring_co_fallocate(bs, aio, s->fd, FALLOC_FL_ZERO_RANGE,
+                                  offset, bytes);
+        if (ret == 0 || (translate_err(ret) != -ENOTSUP && ret != -EINVAL)) {
+            return ret;
+        }
+    }
+#endif
+
+    return -ENOTSUP;
+}
+#endif
+
 static int coroutine_fn
 raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
                      BdrvRequestFlags flags, bool blkdev)
@@ -2997,6 +3288,15 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
         .aio_nbytes     = bytes,
     };
 
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    if (!blkdev) {
+        int ret = raw_co_luring_write_zeroes(bs, offset, bytes, flags);
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+    }
+#endif
+
     if (blkdev) {
         acb.aio_type |= QEMU_AIO_BLKDEV;
     }
@@ -3153,6 +3453,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_aio_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3255,6 +3556,9 @@ BlockDriver bdrv_file = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate = raw_co_truncate,
     .bdrv_getlength = raw_getlength,
@@ -3621,6 +3925,9 @@ static BlockDriver bdrv_host_device = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate       = raw_co_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -3745,6 +4052,9 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -3875,6 +4185,9 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
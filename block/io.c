@@ -820,6 +820,31 @@ bdrv_find_conflicting_request(BdrvTrackedRequest *self)
     return NULL;
 }
 
+/*
+ * Wait for the requests that took the fast path.  They are not in the
+ * tracked requests list, so a serialising request cannot tell whether
+ * they overlap it and waits for all of them.  No new one starts while a
+ * serialising request is in flight, and they never wait for other
+ * requests themselves, so this cannot deadlock.
+ *
+ * Called with bs->reqs_lock held, after serialising_in_flight was
+ * incremented.
+ */
+static bool coroutine_fn
+bdrv_wait_untracked_requests_locked(BlockDriverState *bs)
+{
+    bool waited = false;
+
+    /* Pairs with the barrier in bdrv_fast_request_begin() */
+    smp_mb();
+    while (qatomic_read(&bs->untracked_in_flight)) {
+        qemu_co_queue_wait(&bs->untracked_queue, &bs->reqs_lock);
+        waited = true;
+    }
+
+    return waited;
+}
+
 /* Called with self->bs->reqs_lock held */
 static bool coroutine_fn
 bdrv_wait_serialising_requests_locked(BdrvTrackedRequest *self)
@@ -827,6 +852,10 @@ bdrv_wait_serialising_requests_locked(BdrvTrackedRequest *self)
     BdrvTrackedRequest *req;
     bool waited = false;
 
+    if (self->serialising) {
+        waited = bdrv_wait_untracked_requests_locked(self->bs);
+    }
+
     while ((req = bdrv_find_conflicting_request(self))) {
         self->waiting_for = req;
         qemu_co_queue_wait(&req->wait_queue, &self->bs->reqs_lock);
@@ -954,6 +983,53 @@ bool coroutine_fn bdrv_make_request_serialising(BdrvTrackedRequest *req,
     return waited;
 }
 
+/*
+ * Requests that are aligned, fit in one driver request and within the
+ * image, and that need none of copy-on-read, zero detection, dirty
+ * bitmaps or write threshold go straight to the driver.  They skip the
+ * tracked requests list, so they are only counted in
+ * untracked_in_flight; serialising requests wait for them in
+ * bdrv_wait_untracked_requests_locked().  They still count in in_flight,
+ * which draining relies on.
+ */
+static bool bdrv_fast_request_ok(BlockDriverState *bs, int64_t offset,
+                                 int64_t bytes)
+{
+    int64_t max_transfer = MIN_NON_ZERO(bs->bl.max_transfer, INT_MAX);
+
+    return QEMU_IS_ALIGNED(offset | bytes, bs->bl.request_alignment) &&
+           bytes <= max_transfer && bs->drv &&
+           !bs->drv->has_variable_length &&
+           offset + bytes <= bs->total_sectors * BDRV_SECTOR_SIZE;
+}
+
+static void coroutine_fn bdrv_fast_request_end(BlockDriverState *bs)
+{
+    /* qatomic_fetch_dec() is a full barrier */
+    if (qatomic_fetch_dec(&bs->untracked_in_flight) == 1 &&
+        qatomic_read(&bs->serialising_in_flight)) {
+        qemu_co_mutex_lock(&bs->reqs_lock);
+        qemu_co_queue_restart_all(&bs->untracked_queue);
+        qemu_co_mutex_unlock(&bs->reqs_lock);
+    }
+}
+
+/*
+ * Returns false if a serialising request is in flight; the request must
+ * then take the tracked path.
+ */
+static bool coroutine_fn bdrv_fast_request_begin(BlockDriverState *bs)
+{
+    qatomic_inc(&bs->untracked_in_flight);
+    /* Pairs with the barrier in bdrv_wait_untracked_requests_locked() */
+    smp_mb();
+    if (qatomic_read(&bs->serialising_in_flight)) {
+        bdrv_fast_request_end(bs);
+        return false;
+    }
+    return true;
+}
+
 static int bdrv_check_qiov_request(int64_t offset, int64_t bytes,
                                    QEMUIOVector *qiov, size_t qiov_offset,
                                    Error **errp)
@@ -1836,6 +1912,14 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
         flags |= BDRV_REQ_COPY_ON_READ;
     }
 
+    if (!flags && bdrv_fast_request_ok(bs, offset, bytes) &&
+        bdrv_fast_request_begin(bs)) {
+        ret = bdrv_driver_preadv(bs, offset, bytes, qiov, qiov_offset, 0);
+        bdrv_fast_request_end(bs);
+        bdrv_dec_in_flight(bs);
+        return ret < 0 ? ret : 0;
+    }
+
     ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, &pad,
                            NULL);
     if (ret < 0) {
@@ -1880,6 +1964,9 @@ static int coroutine_fn bdrv_co_do_pwrite_zeroes(BlockDriverState *bs,
         return -ENOTSUP;
     }
 
+    /* Invalidate the cached block status, the range may become a hole */
+    bdrv_bsc_invalidate_range(bs, offset, bytes);
+
     assert(alignment % bs->bl.request_alignment == 0);
     head = offset % alignment;
     tail = (offset + bytes) % alignment;
@@ -2223,6 +2310,16 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
     return bdrv_co_pwritev_part(child, offset, bytes, qiov, 0, flags);
 }
 
+/* The part of bdrv_co_write_req_prepare() that a fast write can skip */
+static bool bdrv_fast_write_ok(BlockDriverState *bs, int64_t offset,
+                               int64_t bytes)
+{
+    return bdrv_fast_request_ok(bs, offset, bytes) &&
+           QLIST_EMPTY(&bs->dirty_bitmaps) &&
+           bs->detect_zeroes == BLOCKDEV_DETECT_ZEROES_OPTIONS_OFF &&
+           !bs->write_threshold_offset && !bdrv_is_read_only(bs);
+}
+
 int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     int64_t offset, int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset,
     BdrvRequestFlags flags)
@@ -2264,6 +2361,26 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
         return 0;
     }
 
+    if (!(flags & ~BDRV_REQ_FUA) && bdrv_fast_write_ok(bs, offset, bytes) &&
+        bdrv_fast_request_begin(bs)) {
+        assert(!(bs->open_flags & BDRV_O_INACTIVE));
+        assert(child->perm & BLK_PERM_WRITE);
+
+        bdrv_inc_in_flight(bs);
+        bdrv_debug_event(bs, BLKDBG_PWRITEV);
+        ret = bdrv_driver_pwritev(bs, offset, bytes, qiov, qiov_offset, flags);
+        bdrv_debug_event(bs, BLKDBG_PWRITEV_DONE);
+
+        /* See bdrv_co_write_req_finish(), the image does not grow */
+        qatomic_inc(&bs->write_gen);
+        stat64_max(&bs->wr_highest_offset, offset + bytes);
+        bdrv_set_dirty(bs, offset, bytes);
+
+        bdrv_fast_request_end(bs);
+        bdrv_dec_in_flight(bs);
+        return ret < 0 ? ret : 0;
+    }
+
     if (!(flags & BDRV_REQ_ZERO_WRITE)) {
         /*
          * Pad request for following read-modify-write cycle.
@@ -2444,9 +2561,50 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
     if (bs->drv->bdrv_co_block_status) {
-        ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
-                                            aligned_bytes, pnum, &local_map,
-                                            &local_file);
+        /*
+         * Use the block-status cache only for protocol nodes: format
+         * drivers are generally quick to inquire the status, but protocol
+         * drivers often need to get the information from outside of qemu
+         * (lseek(SEEK_DATA) in file-posix can take very long on large
+         * sparse files).  Only data regions are cached, because writes
+         * never turn data into holes; discards and write-zeroes invalidate
+         * the cache.
+         *
+         * Limiting ourselves to protocol nodes also allows us to assume
+         * that the status of a data region is DATA | OFFSET_VALID with the
+         * host offset being the same as the guest offset.
+         *
+         * External writers may zero parts of the cached region without the
+         * cache being invalidated, which at worst reports zeroes as data.
+         */
+        if (QLIST_EMPTY(&bs->children) &&
+            bdrv_bsc_is_data(bs, aligned_offset, pnum))
+        {
+            ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+            local_file = bs;
+            local_map = aligned_offset;
+        } else {
+            ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
+                                                aligned_bytes, pnum,
+                                                &local_map, &local_file);
+
+            /*
+             * Only fill the cache from want_zero queries, which have
+             * accurate information about what is zero and what is data.
+             */
+            if (want_zero &&
+                ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
+                QLIST_EMPTY(&bs->children))
+            {
+                /*
+                 * The cache returns local_file = bs and local_map =
+                 * aligned_offset, so the driver must have done the same.
+                 */
+                assert(local_file == bs);
+                assert(local_map == aligned_offset);
+                bdrv_bsc_fill(bs, aligned_offset, *pnum);
+            }
+        }
     } else {
         /* Default code for filters */
 
@@ -2999,6 +3157,9 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
         return 0;
     }
 
+    /* Invalidate the cached block status */
+    bdrv_bsc_invalidate_range(bs, offset, bytes);
+
     /* Discard is advisory, but some devices track and coalesce
      * unaligned requests, so we must pass everything down rather than
      * round here.  Still, most devices will just silently ignore
@@ -3421,6 +3582,9 @@ int coroutine_fn bdrv_co_truncate(BdrvChild *child, int64_t offset, bool exact,
         goto out;
     }
 
+    /* Data beyond the new end of the image is gone */
+    bdrv_bsc_invalidate_range(bs, offset, INT64_MAX);
+
     filtered = bdrv_filter_child(bs);
     backing = bdrv_cow_child(bs);
 
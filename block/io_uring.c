@@ -22,6 +22,10 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of files and buffers that can be registered with the ring */
+#define MAX_FIXED_FILES 64
+#define MAX_FIXED_BUFS 64
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -56,6 +60,23 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /* Completions must be reaped with io_uring_enter, see LuringSetup */
+    bool iopoll;
+
+    /* The kernel supports IORING_OP_FALLOCATE */
+    bool has_fallocate;
+
+    /*
+     * Files registered with the ring, -1 for a free slot.  Protected by
+     * AioContext lock.
+     */
+    bool has_fixed_files;
+    int fixed_files[MAX_FIXED_FILES];
+
+    /* Buffers registered with the ring.  Protected by AioContext lock. */
+    unsigned int nr_fixed_bufs;
+    struct iovec fixed_bufs[MAX_FIXED_BUFS];
 } LuringState;
 
 /**
@@ -144,6 +165,14 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
+    /*
+     * Polled requests don't post their completion by themselves; this
+     * io_uring_enter(IORING_ENTER_GETEVENTS) reaps them.
+     */
+    if (s->iopoll && s->io_q.in_flight) {
+        io_uring_submit(&s->ring);
+    }
+
     while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
@@ -204,9 +233,110 @@ end:
             aio_co_wake(luringcb->co);
         }
     }
+
+    /*
+     * Nothing wakes up the event loop for polled requests, so keep the BH
+     * scheduled while some are in flight.  The AioContext goes back to
+     * sleeping once they have all completed.
+     */
+    if (s->iopoll && s->io_q.in_flight) {
+        return;
+    }
     qemu_bh_cancel(s->completion_bh);
 }
 
+/**
+ * luring_fixed_file:
+ *
+ * Returns the slot of @fd in the registered files, registering it in a
+ * free slot the first time, or -1 if it can't be registered.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int free_slot = -1;
+    int i;
+
+    if (!s->has_fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            return i;
+        }
+        if (s->fixed_files[i] == -1 && free_slot == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot == -1 ||
+        io_uring_register_files_update(&s->ring, free_slot, &fd, 1) != 1) {
+        return -1;
+    }
+
+    s->fixed_files[free_slot] = fd;
+    trace_luring_register_fd(s, fd, free_slot);
+    return free_slot;
+}
+
+/**
+ * luring_fixed_buf:
+ *
+ * Returns the index of the registered buffer that contains @iov,
+ * or -1 if there is none.
+ */
+static int luring_fixed_buf(LuringState *s, const struct iovec *iov)
+{
+    uintptr_t start = (uintptr_t)iov->iov_base;
+    unsigned int i;
+
+    for (i = 0; i < s->nr_fixed_bufs; i++) {
+        uintptr_t base = (uintptr_t)s->fixed_bufs[i].iov_base;
+
+        if (start >= base &&
+            start + iov->iov_len <= base + s->fixed_bufs[i].iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * luring_use_fixed:
+ *
+ * Switch @sqe to the registered file, and to READ_FIXED/WRITE_FIXED when
+ * its single buffer lies in a registered buffer, so that the kernel
+ * doesn't have to look up the file and pin the pages for each request.
+ *
+ * This is done when the sqe is copied to the ring rather than when the
+ * request is prepared, so that requests waiting in submit_queue don't
+ * keep slots that were unregistered meanwhile.
+ */
+static void luring_use_fixed(LuringState *s, struct io_uring_sqe *sqe)
+{
+    struct iovec *iov;
+    int index;
+
+    index = luring_fixed_file(s, sqe->fd);
+    if (index >= 0) {
+        sqe->fd = index;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    if ((sqe->opcode != IORING_OP_READV && sqe->opcode != IORING_OP_WRITEV) ||
+        sqe->len != 1) {
+        return;
+    }
+    iov = (struct iovec *)(uintptr_t)sqe->addr;
+    index = luring_fixed_buf(s, iov);
+    if (index >= 0) {
+        sqe->opcode = sqe->opcode == IORING_OP_READV ?
+                      IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->addr = (__u64)(uintptr_t)iov->iov_base;
+        sqe->len = iov->iov_len;
+        sqe->buf_index = index;
+    }
+}
+
 static int ioq_submit(LuringState *s)
 {
     int ret = 0;
@@ -225,6 +355,7 @@ static int ioq_submit(LuringState *s)
             }
             /* Prep sqe for submission */
             *sqes = luringcb->sqeq;
+            luring_use_fixed(s, sqes);
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
         }
         ret = io_uring_submit(&s->ring);
@@ -278,6 +409,9 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    if (s->iopoll && s->io_q.in_flight) {
+        io_uring_submit(&s->ring);
+    }
     if (io_uring_cq_ready(&s->ring)) {
         luring_process_completions_and_submit(s);
         return true;
@@ -312,6 +446,34 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_queue:
+ * @s: AIO state
+ * @luringcb: AIO control block with a prepared sqe
+ *
+ * Adds the request to the pending queue, and submits it unless the queue
+ * is plugged and not full yet
+ */
+static int luring_queue(LuringState *s, LuringAIOCB *luringcb)
+{
+    int ret;
+
+    io_uring_sqe_set_data(&luringcb->sqeq, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
+                           s->io_q.in_queue, s->io_q.in_flight);
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+        ret = ioq_submit(s);
+        trace_luring_do_submit_done(s, ret);
+        return ret;
+    }
+    return 0;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -320,13 +482,12 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
  * @offset: offset for request
  * @type: type of request
  *
- * Fetches sqes from ring, adds to pending queue and preps them
+ * Preps the sqe of the request and queues it
  *
  */
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
-    int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
     switch (type) {
@@ -346,20 +507,8 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
-    io_uring_sqe_set_data(sqes, luringcb);
 
-    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
-    s->io_q.in_queue++;
-    trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
-                           s->io_q.in_queue, s->io_q.in_flight);
-    if (!s->io_q.blocked &&
-        (!s->io_q.plugged ||
-         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
-        ret = ioq_submit(s);
-        trace_luring_do_submit_done(s, ret);
-        return ret;
-    }
-    return 0;
+    return luring_queue(s, luringcb);
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
@@ -386,6 +535,144 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     return luringcb.ret;
 }
 
+/**
+ * luring_has_fallocate:
+ * @s: AIO state
+ *
+ * Returns whether luring_co_fallocate() can be used with this ring.
+ * Polled rings only support reads and writes.
+ */
+bool luring_has_fallocate(LuringState *s)
+{
+    return s->has_fallocate && !s->iopoll;
+}
+
+/**
+ * luring_co_fallocate:
+ * @bs: block device
+ * @s: AIO state, luring_has_fallocate() must be true
+ * @fd: file descriptor
+ * @mode: fallocate(2) mode
+ * @offset: start of the range
+ * @len: length of the range
+ *
+ * Runs fallocate(2) through the ring instead of blocking a worker thread.
+ * Returns 0 on success and -errno on failure.
+ */
+int coroutine_fn luring_co_fallocate(BlockDriverState *bs, LuringState *s,
+                                     int fd, int mode, uint64_t offset,
+                                     uint64_t len)
+{
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+    };
+
+    assert(luring_has_fallocate(s));
+    trace_luring_co_fallocate(bs, s, &luringcb, fd, mode, offset, len);
+    io_uring_prep_fallocate(&luringcb.sqeq, fd, mode, offset, len);
+    ret = luring_queue(s, &luringcb);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+/**
+ * luring_unregister_fd:
+ * @s: AIO state
+ * @fd: file descriptor
+ *
+ * Drop @fd from the registered files.  It must be called before @fd is
+ * closed, or before its requests move to another AioContext; otherwise
+ * the slot would keep pointing to the old file if the descriptor number
+ * was reused.
+ */
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int unused = -1;
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            s->fixed_files[i] = -1;
+            trace_luring_unregister_fd(s, fd, i);
+            return;
+        }
+    }
+}
+
+/*
+ * Replace the registered buffers with the first @nr of fixed_bufs.  The
+ * kernel waits for the requests in flight before updating the table.
+ */
+static void luring_update_fixed_bufs(LuringState *s, unsigned int nr)
+{
+    int ret;
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        s->nr_fixed_bufs = 0;
+    }
+    if (nr) {
+        ret = io_uring_register_buffers(&s->ring, s->fixed_bufs, nr);
+        trace_luring_update_fixed_bufs(s, nr, ret);
+        if (ret == 0) {
+            s->nr_fixed_bufs = nr;
+        }
+    }
+}
+
+/**
+ * luring_register_buf:
+ * @s: AIO state
+ * @host: start of the buffer
+ * @size: size of the buffer
+ *
+ * Register a buffer that is used for I/O often, so that requests on it
+ * use READ_FIXED/WRITE_FIXED.  The pages of the buffer stay pinned until
+ * luring_unregister_buf() is called.
+ */
+void luring_register_buf(LuringState *s, void *host, size_t size)
+{
+    unsigned int nr = s->nr_fixed_bufs;
+
+    if (nr == MAX_FIXED_BUFS) {
+        return;
+    }
+    s->fixed_bufs[nr].iov_base = host;
+    s->fixed_bufs[nr].iov_len = size;
+    luring_update_fixed_bufs(s, nr + 1);
+}
+
+/**
+ * luring_unregister_buf:
+ * @s: AIO state
+ * @host: start of a buffer given to luring_register_buf()
+ *
+ * The buffer is no longer used once this returns, and can be freed.
+ */
+void luring_unregister_buf(LuringState *s, void *host)
+{
+    unsigned int nr = s->nr_fixed_bufs;
+    unsigned int i;
+
+    for (i = 0; i < nr; i++) {
+        if (s->fixed_bufs[i].iov_base == host) {
+            s->fixed_bufs[i] = s->fixed_bufs[nr - 1];
+            luring_update_fixed_bufs(s, nr - 1);
+            return;
+        }
+    }
+}
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd, false, NULL, NULL, NULL,
@@ -402,26 +689,69 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+/**
+ * luring_init_setup:
+ * @setup: how to create the ring, or NULL for the defaults
+ * @errp: pointer to an error
+ *
+ * With @setup->sqpoll, a kernel thread polls the submission queue, and
+ * io_uring_submit() only makes a syscall when that thread went to sleep
+ * after being idle.  With @setup->iopoll, the kernel polls the device for
+ * completions instead of relying on interrupts; it only works for
+ * O_DIRECT files on drivers that support polling, and doesn't support
+ * flushes.
+ */
+LuringState *luring_init_setup(const LuringSetup *setup, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
+    struct io_uring_probe *probe;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (setup && setup->sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        if (setup->sq_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = setup->sq_cpu;
+        }
+    }
+    if (setup && setup->iopoll) {
+        params.flags |= IORING_SETUP_IOPOLL;
+        s->iopoll = true;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
 
     ioq_init(&s->io_q);
+
+    /* Older kernels can't register sparse file tables, do without */
+    memset(s->fixed_files, -1, sizeof(s->fixed_files));
+    s->has_fixed_files = io_uring_register_files(ring, s->fixed_files,
+                                                 MAX_FIXED_FILES) == 0;
+
+    probe = io_uring_get_probe_ring(ring);
+    if (probe) {
+        s->has_fallocate = io_uring_opcode_supported(probe,
+                                                     IORING_OP_FALLOCATE);
+        io_uring_free_probe(probe);
+    }
     return s;
 
 }
 
+LuringState *luring_init(Error **errp)
+{
+    return luring_init_setup(NULL, errp);
+}
+
 void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
@@ -0,0 +1,836 @@
+/*
+ * local-cache filter driver
+ *
+ * The driver keeps a persistent copy of the recently read clusters of its
+ * "file" child, typically a network-backed disk, in its "cache" child,
+ * typically a file on a local SSD.  Reads of cached clusters are served
+ * from the cache node; writes go to the "file" child and drop the cached
+ * copies they overwrite (write-through).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The cache node starts with a LocalCacheHeader, followed by the index
+ * (one big-endian 64-bit entry per slot, holding the cached cluster index
+ * plus one, or 0 for an empty slot) and by the data of the slots, each
+ * aligned to the cluster size.
+ *
+ * The index is kept in memory while the node is open, with the slots in
+ * LRU order, and only written back on close.  Before anything in the cache
+ * node is modified, the header is flushed with LOCAL_CACHE_DIRTY set; the
+ * flag is cleared after the index has been written back and flushed.  A
+ * cache found dirty on open, for example after a crash, is dropped, so the
+ * index never refers to data that was not completely written or that was
+ * overwritten on the "file" child afterwards.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define LOCAL_CACHE_MAGIC       0x514c4f4341434845ULL /* "QLOCACHE" */
+#define LOCAL_CACHE_VERSION     1
+
+/* The index on disk may be out of date */
+#define LOCAL_CACHE_DIRTY       (1U << 0)
+
+typedef struct LocalCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t cluster_size;
+    uint32_t reserved;
+    uint64_t nb_slots;
+    uint64_t index_offset;
+    uint64_t data_offset;
+    uint64_t image_key;
+} QEMU_PACKED LocalCacheHeader;
+
+typedef enum LocalCacheSlotState {
+    /* in the free list */
+    LC_SLOT_FREE,
+    /* in the map, the data is being read and then written to the cache */
+    LC_SLOT_FILLING,
+    /* in the map and in the LRU list */
+    LC_SLOT_VALID,
+    /* dropped, but it is still being read from */
+    LC_SLOT_DROPPED,
+} LocalCacheSlotState;
+
+typedef struct LocalCacheSlot {
+    uint64_t cluster;
+    LocalCacheSlotState state;
+    /* the cluster was written while the slot was being filled */
+    bool stale;
+    unsigned readers;
+    QTAILQ_ENTRY(LocalCacheSlot) next;
+} LocalCacheSlot;
+
+typedef struct BDRVLocalCacheState {
+    BdrvChild *cache;
+
+    uint32_t cluster_size;
+    uint64_t nb_slots;
+    uint64_t index_offset;
+    uint64_t data_offset;
+    uint64_t image_key;
+
+    LocalCacheSlot *slots;
+    /* cluster index -> slot, for filling and valid slots */
+    GHashTable *map;
+    /* valid slots, most recently used first */
+    QTAILQ_HEAD(, LocalCacheSlot) lru;
+    QTAILQ_HEAD(, LocalCacheSlot) free;
+
+    /* LOCAL_CACHE_DIRTY is set on disk */
+    bool marked_dirty;
+    CoMutex dirty_lock;
+} BDRVLocalCacheState;
+
+#define LOCAL_CACHE_OPT_IMAGE_ID        "image-id"
+#define LOCAL_CACHE_OPT_CLUSTER_SIZE    "cluster-size"
+static QemuOptsList runtime_opts = {
+    .name = "local-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = LOCAL_CACHE_OPT_IMAGE_ID,
+            .type = QEMU_OPT_STRING,
+            .help = "identity of the image, default its filename",
+        },
+        {
+            .name = LOCAL_CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "cache granularity, default 64k",
+        },
+        { /* end of list */ }
+    },
+};
+
+/* 64-bit FNV-1a */
+static uint64_t local_cache_hash_str(const char *str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*str) {
+        h ^= (uint8_t)*str++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t local_cache_slot_offset(BDRVLocalCacheState *s,
+                                        LocalCacheSlot *slot)
+{
+    return s->data_offset + (uint64_t)(slot - s->slots) * s->cluster_size;
+}
+
+static void local_cache_free_slot(BDRVLocalCacheState *s,
+                                  LocalCacheSlot *slot)
+{
+    slot->state = LC_SLOT_FREE;
+    slot->stale = false;
+    QTAILQ_INSERT_TAIL(&s->free, slot, next);
+}
+
+/* Drop @slot, or mark it stale if it is being filled */
+static void local_cache_drop_slot(BDRVLocalCacheState *s,
+                                  LocalCacheSlot *slot)
+{
+    switch (slot->state) {
+    case LC_SLOT_FILLING:
+        slot->stale = true;
+        break;
+    case LC_SLOT_VALID:
+        QTAILQ_REMOVE(&s->lru, slot, next);
+        g_hash_table_remove(s->map, &slot->cluster);
+        slot->state = LC_SLOT_DROPPED;
+        /* fall through */
+    case LC_SLOT_DROPPED:
+        if (!slot->readers) {
+            local_cache_free_slot(s, slot);
+        }
+        break;
+    case LC_SLOT_FREE:
+        break;
+    }
+}
+
+static void local_cache_drop_all(BDRVLocalCacheState *s)
+{
+    uint64_t i;
+
+    for (i = 0; i < s->nb_slots; i++) {
+        local_cache_drop_slot(s, &s->slots[i]);
+    }
+}
+
+/* Drop the cached clusters that intersect [@offset, @offset + @bytes) */
+static void local_cache_invalidate(BlockDriverState *bs, uint64_t offset,
+                                   uint64_t bytes)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    uint64_t cluster = offset / s->cluster_size;
+    uint64_t end = DIV_ROUND_UP(offset + bytes, s->cluster_size);
+    LocalCacheSlot *slot;
+
+    trace_local_cache_invalidate(bs, offset, bytes);
+
+    for (; cluster < end; cluster++) {
+        slot = g_hash_table_lookup(s->map, &cluster);
+        if (slot) {
+            local_cache_drop_slot(s, slot);
+        }
+    }
+}
+
+/*
+ * Reserve a slot for @cluster, evicting the least recently used one if
+ * needed.  Returns NULL if all slots are busy.
+ */
+static LocalCacheSlot *local_cache_alloc_slot(BDRVLocalCacheState *s,
+                                              uint64_t cluster)
+{
+    LocalCacheSlot *slot = QTAILQ_FIRST(&s->free);
+
+    if (slot) {
+        QTAILQ_REMOVE(&s->free, slot, next);
+    } else {
+        QTAILQ_FOREACH_REVERSE(slot, &s->lru, next) {
+            if (!slot->readers) {
+                break;
+            }
+        }
+        if (!slot) {
+            return NULL;
+        }
+        QTAILQ_REMOVE(&s->lru, slot, next);
+        g_hash_table_remove(s->map, &slot->cluster);
+    }
+
+    slot->cluster = cluster;
+    slot->state = LC_SLOT_FILLING;
+    slot->stale = false;
+    g_hash_table_insert(s->map, &slot->cluster, slot);
+    return slot;
+}
+
+static void local_cache_complete_slot(BDRVLocalCacheState *s,
+                                      LocalCacheSlot *slot, bool success)
+{
+    assert(slot->state == LC_SLOT_FILLING);
+
+    if (!success || slot->stale) {
+        g_hash_table_remove(s->map, &slot->cluster);
+        local_cache_free_slot(s, slot);
+        return;
+    }
+
+    slot->state = LC_SLOT_VALID;
+    QTAILQ_INSERT_HEAD(&s->lru, slot, next);
+}
+
+static bool local_cache_is_cached(BDRVLocalCacheState *s, uint64_t cluster)
+{
+    LocalCacheSlot *slot = g_hash_table_lookup(s->map, &cluster);
+
+    return slot && slot->state == LC_SLOT_VALID;
+}
+
+static int local_cache_write_header(BlockDriverState *bs, uint32_t flags)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    LocalCacheHeader header = {
+        .magic          = cpu_to_be64(LOCAL_CACHE_MAGIC),
+        .version        = cpu_to_be32(LOCAL_CACHE_VERSION),
+        .flags          = cpu_to_be32(flags),
+        .cluster_size   = cpu_to_be32(s->cluster_size),
+        .nb_slots       = cpu_to_be64(s->nb_slots),
+        .index_offset   = cpu_to_be64(s->index_offset),
+        .data_offset    = cpu_to_be64(s->data_offset),
+        .image_key      = cpu_to_be64(s->image_key),
+    };
+    int ret;
+
+    ret = bdrv_pwrite(s->cache, 0, &header, sizeof(header));
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_flush(s->cache->bs);
+}
+
+/* Must be called before anything in the cache node is modified */
+static int coroutine_fn local_cache_mark_dirty(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret = 0;
+
+    if (s->marked_dirty) {
+        return 0;
+    }
+
+    qemu_co_mutex_lock(&s->dirty_lock);
+    if (!s->marked_dirty) {
+        ret = local_cache_write_header(bs, LOCAL_CACHE_DIRTY);
+        s->marked_dirty = ret == 0;
+    }
+    qemu_co_mutex_unlock(&s->dirty_lock);
+
+    return ret;
+}
+
+/* Write back the index and mark the cache clean */
+static int local_cache_persist(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    size_t index_size = s->nb_slots * sizeof(uint64_t);
+    g_autofree uint64_t *index = g_try_malloc0(index_size);
+    LocalCacheSlot *slot;
+    int ret;
+
+    if (!index) {
+        return -ENOMEM;
+    }
+
+    QTAILQ_FOREACH(slot, &s->lru, next) {
+        index[slot - s->slots] = cpu_to_be64(slot->cluster + 1);
+    }
+
+    ret = bdrv_pwrite(s->cache, s->index_offset, index, index_size);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = bdrv_flush(s->cache->bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = local_cache_write_header(bs, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->marked_dirty = false;
+    return 0;
+}
+
+/* Compute the layout of an empty cache on a node of @len bytes */
+static int local_cache_init_layout(BDRVLocalCacheState *s, int64_t len,
+                                   Error **errp)
+{
+    s->index_offset = s->cluster_size;
+    s->nb_slots = 0;
+    if (len > s->index_offset) {
+        s->nb_slots = (len - s->index_offset) /
+                      (s->cluster_size + sizeof(uint64_t));
+    }
+
+    for (; s->nb_slots > 0; s->nb_slots--) {
+        s->data_offset = ROUND_UP(s->index_offset +
+                                  s->nb_slots * sizeof(uint64_t),
+                                  s->cluster_size);
+        if (s->data_offset + s->nb_slots * s->cluster_size <= len) {
+            break;
+        }
+    }
+
+    if (s->nb_slots == 0) {
+        error_setg(errp, "The cache node is too small");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Load the index of the cache node, or set up an empty cache */
+static int local_cache_load(BlockDriverState *bs, Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    g_autofree uint64_t *index = NULL;
+    LocalCacheHeader header;
+    uint64_t nb_clusters, i;
+    int64_t len, image_len;
+    int ret;
+
+    len = bdrv_getlength(s->cache->bs);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "Could not get the cache node length");
+        return len;
+    }
+
+    image_len = bdrv_getlength(bs->file->bs);
+    if (image_len < 0) {
+        error_setg_errno(errp, -image_len, "Could not get the image length");
+        return image_len;
+    }
+    nb_clusters = DIV_ROUND_UP(image_len, s->cluster_size);
+
+    ret = bdrv_pread(s->cache, 0, &header, sizeof(header));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the cache header");
+        return ret;
+    }
+
+    s->nb_slots = be64_to_cpu(header.nb_slots);
+    s->index_offset = be64_to_cpu(header.index_offset);
+    s->data_offset = be64_to_cpu(header.data_offset);
+
+    if (be64_to_cpu(header.magic) != LOCAL_CACHE_MAGIC ||
+        be32_to_cpu(header.version) != LOCAL_CACHE_VERSION ||
+        (be32_to_cpu(header.flags) & LOCAL_CACHE_DIRTY) ||
+        be32_to_cpu(header.cluster_size) != s->cluster_size ||
+        be64_to_cpu(header.image_key) != s->image_key ||
+        s->nb_slots == 0 || s->nb_slots > len / s->cluster_size ||
+        s->index_offset < sizeof(header) ||
+        s->index_offset + s->nb_slots * sizeof(uint64_t) > s->data_offset ||
+        !QEMU_IS_ALIGNED(s->data_offset, s->cluster_size) ||
+        s->data_offset + s->nb_slots * s->cluster_size > len) {
+        /* Unusable or out of date, start over */
+        trace_local_cache_reset(bs);
+        return local_cache_init_layout(s, len, errp);
+    }
+
+    index = g_try_new(uint64_t, s->nb_slots);
+    if (!index) {
+        error_setg(errp, "Could not allocate the cache index");
+        return -ENOMEM;
+    }
+
+    ret = bdrv_pread(s->cache, s->index_offset, index,
+                     s->nb_slots * sizeof(uint64_t));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the cache index");
+        return ret;
+    }
+
+    s->slots = g_new0(LocalCacheSlot, s->nb_slots);
+    for (i = 0; i < s->nb_slots; i++) {
+        LocalCacheSlot *slot = &s->slots[i];
+        uint64_t entry = be64_to_cpu(index[i]);
+
+        if (entry == 0 || entry > nb_clusters ||
+            g_hash_table_lookup(s->map, &(uint64_t){ entry - 1 })) {
+            local_cache_free_slot(s, slot);
+            continue;
+        }
+
+        slot->cluster = entry - 1;
+        slot->state = LC_SLOT_VALID;
+        g_hash_table_insert(s->map, &slot->cluster, slot);
+        QTAILQ_INSERT_TAIL(&s->lru, slot, next);
+    }
+
+    return 0;
+}
+
+static int local_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                            Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    QemuOpts *opts;
+    const char *image_id;
+    uint64_t i;
+    int ret;
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
+                               BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
+                               false, errp);
+    if (!bs->file) {
+        return -EINVAL;
+    }
+
+    s->cache = bdrv_open_child(NULL, options, "cache", bs, &child_of_bds,
+                               BDRV_CHILD_METADATA, false, errp);
+    if (!s->cache) {
+        return -EINVAL;
+    }
+
+    if (bdrv_is_read_only(s->cache->bs)) {
+        error_setg(errp, "The cache node must not be read-only; "
+                   "use cache.read-only=off for a read-only filter");
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    image_id = qemu_opt_get(opts, LOCAL_CACHE_OPT_IMAGE_ID) ?:
+               bs->file->bs->filename;
+    s->image_key = local_cache_hash_str(image_id);
+    s->cluster_size = qemu_opt_get_size(opts, LOCAL_CACHE_OPT_CLUSTER_SIZE,
+                                        64 * KiB);
+
+    if (!is_power_of_2(s->cluster_size) ||
+        s->cluster_size < 4 * KiB || s->cluster_size > 2 * MiB) {
+        error_setg(errp, "cluster-size must be a power of two between 4k "
+                   "and 2M");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    s->map = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+    QTAILQ_INIT(&s->free);
+    qemu_co_mutex_init(&s->dirty_lock);
+
+    ret = local_cache_load(bs, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    if (!s->slots) {
+        s->slots = g_new0(LocalCacheSlot, s->nb_slots);
+        for (i = 0; i < s->nb_slots; i++) {
+            local_cache_free_slot(s, &s->slots[i]);
+        }
+    }
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    trace_local_cache_open(bs, s->nb_slots, s->cluster_size,
+                           g_hash_table_size(s->map));
+
+out:
+    qemu_opts_del(opts);
+    if (ret < 0 && s->map) {
+        g_hash_table_destroy(s->map);
+        s->map = NULL;
+        g_free(s->slots);
+        s->slots = NULL;
+    }
+    return ret;
+}
+
+static void local_cache_close(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+
+    /* An inactive node keeps the cache marked dirty, see .bdrv_inactivate */
+    if (s->marked_dirty && !(bs->open_flags & BDRV_O_INACTIVE)) {
+        local_cache_persist(bs);
+    }
+
+    g_hash_table_destroy(s->map);
+    g_free(s->slots);
+}
+
+static int local_cache_inactivate(BlockDriverState *bs)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    /*
+     * Somebody else, like a migration destination, takes over the image
+     * and may write to it, so the cached data cannot be trusted anymore.
+     * The cache stays marked dirty on disk, so it is dropped on the next
+     * open too.
+     */
+    if (!s->marked_dirty) {
+        ret = local_cache_write_header(bs, LOCAL_CACHE_DIRTY);
+        if (ret < 0) {
+            return ret;
+        }
+        s->marked_dirty = true;
+    }
+
+    local_cache_drop_all(s);
+    return 0;
+}
+
+static void coroutine_fn local_cache_co_invalidate_cache(BlockDriverState *bs,
+                                                         Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    /* The image may have been written while we were inactive */
+    ret = local_cache_mark_dirty(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not invalidate the cache");
+        return;
+    }
+
+    local_cache_drop_all(s);
+}
+
+static void local_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                   BdrvChildRole role,
+                                   BlockReopenQueue *reopen_queue,
+                                   uint64_t perm, uint64_t shared,
+                                   uint64_t *nperm, uint64_t *nshared)
+{
+    if (role & BDRV_CHILD_FILTERED) {
+        bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                           nperm, nshared);
+        return;
+    }
+
+    /* The cache node belongs to us alone */
+    *nperm = BLK_PERM_CONSISTENT_READ;
+    if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+        *nperm |= BLK_PERM_WRITE;
+    }
+    *nshared = BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE_UNCHANGED;
+}
+
+static int64_t local_cache_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static int coroutine_fn local_cache_read_slot(BlockDriverState *bs,
+                                              LocalCacheSlot *slot,
+                                              uint64_t offset, uint64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              size_t qiov_offset)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    int ret;
+
+    trace_local_cache_hit(bs, offset, bytes);
+
+    QTAILQ_REMOVE(&s->lru, slot, next);
+    QTAILQ_INSERT_HEAD(&s->lru, slot, next);
+
+    slot->readers++;
+    ret = bdrv_co_preadv_part(s->cache,
+                              local_cache_slot_offset(s, slot) +
+                              offset % s->cluster_size,
+                              bytes, qiov, qiov_offset, 0);
+    slot->readers--;
+
+    if (ret < 0 || slot->state == LC_SLOT_DROPPED) {
+        local_cache_drop_slot(s, slot);
+    }
+
+    if (ret < 0) {
+        /* Not fatal, the data is still on the image */
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov,
+                                   qiov_offset, 0);
+    }
+    return 0;
+}
+
+/*
+ * Read [@offset, @offset + @bytes), none of which is cached, from the image
+ * and add the clusters it touches to the cache.  The clusters are read as a
+ * whole into a bounce buffer, which is also what gets written to the cache,
+ * so that the guest cannot change the data on its way.
+ */
+static int coroutine_fn local_cache_fill(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes,
+                                         QEMUIOVector *qiov,
+                                         size_t qiov_offset)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    uint64_t first = offset / s->cluster_size;
+    uint64_t start = first * s->cluster_size;
+    uint64_t len = ROUND_UP(offset + bytes, s->cluster_size) - start;
+    uint64_t nb = len / s->cluster_size;
+    g_autofree LocalCacheSlot **slots = g_new0(LocalCacheSlot *, nb);
+    bool dirty = false;
+    uint8_t *buf;
+    uint64_t i;
+    int ret;
+
+    trace_local_cache_miss(bs, offset, bytes);
+
+    buf = qemu_try_memalign(MAX(bdrv_opt_mem_align(bs->file->bs),
+                                bdrv_opt_mem_align(s->cache->bs)), len);
+    if (!buf) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov,
+                                   qiov_offset, 0);
+    }
+
+    /*
+     * Reserve the slots before reading, so that writes to the clusters
+     * that complete in the meantime mark them stale.
+     */
+    for (i = 0; i < nb; i++) {
+        if (!g_hash_table_lookup(s->map, &(uint64_t){ first + i })) {
+            slots[i] = local_cache_alloc_slot(s, first + i);
+        }
+    }
+
+    ret = bdrv_co_pread(bs->file, start, len, buf, 0);
+    if (ret >= 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, buf + (offset - start), bytes);
+        dirty = local_cache_mark_dirty(bs) == 0;
+    }
+
+    for (i = 0; i < nb; i++) {
+        bool success = false;
+
+        if (!slots[i]) {
+            continue;
+        }
+        if (ret >= 0 && dirty && !slots[i]->stale) {
+            success = bdrv_co_pwrite(s->cache,
+                                     local_cache_slot_offset(s, slots[i]),
+                                     s->cluster_size,
+                                     buf + i * s->cluster_size, 0) >= 0;
+        }
+        local_cache_complete_slot(s, slots[i], success);
+    }
+
+    qemu_vfree(buf);
+    return ret < 0 ? ret : 0;
+}
+
+static int coroutine_fn local_cache_co_preadv_part(BlockDriverState *bs,
+                                                   uint64_t offset,
+                                                   uint64_t bytes,
+                                                   QEMUIOVector *qiov,
+                                                   size_t qiov_offset,
+                                                   int flags)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    uint64_t end = offset + bytes;
+    int ret;
+
+    while (offset < end) {
+        uint64_t cluster = offset / s->cluster_size;
+        LocalCacheSlot *slot = g_hash_table_lookup(s->map, &cluster);
+        uint64_t n;
+
+        if (slot && slot->state == LC_SLOT_VALID) {
+            n = MIN(end, (cluster + 1) * s->cluster_size) - offset;
+            ret = local_cache_read_slot(bs, slot, offset, n, qiov,
+                                        qiov_offset);
+        } else {
+            /* Read the whole run of clusters that are not cached at once */
+            do {
+                cluster++;
+            } while (cluster * s->cluster_size < end &&
+                     !local_cache_is_cached(s, cluster));
+            n = MIN(end, cluster * s->cluster_size) - offset;
+            ret = local_cache_fill(bs, offset, n, qiov, qiov_offset);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset += n;
+        qiov_offset += n;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn local_cache_co_pwritev_part(BlockDriverState *bs,
+                                                    uint64_t offset,
+                                                    uint64_t bytes,
+                                                    QEMUIOVector *qiov,
+                                                    size_t qiov_offset,
+                                                    int flags)
+{
+    int ret;
+
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    /* Even a failed write may have modified the image */
+    local_cache_invalidate(bs, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_pwrite_zeroes(BlockDriverState *bs,
+                                                     int64_t offset, int bytes,
+                                                     BdrvRequestFlags flags)
+{
+    int ret;
+
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    local_cache_invalidate(bs, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_pdiscard(BlockDriverState *bs,
+                                                int64_t offset, int bytes)
+{
+    int ret;
+
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    local_cache_invalidate(bs, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn local_cache_co_truncate(BlockDriverState *bs,
+                                                int64_t offset, bool exact,
+                                                PreallocMode prealloc,
+                                                BdrvRequestFlags flags,
+                                                Error **errp)
+{
+    BDRVLocalCacheState *s = bs->opaque;
+    uint64_t i;
+    int ret;
+
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+
+    /* Drop the cluster that was cut and everything after it */
+    for (i = 0; i < s->nb_slots; i++) {
+        LocalCacheSlot *slot = &s->slots[i];
+
+        if (slot->state != LC_SLOT_FREE &&
+            (slot->cluster + 1) * s->cluster_size > offset) {
+            local_cache_drop_slot(s, slot);
+        }
+    }
+
+    return ret;
+}
+
+static BlockDriver bdrv_local_cache = {
+    .format_name                = "local-cache",
+    .instance_size              = sizeof(BDRVLocalCacheState),
+
+    .bdrv_open                  = local_cache_open,
+    .bdrv_close                 = local_cache_close,
+    .bdrv_inactivate            = local_cache_inactivate,
+    .bdrv_co_invalidate_cache   = local_cache_co_invalidate_cache,
+    .bdrv_child_perm            = local_cache_child_perm,
+
+    .bdrv_getlength             = local_cache_getlength,
+    .bdrv_co_truncate           = local_cache_co_truncate,
+
+    .bdrv_co_preadv_part        = local_cache_co_preadv_part,
+    .bdrv_co_pwritev_part       = local_cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes      = local_cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard           = local_cache_co_pdiscard,
+    .bdrv_co_block_status       = bdrv_co_block_status_from_file,
+
+    .has_variable_length        = true,
+    .is_filter                  = true,
+};
+
+static void bdrv_local_cache_init(void)
+{
+    bdrv_register(&bdrv_local_cache);
+}
+
+block_init(bdrv_local_cache_init);
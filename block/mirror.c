@@ -28,6 +28,16 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/*
+ * The size of copy operations is adapted so that they complete in between
+ * half of and the full target latency: larger operations amortize the per
+ * request overhead of the target, smaller ones keep more of them in flight.
+ */
+#define MIRROR_IO_LATENCY_TARGET_NS (50 * SCALE_MS)
+
+/* How far past the current dirty range the block status is queried */
+#define MIRROR_BLOCK_STATUS_LOOKAHEAD (64 * MAX_IO_BYTES)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -37,6 +47,15 @@ typedef struct MirrorBuffer {
 
 typedef struct MirrorOp MirrorOp;
 
+/* A guest write that is yet to be copied to the target */
+typedef struct MirrorWriteLogEntry {
+    int64_t offset;
+    uint64_t bytes;
+    uint64_t seq;
+    void *buf;
+    QSIMPLEQ_ENTRY(MirrorWriteLogEntry) next;
+} MirrorWriteLogEntry;
+
 typedef struct MirrorBlockJob {
     BlockJob common;
     BlockBackend *target;
@@ -80,8 +99,28 @@ typedef struct MirrorBlockJob {
     bool unmap;
     int target_cluster_size;
     int max_iov;
+    /* Current size limit of copy operations, see mirror_adapt_io_bytes() */
+    int64_t max_io_bytes;
+    /* Most recent block status of the source, reset by writes through
+     * mirror_top_bs */
+    int64_t status_offset;
+    int64_t status_bytes;
+    int status_ret;
+    uint64_t status_gen;
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
+
+    /*
+     * Guest writes that write-coalescing mode has still to copy to the
+     * target.  write_log_bytes also counts the space reserved for writes
+     * that are in flight on the source and for entries being copied, and
+     * is bounded by buf_size.
+     */
+    QSIMPLEQ_HEAD(, MirrorWriteLogEntry) write_log;
+    uint64_t write_log_bytes;
+    uint64_t write_log_seq;
+    CoQueue write_log_space;
+    bool write_log_closed;
     bool prepared;
     bool in_drain;
 } MirrorBlockJob;
@@ -107,6 +146,8 @@ struct MirrorOp {
     bool is_in_flight;
     CoQueue waiting_requests;
     Coroutine *co;
+    /* Submission time of copy operations */
+    int64_t start_ns;
 
     QTAILQ_ENTRY(MirrorOp) next;
 };
@@ -166,6 +207,36 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+/*
+ * Grow or shrink the size of copy operations based on the time it took to
+ * complete @op.  Only operations that were as large as the current limit
+ * are taken into account.
+ */
+static void mirror_adapt_io_bytes(MirrorBlockJob *s, MirrorOp *op)
+{
+    int64_t latency_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - op->start_ns;
+    int64_t max_io_bytes = s->max_io_bytes;
+    int64_t limit = MIN(MAX(s->buf_size / 4, MAX_IO_BYTES),
+                        s->granularity * s->max_iov);
+
+    if (op->bytes < s->max_io_bytes) {
+        return;
+    }
+
+    if (latency_ns < MIRROR_IO_LATENCY_TARGET_NS / 2) {
+        max_io_bytes = MIN(max_io_bytes * 2, limit);
+    } else if (latency_ns > MIRROR_IO_LATENCY_TARGET_NS) {
+        max_io_bytes = MAX(max_io_bytes / 2, MIN(MAX_IO_BYTES, limit));
+    }
+    max_io_bytes = MAX(QEMU_ALIGN_DOWN(max_io_bytes, s->granularity),
+                       s->granularity);
+
+    if (max_io_bytes != s->max_io_bytes) {
+        trace_mirror_adapt_io_bytes(s, latency_ns, max_io_bytes);
+        s->max_io_bytes = max_io_bytes;
+    }
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -197,6 +268,9 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
             job_progress_update(&s->common.job, op->bytes);
         }
     }
+    if (ret >= 0 && op->start_ns) {
+        mirror_adapt_io_bytes(s, op);
+    }
     qemu_iovec_destroy(&op->qiov);
 
     qemu_co_queue_restart_all(&op->waiting_requests);
@@ -373,6 +447,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
@@ -455,16 +530,61 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
-static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
+static void mirror_invalidate_block_status(MirrorBlockJob *s)
+{
+    s->status_bytes = 0;
+    s->status_gen++;
+}
+
+/*
+ * Get the block status of the source at @offset like
+ * bdrv_block_status_above(), but query up to MIRROR_BLOCK_STATUS_LOOKAHEAD
+ * bytes at once and answer from the last result while it covers @offset.
+ * This saves a (possibly remote) block status request for most operations
+ * on large data or zero extents.
+ */
+static int coroutine_fn mirror_block_status(MirrorBlockJob *s, int64_t offset,
+                                            int64_t bytes, int64_t *pnum)
 {
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
+    int64_t status_bytes;
+    uint64_t gen;
+    int ret;
+
+    if (offset >= s->status_offset &&
+        offset < s->status_offset + s->status_bytes) {
+        *pnum = MIN(bytes, s->status_offset + s->status_bytes - offset);
+        return s->status_ret;
+    }
+
+    gen = s->status_gen;
+    ret = bdrv_block_status_above(source, NULL, offset,
+                                  MIN(MAX(bytes, MIRROR_BLOCK_STATUS_LOOKAHEAD),
+                                      s->bdev_length - offset),
+                                  &status_bytes, NULL, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Do not cache a result that a write may have made stale meanwhile */
+    if (gen == s->status_gen) {
+        s->status_offset = offset;
+        s->status_bytes = status_bytes;
+        s->status_ret = ret;
+    }
+    *pnum = MIN(bytes, status_bytes);
+    return ret;
+}
+
+static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
+{
     MirrorOp *pseudo_op;
     int64_t offset;
     uint64_t delay_ns = 0, ret = 0;
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->max_io_bytes;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -536,9 +656,8 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         MirrorMethod mirror_method = MIRROR_METHOD_COPY;
 
         assert(!(offset % s->granularity));
-        ret = bdrv_block_status_above(source, NULL, offset,
-                                      nb_chunks * s->granularity,
-                                      &io_bytes, NULL, NULL);
+        ret = mirror_block_status(s, offset, nb_chunks * s->granularity,
+                                  &io_bytes);
         if (ret < 0) {
             io_bytes = MIN(nb_chunks * s->granularity, max_io_bytes);
         } else if (ret & BDRV_BLOCK_DATA) {
@@ -877,6 +996,9 @@ static int mirror_flush(MirrorBlockJob *s)
     return ret;
 }
 
+static void coroutine_fn mirror_write_log_drain(MirrorBlockJob *s);
+static void mirror_write_log_close(MirrorBlockJob *s);
+
 static int coroutine_fn mirror_run(Job *job, Error **errp)
 {
     MirrorBlockJob *s = container_of(job, MirrorBlockJob, common.job);
@@ -954,6 +1076,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         s->cow_bitmap = bitmap_new(length);
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
+    s->max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
 
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
@@ -984,6 +1107,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             mirror_wait_for_any_operation(s, true);
         }
 
+        if (!QSIMPLEQ_EMPTY(&s->write_log)) {
+            mirror_write_log_drain(s);
+        }
+
         if (s->ret < 0) {
             ret = s->ret;
             goto immediate_exit;
@@ -1055,7 +1182,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             s->in_drain = true;
             bdrv_drained_begin(bs);
             cnt = bdrv_get_dirty_count(s->dirty_bitmap);
-            if (cnt > 0 || mirror_flush(s) < 0) {
+            if (cnt > 0 || !QSIMPLEQ_EMPTY(&s->write_log) ||
+                mirror_flush(s) < 0) {
                 bdrv_drained_end(bs);
                 s->in_drain = false;
                 continue;
@@ -1098,6 +1226,7 @@ immediate_exit:
         mirror_wait_for_all_io(s);
     }
 
+    mirror_write_log_close(s);
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
     g_free(s->cow_bitmap);
@@ -1381,28 +1510,218 @@ static void coroutine_fn active_write_settle(MirrorOp *op)
     g_free(op);
 }
 
+/*
+ * Reserve space for a write of @bytes in the write log, waiting for the
+ * job to copy earlier writes if the log is full.  Returns false if the log
+ * has been closed and the write must not be logged.
+ */
+static bool coroutine_fn mirror_write_log_reserve(MirrorBlockJob *s,
+                                                  uint64_t bytes)
+{
+    while (!s->write_log_closed &&
+           s->write_log_bytes + bytes > s->buf_size) {
+        trace_mirror_write_log_wait(s, s->write_log_bytes, bytes);
+        job_enter(&s->common.job);
+        qemu_co_queue_wait(&s->write_log_space, NULL);
+    }
+    if (s->write_log_closed) {
+        return false;
+    }
+
+    s->write_log_bytes += bytes;
+    return true;
+}
+
+static void mirror_write_log_release(MirrorBlockJob *s, uint64_t bytes)
+{
+    assert(s->write_log_bytes >= bytes);
+    s->write_log_bytes -= bytes;
+    qemu_co_queue_restart_all(&s->write_log_space);
+}
+
+/*
+ * Wait until all logged writes have been copied to the target, so that a
+ * write that is not logged cannot be overtaken by an earlier one.
+ */
+static void coroutine_fn mirror_write_log_wait_empty(MirrorBlockJob *s)
+{
+    while (!s->write_log_closed && s->write_log_bytes) {
+        job_enter(&s->common.job);
+        qemu_co_queue_wait(&s->write_log_space, NULL);
+    }
+}
+
+/* Add a write for which space was reserved; the log takes ownership of @buf */
+static void mirror_write_log_append(MirrorBlockJob *s, int64_t offset,
+                                    uint64_t bytes, void *buf)
+{
+    MirrorWriteLogEntry *e;
+
+    if (s->write_log_closed) {
+        qemu_vfree(buf);
+        mirror_write_log_release(s, bytes);
+        return;
+    }
+
+    e = g_new(MirrorWriteLogEntry, 1);
+    *e = (MirrorWriteLogEntry) {
+        .offset = offset,
+        .bytes  = bytes,
+        .seq    = s->write_log_seq++,
+        .buf    = buf,
+    };
+    QSIMPLEQ_INSERT_TAIL(&s->write_log, e, next);
+
+    if (s->write_log_bytes >= s->buf_size / 2) {
+        job_enter(&s->common.job);
+    }
+}
+
+static int mirror_write_log_cmp_offset(const void *a, const void *b)
+{
+    const MirrorWriteLogEntry *ea = *(MirrorWriteLogEntry * const *)a;
+    const MirrorWriteLogEntry *eb = *(MirrorWriteLogEntry * const *)b;
+
+    if (ea->offset != eb->offset) {
+        return ea->offset < eb->offset ? -1 : 1;
+    }
+    return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+static int mirror_write_log_cmp_seq(const void *a, const void *b)
+{
+    const MirrorWriteLogEntry *ea = *(MirrorWriteLogEntry * const *)a;
+    const MirrorWriteLogEntry *eb = *(MirrorWriteLogEntry * const *)b;
+
+    return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+/*
+ * Copy all logged writes to the target.  The writes are sorted by offset
+ * and overlapping or adjacent ones are merged into a single request, where
+ * later writes take precedence over earlier ones.  Writes that are logged
+ * meanwhile are left for the next call.
+ */
+static void coroutine_fn mirror_write_log_drain(MirrorBlockJob *s)
+{
+    MirrorWriteLogEntry **entries, *e;
+    int n = 0, i, j, k;
+
+    QSIMPLEQ_FOREACH(e, &s->write_log, next) {
+        n++;
+    }
+    entries = g_new(MirrorWriteLogEntry *, n);
+    for (i = 0; i < n; i++) {
+        entries[i] = QSIMPLEQ_FIRST(&s->write_log);
+        QSIMPLEQ_REMOVE_HEAD(&s->write_log, next);
+    }
+    qsort(entries, n, sizeof(entries[0]), mirror_write_log_cmp_offset);
+
+    for (i = 0; i < n; i = j) {
+        int64_t start = entries[i]->offset;
+        int64_t end = start + entries[i]->bytes;
+        uint64_t log_bytes = entries[i]->bytes;
+        QEMUIOVector qiov;
+        MirrorOp *op;
+        void *buf;
+
+        for (j = i + 1; j < n && entries[j]->offset <= end; j++) {
+            end = MAX(end, entries[j]->offset + entries[j]->bytes);
+            log_bytes += entries[j]->bytes;
+        }
+
+        if (j == i + 1) {
+            buf = entries[i]->buf;
+        } else {
+            buf = qemu_blockalign(blk_bs(s->target), end - start);
+            qsort(&entries[i], j - i, sizeof(entries[0]),
+                  mirror_write_log_cmp_seq);
+            for (k = i; k < j; k++) {
+                memcpy(buf + entries[k]->offset - start, entries[k]->buf,
+                       entries[k]->bytes);
+            }
+        }
+
+        trace_mirror_write_log_drain(s, start, end - start, j - i);
+        op = active_write_prepare(s, start, end - start);
+        if (s->ret >= 0) {
+            qemu_iovec_init_buf(&qiov, buf, end - start);
+            do_sync_target_write(s, MIRROR_METHOD_COPY, start, end - start,
+                                 &qiov, 0);
+        }
+        active_write_settle(op);
+
+        if (j != i + 1) {
+            qemu_vfree(buf);
+        }
+        for (k = i; k < j; k++) {
+            qemu_vfree(entries[k]->buf);
+            g_free(entries[k]);
+        }
+        mirror_write_log_release(s, log_bytes);
+    }
+
+    g_free(entries);
+}
+
+/* Drop all logged writes and stop logging, the job is exiting */
+static void mirror_write_log_close(MirrorBlockJob *s)
+{
+    MirrorWriteLogEntry *e;
+
+    s->write_log_closed = true;
+    while ((e = QSIMPLEQ_FIRST(&s->write_log))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->write_log, next);
+        s->write_log_bytes -= e->bytes;
+        qemu_vfree(e->buf);
+        g_free(e);
+    }
+    qemu_co_queue_restart_all(&s->write_log_space);
+}
+
 static int coroutine_fn bdrv_mirror_top_preadv(BlockDriverState *bs,
     uint64_t offset, uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
     return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
 }
 
+/*
+ * In write-coalescing mode, @log_buf points to the bounce buffer that
+ * @qiov refers to.  If the write is logged, the log takes ownership of the
+ * buffer and *@log_buf is set to NULL.
+ */
 static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
     MirrorMethod method, uint64_t offset, uint64_t bytes, QEMUIOVector *qiov,
-    int flags)
+    int flags, void **log_buf)
 {
     MirrorOp *op = NULL;
     MirrorBDSOpaque *s = bs->opaque;
     int ret = 0;
     bool copy_to_target;
+    bool log_write = false;
 
     copy_to_target = s->job->ret >= 0 &&
-                     s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
+                     s->job->copy_mode != MIRROR_COPY_MODE_BACKGROUND;
+
+    if (copy_to_target &&
+        s->job->copy_mode == MIRROR_COPY_MODE_WRITE_COALESCING) {
+        if (log_buf && bytes <= s->job->buf_size) {
+            log_write = mirror_write_log_reserve(s->job, bytes);
+        } else {
+            mirror_write_log_wait_empty(s->job);
+        }
+    }
 
     if (copy_to_target) {
         op = active_write_prepare(s->job, offset, bytes);
     }
 
+    /*
+     * The block status that the job looked ahead may change, both while
+     * the write is in flight and once it has completed.
+     */
+    mirror_invalidate_block_status(s->job);
+
     switch (method) {
     case MIRROR_METHOD_COPY:
         ret = bdrv_co_pwritev(bs->backing, offset, bytes, qiov, flags);
@@ -1420,11 +1739,19 @@ static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
         abort();
     }
 
+    mirror_invalidate_block_status(s->job);
+
     if (ret < 0) {
+        if (log_write) {
+            mirror_write_log_release(s->job, bytes);
+        }
         goto out;
     }
 
-    if (copy_to_target) {
+    if (log_write) {
+        mirror_write_log_append(s->job, offset, bytes, *log_buf);
+        *log_buf = NULL;
+    } else if (copy_to_target) {
         do_sync_target_write(s->job, method, offset, bytes, qiov, flags);
     }
 
@@ -1445,13 +1772,13 @@ static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     bool copy_to_target;
 
     copy_to_target = s->job->ret >= 0 &&
-                     s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
+                     s->job->copy_mode != MIRROR_COPY_MODE_BACKGROUND;
 
     if (copy_to_target) {
         /* The guest might concurrently modify the data to write; but
          * the data on source and destination must match, so we have
          * to use a bounce buffer if we are going to write to the
-         * target now. */
+         * target now or log the write. */
         bounce_buf = qemu_blockalign(bs, bytes);
         iov_to_buf_full(qiov->iov, qiov->niov, 0, bounce_buf, bytes);
 
@@ -1461,7 +1788,7 @@ static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     }
 
     ret = bdrv_mirror_top_do_write(bs, MIRROR_METHOD_COPY, offset, bytes, qiov,
-                                   flags);
+                                   flags, copy_to_target ? &bounce_buf : NULL);
 
     if (copy_to_target) {
         qemu_iovec_destroy(&bounce_qiov);
@@ -1484,14 +1811,14 @@ static int coroutine_fn bdrv_mirror_top_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags)
 {
     return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_ZERO, offset, bytes, NULL,
-                                    flags);
+                                    flags, NULL);
 }
 
 static int coroutine_fn bdrv_mirror_top_pdiscard(BlockDriverState *bs,
     int64_t offset, int bytes)
 {
     return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_DISCARD, offset, bytes,
-                                    NULL, 0);
+                                    NULL, 0, NULL);
 }
 
 static void bdrv_mirror_top_refresh_filename(BlockDriverState *bs)
@@ -1744,7 +2071,9 @@ static BlockJob *mirror_start_job(
     if (!s->dirty_bitmap) {
         goto fail;
     }
-    if (s->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING) {
+    QSIMPLEQ_INIT(&s->write_log);
+    qemu_co_queue_init(&s->write_log_space);
+    if (s->copy_mode != MIRROR_COPY_MODE_BACKGROUND) {
         bdrv_disable_dirty_bitmap(s->dirty_bitmap);
     }
 
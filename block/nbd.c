@@ -34,6 +34,7 @@
 #include "qemu/uri.h"
 #include "qemu/option.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
 
@@ -50,6 +51,7 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define NBD_MAX_MULTI_CONN  16
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
@@ -96,8 +98,17 @@ typedef struct BDRVNBDState {
     const char *hostname;
     char *x_dirty_bitmap;
     bool alloc_depth;
+    uint32_t multi_conn;
 
     NBDClientConnection *conn;
+
+    /*
+     * Additional connections to the same export if multi-conn > 1.  They
+     * are nbd nodes of their own, each with one connection that reconnects
+     * independently, and take a share of the read and write requests.
+     */
+    BdrvChild *conns[NBD_MAX_MULTI_CONN - 1];
+    int nb_conns;
 } BDRVNBDState;
 
 static void nbd_yank(void *opaque);
@@ -1320,12 +1331,38 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     return ret ? ret : request_ret;
 }
 
+/*
+ * Pick the connection with the fewest requests in flight for a new request.
+ * Returns NULL for the connection of @bs itself, otherwise the child node of
+ * an additional connection.  Connections that are being re-established are
+ * only used if no other one is connected.
+ */
+static BdrvChild *nbd_pick_connection(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BdrvChild *best = NULL;
+    int best_in_flight = nbd_client_connected(s) ? s->in_flight : INT_MAX;
+    int i;
+
+    for (i = 0; i < s->nb_conns; i++) {
+        BDRVNBDState *cs = s->conns[i]->bs->opaque;
+
+        if (nbd_client_connected(cs) && cs->in_flight < best_in_flight) {
+            best = s->conns[i];
+            best_in_flight = cs->in_flight;
+        }
+    }
+
+    return best;
+}
+
 static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
                                 uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BdrvChild *conn;
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1338,6 +1375,11 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
+
+    conn = nbd_pick_connection(bs);
+    if (conn) {
+        return bdrv_co_preadv(conn, offset, bytes, qiov, 0);
+    }
     /*
      * Work around the fact that the block layer doesn't do
      * byte-accurate sizing yet - if the read exceeds the server's
@@ -1382,6 +1424,7 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                  uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BdrvChild *conn;
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -1399,6 +1442,11 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
+
+    conn = nbd_pick_connection(bs);
+    if (conn) {
+        return bdrv_co_pwritev(conn, offset, bytes, qiov, flags);
+    }
     return nbd_co_request(bs, &request, qiov);
 }
 
@@ -1406,6 +1454,7 @@ static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                        int bytes, BdrvRequestFlags flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BdrvChild *conn;
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
@@ -1432,6 +1481,11 @@ static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
     if (!bytes) {
         return 0;
     }
+
+    conn = nbd_pick_connection(bs);
+    if (conn) {
+        return bdrv_co_pwrite_zeroes(conn, offset, bytes, flags);
+    }
     return nbd_co_request(bs, &request, NULL);
 }
 
@@ -1440,6 +1494,11 @@ static int nbd_client_co_flush(BlockDriverState *bs)
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_FLUSH };
 
+    /*
+     * The server advertised NBD_FLAG_CAN_MULTI_CONN if there are additional
+     * connections, so a flush on this connection also covers the writes
+     * that were completed on the others.
+     */
     if (!(s->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
@@ -1459,12 +1518,17 @@ static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
         .from = offset,
         .len = bytes,
     };
+    BdrvChild *conn;
 
     assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
     if (!(s->info.flags & NBD_FLAG_SEND_TRIM) || !bytes) {
         return 0;
     }
 
+    conn = nbd_pick_connection(bs);
+    if (conn) {
+        return bdrv_co_pdiscard(conn, offset, bytes);
+    }
     return nbd_co_request(bs, &request, NULL);
 }
 
@@ -1895,6 +1959,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open to the server if it "
+                    "supports multi-conn. Default 1",
+        },
         { /* end of list */ }
     },
 };
@@ -1951,6 +2021,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > NBD_MAX_MULTI_CONN) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   NBD_MAX_MULTI_CONN);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -1958,11 +2035,42 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+/*
+ * Open the additional connection @index as a child node "conn<index>" that
+ * uses the same connection options as @bs.
+ */
+static int nbd_open_connection_child(BlockDriverState *bs, QDict *conn_opts,
+                                     int index, Error **errp)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    g_autofree char *name = g_strdup_printf("conn%d", index);
+    QDict *opts = qdict_new();
+    const QDictEntry *e;
+    BdrvChild *child;
+
+    for (e = qdict_first(conn_opts); e; e = qdict_next(conn_opts, e)) {
+        g_autofree char *key = g_strdup_printf("%s.%s", name, e->key);
+
+        qdict_put_obj(opts, key, qobject_ref(e->value));
+    }
+
+    child = bdrv_open_child(NULL, opts, name, bs, &child_of_bds,
+                            BDRV_CHILD_DATA, false, errp);
+    qobject_unref(opts);
+    if (!child) {
+        return -EINVAL;
+    }
+
+    s->conns[s->nb_conns++] = child;
+    return 0;
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
-    int ret;
+    int ret, i;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    g_autoptr(QDict) conn_opts = qdict_clone_shallow(options);
 
     s->bs = bs;
     qemu_co_mutex_init(&s->send_mutex);
@@ -1990,6 +2098,24 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     bdrv_inc_in_flight(bs);
     aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
 
+    if (s->multi_conn > 1 && !(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        warn_report("NBD server does not support multi-conn, "
+                    "using a single connection");
+    } else if (s->multi_conn > 1) {
+        qdict_del(conn_opts, "multi-conn");
+        qdict_put_str(conn_opts, "driver", "nbd");
+        for (i = 1; i < s->multi_conn; i++) {
+            ret = nbd_open_connection_child(bs, conn_opts, i, errp);
+            if (ret < 0) {
+                while (s->nb_conns) {
+                    bdrv_unref_child(bs, s->conns[--s->nb_conns]);
+                }
+                nbd_client_close(bs);
+                goto fail;
+            }
+        }
+    }
+
     return 0;
 
 fail:
@@ -2171,6 +2297,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_dirname               = nbd_dirname,
     .strong_runtime_opts        = nbd_strong_runtime_opts,
     .bdrv_cancel_in_flight      = nbd_cancel_in_flight,
+    .bdrv_child_perm            = bdrv_default_perms,
 };
 
 static BlockDriver bdrv_nbd_tcp = {
@@ -2200,6 +2327,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_dirname               = nbd_dirname,
     .strong_runtime_opts        = nbd_strong_runtime_opts,
     .bdrv_cancel_in_flight      = nbd_cancel_in_flight,
+    .bdrv_child_perm            = bdrv_default_perms,
 };
 
 static BlockDriver bdrv_nbd_unix = {
@@ -2229,6 +2357,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_dirname               = nbd_dirname,
     .strong_runtime_opts        = nbd_strong_runtime_opts,
     .bdrv_cancel_in_flight      = nbd_cancel_in_flight,
+    .bdrv_child_perm            = bdrv_default_perms,
 };
 
 static void bdrv_nbd_init(void)
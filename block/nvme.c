@@ -45,6 +45,9 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
+/* Upper limit of the io-queues option */
+#define NVME_MAX_IO_QUEUES 64
+
 /* This driver shares a single MSIX IRQ for the admin and I/O queues */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
@@ -106,6 +109,8 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    /* Round-robin cursor for picking an io queue */
+    unsigned next_io_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -140,6 +145,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_IO_QUEUES "io-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -157,6 +163,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_IO_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -337,6 +348,29 @@ static void nvme_put_free_req_and_wake(NVMeQueuePair *q, NVMeRequest *req)
     qemu_mutex_unlock(&q->lock);
 }
 
+/*
+ * Pick the io queue for a new request.  Queues are used round-robin, but a
+ * queue that has run out of free requests is skipped while another one
+ * still has some, so that a burst doesn't wait on a single full queue.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    unsigned nr_io_queues, start, i;
+
+    assert(s->queue_count > 1);
+    nr_io_queues = s->queue_count - INDEX_IO(0);
+    start = qatomic_fetch_inc(&s->next_io_queue) % nr_io_queues;
+    for (i = 0; i < nr_io_queues; i++) {
+        NVMeQueuePair *q = s->queues[INDEX_IO((start + i) % nr_io_queues)];
+
+        /* Racy, the request is taken under q->lock by nvme_get_free_req() */
+        if (qatomic_read(&q->free_req_head) != -1) {
+            return q;
+        }
+    }
+    return s->queues[INDEX_IO(start)];
+}
+
 static inline int nvme_translate_error(const NvmeCqe *c)
 {
     uint16_t status = (le16_to_cpu(c->status) >> 1) & 0xFF;
@@ -691,6 +725,30 @@ out_error:
     return false;
 }
 
+/*
+ * Ask the controller for @n I/O submission and completion queues.  It may
+ * allocate fewer, in which case creating the others fails later.
+ */
+static bool nvme_set_num_io_queues(BlockDriverState *bs, unsigned n,
+                                   Error **errp)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((n - 1) << 16) | (n - 1)),
+    };
+
+    if (n == 1) {
+        /* At least one queue pair is always allocated */
+        return true;
+    }
+    if (nvme_admin_cmd_sync(bs, &cmd)) {
+        error_setg(errp, "Failed to set the number of I/O queues to %u", n);
+        return false;
+    }
+    return true;
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -701,7 +759,7 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -840,8 +898,23 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_set_num_io_queues(bs, io_queues, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    for (unsigned i = 0; i < io_queues; i++) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            if (i == 0) {
+                error_propagate(errp, local_err);
+                ret = -EIO;
+                goto out;
+            }
+            warn_reportf_err(local_err, "NVMe controller only accepted %u "
+                             "of %u I/O queues: ", i, io_queues);
+            break;
+        }
     }
 out:
     if (regs) {
@@ -932,6 +1005,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -947,7 +1021,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_IO_QUEUES, 1);
+    if (io_queues < 1 || io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IO_QUEUES "' must be between 1 "
+                   "and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1119,7 +1200,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1237,7 +1318,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1268,7 +1349,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = ((bytes >> s->blkshift) - 1) & 0xFFFF;
@@ -1321,7 +1402,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
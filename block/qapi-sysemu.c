@@ -35,8 +35,12 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qmp/qdict.h"
+#include "hw/qdev-core.h"
+#include "qemu/lockable.h"
+#include "qemu/module.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/blockdev.h"
+#include "sysemu/stats.h"
 
 static BlockBackend *qmp_get_blk(const char *blk_name, const char *qdev_id,
                                  Error **errp)
@@ -539,6 +543,7 @@ void qmp_block_latency_histogram_set(
     bool has_boundaries_read, uint64List *boundaries_read,
     bool has_boundaries_write, uint64List *boundaries_write,
     bool has_boundaries_flush, uint64List *boundaries_flush,
+    bool has_log_linear, bool log_linear,
     Error **errp)
 {
     BlockBackend *blk = qmp_get_blk(NULL, id, errp);
@@ -552,12 +557,16 @@ void qmp_block_latency_histogram_set(
     stats = blk_get_stats(blk);
 
     if (!has_boundaries && !has_boundaries_read && !has_boundaries_write &&
-        !has_boundaries_flush)
+        !has_boundaries_flush && !has_log_linear)
     {
         block_latency_histograms_clear(stats);
         return;
     }
 
+    if (has_log_linear) {
+        block_hdr_histograms_enable(stats, log_linear);
+    }
+
     if (has_boundaries || has_boundaries_read) {
         ret = block_latency_histogram_set(
             stats, BLOCK_ACCT_READ,
@@ -588,3 +597,270 @@ void qmp_block_latency_histogram_set(
         }
     }
 }
+
+#define BLOCK_STATS_IO(prefix)                                            \
+    { prefix "-operations", STATS_TYPE_CUMULATIVE },                      \
+    { prefix "-failed-operations", STATS_TYPE_CUMULATIVE },               \
+    { prefix "-invalid-operations", STATS_TYPE_CUMULATIVE },              \
+    { prefix "-total-time", STATS_TYPE_CUMULATIVE,                        \
+      true, STATS_UNIT_NANOSECONDS }
+
+#define BLOCK_STATS_HISTOGRAM(prefix)                                     \
+    { prefix "-latency-histogram", STATS_TYPE_HISTOGRAM },                \
+    { prefix "-latency-histogram-boundaries", STATS_TYPE_INSTANT,         \
+      true, STATS_UNIT_NANOSECONDS }
+
+static const StatsDescriptor block_stats[] = {
+    { "rd-bytes", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES },
+    { "wr-bytes", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES },
+    { "unmap-bytes", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES },
+    BLOCK_STATS_IO("rd"),
+    BLOCK_STATS_IO("wr"),
+    BLOCK_STATS_IO("flush"),
+    BLOCK_STATS_IO("unmap"),
+    BLOCK_STATS_HISTOGRAM("rd"),
+    BLOCK_STATS_HISTOGRAM("wr"),
+    BLOCK_STATS_HISTOGRAM("flush"),
+};
+
+static const char *const block_stats_prefix[BLOCK_MAX_IOTYPE] = {
+    [BLOCK_ACCT_READ] = "rd",
+    [BLOCK_ACCT_WRITE] = "wr",
+    [BLOCK_ACCT_FLUSH] = "flush",
+    [BLOCK_ACCT_UNMAP] = "unmap",
+};
+
+static void block_stats_add_io(StatsList **list, strList *names,
+                               BlockAcctStats *stats, enum BlockAcctType type)
+{
+    const char *prefix = block_stats_prefix[type];
+    BlockLatencyHistogram *hist = &stats->latency_histogram[type];
+    g_autofree char *name = NULL;
+
+    if (type != BLOCK_ACCT_FLUSH) {
+        name = g_strdup_printf("%s-bytes", prefix);
+        stats_add_value(list, names, name, stats->nr_bytes[type]);
+        g_free(name);
+    }
+    name = g_strdup_printf("%s-operations", prefix);
+    stats_add_value(list, names, name, stats->nr_ops[type]);
+    g_free(name);
+    name = g_strdup_printf("%s-failed-operations", prefix);
+    stats_add_value(list, names, name, stats->failed_ops[type]);
+    g_free(name);
+    name = g_strdup_printf("%s-invalid-operations", prefix);
+    stats_add_value(list, names, name, stats->invalid_ops[type]);
+    g_free(name);
+    name = g_strdup_printf("%s-total-time", prefix);
+    stats_add_value(list, names, name, stats->total_time_ns[type]);
+    g_free(name);
+
+    if (hist->bins) {
+        name = g_strdup_printf("%s-latency-histogram", prefix);
+        stats_add_values(list, names, name, hist->bins, hist->nbins);
+        g_free(name);
+        name = g_strdup_printf("%s-latency-histogram-boundaries", prefix);
+        stats_add_values(list, names, name, hist->boundaries,
+                         hist->nbins - 1);
+        g_free(name);
+    }
+}
+
+static const char *const block_stats_size[BLOCK_MAX_ACCT_SIZE] = {
+    [BLOCK_ACCT_SIZE_SMALL] = "small",
+    [BLOCK_ACCT_SIZE_MEDIUM] = "medium",
+    [BLOCK_ACCT_SIZE_LARGE] = "large",
+    [BLOCK_ACCT_SIZE_HUGE] = "huge",
+};
+
+static const char *const block_stats_stage[BLOCK_MAX_ACCT_STAGE] = {
+    [BLOCK_ACCT_STAGE_TOTAL] = "total",
+    [BLOCK_ACCT_STAGE_THROTTLE] = "throttle",
+    [BLOCK_ACCT_STAGE_DRIVER] = "driver",
+};
+
+static const unsigned block_stats_permille[] = { 500, 900, 990, 999 };
+
+/* Flushes have no size, and only reads and writes are split in stages */
+static bool block_hdr_stats_exist(enum BlockAcctType type,
+                                  enum BlockAcctSize size,
+                                  enum BlockAcctStage stage)
+{
+    switch (type) {
+    case BLOCK_ACCT_READ:
+    case BLOCK_ACCT_WRITE:
+        return true;
+    case BLOCK_ACCT_FLUSH:
+        return size == BLOCK_ACCT_SIZE_SMALL &&
+               stage == BLOCK_ACCT_STAGE_TOTAL;
+    default:
+        return stage == BLOCK_ACCT_STAGE_TOTAL;
+    }
+}
+
+/* E.g. "rd-small-driver-latency", "flush-total-latency-p99" */
+static char *block_hdr_stats_name(enum BlockAcctType type,
+                                  enum BlockAcctSize size,
+                                  enum BlockAcctStage stage,
+                                  const char *suffix)
+{
+    if (type == BLOCK_ACCT_FLUSH) {
+        return g_strdup_printf("%s-%s-latency%s", block_stats_prefix[type],
+                               block_stats_stage[stage], suffix);
+    }
+    return g_strdup_printf("%s-%s-%s-latency%s", block_stats_prefix[type],
+                           block_stats_size[size], block_stats_stage[stage],
+                           suffix);
+}
+
+/* E.g. "rd-small-driver-latency-p50", "rd-small-driver-latency-p999" */
+static char *block_hdr_stats_percentile_name(enum BlockAcctType type,
+                                             enum BlockAcctSize size,
+                                             enum BlockAcctStage stage,
+                                             unsigned permille)
+{
+    g_autofree char *suffix =
+        g_strdup_printf("-p%u", permille % 10 ? permille : permille / 10);
+
+    return block_hdr_stats_name(type, size, stage, suffix);
+}
+
+/* Only the histograms that have samples are returned */
+static void block_stats_add_hdr(StatsList **list, strList *names,
+                                BlockHdrHistograms *hdr)
+{
+    g_autofree uint64_t *boundaries = block_hdr_histogram_boundaries();
+    enum BlockAcctType type;
+    enum BlockAcctSize size;
+    enum BlockAcctStage stage;
+    unsigned i;
+
+    for (type = BLOCK_ACCT_READ; type < BLOCK_MAX_IOTYPE; type++) {
+        for (size = 0; size < BLOCK_MAX_ACCT_SIZE; size++) {
+            for (stage = 0; stage < BLOCK_MAX_ACCT_STAGE; stage++) {
+                const uint64_t *bins = hdr->bins[type][size][stage];
+                g_autofree char *name = NULL;
+                g_autofree char *bname = NULL;
+
+                /* The maximum is only zero for an empty histogram */
+                if (!block_hdr_stats_exist(type, size, stage) ||
+                    !block_hdr_histogram_percentile(bins, 1000)) {
+                    continue;
+                }
+
+                name = block_hdr_stats_name(type, size, stage, "");
+                bname = block_hdr_stats_name(type, size, stage,
+                                             "-boundaries");
+                stats_add_values(list, names, name, bins, BLOCK_HDR_NBINS);
+                stats_add_values(list, names, bname, boundaries,
+                                 BLOCK_HDR_NBINS - 1);
+
+                for (i = 0; i < ARRAY_SIZE(block_stats_permille); i++) {
+                    unsigned permille = block_stats_permille[i];
+                    g_autofree char *pname =
+                        block_hdr_stats_percentile_name(type, size, stage,
+                                                        permille);
+
+                    stats_add_value(list, names, pname,
+                                    block_hdr_histogram_percentile(bins,
+                                                                   permille));
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Only devices are reported, identified by their QOM path.  The counters
+ * are read under the accounting lock, so that a request completing in an
+ * iothread does not tear a histogram.
+ */
+static void block_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *targets, strList *names, Error **errp)
+{
+    BlockBackend *blk;
+
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+
+    for (blk = blk_next(NULL); blk; blk = blk_next(blk)) {
+        DeviceState *dev = blk_get_attached_dev(blk);
+        BlockAcctStats *stats = blk_get_stats(blk);
+        g_autofree char *path = NULL;
+        StatsList *list = NULL;
+        enum BlockAcctType type;
+
+        if (!dev) {
+            continue;
+        }
+        path = object_get_canonical_path(OBJECT(dev));
+        if (!apply_str_list_filter(path, targets)) {
+            continue;
+        }
+
+        WITH_QEMU_LOCK_GUARD(&stats->lock) {
+            for (type = BLOCK_ACCT_READ; type < BLOCK_MAX_IOTYPE; type++) {
+                block_stats_add_io(&list, names, stats, type);
+            }
+            if (stats->hdr) {
+                block_stats_add_hdr(&list, names, stats->hdr);
+            }
+        }
+        stats_add_result(result, STATS_PROVIDER_BLOCK, path, list);
+    }
+}
+
+static void block_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    GArray *desc = g_array_new(false, false, sizeof(StatsDescriptor));
+    enum BlockAcctType type;
+    enum BlockAcctSize size;
+    enum BlockAcctStage stage;
+    unsigned i;
+
+    g_array_append_vals(desc, block_stats, ARRAY_SIZE(block_stats));
+    for (type = BLOCK_ACCT_READ; type < BLOCK_MAX_IOTYPE; type++) {
+        for (size = 0; size < BLOCK_MAX_ACCT_SIZE; size++) {
+            for (stage = 0; stage < BLOCK_MAX_ACCT_STAGE; stage++) {
+                StatsDescriptor d = {
+                    .type = STATS_TYPE_HISTOGRAM,
+                };
+
+                if (!block_hdr_stats_exist(type, size, stage)) {
+                    continue;
+                }
+                d.name = block_hdr_stats_name(type, size, stage, "");
+                g_array_append_val(desc, d);
+
+                d.type = STATS_TYPE_INSTANT;
+                d.has_unit = true;
+                d.unit = STATS_UNIT_NANOSECONDS;
+                d.name = block_hdr_stats_name(type, size, stage,
+                                              "-boundaries");
+                g_array_append_val(desc, d);
+                for (i = 0; i < ARRAY_SIZE(block_stats_permille); i++) {
+                    d.name = block_hdr_stats_percentile_name(
+                        type, size, stage, block_stats_permille[i]);
+                    g_array_append_val(desc, d);
+                }
+            }
+        }
+    }
+
+    stats_add_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK,
+                     &g_array_index(desc, StatsDescriptor, 0), desc->len);
+
+    for (i = ARRAY_SIZE(block_stats); i < desc->len; i++) {
+        g_free((char *)g_array_index(desc, StatsDescriptor, i).name);
+    }
+    g_array_free(desc, true);
+}
+
+static void block_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_stats_cb,
+                        block_stats_schemas_cb);
+}
+
+block_init(block_stats_init);
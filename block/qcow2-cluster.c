@@ -215,6 +215,20 @@ static int l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Like l2_load(), but return NULL instead of reading the slice from disk
+ * if it isn't cached.
+ */
+static uint64_t *l2_lookup(BlockDriverState *bs, uint64_t offset,
+                           uint64_t l2_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+
+    return qcow2_cache_lookup(s->l2_table_cache, l2_offset + start_of_slice);
+}
+
 /*
  * Writes an L1 entry to disk (note that depending on the alignment
  * requirements this function may write more that just one entry in
@@ -569,9 +583,9 @@ static int coroutine_fn do_perform_cow_write(BlockDriverState *bs,
  *
  * Returns 0 on success, -errno in error cases.
  */
-int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
-                          unsigned int *bytes, uint64_t *host_offset,
-                          QCow2SubclusterType *subcluster_type)
+static int get_host_offset(BlockDriverState *bs, uint64_t offset,
+                           unsigned int *bytes, uint64_t *host_offset,
+                           QCow2SubclusterType *subcluster_type, bool locked)
 {
     BDRVQcow2State *s = bs->opaque;
     unsigned int l2_index, sc_index;
@@ -613,6 +627,9 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     }
 
     if (offset_into_cluster(s, l2_offset)) {
+        if (!locked) {
+            return -EAGAIN;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#" PRIx64
                                 " unaligned (L1 index: %#" PRIx64 ")",
                                 l2_offset, l1_index);
@@ -621,9 +638,16 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
 
     /* load the l2 slice in memory */
 
-    ret = l2_load(bs, offset, l2_offset, &l2_slice);
-    if (ret < 0) {
-        return ret;
+    if (locked) {
+        ret = l2_load(bs, offset, l2_offset, &l2_slice);
+        if (ret < 0) {
+            return ret;
+        }
+    } else {
+        l2_slice = l2_lookup(bs, offset, l2_offset);
+        if (!l2_slice) {
+            return -EAGAIN;
+        }
     }
 
     /* find the cluster offset for the given disk offset */
@@ -642,6 +666,10 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     type = qcow2_get_subcluster_type(bs, l2_entry, l2_bitmap, sc_index);
     if (s->qcow_version < 3 && (type == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
                                 type == QCOW2_SUBCLUSTER_ZERO_ALLOC)) {
+        if (!locked) {
+            ret = -EAGAIN;
+            goto fail;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "Zero cluster entry found"
                                 " in pre-v3 image (L2 offset: %#" PRIx64
                                 ", L2 index: %#x)", l2_offset, l2_index);
@@ -653,6 +681,10 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         break; /* This is handled by count_contiguous_subclusters() below */
     case QCOW2_SUBCLUSTER_COMPRESSED:
         if (has_data_file(bs)) {
+            if (!locked) {
+                ret = -EAGAIN;
+                goto fail;
+            }
             qcow2_signal_corruption(bs, true, -1, -1, "Compressed cluster "
                                     "entry found in image with external data "
                                     "file (L2 offset: %#" PRIx64 ", L2 index: "
@@ -671,6 +703,10 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         uint64_t host_cluster_offset = l2_entry & L2E_OFFSET_MASK;
         *host_offset = host_cluster_offset + offset_in_cluster;
         if (offset_into_cluster(s, host_cluster_offset)) {
+            if (!locked) {
+                ret = -EAGAIN;
+                goto fail;
+            }
             qcow2_signal_corruption(bs, true, -1, -1,
                                     "Cluster allocation offset %#"
                                     PRIx64 " unaligned (L2 offset: %#" PRIx64
@@ -680,6 +716,10 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
             goto fail;
         }
         if (has_data_file(bs) && *host_offset != offset) {
+            if (!locked) {
+                ret = -EAGAIN;
+                goto fail;
+            }
             qcow2_signal_corruption(bs, true, -1, -1,
                                     "External data file host cluster offset %#"
                                     PRIx64 " does not match guest cluster "
@@ -698,6 +738,10 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     sc = count_contiguous_subclusters(bs, nb_clusters, sc_index,
                                       l2_slice, &l2_index);
     if (sc < 0) {
+        if (!locked) {
+            ret = -EAGAIN;
+            goto fail;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "Invalid cluster entry found "
                                 " (L2 offset: %#" PRIx64 ", L2 index: %#x)",
                                 l2_offset, l2_index);
@@ -728,6 +772,31 @@ fail:
     return ret;
 }
 
+int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
+                          unsigned int *bytes, uint64_t *host_offset,
+                          QCow2SubclusterType *subcluster_type)
+{
+    return get_host_offset(bs, offset, bytes, host_offset, subcluster_type,
+                           true);
+}
+
+/*
+ * Like qcow2_get_host_offset(), but only if the L2 slice is already in the
+ * cache.  This doesn't do any I/O and doesn't yield, so it can be called
+ * without s->lock: coroutines that hold the lock only change the metadata
+ * between yields, and never evict a table that this function is using.
+ *
+ * Returns -EAGAIN if the slice isn't cached or the metadata is corrupted,
+ * the caller must then take s->lock and call qcow2_get_host_offset().
+ */
+int qcow2_try_get_host_offset(BlockDriverState *bs, uint64_t offset,
+                              unsigned int *bytes, uint64_t *host_offset,
+                              QCow2SubclusterType *subcluster_type)
+{
+    return get_host_offset(bs, offset, bytes, host_offset, subcluster_type,
+                           false);
+}
+
 /*
  * get_cluster_table
  *
@@ -1096,9 +1165,12 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
      * clusters), the next write will reuse them anyway.
      */
     if (!m->keep_old_clusters && j != 0) {
+        Qcow2FreeBatch batch = { .type = QCOW2_DISCARD_NEVER };
+
         for (i = 0; i < j; i++) {
-            qcow2_free_any_cluster(bs, old_cluster[i], QCOW2_DISCARD_NEVER);
+            qcow2_free_any_cluster_batched(bs, old_cluster[i], &batch);
         }
+        qcow2_free_batch_flush(bs, &batch);
     }
 
     ret = 0;
@@ -1545,6 +1617,169 @@ out:
     return ret;
 }
 
+/*
+ * Find the reservation that a guest write allocates from: the one with
+ * reserved clusters at @host_offset if that is not INV_OFFSET, otherwise
+ * the sequential stream that continues at @guest_offset.  Returns NULL if
+ * there is none.
+ */
+static Qcow2AllocStream *find_alloc_stream(BDRVQcow2State *s,
+                                           uint64_t guest_offset,
+                                           uint64_t host_offset)
+{
+    int i;
+
+    if (host_offset != INV_OFFSET) {
+        if (s->alloc_pool.nb_clusters &&
+            s->alloc_pool.host_offset == host_offset) {
+            return &s->alloc_pool;
+        }
+    }
+
+    for (i = 0; i < QCOW2_ALLOC_STREAMS; i++) {
+        Qcow2AllocStream *st = &s->alloc_streams[i];
+
+        if (host_offset != INV_OFFSET) {
+            if (st->nb_clusters && st->host_offset == host_offset) {
+                return st;
+            }
+        } else if (st->lru_counter && st->guest_offset == guest_offset) {
+            return st;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Start tracking a new potential sequential stream that continues at
+ * @guest_offset, replacing the least recently used one.
+ */
+static void new_alloc_stream(BlockDriverState *bs, uint64_t guest_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2AllocStream *lru = &s->alloc_streams[0];
+    int i;
+
+    for (i = 1; i < QCOW2_ALLOC_STREAMS; i++) {
+        if (s->alloc_streams[i].lru_counter < lru->lru_counter) {
+            lru = &s->alloc_streams[i];
+        }
+    }
+
+    if (lru->nb_clusters) {
+        trace_qcow2_release_alloc_pool(lru->host_offset, lru->nb_clusters);
+        qcow2_free_clusters(bs, lru->host_offset,
+                            lru->nb_clusters << s->cluster_bits,
+                            QCOW2_DISCARD_NEVER);
+    }
+    *lru = (Qcow2AllocStream) {
+        .guest_offset = guest_offset,
+        .extent_clusters = MIN(QCOW2_ALLOC_POOL_SIZE, s->alloc_extent_size) >>
+                           s->cluster_bits,
+        .lru_counter = ++s->alloc_stream_lru_counter,
+    };
+}
+
+/*
+ * Reserve the next extent for an allocation stream, directly after the
+ * previous one if those clusters are still free.  Each refill doubles the
+ * size of the next one, up to s->alloc_extent_size, so that a sequential
+ * stream ends up with large host-contiguous extents and only one refcount
+ * update for each, even when several streams are interleaved.
+ */
+static int refill_alloc_stream(BlockDriverState *bs, Qcow2AllocStream *st,
+                               uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t max_clusters = MAX(s->alloc_extent_size >> s->cluster_bits, 1);
+    int64_t ret = 0;
+
+    nb_clusters = MAX(nb_clusters, st->extent_clusters);
+
+    if (st->host_offset) {
+        ret = qcow2_alloc_clusters_at(bs, st->host_offset, nb_clusters);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    if (ret > 0) {
+        nb_clusters = ret;
+    } else {
+        ret = qcow2_alloc_clusters(bs, nb_clusters << s->cluster_bits);
+        if (ret < 0) {
+            return ret;
+        }
+        st->host_offset = ret;
+    }
+
+    trace_qcow2_alloc_pool_refill(qemu_coroutine_self(), st->host_offset,
+                                  nb_clusters);
+    st->nb_clusters = nb_clusters;
+    st->extent_clusters = MAX(MIN(st->extent_clusters * 2, max_clusters), 1);
+    return 0;
+}
+
+/*
+ * Allocate clusters for a guest write from a reservation.  Reservations
+ * are only refilled when they run out, so that allocating writes only
+ * update the refcounts, and possibly wait for a refcount block to be
+ * loaded, once per reservation instead of once per write.
+ *
+ * A write that doesn't continue a known stream allocates from the shared
+ * s->alloc_pool, and starts a new stream.  Once a write continues that
+ * stream, the stream gets its own growing extents, so that sequential
+ * writes get contiguous host clusters even when other streams allocate
+ * at the same time.
+ *
+ * If *host_offset is not INV_OFFSET, it must be the start of the reserved
+ * clusters of the pool or a stream.
+ * *nb_clusters may be decreased if the reservation doesn't have enough
+ * clusters.
+ */
+static int alloc_from_pool(BlockDriverState *bs, uint64_t guest_offset,
+                           uint64_t *host_offset, uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2AllocStream *st, *next;
+    int ret;
+
+    guest_offset = start_of_cluster(s, guest_offset);
+    st = find_alloc_stream(s, guest_offset, *host_offset);
+    if (!st) {
+        assert(*host_offset == INV_OFFSET);
+        st = &s->alloc_pool;
+        st->extent_clusters = QCOW2_ALLOC_POOL_SIZE >> s->cluster_bits;
+    }
+
+    if (!st->nb_clusters) {
+        assert(*host_offset == INV_OFFSET);
+        ret = refill_alloc_stream(bs, st, *nb_clusters);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    *nb_clusters = MIN(*nb_clusters, st->nb_clusters);
+    *host_offset = st->host_offset;
+    st->host_offset += *nb_clusters << s->cluster_bits;
+    st->nb_clusters -= *nb_clusters;
+
+    /* A request that continues from the pool may already have a stream */
+    next = st;
+    if (st == &s->alloc_pool) {
+        next = find_alloc_stream(s, guest_offset, INV_OFFSET);
+    }
+
+    guest_offset += *nb_clusters << s->cluster_bits;
+    if (next) {
+        next->guest_offset = guest_offset;
+        next->lru_counter = ++s->alloc_stream_lru_counter;
+    } else {
+        new_alloc_stream(bs, guest_offset);
+    }
+    return 0;
+}
+
 /*
  * Allocates new clusters for the given guest_offset.
  *
@@ -1581,14 +1816,9 @@ static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
-    if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
-        if (cluster_offset < 0) {
-            return cluster_offset;
-        }
-        *host_offset = cluster_offset;
-        return 0;
+    if (*host_offset == INV_OFFSET ||
+        find_alloc_stream(s, guest_offset, *host_offset)) {
+        return alloc_from_pool(bs, guest_offset, host_offset, nb_clusters);
     } else {
         int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
         if (ret < 0) {
@@ -1863,6 +2093,7 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
                                enum qcow2_discard_type type, bool full_discard)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2FreeBatch batch = { .type = type };
     uint64_t *l2_slice;
     int l2_index;
     int ret;
@@ -1920,9 +2151,10 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
             set_l2_bitmap(s, l2_slice, l2_index + i, new_l2_bitmap);
         }
         /* Then decrease the refcount */
-        qcow2_free_any_cluster(bs, old_l2_entry, type);
+        qcow2_free_any_cluster_batched(bs, old_l2_entry, &batch);
     }
 
+    qcow2_free_batch_flush(bs, &batch);
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     return nb_clusters;
@@ -1977,6 +2209,7 @@ static int zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
                             uint64_t nb_clusters, int flags)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2FreeBatch batch = { .type = QCOW2_DISCARD_REQUEST };
     uint64_t *l2_slice;
     int l2_index;
     int ret;
@@ -2019,10 +2252,11 @@ static int zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
 
         /* Then decrease the refcount */
         if (unmap) {
-            qcow2_free_any_cluster(bs, old_l2_entry, QCOW2_DISCARD_REQUEST);
+            qcow2_free_any_cluster_batched(bs, old_l2_entry, &batch);
         }
     }
 
+    qcow2_free_batch_flush(bs, &batch);
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     return nb_clusters;
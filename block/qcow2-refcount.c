@@ -28,6 +28,8 @@
 #include "qemu/range.h"
 #include "qemu/bswap.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "block/aio_task.h"
 #include "trace.h"
 
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
@@ -1063,6 +1065,30 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
     return i;
 }
 
+/*
+ * Drop the refcount of the clusters that were allocated ahead for guest
+ * writes but not used yet.  Must be called before anything that expects
+ * the refcounts to match the references, and before closing the image,
+ * otherwise the clusters are leaked.
+ */
+void qcow2_release_alloc_pool(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    for (i = 0; i <= QCOW2_ALLOC_STREAMS; i++) {
+        Qcow2AllocStream *st = i ? &s->alloc_streams[i - 1] : &s->alloc_pool;
+
+        if (st->nb_clusters) {
+            trace_qcow2_release_alloc_pool(st->host_offset, st->nb_clusters);
+            qcow2_free_clusters(bs, st->host_offset,
+                                st->nb_clusters << s->cluster_bits,
+                                QCOW2_DISCARD_NEVER);
+        }
+        *st = (Qcow2AllocStream) {};
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1203,6 +1229,47 @@ void qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
     }
 }
 
+/*
+ * Like qcow2_free_any_cluster(), but the refcount of a normal cluster that
+ * directly follows the range in @batch is only decreased later, together
+ * with the rest of the range, by qcow2_free_batch_flush().  This saves a
+ * refcount update, and a refcount block lookup, per cluster when a large
+ * area is discarded.
+ *
+ * The caller must update the L2 entries before the batch is flushed, and
+ * must flush it before dropping s->lock.
+ */
+void qcow2_free_any_cluster_batched(BlockDriverState *bs, uint64_t l2_entry,
+                                    Qcow2FreeBatch *batch)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCow2ClusterType ctype = qcow2_get_cluster_type(bs, l2_entry);
+    int64_t offset = l2_entry & L2E_OFFSET_MASK;
+
+    if (has_data_file(bs) ||
+        (ctype != QCOW2_CLUSTER_NORMAL && ctype != QCOW2_CLUSTER_ZERO_ALLOC) ||
+        offset_into_cluster(s, offset)) {
+        qcow2_free_any_cluster(bs, l2_entry, batch->type);
+        return;
+    }
+
+    if (batch->bytes && offset != batch->offset + batch->bytes) {
+        qcow2_free_batch_flush(bs, batch);
+    }
+    if (!batch->bytes) {
+        batch->offset = offset;
+    }
+    batch->bytes += s->cluster_size;
+}
+
+void qcow2_free_batch_flush(BlockDriverState *bs, Qcow2FreeBatch *batch)
+{
+    if (batch->bytes) {
+        qcow2_free_clusters(bs, batch->offset, batch->bytes, batch->type);
+        batch->bytes = 0;
+    }
+}
+
 int coroutine_fn qcow2_write_caches(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -1589,32 +1656,22 @@ enum {
 
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table, which has already been read from @l2_offset
+ * into @l2_table. While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
-static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
-                              void **refcount_table,
-                              int64_t *refcount_table_size, int64_t l2_offset,
-                              int flags, BdrvCheckMode fix, bool active)
+static int check_l2_table(BlockDriverState *bs, BdrvCheckResult *res,
+                          void **refcount_table,
+                          int64_t *refcount_table_size, int64_t l2_offset,
+                          uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                          bool active)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * l2_entry_size(s);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
@@ -1647,7 +1704,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                 l2_entry & QCOW2_COMPRESSED_SECTOR_MASK,
                 nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1702,7 +1759,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                             res->check_errors++;
                             /* Something is seriously wrong, so abort checking
                              * this L2 table */
-                            goto fail;
+                            return ret;
                         }
 
                         ret = bdrv_pwrite_sync(bs->file, l2e_offset,
@@ -1743,7 +1800,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                                refcount_table_size,
                                                offset, s->cluster_size);
                 if (ret < 0) {
-                    goto fail;
+                    return ret;
                 }
             }
             break;
@@ -1758,12 +1815,101 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
+}
 
-fail:
-    g_free(l2_table);
-    return ret;
+/*
+ * Reads the L2 table at @l2_offset and checks it with check_l2_table().
+ */
+static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
+                              void **refcount_table,
+                              int64_t *refcount_table_size, int64_t l2_offset,
+                              int flags, BdrvCheckMode fix, bool active)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint64_t *l2_table = NULL;
+    int l2_size, ret;
+
+    /* Read L2 table from disk */
+    l2_size = s->l2_size * l2_entry_size(s);
+    l2_table = g_malloc(l2_size);
+
+    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
+    if (ret < 0) {
+        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+        res->check_errors++;
+        return ret;
+    }
+
+    return check_l2_table(bs, res, refcount_table, refcount_table_size,
+                          l2_offset, l2_table, flags, fix, active);
+}
+
+/*
+ * On large images, check_refcounts_l1() spends most of its time waiting for
+ * L2 tables to be read.  When it runs in a coroutine, it therefore reads the
+ * L2 tables of up to this many bytes of L1 entries ahead, QCOW2_MAX_WORKERS
+ * at a time, and then checks them one by one in L1 order as before.
+ */
+#define QCOW2_CHECK_L2_READ_AHEAD  (32 * MiB)
+
+typedef struct Qcow2CheckL2Task {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t l2_offset;
+    void *l2_table;
+    int *ret;
+} Qcow2CheckL2Task;
+
+static int coroutine_fn check_refcounts_l2_read_task(AioTask *task)
+{
+    Qcow2CheckL2Task *t = container_of(task, Qcow2CheckL2Task, task);
+    BDRVQcow2State *s = t->bs->opaque;
+
+    *t->ret = bdrv_co_pread(t->bs->file, t->l2_offset,
+                            s->l2_size * l2_entry_size(s), t->l2_table, 0);
+    return *t->ret;
+}
+
+/*
+ * Reads the L2 tables of L1 entries @start to @end - 1 into consecutive
+ * clusters of @l2_tables, and the result of each read into @rets.
+ */
+static void coroutine_fn check_refcounts_l2_read_ahead(BlockDriverState *bs,
+                                                       const uint64_t *l1_table,
+                                                       int start, int end,
+                                                       uint8_t *l2_tables,
+                                                       int *rets)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t l2_size = s->l2_size * l2_entry_size(s);
+    AioTaskPool *pool = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    int i;
+
+    for (i = start; i < end; i++) {
+        uint64_t l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+        Qcow2CheckL2Task *t;
+
+        /* Same test as check_refcounts_l1() */
+        rets[i - start] = 0;
+        if (!l1_table[i]) {
+            continue;
+        }
+
+        t = g_new(Qcow2CheckL2Task, 1);
+        *t = (Qcow2CheckL2Task) {
+            .task.func = check_refcounts_l2_read_task,
+            .bs = bs,
+            .l2_offset = l2_offset,
+            .l2_table = l2_tables + (i - start) * l2_size,
+            .ret = &rets[i - start],
+        };
+        aio_task_pool_wait_slot(pool);
+        aio_task_pool_start_task(pool, &t->task);
+    }
+
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
 }
 
 /*
@@ -1783,7 +1929,10 @@ static int check_refcounts_l1(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l1_table = NULL, l2_offset, l1_size2;
-    int i, ret;
+    size_t l2_size = s->l2_size * l2_entry_size(s);
+    g_autofree uint8_t *l2_tables = NULL;
+    g_autofree int *l2_rets = NULL;
+    int i, start, end, batch = 0, ret;
 
     l1_size2 = l1_size * L1E_SIZE;
 
@@ -1812,10 +1961,33 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
+    /*
+     * Repairing writes to L2 tables while they are checked, so only read
+     * them ahead when nothing is being fixed.
+     */
+    if (qemu_in_coroutine() && !(fix & BDRV_FIX_ERRORS) && l1_size > 1) {
+        batch = MIN(MAX(QCOW2_CHECK_L2_READ_AHEAD / l2_size, 1), l1_size);
+        l2_tables = g_try_malloc(batch * l2_size);
+        l2_rets = g_new(int, batch);
+        if (!l2_tables) {
+            batch = 0;
+        }
+    }
+
     /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
+    for (start = 0; start < l1_size; start = end) {
+        end = MIN(start + MAX(batch, 1), l1_size);
+        if (batch) {
+            check_refcounts_l2_read_ahead(bs, l1_table, start, end,
+                                          l2_tables, l2_rets);
+        }
+
+        for (i = start; i < end; i++) {
+            l2_offset = l1_table[i];
+            if (!l2_offset) {
+                continue;
+            }
+
             /* Mark L2 table as used */
             l2_offset &= L1E_OFFSET_MASK;
             ret = qcow2_inc_refcounts_imrt(bs, res,
@@ -1833,9 +2005,21 @@ static int check_refcounts_l1(BlockDriverState *bs,
             }
 
             /* Process and check L2 entries */
-            ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags,
-                                     fix, active);
+            if (!batch) {
+                ret = check_refcounts_l2(bs, res, refcount_table,
+                                         refcount_table_size, l2_offset,
+                                         flags, fix, active);
+            } else if (l2_rets[i - start] < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                ret = l2_rets[i - start];
+            } else {
+                ret = check_l2_table(bs, res, refcount_table,
+                                     refcount_table_size, l2_offset,
+                                     (uint64_t *)(l2_tables +
+                                                  (i - start) * l2_size),
+                                     flags, fix, active);
+            }
             if (ret < 0) {
                 goto fail;
             }
@@ -79,6 +79,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t bytes,
                            QEMUIOVector *qiov,
                            size_t qiov_offset);
+static void qcow2_decompressed_cache_invalidate(BDRVQcow2State *s);
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -611,6 +612,9 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
     memset(result, 0, sizeof(*result));
 
+    /* Otherwise the pool would show up as leaked clusters */
+    qcow2_release_alloc_pool(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -697,6 +701,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_EXTENT_SIZE,
     NULL
 };
 
@@ -808,6 +813,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_EXTENT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of the host extents reserved for "
+                    "sequential writes",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -969,6 +980,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t alloc_extent_size;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1070,6 +1082,17 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->alloc_extent_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_EXTENT_SIZE,
+                          DEFAULT_ALLOC_EXTENT_SIZE);
+    if (r->alloc_extent_size < s->cluster_size ||
+        r->alloc_extent_size > 1 * GiB) {
+        error_setg(errp, QCOW2_OPT_ALLOC_EXTENT_SIZE " must be between the "
+                   "cluster size and 1 GiB");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1225,6 +1248,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->alloc_extent_size = r->alloc_extent_size;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -2300,10 +2325,15 @@ static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        qemu_co_mutex_lock(&s->lock);
-        ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
-                                    &host_offset, &type);
-        qemu_co_mutex_unlock(&s->lock);
+        /* Lookups that hit the L2 cache don't need s->lock */
+        ret = qcow2_try_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+        if (ret == -EAGAIN) {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+            qemu_co_mutex_unlock(&s->lock);
+        }
         if (ret < 0) {
             goto out;
         }
@@ -2654,6 +2684,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_alloc_pool(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2698,6 +2730,10 @@ static void qcow2_close(BlockDriverState *bs)
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
 
+    qcow2_decompressed_cache_invalidate(s);
+    g_free(s->decompressed_cache);
+    s->decompressed_cache = NULL;
+
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
@@ -4187,6 +4223,9 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
         goto fail;
     }
 
+    /* Shrinking needs the refcounts of the clusters at the end of the file */
+    qcow2_release_alloc_pool(bs);
+
     old_length = bs->total_sectors * BDRV_SECTOR_SIZE;
     new_l1_size = size_to_l1(s, offset);
 
@@ -4559,6 +4598,7 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     }
 
     qemu_co_mutex_lock(&s->lock);
+    qcow2_decompressed_cache_invalidate(s);
     ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
                                                 &cluster_offset);
     if (ret < 0) {
@@ -4662,19 +4702,94 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+static void *qcow2_decompressed_cache_lookup(BDRVQcow2State *s,
+                                             uint64_t cluster_descriptor)
+{
+    int i;
+
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (c->cluster_descriptor == cluster_descriptor) {
+            c->lru_counter = ++s->decompressed_lru_counter;
+            return c->buf;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Add the decompressed cluster @buf to the cache, which takes ownership of
+ * it.  @gen is the cache generation from before the compressed data was
+ * read; if the cache was invalidated since, @buf may be stale and is freed.
+ */
+static void qcow2_decompressed_cache_insert(BlockDriverState *bs,
+                                            uint64_t cluster_descriptor,
+                                            void *buf, uint64_t gen)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *victim = NULL;
+    int i;
+
+    if (gen != s->decompressed_cache_gen ||
+        qcow2_decompressed_cache_lookup(s, cluster_descriptor)) {
+        qemu_vfree(buf);
+        return;
+    }
+
+    if (!s->decompressed_cache) {
+        s->decompressed_cache_size =
+            MAX(1, QCOW2_DECOMPRESSED_CACHE_SIZE >> s->cluster_bits);
+        s->decompressed_cache = g_new0(Qcow2DecompressedCluster,
+                                       s->decompressed_cache_size);
+    }
+
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (!c->cluster_descriptor) {
+            victim = c;
+            break;
+        }
+        if (!victim || c->lru_counter < victim->lru_counter) {
+            victim = c;
+        }
+    }
+
+    qemu_vfree(victim->buf);
+    victim->buf = buf;
+    victim->cluster_descriptor = cluster_descriptor;
+    victim->lru_counter = ++s->decompressed_lru_counter;
+}
+
+/*
+ * Drop all decompressed clusters.  A compressed write may reuse the host
+ * bytes of a compressed cluster that was freed, so the cache must not
+ * outlive it.
+ */
+static void qcow2_decompressed_cache_invalidate(BDRVQcow2State *s)
+{
+    int i;
+
+    s->decompressed_cache_gen++;
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        qemu_vfree(c->buf);
+        c->buf = NULL;
+        c->cluster_descriptor = 0;
+    }
+}
+
+/* Read the compressed cluster at @cluster_descriptor into @out_buf */
 static int coroutine_fn
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t cluster_descriptor,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset)
+qcow2_co_read_decompress(BlockDriverState *bs, uint64_t cluster_descriptor,
+                         void *out_buf)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize, nb_csectors;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint8_t *buf;
 
     coffset = cluster_descriptor & s->cluster_offset_mask;
     nb_csectors = ((cluster_descriptor >> s->csize_shift) & s->csize_mask) + 1;
@@ -4686,8 +4801,6 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
     BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
     if (ret < 0) {
@@ -4699,15 +4812,118 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
 fail:
-    qemu_vfree(out_buf);
     g_free(buf);
 
     return ret;
 }
 
+typedef struct Qcow2DecompressReadahead {
+    BlockDriverState *bs;
+    uint64_t cluster_descriptor;
+    uint64_t gen;
+} Qcow2DecompressReadahead;
+
+static void coroutine_fn qcow2_co_decompress_readahead_entry(void *opaque)
+{
+    Qcow2DecompressReadahead *ra = opaque;
+    BlockDriverState *bs = ra->bs;
+    BDRVQcow2State *s = bs->opaque;
+    void *out_buf = qemu_try_blockalign(bs, s->cluster_size);
+
+    if (out_buf &&
+        qcow2_co_read_decompress(bs, ra->cluster_descriptor, out_buf) == 0) {
+        qcow2_decompressed_cache_insert(bs, ra->cluster_descriptor, out_buf,
+                                        ra->gen);
+    } else {
+        qemu_vfree(out_buf);
+    }
+
+    s->decompress_readahead = 0;
+    bdrv_dec_in_flight(bs);
+    g_free(ra);
+}
+
+/*
+ * If the guest cluster after @offset is compressed too, decompress it in
+ * the background so that it is in the cache when a sequential reader gets
+ * there.  Its decompression runs in the thread pool at the same time as
+ * the one of the cluster being read.  Only clusters whose L2 slice is
+ * already cached are considered, and only one readahead is in flight.
+ */
+static void qcow2_start_decompress_readahead(BlockDriverState *bs,
+                                             uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t next = start_of_cluster(s, offset) + s->cluster_size;
+    unsigned int bytes = s->cluster_size;
+    uint64_t host_offset;
+    QCow2SubclusterType type;
+    Qcow2DecompressReadahead *ra;
+    Coroutine *co;
+
+    if (s->decompress_readahead ||
+        (QCOW2_DECOMPRESSED_CACHE_SIZE >> s->cluster_bits) < 2 ||
+        next >= bs->total_sectors * BDRV_SECTOR_SIZE) {
+        return;
+    }
+    if (qcow2_try_get_host_offset(bs, next, &bytes, &host_offset, &type) < 0 ||
+        type != QCOW2_SUBCLUSTER_COMPRESSED ||
+        qcow2_decompressed_cache_lookup(s, host_offset)) {
+        return;
+    }
+
+    trace_qcow2_decompress_readahead(bs, next, host_offset);
+    ra = g_new(Qcow2DecompressReadahead, 1);
+    *ra = (Qcow2DecompressReadahead) {
+        .bs = bs,
+        .cluster_descriptor = host_offset,
+        .gen = s->decompressed_cache_gen,
+    };
+    s->decompress_readahead = host_offset;
+
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(qcow2_co_decompress_readahead_entry, ra);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
+static int coroutine_fn
+qcow2_co_preadv_compressed(BlockDriverState *bs,
+                           uint64_t cluster_descriptor,
+                           uint64_t offset,
+                           uint64_t bytes,
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint64_t gen = s->decompressed_cache_gen;
+    uint8_t *out_buf;
+    int ret;
+
+    out_buf = qcow2_decompressed_cache_lookup(s, cluster_descriptor);
+    if (out_buf) {
+        trace_qcow2_decompressed_cache_hit(bs, cluster_descriptor);
+        qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                            bytes);
+        return 0;
+    }
+
+    qcow2_start_decompress_readahead(bs, offset);
+
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+    ret = qcow2_co_read_decompress(bs, cluster_descriptor, out_buf);
+    if (ret < 0) {
+        qemu_vfree(out_buf);
+        return ret;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+    qcow2_decompressed_cache_insert(bs, cluster_descriptor, out_buf, gen);
+
+    return 0;
+}
+
 static int make_completely_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -5460,6 +5676,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    /* Refcount rebuilds and downgrades expect exact refcounts */
+    qcow2_release_alloc_pool(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -57,6 +57,20 @@
  * (128 GB for 512 byte clusters, 2 EB for 2 MB clusters) */
 #define QCOW_MAX_L1_SIZE (32 * MiB)
 
+/*
+ * Clusters are allocated for guest writes in extents that start at this
+ * size and double for each refill of a sequential stream, up to the
+ * alloc-extent-size option
+ */
+#define QCOW2_ALLOC_POOL_SIZE (1 * MiB)
+#define DEFAULT_ALLOC_EXTENT_SIZE (32 * MiB)
+
+/* Number of sequential write streams that get their own extent */
+#define QCOW2_ALLOC_STREAMS 8
+
+/* Memory used to keep decompressed clusters around for further reads */
+#define QCOW2_DECOMPRESSED_CACHE_SIZE (2 * MiB)
+
 /* Allow for an average of 1k per snapshot table entry, should be plenty of
  * space for snapshot names and IDs */
 #define QCOW_MAX_SNAPSHOTS_SIZE (1024 * QCOW_MAX_SNAPSHOTS)
@@ -150,6 +164,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_EXTENT_SIZE "alloc-extent-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -310,6 +325,35 @@ typedef struct Qcow2DiscardRegion {
     QTAILQ_ENTRY(Qcow2DiscardRegion) next;
 } Qcow2DiscardRegion;
 
+/*
+ * Contiguous host range whose refcounts are decreased at once by
+ * qcow2_free_batch_flush(), see qcow2_free_any_cluster_batched()
+ */
+typedef struct Qcow2FreeBatch {
+    enum qcow2_discard_type type;
+    int64_t offset;
+    int64_t bytes;
+} Qcow2FreeBatch;
+
+/*
+ * Clusters that already have a refcount of 1 but aren't referenced yet,
+ * reserved for guest writes that continue at @guest_offset
+ */
+typedef struct Qcow2AllocStream {
+    uint64_t guest_offset;
+    uint64_t host_offset;
+    uint64_t nb_clusters;
+    uint64_t extent_clusters;   /* size of the next refill */
+    uint64_t lru_counter;       /* 0 if the stream is unused */
+} Qcow2AllocStream;
+
+/* A decompressed cluster, see qcow2_co_preadv_compressed() */
+typedef struct Qcow2DecompressedCluster {
+    uint64_t cluster_descriptor;    /* 0 if the entry is unused */
+    uint64_t lru_counter;
+    void *buf;
+} Qcow2DecompressedCluster;
+
 typedef uint64_t Qcow2GetRefcountFunc(const void *refcount_array,
                                       uint64_t index);
 typedef void Qcow2SetRefcountFunc(void *refcount_array,
@@ -356,6 +400,23 @@ typedef struct BDRVQcow2State {
     uint32_t max_refcount_table_index; /* Last used entry in refcount_table */
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
+    /* Reserved clusters handed out to guest writes, see alloc_from_pool() */
+    Qcow2AllocStream alloc_pool;
+    Qcow2AllocStream alloc_streams[QCOW2_ALLOC_STREAMS];
+    uint64_t alloc_stream_lru_counter;
+    uint64_t alloc_extent_size;
+
+    /*
+     * Recently decompressed clusters, keyed by their cluster descriptor.
+     * The generation is bumped whenever the cache is invalidated, so that
+     * decompressions that were in flight at that time aren't inserted.
+     */
+    Qcow2DecompressedCluster *decompressed_cache;
+    int decompressed_cache_size;
+    uint64_t decompressed_lru_counter;
+    uint64_t decompressed_cache_gen;
+    /* Cluster descriptor of the readahead in flight, or 0 */
+    uint64_t decompress_readahead;
 
     CoMutex lock;
 
@@ -864,11 +925,15 @@ int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size);
 int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                 int64_t nb_clusters);
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size);
+void qcow2_release_alloc_pool(BlockDriverState *bs);
 void qcow2_free_clusters(BlockDriverState *bs,
                           int64_t offset, int64_t size,
                           enum qcow2_discard_type type);
 void qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
                             enum qcow2_discard_type type);
+void qcow2_free_any_cluster_batched(BlockDriverState *bs, uint64_t l2_entry,
+                                    Qcow2FreeBatch *batch);
+void qcow2_free_batch_flush(BlockDriverState *bs, Qcow2FreeBatch *batch);
 
 int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend);
@@ -907,6 +972,9 @@ int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
 int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                           unsigned int *bytes, uint64_t *host_offset,
                           QCow2SubclusterType *subcluster_type);
+int qcow2_try_get_host_offset(BlockDriverState *bs, uint64_t offset,
+                              unsigned int *bytes, uint64_t *host_offset,
+                              QCow2SubclusterType *subcluster_type);
 int qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                             unsigned int *bytes, uint64_t *host_offset,
                             QCowL2Meta **m);
@@ -971,6 +1039,7 @@ int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
 void qcow2_cache_put(Qcow2Cache *c, void **table);
+void *qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
@@ -17,8 +17,10 @@
 #include "qemu/cutils.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "block/block_int.h"
 #include "block/coroutines.h"
+#include "block/dirty-bitmap.h"
 #include "block/qdict.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-block.h"
@@ -27,6 +29,7 @@
 #include "qapi/qmp/qlist.h"
 #include "qapi/qmp/qstring.h"
 #include "crypto/hash.h"
+#include "trace.h"
 
 #define HASH_LENGTH 32
 
@@ -36,6 +39,16 @@
 #define QUORUM_OPT_BLKVERIFY      "blkverify"
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
+#define QUORUM_OPT_WRITE_PATTERN  "write-pattern"
+
+/* Weight of a new sample in the moving average of the latency is 1/8 */
+#define QUORUM_LATENCY_WEIGHT 8
+
+/* With read-pattern=fastest, one read in this many probes another child */
+#define QUORUM_PROBE_INTERVAL 64
+
+/* Granularity at which failed writes are tracked and resynchronized */
+#define QUORUM_RESYNC_GRANULARITY (64 * 1024)
 
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
@@ -68,6 +81,17 @@ typedef struct QuorumVotes {
     bool (*compare)(QuorumVoteValue *a, QuorumVoteValue *b);
 } QuorumVotes;
 
+/* Per-child state, indexed like BDRVQuorumState.children */
+typedef struct QuorumChildStats {
+    int64_t latency_ns;         /* moving average of the request latency */
+    bool failed;                /* the last read from this child failed */
+    BdrvDirtyBitmap *dirty;     /* with write-pattern=threshold: areas this
+                                 * child failed to write, to be resynced
+                                 */
+} QuorumChildStats;
+
+typedef struct QuorumAIOCB QuorumAIOCB;
+
 /* the following structure holds the state of one quorum instance */
 typedef struct BDRVQuorumState {
     BdrvChild **children;  /* children BlockDriverStates */
@@ -91,9 +115,18 @@ typedef struct BDRVQuorumState {
                             */
 
     QuorumReadPattern read_pattern;
-} BDRVQuorumState;
+    QuorumWritePattern write_pattern;
 
-typedef struct QuorumAIOCB QuorumAIOCB;
+    QuorumChildStats *stats;    /* one entry per child */
+    unsigned reads_since_probe; /* read-pattern=fastest probe countdown */
+    int probe_index;            /* next child to probe */
+
+    /* With write-pattern=threshold, writes until all children completed */
+    QLIST_HEAD(, QuorumAIOCB) writes;
+    /* Writes waiting for overlapping writes, or for the resync */
+    CoQueue write_queue;
+    bool resyncing;
+} BDRVQuorumState;
 
 /* Quorum will create one instance of the following structure per operation it
  * performs on its children.
@@ -105,6 +138,7 @@ typedef struct QuorumChildRequest {
     QEMUIOVector qiov;
     uint8_t *buf;
     int ret;
+    bool done;
     QuorumAIOCB *parent;
 } QuorumChildRequest;
 
@@ -137,6 +171,14 @@ struct QuorumAIOCB {
     bool is_read;
     int vote_ret;
     int children_read;          /* how many children have been read from */
+
+    /* write-pattern=threshold */
+    uint8_t *bounce;            /* copy of the data, which the stragglers
+                                 * still write after the request completed
+                                 */
+    QEMUIOVector bounce_qiov;
+    bool detached;              /* the request has completed */
+    QLIST_ENTRY(QuorumAIOCB) next;
 };
 
 typedef struct QuorumCo {
@@ -642,6 +684,53 @@ static int read_quorum_children(QuorumAIOCB *acb)
     return acb->vote_ret;
 }
 
+static void quorum_account_latency(BDRVQuorumState *s, int i,
+                                   int64_t start_ns)
+{
+    QuorumChildStats *stats = &s->stats[i];
+    int64_t latency = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+
+    if (!stats->latency_ns) {
+        stats->latency_ns = latency;
+    } else {
+        stats->latency_ns += (latency - stats->latency_ns) /
+                             QUORUM_LATENCY_WEIGHT;
+    }
+}
+
+static bool quorum_overlaps(QuorumAIOCB *acb, uint64_t offset,
+                            uint64_t bytes)
+{
+    return offset < acb->offset + acb->bytes && acb->offset < offset + bytes;
+}
+
+/*
+ * With write-pattern=threshold, a child may not have the latest data yet,
+ * either because it has not completed a write that the guest was already
+ * told about, or because it failed to and waits for the resync.
+ */
+static bool quorum_child_is_current(BDRVQuorumState *s, int i,
+                                    uint64_t offset, uint64_t bytes)
+{
+    QuorumAIOCB *write;
+
+    if (s->write_pattern != QUORUM_WRITE_PATTERN_THRESHOLD) {
+        return true;
+    }
+
+    if (bdrv_dirty_bitmap_next_dirty(s->stats[i].dirty, offset, bytes) >= 0) {
+        return false;
+    }
+
+    QLIST_FOREACH(write, &s->writes, next) {
+        if (!write->qcrs[i].done && quorum_overlaps(write, offset, bytes)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static int read_fifo_child(QuorumAIOCB *acb)
 {
     BDRVQuorumState *s = acb->bs->opaque;
@@ -650,6 +739,10 @@ static int read_fifo_child(QuorumAIOCB *acb)
     /* We try to read the next child in FIFO order if we failed to read */
     do {
         n = acb->children_read++;
+        if (!quorum_child_is_current(s, n, acb->offset, acb->bytes)) {
+            ret = -EIO;
+            continue;
+        }
         acb->qcrs[n].bs = s->children[n]->bs;
         ret = bdrv_co_preadv(s->children[n], acb->offset, acb->bytes,
                              acb->qiov, 0);
@@ -663,6 +756,74 @@ static int read_fifo_child(QuorumAIOCB *acb)
     return ret;
 }
 
+/*
+ * Pick the healthy child with the lowest average latency, or when @probe
+ * is true, the next child in turn so that the averages of the others do
+ * not go stale and failed children get a chance to recover.
+ */
+static int quorum_pick_fastest(QuorumAIOCB *acb, bool *tried, bool probe)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    int i, n, best = -1;
+
+    for (n = 0; n < s->num_children; n++) {
+        i = probe ? (s->probe_index + n) % s->num_children : n;
+        if (tried[i] ||
+            !quorum_child_is_current(s, i, acb->offset, acb->bytes)) {
+            continue;
+        }
+        if (probe) {
+            s->probe_index = (i + 1) % s->num_children;
+            return i;
+        }
+        if (best < 0 ||
+            (s->stats[best].failed && !s->stats[i].failed) ||
+            (s->stats[best].failed == s->stats[i].failed &&
+             s->stats[i].latency_ns < s->stats[best].latency_ns)) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static int read_fastest_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    g_autofree bool *tried = g_new0(bool, s->num_children);
+    bool probe = false;
+    int64_t start_ns;
+    int n, ret = -EIO;
+
+    if (++s->reads_since_probe >= QUORUM_PROBE_INTERVAL) {
+        s->reads_since_probe = 0;
+        probe = true;
+    }
+
+    /* On failure, fall back to the next fastest child */
+    while ((n = quorum_pick_fastest(acb, tried, probe)) >= 0) {
+        probe = false;
+        tried[n] = true;
+        acb->qcrs[n].bs = s->children[n]->bs;
+
+        start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        ret = bdrv_co_preadv(s->children[n], acb->offset, acb->bytes,
+                             acb->qiov, 0);
+        trace_quorum_read_fastest(acb->bs, s->children[n]->bs->node_name,
+                                  s->stats[n].latency_ns, ret);
+        if (ret >= 0) {
+            quorum_account_latency(s, n, start_ns);
+            s->stats[n].failed = false;
+            break;
+        }
+
+        s->stats[n].failed = true;
+        quorum_report_bad_acb(&acb->qcrs[n], ret);
+    }
+
+    return ret;
+}
+
 static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
                             uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
@@ -673,16 +834,64 @@ static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
     acb->is_read = true;
     acb->children_read = 0;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    switch (s->read_pattern) {
+    case QUORUM_READ_PATTERN_QUORUM:
         ret = read_quorum_children(acb);
-    } else {
+        break;
+    case QUORUM_READ_PATTERN_FASTEST:
+        ret = read_fastest_child(acb);
+        break;
+    default:
         ret = read_fifo_child(acb);
+        break;
     }
     quorum_aio_finalize(acb);
 
     return ret;
 }
 
+static void quorum_resync_entry(void *opaque);
+
+/*
+ * With write-pattern=threshold, the request may complete before all the
+ * children are done.
+ */
+static bool quorum_write_can_complete(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    int failed = acb->count - acb->success_count;
+
+    if (s->write_pattern != QUORUM_WRITE_PATTERN_THRESHOLD) {
+        return acb->count == s->num_children;
+    }
+
+    return acb->success_count >= s->threshold ||
+           failed > s->num_children - s->threshold;
+}
+
+/* Called once all children are done with a write-pattern=threshold write */
+static void coroutine_fn quorum_write_finish(QuorumAIOCB *acb)
+{
+    BlockDriverState *bs = acb->bs;
+    BDRVQuorumState *s = bs->opaque;
+    bool resync = acb->success_count < s->num_children;
+
+    QLIST_REMOVE(acb, next);
+    qemu_co_queue_restart_all(&s->write_queue);
+
+    if (resync && !s->resyncing) {
+        Coroutine *co = qemu_coroutine_create(quorum_resync_entry, bs);
+
+        s->resyncing = true;
+        bdrv_inc_in_flight(bs);
+        aio_co_enter(bdrv_get_aio_context(bs), co);
+    }
+
+    qemu_vfree(acb->bounce);
+    quorum_aio_finalize(acb);
+    bdrv_dec_in_flight(bs);
+}
+
 static void write_quorum_entry(void *opaque)
 {
     QuorumCo *co = opaque;
@@ -690,6 +899,7 @@ static void write_quorum_entry(void *opaque)
     BDRVQuorumState *s = acb->bs->opaque;
     int i = co->idx;
     QuorumChildRequest *sacb = &acb->qcrs[i];
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     sacb->bs = s->children[i]->bs;
     if (acb->flags & BDRV_REQ_ZERO_WRITE) {
@@ -701,19 +911,105 @@ static void write_quorum_entry(void *opaque)
     }
     if (sacb->ret == 0) {
         acb->success_count++;
+        quorum_account_latency(s, i, start_ns);
     } else {
         quorum_report_bad_acb(sacb, sacb->ret);
+        if (s->write_pattern == QUORUM_WRITE_PATTERN_THRESHOLD) {
+            bdrv_set_dirty_bitmap(s->stats[i].dirty, acb->offset, acb->bytes);
+        }
     }
+    sacb->done = true;
     acb->count++;
     assert(acb->count <= s->num_children);
     assert(acb->success_count <= s->num_children);
 
-    /* Wake up the caller after the last write */
-    if (acb->count == s->num_children) {
+    if (acb->detached) {
+        trace_quorum_write_straggler(acb->bs, sacb->bs->node_name,
+                                     acb->offset, acb->bytes, sacb->ret);
+        if (acb->count == s->num_children) {
+            quorum_write_finish(acb);
+        }
+        return;
+    }
+
+    /* Wake up the caller after the last write, or once enough are done */
+    if (quorum_write_can_complete(acb)) {
         qemu_coroutine_enter_if_inactive(acb->co);
     }
 }
 
+static bool quorum_has_overlapping_write(BDRVQuorumState *s, uint64_t offset,
+                                         uint64_t bytes)
+{
+    QuorumAIOCB *write;
+
+    QLIST_FOREACH(write, &s->writes, next) {
+        if (quorum_overlaps(write, offset, bytes)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Completing a write before all children are done with it must not let
+ * a later write overtake it on the children that are late, or they would
+ * end up with different data.  Overlapping writes are therefore
+ * serialized, and all wait while the resync copies data between the
+ * children.
+ */
+static int coroutine_fn quorum_co_pwritev_threshold(QuorumAIOCB *acb)
+{
+    BlockDriverState *bs = acb->bs;
+    BDRVQuorumState *s = bs->opaque;
+    int i, ret;
+
+    while (s->resyncing ||
+           quorum_has_overlapping_write(s, acb->offset, acb->bytes)) {
+        qemu_co_queue_wait(&s->write_queue, NULL);
+    }
+
+    /* The stragglers keep writing after the caller's buffer is gone */
+    if (acb->qiov) {
+        acb->bounce = qemu_blockalign(bs, acb->bytes);
+        qemu_iovec_init_buf(&acb->bounce_qiov, acb->bounce, acb->bytes);
+        qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, acb->bytes);
+        acb->qiov = &acb->bounce_qiov;
+    }
+
+    QLIST_INSERT_HEAD(&s->writes, acb, next);
+    bdrv_inc_in_flight(bs);
+
+    for (i = 0; i < s->num_children; i++) {
+        Coroutine *co;
+        QuorumCo data = {
+            .acb = acb,
+            .idx = i,
+        };
+
+        co = qemu_coroutine_create(write_quorum_entry, &data);
+        qemu_coroutine_enter(co);
+    }
+
+    while (!quorum_write_can_complete(acb)) {
+        qemu_coroutine_yield();
+    }
+
+    quorum_has_too_much_io_failed(acb);
+    ret = acb->vote_ret;
+    trace_quorum_write_threshold(bs, acb->offset, acb->bytes,
+                                 acb->count, ret);
+
+    if (acb->count < s->num_children) {
+        acb->detached = true;
+    } else {
+        quorum_write_finish(acb);
+    }
+
+    return ret;
+}
+
 static int quorum_co_pwritev(BlockDriverState *bs, uint64_t offset,
                              uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
@@ -721,6 +1017,10 @@ static int quorum_co_pwritev(BlockDriverState *bs, uint64_t offset,
     QuorumAIOCB *acb = quorum_aio_get(bs, qiov, offset, bytes, flags);
     int i, ret;
 
+    if (s->write_pattern == QUORUM_WRITE_PATTERN_THRESHOLD) {
+        return quorum_co_pwritev_threshold(acb);
+    }
+
     for (i = 0; i < s->num_children; i++) {
         Coroutine *co;
         QuorumCo data = {
@@ -752,6 +1052,87 @@ static int quorum_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                              flags | BDRV_REQ_ZERO_WRITE);
 }
 
+/* Find a child that has the data child @i failed to write */
+static int quorum_resync_source(BDRVQuorumState *s, int i, int64_t offset,
+                                int64_t bytes)
+{
+    int j;
+
+    for (j = 0; j < s->num_children; j++) {
+        if (j != i && quorum_child_is_current(s, j, offset, bytes)) {
+            return j;
+        }
+    }
+
+    return -1;
+}
+
+static void coroutine_fn quorum_resync_child(BlockDriverState *bs, int i,
+                                             uint8_t *buf)
+{
+    BDRVQuorumState *s = bs->opaque;
+    BdrvDirtyBitmap *dirty = s->stats[i].dirty;
+    int64_t end = bdrv_dirty_bitmap_size(dirty);
+    int64_t pos = 0, offset, bytes;
+    QEMUIOVector qiov;
+    int src, ret;
+
+    while (bdrv_dirty_bitmap_next_dirty_area(dirty, pos, end,
+                                             QUORUM_RESYNC_GRANULARITY,
+                                             &offset, &bytes)) {
+        pos = offset + bytes;
+
+        /*
+         * If no child has the data, all of them failed the write and the
+         * content of the area is undefined anyway.
+         */
+        src = quorum_resync_source(s, i, offset, bytes);
+        if (src >= 0) {
+            qemu_iovec_init_buf(&qiov, buf, bytes);
+            ret = bdrv_co_preadv(s->children[src], offset, bytes, &qiov, 0);
+            if (ret == 0) {
+                ret = bdrv_co_pwritev(s->children[i], offset, bytes, &qiov,
+                                      0);
+            }
+            trace_quorum_resync(bs, s->children[i]->bs->node_name, offset,
+                                bytes, ret);
+            if (ret < 0) {
+                quorum_report_bad(QUORUM_OP_TYPE_WRITE, offset, bytes,
+                                  s->children[i]->bs->node_name, ret);
+                continue;
+            }
+        }
+
+        bdrv_reset_dirty_bitmap(dirty, offset, bytes);
+    }
+}
+
+/*
+ * Copy the areas that children failed to write from children that have
+ * them.  Writes wait meanwhile, so the data cannot change under us.
+ */
+static void coroutine_fn quorum_resync_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQuorumState *s = bs->opaque;
+    uint8_t *buf;
+    int i;
+
+    while (!QLIST_EMPTY(&s->writes)) {
+        qemu_co_queue_wait(&s->write_queue, NULL);
+    }
+
+    buf = qemu_blockalign(bs, QUORUM_RESYNC_GRANULARITY);
+    for (i = 0; i < s->num_children; i++) {
+        quorum_resync_child(bs, i, buf);
+    }
+    qemu_vfree(buf);
+
+    s->resyncing = false;
+    qemu_co_queue_restart_all(&s->write_queue);
+    bdrv_dec_in_flight(bs);
+}
+
 static int64_t quorum_getlength(BlockDriverState *bs)
 {
     BDRVQuorumState *s = bs->opaque;
@@ -796,7 +1177,9 @@ static coroutine_fn int quorum_co_flush(BlockDriverState *bs)
                               s->children[i]->bs->node_name, result);
             result_value.l = result;
             quorum_count_vote(&error_votes, &result_value, i);
-        } else {
+        } else if (s->write_pattern != QUORUM_WRITE_PATTERN_THRESHOLD ||
+                   !bdrv_get_dirty_count(s->stats[i].dirty)) {
+            /* A child that misses writes does not make them stable */
             success_count++;
         }
     }
@@ -805,7 +1188,7 @@ static coroutine_fn int quorum_co_flush(BlockDriverState *bs)
         result = 0;
     } else {
         winner = quorum_get_vote_winner(&error_votes);
-        result = winner->value.l;
+        result = winner ? winner->value.l : -EIO;
     }
     quorum_free_vote_list(&error_votes);
 
@@ -904,7 +1287,13 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, fastest. "
+                    "Quorum is default",
+        },
+        {
+            .name = QUORUM_OPT_WRITE_PATTERN,
+            .type = QEMU_OPT_STRING,
+            .help = "Allowed pattern: quorum, threshold. Quorum is default",
         },
         { /* end of list */ }
     },
@@ -971,11 +1360,32 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
                               -EINVAL, NULL);
     }
     if (ret < 0) {
-        error_setg(errp, "Please set read-pattern as fifo or quorum");
+        error_setg(errp, "Please set read-pattern as fifo, fastest or quorum");
         goto exit;
     }
     s->read_pattern = ret;
 
+    pattern_str = qemu_opt_get(opts, QUORUM_OPT_WRITE_PATTERN);
+    if (!pattern_str) {
+        ret = QUORUM_WRITE_PATTERN_QUORUM;
+    } else {
+        ret = qapi_enum_parse(&QuorumWritePattern_lookup, pattern_str,
+                              -EINVAL, NULL);
+    }
+    if (ret < 0) {
+        error_setg(errp, "Please set write-pattern as threshold or quorum");
+        goto exit;
+    }
+    s->write_pattern = ret;
+
+    if (s->write_pattern == QUORUM_WRITE_PATTERN_THRESHOLD &&
+        s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+        error_setg(errp, "write-pattern=threshold cannot be used with "
+                   "read-pattern=quorum, as children may be out of date");
+        ret = -EINVAL;
+        goto exit;
+    }
+
     if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
         s->is_blkverify = qemu_opt_get_bool(opts, QUORUM_OPT_BLKVERIFY, false);
         if (s->is_blkverify && (s->num_children != 2 || s->threshold != 2)) {
@@ -997,7 +1407,10 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* allocate the children array */
     s->children = g_new0(BdrvChild *, s->num_children);
+    s->stats = g_new0(QuorumChildStats, s->num_children);
     opened = g_new0(bool, s->num_children);
+    QLIST_INIT(&s->writes);
+    qemu_co_queue_init(&s->write_queue);
 
     for (i = 0; i < s->num_children; i++) {
         char indexstr[INDEXSTR_LEN];
@@ -1013,6 +1426,18 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
         }
 
         opened[i] = true;
+
+        if (s->write_pattern == QUORUM_WRITE_PATTERN_THRESHOLD) {
+            s->stats[i].dirty =
+                bdrv_create_dirty_bitmap(s->children[i]->bs,
+                                         QUORUM_RESYNC_GRANULARITY, NULL,
+                                         errp);
+            if (!s->stats[i].dirty) {
+                ret = -EINVAL;
+                goto close_exit;
+            }
+            bdrv_disable_dirty_bitmap(s->stats[i].dirty);
+        }
     }
     s->next_child_index = s->num_children;
 
@@ -1028,9 +1453,13 @@ close_exit:
         if (!opened[i]) {
             continue;
         }
+        if (s->stats[i].dirty) {
+            bdrv_release_dirty_bitmap(s->stats[i].dirty);
+        }
         bdrv_unref_child(bs, s->children[i]);
     }
     g_free(s->children);
+    g_free(s->stats);
     g_free(opened);
 exit:
     qemu_opts_del(opts);
@@ -1043,16 +1472,21 @@ static void quorum_close(BlockDriverState *bs)
     int i;
 
     for (i = 0; i < s->num_children; i++) {
+        if (s->stats[i].dirty) {
+            bdrv_release_dirty_bitmap(s->stats[i].dirty);
+        }
         bdrv_unref_child(bs, s->children[i]);
     }
 
     g_free(s->children);
+    g_free(s->stats);
 }
 
 static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
                              Error **errp)
 {
     BDRVQuorumState *s = bs->opaque;
+    BdrvDirtyBitmap *dirty = NULL;
     BdrvChild *child;
     char indexstr[INDEXSTR_LEN];
     int ret;
@@ -1078,16 +1512,31 @@ static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
 
     bdrv_drained_begin(bs);
 
+    if (s->write_pattern == QUORUM_WRITE_PATTERN_THRESHOLD) {
+        dirty = bdrv_create_dirty_bitmap(child_bs, QUORUM_RESYNC_GRANULARITY,
+                                         NULL, errp);
+        if (!dirty) {
+            s->next_child_index--;
+            goto out;
+        }
+        bdrv_disable_dirty_bitmap(dirty);
+    }
+
     /* We can safely add the child now */
     bdrv_ref(child_bs);
 
     child = bdrv_attach_child(bs, child_bs, indexstr, &child_of_bds,
                               BDRV_CHILD_DATA, errp);
     if (child == NULL) {
+        if (dirty) {
+            bdrv_release_dirty_bitmap(dirty);
+        }
         s->next_child_index--;
         goto out;
     }
     s->children = g_renew(BdrvChild *, s->children, s->num_children + 1);
+    s->stats = g_renew(QuorumChildStats, s->stats, s->num_children + 1);
+    s->stats[s->num_children] = (QuorumChildStats) { .dirty = dirty };
     s->children[s->num_children++] = child;
     quorum_refresh_flags(bs);
 
@@ -1129,9 +1578,16 @@ static void quorum_del_child(BlockDriverState *bs, BdrvChild *child,
     bdrv_drained_begin(bs);
 
     /* We can safely remove this child now */
+    if (s->stats[i].dirty) {
+        bdrv_release_dirty_bitmap(s->stats[i].dirty);
+    }
     memmove(&s->children[i], &s->children[i + 1],
             (s->num_children - i - 1) * sizeof(BdrvChild *));
+    memmove(&s->stats[i], &s->stats[i + 1],
+            (s->num_children - i - 1) * sizeof(QuorumChildStats));
     s->children = g_renew(BdrvChild *, s->children, --s->num_children);
+    s->stats = g_renew(QuorumChildStats, s->stats, s->num_children);
+    s->probe_index = 0;
     bdrv_unref_child(bs, child);
 
     quorum_refresh_flags(bs);
@@ -1264,6 +1720,7 @@ static const char *const quorum_strong_runtime_opts[] = {
     QUORUM_OPT_BLKVERIFY,
     QUORUM_OPT_REWRITE,
     QUORUM_OPT_READ_PATTERN,
+    QUORUM_OPT_WRITE_PATTERN,
 
     NULL
 };
@@ -0,0 +1,521 @@
+/*
+ * shared-cache filter driver
+ *
+ * The driver caches the data read from a read-only image in a memory
+ * mapped file, typically in /dev/shm, so that all QEMU processes opening
+ * the same image through the same cache file share the cached clusters.
+ * This is meant for base images that are the backing file of many VMs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The cache file starts with a SharedCacheHeader, followed by a table of
+ * SharedCacheSlot and by the cluster data of each slot.  The cache is
+ * direct mapped: a cluster can only be stored in the slot selected by a
+ * hash of the image key and the cluster index, and a newer cluster simply
+ * replaces the previous one.
+ *
+ * Each slot is protected by a sequence counter, shared by all processes,
+ * which is odd while the slot is being filled.  Readers copy the data out
+ * and then check that the counter did not change, as with QemuSeqLock;
+ * writers take the slot with a compare-and-swap and give up if someone
+ * else is filling it.  Nobody ever waits for another process.
+ */
+
+#include "qemu/osdep.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define SHARED_CACHE_MAGIC          0x48434143554d4551ULL /* "QEMUCACH" */
+#define SHARED_CACHE_VERSION        1
+#define SHARED_CACHE_HEADER_SIZE    4096
+
+typedef struct SharedCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t cluster_size;
+    uint64_t nb_slots;
+    uint64_t data_offset;
+} SharedCacheHeader;
+
+typedef struct SharedCacheSlot {
+    /* odd while the slot is being filled */
+    uint32_t seq;
+    uint32_t reserved;
+    /* image key of the cached cluster, 0 if the slot was never filled */
+    uint64_t image;
+    /* index of the cached cluster in the image */
+    uint64_t cluster;
+} SharedCacheSlot;
+
+typedef struct BDRVSharedCacheState {
+    int fd;
+    void *map;
+    size_t map_size;
+
+    SharedCacheSlot *slots;
+    uint8_t *data;
+    uint64_t nb_slots;
+    uint32_t cluster_size;
+
+    /* identifies the image in the cache, never 0 */
+    uint64_t image_key;
+} BDRVSharedCacheState;
+
+#define SHARED_CACHE_OPT_PATH           "path"
+#define SHARED_CACHE_OPT_IMAGE_ID       "image-id"
+#define SHARED_CACHE_OPT_SIZE           "size"
+#define SHARED_CACHE_OPT_CLUSTER_SIZE   "cluster-size"
+static QemuOptsList runtime_opts = {
+    .name = "shared-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = SHARED_CACHE_OPT_PATH,
+            .type = QEMU_OPT_STRING,
+            .help = "memory mapped file holding the cache",
+        },
+        {
+            .name = SHARED_CACHE_OPT_IMAGE_ID,
+            .type = QEMU_OPT_STRING,
+            .help = "identity of the image in the cache, "
+                "default the filename of the image",
+        },
+        {
+            .name = SHARED_CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of a newly created cache file, default 256M",
+        },
+        {
+            .name = SHARED_CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "cache granularity, default 64k",
+        },
+        { /* end of list */ }
+    },
+};
+
+/* 64-bit FNV-1a */
+static uint64_t shared_cache_hash_str(const char *str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*str) {
+        h ^= (uint8_t)*str++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static SharedCacheSlot *shared_cache_slot(BDRVSharedCacheState *s,
+                                          uint64_t cluster)
+{
+    uint32_t h = qemu_xxhash4(s->image_key, cluster);
+
+    return &s->slots[h % s->nb_slots];
+}
+
+static uint8_t *shared_cache_slot_data(BDRVSharedCacheState *s,
+                                       SharedCacheSlot *slot)
+{
+    return s->data + (uint64_t)(slot - s->slots) * s->cluster_size;
+}
+
+/*
+ * Copy @cluster into @qiov at @qiov_offset if it is cached.  On a miss,
+ * the data in @qiov may have been overwritten with garbage.
+ */
+static bool shared_cache_lookup(BDRVSharedCacheState *s, uint64_t cluster,
+                                QEMUIOVector *qiov, size_t qiov_offset)
+{
+    SharedCacheSlot *slot = shared_cache_slot(s, cluster);
+    uint32_t seq = qatomic_load_acquire(&slot->seq);
+
+    if ((seq & 1) || slot->image != s->image_key ||
+        slot->cluster != cluster) {
+        return false;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset, shared_cache_slot_data(s, slot),
+                        s->cluster_size);
+    smp_rmb();
+    return qatomic_read(&slot->seq) == seq;
+}
+
+static void shared_cache_insert(BDRVSharedCacheState *s, uint64_t cluster,
+                                const uint8_t *buf)
+{
+    SharedCacheSlot *slot = shared_cache_slot(s, cluster);
+    uint32_t seq = qatomic_read(&slot->seq);
+
+    /* Somebody else is filling the slot, let them win */
+    if ((seq & 1) || qatomic_cmpxchg(&slot->seq, seq, seq + 1) != seq) {
+        return;
+    }
+
+    slot->image = s->image_key;
+    slot->cluster = cluster;
+    memcpy(shared_cache_slot_data(s, slot), buf, s->cluster_size);
+    qatomic_store_release(&slot->seq, seq + 2);
+}
+
+/*
+ * Map the cache file, initializing it if it is new.  The file lock
+ * serializes this against the other processes opening the same file.
+ */
+static int shared_cache_map(BDRVSharedCacheState *s, const char *path,
+                            uint64_t size, Error **errp)
+{
+    SharedCacheHeader *header;
+    struct stat st;
+    bool create;
+    uint64_t slots_end = 0;
+    int ret;
+
+    s->fd = qemu_create(path, O_RDWR, 0600, errp);
+    if (s->fd < 0) {
+        return -EINVAL;
+    }
+
+    if (flock(s->fd, LOCK_EX) < 0) {
+        ret = -errno;
+        error_setg_errno(errp, errno, "Could not lock '%s'", path);
+        goto fail;
+    }
+
+    if (fstat(s->fd, &st) < 0) {
+        ret = -errno;
+        error_setg_errno(errp, errno, "Could not stat '%s'", path);
+        goto fail;
+    }
+
+    create = st.st_size == 0;
+    if (create) {
+        s->nb_slots = (size - SHARED_CACHE_HEADER_SIZE) /
+                      (s->cluster_size + sizeof(SharedCacheSlot));
+        if (s->nb_slots == 0) {
+            ret = -EINVAL;
+            error_setg(errp, "Cache size is too small");
+            goto fail;
+        }
+        slots_end = SHARED_CACHE_HEADER_SIZE +
+                    s->nb_slots * sizeof(SharedCacheSlot);
+        s->map_size = ROUND_UP(slots_end, qemu_real_host_page_size) +
+                      s->nb_slots * s->cluster_size;
+        if (ftruncate(s->fd, s->map_size) < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not resize '%s'", path);
+            goto fail;
+        }
+    } else {
+        s->map_size = st.st_size;
+        if (s->map_size < SHARED_CACHE_HEADER_SIZE) {
+            ret = -EINVAL;
+            error_setg(errp, "'%s' is not a shared cache file", path);
+            goto fail;
+        }
+    }
+
+    s->map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        ret = -errno;
+        s->map = NULL;
+        error_setg_errno(errp, errno, "Could not map '%s'", path);
+        goto fail;
+    }
+
+    header = s->map;
+    if (create) {
+        header->version = SHARED_CACHE_VERSION;
+        header->cluster_size = s->cluster_size;
+        header->nb_slots = s->nb_slots;
+        header->data_offset = ROUND_UP(slots_end, qemu_real_host_page_size);
+        /* Written last, so that an interrupted initialization is detected */
+        smp_wmb();
+        header->magic = SHARED_CACHE_MAGIC;
+    } else if (header->magic != SHARED_CACHE_MAGIC ||
+               header->version != SHARED_CACHE_VERSION) {
+        ret = -EINVAL;
+        error_setg(errp, "'%s' is not a shared cache file", path);
+        goto fail;
+    } else if (header->cluster_size != s->cluster_size) {
+        ret = -EINVAL;
+        error_setg(errp, "Cache file '%s' has cluster-size %" PRIu32,
+                   path, header->cluster_size);
+        goto fail;
+    } else {
+        s->nb_slots = header->nb_slots;
+        if (s->nb_slots == 0 ||
+            header->data_offset < SHARED_CACHE_HEADER_SIZE +
+                                  s->nb_slots * sizeof(SharedCacheSlot) ||
+            header->data_offset + s->nb_slots * s->cluster_size >
+                s->map_size) {
+            ret = -EINVAL;
+            error_setg(errp, "Cache file '%s' is corrupt", path);
+            goto fail;
+        }
+    }
+
+    s->slots = s->map + SHARED_CACHE_HEADER_SIZE;
+    s->data = s->map + header->data_offset;
+
+    flock(s->fd, LOCK_UN);
+    return 0;
+
+fail:
+    if (s->map) {
+        munmap(s->map, s->map_size);
+        s->map = NULL;
+    }
+    qemu_close(s->fd);
+    return ret;
+}
+
+static int shared_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                             Error **errp)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    QemuOpts *opts;
+    const char *path;
+    g_autofree char *image_id = NULL;
+    uint64_t size;
+    int64_t len;
+    int ret;
+
+    if (flags & BDRV_O_RDWR) {
+        error_setg(errp, "The shared-cache filter requires read-only=on");
+        return -EINVAL;
+    }
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
+                               BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
+                               false, errp);
+    if (!bs->file) {
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    path = qemu_opt_get(opts, SHARED_CACHE_OPT_PATH);
+    if (!path) {
+        error_setg(errp, "Parameter '%s' is required", SHARED_CACHE_OPT_PATH);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    image_id = g_strdup(qemu_opt_get(opts, SHARED_CACHE_OPT_IMAGE_ID) ?:
+                        bs->file->bs->filename);
+    size = qemu_opt_get_size(opts, SHARED_CACHE_OPT_SIZE, 256 * MiB);
+    s->cluster_size = qemu_opt_get_size(opts, SHARED_CACHE_OPT_CLUSTER_SIZE,
+                                        64 * KiB);
+
+    if (!is_power_of_2(s->cluster_size) ||
+        s->cluster_size < BDRV_SECTOR_SIZE || s->cluster_size > 2 * MiB) {
+        error_setg(errp, "cluster-size must be a power of two between 512 "
+                   "and 2M");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (s->cluster_size < bs->file->bs->bl.request_alignment) {
+        error_setg(errp, "cluster-size must be at least the request "
+                   "alignment of the image (%" PRIu32 ")",
+                   bs->file->bs->bl.request_alignment);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (size <= SHARED_CACHE_HEADER_SIZE) {
+        error_setg(errp, "Cache size is too small");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    /* The length is part of the key, as a cheap check for a changed image */
+    len = bdrv_getlength(bs->file->bs);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "Could not get the image length");
+        ret = len;
+        goto out;
+    }
+    s->image_key = shared_cache_hash_str(image_id) ^ qemu_xxhash2(len);
+    s->image_key = s->image_key ?: 1;
+
+    ret = shared_cache_map(s, path, size, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    trace_shared_cache_open(bs, path, image_id, s->nb_slots, s->cluster_size);
+
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void shared_cache_close(BlockDriverState *bs)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+
+    munmap(s->map, s->map_size);
+    qemu_close(s->fd);
+}
+
+static void shared_cache_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+
+    /* Let the block layer pad requests to whole clusters */
+    bs->bl.request_alignment = s->cluster_size;
+}
+
+static void shared_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                    BdrvChildRole role,
+                                    BlockReopenQueue *reopen_queue,
+                                    uint64_t perm, uint64_t shared,
+                                    uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                       nperm, nshared);
+
+    /* Other processes would read stale data from the cache */
+    *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+}
+
+static int64_t shared_cache_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+/*
+ * Read the clusters [@first, @first + @nb) from the image, which were not
+ * found in the cache, and add them to it.  The data goes through a bounce
+ * buffer rather than the caller's buffer, which may be guest memory that
+ * the guest could change before it is copied to the cache.
+ */
+static int coroutine_fn shared_cache_fill(BlockDriverState *bs,
+                                          uint64_t first, uint64_t nb,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    uint64_t bytes = nb * s->cluster_size;
+    uint8_t *buf;
+    uint64_t i;
+    int ret;
+
+    buf = qemu_try_blockalign(bs->file->bs, bytes);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    ret = bdrv_co_pread(bs->file, first * s->cluster_size, bytes, buf, 0);
+    if (ret < 0) {
+        goto out;
+    }
+
+    for (i = 0; i < nb; i++) {
+        shared_cache_insert(s, first + i, buf + i * s->cluster_size);
+    }
+    qemu_iovec_from_buf(qiov, qiov_offset, buf, bytes);
+    ret = 0;
+
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static int coroutine_fn shared_cache_co_preadv_part(BlockDriverState *bs,
+                                                    uint64_t offset,
+                                                    uint64_t bytes,
+                                                    QEMUIOVector *qiov,
+                                                    size_t qiov_offset,
+                                                    int flags)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    uint64_t first = offset / s->cluster_size;
+    uint64_t nb = bytes / s->cluster_size;
+    uint64_t i, miss, hits = 0;
+    int ret;
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, s->cluster_size));
+
+    for (i = 0; i < nb; ) {
+        if (shared_cache_lookup(s, first + i, qiov,
+                                qiov_offset + i * s->cluster_size)) {
+            hits++;
+            i++;
+            continue;
+        }
+
+        /* Read the whole run of missing clusters at once */
+        for (miss = i + 1; miss < nb; miss++) {
+            if (shared_cache_lookup(s, first + miss, qiov,
+                                    qiov_offset + miss * s->cluster_size)) {
+                hits++;
+                break;
+            }
+        }
+
+        ret = shared_cache_fill(bs, first + i, miss - i, qiov,
+                                qiov_offset + i * s->cluster_size);
+        if (ret < 0) {
+            return ret;
+        }
+        i = miss + 1;
+    }
+
+    trace_shared_cache_co_preadv(bs, offset, bytes, hits, nb - hits);
+    return 0;
+}
+
+static BlockDriver bdrv_shared_cache = {
+    .format_name                = "shared-cache",
+    .instance_size              = sizeof(BDRVSharedCacheState),
+
+    .bdrv_open                  = shared_cache_open,
+    .bdrv_close                 = shared_cache_close,
+    .bdrv_refresh_limits        = shared_cache_refresh_limits,
+    .bdrv_child_perm            = shared_cache_child_perm,
+
+    .bdrv_getlength             = shared_cache_getlength,
+
+    .bdrv_co_preadv_part        = shared_cache_co_preadv_part,
+    .bdrv_co_block_status       = bdrv_co_block_status_from_file,
+
+    .is_filter                  = true,
+};
+
+static void bdrv_shared_cache_init(void)
+{
+    bdrv_register(&bdrv_shared_cache);
+}
+
+block_init(bdrv_shared_cache_init);
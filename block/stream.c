@@ -21,6 +21,7 @@
 #include "qemu/ratelimit.h"
 #include "sysemu/block-backend.h"
 #include "block/copy-on-read.h"
+#include "block/aio_task.h"
 
 enum {
     /*
@@ -29,8 +30,19 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Number of chunks that are copied in parallel */
+    STREAM_MAX_WORKERS = 8,
 };
 
+/* A chunk that failed to be copied in the background */
+typedef struct StreamFailedChunk {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    QSIMPLEQ_ENTRY(StreamFailedChunk) next;
+} StreamFailedChunk;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockDriverState *base_overlay; /* COW overlay (stream from this) */
@@ -40,6 +52,10 @@ typedef struct StreamBlockJob {
     BlockdevOnError on_error;
     char *backing_file_str;
     bool bs_read_only;
+
+    /* Chunks that failed, and those to copy again after resuming */
+    QSIMPLEQ_HEAD(, StreamFailedChunk) failed;
+    QSIMPLEQ_HEAD(, StreamFailedChunk) retry;
 } StreamBlockJob;
 
 static int coroutine_fn stream_populate(BlockBackend *blk,
@@ -102,11 +118,100 @@ static void stream_clean(Job *job)
     g_free(s->backing_file_str);
 }
 
+typedef struct StreamTask {
+    AioTask task;
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} StreamTask;
+
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+    StreamBlockJob *s = t->s;
+    int ret;
+
+    ret = stream_populate(s->common.blk, t->offset, t->bytes);
+    if (ret < 0) {
+        StreamFailedChunk *c = g_new(StreamFailedChunk, 1);
+
+        *c = (StreamFailedChunk) {
+            .offset = t->offset,
+            .bytes = t->bytes,
+            .ret = ret,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failed, c, next);
+        return ret;
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    return 0;
+}
+
+static void coroutine_fn stream_copy_chunk(StreamBlockJob *s,
+                                           AioTaskPool *pool,
+                                           int64_t offset, int64_t bytes)
+{
+    StreamTask *t = g_new(StreamTask, 1);
+
+    *t = (StreamTask) {
+        .task.func = stream_task_entry,
+        .s = s,
+        .offset = offset,
+        .bytes = bytes,
+    };
+    aio_task_pool_start_task(pool, &t->task);
+}
+
+/*
+ * Apply the error policy to the chunks that failed in the background.
+ * Chunks for which the job stops are copied again once it is resumed.
+ * Returns the error to report, or 0 if the job goes on.
+ */
+static int coroutine_fn stream_handle_failed(StreamBlockJob *s,
+                                             AioTaskPool *pool, int *error)
+{
+    StreamFailedChunk *c;
+    int ret = 0;
+
+    aio_task_pool_wait_all(pool);
+
+    while ((c = QSIMPLEQ_FIRST(&s->failed))) {
+        BlockErrorAction action;
+
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        if (ret < 0) {
+            g_free(c);
+            continue;
+        }
+
+        action = block_job_error_action(&s->common, s->on_error, true,
+                                        -c->ret);
+        if (action == BLOCK_ERROR_ACTION_STOP) {
+            QSIMPLEQ_INSERT_TAIL(&s->retry, c, next);
+            continue;
+        }
+        if (*error == 0) {
+            *error = c->ret;
+        }
+        if (action == BLOCK_ERROR_ACTION_REPORT) {
+            ret = c->ret;
+        } else {
+            job_progress_update(&s->common.job, c->bytes);
+        }
+        g_free(c);
+    }
+
+    return ret;
+}
+
 static int coroutine_fn stream_run(Job *job, Error **errp)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
     BlockBackend *blk = s->common.blk;
     BlockDriverState *unfiltered_bs = bdrv_skip_filters(s->target_bs);
+    AioTaskPool *pool;
+    StreamFailedChunk *c;
     int64_t len;
     int64_t offset = 0;
     uint64_t delay_ns = 0;
@@ -124,18 +229,52 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
-    for ( ; offset < len; offset += n) {
+    QSIMPLEQ_INIT(&s->failed);
+    QSIMPLEQ_INIT(&s->retry);
+
+    /*
+     * Chunks are copied by up to STREAM_MAX_WORKERS tasks, while this
+     * coroutine looks up the allocation status of the next ones.
+     */
+    pool = aio_task_pool_new(STREAM_MAX_WORKERS);
+
+    while (true) {
         bool copy;
         int ret;
 
+        if (!QSIMPLEQ_EMPTY(&s->failed) &&
+            stream_handle_failed(s, pool, &error) < 0) {
+            break;
+        }
+
+        if (offset >= len && QSIMPLEQ_EMPTY(&s->retry)) {
+            /* The last chunks may still fail */
+            aio_task_pool_wait_all(pool);
+            if (QSIMPLEQ_EMPTY(&s->failed)) {
+                break;
+            }
+            continue;
+        }
+
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.  Chunks that are still
+         * being copied are requests on our BlockBackend, which draining
+         * waits for.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
+        c = QSIMPLEQ_FIRST(&s->retry);
+        if (c) {
+            QSIMPLEQ_REMOVE_HEAD(&s->retry, next);
+            stream_copy_chunk(s, pool, c->offset, c->bytes);
+            delay_ns = block_job_ratelimit_get_delay(&s->common, c->bytes);
+            g_free(c);
+            continue;
+        }
+
         copy = false;
 
         ret = bdrv_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
@@ -155,14 +294,10 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             copy = (ret > 0);
         }
         trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(blk, offset, n);
-        }
         if (ret < 0) {
             BlockErrorAction action =
                 block_job_error_action(&s->common, s->on_error, true, -ret);
             if (action == BLOCK_ERROR_ACTION_STOP) {
-                n = 0;
                 continue;
             }
             if (error == 0) {
@@ -173,13 +308,27 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             }
         }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
         if (copy) {
+            stream_copy_chunk(s, pool, offset, n);
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
+            /* Publish progress */
+            job_progress_update(&s->common.job, n);
             delay_ns = 0;
         }
+        offset += n;
+    }
+
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+
+    while ((c = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(c);
+    }
+    while ((c = QSIMPLEQ_FIRST(&s->retry))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->retry, next);
+        g_free(c);
     }
 
     /* Do not remove the backing file if an error was there but ignored. */
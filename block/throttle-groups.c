@@ -35,6 +35,12 @@
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 
+/* Virtual time that one request of a member with weight 1 takes */
+#define THROTTLE_GROUP_VTIME_SCALE (1 << 16)
+
+/* Number of requests that a member can save up while it is idle */
+#define THROTTLE_GROUP_IDLE_CREDIT 16
+
 static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
@@ -74,6 +80,7 @@ struct ThrottleGroup {
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[2];
+    uint64_t vclock[2];
     bool any_timer_armed[2];
     QEMUClockType clock_type;
 
@@ -206,8 +213,57 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
     return tgm->pending_reqs[is_write];
 }
 
-/* Return the next ThrottleGroupMember in the round-robin sequence with pending
- * I/O requests.
+static unsigned tgm_weight(ThrottleGroupMember *tgm)
+{
+    return tgm->weight ?: 1;
+}
+
+/* Advance the virtual time of a ThrottleGroupMember for a request of @bytes
+ * that is being dispatched. Requests are counted like for the iops limits,
+ * so a large request counts as several if iops-size is set.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void tgm_account_vtime(ThrottleGroupMember *tgm, int64_t bytes,
+                              bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    double units = 1.0;
+
+    if (ts->cfg.op_size && bytes > ts->cfg.op_size) {
+        units = (double) bytes / ts->cfg.op_size;
+    }
+
+    tg->vclock[is_write] = MAX(tg->vclock[is_write], tgm->vtime[is_write]);
+    tgm->vtime[is_write] += units * THROTTLE_GROUP_VTIME_SCALE /
+                            tgm_weight(tgm);
+}
+
+/* A ThrottleGroupMember that was idle gets a request queued. Bring its
+ * virtual time forward to the group's, minus a limited credit for the time
+ * it was idle, so that it can neither monopolize the group nor lose its
+ * share because it was idle.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void tgm_activate_vtime(ThrottleGroupMember *tgm, bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    uint64_t credit = (uint64_t) THROTTLE_GROUP_IDLE_CREDIT *
+                      THROTTLE_GROUP_VTIME_SCALE / tgm_weight(tgm);
+
+    if (tg->vclock[is_write] > credit) {
+        tgm->vtime[is_write] = MAX(tgm->vtime[is_write],
+                                   tg->vclock[is_write] - credit);
+    }
+}
+
+/* Return the ThrottleGroupMember with pending I/O requests that should be
+ * served next. This is weighted fair queueing: each member has a virtual
+ * time that advances by the inverse of its weight for every request it
+ * dispatches, and the member with pending requests and the lowest virtual
+ * time is chosen. With equal weights this is round-robin.
  *
  * This assumes that tg->lock is held.
  *
@@ -221,7 +277,7 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *token, *start;
+    ThrottleGroupMember *token = NULL, *iter, *start;
 
     /* If this member has its I/O limits disabled then it means that
      * it's being drained. Skip the round-robin search and return tgm
@@ -232,19 +288,22 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
         return tgm;
     }
 
-    start = token = tg->tokens[is_write];
-
-    /* get next bs round in round robin style */
-    token = throttle_group_next_tgm(token);
-    while (token != start && !tgm_has_pending_reqs(token, is_write)) {
-        token = throttle_group_next_tgm(token);
-    }
+    /* Start after the current token, so that ties are broken in round
+     * robin order */
+    start = iter = throttle_group_next_tgm(tg->tokens[is_write]);
+    do {
+        if (tgm_has_pending_reqs(iter, is_write) &&
+            (!token || iter->vtime[is_write] < token->vtime[is_write])) {
+            token = iter;
+        }
+        iter = throttle_group_next_tgm(iter);
+    } while (iter != start);
 
-    /* If no IO are queued for scheduling on the next round robin token
-     * then decide the token is the current tgm because chances are
-     * the current tgm got the current request queued.
+    /* If no IO are queued for scheduling then decide the token is the
+     * current tgm because chances are the current tgm got the current
+     * request queued.
      */
-    if (token == start && !tgm_has_pending_reqs(token, is_write)) {
+    if (!token) {
         token = tgm;
     }
 
@@ -375,6 +434,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
+        if (!tgm->pending_reqs[is_write]) {
+            tgm_activate_vtime(tgm, is_write);
+        }
         tgm->pending_reqs[is_write]++;
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
@@ -387,6 +449,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, is_write, bytes);
+    if (!tgm->pending_reqs[is_write]) {
+        tgm_activate_vtime(tgm, is_write);
+    }
+    tgm_account_vtime(tgm, bytes, is_write);
 
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
@@ -462,6 +528,20 @@ void throttle_group_restart_tgm(ThrottleGroupMember *tgm)
     }
 }
 
+/* Set the weight of a ThrottleGroupMember, which determines its share of
+ * the group's limits when several members have requests queued.
+ *
+ * @tgm:    a ThrottleGroupMember that is a member of the group
+ * @weight: the new weight, 0 means 1
+ */
+void throttle_group_set_weight(ThrottleGroupMember *tgm, unsigned weight)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    tgm->weight = weight;
+}
+
 /* Update the throttle configuration for a particular group. Similar
  * to throttle_config(), but guarantees atomicity within the
  * throttling group.
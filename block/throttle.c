@@ -33,19 +33,32 @@ static QemuOptsList throttle_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Name of the throttle group",
         },
+        {
+            .name = "weight",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Share of the group's limits relative to the other "
+                    "members. Default 1",
+        },
         { /* end of list */ }
     },
 };
 
+typedef struct ThrottleReopenState {
+    char *group;
+    unsigned weight;
+} ThrottleReopenState;
+
 /*
  * If this function succeeds then the throttle group name is stored in
- * @group and must be freed by the caller.
- * If there's an error then @group remains unmodified.
+ * @group and must be freed by the caller, and the member weight in @weight.
+ * If there's an error then @group and @weight remain unmodified.
  */
-static int throttle_parse_options(QDict *options, char **group, Error **errp)
+static int throttle_parse_options(QDict *options, char **group,
+                                  unsigned *weight, Error **errp)
 {
     int ret;
     const char *group_name;
+    uint64_t weight_opt;
     QemuOpts *opts = qemu_opts_create(&throttle_opts, NULL, 0, &error_abort);
 
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
@@ -64,7 +77,15 @@ static int throttle_parse_options(QDict *options, char **group, Error **errp)
         goto fin;
     }
 
+    weight_opt = qemu_opt_get_number(opts, "weight", 1);
+    if (weight_opt < 1 || weight_opt > UINT16_MAX) {
+        error_setg(errp, "weight must be between 1 and %d", UINT16_MAX);
+        ret = -EINVAL;
+        goto fin;
+    }
+
     *group = g_strdup(group_name);
+    *weight = weight_opt;
     ret = 0;
 fin:
     qemu_opts_del(opts);
@@ -76,6 +97,7 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
 {
     ThrottleGroupMember *tgm = bs->opaque;
     char *group;
+    unsigned weight;
     int ret;
 
     bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
@@ -89,10 +111,11 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
     bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
                                BDRV_REQ_WRITE_UNCHANGED;
 
-    ret = throttle_parse_options(options, &group, errp);
+    ret = throttle_parse_options(options, &group, &weight, errp);
     if (ret == 0) {
         /* Register membership to group with name group_name */
         throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        throttle_group_set_weight(tgm, weight);
         g_free(group);
     }
 
@@ -182,13 +205,14 @@ static int throttle_reopen_prepare(BDRVReopenState *reopen_state,
                                    BlockReopenQueue *queue, Error **errp)
 {
     int ret;
-    char *group = NULL;
+    ThrottleReopenState *rs = g_new0(ThrottleReopenState, 1);
 
     assert(reopen_state != NULL);
     assert(reopen_state->bs != NULL);
 
-    ret = throttle_parse_options(reopen_state->options, &group, errp);
-    reopen_state->opaque = group;
+    ret = throttle_parse_options(reopen_state->options, &rs->group,
+                                 &rs->weight, errp);
+    reopen_state->opaque = rs;
     return ret;
 }
 
@@ -196,21 +220,26 @@ static void throttle_reopen_commit(BDRVReopenState *reopen_state)
 {
     BlockDriverState *bs = reopen_state->bs;
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group = reopen_state->opaque;
+    ThrottleReopenState *rs = reopen_state->opaque;
 
-    assert(group);
+    assert(rs->group);
 
-    if (strcmp(group, throttle_group_get_name(tgm))) {
+    if (strcmp(rs->group, throttle_group_get_name(tgm))) {
         throttle_group_unregister_tgm(tgm);
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        throttle_group_register_tgm(tgm, rs->group, bdrv_get_aio_context(bs));
     }
-    g_free(reopen_state->opaque);
+    throttle_group_set_weight(tgm, rs->weight);
+    g_free(rs->group);
+    g_free(rs);
     reopen_state->opaque = NULL;
 }
 
 static void throttle_reopen_abort(BDRVReopenState *reopen_state)
 {
-    g_free(reopen_state->opaque);
+    ThrottleReopenState *rs = reopen_state->opaque;
+
+    g_free(rs->group);
+    g_free(rs);
     reopen_state->opaque = NULL;
 }
 
@@ -1438,12 +1438,20 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
                     qemu_iovec_concat(&hd_qiov, qiov,  bytes_done,
                                       sinfo.bytes_avail);
                 }
-                /* block exists, so we can just overwrite it */
-                qemu_co_mutex_unlock(&s->lock);
+                /*
+                 * Block exists, so we can just overwrite it.  A block
+                 * allocated above is already marked present in s->bat, so
+                 * keep other requests out until it holds the data.
+                 */
+                if (!bat_update) {
+                    qemu_co_mutex_unlock(&s->lock);
+                }
                 ret = bdrv_co_pwritev(bs->file, sinfo.file_offset,
                                       sectors_to_write * BDRV_SECTOR_SIZE,
                                       &hd_qiov, 0);
-                qemu_co_mutex_lock(&s->lock);
+                if (!bat_update) {
+                    qemu_co_mutex_lock(&s->lock);
+                }
                 if (ret < 0) {
                     goto error_bat_restore;
                 }
@@ -1900,7 +1900,6 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     uint64_t bytes_done = 0;
 
     qemu_iovec_init(&local_qiov, qiov->niov);
-    qemu_co_mutex_lock(&s->lock);
 
     while (bytes > 0) {
         extent = find_extent(s, offset >> BDRV_SECTOR_BITS, extent);
@@ -1908,8 +1907,14 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             ret = -EIO;
             goto fail;
         }
+        /*
+         * The lock protects the L2 cache.  Allocated grains never move, so
+         * the data is read without it, in parallel with other requests.
+         */
+        qemu_co_mutex_lock(&s->lock);
         ret = get_cluster_offset(bs, extent, NULL,
                                  offset, false, &cluster_offset, 0, 0);
+        qemu_co_mutex_unlock(&s->lock);
         offset_in_cluster = vmdk_find_offset_in_cluster(extent, offset);
 
         n_bytes = MIN(bytes, extent->cluster_sectors * BDRV_SECTOR_SIZE
@@ -1953,7 +1958,6 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
     ret = 0;
 fail:
-    qemu_co_mutex_unlock(&s->lock);
     qemu_iovec_destroy(&local_qiov);
 
     return ret;
@@ -2035,6 +2039,18 @@ static int vmdk_pwritev(BlockDriverState *bs, uint64_t offset,
             } else {
                 return -ENOTSUP;
             }
+        } else if (!m_data.new_allocation && !extent->compressed) {
+            /*
+             * Overwriting an allocated grain touches no metadata, so let
+             * other requests proceed meanwhile.
+             */
+            qemu_co_mutex_unlock(&s->lock);
+            ret = vmdk_write_extent(extent, cluster_offset, offset_in_cluster,
+                                    qiov, bytes_done, n_bytes, offset);
+            qemu_co_mutex_lock(&s->lock);
+            if (ret) {
+                return ret;
+            }
         } else {
             ret = vmdk_write_extent(extent, cluster_offset, offset_in_cluster,
                                     qiov, bytes_done, n_bytes, offset);
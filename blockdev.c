@@ -35,6 +35,7 @@
 #include "sysemu/blockdev.h"
 #include "hw/block/block.h"
 #include "block/blockjob.h"
+#include "block/block-copy.h"
 #include "block/qdict.h"
 #include "block/throttle-groups.h"
 #include "monitor/monitor.h"
@@ -63,6 +64,7 @@
 #include "qemu/help_option.h"
 #include "qemu/main-loop.h"
 #include "qemu/throttle-options.h"
+#include "qemu/timeline.h"
 
 QTAILQ_HEAD(, BlockDriverState) monitor_bdrv_states =
     QTAILQ_HEAD_INITIALIZER(monitor_bdrv_states);
@@ -493,6 +495,7 @@ static BlockBackend *blockdev_init(const char *file, QDict *bs_opts,
     BlockdevDetectZeroesOptions detect_zeroes =
         BLOCKDEV_DETECT_ZEROES_OPTIONS_OFF;
     const char *throttling_group = NULL;
+    int64_t start_ns;
 
     /* Check common options by copying from bs_opts to opts, all other options
      * stay in bs_opts for processing by bdrv_open(). */
@@ -606,7 +609,9 @@ static BlockBackend *blockdev_init(const char *file, QDict *bs_opts,
             bdrv_flags |= BDRV_O_INACTIVE;
         }
 
+        start_ns = timeline_start();
         blk = blk_new_open(file, NULL, bs_opts, bdrv_flags, errp);
+        timeline_record("blockdev", qemu_opts_id(opts) ?: "", start_ns);
         if (!blk) {
             goto err_no_bs_opts;
         }
@@ -2837,6 +2842,12 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_max_chunk) {
             perf.max_chunk = backup->x_perf->max_chunk;
         }
+        if (backup->x_perf->has_shards) {
+            perf.shards = backup->x_perf->shards;
+        }
+        if (backup->x_perf->has_weight) {
+            perf.weight = backup->x_perf->weight;
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
@@ -3346,6 +3357,16 @@ void qmp_block_job_set_speed(const char *device, int64_t speed, Error **errp)
     aio_context_release(aio_context);
 }
 
+void qmp_x_backup_set_global_speed(int64_t speed, Error **errp)
+{
+    if (speed < 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER, "speed");
+        return;
+    }
+
+    block_copy_set_global_speed(speed);
+}
+
 void qmp_block_job_cancel(const char *device,
                           bool has_force, bool force, Error **errp)
 {
@@ -3533,7 +3554,9 @@ out:
 
 void qmp_blockdev_add(BlockdevOptions *options, Error **errp)
 {
+    g_autofree char *node_name = NULL;
     BlockDriverState *bs;
+    int64_t start_ns;
     QObject *obj;
     Visitor *v = qobject_output_visitor_new(&obj);
     QDict *qdict;
@@ -3549,7 +3572,10 @@ void qmp_blockdev_add(BlockdevOptions *options, Error **errp)
         goto fail;
     }
 
+    node_name = g_strdup(qdict_get_str(qdict, "node-name"));
+    start_ns = timeline_start();
     bs = bds_tree_init(qdict, errp);
+    timeline_record("blockdev", node_name, start_ns);
     if (!bs) {
         goto fail;
     }
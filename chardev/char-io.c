@@ -23,6 +23,7 @@
  */
 #include "qemu/osdep.h"
 #include "chardev/char-io.h"
+#include "qemu/iov.h"
 
 typedef struct IOWatchPoll {
     GSource parent;
@@ -109,20 +110,23 @@ void remove_fd_in_watch(Chardev *chr)
     }
 }
 
-int io_channel_send_full(QIOChannel *ioc,
-                         const void *buf, size_t len,
-                         int *fds, size_t nfds)
+int io_channel_sendv_full(QIOChannel *ioc,
+                          const struct iovec *iov, int iovcnt,
+                          int *fds, size_t nfds)
 {
+    /* Only modified once it points to a copy of @iov */
+    struct iovec *cur = (struct iovec *)iov;
+    unsigned int cnt = iovcnt;
+    g_autofree struct iovec *copy = NULL;
+    size_t len = iov_size(iov, iovcnt);
     size_t offset = 0;
 
     while (offset < len) {
         ssize_t ret = 0;
-        struct iovec iov = { .iov_base = (char *)buf + offset,
-                             .iov_len = len - offset };
 
         ret = qio_channel_writev_full(
-            ioc, &iov, 1,
-            fds, nfds, NULL);
+            ioc, cur, cnt,
+            fds, nfds, 0, NULL);
         if (ret == QIO_CHANNEL_ERR_BLOCK) {
             if (offset) {
                 return offset;
@@ -136,11 +140,28 @@ int io_channel_send_full(QIOChannel *ioc,
         }
 
         offset += ret;
+        if (offset < len) {
+            /* Short write, skip what was sent in a private copy */
+            if (!copy) {
+                copy = g_memdup(cur, cnt * sizeof(*cur));
+                cur = copy;
+            }
+            iov_discard_front(&cur, &cnt, ret);
+        }
     }
 
     return offset;
 }
 
+int io_channel_send_full(QIOChannel *ioc,
+                         const void *buf, size_t len,
+                         int *fds, size_t nfds)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+    return io_channel_sendv_full(ioc, &iov, 1, fds, nfds);
+}
+
 int io_channel_send(QIOChannel *ioc, const void *buf, size_t len)
 {
     return io_channel_send_full(ioc, buf, len, NULL, 0);
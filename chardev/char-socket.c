@@ -38,12 +38,20 @@
 
 #include "chardev/char-io.h"
 #include "qom/object.h"
+#include "qemu/units.h"
 
 /***********************************************************/
 /* TCP Net console */
 
 #define TCP_MAX_FDS 16
 
+/*
+ * Larger than CHR_READ_BUF_LEN, so that frontends that can take bulk
+ * data (e.g. virtio-serial ports) get it with fewer main loop
+ * iterations; each read is still limited by what the frontend accepts.
+ */
+#define TCP_CHR_READ_BUF_LEN (64 * KiB)
+
 typedef struct {
     char buf[21];
     size_t buflen;
@@ -71,6 +79,7 @@ struct SocketChardev {
     size_t read_msgfds_num;
     int *write_msgfds;
     size_t write_msgfds_num;
+    uint8_t *read_buf;
     bool registered_yank;
 
     SocketAddress *addr;
@@ -160,14 +169,14 @@ static int tcp_chr_read_poll(void *opaque);
 static void tcp_chr_disconnect_locked(Chardev *chr);
 
 /* Called with chr_write_lock held.  */
-static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
+static int tcp_chr_writev(Chardev *chr, const struct iovec *iov, int iovcnt)
 {
     SocketChardev *s = SOCKET_CHARDEV(chr);
 
     if (s->state == TCP_CHARDEV_STATE_CONNECTED) {
-        int ret =  io_channel_send_full(s->ioc, buf, len,
-                                        s->write_msgfds,
-                                        s->write_msgfds_num);
+        int ret =  io_channel_sendv_full(s->ioc, iov, iovcnt,
+                                         s->write_msgfds,
+                                         s->write_msgfds_num);
 
         /* free the written msgfds in any cases
          * other than ret < 0 && errno == EAGAIN
@@ -194,6 +203,13 @@ static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
     }
 }
 
+static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+    return tcp_chr_writev(chr, &iov, 1);
+}
+
 static int tcp_chr_read_poll(void *opaque)
 {
     Chardev *chr = CHARDEV(opaque);
@@ -541,14 +557,18 @@ static gboolean tcp_chr_read(QIOChannel *chan, GIOCondition cond, void *opaque)
 {
     Chardev *chr = CHARDEV(opaque);
     SocketChardev *s = SOCKET_CHARDEV(opaque);
-    uint8_t buf[CHR_READ_BUF_LEN];
+    uint8_t *buf;
     int len, size;
 
     if ((s->state != TCP_CHARDEV_STATE_CONNECTED) ||
         s->max_size <= 0) {
         return TRUE;
     }
-    len = sizeof(buf);
+    if (!s->read_buf) {
+        s->read_buf = g_malloc(TCP_CHR_READ_BUF_LEN);
+    }
+    buf = s->read_buf;
+    len = TCP_CHR_READ_BUF_LEN;
     if (len > s->max_size) {
         len = s->max_size;
     }
@@ -1116,6 +1136,7 @@ static void char_socket_finalize(Object *obj)
     qapi_free_SocketAddress(s->addr);
     tcp_chr_telnet_destroy(s);
     g_free(s->telnet_init);
+    g_free(s->read_buf);
     if (s->listener) {
         qio_net_listener_set_client_func_full(s->listener, NULL, NULL,
                                               NULL, chr->gcontext);
@@ -1579,6 +1600,7 @@ static void char_socket_class_init(ObjectClass *oc, void *data)
     cc->open = qmp_chardev_open_socket;
     cc->chr_wait_connected = tcp_chr_wait_connected;
     cc->chr_write = tcp_chr_write;
+    cc->chr_writev = tcp_chr_writev;
     cc->chr_sync_read = tcp_chr_sync_read;
     cc->chr_disconnect = tcp_chr_disconnect;
     cc->get_msgfds = tcp_get_msgfds;
@@ -39,6 +39,7 @@
 #include "qemu/id.h"
 #include "qemu/coroutine.h"
 #include "qemu/yank.h"
+#include "qemu/iov.h"
 
 #include "chardev-internal.h"
 
@@ -182,6 +183,67 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+/*
+ * Write a scatter/gather list without flattening it, for backends
+ * that implement chr_writev.  Logging and record/replay work on flat
+ * buffers, so they keep going through qemu_chr_write().
+ */
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt,
+                    bool write_all)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    size_t len = iov_size(iov, iovcnt);
+    struct iovec *cur = (struct iovec *)iov;
+    unsigned int cnt = iovcnt;
+    g_autofree struct iovec *copy = NULL;
+    size_t offset = 0;
+    int res = 0;
+
+    if (iovcnt == 1) {
+        return qemu_chr_write(s, iov->iov_base, iov->iov_len, write_all);
+    }
+    if (!cc->chr_writev || qemu_chr_replay(s) || s->logfd >= 0) {
+        g_autofree uint8_t *buf = g_malloc(len);
+
+        iov_to_buf(iov, iovcnt, 0, buf, len);
+        return qemu_chr_write(s, buf, len, write_all);
+    }
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    while (offset < len) {
+    retry:
+        res = cc->chr_writev(s, cur, cnt);
+        if (res < 0 && errno == EAGAIN && write_all) {
+            if (qemu_in_coroutine()) {
+                qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, 100000);
+            } else {
+                g_usleep(100);
+            }
+            goto retry;
+        }
+
+        if (res <= 0) {
+            break;
+        }
+
+        offset += res;
+        if (!write_all || offset == len) {
+            break;
+        }
+        if (!copy) {
+            copy = g_memdup(cur, cnt * sizeof(*cur));
+            cur = copy;
+        }
+        iov_discard_front(&cur, &cnt, res);
+    }
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    if (res < 0) {
+        return res;
+    }
+    return offset;
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
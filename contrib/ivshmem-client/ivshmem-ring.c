@@ -0,0 +1,196 @@
+/*
+ * Lock-free message rings in ivshmem shared memory
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+
+#include "ivshmem-ring.h"
+
+QEMU_BUILD_BUG_ON(sizeof(IvshmemRingHeader) != 3 * IVSHMEM_RING_CACHELINE);
+
+static inline IvshmemRingSlot *
+ivshmem_ring_slot(const IvshmemRing *ring, uint32_t pos)
+{
+    return (IvshmemRingSlot *)(ring->slots +
+                               (size_t)(pos & ring->mask) * ring->slot_size);
+}
+
+static uint32_t
+ivshmem_ring_slot_size(uint32_t max_msg)
+{
+    return ROUND_UP(sizeof(IvshmemRingSlot) + max_msg,
+                    IVSHMEM_RING_CACHELINE);
+}
+
+size_t
+ivshmem_ring_size(uint32_t nb_slots, uint32_t max_msg)
+{
+    return sizeof(IvshmemRingHeader) +
+           (size_t)nb_slots * ivshmem_ring_slot_size(max_msg);
+}
+
+int
+ivshmem_ring_format(IvshmemRing *ring, void *mem, size_t size,
+                    uint32_t nb_slots, uint32_t max_msg, uint32_t flags)
+{
+    IvshmemRingHeader *hdr = mem;
+    uint32_t i;
+
+    if (!is_power_of_2(nb_slots) ||
+        (uintptr_t)mem % IVSHMEM_RING_CACHELINE ||
+        max_msg > UINT32_MAX - IVSHMEM_RING_CACHELINE ||
+        ivshmem_ring_size(nb_slots, max_msg) > size) {
+        return -EINVAL;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->flags = flags;
+    hdr->nb_slots = nb_slots;
+    hdr->slot_size = ivshmem_ring_slot_size(max_msg);
+
+    ring->hdr = hdr;
+    ring->slots = (uint8_t *)(hdr + 1);
+    ring->mask = nb_slots - 1;
+    ring->slot_size = hdr->slot_size;
+
+    for (i = 0; i < nb_slots; i++) {
+        IvshmemRingSlot *slot = ivshmem_ring_slot(ring, i);
+
+        slot->seq = i;
+        slot->len = 0;
+    }
+
+    /* publish the layout last, peers check the magic before using it */
+    qatomic_store_release(&hdr->magic, IVSHMEM_RING_MAGIC);
+    return 0;
+}
+
+int
+ivshmem_ring_attach(IvshmemRing *ring, void *mem, size_t size)
+{
+    IvshmemRingHeader *hdr = mem;
+
+    if (size < sizeof(*hdr) ||
+        qatomic_load_acquire(&hdr->magic) != IVSHMEM_RING_MAGIC ||
+        !is_power_of_2(hdr->nb_slots) ||
+        hdr->slot_size < sizeof(IvshmemRingSlot) ||
+        hdr->slot_size % IVSHMEM_RING_CACHELINE ||
+        (size - sizeof(*hdr)) / hdr->slot_size < hdr->nb_slots) {
+        return -EINVAL;
+    }
+
+    ring->hdr = hdr;
+    ring->slots = (uint8_t *)(hdr + 1);
+    ring->mask = hdr->nb_slots - 1;
+    ring->slot_size = hdr->slot_size;
+    return 0;
+}
+
+int
+ivshmem_ring_enqueue(IvshmemRing *ring, const void *buf, uint32_t len)
+{
+    IvshmemRingHeader *hdr = ring->hdr;
+    bool multi = hdr->flags & IVSHMEM_RING_F_MULTI_PRODUCER;
+    IvshmemRingSlot *slot;
+    uint32_t pos;
+
+    if (len > ring->slot_size - sizeof(IvshmemRingSlot)) {
+        return -EINVAL;
+    }
+
+    pos = qatomic_read(&hdr->head);
+    for (;;) {
+        int32_t diff;
+
+        slot = ivshmem_ring_slot(ring, pos);
+        diff = (int32_t)(qatomic_load_acquire(&slot->seq) - pos);
+        if (diff < 0) {
+            /* the consumer has not released this slot yet */
+            return -EAGAIN;
+        }
+        if (diff > 0) {
+            /* another producer filled this position, catch up */
+            pos = qatomic_read(&hdr->head);
+            continue;
+        }
+        if (!multi) {
+            qatomic_set(&hdr->head, pos + 1);
+            break;
+        }
+        if (qatomic_cmpxchg(&hdr->head, pos, pos + 1) == pos) {
+            break;
+        }
+        pos = qatomic_read(&hdr->head);
+    }
+
+    memcpy(slot->data, buf, len);
+    slot->len = len;
+    qatomic_store_release(&slot->seq, pos + 1);
+    return 0;
+}
+
+ssize_t
+ivshmem_ring_dequeue(IvshmemRing *ring, void *buf, uint32_t len)
+{
+    IvshmemRingHeader *hdr = ring->hdr;
+    uint32_t pos = qatomic_read(&hdr->tail);
+    IvshmemRingSlot *slot = ivshmem_ring_slot(ring, pos);
+    uint32_t msg_len;
+
+    if (qatomic_load_acquire(&slot->seq) != pos + 1) {
+        return -EAGAIN;
+    }
+
+    msg_len = slot->len;
+    if (msg_len > len) {
+        return -ENOBUFS;
+    }
+    memcpy(buf, slot->data, msg_len);
+
+    /* hand the slot back to the producers for the next lap */
+    qatomic_store_release(&slot->seq, pos + ring->mask + 1);
+    qatomic_set(&hdr->tail, pos + 1);
+    return msg_len;
+}
+
+bool
+ivshmem_ring_empty(const IvshmemRing *ring)
+{
+    uint32_t pos = qatomic_read(&ring->hdr->tail);
+
+    return qatomic_load_acquire(&ivshmem_ring_slot(ring, pos)->seq) !=
+           pos + 1;
+}
+
+bool
+ivshmem_ring_need_notify(const IvshmemRing *ring)
+{
+    /* order the slot update before reading the flag, see prepare_wait */
+    smp_mb();
+    return qatomic_read(&ring->hdr->need_notify);
+}
+
+bool
+ivshmem_ring_prepare_wait(IvshmemRing *ring)
+{
+    qatomic_set(&ring->hdr->need_notify, 1);
+    /* order setting the flag before checking for messages */
+    smp_mb();
+    if (!ivshmem_ring_empty(ring)) {
+        qatomic_set(&ring->hdr->need_notify, 0);
+        return false;
+    }
+    return true;
+}
+
+void
+ivshmem_ring_end_wait(IvshmemRing *ring)
+{
+    qatomic_set(&ring->hdr->need_notify, 0);
+}
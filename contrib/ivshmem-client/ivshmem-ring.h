@@ -0,0 +1,189 @@
+/*
+ * Lock-free message rings in ivshmem shared memory
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#ifndef IVSHMEM_RING_H
+#define IVSHMEM_RING_H
+
+/**
+ * This file provides a reference implementation of the notification
+ * ring described in docs/specs/ivshmem-spec.txt.  A ring is a bounded
+ * queue of fixed-size slots living in the shared memory region, with a
+ * single consumer and either a single producer or several producers.
+ *
+ * Peers exchange messages by polling the ring, so no doorbell write
+ * (and no VM exit, eventfd or interrupt) is needed on the fast path.
+ * A consumer that wants to sleep sets the need_notify flag first; a
+ * producer only rings the consumer's doorbell when it finds the flag
+ * set after enqueueing.
+ *
+ * Because ring state is kept in the region itself, the same code can
+ * be used by a process on the host that maps the ivshmem server's
+ * shared memory and by a guest that maps BAR2.
+ */
+
+#define IVSHMEM_RING_MAGIC        0x52485649 /* "IVHR" */
+#define IVSHMEM_RING_CACHELINE    64
+
+/**
+ * The ring accepts concurrent producers
+ */
+#define IVSHMEM_RING_F_MULTI_PRODUCER (1 << 0)
+
+/**
+ * Ring header, at the start of the ring's area of shared memory
+ *
+ * Fields written by the producers and by the consumer are kept on
+ * separate cache lines.  All fields are in the byte order of the
+ * host, which is also that of the guests sharing the memory.
+ */
+typedef struct IvshmemRingHeader {
+    uint32_t magic;                   /**< IVSHMEM_RING_MAGIC */
+    uint32_t flags;                   /**< IVSHMEM_RING_F_* */
+    uint32_t nb_slots;                /**< number of slots, power of 2 */
+    uint32_t slot_size;               /**< bytes per slot, with header */
+    uint8_t pad0[IVSHMEM_RING_CACHELINE - 16];
+
+    uint32_t head;                    /**< next slot to fill */
+    uint8_t pad1[IVSHMEM_RING_CACHELINE - 4];
+
+    uint32_t tail;                    /**< next slot to consume */
+    uint32_t need_notify;             /**< consumer waits for a doorbell */
+    uint8_t pad2[IVSHMEM_RING_CACHELINE - 8];
+} IvshmemRingHeader;
+
+/**
+ * Slot header, followed by the message payload
+ *
+ * @seq is the slot's sequence number: a slot at ring position pos is
+ * free for the producer when seq == pos, and holds a message for the
+ * consumer when seq == pos + 1.
+ */
+typedef struct IvshmemRingSlot {
+    uint32_t seq;
+    uint32_t len;
+    uint8_t data[];
+} IvshmemRingSlot;
+
+/**
+ * Local handle on a ring in shared memory
+ */
+typedef struct IvshmemRing {
+    IvshmemRingHeader *hdr;           /**< header in shared memory */
+    uint8_t *slots;                   /**< first slot */
+    uint32_t mask;                    /**< nb_slots - 1 */
+    uint32_t slot_size;               /**< bytes per slot */
+} IvshmemRing;
+
+/**
+ * Size of the shared memory used by a ring
+ *
+ * @nb_slots:  The number of slots, a power of 2
+ * @max_msg:   The largest message size in bytes
+ *
+ * Returns:    The size in bytes, a multiple of the cache line size
+ */
+size_t ivshmem_ring_size(uint32_t nb_slots, uint32_t max_msg);
+
+/**
+ * Lay out an empty ring in shared memory
+ *
+ * Only one peer formats a ring, before any other peer attaches to it.
+ *
+ * @ring:      The local ring handle to initialize
+ * @mem:       The start of the ring area, cache line aligned
+ * @size:      The size of the ring area
+ * @nb_slots:  The number of slots, a power of 2
+ * @max_msg:   The largest message size in bytes
+ * @flags:     IVSHMEM_RING_F_* flags
+ *
+ * Returns:    0 on success, or a negative value on error
+ */
+int ivshmem_ring_format(IvshmemRing *ring, void *mem, size_t size,
+                        uint32_t nb_slots, uint32_t max_msg, uint32_t flags);
+
+/**
+ * Attach to a ring formatted by another peer
+ *
+ * @ring:      The local ring handle to initialize
+ * @mem:       The start of the ring area
+ * @size:      The size of the ring area
+ *
+ * Returns:    0 on success, or a negative value if the area does not
+ *             hold a valid ring
+ */
+int ivshmem_ring_attach(IvshmemRing *ring, void *mem, size_t size);
+
+/**
+ * Enqueue a message
+ *
+ * @ring:      The ring
+ * @buf:       The message
+ * @len:       The message length
+ *
+ * Returns:    0 on success, -EAGAIN if the ring is full, or -EINVAL if
+ *             the message does not fit in a slot
+ */
+int ivshmem_ring_enqueue(IvshmemRing *ring, const void *buf, uint32_t len);
+
+/**
+ * Dequeue a message
+ *
+ * Only one consumer may dequeue from a ring.
+ *
+ * @ring:      The ring
+ * @buf:       The buffer receiving the message
+ * @len:       The buffer size
+ *
+ * Returns:    The message length on success, -EAGAIN if the ring is empty,
+ *             or -ENOBUFS if the message is larger than @len; the message
+ *             is left in the ring then
+ */
+ssize_t ivshmem_ring_dequeue(IvshmemRing *ring, void *buf, uint32_t len);
+
+/**
+ * Check whether the ring holds no message
+ *
+ * @ring:      The ring
+ *
+ * Returns:    true if the next dequeue would return -EAGAIN
+ */
+bool ivshmem_ring_empty(const IvshmemRing *ring);
+
+/**
+ * Check whether the consumer must be woken up
+ *
+ * Called by a producer after a successful enqueue.  If it returns true,
+ * the producer rings the consumer's doorbell, for example with
+ * ivshmem_client_notify().
+ *
+ * @ring:      The ring
+ *
+ * Returns:    true if the consumer is waiting for a doorbell
+ */
+bool ivshmem_ring_need_notify(const IvshmemRing *ring);
+
+/**
+ * Announce that the consumer is about to wait for a doorbell
+ *
+ * The consumer must not sleep if this returns false, because a message
+ * was enqueued before the producers could see the request.
+ *
+ * @ring:      The ring
+ *
+ * Returns:    true if the ring is still empty and the consumer may sleep
+ */
+bool ivshmem_ring_prepare_wait(IvshmemRing *ring);
+
+/**
+ * Go back to polling after a wait
+ *
+ * @ring:      The ring
+ */
+void ivshmem_ring_end_wait(IvshmemRing *ring);
+
+#endif /* IVSHMEM_RING_H */
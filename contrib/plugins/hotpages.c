@@ -27,6 +27,11 @@ static uint64_t page_mask;
 static int limit = 50;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 static bool track_io;
+static struct qemu_plugin_mem_filter filter = {
+    .start = 0,
+    .end = UINT64_MAX,
+    .attr = QEMU_PLUGIN_MEM_ATTR_ANY,
+};
 
 enum sort_type {
     SORT_RW = 0,
@@ -115,11 +120,8 @@ static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
 
     /* We only get a hwaddr for system emulation */
     if (track_io) {
-        if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
-            page = vaddr;
-        } else {
-            return;
-        }
+        /* the filter only lets MMIO accesses through */
+        page = vaddr;
     } else {
         if (hwaddr && !qemu_plugin_hwaddr_is_io(hwaddr)) {
             page = (uint64_t) qemu_plugin_hwaddr_phys_addr(hwaddr);
@@ -155,9 +157,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 
     for (i = 0; i < n; i++) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_haddr,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, NULL);
+        qemu_plugin_register_vcpu_mem_cb_filtered(insn, vcpu_haddr,
+                                                  QEMU_PLUGIN_CB_NO_REGS,
+                                                  rw, &filter, NULL);
     }
 }
 
@@ -177,6 +179,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
             sort_by = SORT_A;
         } else if (g_strcmp0(opt, "io") == 0) {
             track_io = true;
+            filter.attr = QEMU_PLUGIN_MEM_ATTR_IO;
+        } else if (g_str_has_prefix(opt, "start=")) {
+            filter.start = g_ascii_strtoull(opt + 6, NULL, 0);
+        } else if (g_str_has_prefix(opt, "end=")) {
+            filter.end = g_ascii_strtoull(opt + 4, NULL, 0);
         } else if (g_str_has_prefix(opt, "pagesize=")) {
             page_size = g_ascii_strtoull(opt + 9, NULL, 10);
         } else {
@@ -24,6 +24,7 @@
 #include "crypto/tlscredspsk.h"
 #include "crypto/tlscredsx509.h"
 #include "qapi/error.h"
+#include "qemu/iov.h"
 #include "authz/base.h"
 #include "tlscredspriv.h"
 #include "trace.h"
@@ -33,6 +34,18 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -509,6 +522,213 @@ qcrypto_tls_session_handshake(QCryptoTLSSession *session,
 }
 
 
+#ifdef CONFIG_KTLS
+#define TLS_CONTENT_TYPE_ALERT 21
+#define TLS_CONTENT_TYPE_APPLICATION_DATA 23
+
+typedef union {
+    struct tls_crypto_info info;
+    struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+    struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+#endif
+} QCryptoTLSKTLSInfo;
+
+/*
+ * In TLS 1.2, the 4 bytes of the GCM salt are the whole IV and the
+ * explicit nonce starts from the sequence number.  In TLS 1.3 the
+ * nonce is implicit and the IV provides both.
+ */
+#define QCRYPTO_TLS_KTLS_GCM(c, tls13, ivd, keyd, seq) ({              \
+    bool ok_ = (keyd)->size == sizeof((c)->key) &&                      \
+        (ivd)->size >= sizeof((c)->salt) + ((tls13) ? sizeof((c)->iv) : 0); \
+    if (ok_) {                                                          \
+        memcpy((c)->salt, (ivd)->data, sizeof((c)->salt));              \
+        memcpy((c)->iv, (tls13) ? (ivd)->data + sizeof((c)->salt) : (seq), \
+               sizeof((c)->iv));                                        \
+        memcpy((c)->key, (keyd)->data, sizeof((c)->key));               \
+        memcpy((c)->rec_seq, (seq), sizeof((c)->rec_seq));              \
+    }                                                                   \
+    ok_;                                                                \
+})
+
+static socklen_t
+qcrypto_tls_session_get_ktls_info(QCryptoTLSSession *session,
+                                  bool read,
+                                  QCryptoTLSKTLSInfo *crypto)
+{
+    gnutls_datum_t mac_key, iv, key;
+    unsigned char seq[8];
+    bool tls13;
+
+    switch (gnutls_protocol_get_version(session->handle)) {
+    case GNUTLS_TLS1_2:
+        tls13 = false;
+        break;
+    case GNUTLS_TLS1_3:
+        tls13 = true;
+        break;
+    default:
+        return 0;
+    }
+
+    if (gnutls_record_get_state(session->handle, read,
+                                &mac_key, &iv, &key, seq) < 0) {
+        return 0;
+    }
+
+    memset(crypto, 0, sizeof(*crypto));
+    crypto->info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+
+    switch (gnutls_cipher_get(session->handle)) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        crypto->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        if (!QCRYPTO_TLS_KTLS_GCM(&crypto->aes_gcm_128, tls13,
+                                  &iv, &key, seq)) {
+            return 0;
+        }
+        return sizeof(crypto->aes_gcm_128);
+    case GNUTLS_CIPHER_AES_256_GCM:
+        crypto->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        if (!QCRYPTO_TLS_KTLS_GCM(&crypto->aes_gcm_256, tls13,
+                                  &iv, &key, seq)) {
+            return 0;
+        }
+        return sizeof(crypto->aes_gcm_256);
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case GNUTLS_CIPHER_CHACHA20_POLY1305: {
+        struct tls12_crypto_info_chacha20_poly1305 *c =
+            &crypto->chacha20_poly1305;
+
+        /* The nonce is implicit in both versions */
+        if (key.size != sizeof(c->key) || iv.size != sizeof(c->iv)) {
+            return 0;
+        }
+        crypto->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(c->iv, iv.data, sizeof(c->iv));
+        memcpy(c->key, key.data, sizeof(c->key));
+        memcpy(c->rec_seq, seq, sizeof(c->rec_seq));
+        return sizeof(*c);
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *session,
+                                int fd)
+{
+    QCryptoTLSKTLSInfo tx, rx;
+    socklen_t txlen, rxlen = 0;
+    int ret = 0;
+
+    if (!session->handshakeComplete) {
+        return 0;
+    }
+
+    txlen = qcrypto_tls_session_get_ktls_info(session, false, &tx);
+    if (!txlen) {
+        goto out;
+    }
+
+    /*
+     * The kernel cannot process post-handshake messages.  A TLS 1.3
+     * server may send session tickets after the handshake, so only
+     * the server side, which never receives such messages, takes
+     * TLS 1.3 reception over.  Data that GnuTLS has already buffered
+     * would be lost, too.
+     */
+    if ((session->creds->endpoint == QCRYPTO_TLS_CREDS_ENDPOINT_SERVER ||
+         gnutls_protocol_get_version(session->handle) == GNUTLS_TLS1_2) &&
+        gnutls_record_check_pending(session->handle) == 0) {
+        rxlen = qcrypto_tls_session_get_ktls_info(session, true, &rx);
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        goto out;
+    }
+    if (setsockopt(fd, SOL_TLS, TLS_TX, &tx, txlen) < 0) {
+        goto out;
+    }
+    ret |= QCRYPTO_TLS_KTLS_TX;
+    if (rxlen && setsockopt(fd, SOL_TLS, TLS_RX, &rx, rxlen) == 0) {
+        ret |= QCRYPTO_TLS_KTLS_RX;
+    }
+
+ out:
+    trace_qcrypto_tls_session_ktls(session, ret);
+    return ret;
+}
+
+
+ssize_t
+qcrypto_tls_session_ktls_readv(QCryptoTLSSession *session,
+                               int fd,
+                               const struct iovec *iov,
+                               size_t niov)
+{
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    struct msghdr msg = {
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = niov,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg;
+    unsigned char alert[2];
+    ssize_t ret;
+
+    do {
+        ret = recvmsg(fd, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        if (errno != EAGAIN) {
+            errno = EIO;
+        }
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_TLS ||
+        cmsg->cmsg_type != TLS_GET_RECORD_TYPE ||
+        *CMSG_DATA(cmsg) == TLS_CONTENT_TYPE_APPLICATION_DATA) {
+        return ret;
+    }
+
+    /* A close_notify alert is the only record expected besides data */
+    if (*CMSG_DATA(cmsg) == TLS_CONTENT_TYPE_ALERT &&
+        iov_to_buf(iov, niov, 0, alert, sizeof(alert)) == sizeof(alert) &&
+        ret == sizeof(alert) && alert[1] == GNUTLS_A_CLOSE_NOTIFY) {
+        return 0;
+    }
+    errno = EIO;
+    return -1;
+}
+#else /* ! CONFIG_KTLS */
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *session,
+                                int fd)
+{
+    return 0;
+}
+
+
+ssize_t
+qcrypto_tls_session_ktls_readv(QCryptoTLSSession *session,
+                               int fd,
+                               const struct iovec *iov,
+                               size_t niov)
+{
+    errno = EIO;
+    return -1;
+}
+#endif
+
+
 QCryptoTLSSessionHandshakeStatus
 qcrypto_tls_session_get_handshake_status(QCryptoTLSSession *session)
 {
@@ -618,6 +838,25 @@ qcrypto_tls_session_handshake(QCryptoTLSSession *sess,
 }
 
 
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *sess G_GNUC_UNUSED,
+                                int fd G_GNUC_UNUSED)
+{
+    return 0;
+}
+
+
+ssize_t
+qcrypto_tls_session_ktls_readv(QCryptoTLSSession *sess G_GNUC_UNUSED,
+                               int fd G_GNUC_UNUSED,
+                               const struct iovec *iov G_GNUC_UNUSED,
+                               size_t niov G_GNUC_UNUSED)
+{
+    errno = EIO;
+    return -1;
+}
+
+
 QCryptoTLSSessionHandshakeStatus
 qcrypto_tls_session_get_handshake_status(QCryptoTLSSession *sess)
 {
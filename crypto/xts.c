@@ -27,6 +27,12 @@
 #include "qemu/bswap.h"
 #include "crypto/xts.h"
 
+/*
+ * Number of blocks that are passed together to the cipher function, so
+ * that multi-block implementations can process them in parallel.
+ */
+#define XTS_BATCH_BLOCKS 32
+
 typedef union {
     uint8_t b[XTS_BLOCK_SIZE];
     uint64_t u[2];
@@ -99,6 +105,46 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/**
+ * xts_batch_encdec:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing the input text of @n * XTS_BLOCK_SIZE bytes
+ * @dst: buffer to output the output text of @n * XTS_BLOCK_SIZE bytes
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ * @n: number of blocks, at most XTS_BATCH_BLOCKS
+ *
+ * Encrypt/decrypt @n blocks with consecutive tweaks.  The tweaks only
+ * depend on each other, so they are computed ahead and the whole batch
+ * goes through a single call to @func.
+ */
+static void xts_batch_encdec(const void *ctx,
+                             xts_cipher_func *func,
+                             const uint8_t *src,
+                             uint8_t *dst,
+                             xts_uint128 *iv,
+                             unsigned long n)
+{
+    xts_uint128 tw[XTS_BATCH_BLOCKS];
+    xts_uint128 buf[XTS_BATCH_BLOCKS];
+    unsigned long i;
+
+    memcpy(buf, src, n * XTS_BLOCK_SIZE);
+    for (i = 0; i < n; i++) {
+        tw[i] = *iv;
+        xts_mult_x(iv);
+        xts_uint128_xor(&buf[i], &buf[i], &tw[i]);
+    }
+
+    func(ctx, n * XTS_BLOCK_SIZE, buf[0].b, buf[0].b);
+
+    for (i = 0; i < n; i++) {
+        xts_uint128_xor(&buf[i], &buf[i], &tw[i]);
+    }
+    memcpy(dst, buf, n * XTS_BLOCK_SIZE);
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -109,7 +155,7 @@ void xts_decrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -127,23 +173,11 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_batch_encdec(datactx, decfunc, src, dst, &T, n);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
@@ -185,7 +219,7 @@ void xts_encrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -203,24 +237,11 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_batch_encdec(datactx, encfunc, src, dst, &T, n);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
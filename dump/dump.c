@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "elf.h"
 #include "exec/hwaddr.h"
 #include "monitor/monitor.h"
@@ -41,6 +42,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -382,30 +386,50 @@ static void write_data(DumpState *s, void *buf, int length, Error **errp)
     }
 }
 
-/* write the memory to vmcore. 1 page per I/O. */
+#define DUMP_MEMORY_IO_MAX (1 * MiB)
+
+/*
+ * write the memory to vmcore.  Consecutive pages go in a single I/O of
+ * up to DUMP_MEMORY_IO_MAX bytes.  If the vmcore is a sparse-capable
+ * file, zero pages are skipped and left as holes.
+ */
 static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
                          int64_t size, Error **errp)
 {
-    int64_t i;
+    uint8_t *buf = block->host_addr + start;
+    int64_t i, len, run = 0;
     Error *local_err = NULL;
 
-    for (i = 0; i < size / s->dump_info.page_size; i++) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
-                   s->dump_info.page_size, &local_err);
-        if (local_err) {
-            error_propagate(errp, local_err);
-            return;
+    for (i = 0; i < size; i += len) {
+        bool hole;
+
+        len = MIN(s->dump_info.page_size, size - i);
+        hole = s->sparse && buffer_is_zero(buf + i, len);
+
+        /* flush the pages before i */
+        if (run && (hole || run + len > DUMP_MEMORY_IO_MAX)) {
+            write_data(s, buf + i - run, run, &local_err);
+            if (local_err) {
+                error_propagate(errp, local_err);
+                return;
+            }
+            run = 0;
         }
-    }
 
-    if ((size % s->dump_info.page_size) != 0) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
-                   size % s->dump_info.page_size, &local_err);
-        if (local_err) {
-            error_propagate(errp, local_err);
-            return;
+        if (hole) {
+            if (lseek(s->fd, len, SEEK_CUR) < 0) {
+                error_setg_errno(errp, errno, "dump: failed to save memory");
+                return;
+            }
+            s->written_size += len;
+        } else {
+            run += len;
         }
     }
+
+    if (run) {
+        write_data(s, buf + size - run, run, errp);
+    }
 }
 
 /* get the memory's offset and size in the vmcore */
@@ -673,7 +697,20 @@ static void create_vmcore(DumpState *s, Error **errp)
         return;
     }
 
-    dump_iterate(s, errp);
+    dump_iterate(s, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    /* the memory may end with a hole */
+    if (s->sparse) {
+        off_t end = lseek(s->fd, 0, SEEK_CUR);
+
+        if (end < 0 || ftruncate(s->fd, end) < 0) {
+            error_setg_errno(errp, errno, "dump: failed to save memory");
+        }
+    }
 }
 
 static int write_start_flat_header(int fd)
@@ -846,6 +883,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -958,6 +1000,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1285,6 +1332,11 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
@@ -1297,20 +1349,176 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/* Pages handed to a compression thread at a time */
+#define DUMP_COMPRESS_BATCH 256
+#define DUMP_COMPRESS_MAX_THREADS 16
+
+typedef struct DumpCompressThread {
+    QemuThread thread;
+    QemuSemaphore sem;          /* posted when a batch is ready */
+    QemuSemaphore done;         /* posted when the batch is compressed */
+    bool quit;
+    DumpState *s;
+
+    /* compressed data, len_buf_out bytes per page of the batch */
+    uint8_t *buf_out;
+    size_t len_buf_out;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+
+    unsigned num;
+    uint8_t *page[DUMP_COMPRESS_BATCH];
+    /* size of the page data, 0 for a zero page */
+    size_t size[DUMP_COMPRESS_BATCH];
+    /* DUMP_DH_COMPRESSED_*, or 0 if the page is saved in plaintext */
+    uint32_t flags[DUMP_COMPRESS_BATCH];
+} DumpCompressThread;
+
+/*
+ * Compress page @i of the thread's batch.  Only one compression format
+ * will be used here, for s->flag_compress is set.  But when compression
+ * fails to work, we fall back to save in plaintext.
+ */
+static void dump_compress_page(DumpCompressThread *t, unsigned i)
+{
+    DumpState *s = t->s;
+    size_t page_size = s->dump_info.page_size;
+    uint8_t *buf = t->page[i];
+    uint8_t *buf_out = t->buf_out + i * t->len_buf_out;
+    size_t size_out = t->len_buf_out;
+
+    if (is_zero_page(buf, page_size)) {
+        t->size[i] = 0;
+        t->flags[i] = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+            (compress2(buf_out, (uLongf *)&size_out, buf,
+                       page_size, Z_BEST_SPEED) == Z_OK) &&
+            (size_out < page_size)) {
+        t->flags[i] = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+            (lzo1x_1_compress(buf, page_size, buf_out,
+            (lzo_uint *)&size_out, t->wrkmem) == LZO_E_OK) &&
+            (size_out < page_size)) {
+        t->flags[i] = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+            (snappy_compress((char *)buf, page_size,
+            (char *)buf_out, &size_out) == SNAPPY_OK) &&
+            (size_out < page_size)) {
+        t->flags[i] = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) &&
+            !ZSTD_isError(size_out = ZSTD_compressCCtx(t->zstd, buf_out,
+                                                       t->len_buf_out, buf,
+                                                       page_size, 1)) &&
+            (size_out < page_size)) {
+        t->flags[i] = DUMP_DH_COMPRESSED_ZSTD;
+#endif
+    } else {
+        /*
+         * fall back to save in plaintext, size_out should be
+         * assigned the target's page size
+         */
+        t->flags[i] = 0;
+        size_out = page_size;
+    }
+    t->size[i] = size_out;
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressThread *t = opaque;
+    unsigned i;
+
+    while (true) {
+        qemu_sem_wait(&t->sem);
+        if (t->quit) {
+            break;
+        }
+        for (i = 0; i < t->num; i++) {
+            dump_compress_page(t, i);
+        }
+        qemu_sem_post(&t->done);
+    }
+
+    return NULL;
+}
+
+/*
+ * Write the page data and page descriptors of a compressed batch, in
+ * the order of the pages.
+ */
+static int write_dump_batch(DumpState *s, DumpCompressThread *t,
+                            DataCache *page_desc, DataCache *page_data,
+                            PageDescriptor *pd_zero, off_t *offset_data,
+                            Error **errp)
+{
+    PageDescriptor pd;
+    const uint8_t *data;
+    unsigned i;
+    int ret;
+
+    for (i = 0; i < t->num; i++) {
+        if (!t->size[i]) {
+            /* zero pages all share the first page of page section */
+            ret = write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                              false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return ret;
+            }
+            s->written_size += s->dump_info.page_size;
+            continue;
+        }
+
+        data = t->flags[i] ? t->buf_out + i * t->len_buf_out : t->page[i];
+        ret = write_cache(page_data, data, t->size[i], false);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page data");
+            return ret;
+        }
+
+        /* get and write page desc here */
+        pd.flags = cpu_to_dump32(s, t->flags[i]);
+        pd.size = cpu_to_dump32(s, t->size[i]);
+        pd.page_flags = cpu_to_dump64(s, 0);
+        pd.offset = cpu_to_dump64(s, *offset_data);
+        *offset_data += t->size[i];
+
+        ret = write_cache(page_desc, &pd, sizeof(PageDescriptor), false);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page desc");
+            return ret;
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+
+    return 0;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    DumpCompressThread *threads;
+    int nr_threads, i;
+    bool more = true;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1323,11 +1531,33 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
+    /*
+     * Compressing the pages takes much longer than writing them, so it is
+     * split across a thread per host CPU.  Each thread compresses a batch
+     * of consecutive pages, and the batches are written in order.
+     */
+    nr_threads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1),
+                     DUMP_COMPRESS_MAX_THREADS);
+    threads = g_new0(DumpCompressThread, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        DumpCompressThread *t = &threads[i];
+
+        t->s = s;
+        t->len_buf_out = len_buf_out;
+        t->buf_out = g_malloc(DUMP_COMPRESS_BATCH * len_buf_out);
 #ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+        t->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
 #endif
-
-    buf_out = g_malloc(len_buf_out);
+#ifdef CONFIG_ZSTD
+        if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+            t->zstd = ZSTD_createCCtx();
+        }
+#endif
+        qemu_sem_init(&t->sem, 0);
+        qemu_sem_init(&t->done, 0);
+        qemu_thread_create(&t->thread, "dump-compress", dump_compress_thread,
+                           t, QEMU_THREAD_JOINABLE);
+    }
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1351,97 +1581,37 @@ static void write_dump_pages(DumpState *s, Error **errp)
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (more) {
+        for (i = 0; i < nr_threads && more; i++) {
+            DumpCompressThread *t = &threads[i];
+
+            t->num = 0;
+            while (t->num < DUMP_COMPRESS_BATCH &&
+                   (more = get_next_page(&block_iter, &pfn_iter, &buf, s))) {
+                t->page[t->num++] = buf;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
+            if (t->num) {
+                qemu_sem_post(&t->sem);
             }
+        }
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+        /* wait for every started batch, even after a write error */
+        for (i = 0; i < nr_threads; i++) {
+            DumpCompressThread *t = &threads[i];
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+            if (!t->num) {
+                continue;
             }
+            qemu_sem_wait(&t->done);
+            if (ret >= 0) {
+                ret = write_dump_batch(s, t, &page_desc, &page_data,
+                                       &pd_zero, &offset_data, errp);
+            }
+            t->num = 0;
+        }
+        if (ret < 0) {
+            goto out;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1459,11 +1629,23 @@ out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
 
+    for (i = 0; i < nr_threads; i++) {
+        DumpCompressThread *t = &threads[i];
+
+        t->quit = true;
+        qemu_sem_post(&t->sem);
+        qemu_thread_join(&t->thread);
+        qemu_sem_destroy(&t->sem);
+        qemu_sem_destroy(&t->done);
 #ifdef CONFIG_LZO
-    g_free(wrkmem);
+        g_free(t->wrkmem);
 #endif
-
-    g_free(buf_out);
+#ifdef CONFIG_ZSTD
+        ZSTD_freeCCtx(t->zstd);
+#endif
+        g_free(t->buf_out);
+    }
+    g_free(threads);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1645,6 +1827,7 @@ static void dump_init(DumpState *s, int fd, bool has_format,
 {
     VMCoreInfoState *vmci = vmcoreinfo_find();
     CPUState *cpu;
+    struct stat st;
     int nr_cpus;
     Error *err = NULL;
     int ret;
@@ -1675,6 +1858,12 @@ static void dump_init(DumpState *s, int fd, bool has_format,
     }
 
     s->fd = fd;
+    /*
+     * Skipped zero pages read back as zeroes only from a regular file
+     * that is empty past the current position.
+     */
+    s->sparse = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                st.st_size <= lseek(fd, 0, SEEK_CUR);
     s->has_filter = has_filter;
     s->begin = begin;
     s->length = length;
@@ -1804,6 +1993,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -1976,6 +2169,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #ifndef TARGET_X86_64
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
         error_setg(errp, "Windows dump is only available for x86-64");
@@ -2049,6 +2249,11 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+#endif
+
     /* Windows dump is available only if target is x86_64 */
 #ifdef TARGET_X86_64
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
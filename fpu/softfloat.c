@@ -1977,11 +1977,82 @@ float128 float128_sub(float128 a, float128 b, float_status *status)
     return float128_addsub(a, b, status, true);
 }
 
+/*
+ * On x86_64 hosts, long double is the x87 extended format, laid out in
+ * memory exactly like floatx80, so additions and multiplications at
+ * full precision can use the host FPU like float32 and float64 do.
+ */
+#if defined(__x86_64__) && LDBL_MANT_DIG == 64
+#define HARD_FLOATX80 1
+typedef union {
+    floatx80 s;
+    long double h;
+} union_floatx80;
+
+static inline bool floatx80_is_zero_or_normal_hw(floatx80 a)
+{
+    int exp = a.high & 0x7fff;
+
+    if (exp == 0) {
+        return a.low == 0;
+    }
+    return exp != 0x7fff && (a.low >> 63);
+}
+
+typedef long double (*hard_fx80_op)(long double, long double);
+
+static long double hard_fx80_add(long double a, long double b)
+{
+    return a + b;
+}
+
+static long double hard_fx80_sub(long double a, long double b)
+{
+    return a - b;
+}
+
+static long double hard_fx80_mul(long double a, long double b)
+{
+    return a * b;
+}
+
+static bool floatx80_hard_op(floatx80 a, floatx80 b, floatx80 *r,
+                             hard_fx80_op op, float_status *s)
+{
+    union_floatx80 ua = { .s = a }, ub = { .s = b }, ur;
+
+    if (QEMU_NO_HARDFLOAT || !can_use_fpu(s) ||
+        s->floatx80_rounding_precision != floatx80_precision_x ||
+        !floatx80_is_zero_or_normal_hw(a) ||
+        !floatx80_is_zero_or_normal_hw(b)) {
+        return false;
+    }
+    ur.h = op(ua.h, ub.h);
+    /* Leave zero, tiny and overflowing results to the soft version */
+    if (!(fabsl(ur.h) > LDBL_MIN && fabsl(ur.h) <= LDBL_MAX)) {
+        return false;
+    }
+    *r = (floatx80) { .low = ur.s.low, .high = ur.s.high };
+    return true;
+}
+#else
+#define HARD_FLOATX80 0
+#endif
+
 static floatx80 QEMU_FLATTEN
 floatx80_addsub(floatx80 a, floatx80 b, float_status *status, bool subtract)
 {
     FloatParts128 pa, pb, *pr;
 
+#if HARD_FLOATX80
+    floatx80 r;
+
+    if (floatx80_hard_op(a, b, &r, subtract ? hard_fx80_sub : hard_fx80_add,
+                         status)) {
+        return r;
+    }
+#endif
+
     if (!floatx80_unpack_canonical(&pa, a, status) ||
         !floatx80_unpack_canonical(&pb, b, status)) {
         return floatx80_default_nan(status);
@@ -2093,6 +2164,14 @@ floatx80_mul(floatx80 a, floatx80 b, float_status *status)
 {
     FloatParts128 pa, pb, *pr;
 
+#if HARD_FLOATX80
+    floatx80 r;
+
+    if (floatx80_hard_op(a, b, &r, hard_fx80_mul, status)) {
+        return r;
+    }
+#endif
+
     if (!floatx80_unpack_canonical(&pa, a, status) ||
         !floatx80_unpack_canonical(&pb, b, status)) {
         return floatx80_default_nan(status);
@@ -2693,7 +2772,8 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(&p, s, fmt);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2702,6 +2782,30 @@ float32 float64_to_float32(float64 a, float_status *s)
     return float32_round_pack_canonical(&p, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    if (likely(!QEMU_NO_HARDFLOAT && float64_is_normal(a))) {
+        union_float64 ud;
+        union_float32 uf;
+
+        ud.s = a;
+        uf.h = ud.h;
+        /*
+         * Overflowing and tiny results need the flags computed by the
+         * soft version.  Exact results raise nothing; inexact ones only
+         * if the inexact flag is already set and the host rounding mode
+         * matches.
+         */
+        if (likely(fabsf(uf.h) > FLT_MIN && fabsf(uf.h) <= FLT_MAX) &&
+            (uf.h == ud.h || can_use_fpu(s))) {
+            return uf.s;
+        }
+    } else if (float64_is_zero(a)) {
+        return float32_set_sign(float32_zero, float64_is_neg(a));
+    }
+    return soft_float64_to_float32(a, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
@@ -2956,10 +3060,59 @@ int16_t float32_to_int16_scalbn(float32 a, FloatRoundMode rmode, int scale,
     return parts_float_to_sint(&p, rmode, scale, INT16_MIN, INT16_MAX, s);
 }
 
+/*
+ * Convert @x to an integer in [@min, @max] with the host FPU.  Only
+ * truncation and round-to-nearest-even (the host's rounding mode) are
+ * handled, for values that are in range; the only flag that the
+ * conversion may then raise is inexact.
+ *
+ * The callers check that the input is zero or normal, so that denormal
+ * inputs are still flushed by the soft version.
+ */
+static inline bool hard_float_to_sint(double x, FloatRoundMode rmode,
+                                      int scale, int64_t min, int64_t max,
+                                      int64_t *r, float_status *s)
+{
+    double d;
+
+    if (QEMU_NO_HARDFLOAT || scale != 0) {
+        return false;
+    }
+    switch (rmode) {
+    case float_round_nearest_even:
+        d = rint(x);
+        break;
+    case float_round_to_zero:
+        d = trunc(x);
+        break;
+    default:
+        return false;
+    }
+    /* (double)INT64_MAX rounds up to 2^63, so compare against max + 1 */
+    if (!(d >= (double)min && d < (double)max + 1.0)) {
+        return false;
+    }
+    if (d != x) {
+        float_raise(float_flag_inexact, s);
+    }
+    *r = d;
+    return true;
+}
+
 int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    int64_t r;
+
+    if (float32_is_zero_or_normal(a)) {
+        union_float32 ua = { .s = a };
+
+        if (hard_float_to_sint(ua.h, rmode, scale, INT32_MIN, INT32_MAX,
+                               &r, s)) {
+            return r;
+        }
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -2969,6 +3122,16 @@ int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    int64_t r;
+
+    if (float32_is_zero_or_normal(a)) {
+        union_float32 ua = { .s = a };
+
+        if (hard_float_to_sint(ua.h, rmode, scale, INT64_MIN, INT64_MAX,
+                               &r, s)) {
+            return r;
+        }
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -2987,6 +3150,16 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    int64_t r;
+
+    if (float64_is_zero_or_normal(a)) {
+        union_float64 ua = { .s = a };
+
+        if (hard_float_to_sint(ua.h, rmode, scale, INT32_MIN, INT32_MAX,
+                               &r, s)) {
+            return r;
+        }
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -2996,6 +3169,16 @@ int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    int64_t r;
+
+    if (float64_is_zero_or_normal(a)) {
+        union_float64 ua = { .s = a };
+
+        if (hard_float_to_sint(ua.h, rmode, scale, INT64_MIN, INT64_MAX,
+                               &r, s)) {
+            return r;
+        }
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
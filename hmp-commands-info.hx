@@ -322,6 +322,31 @@ SRST
     When different objects that share the same call site are coalesced,
     the "Object" field shows---enclosed in brackets---the number of objects
     being coalesced.
+
+    Mutexes, recursive mutexes, condition variables, coroutine mutexes and
+    rwlocks, and ``QemuLockCnt`` objects are profiled. The QMP command
+    ``query-sync-profile`` also returns a histogram of the wait times of
+    each call site.
+ERST
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the guest PCs with the most samples of the "
+                      "translated code profiler, up to max entries "
+                      "(default: 20)",
+        .cmd        = hmp_info_tb_profile,
+    },
+#endif
+
+SRST
+  ``info tb-profile`` [*max*]
+    Show the guest PCs with the most samples of the translated code profiler
+    (see ``tb-profile``), up to *max* entries (default: 20). Each sample
+    stands for a millisecond of host time spent by a vCPU in the translation
+    block that starts at the guest PC.
 ERST
 
     {
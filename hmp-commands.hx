@@ -609,17 +609,44 @@ SRST
 ERST
     {
         .name       = "sync-profile",
-        .args_type  = "op:s?",
-        .params     = "[on|off|reset]",
+        .args_type  = "op:s?,period:i?",
+        .params     = "[on|off|reset] [period]",
         .help       = "enable, disable or reset synchronization profiling. "
-                      "With no arguments, prints whether profiling is on or off.",
+                      "If period is given, only time one in period lock "
+                      "operations. With no arguments, prints whether "
+                      "profiling is on or off.",
         .cmd        = hmp_sync_profile,
     },
 
 SRST
-``sync-profile [on|off|reset]``
+``sync-profile [on|off|reset]`` [*period*]
   Enable, disable or reset synchronization profiling. With no arguments, prints
   whether profiling is on or off.
+
+  If *period* is given, each thread only times one in *period* lock
+  operations, and scales the counts and wait times it records accordingly.
+  This lowers the overhead of profiling busy locks. A period of 1 times
+  every operation.
+ERST
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "op:s?",
+        .params     = "[on|off|reset]",
+        .help       = "enable, disable or reset sampling of the executed "
+                      "translation blocks. With no arguments, prints whether "
+                      "profiling is on or off.",
+        .cmd        = hmp_tb_profile,
+    },
+#endif
+
+SRST
+``tb-profile [on|off|reset]``
+  Enable, disable or reset the sampling profiler for translated code. While
+  it is on, each running vCPU records once per millisecond the guest PC of
+  the translation block it is executing. With no arguments, prints whether
+  profiling is on or off.
 ERST
 
     {
@@ -1055,14 +1082,15 @@ ERST
 
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:-p,detach:-d,windmp:-w,zlib:-z,lzo:-l,snappy:-s,filename:F,begin:l?,length:l?",
-        .params     = "[-p] [-d] [-z|-l|-s|-w] filename [begin length]",
+        .args_type  = "paging:-p,detach:-d,windmp:-w,zlib:-z,lzo:-l,snappy:-s,zstd:-Z,filename:F,begin:l?,length:l?",
+        .params     = "[-p] [-d] [-z|-l|-s|-Z|-w] filename [begin length]",
         .help       = "dump guest memory into file 'filename'.\n\t\t\t"
                       "-p: do paging to get guest's memory mapping.\n\t\t\t"
                       "-d: return immediately (do not wait for completion).\n\t\t\t"
                       "-z: dump in kdump-compressed format, with zlib compression.\n\t\t\t"
                       "-l: dump in kdump-compressed format, with lzo compression.\n\t\t\t"
                       "-s: dump in kdump-compressed format, with snappy compression.\n\t\t\t"
+                      "-Z: dump in kdump-compressed format, with zstd compression.\n\t\t\t"
                       "-w: dump in Windows crashdump format (can be used instead of ELF-dump converting),\n\t\t\t"
                       "    for Windows x64 guests with vmcoreinfo driver only.\n\t\t\t"
                       "begin: the starting physical address.\n\t\t\t"
@@ -1073,9 +1101,9 @@ ERST
 SRST
 ``dump-guest-memory [-p]`` *filename* *begin* *length*
   \ 
-``dump-guest-memory [-z|-l|-s|-w]`` *filename*
+``dump-guest-memory [-z|-l|-s|-Z|-w]`` *filename*
   Dump guest memory to *protocol*. The file can be processed with crash or
-  gdb. Without ``-z|-l|-s|-w``, the dump format is ELF.
+  gdb. Without ``-z|-l|-s|-Z|-w``, the dump format is ELF.
 
   ``-p``
     do paging to get guest's memory mapping.
@@ -1085,6 +1113,8 @@ SRST
     dump in kdump-compressed format, with lzo compression.
   ``-s``
     dump in kdump-compressed format, with snappy compression.
+  ``-Z``
+    dump in kdump-compressed format, with zstd compression.
   ``-w``
     dump in Windows crashdump format (can be used instead of ELF-dump converting),
     for Windows x64 guests with vmcoreinfo driver only
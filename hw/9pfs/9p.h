@@ -201,6 +201,13 @@ typedef struct V9fsDir {
     CoMutex readdir_mutex_u;
     /* readdir mutex type used for 9P2000.L protocol variant */
     QemuMutex readdir_mutex_L;
+    /*
+     * 9P2000.L only, protected by readdir_mutex_L: directory entries read
+     * ahead of the client, the first one being at directory position
+     * cache_pos
+     */
+    struct V9fsDirEnt *cache;
+    off_t cache_pos;
 } V9fsDir;
 
 static inline void v9fs_readdir_lock(V9fsDir *dir)
@@ -456,6 +463,8 @@ void v9fs_path_free(V9fsPath *path);
 void v9fs_path_sprintf(V9fsPath *path, const char *fmt, ...);
 void v9fs_path_copy(V9fsPath *dst, const V9fsPath *src);
 size_t v9fs_readdir_response_size(V9fsString *name);
+void v9fs_free_dirents(struct V9fsDirEnt *e);
+void v9fs_readdir_cache_drop(V9fsDir *dir);
 int v9fs_name_to_path(V9fsState *s, V9fsPath *dirpath,
                       const char *name, V9fsPath *path);
 int v9fs_device_realize_common(V9fsState *s, const V9fsTransport *t,
@@ -62,6 +62,100 @@ int coroutine_fn v9fs_co_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
     return err;
 }
 
+static int32_t readdir_entry_size(struct dirent *dent)
+{
+    V9fsString name;
+    int32_t len;
+
+    v9fs_string_init(&name);
+    v9fs_string_sprintf(&name, "%s", dent->d_name);
+    len = v9fs_readdir_response_size(&name);
+    v9fs_string_free(&name);
+    return len;
+}
+
+void v9fs_readdir_cache_drop(V9fsDir *dir)
+{
+    v9fs_free_dirents(dir->cache);
+    dir->cache = NULL;
+}
+
+/*
+ * Directory entries following a full reply are read ahead into the fid's
+ * cache, up to another @maxsize bytes worth of them, so that the client's
+ * next T_readdir is answered from memory by the main IO thread.  The fs
+ * driver gets them from the same getdents64 buffer anyway.
+ *
+ * Like libc's own readdir buffer, the cache may miss changes made to the
+ * directory after it was filled.  A T_readdir from offset 0 always goes to
+ * the fs driver.
+ *
+ * Called with readdir_mutex_L held, on a background IO thread.
+ */
+static void do_readdir_prefetch(V9fsPDU *pdu, V9fsFidState *fidp,
+                                struct dirent *dent, off_t pos,
+                                int32_t maxsize)
+{
+    V9fsDir *dir = &fidp->fs.dir;
+    struct V9fsDirEnt *e = NULL;
+    int32_t size = 0;
+
+    dir->cache_pos = pos;
+    while (dent && size < maxsize) {
+        if (!e) {
+            dir->cache = e = g_malloc0(sizeof(V9fsDirEnt));
+        } else {
+            e = e->next = g_malloc0(sizeof(V9fsDirEnt));
+        }
+        e->dent = g_malloc0(sizeof(struct dirent));
+        memcpy(e->dent, dent, sizeof(struct dirent));
+        size += readdir_entry_size(dent);
+
+        if (v9fs_request_cancelled(pdu) || do_readdir(pdu, fidp, &dent)) {
+            break;
+        }
+    }
+}
+
+/*
+ * Takes as many entries from the fid's read ahead cache as fit into
+ * @maxsize, if the cache continues at @offset.  Runs on the main IO thread,
+ * which must not wait for a background IO thread holding the lock.
+ *
+ * Returns the response message body size of the entries taken, 0 if the
+ * request has to go to the fs driver.
+ */
+static int32_t readdir_cache_take(V9fsFidState *fidp,
+                                  struct V9fsDirEnt **entries,
+                                  off_t offset, int32_t maxsize)
+{
+    V9fsDir *dir = &fidp->fs.dir;
+    struct V9fsDirEnt *e, **tail = entries;
+    int32_t size = 0, len;
+
+    *entries = NULL;
+    if (dir->proto_version != V9FS_PROTO_2000L ||
+        qemu_mutex_trylock(&dir->readdir_mutex_L)) {
+        return 0;
+    }
+    if (offset != 0 && dir->cache_pos == offset) {
+        while ((e = dir->cache)) {
+            len = readdir_entry_size(e->dent);
+            if (size + len > maxsize) {
+                break;
+            }
+            dir->cache = e->next;
+            dir->cache_pos = e->dent->d_off;
+            e->next = NULL;
+            *tail = e;
+            tail = &e->next;
+            size += len;
+        }
+    }
+    qemu_mutex_unlock(&dir->readdir_mutex_L);
+    return size;
+}
+
 /*
  * This is solely executed on a background IO thread.
  *
@@ -72,7 +166,6 @@ static int do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
                            int32_t maxsize, bool dostat)
 {
     V9fsState *s = pdu->s;
-    V9fsString name;
     int len, err = 0;
     int32_t size = 0;
     off_t saved_dir_pos;
@@ -94,6 +187,7 @@ static int do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
      * issue here.
      */
     v9fs_readdir_lock(&fidp->fs.dir);
+    v9fs_readdir_cache_drop(&fidp->fs.dir);
 
     /* seek directory to requested initial position */
     if (offset == 0) {
@@ -128,10 +222,7 @@ static int do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
          * because anything beyond that size would need to be discarded by
          * 9p controller (main thread / top half) anyway
          */
-        v9fs_string_init(&name);
-        v9fs_string_sprintf(&name, "%s", dent->d_name);
-        len = v9fs_readdir_response_size(&name);
-        v9fs_string_free(&name);
+        len = readdir_entry_size(dent);
         if (size + len > maxsize) {
             /* this is not an error case actually */
             break;
@@ -170,6 +261,12 @@ static int do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
         saved_dir_pos = dent->d_off;
     }
 
+    /* the reply is full, read the next entries ahead of the client */
+    if (!err && dent && !dostat &&
+        fidp->fs.dir.proto_version == V9FS_PROTO_2000L) {
+        do_readdir_prefetch(pdu, fidp, dent, saved_dir_pos, maxsize);
+    }
+
     /* restore (last) saved position */
     s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
 
@@ -196,7 +293,9 @@ out:
  * request latency is added, which in practice could lead to overall
  * latencies of several hundred ms for reading all entries (of just a single
  * directory) if every directory entry was individually requested from fs
- * driver.
+ * driver. For the same reason, entries following a full reply are read
+ * ahead and the next request continuing from there is answered without a
+ * background IO thread (unless @p dostat is set).
  *
  * @note You must @b ALWAYS call @c v9fs_free_dirents(entries) after calling
  * v9fs_co_readdir_many(), both on success and on error cases of this
@@ -223,6 +322,12 @@ int coroutine_fn v9fs_co_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
+    if (!dostat) {
+        err = readdir_cache_take(fidp, entries, offset, maxsize);
+        if (err > 0) {
+            return err;
+        }
+    }
     v9fs_co_run_in_worker({
         err = do_readdir_many(pdu, fidp, entries, offset, maxsize, dostat);
     });
@@ -43,6 +43,15 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * IOThreads named by iothread-vq-mapping and the AioContext that
+     * handles each virtqueue's host notifier.  The BlockBackend stays in
+     * @ctx; virtqueue handlers running elsewhere take its AioContext lock.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -63,8 +72,11 @@ static void notify_guest_bh(void *opaque)
     unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
+    /* Virtqueue handlers in other IOThreads set bits under this lock */
+    aio_context_acquire(s->ctx);
     memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
     memset(s->batch_notify_vqs, 0, sizeof(bitmap));
+    aio_context_release(s->ctx);
 
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
         unsigned long bits = bitmap[j / BITS_PER_LONG];
@@ -80,6 +92,57 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+/*
+ * Assign the virtqueues round-robin to the IOThreads listed, separated by
+ * colons, in the iothread-vq-mapping property.  Without the property all
+ * virtqueues are handled in the device's AioContext.
+ *
+ * Context: QEMU global mutex held
+ */
+static bool virtio_blk_data_plane_map_vqs(VirtIOBlockDataPlane *s,
+                                          Error **errp)
+{
+    unsigned nvqs = s->conf->num_queues;
+    g_auto(GStrv) ids = NULL;
+    unsigned i;
+
+    s->vq_aio_context = g_new(AioContext *, nvqs);
+    if (!s->conf->iothread_vq_mapping) {
+        for (i = 0; i < nvqs; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
+        return true;
+    }
+
+    ids = g_strsplit(s->conf->iothread_vq_mapping, ":", -1);
+    if (!ids[0]) {
+        error_setg(errp, "iothread-vq-mapping must name at least one "
+                   "iothread");
+        return false;
+    }
+
+    s->vq_iothreads = g_new0(IOThread *, g_strv_length(ids));
+    for (i = 0; ids[i]; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "iothread-vq-mapping: iothread '%s' not found",
+                       ids[i]);
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        s->vq_iothreads[s->num_vq_iothreads++] = iothread;
+    }
+
+    for (i = 0; i < nvqs; i++) {
+        unsigned j = i % s->num_vq_iothreads;
+
+        s->vq_aio_context[i] = iothread_get_aio_context(s->vq_iothreads[j]);
+        trace_virtio_blk_data_plane_map_vq(s, i, ids[j]);
+    }
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -130,6 +193,11 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
+    if (!virtio_blk_data_plane_map_vqs(s, errp)) {
+        virtio_blk_data_plane_destroy(s);
+        return false;
+    }
+
     *dataplane = s;
 
     return true;
@@ -139,6 +207,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -146,6 +215,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_aio_context);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
     if (s->iothread) {
@@ -246,14 +320,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -282,19 +357,23 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/* Stop notifications for new requests from guest on the virtqueues
+ * handled by the current AioContext.
  *
  * Context: BH in IOThread
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vq_aio_context[i] == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
+        }
     }
 }
 
@@ -321,6 +400,17 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    /* Detach the virtqueues that are handled outside the device's context */
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->vq_iothreads[i]);
+
+        if (ctx != s->ctx) {
+            aio_context_acquire(ctx);
+            aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+            aio_context_release(ctx);
+        }
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
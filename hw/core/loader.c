@@ -60,6 +60,7 @@
 #include "hw/boards.h"
 #include "qemu/cutils.h"
 #include "sysemu/runstate.h"
+#include "qemu/timeline.h"
 
 #include <zlib.h>
 
@@ -944,7 +945,7 @@ int rom_add_file(const char *file, const char *fw_dir,
 {
     MachineClass *mc = MACHINE_GET_CLASS(qdev_get_machine());
     Rom *rom;
-    int rc, fd = -1;
+    GError *gerr = NULL;
     char devpath[100];
 
     if (as && mr) {
@@ -962,10 +963,16 @@ int rom_add_file(const char *file, const char *fw_dir,
         rom->path = g_strdup(file);
     }
 
-    fd = open(rom->path, O_RDONLY | O_BINARY);
-    if (fd == -1) {
+    /*
+     * Map the file instead of reading it: pages are only read when the
+     * ROM is copied to the guest, and a private writable mapping still
+     * lets boards patch rom->data through rom_ptr().
+     */
+    rom->mapped_file = g_mapped_file_new(rom->path, TRUE, &gerr);
+    if (!rom->mapped_file) {
         fprintf(stderr, "Could not open option rom '%s': %s\n",
-                rom->path, strerror(errno));
+                rom->path, gerr->message);
+        g_error_free(gerr);
         goto err;
     }
 
@@ -974,23 +981,9 @@ int rom_add_file(const char *file, const char *fw_dir,
         rom->fw_file = g_strdup(file);
     }
     rom->addr     = addr;
-    rom->romsize  = lseek(fd, 0, SEEK_END);
-    if (rom->romsize == -1) {
-        fprintf(stderr, "rom: file %-20s: get size error: %s\n",
-                rom->name, strerror(errno));
-        goto err;
-    }
-
+    rom->romsize  = g_mapped_file_get_length(rom->mapped_file);
     rom->datasize = rom->romsize;
-    rom->data     = g_malloc0(rom->datasize);
-    lseek(fd, 0, SEEK_SET);
-    rc = read(fd, rom->data, rom->datasize);
-    if (rc != rom->datasize) {
-        fprintf(stderr, "rom: file %-20s: read error: rc=%d (expected %zd)\n",
-                rom->name, rc, rom->datasize);
-        goto err;
-    }
-    close(fd);
+    rom->data     = (uint8_t *)g_mapped_file_get_contents(rom->mapped_file);
     rom_insert(rom);
     if (rom->fw_file && fw_cfg) {
         const char *basename;
@@ -1027,9 +1020,6 @@ int rom_add_file(const char *file, const char *fw_dir,
     return 0;
 
 err:
-    if (fd != -1)
-        close(fd);
-
     rom_free(rom);
     return -1;
 }
@@ -1117,6 +1107,7 @@ int rom_add_option(const char *file, int32_t bootindex)
 
 static void rom_reset(void *unused)
 {
+    int64_t start_ns;
     Rom *rom;
 
     QTAILQ_FOREACH(rom, &roms, next) {
@@ -1142,6 +1133,7 @@ static void rom_reset(void *unused)
         if (rom->data == NULL) {
             continue;
         }
+        start_ns = timeline_start();
         if (rom->mr) {
             void *host = memory_region_get_ram_ptr(rom->mr);
             memcpy(host, rom->data, rom->datasize);
@@ -1149,6 +1141,7 @@ static void rom_reset(void *unused)
             address_space_write_rom(rom->as, rom->addr, MEMTXATTRS_UNSPECIFIED,
                                     rom->data, rom->datasize);
         }
+        timeline_record("firmware", rom->name, start_ns);
         if (rom->isrom) {
             /* rom needs to be written only once */
             rom_free_data(rom);
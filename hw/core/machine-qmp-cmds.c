@@ -122,6 +122,31 @@ CurrentMachineParams *qmp_query_current_machine(Error **errp)
     return params;
 }
 
+InitPhaseInfoList *qmp_query_init_phases(Error **errp)
+{
+    InitPhaseInfoList *head = NULL, **tail = &head;
+    MachineInitPhase phase;
+
+    QEMU_BUILD_BUG_ON(INIT_PHASE__MAX != PHASE_MACHINE_READY + 1);
+
+    for (phase = PHASE_NO_MACHINE; phase <= PHASE_MACHINE_READY; phase++) {
+        InitPhaseInfo *info;
+
+        if (!phase_check(phase)) {
+            break;
+        }
+        info = g_new0(InitPhaseInfo, 1);
+        info->phase = (InitPhase)phase;
+        info->start_ns = phase_timestamp(phase);
+        if (phase < PHASE_MACHINE_READY && phase_check(phase + 1)) {
+            info->has_duration_ns = true;
+            info->duration_ns = phase_timestamp(phase + 1) - info->start_ns;
+        }
+        QAPI_LIST_APPEND(tail, info);
+    }
+    return head;
+}
+
 TargetInfo *qmp_query_target(Error **errp)
 {
     TargetInfo *info = g_malloc0(sizeof(*info));
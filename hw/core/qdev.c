@@ -32,6 +32,8 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
+#include "qemu/timeline.h"
 #include "hw/hotplug.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
@@ -758,7 +760,14 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         }
 
         if (dc->realize) {
+            int64_t start_ns = timeline_start();
+            g_autofree char *name = NULL;
+
             dc->realize(dev, &local_err);
+            name = dev->id ? g_strdup_printf("%s (%s)",
+                                             object_get_typename(obj), dev->id)
+                           : g_strdup(object_get_typename(obj));
+            timeline_record("realize", name, start_ns);
             if (local_err != NULL) {
                 goto fail;
             }
@@ -1138,16 +1147,40 @@ Object *qdev_get_machine(void)
 }
 
 static MachineInitPhase machine_phase;
+static int64_t machine_phase_ns[PHASE_MACHINE_READY + 1];
+
+static const char *const machine_phase_names[PHASE_MACHINE_READY + 1] = {
+    [PHASE_NO_MACHINE] = "no-machine",
+    [PHASE_MACHINE_CREATED] = "machine-created",
+    [PHASE_ACCEL_CREATED] = "accel-created",
+    [PHASE_MACHINE_INITIALIZED] = "machine-initialized",
+    [PHASE_MACHINE_READY] = "machine-ready",
+};
 
 bool phase_check(MachineInitPhase phase)
 {
-    return machine_phase >= phase;
+    /* Pairs with the store in phase_advance(), for query-init-phases */
+    return qatomic_load_acquire(&machine_phase) >= phase;
 }
 
 void phase_advance(MachineInitPhase phase)
 {
     assert(machine_phase == phase - 1);
-    machine_phase = phase;
+    machine_phase_ns[phase] = get_clock();
+    qatomic_store_release(&machine_phase, phase);
+    timeline_record("phase", machine_phase_names[phase - 1],
+                    machine_phase_ns[phase - 1]);
+}
+
+void phase_start(void)
+{
+    assert(machine_phase == PHASE_NO_MACHINE);
+    machine_phase_ns[PHASE_NO_MACHINE] = get_clock();
+}
+
+int64_t phase_timestamp(MachineInitPhase phase)
+{
+    return machine_phase_ns[phase];
 }
 
 static const TypeInfo device_type_info = {
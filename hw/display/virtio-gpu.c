@@ -477,8 +477,7 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
 
-    if (t2d.offset || t2d.r.x || t2d.r.y ||
-        t2d.r.width != pixman_image_get_width(res->image)) {
+    if (t2d.r.x || t2d.r.width != pixman_image_get_width(res->image)) {
         void *img_data = pixman_image_get_data(res->image);
         for (h = 0; h < t2d.r.height; h++) {
             src_offset = t2d.offset + stride * h;
@@ -489,20 +488,48 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
                        + dst_offset, t2d.r.width * bpp);
         }
     } else {
-        iov_to_buf(res->iov, res->iov_cnt, 0,
-                   pixman_image_get_data(res->image),
-                   pixman_image_get_stride(res->image)
-                   * pixman_image_get_height(res->image));
+        /* full width band, the rows are contiguous on both sides */
+        dst_offset = t2d.r.y * stride;
+        iov_to_buf(res->iov, res->iov_cnt, t2d.offset,
+                   (uint8_t *)pixman_image_get_data(res->image) + dst_offset,
+                   stride * t2d.r.height);
     }
 }
 
+/*
+ * Intersect the flushed rectangle @r of a resource with the part of it
+ * shown by @scanout, in scanout coordinates.  Returns false if the
+ * scanout does not need an update.
+ */
+static bool virtio_gpu_scanout_damage(struct virtio_gpu_scanout *scanout,
+                                      struct virtio_gpu_rect *r,
+                                      struct virtio_gpu_rect *damage)
+{
+    uint64_t x1 = MAX(r->x, scanout->x);
+    uint64_t y1 = MAX(r->y, scanout->y);
+    uint64_t x2 = MIN((uint64_t)r->x + r->width,
+                      (uint64_t)scanout->x + scanout->width);
+    uint64_t y2 = MIN((uint64_t)r->y + r->height,
+                      (uint64_t)scanout->y + scanout->height);
+
+    if (x1 >= x2 || y1 >= y2) {
+        return false;
+    }
+
+    damage->x = x1 - scanout->x;
+    damage->y = y1 - scanout->y;
+    damage->width = x2 - x1;
+    damage->height = y2 - y1;
+    return true;
+}
+
 static void virtio_gpu_resource_flush(VirtIOGPU *g,
                                       struct virtio_gpu_ctrl_command *cmd)
 {
     struct virtio_gpu_simple_resource *res;
     struct virtio_gpu_resource_flush rf;
     struct virtio_gpu_scanout *scanout;
-    pixman_region16_t flush_region;
+    struct virtio_gpu_rect damage;
     int i;
 
     VIRTIO_GPU_FILL_CMD(rf);
@@ -516,18 +543,6 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         return;
     }
 
-    if (res->blob) {
-        for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
-            scanout = &g->parent_obj.scanout[i];
-            if (scanout->resource_id == res->resource_id &&
-                console_has_gl(scanout->con)) {
-                dpy_gl_update(scanout->con, 0, 0, scanout->width,
-                              scanout->height);
-                return;
-            }
-        }
-    }
-
     if (!res->blob &&
         (rf.r.x > res->width ||
         rf.r.y > res->height ||
@@ -543,34 +558,26 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         return;
     }
 
-    pixman_region_init_rect(&flush_region,
-                            rf.r.x, rf.r.y, rf.r.width, rf.r.height);
     for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
-        pixman_region16_t region, finalregion;
-        pixman_box16_t *extents;
-
         if (!(res->scanout_bitmask & (1 << i))) {
             continue;
         }
         scanout = &g->parent_obj.scanout[i];
 
-        pixman_region_init(&finalregion);
-        pixman_region_init_rect(&region, scanout->x, scanout->y,
-                                scanout->width, scanout->height);
-
-        pixman_region_intersect(&finalregion, &flush_region, &region);
-        pixman_region_translate(&finalregion, -scanout->x, -scanout->y);
-        extents = pixman_region_extents(&finalregion);
-        /* work out the area we need to update for each console */
-        dpy_gfx_update(g->parent_obj.scanout[i].con,
-                       extents->x1, extents->y1,
-                       extents->x2 - extents->x1,
-                       extents->y2 - extents->y1);
-
-        pixman_region_fini(&region);
-        pixman_region_fini(&finalregion);
+        /* only update the part of each console that was flushed */
+        if (!virtio_gpu_scanout_damage(scanout, &rf.r, &damage)) {
+            continue;
+        }
+        trace_virtio_gpu_flush_damage(i, damage.width, damage.height,
+                                      damage.x, damage.y);
+        if (res->blob && console_has_gl(scanout->con)) {
+            dpy_gl_update(scanout->con, damage.x, damage.y,
+                          damage.width, damage.height);
+        } else {
+            dpy_gfx_update(scanout->con, damage.x, damage.y,
+                           damage.width, damage.height);
+        }
     }
-    pixman_region_fini(&flush_region);
 }
 
 static void virtio_unref_resource(pixman_image_t *image, void *data)
@@ -198,10 +198,10 @@ static guint vtd_uint64_hash(gconstpointer v)
     return (guint)*(const uint64_t *)v;
 }
 
-static gboolean vtd_hash_remove_by_domain(gpointer key, gpointer value,
-                                          gpointer user_data)
+static gboolean vtd_hash_remove_pwc_by_domain(gpointer key, gpointer value,
+                                              gpointer user_data)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
+    VTDPWCEntry *entry = (VTDPWCEntry *)value;
     uint16_t domain_id = *(uint16_t *)user_data;
     return entry->domain_id == domain_id;
 }
@@ -218,11 +218,9 @@ static inline uint64_t vtd_slpt_level_page_mask(uint32_t level)
     return ~((1ULL << vtd_slpt_level_shift(level)) - 1);
 }
 
-static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
-                                        gpointer user_data)
+static bool vtd_iotlb_entry_in_page_range(VTDIOTLBEntry *entry,
+                                          VTDIOTLBPageInvInfo *info)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
     uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
     uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
     return (entry->domain_id == info->domain_id) &&
@@ -230,6 +228,20 @@ static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
              (entry->gfn == gfn_tlb));
 }
 
+/*
+ * Paging-structure entries are dropped if the table translates any
+ * address in the range, because the range may cover a removed table.
+ */
+static gboolean vtd_hash_remove_pwc_by_page(gpointer key, gpointer value,
+                                            gpointer user_data)
+{
+    VTDPWCEntry *entry = (VTDPWCEntry *)value;
+    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
+    uint64_t mask = (info->mask << VTD_PAGE_SHIFT_4K) & entry->mask;
+    return (entry->domain_id == info->domain_id) &&
+            ((info->addr & mask) == (entry->iova & mask));
+}
+
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
  * IntelIOMMUState to 1.  Must be called with IOMMU lock held.
  */
@@ -261,6 +273,16 @@ static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
     g_hash_table_remove_all(s->iotlb);
+    QTAILQ_INIT(&s->iotlb_lru);
+    g_hash_table_remove_all(s->pwc);
+}
+
+/* Must be called with IOMMU lock held. */
+static void vtd_remove_iotlb_locked(IntelIOMMUState *s, VTDIOTLBEntry *entry)
+{
+    QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+    /* This frees the entry */
+    g_hash_table_remove(s->iotlb, &entry->key);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -308,6 +330,10 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
     }
 
 out:
+    if (entry && entry != QTAILQ_LAST(&s->iotlb_lru)) {
+        QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+        QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+    }
     return entry;
 }
 
@@ -317,13 +343,19 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint8_t access_flags, uint32_t level)
 {
     VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    uint64_t *key = g_malloc(sizeof(*key));
+    VTDIOTLBEntry *old;
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
 
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
-    if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
-        trace_vtd_iotlb_reset("iotlb exceeds size limit");
-        vtd_reset_iotlb_locked(s);
+
+    entry->key = vtd_get_iotlb_key(gfn, source_id, level);
+    old = g_hash_table_lookup(s->iotlb, &entry->key);
+    if (old) {
+        vtd_remove_iotlb_locked(s, old);
+    } else if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
+        old = QTAILQ_FIRST(&s->iotlb_lru);
+        trace_vtd_iotlb_evict(old->key, old->domain_id);
+        vtd_remove_iotlb_locked(s, old);
     }
 
     entry->gfn = gfn;
@@ -331,8 +363,68 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
     entry->slpte = slpte;
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
-    *key = vtd_get_iotlb_key(gfn, source_id, level);
-    g_hash_table_replace(s->iotlb, key, entry);
+    g_hash_table_insert(s->iotlb, &entry->key, entry);
+    QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+}
+
+/*
+ * The paging-structure cache remembers the tables that page walks went
+ * through, keyed by the IOVA range each of them translates, so that an
+ * IOTLB miss only needs to read the levels below the lowest cached table.
+ */
+static uint64_t vtd_get_pwc_key(uint64_t iova, uint16_t domain_id,
+                                uint32_t level)
+{
+    return (iova >> vtd_slpt_level_shift(level + 1)) |
+           ((uint64_t)(domain_id) << VTD_PWC_DID_SHIFT) |
+           ((uint64_t)(level) << VTD_PWC_LVL_SHIFT);
+}
+
+/* Must be called with IOMMU lock held */
+static VTDPWCEntry *vtd_lookup_pwc(IntelIOMMUState *s, uint16_t domain_id,
+                                   uint64_t iova, uint32_t top_level)
+{
+    VTDPWCEntry *entry;
+    uint64_t key;
+    uint32_t level;
+
+    for (level = VTD_SL_PT_LEVEL; level < top_level; level++) {
+        key = vtd_get_pwc_key(iova, domain_id, level);
+        entry = g_hash_table_lookup(s->pwc, &key);
+        if (entry) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Must be called with IOMMU lock held */
+static void vtd_update_pwc(IntelIOMMUState *s, uint16_t domain_id,
+                           uint64_t iova, uint64_t table, uint32_t level,
+                           bool reads, bool writes)
+{
+    VTDPWCEntry *entry;
+
+    if (g_hash_table_size(s->pwc) >= VTD_PWC_MAX_SIZE) {
+        GHashTableIter iter;
+
+        /* Entries are cheap to rebuild, evict an arbitrary one */
+        g_hash_table_iter_init(&iter, s->pwc);
+        if (g_hash_table_iter_next(&iter, NULL, NULL)) {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    entry = g_new(VTDPWCEntry, 1);
+    entry->key = vtd_get_pwc_key(iova, domain_id, level);
+    entry->domain_id = domain_id;
+    entry->mask = vtd_slpt_level_page_mask(level + 1);
+    entry->iova = iova & entry->mask;
+    entry->table = table;
+    entry->level = level;
+    entry->reads = reads;
+    entry->writes = writes;
+    g_hash_table_replace(s->pwc, &entry->key, entry);
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -1012,12 +1104,13 @@ static VTDBus *vtd_find_as_from_bus_num(IntelIOMMUState *s, uint8_t bus_num)
  * of the translation, can be used for deciding the size of large page.
  */
 static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
-                             uint64_t iova, bool is_write,
+                             uint16_t domain_id, uint64_t iova, bool is_write,
                              uint64_t *slptep, uint32_t *slpte_level,
                              bool *reads, bool *writes, uint8_t aw_bits)
 {
     dma_addr_t addr = vtd_get_iova_pgtbl_base(s, ce);
     uint32_t level = vtd_get_iova_level(s, ce);
+    VTDPWCEntry *pwc;
     uint32_t offset;
     uint64_t slpte;
     uint64_t access_right_check;
@@ -1031,6 +1124,19 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
     /* FIXME: what is the Atomics request here? */
     access_right_check = is_write ? VTD_SL_W : VTD_SL_R;
 
+    /*
+     * Start from the lowest cached table.  If the upper levels deny the
+     * access, walk from the top so that the fault is reported as usual.
+     */
+    pwc = vtd_lookup_pwc(s, domain_id, iova, level);
+    if (pwc && (is_write ? pwc->writes : pwc->reads)) {
+        trace_vtd_pwc_hit(domain_id, iova, pwc->level);
+        *reads = (*reads) && pwc->reads;
+        *writes = (*writes) && pwc->writes;
+        addr = pwc->table;
+        level = pwc->level;
+    }
+
     while (true) {
         offset = vtd_iova_level_offset(iova, level);
         slpte = vtd_get_slpte(addr, offset);
@@ -1069,6 +1175,7 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
         }
         addr = vtd_get_slpte_addr(slpte, aw_bits);
         level--;
+        vtd_update_pwc(s, domain_id, iova, addr, level, *reads, *writes);
     }
 }
 
@@ -1691,6 +1798,7 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     uint64_t slpte, page_mask;
     uint32_t level;
     uint16_t source_id = vtd_make_source_id(bus_num, devfn);
+    uint16_t domain_id;
     int ret_fr;
     bool is_fpd_set = false;
     bool reads = true;
@@ -1770,13 +1878,14 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
         return true;
     }
 
-    ret_fr = vtd_iova_to_slpte(s, &ce, addr, is_write, &slpte, &level,
-                               &reads, &writes, s->aw_bits);
+    domain_id = vtd_get_domain_id(s, &ce);
+    ret_fr = vtd_iova_to_slpte(s, &ce, domain_id, addr, is_write, &slpte,
+                               &level, &reads, &writes, s->aw_bits);
     VTD_PE_GET_FPD_ERR(ret_fr, is_fpd_set, s, source_id, addr, is_write);
 
     page_mask = vtd_slpt_level_page_mask(level);
     access_flags = IOMMU_ACCESS_FLAG(reads, writes);
-    vtd_update_iotlb(s, source_id, vtd_get_domain_id(s, &ce), addr, slpte,
+    vtd_update_iotlb(s, source_id, domain_id, addr, slpte,
                      access_flags, level);
 out:
     vtd_iommu_unlock(s);
@@ -1960,11 +2069,17 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
 {
     VTDContextEntry ce;
     VTDAddressSpace *vtd_as;
+    VTDIOTLBEntry *entry, *next;
 
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
+    QTAILQ_FOREACH_SAFE(entry, &s->iotlb_lru, lru, next) {
+        if (entry->domain_id == domain_id) {
+            vtd_remove_iotlb_locked(s, entry);
+        }
+    }
+    g_hash_table_foreach_remove(s->pwc, vtd_hash_remove_pwc_by_domain,
                                 &domain_id);
     vtd_iommu_unlock(s);
 
@@ -2023,6 +2138,7 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
                                       hwaddr addr, uint8_t am)
 {
     VTDIOTLBPageInvInfo info;
+    VTDIOTLBEntry *entry, *next;
 
     trace_vtd_inv_desc_iotlb_pages(domain_id, addr, am);
 
@@ -2031,7 +2147,12 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.addr = addr;
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    QTAILQ_FOREACH_SAFE(entry, &s->iotlb_lru, lru, next) {
+        if (vtd_iotlb_entry_in_page_range(entry, &info)) {
+            vtd_remove_iotlb_locked(s, entry);
+        }
+    }
+    g_hash_table_foreach_remove(s->pwc, vtd_hash_remove_pwc_by_page, &info);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am);
 }
@@ -3837,7 +3958,10 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     sysbus_init_mmio(SYS_BUS_DEVICE(s), &s->csrmem);
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
-                                     g_free, g_free);
+                                     NULL, g_free);
+    QTAILQ_INIT(&s->iotlb_lru);
+    s->pwc = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
+                                   NULL, g_free);
     s->vtd_as_by_busptr = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
                                               g_free, g_free);
     vtd_init(s);
@@ -118,6 +118,11 @@
 #define VTD_IOTLB_LVL_SHIFT         52
 #define VTD_IOTLB_MAX_SIZE          1024    /* Max size of the hash table */
 
+/* Paging-structure cache */
+#define VTD_PWC_DID_SHIFT           36
+#define VTD_PWC_LVL_SHIFT           52
+#define VTD_PWC_MAX_SIZE            256     /* Max size of the hash table */
+
 /* IOTLB_REG */
 #define VTD_TLB_GLOBAL_FLUSH        (1ULL << 60) /* Global invalidation */
 #define VTD_TLB_DSI_FLUSH           (2ULL << 60) /* Domain-selective */
@@ -412,7 +417,7 @@ typedef union VTDInvDesc VTDInvDesc;
 struct VTDIOTLBPageInvInfo {
     uint16_t domain_id;
     uint64_t addr;
-    uint8_t mask;
+    uint64_t mask;
 };
 typedef struct VTDIOTLBPageInvInfo VTDIOTLBPageInvInfo;
 
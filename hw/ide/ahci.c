@@ -31,6 +31,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/dma.h"
 #include "hw/ide/internal.h"
@@ -215,6 +216,9 @@ static void ahci_check_irq(AHCIState *s)
             s->control_regs.irqstatus |= (1 << i);
         }
     }
+    if (s->ccc_pending) {
+        s->control_regs.irqstatus |= 1U << s->ports;
+    }
     trace_ahci_check_irq(s, old_irq, s->control_regs.irqstatus);
     if (s->control_regs.irqstatus &&
         (s->control_regs.ghc & HOST_CTL_IRQ_EN)) {
@@ -240,6 +244,65 @@ static void ahci_trigger_irq(AHCIState *s, AHCIDevice *d,
     ahci_check_irq(s);
 }
 
+/*
+ * AHCI 1.3 section 11 ("Command Completion Coalescing")
+ * Completions on the ports selected in CCC_PORTS are counted, and the
+ * CCC interrupt (IS bit CCC_CTL.INT, right after the last port) is raised
+ * after CCC_CTL.CC completions or CCC_CTL.TV ms after the first one,
+ * whichever comes first.  Software is expected to mask the completion
+ * interrupts of these ports in PxIE.
+ */
+static void ahci_ccc_fire(AHCIState *s)
+{
+    trace_ahci_ccc_irq(s, s->ccc_count);
+
+    timer_del(s->ccc_timer);
+    s->ccc_count = 0;
+    s->ccc_pending = true;
+    ahci_check_irq(s);
+}
+
+static void ahci_ccc_timer_cb(void *opaque)
+{
+    AHCIState *s = opaque;
+
+    if (s->ccc_count) {
+        ahci_ccc_fire(s);
+    }
+}
+
+static void ahci_ccc_complete(AHCIState *s, int port)
+{
+    uint32_t ctl = s->control_regs.ccc_ctl;
+    unsigned cc = extract32(ctl, HOST_CCC_CTL_CC_SHIFT, 8);
+    unsigned tv = extract32(ctl, HOST_CCC_CTL_TV_SHIFT, 16);
+
+    if (!(ctl & HOST_CCC_CTL_EN) ||
+        !(s->control_regs.ccc_ports & (1U << port))) {
+        return;
+    }
+
+    if (!s->ccc_count++ && tv) {
+        timer_mod(s->ccc_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) + tv);
+    }
+    if (cc && s->ccc_count >= cc) {
+        ahci_ccc_fire(s);
+    }
+}
+
+static void ahci_ccc_write_ctl(AHCIState *s, uint32_t val)
+{
+    uint32_t old = s->control_regs.ccc_ctl;
+
+    s->control_regs.ccc_ctl = (val & HOST_CCC_CTL_RW_MASK) |
+                              (s->ports << HOST_CCC_CTL_INT_SHIFT);
+    if ((old ^ val) & HOST_CCC_CTL_EN) {
+        timer_del(s->ccc_timer);
+        s->ccc_count = 0;
+    }
+}
+
 static void map_page(AddressSpace *as, uint8_t **ptr, uint64_t addr,
                      uint32_t wanted)
 {
@@ -407,6 +470,12 @@ static uint64_t ahci_mem_read_32(void *opaque, hwaddr addr)
         case AHCI_HOST_REG_VERSION:
             val = s->control_regs.version;
             break;
+        case AHCI_HOST_REG_CCC_CTL:
+            val = s->control_regs.ccc_ctl;
+            break;
+        case AHCI_HOST_REG_CCC_PORTS:
+            val = s->control_regs.ccc_ports;
+            break;
         default:
             trace_ahci_mem_read_32_host_default(s, AHCIHostReg_lookup[regnum],
                                                 addr);
@@ -489,6 +558,9 @@ static void ahci_mem_write(void *opaque, hwaddr addr,
             break;
         case AHCI_HOST_REG_IRQ_STAT: /* R/WC, RO */
             s->control_regs.irqstatus &= ~val;
+            if (s->ccc && (val & (1U << s->ports))) {
+                s->ccc_pending = false;
+            }
             ahci_check_irq(s);
             break;
         case AHCI_HOST_REG_PORTS_IMPL: /* R/WO, RO */
@@ -497,6 +569,16 @@ static void ahci_mem_write(void *opaque, hwaddr addr,
         case AHCI_HOST_REG_VERSION: /* RO */
             /* FIXME report write? */
             break;
+        case AHCI_HOST_REG_CCC_CTL: /* R/W */
+            if (s->ccc) {
+                ahci_ccc_write_ctl(s, val);
+            }
+            break;
+        case AHCI_HOST_REG_CCC_PORTS: /* R/W */
+            if (s->ccc) {
+                s->control_regs.ccc_ports = val & s->control_regs.impl;
+            }
+            break;
         default:
             qemu_log_mask(LOG_UNIMP,
                           "Attempted write to unimplemented register: "
@@ -573,6 +655,14 @@ static void ahci_reg_init(AHCIState *s)
                           (AHCI_SUPPORTED_SPEED_GEN1 << AHCI_SUPPORTED_SPEED) |
                           HOST_CAP_NCQ | HOST_CAP_AHCI | HOST_CAP_64;
 
+    /* The CCC interrupt needs an IS bit beyond the last port */
+    if (s->ports >= 32) {
+        s->ccc = false;
+    }
+    if (s->ccc) {
+        s->control_regs.cap |= HOST_CAP_CCCS;
+    }
+
     s->control_regs.impl = (1 << s->ports) - 1;
 
     s->control_regs.version = AHCI_VERSION_1_0;
@@ -1010,6 +1100,7 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
     }
 
     ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs);
+    ahci_ccc_complete(ncq_tfs->drive->hba, ncq_tfs->drive->port_no);
 
     trace_ncq_finish(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
                      ncq_tfs->tag);
@@ -1502,6 +1593,7 @@ static void ahci_cmd_done(const IDEDMA *dma)
 
     /* update d2h status */
     ahci_write_fis_d2h(ad);
+    ahci_ccc_complete(ad->hba, ad->port_no);
 
     if (ad->port_regs.cmd_issue && !ad->check_bh) {
         ad->check_bh = qemu_bh_new(ahci_check_cmd_bh, ad);
@@ -1543,6 +1635,7 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
     s->as = as;
     s->ports = ports;
     s->dev = g_new0(AHCIDevice, ports);
+    s->ccc_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, ahci_ccc_timer_cb, s);
     ahci_reg_init(s);
     irqs = qemu_allocate_irqs(ahci_irq_set, s, s->ports);
     for (i = 0; i < s->ports; i++) {
@@ -1575,6 +1668,7 @@ void ahci_uninit(AHCIState *s)
         object_unparent(OBJECT(&ad->port));
     }
 
+    timer_free(s->ccc_timer);
     g_free(s->dev);
 }
 
@@ -1596,6 +1690,17 @@ void ahci_reset(AHCIState *s)
      */
     s->control_regs.ghc = HOST_CTL_AHCI_EN;
 
+    /* CC and TV reset to their maximum, software programs both anyway */
+    s->control_regs.ccc_ctl = 0;
+    if (s->ccc) {
+        s->control_regs.ccc_ctl = (0xffffff00 & HOST_CCC_CTL_RW_MASK) |
+                                  (s->ports << HOST_CCC_CTL_INT_SHIFT);
+    }
+    s->control_regs.ccc_ports = 0;
+    s->ccc_count = 0;
+    s->ccc_pending = false;
+    timer_del(s->ccc_timer);
+
     for (i = 0; i < s->ports; i++) {
         pr = &s->dev[i].port_regs;
         pr->irq_stat = 0;
@@ -1737,6 +1842,28 @@ static int ahci_state_post_load(void *opaque, int version_id)
     return 0;
 }
 
+static bool ahci_ccc_needed(void *opaque)
+{
+    AHCIState *s = opaque;
+
+    return s->control_regs.cap & HOST_CAP_CCCS;
+}
+
+static const VMStateDescription vmstate_ahci_ccc = {
+    .name = "ahci/ccc",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = ahci_ccc_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(control_regs.ccc_ctl, AHCIState),
+        VMSTATE_UINT32(control_regs.ccc_ports, AHCIState),
+        VMSTATE_UINT8(ccc_count, AHCIState),
+        VMSTATE_BOOL(ccc_pending, AHCIState),
+        VMSTATE_TIMER_PTR(ccc_timer, AHCIState),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 const VMStateDescription vmstate_ahci = {
     .name = "ahci",
     .version_id = 1,
@@ -1753,6 +1880,10 @@ const VMStateDescription vmstate_ahci = {
         VMSTATE_INT32_EQUAL(ports, AHCIState, NULL),
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (const VMStateDescription*[]) {
+        &vmstate_ahci_ccc,
+        NULL
+    }
 };
 
 static const VMStateDescription vmstate_sysbus_ahci = {
@@ -1790,6 +1921,7 @@ static void sysbus_ahci_realize(DeviceState *dev, Error **errp)
 
 static Property sysbus_ahci_properties[] = {
     DEFINE_PROP_UINT32("num-ports", SysbusAHCIState, num_ports, 1),
+    DEFINE_PROP_BOOL("ccc", SysbusAHCIState, ahci.ccc, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -63,6 +63,7 @@
 #include "qemu/osdep.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/pci.h"
+#include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 #include "qemu/module.h"
 #include "hw/isa/isa.h"
@@ -161,6 +162,11 @@ static void pci_ich9_uninit(PCIDevice *dev)
     qemu_free_irq(d->ahci.irq);
 }
 
+static Property ich_ahci_properties[] = {
+    DEFINE_PROP_BOOL("ccc", AHCIPCIState, ahci.ccc, true),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void ich_ahci_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -173,6 +179,7 @@ static void ich_ahci_class_init(ObjectClass *klass, void *data)
     k->revision = 0x02;
     k->class_id = PCI_CLASS_STORAGE_SATA;
     dc->vmsd = &vmstate_ich9_ahci;
+    device_class_set_props(dc, ich_ahci_properties);
     dc->reset = pci_ich9_reset;
     set_bit(DEVICE_CATEGORY_STORAGE, dc->categories);
 }
@@ -17,6 +17,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/bitops.h"
 #include "qemu/module.h"
 #include "hw/intc/arm_gicv3.h"
 #include "gicv3_internal.h"
@@ -129,14 +130,12 @@ static uint32_t gicr_int_pending(GICv3CPUState *cs)
     return pend;
 }
 
-/* Update the interrupt status after state in a redistributor
- * or CPU interface has changed, but don't tell the CPU i/f.
+/* Find the highest priority pending interrupt among the
+ * redistributor interrupts (SGIs and PPIs), and record it if it
+ * is better than the current one. Returns true if it was.
  */
-static void gicv3_redist_update_noirqset(GICv3CPUState *cs)
+static bool gicv3_redist_find_best(GICv3CPUState *cs)
 {
-    /* Find the highest priority pending interrupt among the
-     * redistributor interrupts (SGIs and PPIs).
-     */
     bool seenbetter = false;
     uint8_t prio;
     int i;
@@ -160,6 +159,55 @@ static void gicv3_redist_update_noirqset(GICv3CPUState *cs)
             }
         }
     }
+    return seenbetter;
+}
+
+/* Completely recalculate the highest priority pending interrupt of
+ * one CPU, but don't tell the CPU i/f. The distributor interrupts
+ * are taken from the pending status cached by the last update of
+ * each of them, so only the ones that are pending are looked at,
+ * and no other CPU is affected. This is what happens when the best
+ * interrupt of a CPU goes away, for instance when it is acknowledged.
+ */
+static void gicv3_cpu_update_noirqset(GICv3CPUState *cs)
+{
+    GICv3State *s = cs->gic;
+    int i;
+
+    cs->hppi.prio = 0xff;
+
+    for (i = GIC_INTERNAL; i < s->num_irq; i += 32) {
+        uint32_t pend = *gic_bmp_ptr32(s->pending_eligible, i);
+
+        while (pend) {
+            int irq = i + ctz32(pend);
+            uint8_t prio;
+
+            pend &= pend - 1;
+            if (s->gicd_irouter_target[irq] != cs) {
+                continue;
+            }
+            prio = s->gicd_ipriority[irq];
+            if (irqbetter(cs, irq, prio)) {
+                cs->hppi.irq = irq;
+                cs->hppi.prio = prio;
+            }
+        }
+    }
+
+    gicv3_redist_find_best(cs);
+
+    if (cs->hppi.prio != 0xff) {
+        cs->hppi.grp = gicv3_irq_group(s, cs, cs->hppi.irq);
+    }
+}
+
+/* Update the interrupt status after state in a redistributor
+ * or CPU interface has changed, but don't tell the CPU i/f.
+ */
+static void gicv3_redist_update_noirqset(GICv3CPUState *cs)
+{
+    bool seenbetter = gicv3_redist_find_best(cs);
 
     if (seenbetter) {
         cs->hppi.grp = gicv3_irq_group(cs->gic, cs, cs->hppi.irq);
@@ -172,12 +220,12 @@ static void gicv3_redist_update_noirqset(GICv3CPUState *cs)
      * best, and the previous best is outside our range (or there was no
      * previous pending interrupt at all), then that is still valid, and
      * we leave it as the best.
-     * Otherwise, we need to do a full update (because the previous best
-     * interrupt has reduced in priority and any other interrupt could
-     * now be the new best one).
+     * Otherwise, we need to recalculate this CPU's best interrupt
+     * (because the previous best interrupt has reduced in priority
+     * and any other interrupt could now be the new best one).
      */
     if (!seenbetter && cs->hppi.prio != 0xff && cs->hppi.irq < GIC_INTERNAL) {
-        gicv3_full_update_noirqset(cs->gic);
+        gicv3_cpu_update_noirqset(cs);
     }
 }
 
@@ -215,6 +263,7 @@ static void gicv3_update_noirqset(GICv3State *s, int start, int len)
         if (i == start || (i & 0x1f) == 0) {
             /* Calculate the next 32 bits worth of pending status */
             pend = gicd_int_pending(s, i & ~0x1f);
+            *gic_bmp_ptr32(s->pending_eligible, i) = pend;
         }
 
         if (!(pend & (1 << (i & 0x1f)))) {
@@ -242,9 +291,11 @@ static void gicv3_update_noirqset(GICv3State *s, int start, int len)
      * best, and the previous best is outside our range (or there was
      * no previous pending interrupt at all), then that
      * is still valid, and we leave it as the best.
-     * Otherwise, we need to do a full update (because the previous best
-     * interrupt has reduced in priority and any other interrupt could
-     * now be the new best one).
+     * Otherwise, we need to recalculate that CPU's best interrupt
+     * (because the previous best interrupt has reduced in priority
+     * and any other interrupt could now be the new best one).
+     * Either way, seenbetter is left set for the CPUs whose best
+     * interrupt may have changed.
      */
     for (i = 0; i < s->num_cpu; i++) {
         GICv3CPUState *cs = &s->cpu[i];
@@ -255,8 +306,8 @@ static void gicv3_update_noirqset(GICv3State *s, int start, int len)
 
         if (!cs->seenbetter && cs->hppi.prio != 0xff &&
             cs->hppi.irq >= start && cs->hppi.irq < start + len) {
-            gicv3_full_update_noirqset(s);
-            break;
+            gicv3_cpu_update_noirqset(cs);
+            cs->seenbetter = true;
         }
     }
 }
@@ -267,7 +318,10 @@ void gicv3_update(GICv3State *s, int start, int len)
 
     gicv3_update_noirqset(s, start, len);
     for (i = 0; i < s->num_cpu; i++) {
-        gicv3_cpuif_update(&s->cpu[i]);
+        /* The other CPUs have the same best interrupt as before */
+        if (s->cpu[i].seenbetter) {
+            gicv3_cpuif_update(&s->cpu[i]);
+        }
     }
 }
 
@@ -282,10 +336,11 @@ void gicv3_full_update_noirqset(GICv3State *s)
         s->cpu[i].hppi.prio = 0xff;
     }
 
-    /* Note that we can guarantee that these functions will not
-     * recursively call back into gicv3_full_update(), because
-     * at each point the "previous best" is always outside the
-     * range we ask them to update.
+    /* Note that these functions will not need to recalculate
+     * the best interrupt of any CPU, because at each point the
+     * "previous best" is always outside the range we ask them to
+     * update. Updating all the distributor interrupts also
+     * refreshes their cached pending status.
      */
     gicv3_update_noirqset(s, GIC_INTERNAL, s->num_irq - GIC_INTERNAL);
 
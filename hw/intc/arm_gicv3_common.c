@@ -449,6 +449,7 @@ static void arm_gicv3_common_reset(DeviceState *dev)
     memset(s->active, 0, sizeof(s->active));
     memset(s->level, 0, sizeof(s->level));
     memset(s->edge_trigger, 0, sizeof(s->edge_trigger));
+    memset(s->pending_eligible, 0, sizeof(s->pending_eligible));
     memset(s->gicd_ipriority, 0, sizeof(s->gicd_ipriority));
     memset(s->gicd_irouter, 0, sizeof(s->gicd_irouter));
     memset(s->gicd_nsacr, 0, sizeof(s->gicd_nsacr));
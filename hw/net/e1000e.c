@@ -666,6 +666,7 @@ static Property e1000e_properties[] = {
                         e1000e_prop_subsys_ven, uint16_t),
     DEFINE_PROP_SIGNED("subsys", E1000EState, subsys, 0,
                         e1000e_prop_subsys, uint16_t),
+    DEFINE_PROP_BOOL("itr-adaptive", E1000EState, core.itr_adaptive, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
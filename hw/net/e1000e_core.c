@@ -53,6 +53,13 @@
                                      second according to spec 10.2.4.2 */
 #define E1000E_MAX_TX_FRAGS (64)
 
+/* Descriptors read and written back with a single DMA access */
+#define E1000E_TX_DESC_BATCH (32)
+#define E1000E_RX_DESC_BATCH (8)
+
+/* Adaptive ITR/EITR may shorten the guest's interval down to 1/8 */
+#define E1000E_ITR_ADAPTIVE_MAX_SHIFT (3)
+
 static inline void
 e1000e_set_interrupt_cause(E1000ECore *core, uint32_t val);
 
@@ -90,8 +97,9 @@ e1000e_lower_legacy_irq(E1000ECore *core)
 static inline void
 e1000e_intrmgr_rearm_timer(E1000IntrDelayTimer *timer)
 {
-    int64_t delay_ns = (int64_t) timer->core->mac[timer->delay_reg] *
-                                 timer->delay_resolution_ns;
+    int64_t delay_ns = ((int64_t) timer->core->mac[timer->delay_reg] *
+                                  timer->delay_resolution_ns) >>
+                       timer->adaptive_shift;
 
     trace_e1000e_irq_rearm_timer(timer->delay_reg << 2, delay_ns);
 
@@ -143,6 +151,29 @@ e1000e_intrmgr_on_timer(void *opaque)
     e1000e_intrmgr_fire_delayed_interrupts(timer->core);
 }
 
+/*
+ * With adaptive throttling, an interval that expires with an interrupt
+ * pending means the queue is busy, so move back towards the interval
+ * programmed by the guest.  One that expires idle halves the next
+ * interval, for lower latency on lightly loaded queues.
+ */
+static void
+e1000e_intrmgr_adapt_throttling(E1000IntrDelayTimer *timer, bool pending)
+{
+    if (!timer->core->itr_adaptive) {
+        return;
+    }
+    if (pending) {
+        if (timer->adaptive_shift > 0) {
+            timer->adaptive_shift--;
+        }
+    } else if (timer->adaptive_shift < E1000E_ITR_ADAPTIVE_MAX_SHIFT) {
+        timer->adaptive_shift++;
+    }
+    trace_e1000e_irq_throttling_adapt(timer->delay_reg << 2,
+                                      timer->adaptive_shift);
+}
+
 static void
 e1000e_intrmgr_on_throttling_timer(void *opaque)
 {
@@ -151,11 +182,13 @@ e1000e_intrmgr_on_throttling_timer(void *opaque)
     assert(!msix_enabled(timer->core->owner));
 
     timer->running = false;
+    e1000e_intrmgr_adapt_throttling(timer, timer->core->itr_intr_pending);
 
     if (!timer->core->itr_intr_pending) {
         trace_e1000e_irq_throttling_no_pending_interrupts();
         return;
     }
+    timer->core->itr_intr_pending = false;
 
     if (msi_enabled(timer->core->owner)) {
         trace_e1000e_irq_msi_notify_postponed();
@@ -175,11 +208,14 @@ e1000e_intrmgr_on_msix_throttling_timer(void *opaque)
     assert(msix_enabled(timer->core->owner));
 
     timer->running = false;
+    e1000e_intrmgr_adapt_throttling(timer,
+                                    timer->core->eitr_intr_pending[idx]);
 
     if (!timer->core->eitr_intr_pending[idx]) {
         trace_e1000e_irq_throttling_no_pending_vec(idx);
         return;
     }
+    timer->core->eitr_intr_pending[idx] = false;
 
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
     msix_notify(timer->core->owner, idx);
@@ -423,9 +459,13 @@ e1000e_intrmgr_reset(E1000ECore *core)
     e1000e_intrmgr_stop_delay_timers(core);
 
     e1000e_intrmgr_stop_timer(&core->itr);
+    core->itr.adaptive_shift = 0;
+    core->itr_intr_pending = false;
 
     for (i = 0; i < E1000E_MSIX_VEC_NUM; i++) {
         e1000e_intrmgr_stop_timer(&core->eitr[i]);
+        core->eitr[i].adaptive_shift = 0;
+        core->eitr_intr_pending[i] = false;
     }
 }
 
@@ -767,9 +807,13 @@ e1000e_rx_wb_interrupt_cause(E1000ECore *core, int queue_idx,
     return (queue_idx == 0) ? E1000_ICR_RXQ0 : E1000_ICR_RXQ1;
 }
 
+/*
+ * Set DD in @dp if the guest asked for a status writeback.  The caller
+ * writes the descriptor back to guest memory if this returns non-zero.
+ */
 static uint32_t
-e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
-                        struct e1000_tx_desc *dp, bool *ide, int queue_idx)
+e1000e_txdesc_writeback(E1000ECore *core, struct e1000_tx_desc *dp,
+                        bool *ide, int queue_idx)
 {
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
@@ -783,8 +827,6 @@ e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
     txd_upper = le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD;
 
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(core->owner, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
     return e1000e_tx_wb_interrupt_cause(core, queue_idx);
 }
 
@@ -848,6 +890,26 @@ e1000e_ring_free_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
     return 0;
 }
 
+/*
+ * Number of descriptors of @desc_len bytes, at most @max, that the guest
+ * made available at the head of the ring without wrapping around.
+ */
+static inline uint32_t
+e1000e_ring_contig_descr_num(E1000ECore *core, const E1000E_RingInfo *r,
+                             uint32_t desc_len, uint32_t max)
+{
+    uint32_t units = desc_len / E1000_RING_DESC_LEN;
+    uint32_t avail;
+
+    if (core->mac[r->dh] < core->mac[r->dt]) {
+        avail = core->mac[r->dt] - core->mac[r->dh];
+    } else {
+        avail = core->mac[r->dlen] / E1000_RING_DESC_LEN - core->mac[r->dh];
+    }
+
+    return MAX(MIN(avail / units, max), 1);
+}
+
 static inline bool
 e1000e_ring_enabled(E1000ECore *core, const E1000E_RingInfo *r)
 {
@@ -906,7 +968,7 @@ static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc desc[E1000E_TX_DESC_BATCH];
     bool ide = false;
     const E1000E_RingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
@@ -917,17 +979,41 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
     }
 
     while (!e1000e_ring_empty(core, txi)) {
+        uint32_t i, n, wb_first = UINT32_MAX, wb_last = 0;
+
         base = e1000e_ring_head_descr(core, txi);
+        n = e1000e_ring_contig_descr_num(core, txi, sizeof(desc[0]),
+                                         E1000E_TX_DESC_BATCH);
+
+        pci_dma_read(core->owner, base, desc, n * sizeof(desc[0]));
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        for (i = 0; i < n; i++) {
+            uint32_t wb_cause;
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].buffer_addr,
+                                  desc[i].lower.data, desc[i].upper.data);
+
+            e1000e_process_tx_desc(core, txr->tx, &desc[i], txi->idx);
+            wb_cause = e1000e_txdesc_writeback(core, &desc[i], &ide,
+                                               txi->idx);
+            if (wb_cause) {
+                cause |= wb_cause;
+                wb_first = MIN(wb_first, i);
+                wb_last = i;
+            }
 
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+            e1000e_ring_advance(core, txi, 1);
+        }
 
-        e1000e_ring_advance(core, txi, 1);
+        /*
+         * Descriptors between those written back are still owned by the
+         * device and unchanged, so one write covers the whole span.
+         */
+        if (wb_first != UINT32_MAX) {
+            pci_dma_write(core->owner, base + wb_first * sizeof(desc[0]),
+                          &desc[wb_first],
+                          (wb_last - wb_first + 1) * sizeof(desc[0]));
+        }
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
@@ -1490,8 +1576,10 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
                              const E1000E_RSSInfo *rss_info)
 {
     PCIDevice *d = core->owner;
-    dma_addr_t base;
-    uint8_t desc[E1000_MAX_RX_DESC_LEN];
+    dma_addr_t base = 0;
+    uint8_t descs[E1000E_RX_DESC_BATCH * E1000_MAX_RX_DESC_LEN];
+    uint8_t *desc;
+    uint32_t batch_num = 0, batch_idx = 0;
     size_t desc_size;
     size_t desc_offset = 0;
     size_t iov_ofs = 0;
@@ -1517,15 +1605,31 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
             desc_size = core->rx_desc_buf_size;
         }
 
-        if (e1000e_ring_empty(core, rxi)) {
-            return;
-        }
+        if (batch_idx == batch_num) {
+            /* Write back the processed batch before fetching the next one */
+            if (batch_num) {
+                pci_dma_write(d, base, descs, batch_num * core->rx_desc_len);
+                batch_num = batch_idx = 0;
+            }
 
-        base = e1000e_ring_head_descr(core, rxi);
+            if (e1000e_ring_empty(core, rxi)) {
+                return;
+            }
 
-        pci_dma_read(d, base, &desc, core->rx_desc_len);
+            base = e1000e_ring_head_descr(core, rxi);
+            batch_num = e1000e_ring_contig_descr_num(core, rxi,
+                            core->rx_desc_len, E1000E_RX_DESC_BATCH);
+            batch_num = MIN(batch_num,
+                            DIV_ROUND_UP(total_size - desc_offset,
+                                         core->rx_desc_buf_size));
 
-        trace_e1000e_rx_descr(rxi->idx, base, core->rx_desc_len);
+            pci_dma_read(d, base, descs, batch_num * core->rx_desc_len);
+        }
+
+        desc = descs + batch_idx * core->rx_desc_len;
+
+        trace_e1000e_rx_descr(rxi->idx, base + batch_idx * core->rx_desc_len,
+                              core->rx_desc_len);
 
         e1000e_read_rx_descr(core, desc, &ba);
 
@@ -1599,13 +1703,17 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
 
         e1000e_write_rx_descr(core, desc, is_last ? core->rx_pkt : NULL,
                            rss_info, do_ps ? ps_hdr_len : 0, &bastate.written);
-        pci_dma_write(d, base, &desc, core->rx_desc_len);
+        batch_idx++;
 
         e1000e_ring_advance(core, rxi,
                             core->rx_desc_len / E1000_MIN_RX_DESC_LEN);
 
     } while (desc_offset < total_size);
 
+    if (batch_num) {
+        pci_dma_write(d, base, descs, batch_idx * core->rx_desc_len);
+    }
+
     e1000e_update_rx_stats(core, size, total_size);
 }
 
@@ -55,6 +55,7 @@ typedef struct E1000IntrDelayTimer_st {
     bool running;
     uint32_t delay_reg;
     uint32_t delay_resolution_ns;
+    uint32_t adaptive_shift;
     E1000ECore *core;
 } E1000IntrDelayTimer;
 
@@ -99,6 +100,7 @@ struct E1000Core {
 
     E1000IntrDelayTimer eitr[E1000E_MSIX_VEC_NUM];
     bool eitr_intr_pending[E1000E_MSIX_VEC_NUM];
+    bool itr_adaptive;
 
     VMChangeStateEntry *vmstate;
 
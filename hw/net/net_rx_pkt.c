@@ -321,15 +321,11 @@ _net_rx_rss_prepare_udp(uint8_t *rss_input,
                           &udphdr->uh_dport, sizeof(uint16_t));
 }
 
-uint32_t
-net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
-                         NetRxPktRssType type,
-                         uint8_t *key)
+static size_t
+net_rx_pkt_rss_input(struct NetRxPkt *pkt, NetRxPktRssType type,
+                     uint8_t *rss_input)
 {
-    uint8_t rss_input[36];
     size_t rss_length = 0;
-    uint32_t rss_hash = 0;
-    net_toeplitz_key key_data;
 
     switch (type) {
     case NetPktRssIpV4:
@@ -394,6 +390,20 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
         break;
     }
 
+    return rss_length;
+}
+
+uint32_t
+net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
+                         NetRxPktRssType type,
+                         uint8_t *key)
+{
+    uint8_t rss_input[NET_TOEPLITZ_MAX_INPUT];
+    size_t rss_length;
+    uint32_t rss_hash = 0;
+    net_toeplitz_key key_data;
+
+    rss_length = net_rx_pkt_rss_input(pkt, type, rss_input);
     net_toeplitz_key_init(&key_data, key);
     net_toeplitz_add(&rss_hash, rss_input, rss_length, &key_data);
 
@@ -402,6 +412,23 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
     return rss_hash;
 }
 
+uint32_t
+net_rx_pkt_calc_rss_hash_table(struct NetRxPkt *pkt,
+                               NetRxPktRssType type,
+                               const NetToeplitzTable *table)
+{
+    uint8_t rss_input[NET_TOEPLITZ_MAX_INPUT];
+    size_t rss_length;
+    uint32_t rss_hash;
+
+    rss_length = net_rx_pkt_rss_input(pkt, type, rss_input);
+    rss_hash = net_toeplitz_table_hash(table, rss_input, rss_length);
+
+    trace_net_rx_pkt_rss_hash(rss_length, rss_hash);
+
+    return rss_hash;
+}
+
 uint16_t net_rx_pkt_get_ip_id(struct NetRxPkt *pkt)
 {
     assert(pkt);
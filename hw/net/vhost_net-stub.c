@@ -101,3 +101,7 @@ int vhost_net_set_mtu(struct vhost_net *net, uint16_t mtu)
 {
     return 0;
 }
+
+void vhost_net_reset_inflight(NetClientState *nc)
+{
+}
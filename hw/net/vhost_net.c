@@ -236,6 +236,39 @@ static void vhost_net_set_vq_index(struct vhost_net *net, int vq_index)
     net->dev.vq_index = vq_index;
 }
 
+#ifdef CONFIG_VHOST_NET_USER
+/*
+ * Give the vhost-user backend a region where it tracks the descriptors
+ * it is processing.  The region belongs to the netdev and survives the
+ * connection, so a restarted backend resumes these descriptors instead
+ * of losing them, as vhost-user-blk already does.
+ */
+static int vhost_net_set_inflight(struct vhost_net *net, VirtIODevice *dev)
+{
+    struct vhost_inflight *inflight = vhost_user_get_inflight(net->nc);
+    int r;
+
+    r = vhost_dev_prepare_inflight(&net->dev, dev);
+    if (r < 0) {
+        return r;
+    }
+
+    if (!inflight->addr) {
+        /* both rings of the pair share the region layout */
+        uint16_t queue_size =
+            MAX(virtio_queue_get_num(dev, net->dev.vq_index),
+                virtio_queue_get_num(dev, net->dev.vq_index + 1));
+
+        r = vhost_dev_get_inflight(&net->dev, queue_size, inflight);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return vhost_dev_set_inflight(&net->dev, inflight);
+}
+#endif
+
 static int vhost_net_start_one(struct vhost_net *net,
                                VirtIODevice *dev)
 {
@@ -250,6 +283,15 @@ static int vhost_net_start_one(struct vhost_net *net,
         goto fail_notifiers;
     }
 
+#ifdef CONFIG_VHOST_NET_USER
+    if (net->nc->info->type == NET_CLIENT_DRIVER_VHOST_USER) {
+        r = vhost_net_set_inflight(net, dev);
+        if (r < 0) {
+            goto fail_start;
+        }
+    }
+#endif
+
     r = vhost_dev_start(&net->dev, dev);
     if (r < 0) {
         goto fail_start;
@@ -407,6 +449,16 @@ void vhost_net_stop(VirtIODevice *dev, NetClientState *ncs,
     assert(r >= 0);
 }
 
+/* The guest reset the device, descriptors in flight are gone for good */
+void vhost_net_reset_inflight(NetClientState *nc)
+{
+#ifdef CONFIG_VHOST_NET_USER
+    if (nc && nc->info->type == NET_CLIENT_DRIVER_VHOST_USER) {
+        vhost_dev_free_inflight(vhost_user_get_inflight(nc));
+    }
+#endif
+}
+
 void vhost_net_cleanup(struct vhost_net *net)
 {
     vhost_dev_cleanup(&net->dev);
@@ -562,6 +562,7 @@ static void virtio_net_reset(VirtIODevice *vdev)
         if (nc->peer) {
             qemu_flush_or_purge_queued_packets(nc->peer, true);
             assert(!virtio_net_get_subqueue(nc)->async_tx.elem);
+            vhost_net_reset_inflight(nc->peer);
         }
     }
 }
@@ -1345,6 +1346,7 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
     offset += size_get;
     size_get = temp.b;
     s = iov_to_buf(iov, iov_cnt, offset, n->rss_data.key, size_get);
+    n->rss_table_valid = false;
     if (s != size_get) {
         err_msg = "Can get key buffer";
         err_value = (uint32_t)s;
@@ -1726,7 +1728,15 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
         return n->rss_data.redirect ? n->rss_data.default_queue : -1;
     }
 
-    hash = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, n->rss_data.key);
+    if (!n->rss_table_valid) {
+        QEMU_BUILD_BUG_ON(sizeof(n->rss_data.key) < NET_TOEPLITZ_MAX_INPUT + 4);
+        if (!n->rss_table) {
+            n->rss_table = g_new(NetToeplitzTable, 1);
+        }
+        net_toeplitz_table_init(n->rss_table, n->rss_data.key);
+        n->rss_table_valid = true;
+    }
+    hash = net_rx_pkt_calc_rss_hash_table(pkt, net_hash_type, n->rss_table);
 
     if (n->rss_data.populate_hash) {
         virtio_set_packet_hash(buf, reports[net_hash_type], hash);
@@ -1852,7 +1862,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (q->rx_batch) {
+        q->rx_notify = true;
+    } else {
+        virtio_notify(vdev, q->rx_vq);
+    }
 
     return size;
 }
@@ -1901,6 +1915,46 @@ static void virtio_net_rsc_extract_unit6(VirtioNetRscChain *chain,
     unit->payload = htons(*unit->ip_plen) - unit->tcp_hdrlen;
 }
 
+/* Largest segment: the biggest virtio header and an IPv6 TCP packet */
+#define VIRTIO_NET_RSC_SEG_SIZE (sizeof(struct virtio_net_hdr_v1_hash) + \
+                                 sizeof(struct eth_header) +             \
+                                 sizeof(struct ip6_header) +             \
+                                 VIRTIO_NET_MAX_TCP_PAYLOAD)
+
+/* Number of drained segments that are kept for reuse */
+#define VIRTIO_NET_RSC_FREE_SEGS 16
+
+/*
+ * Caching a packet needs a buffer big enough for a whole coalesced
+ * segment; recycle them rather than allocating 64 KiB per packet.
+ */
+static VirtioNetRscSeg *virtio_net_rsc_seg_alloc(VirtIONet *n)
+{
+    VirtioNetRscSeg *seg = QTAILQ_FIRST(&n->rsc_free_segs);
+
+    if (seg) {
+        QTAILQ_REMOVE(&n->rsc_free_segs, seg, next);
+        n->rsc_free_len--;
+        return seg;
+    }
+
+    assert(n->guest_hdr_len <= sizeof(struct virtio_net_hdr_v1_hash));
+    seg = g_malloc(sizeof(VirtioNetRscSeg));
+    seg->buf = g_malloc(VIRTIO_NET_RSC_SEG_SIZE);
+    return seg;
+}
+
+static void virtio_net_rsc_seg_free(VirtIONet *n, VirtioNetRscSeg *seg)
+{
+    if (n->rsc_free_len < VIRTIO_NET_RSC_FREE_SEGS) {
+        QTAILQ_INSERT_HEAD(&n->rsc_free_segs, seg, next);
+        n->rsc_free_len++;
+    } else {
+        g_free(seg->buf);
+        g_free(seg);
+    }
+}
+
 static size_t virtio_net_rsc_drain_seg(VirtioNetRscChain *chain,
                                        VirtioNetRscSeg *seg)
 {
@@ -1924,18 +1978,41 @@ static size_t virtio_net_rsc_drain_seg(VirtioNetRscChain *chain,
 
     ret = virtio_net_do_receive(seg->nc, seg->buf, seg->size);
     QTAILQ_REMOVE(&chain->buffers, seg, next);
-    g_free(seg->buf);
-    g_free(seg);
+    virtio_net_rsc_seg_free(chain->n, seg);
 
     return ret;
 }
 
+/*
+ * With rsc_min_interval set, the drain timeout of a chain adapts to the
+ * flows: it doubles, up to rsc_interval, when waiting let segments
+ * coalesce, and halves, down to rsc_min_interval, when the timer only
+ * found single packets, for which waiting only added latency.
+ */
+static void virtio_net_rsc_adapt_timeout(VirtioNetRscChain *chain,
+                                         bool coalesced)
+{
+    VirtIONet *n = chain->n;
+
+    if (!n->rsc_min_timeout) {
+        return;
+    }
+    if (coalesced) {
+        chain->timeout = MIN((uint64_t)chain->timeout * 2, n->rsc_timeout);
+    } else {
+        chain->timeout = MAX(chain->timeout / 2,
+                             MIN(n->rsc_min_timeout, n->rsc_timeout));
+    }
+}
+
 static void virtio_net_rsc_purge(void *opq)
 {
     VirtioNetRscSeg *seg, *rn;
     VirtioNetRscChain *chain = (VirtioNetRscChain *)opq;
+    bool coalesced = false;
 
     QTAILQ_FOREACH_SAFE(seg, &chain->buffers, next, rn) {
+        coalesced |= seg->packets > 1;
         if (virtio_net_rsc_drain_seg(chain, seg) == 0) {
             chain->stat.purge_failed++;
             continue;
@@ -1943,9 +2020,10 @@ static void virtio_net_rsc_purge(void *opq)
     }
 
     chain->stat.timer++;
+    virtio_net_rsc_adapt_timeout(chain, coalesced);
     if (!QTAILQ_EMPTY(&chain->buffers)) {
         timer_mod(chain->drain_timer,
-              qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->n->rsc_timeout);
+              qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->timeout);
     }
 }
 
@@ -1965,19 +2043,22 @@ static void virtio_net_rsc_cleanup(VirtIONet *n)
         QTAILQ_REMOVE(&n->rsc_chains, chain, next);
         g_free(chain);
     }
+
+    QTAILQ_FOREACH_SAFE(seg, &n->rsc_free_segs, next, rn_seg) {
+        QTAILQ_REMOVE(&n->rsc_free_segs, seg, next);
+        g_free(seg->buf);
+        g_free(seg);
+    }
+    n->rsc_free_len = 0;
 }
 
 static void virtio_net_rsc_cache_buf(VirtioNetRscChain *chain,
                                      NetClientState *nc,
                                      const uint8_t *buf, size_t size)
 {
-    uint16_t hdr_len;
     VirtioNetRscSeg *seg;
 
-    hdr_len = chain->n->guest_hdr_len;
-    seg = g_malloc(sizeof(VirtioNetRscSeg));
-    seg->buf = g_malloc(hdr_len + sizeof(struct eth_header)
-        + sizeof(struct ip6_header) + VIRTIO_NET_MAX_TCP_PAYLOAD);
+    seg = virtio_net_rsc_seg_alloc(chain->n);
     memcpy(seg->buf, buf, size);
     seg->size = size;
     seg->packets = 1;
@@ -2181,7 +2262,7 @@ static size_t virtio_net_rsc_do_coalesce(VirtioNetRscChain *chain,
         chain->stat.empty_cache++;
         virtio_net_rsc_cache_buf(chain, nc, buf, size);
         timer_mod(chain->drain_timer,
-              qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->n->rsc_timeout);
+              qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->timeout);
         return size;
     }
 
@@ -2419,6 +2500,7 @@ static VirtioNetRscChain *virtio_net_rsc_lookup_chain(VirtIONet *n,
         chain->max_payload = VIRTIO_NET_MAX_IP6_PAYLOAD;
         chain->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
     }
+    chain->timeout = n->rsc_timeout;
     chain->drain_timer = timer_new_ns(QEMU_CLOCK_HOST,
                                       virtio_net_rsc_purge, chain);
     memset(&chain->stat, 0, sizeof(chain->stat));
@@ -2469,6 +2551,26 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     }
 }
 
+static bool virtio_net_begin_batch(NetClientState *nc)
+{
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    q->rx_batch = true;
+    return true;
+}
+
+static void virtio_net_end_batch(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    q->rx_batch = false;
+    if (q->rx_notify) {
+        q->rx_notify = false;
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
@@ -2480,7 +2582,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->tx_vq, q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2488,13 +2590,57 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Number of elements that virtio_net_flush_tx() pops at once */
+#define VIRTIO_NET_TX_BATCH 32
+
+/* Give back the elements of a batch that were not transmitted */
+static void virtio_net_tx_unpop(VirtQueue *vq, VirtQueueElement **elems,
+                                unsigned int first, unsigned int num)
+{
+    while (num > first) {
+        VirtQueueElement *elem = elems[--num];
+
+        virtqueue_unpop(vq, elem, 0);
+        virtqueue_element_free(vq, elem);
+    }
+}
+
+/*
+ * Complete the elements of a batch that were handed to the peer.  If the
+ * peer accepted a batch, it may still be reading their buffers, so close
+ * the batch first.
+ */
+static void virtio_net_tx_push(VirtIONetQueue *q, NetClientState *nc,
+                               bool batch, VirtQueueElement **elems,
+                               unsigned int num)
+{
+    unsigned int i;
+
+    if (batch) {
+        qemu_net_end_batch(nc);
+    }
+    for (i = 0; i < num; i++) {
+        virtqueue_push(q->tx_vq, elems[i], 0);
+        virtqueue_element_free(q->tx_vq, elems[i]);
+    }
+    if (num) {
+        virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+    unsigned int num_elems = 0, next_elem = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+    bool batch = false;
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2510,17 +2656,30 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        if (next_elem == num_elems) {
+            virtio_net_tx_push(q, nc, batch, elems, num_elems);
+            /* never pop more than the rest of the burst */
+            next_elem = 0;
+            num_elems = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                            (void **)elems,
+                                            MIN(ARRAY_SIZE(elems),
+                                                n->tx_burst - num_packets));
+            if (!num_elems) {
+                return num_packets;
+            }
+            /* the swapped header lives on the stack, it cannot be batched */
+            batch = !n->needs_vnet_hdr_swap && qemu_net_begin_batch(nc);
         }
+        elem = elems[next_elem++];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
         if (out_num < 1) {
             virtio_error(vdev, "virtio-net header not in first element");
+            virtio_net_tx_push(q, nc, batch, elems, next_elem - 1);
             virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(q->tx_vq, elem);
+            virtio_net_tx_unpop(q->tx_vq, elems, next_elem, num_elems);
             return -EINVAL;
         }
 
@@ -2528,8 +2687,10 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
+                virtio_net_tx_push(q, nc, batch, elems, next_elem - 1);
                 virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
+                virtqueue_element_free(q->tx_vq, elem);
+                virtio_net_tx_unpop(q->tx_vq, elems, next_elem, num_elems);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
@@ -2563,23 +2724,22 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        ret = qemu_sendv_packet_async(nc, out_sg, out_num,
+                                      virtio_net_tx_complete);
         if (ret == 0) {
+            virtio_net_tx_push(q, nc, batch, elems, next_elem - 1);
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_unpop(q->tx_vq, elems, next_elem, num_elems);
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_push(q, nc, batch, elems, next_elem);
     return num_packets;
 }
 
@@ -2858,6 +3018,7 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
         }
     }
 
+    n->rss_table_valid = false;
     if (n->rss_data.enabled) {
         n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
         if (!n->rss_data.populate_hash) {
@@ -3145,6 +3306,8 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .begin_batch = virtio_net_begin_batch,
+    .end_batch = virtio_net_end_batch,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3449,6 +3612,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
             (uint8_t *)&netcfg, 0, ETH_ALEN, VHOST_SET_CONFIG_TYPE_MASTER);
     }
     QTAILQ_INIT(&n->rsc_chains);
+    QTAILQ_INIT(&n->rsc_free_segs);
     n->qdev = dev;
 
     net_rx_pkt_init(&n->rx_pkt, false);
@@ -3496,6 +3660,8 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    g_free(n->rss_table);
+    n->rss_table = NULL;
     virtio_cleanup(vdev);
 }
 
@@ -3609,6 +3775,7 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_RSC_EXT, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
+    DEFINE_PROP_UINT32("rsc_min_interval", VirtIONet, rsc_min_timeout, 0),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
     DEFINE_PROP_UINT32("x-txtimer", VirtIONet, net_conf.txtimer,
                        TX_TIMER_INTERVAL),
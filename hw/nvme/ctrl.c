@@ -35,6 +35,7 @@
  *              mdts=<N[optional]>,vsl=<N[optional]>, \
  *              zoned.zasl=<N[optional]>, \
  *              zoned.auto_transition=<on|off[optional]>, \
+ *              ioeventfd=<on|off[optional]>,iothread=<iothread_id>, \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -106,6 +107,17 @@
  *   transitioned to zone state closed for resource management purposes.
  *   Defaults to 'on'.
  *
+ * - `ioeventfd`
+ *   Back the I/O queue doorbell registers with ioeventfds once the host has
+ *   configured shadow doorbells with the Doorbell Buffer Config command, so
+ *   that doorbell writes do not exit to the device model synchronously.
+ *   Defaults to 'off'.
+ *
+ * - `iothread`
+ *   Process the I/O queues of the controller, and complete their requests,
+ *   in the given IOThread instead of the main loop. The namespace block
+ *   backends are moved to the AioContext of the IOThread.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -156,9 +168,11 @@
 #include "qemu/units.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
+#include "block/aio-wait.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/hostmem.h"
+#include "sysemu/kvm.h"
 #include "hw/pci/msix.h"
 #include "migration/vmstate.h"
 
@@ -220,6 +234,7 @@ static const uint32_t nvme_cse_acs[256] = {
     [NVME_ADM_CMD_GET_FEATURES]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_ASYNC_EV_REQ]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_NS_ATTACHMENT]    = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_NIC,
+    [NVME_ADM_CMD_DBBUF_CONFIG]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_FORMAT_NVM]       = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC,
 };
 
@@ -481,6 +496,240 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/*
+ * I/O queues of a controller with an iothread are processed without the BQL,
+ * so their interrupts are raised from the main loop by nvme_cq_irq_notifier,
+ * or directly by KVM if the irq notifier is bound to an MSI route (irqfd).
+ */
+static bool nvme_queue_in_iothread(NvmeCtrl *n, uint16_t qid)
+{
+    return n->iothread && qid;
+}
+
+static void nvme_irq_sync(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    } else {
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+static void nvme_irq_update(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->irqfd_enabled) {
+        /* MSI-X interrupts are never deasserted */
+        if (cq->tail != cq->head) {
+            trace_pci_nvme_irq_msix(cq->vector);
+            event_notifier_set(&cq->irq_notifier);
+        }
+    } else if (nvme_queue_in_iothread(n, cq->cqid)) {
+        event_notifier_set(&cq->irq_notifier);
+    } else {
+        nvme_irq_sync(n, cq);
+    }
+}
+
+static void nvme_cq_irq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, irq_notifier);
+    NvmeCtrl *n = cq->ctrl;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    aio_context_acquire(n->ctx);
+    nvme_irq_sync(n, cq);
+    aio_context_release(n->ctx);
+}
+
+/*
+ * While the MSI-X vector of the queue is unmasked, the irq notifier is bound
+ * to its MSI route; while it is masked, nvme_cq_irq_notifier() goes through
+ * msix_notify(), which sets the pending bit.
+ */
+static void nvme_cq_irqfd_use(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    event_notifier_set_handler(&cq->irq_notifier, NULL);
+    if (kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, &cq->irq_notifier,
+                                           NULL, cq->virq) < 0) {
+        event_notifier_set_handler(&cq->irq_notifier, nvme_cq_irq_notifier);
+        return;
+    }
+
+    cq->irqfd_enabled = true;
+
+    /* an interrupt may have been missed while the vector was masked */
+    if (cq->tail != cq->head) {
+        event_notifier_set(&cq->irq_notifier);
+    }
+}
+
+static void nvme_cq_irqfd_release(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    int ret;
+
+    ret = kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, &cq->irq_notifier,
+                                                cq->virq);
+    assert(ret == 0);
+
+    cq->irqfd_enabled = false;
+    event_notifier_set_handler(&cq->irq_notifier, nvme_cq_irq_notifier);
+}
+
+static void nvme_init_cq_irqfd(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    PCIDevice *pci = &n->parent_obj;
+    int ret;
+
+    if (!kvm_msi_via_irqfd_enabled() || !msix_enabled(pci) ||
+        !cq->irq_enabled) {
+        return;
+    }
+
+    ret = kvm_irqchip_add_msi_route(kvm_state, cq->vector, pci);
+    if (ret < 0) {
+        return;
+    }
+
+    cq->virq = ret;
+    kvm_irqchip_commit_routes(kvm_state);
+
+    if (!msix_is_masked(pci, cq->vector)) {
+        nvme_cq_irqfd_use(n, cq);
+    }
+}
+
+static void nvme_free_cq_irqfd(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->irqfd_enabled) {
+        nvme_cq_irqfd_release(n, cq);
+    }
+    if (cq->virq >= 0) {
+        kvm_irqchip_release_virq(kvm_state, cq->virq);
+        cq->virq = -1;
+    }
+}
+
+static int nvme_msix_vector_use(PCIDevice *pci_dev, unsigned int vector,
+                                MSIMessage msg)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    NvmeCQueue *cq;
+    int i;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        cq = n->cq[i];
+        if (!cq || cq->vector != vector || cq->virq < 0) {
+            continue;
+        }
+
+        if (kvm_irqchip_update_msi_route(kvm_state, cq->virq, msg,
+                                         pci_dev) < 0) {
+            continue;
+        }
+        kvm_irqchip_commit_routes(kvm_state);
+
+        if (!cq->irqfd_enabled) {
+            nvme_cq_irqfd_use(n, cq);
+        }
+    }
+
+    return 0;
+}
+
+static void nvme_msix_vector_release(PCIDevice *pci_dev, unsigned int vector)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    NvmeCQueue *cq;
+    int i;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        cq = n->cq[i];
+        if (cq && cq->vector == vector && cq->irqfd_enabled) {
+            nvme_cq_irqfd_release(n, cq);
+        }
+    }
+}
+
+/*
+ * Shadow doorbells are only used for the I/O queues; like Linux, the host is
+ * expected to keep ringing the admin queue doorbells.
+ */
+static void nvme_update_sq_tail(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    uint32_t v;
+
+    if (!sq->db_addr || pci_dma_read(&n->parent_obj, sq->db_addr, &v,
+                                     sizeof(v))) {
+        return;
+    }
+
+    v = le32_to_cpu(v);
+    if (v < sq->size) {
+        sq->tail = v;
+    }
+}
+
+static void nvme_update_sq_eventidx(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    if (sq->ei_addr) {
+        pci_dma_write(&n->parent_obj, sq->ei_addr, &v, sizeof(v));
+    }
+}
+
+static void nvme_cq_set_head(NvmeCtrl *n, NvmeCQueue *cq, uint32_t new_head)
+{
+    int64_t now;
+    NvmeSQueue *sq;
+
+    if (new_head == cq->head) {
+        return;
+    }
+
+    if (nvme_cq_full(cq)) {
+        now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+            timer_mod(sq->timer, now + 500);
+        }
+        timer_mod(cq->timer, now + 500);
+    }
+
+    cq->head = new_head;
+    if (cq->tail == cq->head) {
+        if (cq->irq_enabled) {
+            n->cq_pending--;
+        }
+
+        nvme_irq_update(n, cq);
+    }
+}
+
+/*
+ * Pick up the head from the shadow doorbell and ask the host to ring the
+ * doorbell again as soon as it consumes any further entry.
+ */
+static void nvme_update_cq_head(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    uint32_t v;
+
+    if (!cq->db_addr || pci_dma_read(&n->parent_obj, cq->db_addr, &v,
+                                     sizeof(v))) {
+        return;
+    }
+
+    v = le32_to_cpu(v);
+    if (v < cq->size) {
+        nvme_cq_set_head(n, cq, v);
+    }
+
+    v = cpu_to_le32(cq->head);
+    pci_dma_write(&n->parent_obj, cq->ei_addr, &v, sizeof(v));
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -1255,9 +1504,14 @@ static void nvme_post_cqes(void *opaque)
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
-    bool pending = cq->head != cq->tail;
+    bool pending;
     int ret;
 
+    aio_context_acquire(n->ctx);
+
+    nvme_update_cq_head(n, cq);
+    pending = cq->head != cq->tail;
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -1289,12 +1543,16 @@ static void nvme_post_cqes(void *opaque)
             n->cq_pending++;
         }
 
-        nvme_irq_assert(n, cq);
+        nvme_irq_update(n, cq);
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
 {
+    NvmeCtrl *n = cq->ctrl;
+
     assert(cq->cqid == req->sq->cqid);
     trace_pci_nvme_enqueue_req_completion(nvme_cid(req), cq->cqid,
                                           le32_to_cpu(req->cqe.result),
@@ -1306,9 +1564,14 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
                                       req->status, req->cmd.opcode);
     }
 
+    aio_context_acquire(n->ctx);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
     timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    aio_context_release(n->ctx);
+
+    /* nvme_del_sq() may be waiting for the submission queue to go idle */
+    aio_wait_kick();
 }
 
 static void nvme_process_aers(void *opaque)
@@ -2334,7 +2597,7 @@ static uint16_t nvme_dsm(NvmeCtrl *n, NvmeRequest *req)
                                          nvme_misc_cb, req);
 
         iocb->req = req;
-        iocb->bh = qemu_bh_new(nvme_dsm_bh, iocb);
+        iocb->bh = aio_bh_new(n->ctx, nvme_dsm_bh, iocb);
         iocb->ret = 0;
         iocb->range = g_new(NvmeDsmRange, nr);
         iocb->nr = nr;
@@ -2818,7 +3081,7 @@ static uint16_t nvme_copy(NvmeCtrl *n, NvmeRequest *req)
     }
 
     iocb->req = req;
-    iocb->bh = qemu_bh_new(nvme_copy_bh, iocb);
+    iocb->bh = aio_bh_new(n->ctx, nvme_copy_bh, iocb);
     iocb->ret = 0;
     iocb->nr = nr;
     iocb->idx = 0;
@@ -3008,7 +3271,7 @@ static uint16_t nvme_flush(NvmeCtrl *n, NvmeRequest *req)
     iocb = qemu_aio_get(&nvme_flush_aiocb_info, NULL, nvme_misc_cb, req);
 
     iocb->req = req;
-    iocb->bh = qemu_bh_new(nvme_flush_bh, iocb);
+    iocb->bh = aio_bh_new(n->ctx, nvme_flush_bh, iocb);
     iocb->ret = 0;
     iocb->ns = NULL;
     iocb->nsid = 0;
@@ -3642,7 +3905,7 @@ static uint16_t nvme_zone_mgmt_send(NvmeCtrl *n, NvmeRequest *req)
                            nvme_misc_cb, req);
 
         iocb->req = req;
-        iocb->bh = qemu_bh_new(nvme_zone_reset_bh, iocb);
+        iocb->bh = aio_bh_new(n->ctx, nvme_zone_reset_bh, iocb);
         iocb->ret = 0;
         iocb->all = all;
         iocb->idx = zone_idx;
@@ -3908,9 +4171,158 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
     return NVME_INVALID_OPCODE | NVME_DNR;
 }
 
+static QEMUTimer *nvme_queue_timer_new(NvmeCtrl *n, uint16_t qid,
+                                       QEMUTimerCB *cb, void *opaque)
+{
+    if (nvme_queue_in_iothread(n, qid)) {
+        return aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS, cb,
+                             opaque);
+    }
+
+    return timer_new_ns(QEMU_CLOCK_VIRTUAL, cb, opaque);
+}
+
+static void nvme_set_queue_notifier(NvmeCtrl *n, uint16_t qid,
+                                    EventNotifier *e,
+                                    EventNotifierHandler *handler)
+{
+    if (nvme_queue_in_iothread(n, qid)) {
+        aio_set_event_notifier(n->ctx, e, true, handler, NULL);
+    } else {
+        event_notifier_set_handler(e, handler);
+    }
+}
+
+/*
+ * Run @cb in the context that processes queue @qid, so that none of its
+ * timers or notifiers can be running concurrently.
+ */
+static void nvme_queue_run(NvmeCtrl *n, uint16_t qid, QEMUBHFunc *cb,
+                           void *opaque)
+{
+    if (nvme_queue_in_iothread(n, qid)) {
+        aio_wait_bh_oneshot(n->ctx, cb, opaque);
+    } else {
+        cb(opaque);
+    }
+}
+
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    nvme_process_sq(sq);
+}
+
+static void nvme_cq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+    NvmeCtrl *n = cq->ctrl;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    aio_context_acquire(n->ctx);
+    nvme_update_cq_head(n, cq);
+    aio_context_release(n->ctx);
+}
+
+/*
+ * With ioeventfd the value written to the doorbell register is lost, so the
+ * notifiers are only enabled together with the shadow doorbells.
+ */
+static void nvme_init_sq_ioeventfd(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    uint16_t offset = sq->sqid << 3;
+
+    if (event_notifier_init(&sq->notifier, 0) < 0) {
+        trace_pci_nvme_err_ioeventfd_init(sq->sqid);
+        return;
+    }
+
+    nvme_set_queue_notifier(n, sq->sqid, &sq->notifier, nvme_sq_notifier);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              &sq->notifier);
+    sq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_cq_ioeventfd(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    uint16_t offset = (cq->cqid << 3) + (1 << 2);
+
+    if (event_notifier_init(&cq->notifier, 0) < 0) {
+        trace_pci_nvme_err_ioeventfd_init(cq->cqid);
+        return;
+    }
+
+    nvme_set_queue_notifier(n, cq->cqid, &cq->notifier, nvme_cq_notifier);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              &cq->notifier);
+    cq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_sq_dbbuf(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+
+    if (n->params.ioeventfd && !sq->ioeventfd_enabled) {
+        nvme_init_sq_ioeventfd(n, sq);
+    }
+}
+
+static void nvme_init_cq_dbbuf(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+    pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+
+    if (n->params.ioeventfd && !cq->ioeventfd_enabled) {
+        nvme_init_cq_ioeventfd(n, cq);
+    }
+}
+
+static void nvme_sq_stop_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    timer_del(sq->timer);
+    if (sq->ioeventfd_enabled) {
+        nvme_set_queue_notifier(sq->ctrl, sq->sqid, &sq->notifier, NULL);
+    }
+}
+
+static void nvme_sq_cancel_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    NvmeRequest *r, *next;
+
+    QTAILQ_FOREACH_SAFE(r, &sq->out_req_list, entry, next) {
+        if (r->aiocb) {
+            blk_aio_cancel_async(r->aiocb);
+        }
+    }
+}
+
+/* The queue must have been stopped with nvme_sq_stop_bh() */
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+        event_notifier_cleanup(&sq->notifier);
+    }
     timer_free(sq->timer);
     g_free(sq->io_req);
     if (sq->sqid) {
@@ -3934,6 +4346,14 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
+    nvme_queue_run(n, qid, nvme_sq_stop_bh, sq);
+
+    if (nvme_queue_in_iothread(n, qid)) {
+        /* blk_aio_cancel() cannot poll the AioContext of the iothread */
+        aio_wait_bh_oneshot(n->ctx, nvme_sq_cancel_bh, sq);
+        AIO_WAIT_WHILE(n->ctx, !QTAILQ_EMPTY(&sq->out_req_list));
+    }
+
     while (!QTAILQ_EMPTY(&sq->out_req_list)) {
         r = QTAILQ_FIRST(&sq->out_req_list);
         assert(r->aiocb);
@@ -3979,7 +4399,11 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    sq->timer = nvme_queue_timer_new(n, sqid, nvme_process_sq, sq);
+
+    if (sqid && n->dbbuf_enabled) {
+        nvme_init_sq_dbbuf(n, sq);
+    }
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
@@ -4276,9 +4700,31 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+static void nvme_cq_stop_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    timer_del(cq->timer);
+    if (cq->ioeventfd_enabled) {
+        nvme_set_queue_notifier(cq->ctrl, cq->cqid, &cq->notifier, NULL);
+    }
+}
+
+/* The queue must have been stopped with nvme_cq_stop_bh() */
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
+    if (cq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem,
+                                  0x1000 + (cq->cqid << 3) + (1 << 2), 4,
+                                  false, 0, &cq->notifier);
+        event_notifier_cleanup(&cq->notifier);
+    }
+    if (nvme_queue_in_iothread(n, cq->cqid)) {
+        nvme_free_cq_irqfd(n, cq);
+        event_notifier_set_handler(&cq->irq_notifier, NULL);
+        event_notifier_cleanup(&cq->irq_notifier);
+    }
     timer_free(cq->timer);
     if (msix_enabled(&n->parent_obj)) {
         msix_vector_unuse(&n->parent_obj, cq->vector);
@@ -4309,6 +4755,7 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
         n->cq_pending--;
     }
 
+    nvme_queue_run(n, qid, nvme_cq_stop_bh, cq);
     nvme_irq_deassert(n, cq);
     trace_pci_nvme_del_cq(qid);
     nvme_free_cq(cq, n);
@@ -4333,10 +4780,21 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->irq_enabled = irq_enabled;
     cq->vector = vector;
     cq->head = cq->tail = 0;
+    cq->virq = -1;
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->timer = nvme_queue_timer_new(n, cqid, nvme_post_cqes, cq);
+
+    if (nvme_queue_in_iothread(n, cqid)) {
+        event_notifier_init(&cq->irq_notifier, 0);
+        event_notifier_set_handler(&cq->irq_notifier, nvme_cq_irq_notifier);
+        nvme_init_cq_irqfd(n, cq);
+    }
+
+    if (cqid && n->dbbuf_enabled) {
+        nvme_init_cq_dbbuf(n, cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5402,7 +5860,7 @@ static uint16_t nvme_format(NvmeCtrl *n, NvmeRequest *req)
     iocb = qemu_aio_get(&nvme_format_aiocb_info, NULL, nvme_misc_cb, req);
 
     iocb->req = req;
-    iocb->bh = qemu_bh_new(nvme_format_bh, iocb);
+    iocb->bh = aio_bh_new(n->ctx, nvme_format_bh, iocb);
     iocb->ret = 0;
     iocb->ns = NULL;
     iocb->nsid = 0;
@@ -5434,6 +5892,36 @@ out:
     return status;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
+{
+    uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
+    uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
+    int i;
+
+    trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    /* both buffers are a single, page aligned, memory page */
+    if (!dbs_addr || !eis_addr || (dbs_addr & (n->page_size - 1)) ||
+        (eis_addr & (n->page_size - 1))) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n, n->sq[i]);
+        }
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n, n->cq[i]);
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 {
     trace_pci_nvme_admin_cmd(nvme_cid(req), nvme_sqid(req), req->cmd.opcode,
@@ -5474,6 +5962,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
         return nvme_ns_attachment(n, req);
     case NVME_ADM_CMD_FORMAT_NVM:
         return nvme_format(n, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, req);
     default:
         assert(false);
     }
@@ -5492,6 +5982,9 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    aio_context_acquire(n->ctx);
+
+    nvme_update_sq_tail(n, sq);
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         if (nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd))) {
@@ -5515,7 +6008,15 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (nvme_sq_empty(sq) && sq->db_addr) {
+            /* have the host ring the doorbell for the next submission */
+            nvme_update_sq_eventidx(n, sq);
+            nvme_update_sq_tail(n, sq);
+        }
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_ctrl_reset(NvmeCtrl *n)
@@ -5523,6 +6024,12 @@ static void nvme_ctrl_reset(NvmeCtrl *n)
     NvmeNamespace *ns;
     int i;
 
+    for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i] != NULL) {
+            nvme_queue_run(n, i, nvme_sq_stop_bh, n->sq[i]);
+        }
+    }
+
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -5532,6 +6039,13 @@ static void nvme_ctrl_reset(NvmeCtrl *n)
         nvme_ns_drain(ns);
     }
 
+    /* the completion queue timers may have been rearmed while draining */
+    for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->cq[i] != NULL) {
+            nvme_queue_run(n, i, nvme_cq_stop_bh, n->cq[i]);
+        }
+    }
+
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
         if (n->sq[i] != NULL) {
             nvme_free_sq(n->sq[i], n);
@@ -5543,6 +6057,10 @@ static void nvme_ctrl_reset(NvmeCtrl *n)
         }
     }
 
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+    n->dbbuf_enabled = false;
+
     while (!QTAILQ_EMPTY(&n->aer_queue)) {
         NvmeAsyncEvent *event = QTAILQ_FIRST(&n->aer_queue);
         QTAILQ_REMOVE(&n->aer_queue, event, entry);
@@ -5989,7 +6507,6 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         /* Completion queue doorbell write */
 
         uint16_t new_head = val & 0xffff;
-        int start_sqs;
         NvmeCQueue *cq;
 
         qid = (addr - (0x1000 + (1 << 2))) >> 3;
@@ -6040,23 +6557,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
-        start_sqs = nvme_cq_full(cq) ? 1 : 0;
-        cq->head = new_head;
-        if (start_sqs) {
-            NvmeSQueue *sq;
-            QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-            }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-        }
-
-        if (cq->tail == cq->head) {
-            if (cq->irq_enabled) {
-                n->cq_pending--;
-            }
-
-            nvme_irq_deassert(n, cq);
-        }
+        nvme_cq_set_head(n, cq, new_head);
     } else {
         /* Submission queue doorbell write */
 
@@ -6110,11 +6611,13 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
 
     trace_pci_nvme_mmio_write(addr, data, size);
 
+    aio_context_acquire(n->ctx);
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else {
         nvme_process_db(n, addr, data);
     }
+    aio_context_release(n->ctx);
 }
 
 static const MemoryRegionOps nvme_mmio_ops = {
@@ -6370,7 +6873,8 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
 
     id->mdts = n->params.mdts;
     id->ver = cpu_to_le32(NVME_SPEC_VER);
-    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT);
+    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT |
+                           NVME_OACS_DBBUF);
     id->cntrltype = 0x1;
 
     /*
@@ -6479,6 +6983,12 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
+
     qbus_create_inplace(&n->bus, sizeof(NvmeBus), TYPE_NVME_BUS,
                         &pci_dev->qdev, n->parent_obj.qdev.id);
 
@@ -6493,6 +7003,11 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     }
     nvme_init_ctrl(n, pci_dev);
 
+    if (n->iothread && kvm_msi_via_irqfd_enabled()) {
+        msix_set_vector_notifiers(pci_dev, nvme_msix_vector_use,
+                                  nvme_msix_vector_release, NULL);
+    }
+
     /* setup a namespace if the controller drive property was given */
     if (n->namespace.blkconf.blk) {
         ns = &n->namespace;
@@ -6512,6 +7027,7 @@ static void nvme_exit(PCIDevice *pci_dev)
     NvmeNamespace *ns;
     int i;
 
+    aio_context_acquire(n->ctx);
     nvme_ctrl_reset(n);
 
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
@@ -6522,6 +7038,18 @@ static void nvme_exit(PCIDevice *pci_dev)
 
         nvme_ns_cleanup(ns);
     }
+    aio_context_release(n->ctx);
+
+    for (i = 1; n->iothread && i <= NVME_MAX_NAMESPACES; i++) {
+        ns = nvme_ns(n, i);
+        if (ns) {
+            nvme_ns_set_aio_context(ns, qemu_get_aio_context(), NULL);
+        }
+    }
+
+    if (pci_dev->msix_vector_use_notifier) {
+        msix_unset_vector_notifiers(pci_dev);
+    }
 
     g_free(n->cq);
     g_free(n->sq);
@@ -6544,6 +7072,8 @@ static Property nvme_props[] = {
                      HostMemoryBackend *),
     DEFINE_PROP_LINK("subsys", NvmeCtrl, subsys, TYPE_NVME_SUBSYS,
                      NvmeSubsystem *),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_STRING("serial", NvmeCtrl, params.serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, params.cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, params.num_queues, 0),
@@ -6558,6 +7088,7 @@ static Property nvme_props[] = {
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -411,6 +411,22 @@ static int nvme_ns_check_constraints(NvmeCtrl *n, NvmeNamespace *ns,
     return 0;
 }
 
+int nvme_ns_set_aio_context(NvmeNamespace *ns, AioContext *ctx, Error **errp)
+{
+    AioContext *old_ctx = blk_get_aio_context(ns->blkconf.blk);
+    int ret;
+
+    if (old_ctx == ctx) {
+        return 0;
+    }
+
+    aio_context_acquire(old_ctx);
+    ret = blk_set_aio_context(ns->blkconf.blk, ctx, errp);
+    aio_context_release(old_ctx);
+
+    return ret;
+}
+
 int nvme_ns_setup(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
 {
     if (nvme_ns_check_constraints(n, ns, errp)) {
@@ -421,6 +437,10 @@ int nvme_ns_setup(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
         return -1;
     }
 
+    if (nvme_ns_set_aio_context(ns, n->ctx, errp)) {
+        return -1;
+    }
+
     if (nvme_ns_init(ns, errp)) {
         return -1;
     }
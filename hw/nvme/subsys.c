@@ -20,6 +20,13 @@ int nvme_subsys_register_ctrl(NvmeCtrl *n, Error **errp)
         if (!subsys->ctrls[cntlid]) {
             break;
         }
+
+        /* shared namespaces can only be in a single AioContext */
+        if (subsys->ctrls[cntlid]->ctx != n->ctx) {
+            error_setg(errp, "all controllers in a subsystem must use the "
+                       "same iothread");
+            return -1;
+        }
     }
 
     if (cntlid == ARRAY_SIZE(subsys->ctrls)) {
@@ -3,6 +3,7 @@
 #include "qemu/error-report.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/thread.h"
 #include "hw/qdev-properties.h"
 #include "hw/scsi/scsi.h"
 #include "migration/qemu-file-types.h"
@@ -674,6 +675,95 @@ static const struct SCSIReqOps reqops_target_command = {
 };
 
 
+/*
+ * Freed requests are kept in small per-thread free lists, one for each of the
+ * few request sizes used by the SCSI devices, so that the data path does not
+ * go through g_malloc()/g_free() for every command.
+ */
+#define SCSI_REQ_POOL_CLASSES   4
+#define SCSI_REQ_POOL_MAX       64
+
+typedef struct SCSIRequestFree {
+    QSLIST_ENTRY(SCSIRequestFree) next;
+} SCSIRequestFree;
+
+typedef struct SCSIRequestPool {
+    size_t size;
+    unsigned int len;
+    QSLIST_HEAD(, SCSIRequestFree) head;
+} SCSIRequestPool;
+
+static __thread SCSIRequestPool scsi_req_pool[SCSI_REQ_POOL_CLASSES];
+static __thread Notifier scsi_req_pool_cleanup_notifier;
+
+static void scsi_req_pool_cleanup(Notifier *n, void *value)
+{
+    SCSIRequestFree *f;
+    int i;
+
+    for (i = 0; i < SCSI_REQ_POOL_CLASSES; i++) {
+        SCSIRequestPool *pool = &scsi_req_pool[i];
+
+        while ((f = QSLIST_FIRST(&pool->head))) {
+            QSLIST_REMOVE_HEAD(&pool->head, next);
+            g_free(f);
+        }
+        pool->len = 0;
+    }
+}
+
+static SCSIRequestPool *scsi_req_pool_find(size_t size)
+{
+    int i;
+
+    for (i = 0; i < SCSI_REQ_POOL_CLASSES; i++) {
+        if (scsi_req_pool[i].size == size) {
+            return &scsi_req_pool[i];
+        }
+    }
+    for (i = 0; i < SCSI_REQ_POOL_CLASSES; i++) {
+        if (!scsi_req_pool[i].size) {
+            scsi_req_pool[i].size = size;
+            QSLIST_INIT(&scsi_req_pool[i].head);
+            return &scsi_req_pool[i];
+        }
+    }
+    return NULL;
+}
+
+static void *scsi_req_pool_get(size_t size)
+{
+    SCSIRequestPool *pool = scsi_req_pool_find(size);
+    SCSIRequestFree *f;
+
+    if (!pool || !(f = QSLIST_FIRST(&pool->head))) {
+        return g_malloc(size);
+    }
+
+    QSLIST_REMOVE_HEAD(&pool->head, next);
+    pool->len--;
+    return f;
+}
+
+static void scsi_req_pool_put(void *p, size_t size)
+{
+    SCSIRequestPool *pool = scsi_req_pool_find(size);
+    SCSIRequestFree *f = p;
+
+    if (!pool || pool->len >= SCSI_REQ_POOL_MAX) {
+        g_free(p);
+        return;
+    }
+
+    if (!scsi_req_pool_cleanup_notifier.notify) {
+        scsi_req_pool_cleanup_notifier.notify = scsi_req_pool_cleanup;
+        qemu_thread_atexit_add(&scsi_req_pool_cleanup_notifier);
+    }
+
+    QSLIST_INSERT_HEAD(&pool->head, f, next);
+    pool->len++;
+}
+
 SCSIRequest *scsi_req_alloc(const SCSIReqOps *reqops, SCSIDevice *d,
                             uint32_t tag, uint32_t lun, void *hba_private)
 {
@@ -683,7 +773,7 @@ SCSIRequest *scsi_req_alloc(const SCSIReqOps *reqops, SCSIDevice *d,
     const int memset_off = offsetof(SCSIRequest, sense)
                            + sizeof(req->sense);
 
-    req = g_malloc(reqops->size);
+    req = scsi_req_pool_get(reqops->size);
     memset((uint8_t *)req + memset_off, 0, reqops->size - memset_off);
     req->refcount = 1;
     req->bus = bus;
@@ -1375,7 +1465,7 @@ void scsi_req_unref(SCSIRequest *req)
         }
         object_unref(OBJECT(req->dev));
         object_unref(OBJECT(qbus->parent));
-        g_free(req);
+        scsi_req_pool_put(req, req->ops->size);
     }
 }
 
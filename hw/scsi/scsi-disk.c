@@ -1616,17 +1616,39 @@ static void scsi_unmap_complete_noio(UnmapCBData *data, int ret)
 
     if (data->count > 0) {
         uint64_t sector_num = ldq_be_p(&data->inbuf[0]);
-        uint32_t nb_sectors = ldl_be_p(&data->inbuf[8]) & 0xffffffffULL;
+        uint64_t nb_sectors = 0;
+        bool first = true;
+
+        /*
+         * Descriptors for adjacent ranges, which guests commonly send when
+         * trimming free space, are merged into a single discard.
+         */
+        do {
+            uint64_t lba = ldq_be_p(&data->inbuf[0]);
+            uint32_t nb = ldl_be_p(&data->inbuf[8]) & 0xffffffffULL;
+
+            if (!first && (lba != sector_num + nb_sectors ||
+                           (nb_sectors + nb) * s->qdev.blocksize >
+                           BDRV_REQUEST_MAX_BYTES)) {
+                break;
+            }
+
+            if (!check_lba_range(s, lba, nb)) {
+                block_acct_invalid(blk_get_stats(s->qdev.conf.blk),
+                                   BLOCK_ACCT_UNMAP);
+                scsi_check_condition(r, SENSE_CODE(LBA_OUT_OF_RANGE));
+                goto done;
+            }
+
+            nb_sectors += nb;
+            data->count--;
+            data->inbuf += 16;
+            first = false;
+        } while (data->count > 0);
+
         r->sector = sector_num * (s->qdev.blocksize / BDRV_SECTOR_SIZE);
         r->sector_count = nb_sectors * (s->qdev.blocksize / BDRV_SECTOR_SIZE);
 
-        if (!check_lba_range(s, sector_num, nb_sectors)) {
-            block_acct_invalid(blk_get_stats(s->qdev.conf.blk),
-                               BLOCK_ACCT_UNMAP);
-            scsi_check_condition(r, SENSE_CODE(LBA_OUT_OF_RANGE));
-            goto done;
-        }
-
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
                          r->sector_count * BDRV_SECTOR_SIZE,
                          BLOCK_ACCT_UNMAP);
@@ -1635,8 +1657,6 @@ static void scsi_unmap_complete_noio(UnmapCBData *data, int ret)
                                         r->sector * BDRV_SECTOR_SIZE,
                                         r->sector_count * BDRV_SECTOR_SIZE,
                                         scsi_unmap_complete, data);
-        data->count--;
-        data->inbuf += 16;
         return;
     }
 
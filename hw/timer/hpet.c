@@ -30,6 +30,8 @@
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
 #include "hw/timer/hpet.h"
 #include "hw/sysbus.h"
 #include "hw/rtc/mc146818rtc.h"
@@ -71,6 +73,13 @@ struct HPETState {
     SysBusDevice parent_obj;
     /*< public >*/
 
+    /*
+     * MMIO reads run without the BQL and only take this lock.  Everything
+     * else runs with the BQL and takes the lock to modify registers that
+     * MMIO reads return.  The interrupt inputs do not take it, because
+     * the PIT may signal them while the lock is held.
+     */
+    QemuMutex lock;
     MemoryRegion iomem;
     uint64_t hpet_offset;
     bool hpet_offset_saved;
@@ -359,9 +368,12 @@ static void hpet_timer(void *opaque)
 {
     HPETTimer *t = opaque;
     uint64_t diff;
+    uint64_t period;
+    uint64_t cur_tick;
 
-    uint64_t period = t->period;
-    uint64_t cur_tick = hpet_get_ticks(t->state);
+    QEMU_LOCK_GUARD(&t->state->lock);
+    period = t->period;
+    cur_tick = hpet_get_ticks(t->state);
 
     if (timer_is_periodic(t) && period != 0) {
         if (t->config & HPET_TN_32BIT) {
@@ -417,10 +429,8 @@ static void hpet_del_timer(HPETTimer *t)
     update_irq(t, 0);
 }
 
-static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
-                              unsigned size)
+static uint64_t hpet_ram_read_locked(HPETState *s, hwaddr addr)
 {
-    HPETState *s = opaque;
     uint64_t cur_tick, index;
 
     DPRINTF("qemu: Enter hpet_ram_readl at %" PRIx64 "\n", addr);
@@ -489,17 +499,25 @@ static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
     return 0;
 }
 
-static void hpet_ram_write(void *opaque, hwaddr addr,
-                           uint64_t value, unsigned size)
+/* Called without the BQL: guests using the HPET as clocksource poll it */
+static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
+                              unsigned size)
 {
-    int i;
     HPETState *s = opaque;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    return hpet_ram_read_locked(s, addr);
+}
+
+static void hpet_ram_write_locked(HPETState *s, hwaddr addr, uint64_t value)
+{
+    int i;
     uint64_t old_val, new_val, val, index;
 
     DPRINTF("qemu: Enter hpet_ram_writel at %" PRIx64 " = 0x%" PRIx64 "\n",
             addr, value);
     index = addr;
-    old_val = hpet_ram_read(opaque, addr, 4);
+    old_val = hpet_ram_read_locked(s, addr);
     new_val = value;
 
     /*address range of all TN regs*/
@@ -658,6 +676,25 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
     }
 }
 
+static void hpet_ram_write(void *opaque, hwaddr addr,
+                           uint64_t value, unsigned size)
+{
+    HPETState *s = opaque;
+    bool release_lock = false;
+
+    /* Writes arm QEMU timers and raise interrupts, which need the BQL */
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        release_lock = true;
+    }
+    qemu_mutex_lock(&s->lock);
+    hpet_ram_write_locked(s, addr, value);
+    qemu_mutex_unlock(&s->lock);
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static const MemoryRegionOps hpet_ram_ops = {
     .read = hpet_ram_read,
     .write = hpet_ram_write,
@@ -674,6 +711,7 @@ static void hpet_reset(DeviceState *d)
     SysBusDevice *sbd = SYS_BUS_DEVICE(d);
     int i;
 
+    QEMU_LOCK_GUARD(&s->lock);
     for (i = 0; i < s->num_timers; i++) {
         HPETTimer *timer = &s->timer[i];
 
@@ -721,11 +759,21 @@ static void hpet_init(Object *obj)
     SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
     HPETState *s = HPET(obj);
 
+    qemu_mutex_init(&s->lock);
+
     /* HPET Area */
     memory_region_init_io(&s->iomem, obj, &hpet_ram_ops, s, "hpet", HPET_LEN);
+    memory_region_clear_global_locking(&s->iomem);
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
+static void hpet_finalize(Object *obj)
+{
+    HPETState *s = HPET(obj);
+
+    qemu_mutex_destroy(&s->lock);
+}
+
 static void hpet_realize(DeviceState *dev, Error **errp)
 {
     SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
@@ -796,6 +844,7 @@ static const TypeInfo hpet_device_info = {
     .parent        = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(HPETState),
     .instance_init = hpet_init,
+    .instance_finalize = hpet_finalize,
     .class_init    = hpet_device_class_init,
 };
 
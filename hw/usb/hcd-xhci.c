@@ -23,8 +23,11 @@
 #include "qemu/timer.h"
 #include "qemu/module.h"
 #include "qemu/queue.h"
+#include "qemu/main-loop.h"
+#include "qemu/event_notifier.h"
 #include "migration/vmstate.h"
 #include "hw/qdev-properties.h"
+#include "sysemu/runstate.h"
 #include "trace.h"
 #include "qapi/error.h"
 
@@ -124,6 +127,9 @@
 #define IMAN_IP         (1<<0)
 #define IMAN_IE         (1<<1)
 
+#define IMOD_IMODI_MASK 0xffff
+#define IMOD_NS         250
+
 #define ERDP_EHB        (1<<3)
 
 #define TRB_SIZE 16
@@ -292,6 +298,10 @@ struct XHCIEPContext {
     unsigned int interval;
     int64_t mfindex_last;
     QEMUTimer *kick_timer;
+
+    /* doorbell writes for stream 0, see xhci_ep_doorbell_init() */
+    EventNotifier doorbell;
+    bool doorbell_active;
 };
 
 typedef struct XHCIEvRingSeg {
@@ -562,17 +572,21 @@ static void xhci_intr_update(XHCIState *xhci, int v)
     }
 }
 
-static void xhci_intr_raise(XHCIState *xhci, int v)
+static void xhci_er_write_batch(XHCIState *xhci, int v)
 {
-    bool pending = (xhci->intr[v].erdp_low & ERDP_EHB);
-
-    xhci->intr[v].erdp_low |= ERDP_EHB;
-    xhci->intr[v].iman |= IMAN_IP;
-    xhci->usbsts |= USBSTS_EINT;
+    XHCIInterrupter *intr = &xhci->intr[v];
 
-    if (pending) {
+    if (!intr->ev_batch_len) {
         return;
     }
+    QEMU_BUILD_BUG_ON(sizeof(XHCIEvTRB) != TRB_SIZE);
+    dma_memory_write(xhci->as, intr->er_start + TRB_SIZE * intr->ev_batch_idx,
+                     intr->ev_batch, TRB_SIZE * intr->ev_batch_len);
+    intr->ev_batch_len = 0;
+}
+
+static void xhci_intr_deliver(XHCIState *xhci, int v)
+{
     if (!(xhci->intr[v].iman & IMAN_IE)) {
         return;
     }
@@ -587,6 +601,80 @@ static void xhci_intr_raise(XHCIState *xhci, int v)
     }
 }
 
+static void xhci_intr_raise(XHCIState *xhci, int v)
+{
+    XHCIInterrupter *intr = &xhci->intr[v];
+    bool pending = (intr->erdp_low & ERDP_EHB);
+    uint32_t imodi = intr->imod & IMOD_IMODI_MASK;
+
+    /* The guest must find every event the interrupt is for */
+    xhci_er_write_batch(xhci, v);
+
+    intr->erdp_low |= ERDP_EHB;
+    intr->iman |= IMAN_IP;
+    xhci->usbsts |= USBSTS_EINT;
+
+    if (pending) {
+        return;
+    }
+
+    /*
+     * Interrupt moderation: after an interrupt, hold the next one back
+     * until IMODI * 250ns have passed.
+     */
+    if (imodi) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+        if (now < intr->imod_deadline) {
+            if (!timer_pending(intr->imod_timer)) {
+                trace_usb_xhci_intr_moderate(v, intr->imod_deadline - now);
+                timer_mod(intr->imod_timer, intr->imod_deadline);
+            }
+            return;
+        }
+        intr->imod_deadline = now + (int64_t)imodi * IMOD_NS;
+    }
+    xhci_intr_deliver(xhci, v);
+}
+
+static void xhci_imod_timer(void *opaque)
+{
+    XHCIInterrupter *intr = opaque;
+    XHCIState *xhci = intr->xhci;
+    uint32_t imodi = intr->imod & IMOD_IMODI_MASK;
+
+    intr->imod_deadline = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                          (int64_t)imodi * IMOD_NS;
+    if (intr->iman & IMAN_IP) {
+        xhci_intr_deliver(xhci, intr - xhci->intr);
+    }
+}
+
+/*
+ * Write the events queued so far to the event rings and raise the
+ * interrupts they are waiting for.  Called at the end of each batch of
+ * work, and from a bottom half for events from any other context.
+ */
+static void xhci_events_flush(XHCIState *xhci)
+{
+    int v;
+
+    for (v = 0; v < xhci->numintrs; v++) {
+        XHCIInterrupter *intr = &xhci->intr[v];
+
+        xhci_er_write_batch(xhci, v);
+        if (intr->ev_intr) {
+            intr->ev_intr = false;
+            xhci_intr_raise(xhci, v);
+        }
+    }
+}
+
+static void xhci_events_bh(void *opaque)
+{
+    xhci_events_flush(opaque);
+}
+
 static inline int xhci_running(XHCIState *xhci)
 {
     return !(xhci->usbsts & USBSTS_HCH);
@@ -602,7 +690,7 @@ static void xhci_write_event(XHCIState *xhci, XHCIEvent *event, int v)
 {
     XHCIInterrupter *intr = &xhci->intr[v];
     XHCITRB ev_trb;
-    dma_addr_t addr;
+    XHCIEvTRB *slot;
 
     ev_trb.parameter = cpu_to_le64(event->ptr);
     ev_trb.status = cpu_to_le32(event->length | (event->ccode << 24));
@@ -617,17 +705,33 @@ static void xhci_write_event(XHCIState *xhci, XHCIEvent *event, int v)
                                event_name(event), ev_trb.parameter,
                                ev_trb.status, ev_trb.control);
 
-    addr = intr->er_start + TRB_SIZE*intr->er_ep_idx;
-    dma_memory_write(xhci->as, addr, &ev_trb, TRB_SIZE);
+    if (!intr->ev_batch_len) {
+        intr->ev_batch_idx = intr->er_ep_idx;
+    }
+    slot = &intr->ev_batch[intr->ev_batch_len++];
+    slot->parameter = ev_trb.parameter;
+    slot->status = ev_trb.status;
+    slot->control = ev_trb.control;
 
     intr->er_ep_idx++;
     if (intr->er_ep_idx >= intr->er_size) {
         intr->er_ep_idx = 0;
         intr->er_pcs = !intr->er_pcs;
     }
+
+    /* A batch is a single contiguous write, so it cannot wrap */
+    if (intr->ev_batch_len == XHCI_EV_BATCH || intr->er_ep_idx == 0) {
+        xhci_er_write_batch(xhci, v);
+    }
 }
 
-static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
+/*
+ * Queue an event on interrupter V.  The event reaches the guest from
+ * xhci_events_flush(), which also raises the interrupt unless IRQ is
+ * false (for transfers with Block Event Interrupt).
+ */
+static void xhci_queue_event(XHCIState *xhci, XHCIEvent *event, int v,
+                             bool irq)
 {
     XHCIInterrupter *intr;
     dma_addr_t erdp;
@@ -662,7 +766,15 @@ static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
         xhci_write_event(xhci, event, v);
     }
 
-    xhci_intr_raise(xhci, v);
+    if (irq) {
+        intr->ev_intr = true;
+    }
+    qemu_bh_schedule(xhci->ev_bh);
+}
+
+static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
+{
+    xhci_queue_event(xhci, event, v, true);
 }
 
 static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
@@ -769,6 +881,9 @@ static void xhci_er_reset(XHCIState *xhci, int v)
     XHCIEvRingSeg seg;
     dma_addr_t erstba = xhci_addr64(intr->erstba_low, intr->erstba_high);
 
+    /* events already queued belong to the old ring */
+    xhci_er_write_batch(xhci, v);
+
     if (intr->erstsz == 0 || erstba == 0) {
         /* disabled */
         intr->er_start = 0;
@@ -1036,6 +1151,56 @@ static void xhci_ep_kick_timer(void *opaque)
 {
     XHCIEPContext *epctx = opaque;
     xhci_kick_epctx(epctx, 0);
+    xhci_events_flush(epctx->xhci);
+}
+
+static void xhci_ep_doorbell_notify(EventNotifier *n)
+{
+    XHCIEPContext *epctx = container_of(n, XHCIEPContext, doorbell);
+    XHCIState *xhci = epctx->xhci;
+
+    if (!event_notifier_test_and_clear(n)) {
+        return;
+    }
+    trace_usb_xhci_doorbell_notify(epctx->slotid, epctx->epid);
+    if (!xhci_running(xhci)) {
+        return;
+    }
+    xhci_kick_ep(xhci, epctx->slotid, epctx->epid, 0);
+    xhci_events_flush(xhci);
+}
+
+/*
+ * Doorbell writes for stream 0 of an endpoint, which are what drivers
+ * issue for every transfer outside of stream endpoints, signal an
+ * eventfd so that the vCPU does not process the transfer ring itself.
+ * Other values still go through xhci_doorbell_write().
+ */
+static void xhci_ep_doorbell_init(XHCIEPContext *epctx)
+{
+    XHCIState *xhci = epctx->xhci;
+
+    if (!xhci->ioeventfd || event_notifier_init(&epctx->doorbell, 0) < 0) {
+        return;
+    }
+    event_notifier_set_handler(&epctx->doorbell, xhci_ep_doorbell_notify);
+    memory_region_add_eventfd(&xhci->mem_doorbell, epctx->slotid * 4, 4,
+                              true, epctx->epid, &epctx->doorbell);
+    epctx->doorbell_active = true;
+}
+
+static void xhci_ep_doorbell_cleanup(XHCIEPContext *epctx)
+{
+    XHCIState *xhci = epctx->xhci;
+
+    if (!epctx->doorbell_active) {
+        return;
+    }
+    memory_region_del_eventfd(&xhci->mem_doorbell, epctx->slotid * 4, 4,
+                              true, epctx->epid, &epctx->doorbell);
+    event_notifier_set_handler(&epctx->doorbell, NULL);
+    event_notifier_cleanup(&epctx->doorbell);
+    epctx->doorbell_active = false;
 }
 
 static XHCIEPContext *xhci_alloc_epctx(XHCIState *xhci,
@@ -1051,6 +1216,7 @@ static XHCIEPContext *xhci_alloc_epctx(XHCIState *xhci,
 
     QTAILQ_INIT(&epctx->transfers);
     epctx->kick_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_ep_kick_timer, epctx);
+    xhci_ep_doorbell_init(epctx);
 
     return epctx;
 }
@@ -1242,6 +1408,7 @@ static TRBCCode xhci_disable_ep(XHCIState *xhci, unsigned int slotid,
         xhci_set_ep_state(xhci, epctx, NULL, EP_DISABLED);
     }
 
+    xhci_ep_doorbell_cleanup(epctx);
     timer_free(epctx->kick_timer);
     g_free(epctx);
     slot->eps[epid-1] = NULL;
@@ -1441,6 +1608,19 @@ static void xhci_xfer_unmap(XHCITransfer *xfer)
     qemu_sglist_destroy(&xfer->sgl);
 }
 
+/* Block Event Interrupt is only defined for these transfer TRBs */
+static bool xhci_trb_blocks_intr(XHCITRB *trb)
+{
+    switch (TRB_TYPE(*trb)) {
+    case TR_NORMAL:
+    case TR_ISOCH:
+    case TR_EVDATA:
+        return trb->control & TRB_TR_BEI;
+    default:
+        return false;
+    }
+}
+
 static void xhci_xfer_report(XHCITransfer *xfer)
 {
     uint32_t edtla = 0;
@@ -1503,7 +1683,9 @@ static void xhci_xfer_report(XHCITransfer *xfer)
                 DPRINTF("xhci_xfer_data: EDTLA=%d\n", event.length);
                 edtla = 0;
             }
-            xhci_event(xhci, &event, TRB_INTR(*trb));
+            xhci_queue_event(xhci, &event, TRB_INTR(*trb),
+                             xfer->status != CC_SUCCESS ||
+                             !xhci_trb_blocks_intr(trb));
             reported = 1;
             if (xfer->status != CC_SUCCESS) {
                 return;
@@ -2681,6 +2863,11 @@ static void xhci_reset(DeviceState *dev)
         xhci->intr[i].er_pcs = 1;
         xhci->intr[i].ev_buffer_put = 0;
         xhci->intr[i].ev_buffer_get = 0;
+
+        xhci->intr[i].ev_batch_len = 0;
+        xhci->intr[i].ev_intr = false;
+        xhci->intr[i].imod_deadline = 0;
+        timer_del(xhci->intr[i].imod_timer);
     }
 
     xhci->mfindex_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
@@ -3118,6 +3305,7 @@ static void xhci_doorbell_write(void *ptr, hwaddr reg,
             xhci_kick_ep(xhci, reg, epid, streamid);
         }
     }
+    xhci_events_flush(xhci);
 }
 
 static void xhci_cap_write(void *opaque, hwaddr addr, uint64_t val,
@@ -3200,6 +3388,7 @@ static void xhci_wakeup(USBPort *usbport)
 
 static void xhci_complete(USBPort *port, USBPacket *packet)
 {
+    XHCIState *xhci = port->opaque;
     XHCITransfer *xfer = container_of(packet, XHCITransfer, packet);
 
     if (packet->status == USB_RET_REMOVE_FROM_QUEUE) {
@@ -3211,6 +3400,7 @@ static void xhci_complete(USBPort *port, USBPacket *packet)
     if (xfer->complete) {
         xhci_ep_free_xfer(xfer);
     }
+    xhci_events_flush(xhci);
 }
 
 static void xhci_child_detach(USBPort *uport, USBDevice *child)
@@ -3270,6 +3460,7 @@ static void xhci_wakeup_endpoint(USBBus *bus, USBEndpoint *ep,
         return;
     }
     xhci_kick_ep(xhci, slotid, xhci_find_epid(ep), stream);
+    xhci_events_flush(xhci);
 }
 
 static USBBusOps xhci_bus_ops = {
@@ -3332,6 +3523,17 @@ static void usb_xhci_init(XHCIState *xhci)
     }
 }
 
+/*
+ * Events still queued when the VM stops must reach guest memory before
+ * its final migration pass.
+ */
+static void xhci_vm_state_change(void *opaque, bool running, RunState state)
+{
+    if (!running) {
+        xhci_events_flush(opaque);
+    }
+}
+
 static void usb_xhci_realize(DeviceState *dev, Error **errp)
 {
     int i;
@@ -3361,6 +3563,15 @@ static void usb_xhci_realize(DeviceState *dev, Error **errp)
 
     usb_xhci_init(xhci);
     xhci->mfwrap_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_mfwrap_timer, xhci);
+    for (i = 0; i < xhci->numintrs; i++) {
+        xhci->intr[i].xhci = xhci;
+        xhci->intr[i].imod_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                                xhci_imod_timer,
+                                                &xhci->intr[i]);
+    }
+    xhci->ev_bh = qemu_bh_new(xhci_events_bh, xhci);
+    xhci->vmstate_entry =
+        qemu_add_vm_change_state_handler(xhci_vm_state_change, xhci);
 
     memory_region_init(&xhci->mem, OBJECT(dev), "xhci", XHCI_LEN_REGS);
     memory_region_init_io(&xhci->mem_cap, OBJECT(dev), &xhci_cap_ops, xhci,
@@ -3402,6 +3613,12 @@ static void usb_xhci_unrealize(DeviceState *dev)
         timer_free(xhci->mfwrap_timer);
         xhci->mfwrap_timer = NULL;
     }
+    for (i = 0; i < xhci->numintrs; i++) {
+        timer_free(xhci->intr[i].imod_timer);
+        xhci->intr[i].imod_timer = NULL;
+    }
+    qemu_del_vm_change_state_handler(xhci->vmstate_entry);
+    qemu_bh_delete(xhci->ev_bh);
 
     memory_region_del_subregion(&xhci->mem, &xhci->mem_cap);
     memory_region_del_subregion(&xhci->mem, &xhci->mem_oper);
@@ -3424,7 +3641,7 @@ static int usb_xhci_post_load(void *opaque, int version_id)
     dma_addr_t dcbaap, pctx;
     uint32_t slot_ctx[4];
     uint32_t ep_ctx[5];
-    int slotid, epid, state;
+    int slotid, epid, state, i;
 
     dcbaap = xhci_addr64(xhci->dcbaap_low, xhci->dcbaap_high);
 
@@ -3462,6 +3679,14 @@ static int usb_xhci_post_load(void *opaque, int version_id)
             }
         }
     }
+
+    /* an interrupt may have been held back by moderation */
+    for (i = 0; i < xhci->numintrs; i++) {
+        if (xhci->intr[i].iman & IMAN_IP) {
+            timer_mod(xhci->intr[i].imod_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+        }
+    }
     return 0;
 }
 
@@ -3582,6 +3807,7 @@ static Property xhci_properties[] = {
                     XHCI_FLAG_ENABLE_STREAMS, true),
     DEFINE_PROP_UINT32("p2",    XHCIState, numports_2, 4),
     DEFINE_PROP_UINT32("p3",    XHCIState, numports_3, 4),
+    DEFINE_PROP_BOOL("ioeventfd", XHCIState, ioeventfd, true),
     DEFINE_PROP_LINK("host",    XHCIState, hostOpaque, TYPE_DEVICE,
                      DeviceState *),
     DEFINE_PROP_END_OF_LIST(),
@@ -32,6 +32,9 @@ OBJECT_DECLARE_SIMPLE_TYPE(XHCIState, XHCI)
 /* Very pessimistic, let's hope it's enough for all cases */
 #define EV_QUEUE (((3 * 24) + 16) * XHCI_MAXSLOTS)
 
+/* Event TRBs gathered before writing them to the event ring at once */
+#define XHCI_EV_BATCH 16
+
 typedef struct XHCIStreamContext XHCIStreamContext;
 typedef struct XHCIEPContext XHCIEPContext;
 
@@ -151,7 +154,15 @@ typedef struct XHCIEvent {
     uint8_t epid;
 } XHCIEvent;
 
+/* An event TRB as laid out in the guest's event ring */
+typedef struct XHCIEvTRB {
+    uint64_t parameter;
+    uint32_t status;
+    uint32_t control;
+} XHCIEvTRB;
+
 typedef struct XHCIInterrupter {
+    XHCIState *xhci;
     uint32_t iman;
     uint32_t imod;
     uint32_t erstsz;
@@ -166,6 +177,19 @@ typedef struct XHCIInterrupter {
     uint32_t er_size;
     unsigned int er_ep_idx;
 
+    /*
+     * Events not yet in guest memory, to be written at ring index
+     * ev_batch_idx.  ev_intr is set if they should raise an interrupt.
+     */
+    XHCIEvTRB ev_batch[XHCI_EV_BATCH];
+    unsigned int ev_batch_len;
+    unsigned int ev_batch_idx;
+    bool ev_intr;
+
+    /* interrupt moderation, see IMOD */
+    QEMUTimer *imod_timer;
+    int64_t imod_deadline;
+
     /* kept for live migration compat only */
     bool er_full_unused;
     XHCIEvent ev_buffer[EV_QUEUE];
@@ -193,6 +217,7 @@ typedef struct XHCIState {
     uint32_t numslots;
     uint32_t flags;
     uint32_t max_pstreams_mask;
+    bool ioeventfd;
     void (*intr_update)(XHCIState *s, int n, bool enable);
     bool (*intr_raise)(XHCIState *s, int n, bool level);
     DeviceState *hostOpaque;
@@ -216,6 +241,8 @@ typedef struct XHCIState {
     int64_t mfindex_start;
     QEMUTimer *mfwrap_timer;
     XHCIInterrupter intr[XHCI_MAXINTRS];
+    QEMUBH *ev_bh;
+    VMChangeStateEntry *vmstate_entry;
 
     XHCIRing cmd_ring;
 
@@ -30,10 +30,12 @@
 #include "exec/address-spaces.h"
 #include "exec/memory.h"
 #include "exec/ram_addr.h"
+#include "hw/boards.h"
 #include "hw/hw.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/units.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "trace.h"
@@ -496,6 +498,41 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * The type1 IOMMU only returns dirty bitmaps for ranges made of whole
+ * mappings.  When it tracks dirty pages, guest RAM is therefore mapped in
+ * chunks of this size, so that each migration sync can fetch and process
+ * the bitmap a chunk at a time instead of allocating it for a whole RAM
+ * section.
+ */
+#define VFIO_DIRTY_CHUNK_SIZE (1 * GiB)
+
+static hwaddr vfio_dma_chunk_size(VFIOContainer *container, hwaddr size)
+{
+    return container->dirty_pages_supported ?
+           MIN(size, VFIO_DIRTY_CHUNK_SIZE) : size;
+}
+
+static int vfio_dma_map_ram(VFIOContainer *container, hwaddr iova,
+                            ram_addr_t size, void *vaddr, bool readonly)
+{
+    hwaddr done, len;
+    int ret;
+
+    for (done = 0; done < size; done += len) {
+        len = vfio_dma_chunk_size(container, size - done);
+        ret = vfio_dma_map(container, iova + done, len, vaddr + done,
+                           readonly);
+        if (ret) {
+            if (done) {
+                vfio_dma_unmap(container, iova, done, NULL);
+            }
+            return ret;
+        }
+    }
+    return 0;
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -649,6 +686,34 @@ out:
     rcu_read_unlock();
 }
 
+/*
+ * VFIO_IOMMU_MAP_DMA faults in the guest memory it pins one page at a
+ * time, under a lock held for the whole container, so splitting a section
+ * into concurrent ioctls does not help.  While the machine is still being
+ * created, populate large sections with parallel threads first; pinning
+ * then only has to take references to pages that are already there.
+ */
+#define VFIO_PREFAULT_MIN_SIZE (1 * GiB)
+
+static void vfio_prefault_ram(MemoryRegionSection *section, hwaddr iova,
+                              void *vaddr, hwaddr size)
+{
+    Error *local_err = NULL;
+
+    if (phase_check(PHASE_MACHINE_READY) || size < VFIO_PREFAULT_MIN_SIZE ||
+        section->readonly || memory_region_is_ram_device(section->mr)) {
+        return;
+    }
+
+    trace_vfio_prefault_ram(iova, size);
+    os_mem_prealloc(memory_region_get_fd(section->mr), vaddr, size,
+                    current_machine->smp.cpus, NULL, 0, false, &local_err);
+    if (local_err) {
+        /* Let the mapping itself report what went wrong */
+        warn_report_err(local_err);
+    }
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -831,8 +896,10 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
-    ret = vfio_dma_map(container, iova, int128_get64(llsize),
-                       vaddr, section->readonly);
+    vfio_prefault_ram(section, iova, vaddr, int128_get64(llsize));
+
+    ret = vfio_dma_map_ram(container, iova, int128_get64(llsize),
+                           vaddr, section->readonly);
     if (ret) {
         error_setg(&err, "vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
                    "0x%"HWADDR_PRIx", %p) = %d (%m)",
@@ -1112,6 +1179,8 @@ static int vfio_sync_dirty_bitmap(VFIOContainer *container,
                                   MemoryRegionSection *section)
 {
     ram_addr_t ram_addr;
+    hwaddr iova, size, done, len;
+    int ret;
 
     if (memory_region_is_iommu(section->mr)) {
         VFIOGuestIOMMU *giommu;
@@ -1143,10 +1212,19 @@ static int vfio_sync_dirty_bitmap(VFIOContainer *container,
 
     ram_addr = memory_region_get_ram_addr(section->mr) +
                section->offset_within_region;
+    iova = REAL_HOST_PAGE_ALIGN(section->offset_within_address_space);
+    size = int128_get64(section->size);
 
-    return vfio_get_dirty_bitmap(container,
-                   REAL_HOST_PAGE_ALIGN(section->offset_within_address_space),
-                   int128_get64(section->size), ram_addr);
+    /* Follow the chunks vfio_dma_map_ram() mapped the section with */
+    for (done = 0; done < size; done += len) {
+        len = vfio_dma_chunk_size(container, size - done);
+        ret = vfio_get_dirty_bitmap(container, iova + done, len,
+                                    ram_addr + done);
+        if (ret) {
+            return ret;
+        }
+    }
+    return 0;
 }
 
 static void vfio_listener_log_sync(MemoryListener *listener,
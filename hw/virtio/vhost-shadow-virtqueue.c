@@ -0,0 +1,378 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "exec/address-spaces.h"
+#include "hw/virtio/vhost-shadow-virtqueue.h"
+#include "trace.h"
+
+/* The device gets the address of each part, so they only need this */
+#define VHOST_SVQ_ALIGN 64
+
+/*
+ * Check that the features the guest acked let a split shadow ring,
+ * holding the guest physical addresses of the buffers, stand in for the
+ * guest virtqueue.
+ */
+bool vhost_svq_valid_features(VirtIODevice *vdev, Error **errp)
+{
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1)) {
+        error_setg(errp, "shadow virtqueues need a modern device");
+        return false;
+    }
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        error_setg(errp, "shadow virtqueues do not support packed rings");
+        return false;
+    }
+    if (vdev->dma_as != &address_space_memory) {
+        error_setg(errp, "shadow virtqueues do not support a vIOMMU");
+        return false;
+    }
+    return true;
+}
+
+/* The caller sets the IOVA where it maps svq->ring for the device */
+VhostShadowVirtqueue *vhost_svq_new(void)
+{
+    VhostShadowVirtqueue *svq = g_new0(VhostShadowVirtqueue, 1);
+    int r;
+
+    r = event_notifier_init(&svq->hdev_kick, 0);
+    if (r != 0) {
+        error_report("Couldn't create kick event notifier: %s", strerror(-r));
+        goto err_kick;
+    }
+    r = event_notifier_init(&svq->hdev_call, 0);
+    if (r != 0) {
+        error_report("Couldn't create call event notifier: %s", strerror(-r));
+        goto err_call;
+    }
+
+    svq->ring_size = ROUND_UP(vring_size(VIRTQUEUE_MAX_SIZE, VHOST_SVQ_ALIGN),
+                              qemu_real_host_page_size);
+    svq->ring = qemu_memalign(qemu_real_host_page_size, svq->ring_size);
+    svq->ring_id_maps = g_new0(VirtQueueElement *, VIRTQUEUE_MAX_SIZE);
+    event_notifier_init_fd(&svq->svq_kick, -1);
+    event_notifier_init_fd(&svq->svq_call, -1);
+    vhost_svq_set_num(svq, VIRTQUEUE_MAX_SIZE);
+    return svq;
+
+err_call:
+    event_notifier_cleanup(&svq->hdev_kick);
+err_kick:
+    g_free(svq);
+    return NULL;
+}
+
+void vhost_svq_free(VhostShadowVirtqueue *svq)
+{
+    if (!svq) {
+        return;
+    }
+    assert(!svq->started);
+    event_notifier_cleanup(&svq->hdev_kick);
+    event_notifier_cleanup(&svq->hdev_call);
+    g_free(svq->ring_id_maps);
+    qemu_vfree(svq->ring);
+    g_free(svq);
+}
+
+/* Lay out an empty ring of @num descriptors, all of them free */
+void vhost_svq_set_num(VhostShadowVirtqueue *svq, unsigned int num)
+{
+    unsigned int i;
+
+    assert(!svq->started && num && num <= VIRTQUEUE_MAX_SIZE);
+    memset(svq->ring, 0, svq->ring_size);
+    vring_init(&svq->vring, num, svq->ring, VHOST_SVQ_ALIGN);
+    for (i = 0; i < num - 1; i++) {
+        svq->vring.desc[i].next = cpu_to_le16(i + 1);
+    }
+    svq->free_head = 0;
+    svq->num_free = num;
+    svq->shadow_avail_idx = 0;
+    svq->last_used_idx = 0;
+}
+
+void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
+                              struct vhost_vring_addr *addr)
+{
+    addr->desc_user_addr = svq->iova;
+    addr->avail_user_addr = svq->iova +
+        ((void *)svq->vring.avail - svq->ring);
+    addr->used_user_addr = svq->iova + ((void *)svq->vring.used - svq->ring);
+    addr->log_guest_addr = 0;
+    addr->flags = 0;
+}
+
+void vhost_svq_set_guest_kick_fd(VhostShadowVirtqueue *svq, int fd)
+{
+    assert(!svq->started);
+    event_notifier_init_fd(&svq->svq_kick, fd);
+}
+
+/* The guest notifier can change at any time, when it is (un)masked */
+void vhost_svq_set_guest_call_fd(VhostShadowVirtqueue *svq, int fd)
+{
+    event_notifier_init_fd(&svq->svq_call, fd);
+}
+
+static void vhost_svq_add(VhostShadowVirtqueue *svq, VirtQueueElement *elem)
+{
+    struct vring_desc *desc = svq->vring.desc;
+    unsigned int n = elem->out_num + elem->in_num;
+    uint16_t head = svq->free_head, i = head, last = head;
+    unsigned int j;
+
+    for (j = 0; j < n; j++) {
+        bool in = j >= elem->out_num;
+        unsigned int k = in ? j - elem->out_num : j;
+        uint16_t flags = in ? VRING_DESC_F_WRITE : 0;
+
+        if (j + 1 < n) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+        desc[i].addr = cpu_to_le64(in ? elem->in_addr[k] : elem->out_addr[k]);
+        desc[i].len = cpu_to_le32(in ? elem->in_sg[k].iov_len
+                                     : elem->out_sg[k].iov_len);
+        desc[i].flags = cpu_to_le16(flags);
+        last = i;
+        i = le16_to_cpu(desc[i].next);
+    }
+
+    /* The free list links the descriptors of the chain already */
+    svq->free_head = le16_to_cpu(desc[last].next);
+    svq->num_free -= n;
+    svq->ring_id_maps[head] = elem;
+
+    svq->vring.avail->ring[svq->shadow_avail_idx % svq->vring.num] =
+        cpu_to_le16(head);
+    svq->shadow_avail_idx++;
+
+    /* Expose the descriptors before the index to the device */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+}
+
+/* Move what the guest made available to the shadow ring */
+static void vhost_svq_forward_avail(VhostShadowVirtqueue *svq)
+{
+    VirtQueueElement *elem;
+    bool added = false;
+
+    do {
+        virtio_queue_set_notification(svq->vq, false);
+
+        for (;;) {
+            if (svq->next_guest_avail_elem) {
+                elem = svq->next_guest_avail_elem;
+                svq->next_guest_avail_elem = NULL;
+            } else {
+                elem = virtqueue_pop(svq->vq, sizeof(*elem));
+            }
+            if (!elem) {
+                break;
+            }
+
+            if (elem->out_num + elem->in_num > svq->vring.num) {
+                error_report("Guest buffer with %u descriptors does not fit "
+                             "a shadow virtqueue of %u",
+                             elem->out_num + elem->in_num, svq->vring.num);
+                virtqueue_push(svq->vq, elem, 0);
+                g_free(elem);
+                continue;
+            }
+            if (elem->out_num + elem->in_num > svq->num_free) {
+                /*
+                 * Retry when the device uses buffers.  Guest kicks are
+                 * useless until then, so keep them disabled.
+                 */
+                svq->next_guest_avail_elem = elem;
+                goto out;
+            }
+
+            trace_vhost_svq_add(svq, elem->index, elem->out_num,
+                                elem->in_num);
+            vhost_svq_add(svq, elem);
+            added = true;
+        }
+
+        virtio_queue_set_notification(svq->vq, true);
+    } while (!virtio_queue_empty(svq->vq));
+
+out:
+    if (added) {
+        event_notifier_set(&svq->hdev_kick);
+    }
+}
+
+static void vhost_svq_handle_kick(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    event_notifier_test_and_clear(n);
+    vhost_svq_forward_avail(svq);
+}
+
+static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
+{
+    return svq->last_used_idx != le16_to_cpu(svq->vring.used->idx);
+}
+
+static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
+                                           uint32_t *len)
+{
+    struct vring_desc *desc = svq->vring.desc;
+    const struct vring_used_elem *used_elem;
+    VirtQueueElement *elem;
+    uint32_t id;
+    uint16_t last;
+    unsigned int i;
+
+    if (!vhost_svq_more_used(svq)) {
+        return NULL;
+    }
+
+    /* Read the used entry only after its index */
+    smp_rmb();
+    used_elem = &svq->vring.used->ring[svq->last_used_idx % svq->vring.num];
+    id = le32_to_cpu(used_elem->id);
+    *len = le32_to_cpu(used_elem->len);
+    svq->last_used_idx++;
+
+    if (id >= svq->vring.num || !svq->ring_id_maps[id]) {
+        error_report("Device used invalid shadow descriptor %u", id);
+        return NULL;
+    }
+
+    elem = svq->ring_id_maps[id];
+    svq->ring_id_maps[id] = NULL;
+
+    last = id;
+    for (i = 1; i < elem->out_num + elem->in_num; i++) {
+        last = le16_to_cpu(desc[last].next);
+    }
+    desc[last].next = cpu_to_le16(svq->free_head);
+    svq->free_head = id;
+    svq->num_free += elem->out_num + elem->in_num;
+
+    return elem;
+}
+
+/* Return the buffers the device used to the guest */
+static void vhost_svq_flush(VhostShadowVirtqueue *svq)
+{
+    VirtQueueElement *elem;
+    unsigned int i;
+    uint32_t len;
+
+    do {
+        for (i = 0; (elem = vhost_svq_get_buf(svq, &len)); i++) {
+            virtqueue_fill(svq->vq, elem, len, i);
+            g_free(elem);
+        }
+        if (!i) {
+            break;
+        }
+        virtqueue_flush(svq->vq, i);
+        trace_vhost_svq_flush(svq, i);
+        if (virtio_queue_should_notify(svq->vdev, svq->vq)) {
+            event_notifier_set(&svq->svq_call);
+        }
+
+        if (svq->started && svq->next_guest_avail_elem) {
+            vhost_svq_forward_avail(svq);
+        }
+
+        /* With EVENT_IDX, ask for a call after the next used buffer */
+        vring_used_event(&svq->vring) = cpu_to_le16(svq->last_used_idx);
+        smp_mb();
+    } while (vhost_svq_more_used(svq));
+}
+
+static void vhost_svq_handle_call(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    event_notifier_test_and_clear(n);
+    vhost_svq_flush(svq);
+}
+
+/*
+ * Start forwarding between @vq and the device, which must have been given
+ * the shadow ring and notifiers and be running.
+ */
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq)
+{
+    assert(!svq->started);
+    svq->vdev = vdev;
+    svq->vq = vq;
+    svq->started = true;
+
+    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    if (event_notifier_get_fd(&svq->svq_kick) >= 0) {
+        event_notifier_set_handler(&svq->svq_kick, vhost_svq_handle_kick);
+    }
+
+    /* The guest may have made buffers available before */
+    vhost_svq_forward_avail(svq);
+}
+
+/*
+ * Stop forwarding.  The device must be reset already: the buffers it did
+ * not use are returned to the guest as used with a length of 0, so that
+ * none of them is made available twice.
+ */
+void vhost_svq_stop(VhostShadowVirtqueue *svq)
+{
+    unsigned int i, n = 0;
+
+    if (!svq->started) {
+        return;
+    }
+    svq->started = false;
+
+    if (event_notifier_get_fd(&svq->svq_kick) >= 0) {
+        event_notifier_set_handler(&svq->svq_kick, NULL);
+    }
+    event_notifier_set_handler(&svq->hdev_call, NULL);
+    event_notifier_test_and_clear(&svq->hdev_call);
+
+    vhost_svq_flush(svq);
+
+    if (svq->next_guest_avail_elem) {
+        virtqueue_unpop(svq->vq, svq->next_guest_avail_elem, 0);
+        g_free(svq->next_guest_avail_elem);
+        svq->next_guest_avail_elem = NULL;
+    }
+
+    for (i = 0; i < svq->vring.num; i++) {
+        VirtQueueElement *elem = svq->ring_id_maps[i];
+
+        if (elem) {
+            virtqueue_fill(svq->vq, elem, 0, n++);
+            g_free(elem);
+            svq->ring_id_maps[i] = NULL;
+        }
+    }
+    if (n) {
+        virtqueue_flush(svq->vq, n);
+        if (virtio_queue_should_notify(svq->vdev, svq->vq)) {
+            event_notifier_set(&svq->svq_call);
+        }
+    }
+    trace_vhost_svq_stop(svq, n);
+
+    svq->vdev = NULL;
+    svq->vq = NULL;
+}
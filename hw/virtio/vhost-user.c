@@ -650,12 +650,12 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
         for (j = 0; j < dev->mem->nregions; j++) {
             reg = &dev->mem->regions[j];
 
-            mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
-
             if (reg_equal(shadow_reg, reg)) {
                 matching = true;
                 found[j] = true;
                 if (track_ramblocks) {
+                    mr = vhost_user_get_mr_data(reg->userspace_addr,
+                                                &offset, &fd);
                     /*
                      * Reset postcopy client bases, region_rb, and
                      * region_rb_offset in case regions are removed.
@@ -888,11 +888,22 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
     uint64_t shadow_pcb[VHOST_USER_MAX_RAM_SLOTS] = {};
     int nr_add_reg, nr_rem_reg;
 
+    /*
+     * Like VHOST_USER_SET_MEM_TABLE, the memory table is shared by all the
+     * queue pairs of the backend, so only the first vhost_dev updates it.
+     * Postcopy keeps per-device client bases and still talks to each one.
+     */
+    if (dev->vq_index != 0 && !track_ramblocks) {
+        return 0;
+    }
+
     msg->hdr.size = sizeof(msg->payload.mem_reg);
 
     /* Find the regions which need to be removed or added. */
     scrub_shadow_regions(dev, add_reg, &nr_add_reg, rem_reg, &nr_rem_reg,
                          shadow_pcb, track_ramblocks);
+    trace_vhost_user_add_remove_regions(dev->mem->nregions, nr_add_reg,
+                                        nr_rem_reg);
 
     if (nr_rem_reg && send_remove_regions(dev, rem_reg, nr_rem_reg, msg,
                 reply_supported) < 0)
@@ -1863,29 +1874,49 @@ static int vhost_user_postcopy_notifier(NotifierWithReturn *notifier,
 static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
                                    Error **errp)
 {
-    uint64_t features, protocol_features, ram_slots;
+    uint64_t features, protocol_features = 0, ram_slots;
     struct vhost_user *u;
+    VhostUserState *user = opaque;
+    bool cached;
     int err;
 
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
     u = g_new0(struct vhost_user, 1);
-    u->user = opaque;
+    u->user = user;
     u->dev = dev;
     dev->opaque = u;
 
-    err = vhost_user_get_features(dev, &features);
-    if (err < 0) {
-        return err;
+    /*
+     * The queue pairs of a multiqueue device share the connection, so
+     * only the first one needs to negotiate with the backend.  This
+     * saves several round trips per queue pair when a backend restarts.
+     */
+    cached = dev->vq_index != 0 && user->features_valid;
+    if (dev->vq_index == 0) {
+        user->features_valid = false;
+    }
+
+    if (cached) {
+        features = user->features;
+    } else {
+        err = vhost_user_get_features(dev, &features);
+        if (err < 0) {
+            return err;
+        }
     }
 
     if (virtio_has_feature(features, VHOST_USER_F_PROTOCOL_FEATURES)) {
         dev->backend_features |= 1ULL << VHOST_USER_F_PROTOCOL_FEATURES;
 
-        err = vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
-                                 &protocol_features);
-        if (err < 0) {
-            return -EPROTO;
+        if (cached) {
+            protocol_features = user->protocol_features;
+        } else {
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
+                                     &protocol_features);
+            if (err < 0) {
+                return -EPROTO;
+            }
         }
 
         dev->protocol_features =
@@ -1901,9 +1932,13 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
             return -EINVAL;
         }
 
-        err = vhost_user_set_protocol_features(dev, dev->protocol_features);
-        if (err < 0) {
-            return -EPROTO;
+        if (!cached ||
+            dev->protocol_features != user->acked_protocol_features) {
+            err = vhost_user_set_protocol_features(dev,
+                                                   dev->protocol_features);
+            if (err < 0) {
+                return -EPROTO;
+            }
         }
 
         /* query the max queues we support if backend supports Multiple Queue */
@@ -1934,7 +1969,7 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
         if (!virtio_has_feature(dev->protocol_features,
                                 VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
             u->user->memory_slots = VHOST_MEMORY_BASELINE_NREGIONS;
-        } else {
+        } else if (!cached) {
             err = vhost_user_get_max_memslots(dev, &ram_slots);
             if (err < 0) {
                 return -EPROTO;
@@ -1970,6 +2005,13 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
     u->postcopy_notifier.notify = vhost_user_postcopy_notifier;
     postcopy_add_notifier(&u->postcopy_notifier);
 
+    if (dev->vq_index == 0) {
+        user->features = features;
+        user->protocol_features = protocol_features;
+        user->acked_protocol_features = dev->protocol_features;
+        user->features_valid = true;
+    }
+
     return 0;
 }
 
@@ -2401,6 +2443,7 @@ bool vhost_user_init(VhostUserState *user, CharBackend *chr, Error **errp)
     }
     user->chr = chr;
     user->memory_slots = 0;
+    user->features_valid = false;
     return true;
 }
 
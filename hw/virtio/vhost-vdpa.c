@@ -19,6 +19,7 @@
 #include "hw/virtio/virtio-net.h"
 #include "hw/virtio/vhost-vdpa.h"
 #include "exec/address-spaces.h"
+#include "qapi/error.h"
 #include "qemu/main-loop.h"
 #include "cpu.h"
 #include "trace.h"
@@ -267,6 +268,55 @@ static void vhost_vdpa_add_status(struct vhost_dev *dev, uint8_t status)
     vhost_vdpa_call(dev, VHOST_VDPA_SET_STATUS, &s);
 }
 
+static void vhost_vdpa_get_iova_range(struct vhost_vdpa *v)
+{
+    int ret = vhost_vdpa_call(v->dev, VHOST_VDPA_GET_IOVA_RANGE,
+                              &v->iova_range);
+
+    if (ret != 0) {
+        v->iova_range.first = 0;
+        v->iova_range.last = UINT64_MAX;
+    }
+    trace_vhost_vdpa_get_iova_range(v->dev, v->iova_range.first,
+                                    v->iova_range.last);
+}
+
+/*
+ * The shadow rings are mapped at the top of the IOVA range of the device,
+ * out of the way of guest memory, which the device sees at its guest
+ * physical address.
+ */
+static int vhost_vdpa_init_svq(struct vhost_dev *dev, struct vhost_vdpa *v,
+                               Error **errp)
+{
+    uint64_t iova = v->iova_range.last + 1;
+    int i;
+
+    v->shadow_vqs = g_ptr_array_new_full(dev->nvqs,
+                                         (GDestroyNotify)vhost_svq_free);
+    for (i = 0; i < dev->nvqs; i++) {
+        VhostShadowVirtqueue *svq = vhost_svq_new();
+
+        if (!svq) {
+            error_setg(errp, "Cannot create shadow virtqueue");
+            return -1;
+        }
+        g_ptr_array_add(v->shadow_vqs, svq);
+
+        if (v->iova_range.last - v->iova_range.first <
+            (uint64_t)(i + 1) * svq->ring_size) {
+            error_setg(errp, "No room for shadow virtqueues in the IOVA range "
+                       "of the device");
+            return -1;
+        }
+        iova = QEMU_ALIGN_DOWN(iova - svq->ring_size,
+                               qemu_real_host_page_size);
+        svq->iova = iova;
+    }
+
+    return 0;
+}
+
 static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
 {
     struct vhost_vdpa *v;
@@ -279,12 +329,45 @@ static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
     v->listener = vhost_vdpa_memory_listener;
     v->msg_type = VHOST_IOTLB_MSG_V2;
 
+    if (v->shadow_vqs_allowed) {
+        vhost_vdpa_get_iova_range(v);
+        if (vhost_vdpa_init_svq(dev, v, errp) < 0) {
+            g_ptr_array_free(v->shadow_vqs, true);
+            v->shadow_vqs = NULL;
+            return -1;
+        }
+    }
+
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
 
     return 0;
 }
 
+/*
+ * With shadow virtqueues, vhost sets the features and vring addresses of
+ * a running device again to toggle the dirty log, which only QEMU keeps.
+ */
+static bool vhost_vdpa_running(struct vhost_dev *dev)
+{
+    uint8_t status = 0;
+
+    vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
+    return status & VIRTIO_CONFIG_S_DRIVER_OK;
+}
+
+/* The shadow virtqueue for vhost index @index, if they are in use */
+static VhostShadowVirtqueue *vhost_vdpa_get_svq(struct vhost_dev *dev,
+                                                unsigned int index)
+{
+    struct vhost_vdpa *v = dev->opaque;
+
+    if (!v->shadow_vqs_enabled) {
+        return NULL;
+    }
+    return g_ptr_array_index(v->shadow_vqs, index);
+}
+
 static void vhost_vdpa_host_notifier_uninit(struct vhost_dev *dev,
                                             int queue_index)
 {
@@ -375,6 +458,10 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
     trace_vhost_vdpa_cleanup(dev, v);
     vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
     memory_listener_unregister(&v->listener);
+    if (v->shadow_vqs) {
+        g_ptr_array_free(v->shadow_vqs, true);
+        v->shadow_vqs = NULL;
+    }
 
     dev->opaque = NULL;
     return 0;
@@ -411,7 +498,16 @@ static int vhost_vdpa_set_mem_table(struct vhost_dev *dev,
 static int vhost_vdpa_set_features(struct vhost_dev *dev,
                                    uint64_t features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
+
+    if (v->shadow_vqs) {
+        /* see vhost_vdpa_get_features() */
+        features &= ~BIT_ULL(VHOST_F_LOG_ALL);
+        if (vhost_vdpa_running(dev)) {
+            return 0;
+        }
+    }
     trace_vhost_vdpa_set_features(dev, features);
     ret = vhost_vdpa_call(dev, VHOST_SET_FEATURES, &features);
     uint8_t status = 0;
@@ -543,6 +639,48 @@ static int vhost_vdpa_get_config(struct vhost_dev *dev, uint8_t *config,
     return ret;
  }
 
+static int vhost_vdpa_svqs_map(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int i, r;
+
+    for (i = 0; i < dev->nvqs; i++) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
+
+        r = vhost_vdpa_dma_map(v, svq->iova, svq->ring_size, svq->ring,
+                               false);
+        if (r) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+static void vhost_vdpa_svqs_start(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int i;
+
+    for (i = 0; i < dev->nvqs; i++) {
+        vhost_svq_start(g_ptr_array_index(v->shadow_vqs, i), dev->vdev,
+                        virtio_get_queue(dev->vdev, dev->vq_index + i));
+    }
+}
+
+/* The device is reset, so it does not access the shadow rings anymore */
+static void vhost_vdpa_svqs_stop(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int i;
+
+    for (i = 0; i < dev->nvqs; i++) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
+
+        vhost_svq_stop(svq);
+        vhost_vdpa_dma_unmap(v, svq->iova, svq->ring_size);
+    }
+}
+
 static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
 {
     struct vhost_vdpa *v = dev->opaque;
@@ -550,14 +688,30 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
     if (started) {
         uint8_t status = 0;
         memory_listener_register(&v->listener, &address_space_memory);
-        vhost_vdpa_host_notifiers_init(dev);
+        if (v->shadow_vqs_enabled) {
+            /* the guest must not kick the device behind QEMU's back */
+            if (vhost_vdpa_svqs_map(dev)) {
+                return -1;
+            }
+        } else {
+            vhost_vdpa_host_notifiers_init(dev);
+        }
         vhost_vdpa_set_vring_ready(dev);
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
         vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
+        if (!(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+            return 1;
+        }
 
-        return !(status & VIRTIO_CONFIG_S_DRIVER_OK);
+        if (v->shadow_vqs_enabled) {
+            vhost_vdpa_svqs_start(dev);
+        }
+        return 0;
     } else {
         vhost_vdpa_reset_device(dev);
+        if (v->shadow_vqs_enabled) {
+            vhost_vdpa_svqs_stop(dev);
+        }
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                    VIRTIO_CONFIG_S_DRIVER);
         vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
@@ -570,6 +724,12 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
                                      struct vhost_log *log)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
+    if (v->shadow_vqs) {
+        /* QEMU logs the writes of the device, see vhost_svq_flush() */
+        return 0;
+    }
     trace_vhost_vdpa_set_log_base(dev, base, log->size, log->refcnt, log->fd,
                                   log->log);
     return vhost_vdpa_call(dev, VHOST_SET_LOG_BASE, &base);
@@ -578,6 +738,24 @@ static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
 static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
                                        struct vhost_vring_addr *addr)
 {
+    struct vhost_vdpa *v = dev->opaque;
+    VhostShadowVirtqueue *svq = vhost_vdpa_get_svq(dev, addr->index);
+
+    if (v->shadow_vqs && vhost_vdpa_running(dev)) {
+        return 0;
+    }
+    if (svq) {
+        struct vhost_vring_addr svq_addr = { .index = addr->index };
+        Error *local_err = NULL;
+
+        if (!vhost_svq_valid_features(dev->vdev, &local_err)) {
+            error_report_err(local_err);
+            return -ENOTSUP;
+        }
+        vhost_svq_get_vring_addr(svq, &svq_addr);
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_ADDR, &svq_addr);
+    }
+
     trace_vhost_vdpa_set_vring_addr(dev, addr->index, addr->flags,
                                     addr->desc_user_addr, addr->used_user_addr,
                                     addr->avail_user_addr,
@@ -588,7 +766,15 @@ static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
 static int vhost_vdpa_set_vring_num(struct vhost_dev *dev,
                                       struct vhost_vring_state *ring)
 {
+    VhostShadowVirtqueue *svq = vhost_vdpa_get_svq(dev, ring->index);
+
     trace_vhost_vdpa_set_vring_num(dev, ring->index, ring->num);
+    if (svq) {
+        if (ring->num > VIRTQUEUE_MAX_SIZE) {
+            return -EINVAL;
+        }
+        vhost_svq_set_num(svq, ring->num);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_NUM, ring);
 }
 
@@ -596,15 +782,27 @@ static int vhost_vdpa_set_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
     trace_vhost_vdpa_set_vring_base(dev, ring->index, ring->num);
+    if (vhost_vdpa_get_svq(dev, ring->index)) {
+        /* the shadow ring starts empty, QEMU tracks the guest's index */
+        struct vhost_vring_state svq_ring = { .index = ring->index };
+
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, &svq_ring);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, ring);
 }
 
 static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
-    int ret;
+    int ret = 0;
 
-    ret = vhost_vdpa_call(dev, VHOST_GET_VRING_BASE, ring);
+    if (vhost_vdpa_get_svq(dev, ring->index)) {
+        ring->num = virtio_queue_get_last_avail_idx(dev->vdev,
+                                                    dev->vq_index +
+                                                    ring->index);
+    } else {
+        ret = vhost_vdpa_call(dev, VHOST_GET_VRING_BASE, ring);
+    }
     trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
     return ret;
 }
@@ -612,23 +810,53 @@ static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
 static int vhost_vdpa_set_vring_kick(struct vhost_dev *dev,
                                        struct vhost_vring_file *file)
 {
+    VhostShadowVirtqueue *svq = vhost_vdpa_get_svq(dev, file->index);
+
     trace_vhost_vdpa_set_vring_kick(dev, file->index, file->fd);
+    if (svq) {
+        struct vhost_vring_file svq_file = {
+            .index = file->index,
+            .fd = event_notifier_get_fd(&svq->hdev_kick),
+        };
+
+        vhost_svq_set_guest_kick_fd(svq, file->fd);
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, &svq_file);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, file);
 }
 
 static int vhost_vdpa_set_vring_call(struct vhost_dev *dev,
                                        struct vhost_vring_file *file)
 {
+    VhostShadowVirtqueue *svq = vhost_vdpa_get_svq(dev, file->index);
+
     trace_vhost_vdpa_set_vring_call(dev, file->index, file->fd);
+    if (svq) {
+        struct vhost_vring_file svq_file = {
+            .index = file->index,
+            .fd = event_notifier_get_fd(&svq->hdev_call),
+        };
+
+        vhost_svq_set_guest_call_fd(svq, file->fd);
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, &svq_file);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, file);
 }
 
 static int vhost_vdpa_get_features(struct vhost_dev *dev,
                                      uint64_t *features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
     ret = vhost_vdpa_call(dev, VHOST_GET_FEATURES, features);
+    if (ret == 0 && v->shadow_vqs) {
+        /*
+         * The device cannot log its writes, but the shadow virtqueues
+         * that replace its rings while migrating do it for it.
+         */
+        *features |= BIT_ULL(VHOST_F_LOG_ALL);
+    }
     trace_vhost_vdpa_get_features(dev, *features);
     return ret;
 }
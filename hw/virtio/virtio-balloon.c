@@ -30,6 +30,8 @@
 #include "trace.h"
 #include "qemu/error-report.h"
 #include "migration/misc.h"
+#include "block/thread-pool.h"
+#include "qemu/main-loop.h"
 
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
@@ -324,14 +326,170 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/* A free page report taken from the guest, within a RAMBlock */
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+    uint8_t *host;
+} BalloonReportRange;
+
+/*
+ * The elements popped from the reporting queue in one go, discarded by a
+ * worker thread.  The elements keep the memory mapped, and are only given
+ * back to the guest once the discard is done.
+ */
+typedef struct BalloonReportBatch {
+    VirtIOBalloon *dev;
+    GPtrArray *elems;
+    GArray *ranges;
+} BalloonReportBatch;
+
+static gint balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Discard the host pages fully covered by @r.  On success, @r is updated to
+ * the range discarded.
+ */
+static bool balloon_report_discard_range(BalloonReportRange *r)
+{
+    size_t pagesize = qemu_ram_pagesize(r->rb);
+    ram_addr_t start = ROUND_UP(r->offset, pagesize);
+    ram_addr_t end = QEMU_ALIGN_DOWN(r->offset + r->size, pagesize);
+
+    if (start >= end || virtio_balloon_inhibited()) {
+        return false;
+    }
+    if (ram_block_discard_range(r->rb, start, end - start)) {
+        return false;
+    }
+
+    r->host += start - r->offset;
+    r->offset = start;
+    r->size = end - start;
+    return true;
+}
+
+/*
+ * Runs in a worker thread.  Reports are usually smaller than a huge page,
+ * so the ones that are adjacent in a RAMBlock are merged before aligning
+ * them to the host page size.  Only the ranges discarded are kept.
+ */
+static int virtio_balloon_report_discard(void *opaque)
+{
+    BalloonReportBatch *batch = opaque;
+    GArray *ranges = batch->ranges;
+    BalloonReportRange cur;
+    guint i, n = 0;
+
+    g_array_sort(ranges, balloon_report_range_cmp);
+    cur = g_array_index(ranges, BalloonReportRange, 0);
+    for (i = 1; i <= ranges->len; i++) {
+        BalloonReportRange *r = NULL;
+
+        if (i < ranges->len) {
+            r = &g_array_index(ranges, BalloonReportRange, i);
+            if (r->rb == cur.rb && r->offset <= cur.offset + cur.size) {
+                cur.size = MAX(cur.offset + cur.size,
+                               r->offset + r->size) - cur.offset;
+                continue;
+            }
+        }
+        if (balloon_report_discard_range(&cur)) {
+            g_array_index(ranges, BalloonReportRange, n++) = cur;
+        }
+        if (r) {
+            cur = *r;
+        }
+    }
+    g_array_set_size(ranges, n);
+
+    return 0;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_complete(void *opaque, int ret)
+{
+    BalloonReportBatch *batch = opaque;
+    VirtIOBalloon *dev = batch->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    guint i;
+
+    for (i = 0; i < batch->ranges->len; i++) {
+        BalloonReportRange *r = &g_array_index(batch->ranges,
+                                               BalloonReportRange, i);
+
+        trace_virtio_balloon_report_discard(dev, r->offset, r->size);
+        /*
+         * Reported pages stay unused until we return the element, and
+         * the guest dirties them again when it reuses them.  Unless it
+         * expects them to be zeroed (page poisoning with value 0), the
+         * content the destination has for them is as good as the zero
+         * page left by the discard, so stop migrating them.
+         */
+        if (!virtio_vdev_has_feature(vdev, VIRTIO_BALLOON_F_PAGE_POISON)) {
+            qemu_guest_free_page_hint(r->host, r->size);
+        }
+    }
+
+    for (i = 0; i < batch->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(batch->elems, i);
+
+        virtqueue_push(dev->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    virtio_notify(vdev, dev->reporting_vq);
+
+    g_ptr_array_free(batch->elems, true);
+    g_array_free(batch->ranges, true);
+    g_free(batch);
+
+    if (dev->report_inflight) {
+        /* Pick up the reports queued in the meantime */
+        dev->report_inflight = false;
+        virtio_balloon_handle_report(vdev, dev->reporting_vq);
+    }
+}
+
+static void virtio_balloon_report_drain(VirtIOBalloon *dev)
+{
+    while (dev->report_inflight) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    BalloonReportBatch *batch;
     VirtQueueElement *elem;
 
+    if (dev->report_inflight) {
+        return;
+    }
+
+    batch = g_new0(BalloonReportBatch, 1);
+    batch->dev = dev;
+    batch->elems = g_ptr_array_new();
+    batch->ranges = g_array_new(false, false, sizeof(BalloonReportRange));
+
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(batch->elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
@@ -340,14 +498,11 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * expecting it to retain a non-zero value.
          */
         if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
-            void *addr = elem->in_sg[i].iov_base;
-            size_t size = elem->in_sg[i].iov_len;
-            ram_addr_t ram_offset;
-            RAMBlock *rb;
+            BalloonReportRange r;
 
             /*
              * There is no need to check the memory section to see if
@@ -360,29 +515,39 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * will return NULL after the first bounce buffer and fail
              * to map any resources.
              */
-            rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-            if (!rb) {
+            r.host = elem->in_sg[i].iov_base;
+            r.size = elem->in_sg[i].iov_len;
+            r.rb = qemu_ram_block_from_host(r.host, false, &r.offset);
+            if (!r.rb) {
                 trace_virtio_balloon_bad_addr(elem->in_addr[i]);
                 continue;
             }
 
-            /*
-             * For now we will simply ignore unaligned memory regions, or
-             * regions that overrun the end of the RAMBlock.
-             */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
+            /* Ignore regions that overrun the end of the RAMBlock */
+            if ((r.offset + r.size) > qemu_ram_get_used_length(r.rb)) {
                 continue;
             }
-
-            ram_block_discard_range(rb, ram_offset, size);
+            g_array_append_val(batch->ranges, r);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!batch->elems->len) {
+        g_ptr_array_free(batch->elems, true);
+        g_array_free(batch->ranges, true);
+        g_free(batch);
+        return;
     }
+    trace_virtio_balloon_report_batch(dev, batch->elems->len,
+                                      batch->ranges->len);
+    if (!batch->ranges->len) {
+        virtio_balloon_report_complete(batch, 0);
+        return;
+    }
+
+    dev->report_inflight = true;
+    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+                           virtio_balloon_report_discard, batch,
+                           virtio_balloon_report_complete, batch);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -860,10 +1025,20 @@ static const VMStateDescription vmstate_virtio_balloon_page_poison = {
     }
 };
 
+static int virtio_balloon_pre_save_device(void *opaque)
+{
+    VirtIOBalloon *s = VIRTIO_BALLOON(opaque);
+
+    /* Reports in flight are not migrated, hand them back to the guest */
+    virtio_balloon_report_drain(s);
+    return 0;
+}
+
 static const VMStateDescription vmstate_virtio_balloon_device = {
     .name = "virtio-balloon-device",
     .version_id = 1,
     .minimum_version_id = 1,
+    .pre_save = virtio_balloon_pre_save_device,
     .post_load = virtio_balloon_post_load_device,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32(num_pages, VirtIOBalloon),
@@ -930,6 +1105,7 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
+    virtio_balloon_report_drain(s);
     if (s->free_page_bh) {
         qemu_bh_delete(s->free_page_bh);
         object_unref(OBJECT(s->iothread));
@@ -955,6 +1131,8 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
 
+    virtio_balloon_report_drain(s);
+
     if (virtio_balloon_free_page_support(s)) {
         virtio_balloon_free_page_stop(s);
     }
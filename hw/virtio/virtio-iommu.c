@@ -25,6 +25,7 @@
 #include "hw/virtio/virtio.h"
 #include "sysemu/kvm.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 
@@ -44,6 +45,11 @@ typedef struct VirtIOIOMMUDomain {
     uint32_t id;
     GTree *mappings;
     QLIST_HEAD(, VirtIOIOMMUEndpoint) endpoint_list;
+    /* Statistics, exported through the "domain-stats" property */
+    uint64_t map_requests;
+    uint64_t unmap_requests;
+    uint64_t map_notifications;
+    uint64_t unmap_notifications;
 } VirtIOIOMMUDomain;
 
 typedef struct VirtIOIOMMUEndpoint {
@@ -436,6 +442,8 @@ static int virtio_iommu_map(VirtIOIOMMU *s,
     mapping->flags = flags;
 
     g_tree_insert(domain->mappings, interval, mapping);
+    domain->map_requests++;
+    domain->map_notifications++;
 
     QLIST_FOREACH(ep, &domain->endpoint_list, next) {
         virtio_iommu_notify_map(ep->iommu_mr, virt_start, virt_end, phys_start,
@@ -445,6 +453,52 @@ static int virtio_iommu_map(VirtIOIOMMU *s,
     return VIRTIO_IOMMU_S_OK;
 }
 
+/* Must be called with the mutex held */
+static void virtio_iommu_flush_unmap(VirtIOIOMMU *s)
+{
+    VirtIOIOMMUDomain *domain = s->pending_unmap_domain;
+    VirtIOIOMMUEndpoint *ep;
+
+    if (!domain) {
+        return;
+    }
+
+    QLIST_FOREACH(ep, &domain->endpoint_list, next) {
+        virtio_iommu_notify_unmap(ep->iommu_mr, s->pending_unmap_low,
+                                  s->pending_unmap_high);
+    }
+    domain->unmap_notifications++;
+    s->pending_unmap_domain = NULL;
+}
+
+/*
+ * Queue the UNMAP notification for a removed mapping, merging it with
+ * the pending one if the two ranges are adjacent.  VFIO can then remove
+ * a run of small mappings with a few ioctls.  Merging MAP notifications
+ * would not be safe, because VFIO refuses to unmap part of a mapping.
+ *
+ * Must be called with the mutex held.
+ */
+static void virtio_iommu_queue_unmap(VirtIOIOMMU *s, VirtIOIOMMUDomain *domain,
+                                     uint64_t low, uint64_t high)
+{
+    if (s->pending_unmap_domain == domain) {
+        if (low == s->pending_unmap_high + 1) {
+            s->pending_unmap_high = high;
+            return;
+        }
+        if (high + 1 == s->pending_unmap_low) {
+            s->pending_unmap_low = low;
+            return;
+        }
+    }
+
+    virtio_iommu_flush_unmap(s);
+    s->pending_unmap_domain = domain;
+    s->pending_unmap_low = low;
+    s->pending_unmap_high = high;
+}
+
 static int virtio_iommu_unmap(VirtIOIOMMU *s,
                               struct virtio_iommu_req_unmap *req)
 {
@@ -454,7 +508,6 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
     VirtIOIOMMUMapping *iter_val;
     VirtIOIOMMUInterval interval, *iter_key;
     VirtIOIOMMUDomain *domain;
-    VirtIOIOMMUEndpoint *ep;
     int ret = VIRTIO_IOMMU_S_OK;
 
     trace_virtio_iommu_unmap(domain_id, virt_start, virt_end);
@@ -463,6 +516,7 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
     if (!domain) {
         return VIRTIO_IOMMU_S_NOENT;
     }
+    domain->unmap_requests++;
     interval.low = virt_start;
     interval.high = virt_end;
 
@@ -472,10 +526,7 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
         uint64_t current_high = iter_key->high;
 
         if (interval.low <= current_low && interval.high >= current_high) {
-            QLIST_FOREACH(ep, &domain->endpoint_list, next) {
-                virtio_iommu_notify_unmap(ep->iommu_mr, current_low,
-                                          current_high);
-            }
+            virtio_iommu_queue_unmap(s, domain, current_low, current_high);
             g_tree_remove(domain->mappings, iter_key);
             trace_virtio_iommu_unmap_done(domain_id, current_low, current_high);
         } else {
@@ -585,23 +636,59 @@ static int virtio_iommu_handle_probe(VirtIOIOMMU *s,
     return ret ? ret : virtio_iommu_probe(s, &req, buf);
 }
 
+/*
+ * Complete a batch of requests.  Their UNMAP notifications must be sent
+ * before the driver can see them as used, because it may reuse the
+ * IOVAs as soon as it does.
+ */
+static void virtio_iommu_complete_batch(VirtIOIOMMU *s, VirtQueue *vq,
+                                        VirtQueueElement **elems,
+                                        unsigned int *lens, unsigned int nr)
+{
+    unsigned int i;
+
+    qemu_mutex_lock(&s->mutex);
+    virtio_iommu_flush_unmap(s);
+    qemu_mutex_unlock(&s->mutex);
+
+    if (!nr) {
+        return;
+    }
+
+    trace_virtio_iommu_complete_batch(nr);
+    for (i = 0; i < nr; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+        g_free(elems[i]);
+    }
+    virtqueue_flush(vq, nr);
+    virtio_notify(VIRTIO_DEVICE(s), vq);
+}
+
 static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOIOMMU *s = VIRTIO_IOMMU(vdev);
+    VirtQueueElement *elems[VIOMMU_DEFAULT_QUEUE_SIZE];
+    unsigned int lens[VIOMMU_DEFAULT_QUEUE_SIZE];
+    unsigned int nr = 0;
     struct virtio_iommu_req_head head;
-    struct virtio_iommu_req_tail tail = {};
-    size_t output_size = sizeof(tail), sz;
+    struct virtio_iommu_req_tail tail;
+    size_t output_size, sz;
     VirtQueueElement *elem;
     unsigned int iov_cnt;
     struct iovec *iov;
-    void *buf = NULL;
+    void *buf;
 
+    /* All requests available after a kick are completed together */
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
+        memset(&tail, 0, sizeof(tail));
+        output_size = sizeof(tail);
+        buf = NULL;
+
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
             iov_size(elem->out_sg, elem->out_num) < sizeof(head)) {
             virtio_error(vdev, "virtio-iommu bad head/tail size");
@@ -618,6 +705,9 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
             goto out;
         }
         qemu_mutex_lock(&s->mutex);
+        if (head.type != VIRTIO_IOMMU_T_UNMAP) {
+            virtio_iommu_flush_unmap(s);
+        }
         switch (head.type) {
         case VIRTIO_IOMMU_T_ATTACH:
             tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
@@ -652,12 +742,17 @@ out:
         sz = iov_from_buf(elem->in_sg, elem->in_num, 0,
                           buf ? buf : &tail, output_size);
         assert(sz == output_size);
-
-        virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
-        g_free(elem);
         g_free(buf);
+
+        elems[nr] = elem;
+        lens[nr] = sz;
+        if (++nr == ARRAY_SIZE(elems)) {
+            virtio_iommu_complete_batch(s, vq, elems, lens, nr);
+            nr = 0;
+        }
     }
+
+    virtio_iommu_complete_batch(s, vq, elems, lens, nr);
 }
 
 static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
@@ -1049,8 +1144,63 @@ static void virtio_iommu_set_status(VirtIODevice *vdev, uint8_t status)
     trace_virtio_iommu_device_status(status);
 }
 
+typedef struct VirtIOIOMMUStatsVisit {
+    Visitor *v;
+    Error *err;
+} VirtIOIOMMUStatsVisit;
+
+static gboolean virtio_iommu_visit_domain_stats(gpointer key, gpointer value,
+                                                gpointer data)
+{
+    VirtIOIOMMUDomain *domain = value;
+    VirtIOIOMMUStatsVisit *visit = data;
+    Visitor *v = visit->v;
+    g_autofree char *name = g_strdup_printf("%" PRIu32, domain->id);
+
+    if (!visit_start_struct(v, name, NULL, 0, &visit->err)) {
+        return true;
+    }
+    if (visit_type_uint64(v, "map-requests", &domain->map_requests,
+                          &visit->err) &&
+        visit_type_uint64(v, "unmap-requests", &domain->unmap_requests,
+                          &visit->err) &&
+        visit_type_uint64(v, "map-notifications", &domain->map_notifications,
+                          &visit->err) &&
+        visit_type_uint64(v, "unmap-notifications",
+                          &domain->unmap_notifications, &visit->err)) {
+        visit_check_struct(v, &visit->err);
+    }
+    visit_end_struct(v, NULL);
+    return visit->err != NULL;
+}
+
+static void virtio_iommu_get_domain_stats(Object *obj, Visitor *v,
+                                          const char *name, void *opaque,
+                                          Error **errp)
+{
+    VirtIOIOMMU *s = VIRTIO_IOMMU(obj);
+    VirtIOIOMMUStatsVisit visit = { .v = v };
+
+    if (!visit_start_struct(v, name, NULL, 0, &visit.err)) {
+        goto out;
+    }
+    qemu_mutex_lock(&s->mutex);
+    if (s->domains) {
+        g_tree_foreach(s->domains, virtio_iommu_visit_domain_stats, &visit);
+    }
+    qemu_mutex_unlock(&s->mutex);
+    if (!visit.err) {
+        visit_check_struct(v, &visit.err);
+    }
+    visit_end_struct(v, NULL);
+out:
+    error_propagate(errp, visit.err);
+}
+
 static void virtio_iommu_instance_init(Object *obj)
 {
+    object_property_add(obj, "domain-stats", "domain statistics",
+                        virtio_iommu_get_domain_stats, NULL, NULL, NULL);
 }
 
 #define VMSTATE_INTERVAL                               \
@@ -174,17 +174,20 @@ static void virtio_mem_set_bitmap(VirtIOMEM *vmem, uint64_t start_gpa,
     }
 }
 
-static void virtio_mem_send_response(VirtIOMEM *vmem, VirtQueueElement *elem,
+static void virtio_mem_push_response(VirtIOMEM *vmem, VirtQueueElement *elem,
                                      struct virtio_mem_resp *resp)
 {
-    VirtIODevice *vdev = VIRTIO_DEVICE(vmem);
-    VirtQueue *vq = vmem->vq;
-
     trace_virtio_mem_send_response(le16_to_cpu(resp->type));
     iov_from_buf(elem->in_sg, elem->in_num, 0, resp, sizeof(*resp));
 
-    virtqueue_push(vq, elem, sizeof(*resp));
-    virtio_notify(vdev, vq);
+    virtqueue_push(vmem->vq, elem, sizeof(*resp));
+}
+
+static void virtio_mem_send_response(VirtIOMEM *vmem, VirtQueueElement *elem,
+                                     struct virtio_mem_resp *resp)
+{
+    virtio_mem_push_response(vmem, elem, resp);
+    virtio_notify(VIRTIO_DEVICE(vmem), vmem->vq);
 }
 
 static void virtio_mem_send_response_simple(VirtIOMEM *vmem,
@@ -281,16 +284,94 @@ static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
     virtio_mem_send_response_simple(vmem, elem, type);
 }
 
-static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
+/*
+ * Guests unplug memory with a stream of requests for adjacent ranges,
+ * usually walking down from the end of the device.  Unplug requests that
+ * follow each other and cover adjacent ranges are batched: the bitmap and
+ * size are updated right away, while the range is discarded with a single
+ * call once the batch ends, after which all its requests are answered and
+ * the guest is notified once.  A batch ends before any other request is
+ * processed, so nothing can observe or replug a range before the discard.
+ */
+typedef struct VirtIOMEMUnplugBatch {
+    uint64_t gpa;
+    uint64_t size;
+    GPtrArray *elems;
+} VirtIOMEMUnplugBatch;
+
+static void virtio_mem_unplug_batch_flush(VirtIOMEM *vmem,
+                                          VirtIOMEMUnplugBatch *batch)
+{
+    struct virtio_mem_resp resp = {
+        .type = cpu_to_le16(VIRTIO_MEM_RESP_ACK),
+    };
+    guint i;
+    int ret;
+
+    if (!batch->elems->len) {
+        return;
+    }
+
+    trace_virtio_mem_unplug_batch(batch->gpa, batch->size, batch->elems->len);
+    ret = ram_block_discard_range(vmem->memdev->mr.ram_block,
+                                  batch->gpa - vmem->addr, batch->size);
+    if (ret) {
+        error_report("Unexpected error discarding RAM: %s", strerror(-ret));
+        virtio_mem_set_bitmap(vmem, batch->gpa, batch->size, true);
+        vmem->size += batch->size;
+        resp.type = cpu_to_le16(VIRTIO_MEM_RESP_BUSY);
+    } else {
+        notifier_list_notify(&vmem->size_change_notifiers, &vmem->size);
+    }
+
+    for (i = 0; i < batch->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(batch->elems, i);
+
+        virtio_mem_push_response(vmem, elem, &resp);
+        g_free(elem);
+    }
+    virtio_notify(VIRTIO_DEVICE(vmem), vmem->vq);
+
+    g_ptr_array_set_size(batch->elems, 0);
+    batch->size = 0;
+}
+
+/* Returns true if @elem was added to @batch, which then owns it. */
+static bool virtio_mem_unplug_request(VirtIOMEM *vmem,
+                                      VirtIOMEMUnplugBatch *batch,
+                                      VirtQueueElement *elem,
                                       struct virtio_mem_req *req)
 {
     const uint64_t gpa = le64_to_cpu(req->u.unplug.addr);
     const uint16_t nb_blocks = le16_to_cpu(req->u.unplug.nb_blocks);
-    uint16_t type;
+    const uint64_t size = nb_blocks * vmem->block_size;
+    uint16_t type = VIRTIO_MEM_RESP_ERROR;
 
     trace_virtio_mem_unplug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, false);
+    if (batch->size && gpa + size != batch->gpa &&
+        batch->gpa + batch->size != gpa) {
+        virtio_mem_unplug_batch_flush(vmem, batch);
+    }
+
+    /* test if really all blocks are plugged */
+    if (virtio_mem_valid_range(vmem, gpa, size) &&
+        virtio_mem_test_bitmap(vmem, gpa, size, true)) {
+        if (!virtio_mem_is_busy()) {
+            virtio_mem_set_bitmap(vmem, gpa, size, false);
+            vmem->size -= size;
+            if (!batch->size || gpa < batch->gpa) {
+                batch->gpa = gpa;
+            }
+            batch->size += size;
+            g_ptr_array_add(batch->elems, elem);
+            return true;
+        }
+        type = VIRTIO_MEM_RESP_BUSY;
+    }
+
+    virtio_mem_unplug_batch_flush(vmem, batch);
     virtio_mem_send_response_simple(vmem, elem, type);
+    return false;
 }
 
 static void virtio_mem_resize_usable_region(VirtIOMEM *vmem,
@@ -381,6 +462,9 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
 {
     const int len = sizeof(struct virtio_mem_req);
     VirtIOMEM *vmem = VIRTIO_MEM(vdev);
+    VirtIOMEMUnplugBatch batch = {
+        .elems = g_ptr_array_new(),
+    };
     VirtQueueElement *elem;
     struct virtio_mem_req req;
     uint16_t type;
@@ -388,7 +472,7 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
     while (true) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_to_buf(elem->out_sg, elem->out_num, 0, &req, len) < len) {
@@ -396,7 +480,7 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
                          " size: %d", len);
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) <
@@ -406,17 +490,22 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
                          iov_size(elem->in_sg, elem->in_num));
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
-            return;
+            break;
         }
 
         type = le16_to_cpu(req.type);
+        if (type == VIRTIO_MEM_REQ_UNPLUG) {
+            if (!virtio_mem_unplug_request(vmem, &batch, elem, &req)) {
+                g_free(elem);
+            }
+            continue;
+        }
+
+        virtio_mem_unplug_batch_flush(vmem, &batch);
         switch (type) {
         case VIRTIO_MEM_REQ_PLUG:
             virtio_mem_plug_request(vmem, elem, &req);
             break;
-        case VIRTIO_MEM_REQ_UNPLUG:
-            virtio_mem_unplug_request(vmem, elem, &req);
-            break;
         case VIRTIO_MEM_REQ_UNPLUG_ALL:
             virtio_mem_unplug_all_request(vmem, elem);
             break;
@@ -428,11 +517,15 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
                          " type: %d", type);
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
+            g_ptr_array_free(batch.elems, true);
             return;
         }
 
         g_free(elem);
     }
+
+    virtio_mem_unplug_batch_flush(vmem, &batch);
+    g_ptr_array_free(batch.elems, true);
 }
 
 static void virtio_mem_get_config(VirtIODevice *vdev, uint8_t *config_data)
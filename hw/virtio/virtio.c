@@ -131,6 +131,23 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Free elements for virtqueue_pop_batch(), linked through their start */
+    void *pool;
+    unsigned int pool_len;
+    size_t pool_sz;
+    /* Offsets of the arrays in a pooled element */
+    size_t pool_in_addr_ofs;
+    size_t pool_in_sg_ofs;
+    size_t pool_out_sg_ofs;
+
+    /* Interrupt moderation state, see virtio_notify_irqfd() */
+    QEMUTimer *irq_timer;
+    AioContext *irq_ctx;
+    int64_t irq_last_ns;        /* last interrupt sent */
+    int64_t irq_prev_ns;        /* last completion */
+    int64_t irq_interval_ns;    /* moving average of time between completions */
+    unsigned int irq_pending;   /* completions not signalled yet */
 };
 
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
@@ -530,12 +547,13 @@ static void vring_packed_desc_read(VirtIODevice *vdev,
         smp_rmb();
     }
 
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, addr),
-                              &desc->addr, sizeof(desc->addr));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, id),
-                              &desc->id, sizeof(desc->id));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, len),
-                              &desc->len, sizeof(desc->len));
+    /* addr, len and id precede flags and are read in one go */
+    QEMU_BUILD_BUG_ON(offsetof(VRingPackedDesc, addr) != 0 ||
+                      offsetof(VRingPackedDesc, len) != 8 ||
+                      offsetof(VRingPackedDesc, id) != 12 ||
+                      offsetof(VRingPackedDesc, flags) != 14);
+    address_space_read_cached(cache, off, desc,
+                              offsetof(VRingPackedDesc, flags));
     virtio_tswap64s(vdev, &desc->addr);
     virtio_tswap16s(vdev, &desc->id);
     virtio_tswap32s(vdev, &desc->len);
@@ -546,17 +564,16 @@ static void vring_packed_desc_write_data(VirtIODevice *vdev,
                                          MemoryRegionCache *cache,
                                          int i)
 {
-    hwaddr off_id = i * sizeof(VRingPackedDesc) +
-                    offsetof(VRingPackedDesc, id);
     hwaddr off_len = i * sizeof(VRingPackedDesc) +
                     offsetof(VRingPackedDesc, len);
+    /* len and id are adjacent, write them at once */
+    hwaddr size = offsetof(VRingPackedDesc, flags) -
+                  offsetof(VRingPackedDesc, len);
 
     virtio_tswap32s(vdev, &desc->len);
     virtio_tswap16s(vdev, &desc->id);
-    address_space_write_cached(cache, off_id, &desc->id, sizeof(desc->id));
-    address_space_cache_invalidate(cache, off_id, sizeof(desc->id));
-    address_space_write_cached(cache, off_len, &desc->len, sizeof(desc->len));
-    address_space_cache_invalidate(cache, off_len, sizeof(desc->len));
+    address_space_write_cached(cache, off_len, &desc->len, size);
+    address_space_cache_invalidate(cache, off_len, size);
 }
 
 static void vring_packed_desc_write_flags(VirtIODevice *vdev,
@@ -1410,7 +1427,54 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Elements from the pool have room for VIRTQUEUE_POOL_SG descriptors in
+ * each direction, which covers the usual block and network requests.
+ */
+#define VIRTQUEUE_POOL_SG   16
+#define VIRTQUEUE_POOL_MAX  64
+
+static void virtqueue_pool_drain(VirtQueue *vq)
+{
+    while (vq->pool) {
+        void *elem = vq->pool;
+
+        vq->pool = *(void **)elem;
+        g_free(elem);
+    }
+    vq->pool_len = 0;
+}
+
+static void *virtqueue_pool_alloc_element(VirtQueue *vq, size_t sz,
+                                          unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    if (out_num > VIRTQUEUE_POOL_SG || in_num > VIRTQUEUE_POOL_SG) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    if (vq->pool_sz != sz) {
+        virtqueue_pool_drain(vq);
+        vq->pool_sz = sz;
+    }
+    if (vq->pool) {
+        elem = vq->pool;
+        vq->pool = *(void **)elem;
+        vq->pool_len--;
+    } else {
+        elem = virtqueue_alloc_element(sz, VIRTQUEUE_POOL_SG,
+                                       VIRTQUEUE_POOL_SG);
+        vq->pool_in_addr_ofs = (void *)elem->in_addr - (void *)elem;
+        vq->pool_in_sg_ofs = (void *)elem->in_sg - (void *)elem;
+        vq->pool_out_sg_ofs = (void *)elem->out_sg - (void *)elem;
+    }
+    elem->out_num = out_num;
+    elem->in_num = in_num;
+    return elem;
+}
+
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz, bool batch)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1447,7 +1511,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    /* virtqueue_pop_batch() does this once for the whole batch */
+    if (!batch && virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1522,7 +1587,11 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (batch) {
+        elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1547,7 +1616,7 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz, bool batch)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1648,7 +1717,11 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (batch) {
+        elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1689,10 +1762,78 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, false);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, false);
+    }
+}
+
+/*
+ * virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: Size of the elements, as for virtqueue_pop()
+ * @elems: Array that receives the elements
+ * @max: Size of @elems
+ *
+ * Pop up to @max elements at once.  The region caches are looked up and
+ * the avail event is written once for the whole batch, and the elements
+ * come from a per-queue pool.  They must be released with
+ * virtqueue_element_free() to be recycled.
+ *
+ * Returns: the number of elements stored in @elems
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed;
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        void *elem = packed ? virtqueue_packed_pop(vq, sz, true)
+                            : virtqueue_split_pop(vq, sz, true);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+    }
+
+    if (n && !packed &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+/*
+ * virtqueue_element_free:
+ * @vq: The #VirtQueue the element was popped from
+ * @elem: The element, or the device structure that starts with it
+ *
+ * Free an element, returning it to the pool of @vq if it came from
+ * virtqueue_pop_batch().  Other elements are simply freed with g_free().
+ */
+void virtqueue_element_free(VirtQueue *vq, void *elem)
+{
+    VirtQueueElement *e = elem;
+
+    if (e && vq->pool_len < VIRTQUEUE_POOL_MAX && vq->pool_sz &&
+        (void *)e->in_addr == elem + vq->pool_in_addr_ofs &&
+        (void *)e->in_sg == elem + vq->pool_in_sg_ofs &&
+        (void *)e->out_sg == elem + vq->pool_out_sg_ofs) {
+        *(void **)elem = vq->pool;
+        vq->pool = elem;
+        vq->pool_len++;
+        return;
     }
+    g_free(elem);
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -2025,6 +2166,10 @@ void virtio_reset(void *opaque)
         vdev->vq[i].notification = true;
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
+        if (vdev->vq[i].irq_timer) {
+            timer_del(vdev->vq[i].irq_timer);
+        }
+        vdev->vq[i].irq_pending = 0;
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
 }
@@ -2423,6 +2568,12 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_pool_drain(vq);
+    vq->pool_sz = 0;
+    timer_free(vq->irq_timer);
+    vq->irq_timer = NULL;
+    vq->irq_ctx = NULL;
+    vq->irq_pending = 0;
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2522,14 +2673,8 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
-    WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
-            return;
-        }
-    }
-
     trace_virtio_notify_irqfd(vdev, vq);
 
     /*
@@ -2551,6 +2696,128 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     event_notifier_set(&vq->guest_notifier);
 }
 
+/* Send the interrupt that virtio_irqfd_coalesce() held back */
+static void virtio_irqfd_flush(VirtQueue *vq, int64_t now)
+{
+    if (vq->irq_timer) {
+        timer_del(vq->irq_timer);
+    }
+    if (!vq->irq_pending) {
+        return;
+    }
+
+    vq->irq_pending = 0;
+    vq->irq_last_ns = now;
+    /*
+     * The guest is being signalled up to the current used index, even if
+     * the completions after the first did not go through
+     * virtio_should_notify().
+     */
+    vq->signalled_used = vq->used_idx;
+    vq->signalled_used_valid = true;
+    virtio_irqfd(vq->vdev, vq);
+}
+
+static void virtio_irqfd_timer(void *opaque)
+{
+    VirtQueue *vq = opaque;
+    AioContext *ctx = vq->irq_ctx;
+
+    aio_context_acquire(ctx);
+    virtio_irqfd_flush(vq, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+    aio_context_release(ctx);
+}
+
+/*
+ * Interrupt moderation.  The first completion after a quiet period of
+ * irq-coalesce-usecs is signalled at once, so that latency does not
+ * suffer at low load.  On a busy queue the interrupt is held back until
+ * irq-coalesce-events completions are pending, or for as long as that
+ * many completions are expected to take at the current completion rate,
+ * but never more than irq-coalesce-usecs.
+ *
+ * Returns true if the notification was deferred or merged into a
+ * pending one.
+ */
+static bool virtio_irqfd_coalesce(VirtIODevice *vdev, VirtQueue *vq)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    int64_t max_ns = vdev->irq_coalesce_usecs * SCALE_US;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t delay;
+
+    if (!max_ns) {
+        return false;
+    }
+
+    if (vq->irq_prev_ns) {
+        int64_t interval = MIN(now - vq->irq_prev_ns, max_ns);
+
+        vq->irq_interval_ns = (vq->irq_interval_ns * 7 + interval) / 8;
+    }
+    vq->irq_prev_ns = now;
+
+    if (vq->irq_pending) {
+        if (++vq->irq_pending >= vdev->irq_coalesce_events) {
+            virtio_irqfd_flush(vq, now);
+        }
+        return true;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (!virtio_should_notify(vdev, vq)) {
+            return true;
+        }
+    }
+
+    delay = MIN(vq->irq_interval_ns * vdev->irq_coalesce_events, max_ns);
+    if (now - vq->irq_last_ns >= max_ns || vdev->irq_coalesce_events <= 1 ||
+        !delay) {
+        vq->irq_last_ns = now;
+        return false;
+    }
+
+    /* The queue may have moved to another AioContext since the last time */
+    if (vq->irq_ctx != ctx) {
+        timer_free(vq->irq_timer);
+        vq->irq_timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                      virtio_irqfd_timer, vq);
+        vq->irq_ctx = ctx;
+    }
+
+    trace_virtio_notify_irqfd_deferred(vdev, vq, delay);
+    vq->irq_pending = 1;
+    timer_mod(vq->irq_timer, now + delay);
+    return true;
+}
+
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (vdev->irq_coalesce_usecs) {
+        if (virtio_irqfd_coalesce(vdev, vq)) {
+            return;
+        }
+    } else {
+        WITH_RCU_READ_LOCK_GUARD() {
+            if (!virtio_should_notify(vdev, vq)) {
+                return;
+            }
+        }
+    }
+
+    virtio_irqfd(vdev, vq);
+}
+
+/*
+ * For code that forwards the used buffers of @vq itself and signals the
+ * guest through its own notifier, as the vhost shadow virtqueue does.
+ */
+bool virtio_queue_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    RCU_READ_LOCK_GUARD();
+    return virtio_should_notify(vdev, vq);
+}
+
 static void virtio_irq(VirtQueue *vq)
 {
     virtio_set_isr(vq->vdev, 0x1);
@@ -3512,6 +3779,12 @@ void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
         event_notifier_set_handler(&vq->guest_notifier, NULL);
     }
     if (!assign) {
+        /* Deliver a moderated interrupt before the notifier goes away */
+        if (vq->irq_ctx) {
+            aio_context_acquire(vq->irq_ctx);
+            virtio_irqfd_flush(vq, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+            aio_context_release(vq->irq_ctx);
+        }
         /* Test and clear notifier before closing it,
          * in case poll callback didn't have time to run. */
         virtio_queue_guest_notifier_read(&vq->guest_notifier);
@@ -3699,6 +3972,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        timer_free(vdev->vq[i].irq_timer);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
     g_free(vdev->vq);
@@ -3720,6 +3994,10 @@ static Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("irq-coalesce-usecs", VirtIODevice, irq_coalesce_usecs,
+                       0),
+    DEFINE_PROP_UINT32("irq-coalesce-events", VirtIODevice,
+                       irq_coalesce_events, 16),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -78,6 +78,42 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/* Request sizes that the log-linear histograms distinguish */
+enum BlockAcctSize {
+    BLOCK_ACCT_SIZE_SMALL,      /* up to 4 KiB */
+    BLOCK_ACCT_SIZE_MEDIUM,     /* up to 64 KiB */
+    BLOCK_ACCT_SIZE_LARGE,      /* up to 1 MiB */
+    BLOCK_ACCT_SIZE_HUGE,
+    BLOCK_MAX_ACCT_SIZE,
+};
+
+/* Where the time of a request goes */
+enum BlockAcctStage {
+    BLOCK_ACCT_STAGE_TOTAL,     /* from block_acct_start() to completion */
+    BLOCK_ACCT_STAGE_THROTTLE,  /* waiting for the I/O limits */
+    BLOCK_ACCT_STAGE_DRIVER,    /* in the drivers of the node graph */
+    BLOCK_MAX_ACCT_STAGE,
+};
+
+/*
+ * Log-linear ("HDR") latency histograms: each power of two between
+ * 2^BLOCK_HDR_MIN_SHIFT and 2^BLOCK_HDR_MAX_SHIFT ns is split in
+ * 2^BLOCK_HDR_SUB_BITS bins, so that the upper bound of a bin is within
+ * 12.5% of any latency in it.  The first bin collects the latencies
+ * below 1 us, the last one those above 34 s.  The bin boundaries, as in
+ * BlockLatencyHistogram, are given by block_hdr_histogram_boundaries().
+ */
+#define BLOCK_HDR_SUB_BITS  3
+#define BLOCK_HDR_MIN_SHIFT 10
+#define BLOCK_HDR_MAX_SHIFT 35
+#define BLOCK_HDR_NBINS \
+    (((BLOCK_HDR_MAX_SHIFT - BLOCK_HDR_MIN_SHIFT) << BLOCK_HDR_SUB_BITS) + 2)
+
+typedef struct BlockHdrHistograms {
+    uint64_t bins[BLOCK_MAX_IOTYPE][BLOCK_MAX_ACCT_SIZE][BLOCK_MAX_ACCT_STAGE]
+                 [BLOCK_HDR_NBINS];
+} BlockHdrHistograms;
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -91,6 +127,7 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    BlockHdrHistograms *hdr; /* NULL unless enabled, protected by @lock */
 };
 
 typedef struct BlockAcctCookie {
@@ -120,4 +157,13 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
 
+void block_hdr_histograms_enable(BlockAcctStats *stats, bool enable);
+uint64_t *block_hdr_histogram_boundaries(void);
+uint64_t block_hdr_histogram_percentile(const uint64_t *bins,
+                                        unsigned permille);
+int64_t block_acct_stage_start(BlockAcctStats *stats);
+void block_acct_stage_done(BlockAcctStats *stats, enum BlockAcctType type,
+                           int64_t bytes, enum BlockAcctStage stage,
+                           int64_t start_ns);
+
 #endif
@@ -59,6 +59,24 @@ struct LuringState;
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Completion of a request submitted with aio_add_sqe().  @cb is called
+ * from aio_poll() in the AioContext's thread, with @cqe filled in.
+ */
+typedef struct CqeHandler CqeHandler;
+struct CqeHandler {
+    void (*cb)(CqeHandler *handler);
+
+    /* Set before @cb is called */
+    struct io_uring_cqe cqe;
+
+    /* Used internally, do not access this */
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+typedef QSIMPLEQ_HEAD(, CqeHandler) CqeHandlerSimpleQ;
+#endif
+
 /* Callbacks for file descriptor monitoring implementations */
 typedef struct {
     /*
@@ -182,9 +200,11 @@ struct AioContext {
      * positives are possible, i.e. "notified" could be set even though the
      * EventNotifier is clear.
      *
-     * Note that event_notifier_set *cannot* be optimized the same way.  For
-     * more information on the problem that would result, see "#ifdef BUG2"
-     * in the docs/aio_notify_accept.promela formal model.
+     * event_notifier_set is skipped when "notified" was already set, which
+     * is only correct because event loops read "notified" after setting
+     * notify_me and do not block if it is set.  Without that check this
+     * would be the bug shown by "#ifdef BUG2" in the
+     * docs/spin/aio_notify_accept.promela formal model.
      */
     bool notified;
     EventNotifier notifier;
@@ -214,6 +234,9 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* Completed aio_add_sqe() requests, only used during aio_poll() */
+    CqeHandlerSimpleQ cqe_handler_ready_list;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -492,6 +515,39 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the aio context
+ *
+ * Return whether @ctx monitors its file descriptors with io_uring, so that
+ * aio_add_sqe() can be used.  This is not the case for AioContexts that
+ * are run by the glib main loop.
+ */
+bool aio_has_io_uring(AioContext *ctx);
+
+/**
+ * aio_add_sqe:
+ * @prep_sqe: fills in the sqe
+ * @opaque: passed to @prep_sqe
+ * @cqe_handler: called when the request completes
+ *
+ * Submit a request on the io_uring of the current thread's AioContext,
+ * which must satisfy aio_has_io_uring().  The request is submitted
+ * together with the file descriptor monitoring of the next aio_poll()
+ * iteration, and its completion is reaped by the same io_uring_enter()
+ * call; no system call is made here.
+ *
+ * Like external file descriptor handlers, completions are not processed
+ * while aio_disable_external() is in effect.
+ *
+ * @prep_sqe must not set the sqe's user_data, and @cqe_handler must stay
+ * valid until its callback is called.
+ */
+void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -730,4 +786,24 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/* Adaptive polling statistics of a handler with an io_poll callback */
+typedef struct {
+    int fd;
+    bool polling;       /* is the handler in the poll set? */
+    uint64_t sessions;  /* polling sessions the handler was polled in */
+    uint64_t successes; /* sessions in which polling it made progress */
+    uint64_t removals;  /* times it was dropped from the poll set */
+} AioPollStats;
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @stats: set to a newly allocated array, to be freed with g_free()
+ *
+ * Must be called from the thread that runs @ctx.
+ *
+ * Returns: the number of elements in @stats
+ */
+size_t aio_context_get_poll_stats(AioContext *ctx, AioPollStats **stats);
+
 #endif
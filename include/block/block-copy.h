@@ -74,6 +74,8 @@ bool block_copy_call_cancelled(BlockCopyCallState *call_state);
 int block_copy_call_status(BlockCopyCallState *call_state, bool *error_is_read);
 
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed);
+void block_copy_set_weight(BlockCopyState *s, uint32_t weight);
+void block_copy_set_global_speed(uint64_t speed);
 void block_copy_kick(BlockCopyCallState *call_state);
 
 /*
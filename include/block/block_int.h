@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/rcu.h"
 #include "block/snapshot.h"
 #include "qemu/throttle.h"
 
@@ -839,6 +840,24 @@ struct BdrvChild {
     QLIST_ENTRY(BdrvChild) next_parent;
 };
 
+/*
+ * Block status cache of a protocol node: remembers the last region for which
+ * the driver reported BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID, so that
+ * repeated queries (e.g. lseek(SEEK_DATA) in file-posix) for that region are
+ * answered from memory.  Replaced as a whole under bsc_modify_lock, read
+ * under RCU.
+ */
+typedef struct BdrvBlockStatusCache {
+    struct rcu_head rcu;
+
+    /* False if the cache has been invalidated */
+    bool valid;
+
+    /* [data_start, data_end) is a known data region */
+    int64_t data_start;
+    int64_t data_end;
+} BdrvBlockStatusCache;
+
 /*
  * Note: the function bdrv_append() copies and swaps contents of
  * BlockDriverStates, so if you add new fields to this struct, please
@@ -985,6 +1004,11 @@ struct BlockDriverState {
     unsigned int in_flight;
     unsigned int serialising_in_flight;
 
+    /* number of in-flight requests that took the fast path and are not
+     * in tracked_requests.  Accessed with atomic ops.
+     */
+    unsigned int untracked_in_flight;
+
     /* counter for nested bdrv_io_plug.
      * Accessed with atomic ops.
     */
@@ -1002,6 +1026,7 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    CoQueue untracked_queue;              /* Waiting for untracked requests */
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -1010,6 +1035,11 @@ struct BlockDriverState {
 
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
+
+    /* Lock for block-status cache RCU writers */
+    QemuMutex bsc_modify_lock;
+    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
+    BdrvBlockStatusCache *block_status_cache;
 };
 
 struct BlockBackendRootState {
@@ -1352,6 +1382,32 @@ bool bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
 void bdrv_inc_in_flight(BlockDriverState *bs);
 void bdrv_dec_in_flight(BlockDriverState *bs);
 
+/**
+ * Check whether the given offset is in the cached block-status data
+ * region.
+ *
+ * If it is, and @pnum is not NULL, *pnum is set to
+ * `bsc.data_end - offset`, i.e. how many bytes, starting from
+ * @offset, are data (according to the cache).
+ * Otherwise, *pnum is not touched.
+ */
+bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
+
+/**
+ * If [offset, offset + bytes) overlaps with the currently cached
+ * block-status region, invalidate the cache.
+ *
+ * (To be used by I/O paths that cause data regions to be zero or
+ * holes.)
+ */
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes);
+
+/**
+ * Mark the range [offset, offset + bytes) as a data region.
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
+
 void blockdev_close_all_bdrv_states(void);
 
 int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, int64_t src_offset,
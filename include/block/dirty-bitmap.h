@@ -70,6 +70,13 @@ void bdrv_dirty_bitmap_deserialize_zeroes(BdrvDirtyBitmap *bitmap,
 void bdrv_dirty_bitmap_deserialize_ones(BdrvDirtyBitmap *bitmap,
                                         uint64_t offset, uint64_t bytes,
                                         bool finish);
+size_t bdrv_dirty_bitmap_serialize_runs(const BdrvDirtyBitmap *bitmap,
+                                        uint8_t *buf, size_t size,
+                                        uint64_t offset, uint64_t bytes);
+int bdrv_dirty_bitmap_deserialize_runs(BdrvDirtyBitmap *bitmap,
+                                       const uint8_t *buf, size_t size,
+                                       uint64_t offset, uint64_t bytes,
+                                       bool finish);
 void bdrv_dirty_bitmap_deserialize_finish(BdrvDirtyBitmap *bitmap);
 
 void bdrv_dirty_bitmap_set_readonly(BdrvDirtyBitmap *bitmap, bool value);
@@ -60,7 +60,15 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s);
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
+typedef struct LuringSetup {
+    /* Submit from a kernel thread, pinned to sq_cpu if it is not -1 */
+    bool sqpoll;
+    int sq_cpu;
+    /* Poll the device for completions */
+    bool iopoll;
+} LuringSetup;
 LuringState *luring_init(Error **errp);
+LuringState *luring_init_setup(const LuringSetup *setup, Error **errp);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
                                 uint64_t offset, QEMUIOVector *qiov, int type);
@@ -68,6 +76,13 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
 void luring_io_unplug(BlockDriverState *bs, LuringState *s);
+void luring_unregister_fd(LuringState *s, int fd);
+void luring_register_buf(LuringState *s, void *host, size_t size);
+void luring_unregister_buf(LuringState *s, void *host);
+bool luring_has_fallocate(LuringState *s);
+int coroutine_fn luring_co_fallocate(BlockDriverState *bs, LuringState *s,
+                                     int fd, int mode, uint64_t offset,
+                                     uint64_t len);
 #endif
 
 #ifdef _WIN32
@@ -24,6 +24,15 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+typedef struct ThreadPoolStats {
+    int threads;
+    int idle_threads;
+    int queue_depth;
+    /* requests started by a worker, and the time they spent queued */
+    uint64_t requests;
+    uint64_t wait_ns;
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
@@ -33,5 +42,6 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
 int coroutine_fn thread_pool_submit_co(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 #endif
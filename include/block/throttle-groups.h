@@ -57,6 +57,12 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /* Share of the group's limits relative to the other members, 0 means 1.
+     * vtime is the virtual time of the member's next request, see
+     * next_throttle_token(). */
+    unsigned       weight;
+    uint64_t       vtime[2];
+
 } ThrottleGroupMember;
 
 #define TYPE_THROTTLE_GROUP "throttle-group"
@@ -75,6 +81,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
                                 AioContext *ctx);
 void throttle_group_unregister_tgm(ThrottleGroupMember *tgm);
 void throttle_group_restart_tgm(ThrottleGroupMember *tgm);
+void throttle_group_set_weight(ThrottleGroupMember *tgm, unsigned weight);
 
 void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm,
                                                         int64_t bytes,
@@ -43,4 +43,7 @@ int io_channel_send(QIOChannel *ioc, const void *buf, size_t len);
 int io_channel_send_full(QIOChannel *ioc, const void *buf, size_t len,
                          int *fds, size_t nfds);
 
+int io_channel_sendv_full(QIOChannel *ioc, const struct iovec *iov,
+                          int iovcnt, int *fds, size_t nfds);
+
 #endif /* CHAR_IO_H */
@@ -248,6 +248,55 @@ ssize_t qcrypto_tls_session_read(QCryptoTLSSession *sess,
                                  char *buf,
                                  size_t len);
 
+typedef enum {
+    QCRYPTO_TLS_KTLS_TX = (1 << 0),
+    QCRYPTO_TLS_KTLS_RX = (1 << 1),
+} QCryptoTLSSessionKTLS;
+
+/**
+ * qcrypto_tls_session_enable_ktls:
+ * @sess: the TLS session object
+ * @fd: the TCP socket that carries the session
+ *
+ * Hand the keys of the session over to the kernel TLS
+ * implementation, so that records are encrypted and
+ * decrypted by the kernel, or by the NIC, on @fd. This
+ * is only possible once the handshake is complete, and
+ * only for the ciphers that the kernel supports.
+ *
+ * For each direction that is enabled, plain text is sent
+ * to, or received from @fd; qcrypto_tls_session_write()
+ * or qcrypto_tls_session_read() must not be called any
+ * more. Received data should be read with
+ * qcrypto_tls_session_ktls_readv().
+ *
+ * Returns: a mask of QCryptoTLSSessionKTLS flags for
+ * the directions handled by the kernel, possibly 0
+ */
+int qcrypto_tls_session_enable_ktls(QCryptoTLSSession *sess,
+                                    int fd);
+
+/**
+ * qcrypto_tls_session_ktls_readv:
+ * @sess: the TLS session object
+ * @fd: the TCP socket that carries the session
+ * @iov: the array of memory regions to fill with plain text
+ * @niov: the length of the @iov array
+ *
+ * Receive data decrypted by the kernel, after
+ * qcrypto_tls_session_enable_ktls() has enabled
+ * QCRYPTO_TLS_KTLS_RX. A close_notify alert from the
+ * peer is reported as end of file; other records that
+ * do not carry application data are errors.
+ *
+ * Returns: the number of bytes received, or -1 on error
+ * with errno set as for qcrypto_tls_session_read()
+ */
+ssize_t qcrypto_tls_session_ktls_readv(QCryptoTLSSession *sess,
+                                       int fd,
+                                       const struct iovec *iov,
+                                       size_t niov);
+
 /**
  * qcrypto_tls_session_handshake:
  * @sess: the TLS session object
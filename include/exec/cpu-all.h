@@ -442,6 +442,14 @@ void dump_opcount_info(void);
 int cpu_exec(CPUState *cpu);
 void tcg_exec_realizefn(CPUState *cpu, Error **errp);
 void tcg_exec_unrealizefn(CPUState *cpu);
+/* accel/tcg/translate-all.c */
+void dump_exec_stats_json(FILE *f);
+/* accel/tcg/tb-profile.c */
+bool tb_profile_is_enabled(void);
+void tb_profile_enable(void);
+void tb_profile_disable(void);
+void tb_profile_reset(void);
+void tb_profile_report(size_t max);
 #endif /* CONFIG_TCG */
 
 /* Returns: 0 on success, -1 on error */
@@ -79,6 +79,9 @@ typedef uint64_t target_ulong;
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
+/* number of large pages per MMU mode that can be refilled without tlb_fill */
+#define CPU_TLB_LARGE_PAGES 8
+
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -150,6 +153,21 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * A translation for a page larger than TARGET_PAGE_SIZE, as passed to
+ * tlb_set_page_with_attrs().  The TLB itself only holds TARGET_PAGE_SIZE
+ * entries; this remembers the whole page so that a miss on any of its
+ * target pages can be refilled without walking the guest page tables.
+ */
+typedef struct CPUTLBLargePage {
+    /* Page-size aligned; @size is 0 if the entry is unused */
+    target_ulong vaddr;
+    target_ulong size;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -163,6 +181,14 @@ typedef struct CPUTLBDesc {
      */
     target_ulong large_page_addr;
     target_ulong large_page_mask;
+    /*
+     * The most recent large pages allocated into the tlb.  They are
+     * flushed precisely; only once a large page is evicted from this
+     * array is it added to the large_page_addr/mask region.
+     */
+    CPUTLBLargePage large_pages[CPU_TLB_LARGE_PAGES];
+    /* The next index to use in large_pages.  */
+    size_t lpindex;
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
@@ -188,6 +214,28 @@ typedef struct CPUTLBDescFast {
     CPUTLBEntry *table;
 } CPUTLBDescFast QEMU_ALIGNED(2 * sizeof(void *));
 
+/* Number of disjoint ranges that CPUTLBPending can hold */
+#define CPU_TLB_PENDING_RANGES 8
+
+typedef struct CPUTLBPendingRange {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBPendingRange;
+
+/*
+ * Flushes requested by other vCPUs and not run yet.  Overlapping ranges
+ * are merged; when there are too many, their mmu_idx are flushed fully.
+ */
+typedef struct CPUTLBPending {
+    /* A work item that runs the flushes is queued */
+    bool queued;
+    uint16_t full_idxmap;
+    unsigned int nr_ranges;
+    CPUTLBPendingRange range[CPU_TLB_PENDING_RANGES];
+} CPUTLBPending;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -200,6 +248,13 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /* Protected by tlb_c.lock. */
+    CPUTLBPending pending;
+    /*
+     * This vCPU queued flushes on other vCPUs and has yet to wait for
+     * them in tlb_flush_sync().  Only accessed by the vCPU itself.
+     */
+    bool sync_pending;
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -208,6 +263,7 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t batched_flush_count;
 } CPUTLBCommon;
 
 /*
@@ -27,5 +27,7 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+/* Register the TLB flush counters with query-stats */
+void tlb_stats_init(void);
 #endif
 #endif
@@ -285,6 +285,17 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                target_ulong len,
                                                uint16_t idxmap,
                                                unsigned bits);
+/**
+ * tlb_flush_sync:
+ * @cpu: the CPU executing a barrier
+ * @retaddr: return address of the helper that implements the barrier
+ *
+ * For targets with TCGCPUOps.tlb_sync_at_barrier: if @cpu has requested
+ * *_all_cpus_synced() flushes since its last barrier, exit the cpu loop
+ * and restart the barrier once all CPUs have left their TBs, i.e. once
+ * no CPU can use a TLB entry that those flushes invalidated.
+ */
+void tlb_flush_sync(CPUState *cpu, uintptr_t retaddr);
 
 /**
  * tlb_set_page_with_attrs:
@@ -408,6 +419,9 @@ static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                              unsigned bits)
 {
 }
+static inline void tlb_flush_sync(CPUState *cpu, uintptr_t retaddr)
+{
+}
 #endif
 /**
  * probe_access:
@@ -55,7 +55,17 @@ static inline void fuzz_dma_read_cb(size_t addr,
 }
 #endif
 
-extern bool global_dirty_log;
+/* Possible bits for global_dirty_log */
+
+/* Dirty tracking enabled because migration is running */
+#define GLOBAL_DIRTY_MIGRATION  (1U << 0)
+
+/* Dirty tracking enabled because the dirty rate is being measured */
+#define GLOBAL_DIRTY_DIRTY_RATE (1U << 1)
+
+#define GLOBAL_DIRTY_MASK  (0x3)
+
+extern unsigned int global_dirty_log;
 
 typedef struct MemoryRegionOps MemoryRegionOps;
 
@@ -450,6 +460,8 @@ struct IOMMUMemoryRegionClass {
 
 typedef struct CoalescedMemoryRange CoalescedMemoryRange;
 typedef struct MemoryRegionIoeventfd MemoryRegionIoeventfd;
+typedef struct MemoryRegionDoorbell MemoryRegionDoorbell;
+typedef void MemoryRegionDoorbellFn(void *opaque);
 
 /** MemoryRegion:
  *
@@ -468,6 +480,7 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool global_locking;
     uint8_t dirty_log_mask;
     bool is_iommu;
     RAMBlock *ram_block;
@@ -626,10 +639,11 @@ struct MemoryListener {
     /**
      * @log_sync_global:
      *
-     * This is the global version of @log_sync when the listener does
-     * not have a way to synchronize the log with finer granularity.
-     * When the listener registers with @log_sync_global defined, then
-     * its @log_sync must be NULL.  Vice versa.
+     * This is the global version of @log_sync.  It is used instead of
+     * @log_sync to synchronize the whole log, and for all
+     * synchronizations when the listener has no @log_sync because it
+     * does not have a way to synchronize the log with finer
+     * granularity.
      *
      * @listener: The #MemoryListener.
      */
@@ -772,11 +786,23 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /*
+     * Bytes of bounce buffers currently handed out by address_space_map(),
+     * and the limit for them.  Accessed atomically.
+     */
+    size_t bounce_buffer_size;
+    size_t max_bounce_buffer_size;
+    /* Callbacks waiting for bounce buffer space to be freed */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
 typedef struct FlatRange FlatRange;
 
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE (4096)
+
 /* Flattened global view of current active memory hierarchy.  Kept in sorted
  * order.
  */
@@ -1853,6 +1879,37 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_set_global_locking: Declares the access processing requires
+ *                                   QEMU's global lock.
+ *
+ * When this is invoked, accesses to the memory region will be processed while
+ * holding the global lock of QEMU.  This is the default behavior of memory
+ * regions.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_set_global_locking(MemoryRegion *mr);
+
+/**
+ * memory_region_clear_global_locking: Declares that access processing does
+ *                                     not depend on the QEMU global lock.
+ *
+ * By clearing this property, accesses to the memory region will be processed
+ * outside of QEMU's global lock (unless the lock is held on when issuing the
+ * access request).  In this case, the device model implementing the access
+ * handlers is responsible for synchronization of concurrency, usually with
+ * a lock of its own; the handlers may still take the global lock for the
+ * parts that need it, for example when raising interrupts.
+ *
+ * Dispatch itself is safe without the global lock: the region is looked up
+ * in an RCU-protected FlatView, which keeps it alive until the access
+ * completes.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_clear_global_locking(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -1896,6 +1953,59 @@ void memory_region_del_eventfd(MemoryRegion *mr,
                                uint64_t data,
                                EventNotifier *e);
 
+/**
+ * memory_region_add_doorbell: Run a handler in an AioContext when a
+ *                             doorbell location is written.
+ *
+ * Backs a doorbell register with an ioeventfd, so that guest writes to it
+ * complete without a userspace exit, and runs @fn from @ctx once the
+ * eventfd fires.  Several writes that happen before @fn runs are coalesced
+ * into a single call, and the written value is not passed to @fn; devices
+ * whose doorbells carry data must either use @match_data or find the new
+ * state elsewhere (for example in guest memory).
+ *
+ * Without @match_data, KVM's "any length" ioeventfds are used when
+ * available, so that writes of any size trigger the doorbell.  If @ctx is
+ * not the main loop's AioContext, @fn runs without the BQL held.
+ *
+ * The doorbell must be removed with memory_region_del_doorbell() before
+ * @mr is destroyed.
+ *
+ * @mr: the memory region being updated.
+ * @addr: the address of the doorbell within @mr
+ * @size: the size of the access to trigger the doorbell
+ * @match_data: whether to match against @data, instead of just @addr
+ * @data: the data to match against the guest write
+ * @ctx: the AioContext in which @fn runs
+ * @fn: the handler
+ * @opaque: the argument to @fn
+ * @errp: pointer to Error*, to store an error if it happens.
+ *
+ * Returns the doorbell, or NULL on failure.
+ */
+MemoryRegionDoorbell *memory_region_add_doorbell(MemoryRegion *mr,
+                                                 hwaddr addr,
+                                                 unsigned size,
+                                                 bool match_data,
+                                                 uint64_t data,
+                                                 AioContext *ctx,
+                                                 MemoryRegionDoorbellFn *fn,
+                                                 void *opaque,
+                                                 Error **errp);
+
+/**
+ * memory_region_del_doorbell: Remove a doorbell.
+ *
+ * Removes and frees a doorbell added by memory_region_add_doorbell().
+ * Writes the guest did before the call but that were not yet handled are
+ * lost; the caller should check the device state afterwards if it cares.
+ * Must be called from the thread that runs the doorbell's AioContext, or
+ * while that AioContext is acquired.
+ *
+ * @db: the doorbell to remove
+ */
+void memory_region_del_doorbell(MemoryRegionDoorbell *db);
+
 /**
  * memory_region_add_subregion: Add a subregion to a container.
  *
@@ -2105,13 +2215,22 @@ void memory_listener_unregister(MemoryListener *listener);
 
 /**
  * memory_global_dirty_log_start: begin dirty logging for all regions
+ *
+ * Dirty logging stays enabled until every user that started it has
+ * stopped it again.
+ *
+ * @flags: the users that need dirty logging, one or more of the
+ *         GLOBAL_DIRTY_* bits
  */
-void memory_global_dirty_log_start(void);
+void memory_global_dirty_log_start(unsigned int flags);
 
 /**
  * memory_global_dirty_log_stop: end dirty logging for all regions
+ *
+ * @flags: the users that no longer need dirty logging, as passed to
+ *         memory_global_dirty_log_start()
  */
-void memory_global_dirty_log_stop(void);
+void memory_global_dirty_log_stop(unsigned int flags);
 
 void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled);
 
@@ -2446,8 +2565,8 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May return %NULL and set *@plen to zero(0), if resources needed to perform
  * the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2472,6 +2591,29 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len);
 
+/*
+ * address_space_register_map_client: Register a callback to invoke when
+ * resources for address_space_map() are available again.
+ *
+ * address_space_map may fail when there are not enough resources available,
+ * such as when bounce buffer memory would exceed the limit.  The callback can
+ * be used to retry the address_space_map operation.  Note that the callback
+ * gets automatically removed after firing.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to invoke when address_space_map() retry is appropriate
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/*
+ * address_space_unregister_map_client: Unregister a callback that has
+ * previously been registered and not fired yet.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to unregister
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
@@ -262,6 +262,41 @@ static inline uint8_t cpu_physical_memory_range_includes_clean(ram_addr_t start,
     return ret;
 }
 
+static inline unsigned long *dirty_memory_summary(unsigned long *block)
+{
+    return block + DIRTY_MEMORY_BLOCK_WORDS;
+}
+
+/* Called after setting the dirty bits of pages @offset..@offset+@num-1 */
+static inline void dirty_memory_summary_set(unsigned long *block,
+                                            unsigned long offset,
+                                            unsigned long num)
+{
+    unsigned long first = offset / DIRTY_MEMORY_SUMMARY_PAGES;
+    unsigned long last = (offset + num - 1) / DIRTY_MEMORY_SUMMARY_PAGES;
+
+    bitmap_set_atomic(dirty_memory_summary(block), first, last - first + 1);
+}
+
+/*
+ * Return whether summary bit @group of @block is set.  If @whole, the
+ * caller is about to clear all the pages it covers, so clear it first.
+ */
+static inline bool dirty_memory_summary_test_and_clear(unsigned long *block,
+                                                       unsigned long group,
+                                                       bool whole)
+{
+    unsigned long *word = dirty_memory_summary(block) + BIT_WORD(group);
+
+    if (!(qatomic_read(word) & BIT_MASK(group))) {
+        return false;
+    }
+    if (whole) {
+        qatomic_and(word, ~BIT_MASK(group));
+    }
+    return true;
+}
+
 static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
                                                       unsigned client)
 {
@@ -279,6 +314,8 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
     blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
 
     set_bit_atomic(offset, blocks->blocks[idx]);
+    set_bit_atomic(offset / DIRTY_MEMORY_SUMMARY_PAGES,
+                   dirty_memory_summary(blocks->blocks[idx]));
 }
 
 static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
@@ -311,14 +348,23 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
             if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_summary_set(
+                        blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                        offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_summary_set(
+                        blocks[DIRTY_MEMORY_VGA]->blocks[idx],
+                        offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_CODE))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_CODE]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_summary_set(
+                        blocks[DIRTY_MEMORY_CODE]->blocks[idx],
+                        offset, next - page);
             }
 
             page = next;
@@ -352,6 +398,7 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
         unsigned long offset;
         long k;
         long nr = BITS_TO_LONGS(pages);
+        bool group_dirty = false;
 
         idx = (start >> TARGET_PAGE_BITS) / DIRTY_MEMORY_BLOCK_SIZE;
         offset = BIT_WORD((start >> TARGET_PAGE_BITS) %
@@ -379,6 +426,26 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                         qatomic_or(&blocks[DIRTY_MEMORY_CODE][idx][offset],
                                    temp);
                     }
+                    group_dirty = true;
+                }
+
+                /* Mark the summary once done with each group of words */
+                if (group_dirty &&
+                    ((offset + 1) % DIRTY_MEMORY_SUMMARY_WORDS == 0 ||
+                     k == nr - 1)) {
+                    unsigned long first = offset * BITS_PER_LONG;
+
+                    dirty_memory_summary_set(blocks[DIRTY_MEMORY_VGA][idx],
+                                             first, 1);
+                    if (global_dirty_log) {
+                        dirty_memory_summary_set(
+                                blocks[DIRTY_MEMORY_MIGRATION][idx], first, 1);
+                    }
+                    if (tcg_enabled()) {
+                        dirty_memory_summary_set(
+                                blocks[DIRTY_MEMORY_CODE][idx], first, 1);
+                    }
+                    group_dirty = false;
                 }
 
                 if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
@@ -453,8 +520,8 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
     if (((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
          (start + rb->offset) &&
         !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1))) {
-        int k;
-        int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
+        unsigned long k, j, num;
+        unsigned long nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
         unsigned long * const *src;
         unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
         unsigned long offset = BIT_WORD((word * BITS_PER_LONG) %
@@ -464,17 +531,30 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         src = qatomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
+        /* Go through the words in groups, skipping those summarized clean */
+        for (k = page; k < page + nr; k += num) {
+            num = MIN(page + nr - k, DIRTY_MEMORY_SUMMARY_WORDS -
+                                     offset % DIRTY_MEMORY_SUMMARY_WORDS);
+
+            if (dirty_memory_summary_test_and_clear(src[idx],
+                                    offset / DIRTY_MEMORY_SUMMARY_WORDS,
+                                    num == DIRTY_MEMORY_SUMMARY_WORDS)) {
+                for (j = 0; j < num; j++) {
+                    unsigned long *w = &src[idx][offset + j];
+
+                    if (*w) {
+                        unsigned long bits = qatomic_xchg(w, 0);
+                        unsigned long new_dirty;
+                        new_dirty = ~dest[k + j];
+                        dest[k + j] |= bits;
+                        new_dirty &= bits;
+                        num_dirty += ctpopl(new_dirty);
+                    }
+                }
             }
 
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            offset += num;
+            if (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
                 offset = 0;
                 idx++;
             }
@@ -38,6 +38,8 @@ struct RAMBlock {
     QLIST_ENTRY(RAMBlock) next;
     QLIST_HEAD(, RAMBlockNotifier) ramblock_notifiers;
     int fd;
+    /* offset of the block in @fd */
+    off_t fd_offset;
     size_t page_size;
     /* dirty bitmap used during migration */
     unsigned long *bmap;
@@ -69,6 +71,15 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * fixed-ram migration: file offsets of the bitmap of the pages that
+     * the file holds, and of the pages themselves.  @file_bmap is only
+     * set on the source.
+     */
+    off_t bitmap_offset;
+    off_t pages_offset;
+    unsigned long *file_bmap;
 };
 #endif
 #endif
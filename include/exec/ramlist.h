@@ -39,6 +39,17 @@ typedef struct RAMBlockNotifier RAMBlockNotifier;
  * pointed to from the new DirtyMemoryBlocks).
  */
 #define DIRTY_MEMORY_BLOCK_SIZE ((ram_addr_t)256 * 1024 * 8)
+#define DIRTY_MEMORY_BLOCK_WORDS (DIRTY_MEMORY_BLOCK_SIZE / BITS_PER_LONG)
+
+/* The bitmap of each block is followed by a summary with one bit for every
+ * DIRTY_MEMORY_SUMMARY_WORDS words of it.  Writers set the summary bit after
+ * the page bits, so a clear summary bit lets scans skip that part of the
+ * block; a set one only says that some of its pages may be dirty.
+ */
+#define DIRTY_MEMORY_SUMMARY_WORDS 64
+#define DIRTY_MEMORY_SUMMARY_PAGES (DIRTY_MEMORY_SUMMARY_WORDS * BITS_PER_LONG)
+#define DIRTY_MEMORY_SUMMARY_BITS \
+    (DIRTY_MEMORY_BLOCK_WORDS / DIRTY_MEMORY_SUMMARY_WORDS)
 typedef struct {
     struct rcu_head rcu;
     unsigned long *blocks[];
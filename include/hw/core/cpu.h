@@ -265,6 +265,7 @@ struct qemu_work_item;
  * @stopped: Indicates the CPU has been artificially stopped.
  * @unplug: Indicates a pending CPU unplug request.
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
+ * @tb_profile_pending: The TB profiler asked for a sample (lockless).
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
  * @can_do_io: Nonzero if memory-mapped IO is safe. Deterministic execution
@@ -297,6 +298,17 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @dirty_pages: Number of pages dirtied by this vCPU, as collected from
+ *    its KVM dirty ring.
+ * @throttle_dirty_pages: Value of @dirty_pages when the throttling of this
+ *    vCPU was last reevaluated.
+ * @throttle_exempt: This vCPU is not slowed down by the CPU throttle.
+ * @halt_poll_kicks: Incremented by qemu_cpu_kick() (lockless).
+ * @halt_poll_ns: Current userspace halt polling time of this vCPU.
+ * @halt_poll_attempts: Number of halts that started with polling.
+ * @halt_poll_successes: Number of halts woken up while polling.
+ * @halt_poll_success_ns: Time spent in polls that were woken up.
+ * @halt_poll_fail_ns: Time spent in polls that ended in a sleep.
  *
  * State of one CPU core or thread.
  */
@@ -326,6 +338,7 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    bool tb_profile_pending;
     bool in_exclusive_context;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
@@ -349,6 +362,9 @@ struct CPUState {
 
     /* Accessed in parallel; all accesses must be atomic */
     TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /* TB lookups, and those that had to go to the global TB hash table */
+    size_t tb_lookups;
+    size_t tb_jmp_cache_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -374,6 +390,17 @@ struct CPUState {
     struct kvm_run *kvm_run;
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
+    uint64_t dirty_pages;
+    uint64_t throttle_dirty_pages;
+    bool throttle_exempt;
+
+    /* Userspace halt polling, protected by the BQL unless noted */
+    unsigned int halt_poll_kicks;
+    int64_t halt_poll_ns;
+    uint64_t halt_poll_attempts;
+    uint64_t halt_poll_successes;
+    uint64_t halt_poll_success_ns;
+    uint64_t halt_poll_fail_ns;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
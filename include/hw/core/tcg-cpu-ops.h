@@ -98,6 +98,14 @@ struct TCGCPUOps {
      */
     bool (*io_recompile_replay_branch)(CPUState *cpu,
                                        const TranslationBlock *tb);
+
+    /**
+     * @tlb_sync_at_barrier: The flushes of the *_all_cpus_synced()
+     * functions need only be complete at the next barrier, which the
+     * target implements with tlb_flush_sync(); e.g. Arm's DSB after a
+     * broadcast TLBI.
+     */
+    bool tlb_sync_at_barrier;
 #endif /* CONFIG_SOFTMMU */
 #endif /* NEED_CPU_H */
 
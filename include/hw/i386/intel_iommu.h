@@ -58,6 +58,7 @@ typedef struct VTDContextEntry VTDContextEntry;
 typedef struct VTDContextCacheEntry VTDContextCacheEntry;
 typedef struct VTDAddressSpace VTDAddressSpace;
 typedef struct VTDIOTLBEntry VTDIOTLBEntry;
+typedef struct VTDPWCEntry VTDPWCEntry;
 typedef struct VTDBus VTDBus;
 typedef union VTD_IR_TableEntry VTD_IR_TableEntry;
 typedef union VTD_IR_MSIAddress VTD_IR_MSIAddress;
@@ -118,11 +119,25 @@ struct VTDBus {
 };
 
 struct VTDIOTLBEntry {
+    uint64_t key;               /* Key in IntelIOMMUState.iotlb */
     uint64_t gfn;
     uint16_t domain_id;
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    QTAILQ_ENTRY(VTDIOTLBEntry) lru;
+};
+
+/* Paging-structure cache entry: a page table reached by a page walk */
+struct VTDPWCEntry {
+    uint64_t key;               /* Key in IntelIOMMUState.pwc */
+    uint16_t domain_id;
+    uint64_t iova;              /* First IOVA translated by the table */
+    uint64_t mask;              /* Mask of the IOVAs translated by it */
+    uint64_t table;             /* Address of the table */
+    uint32_t level;             /* Level of the table */
+    bool reads;                 /* Permissions granted by upper levels */
+    bool writes;
 };
 
 /* VT-d Source-ID Qualifier types */
@@ -251,6 +266,9 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    /* IOTLB entries, least recently used first */
+    QTAILQ_HEAD(, VTDIOTLBEntry) iotlb_lru;
+    GHashTable *pwc;                /* Paging-structure cache */
 
     GHashTable *vtd_as_by_busptr;   /* VTDBus objects indexed by PCIBus* reference */
     VTDBus *vtd_as_by_bus_num[VTD_PCI_BUS_MAX]; /* VTDBus objects indexed by bus number */
@@ -269,7 +287,8 @@ struct IntelIOMMUState {
 
     /*
      * Protects IOMMU states in general.  Currently it protects the
-     * per-IOMMU IOTLB cache, and context entry cache in VTDAddressSpace.
+     * per-IOMMU IOTLB and paging-structure caches, and context entry
+     * cache in VTDAddressSpace.
      */
     QemuMutex iommu_lock;
 };
@@ -35,6 +35,8 @@ typedef struct AHCIControlRegs {
     uint32_t    irqstatus;
     uint32_t    impl;
     uint32_t    version;
+    uint32_t    ccc_ctl;
+    uint32_t    ccc_ports;
 } AHCIControlRegs;
 
 typedef struct AHCIState {
@@ -49,6 +51,12 @@ typedef struct AHCIState {
     int32_t ports;
     qemu_irq irq;
     AddressSpace *as;
+
+    /* Command completion coalescing */
+    bool ccc;
+    uint8_t ccc_count;      /* completions since the last CCC interrupt */
+    bool ccc_pending;       /* IS bit CCC_CTL.INT is set */
+    QEMUTimer *ccc_timer;
 } AHCIState;
 
 
@@ -202,7 +202,9 @@ struct GICv3CPUState {
      * real state above; it doesn't need to be migrated.
      */
     PendingIrq hppi;
-    /* This is temporary working state, to avoid a malloc in gicv3_update() */
+    /* This is temporary working state, to avoid a malloc in gicv3_update();
+     * it is set for the CPUs whose hppi may have changed.
+     */
     bool seenbetter;
 };
 
@@ -246,6 +248,11 @@ struct GICv3State {
      * in the IROUTER registers
      */
     GICv3CPUState *gicd_irouter_target[GICV3_MAXIRQ];
+    /* Cached information: the interrupts that were eligible to be
+     * signaled to a CPU interface as of the last update of each
+     * group of 32. Only used by the emulated GIC.
+     */
+    GIC_DECLARE_BITMAP(pending_eligible);
     uint32_t gicd_nsacr[DIV_ROUND_UP(GICV3_MAXIRQ, 16)];
 
     GICv3CPUState *cpu;
@@ -842,4 +842,16 @@ typedef enum MachineInitPhase {
 extern bool phase_check(MachineInitPhase phase);
 extern void phase_advance(MachineInitPhase phase);
 
+/*
+ * phase_start: record the time QEMU starts initializing, i.e. the
+ * beginning of PHASE_NO_MACHINE
+ */
+extern void phase_start(void);
+
+/*
+ * phase_timestamp: return the get_clock() time at which @phase was
+ * entered, or 0 if it was not reached yet
+ */
+extern int64_t phase_timestamp(MachineInitPhase phase);
+
 #endif
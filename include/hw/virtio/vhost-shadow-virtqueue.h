@@ -0,0 +1,70 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef VHOST_SHADOW_VIRTQUEUE_H
+#define VHOST_SHADOW_VIRTQUEUE_H
+
+#include "qemu/event_notifier.h"
+#include "hw/virtio/virtio.h"
+#include "standard-headers/linux/vhost_types.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+/*
+ * A shadow virtqueue sits between the guest virtqueue and a vhost device:
+ * QEMU pops the buffers the guest makes available and exposes them to the
+ * device in a split ring of its own, then returns them to the guest when
+ * the device uses them.  Guest memory is then written by QEMU's virtqueue
+ * code, which logs the pages it dirties for migration.
+ *
+ * The buffers keep their guest physical addresses, so the device must
+ * see guest memory at IOVA == GPA, as vhost-vdpa maps it without vIOMMU.
+ */
+typedef struct VhostShadowVirtqueue {
+    /* The shadow ring, which the device sees at @iova */
+    struct vring vring;
+    void *ring;
+    size_t ring_size;
+    hwaddr iova;
+
+    /* Kicked by QEMU and signalled by the device */
+    EventNotifier hdev_kick;
+    EventNotifier hdev_call;
+
+    /* The guest's kick for this queue and its interrupt, not owned */
+    EventNotifier svq_kick;
+    EventNotifier svq_call;
+    bool started;
+
+    VirtIODevice *vdev;
+    VirtQueue *vq;
+
+    /* Element exposed with each head descriptor, NULL if not in flight */
+    VirtQueueElement **ring_id_maps;
+    /* Popped from the guest but waiting for shadow descriptors */
+    VirtQueueElement *next_guest_avail_elem;
+
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t shadow_avail_idx;
+    uint16_t last_used_idx;
+} VhostShadowVirtqueue;
+
+VhostShadowVirtqueue *vhost_svq_new(void);
+void vhost_svq_free(VhostShadowVirtqueue *svq);
+
+bool vhost_svq_valid_features(VirtIODevice *vdev, Error **errp);
+void vhost_svq_set_num(VhostShadowVirtqueue *svq, unsigned int num);
+void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
+                              struct vhost_vring_addr *addr);
+void vhost_svq_set_guest_kick_fd(VhostShadowVirtqueue *svq, int fd);
+void vhost_svq_set_guest_call_fd(VhostShadowVirtqueue *svq, int fd);
+
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq);
+void vhost_svq_stop(VhostShadowVirtqueue *svq);
+
+#endif
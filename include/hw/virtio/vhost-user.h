@@ -21,6 +21,14 @@ typedef struct VhostUserState {
     CharBackend *chr;
     VhostUserHostNotifier notifier[VIRTIO_QUEUE_MAX];
     int memory_slots;
+    /*
+     * Negotiation done by the vhost_dev with vq_index 0, reused by the
+     * other queue pairs on the same connection instead of asking again.
+     */
+    bool features_valid;
+    uint64_t features;
+    uint64_t protocol_features;
+    uint64_t acked_protocol_features;
 } VhostUserState;
 
 bool vhost_user_init(VhostUserState *user, CharBackend *chr, Error **errp);
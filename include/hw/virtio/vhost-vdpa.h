@@ -13,6 +13,7 @@
 #define HW_VIRTIO_VHOST_VDPA_H
 
 #include "hw/virtio/virtio.h"
+#include "hw/virtio/vhost-shadow-virtqueue.h"
 
 typedef struct VhostVDPAHostNotifier {
     MemoryRegion mr;
@@ -25,6 +26,12 @@ typedef struct vhost_vdpa {
     MemoryListener listener;
     struct vhost_dev *dev;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
+    /* Set before init to allow shadow virtqueues, which log dirty pages */
+    bool shadow_vqs_allowed;
+    /* Changed by the owner while the device is stopped */
+    bool shadow_vqs_enabled;
+    GPtrArray *shadow_vqs;
+    struct vhost_vdpa_iova_range iova_range;
 } VhostVDPA;
 
 #endif
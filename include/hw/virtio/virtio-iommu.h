@@ -58,6 +58,13 @@ struct VirtIOIOMMU {
     GTree *domains;
     QemuMutex mutex;
     GTree *endpoints;
+    /*
+     * UNMAP notifications not sent yet, to be merged with the ones for
+     * adjacent mappings.  Only set while a request batch is processed.
+     */
+    struct VirtIOIOMMUDomain *pending_unmap_domain;
+    uint64_t pending_unmap_low;
+    uint64_t pending_unmap_high;
 };
 
 #endif
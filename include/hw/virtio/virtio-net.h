@@ -119,6 +119,7 @@ typedef struct VirtioNetRscChain {
     uint16_t proto;
     uint8_t  gso_type;
     uint16_t max_payload;
+    uint32_t timeout;       /* current drain timeout, see rsc_min_interval */
     QEMUTimer *drain_timer;
     QTAILQ_HEAD(, VirtioNetRscSeg) buffers;
     VirtioNetRscStat stat;
@@ -151,6 +152,9 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* the peer sends a batch, signal the guest at its end */
+    bool rx_batch;
+    bool rx_notify;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -164,6 +168,9 @@ struct VirtIONet {
     /* RSC Chains - temporary storage of coalesced data,
        all these data are lost in case of migration */
     QTAILQ_HEAD(, VirtioNetRscChain) rsc_chains;
+    /* segments kept for reuse, along with their buffer */
+    QTAILQ_HEAD(, VirtioNetRscSeg) rsc_free_segs;
+    unsigned int rsc_free_len;
     uint32_t tx_timeout;
     int32_t tx_burst;
     uint32_t has_vnet_hdr;
@@ -171,6 +178,7 @@ struct VirtIONet {
     size_t guest_hdr_len;
     uint64_t host_features;
     uint32_t rsc_timeout;
+    uint32_t rsc_min_timeout;
     uint8_t rsc4_enabled;
     uint8_t rsc6_enabled;
     uint8_t has_ufo;
@@ -211,6 +219,9 @@ struct VirtIONet {
     DeviceListener primary_listener;
     Notifier migration_state;
     VirtioNetRssData rss_data;
+    /* software RSS lookup table for rss_data.key, built on first use */
+    struct NetToeplitzTable *rss_table;
+    bool rss_table_valid;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
 };
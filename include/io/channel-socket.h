@@ -47,6 +47,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    /* Number of sendmsg() calls done with, and completed for, zero-copy */
+    ssize_t zero_copy_queued;
+    ssize_t zero_copy_sent;
 };
 
 
@@ -260,4 +263,19 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_poll_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the zero-copy completions that the kernel has already
+ * reported, without waiting for more.  Afterwards, the buffers of
+ * the first @ioc->zero_copy_sent zero-copy writes may be reused.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_poll_zero_copy(QIOChannelSocket *ioc,
+                                  Error **errp);
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -41,6 +41,11 @@ OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelTLS, QIO_CHANNEL_TLS)
  *
  * This channel object is capable of running as either a
  * TLS server or TLS client.
+ *
+ * When the master channel is a TCP socket, the record
+ * encryption is handed over to the kernel after the
+ * handshake, if the kernel supports the negotiated cipher.
+ * Data then goes directly through the socket.
  */
 
 struct QIOChannelTLS {
@@ -48,6 +53,7 @@ struct QIOChannelTLS {
     QIOChannel *master;
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
+    int ktls; /* QCryptoTLSSessionKTLS flags */
 };
 
 /**
@@ -32,12 +32,15 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 
 #define QIO_CHANNEL_ERR_BLOCK -2
 
+#define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
+
 typedef enum QIOChannelFeature QIOChannelFeature;
 
 enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_FD_PASS,
     QIO_CHANNEL_FEATURE_SHUTDOWN,
     QIO_CHANNEL_FEATURE_LISTEN,
+    QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY,
 };
 
 
@@ -78,6 +81,7 @@ struct QIOChannel {
     AioContext *ctx;
     Coroutine *read_coroutine;
     Coroutine *write_coroutine;
+    bool use_io_uring;
 #ifdef _WIN32
     HANDLE event; /* For use with GSource on Win32 */
 #endif
@@ -104,6 +108,7 @@ struct QIOChannelClass {
                          size_t niov,
                          int *fds,
                          size_t nfds,
+                         int flags,
                          Error **errp);
     ssize_t (*io_readv)(QIOChannel *ioc,
                         const struct iovec *iov,
@@ -136,6 +141,23 @@ struct QIOChannelClass {
                                   IOHandler *io_read,
                                   IOHandler *io_write,
                                   void *opaque);
+    int (*io_flush)(QIOChannel *ioc,
+                    Error **errp);
+
+    /*
+     * Called from a coroutine after io_readv/io_writev would block:
+     * submit the I/O to the AioContext's io_uring and yield until it
+     * completes.  Return QIO_CHANNEL_ERR_BLOCK if that is not possible,
+     * so that the caller falls back to qio_channel_yield().
+     */
+    ssize_t (*io_co_readv)(QIOChannel *ioc,
+                           const struct iovec *iov,
+                           size_t niov,
+                           Error **errp);
+    ssize_t (*io_co_writev)(QIOChannel *ioc,
+                            const struct iovec *iov,
+                            size_t niov,
+                            Error **errp);
 };
 
 /* General I/O handling functions */
@@ -228,6 +250,7 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  * Write data to the IO channel, reading it from the
@@ -251,6 +274,14 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * unless qio_channel_has_feature() returns a true
  * value for the QIO_CHANNEL_FEATURE_FD_PASS constant.
  *
+ * If @flags contains QIO_CHANNEL_WRITE_FLAG_ZERO_COPY, the
+ * memory regions in @iov are sent without being copied and
+ * must not be modified or freed until qio_channel_flush()
+ * returns.  It is an error to pass this flag unless
+ * qio_channel_has_feature() returns a true value for the
+ * QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY constant, or to combine
+ * it with file handles.
+ *
  * Returns: the number of bytes sent, or -1 on error,
  * or QIO_CHANNEL_ERR_BLOCK if no data is can be sent
  * and the channel is non-blocking
@@ -260,6 +291,7 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
                                 size_t niov,
                                 int *fds,
                                 size_t nfds,
+                                int flags,
                                 Error **errp);
 
 /**
@@ -547,6 +579,30 @@ int qio_channel_shutdown(QIOChannel *ioc,
 void qio_channel_set_delay(QIOChannel *ioc,
                            bool enabled);
 
+/**
+ * qio_channel_set_io_uring:
+ * @ioc: the channel object
+ * @enabled: the new flag state
+ *
+ * Controls whether the coroutine paths of qio_channel_readv_all(),
+ * qio_channel_writev_all() and their variants may submit reads
+ * and writes that would block to the io_uring of the channel's
+ * #AioContext, instead of waiting for the file descriptor to
+ * become ready and calling read/write system calls.  This is
+ * only done when the channel implementation supports it, the
+ * #AioContext uses io_uring and is the one the coroutine runs in.
+ * Transfers that pass file descriptors or use zero copy are
+ * never submitted to io_uring.
+ *
+ * While such a request is in flight, the coroutine must only be
+ * entered by its completion: unlike qio_channel_yield(), it cannot
+ * be interrupted, and qio_channel_detach_aio_context() does not
+ * move it to another #AioContext.  Callers that need either must
+ * not enable this.
+ */
+void qio_channel_set_io_uring(QIOChannel *ioc,
+                              bool enabled);
+
 /**
  * qio_channel_set_cork:
  * @ioc: the channel object
@@ -837,6 +893,7 @@ int qio_channel_readv_full_all(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  *
@@ -853,6 +910,22 @@ int qio_channel_writev_full_all(QIOChannel *ioc,
                                 const struct iovec *iov,
                                 size_t niov,
                                 int *fds, size_t nfds,
-                                Error **errp);
+                                int flags, Error **errp);
+
+/**
+ * qio_channel_flush:
+ * @ioc: the channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until all the zero-copy writes that were queued on the
+ * channel with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY have been sent,
+ * so that their buffers can be reused.  Channels without zero-copy
+ * support return immediately.
+ *
+ * Returns: -1 on error, 1 if all the queued writes fell back to
+ * copying the data, 0 otherwise
+ */
+int qio_channel_flush(QIOChannel *ioc,
+                      Error **errp);
 
 #endif /* QIO_CHANNEL_H */
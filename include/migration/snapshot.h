@@ -61,4 +61,16 @@ bool delete_snapshot(const char *name,
                     bool has_devices, strList *devices,
                     Error **errp);
 
+/**
+ * load_clone_template: Start a clone from a template.
+ * @filename: file saved with x-clone-template-save
+ * @errp: pointer to error object
+ * Load the device state of the template into the VM, which must be
+ * created with the template's configuration, and with its file-backed
+ * memory backends mapping the template's files with share=off.
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool load_clone_template(const char *filename, Error **errp);
+
 #endif
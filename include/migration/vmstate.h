@@ -189,6 +189,26 @@ struct VMStateDescription {
     int (*post_save)(void *opaque);
     bool (*needed)(void *opaque);
     bool (*dev_unplug_pending)(void *opaque);
+    /*
+     * With the x-parallel-device-state capability, the device state is
+     * saved and loaded at switchover in a worker thread, concurrently
+     * with other such devices.  The hooks and fields must then not
+     * depend on the BQL or on the state of other devices.
+     */
+    bool parallel;
+    /*
+     * With the x-early-device-state capability, the device state is
+     * sent during precopy, and only the parts that changed are sent
+     * again at switchover.  The state is also loaded at switchover.
+     */
+    bool early_precopy;
+    /*
+     * Optional, for early_precopy devices: return whether the state may
+     * have changed since the previous call, including changes made by
+     * pre_save.  The state is then sent again during precopy; at
+     * switchover, it is not even saved again if nothing changed.
+     */
+    bool (*state_dirty)(void *opaque);
 
     const VMStateField *fields;
     const VMStateDescription **subsections;
@@ -19,6 +19,7 @@
 #define QEMU_NET_CHECKSUM_H
 
 #include "qemu/bswap.h"
+#include "qemu/host-utils.h"
 struct iovec;
 
 #define CSUM_IP     0x01
@@ -108,4 +109,54 @@ void net_toeplitz_add(uint32_t *result,
     *result = accumulator;
 }
 
+/* Longest RSS hash input: two IPv6 addresses and two ports */
+#define NET_TOEPLITZ_MAX_INPUT 36
+
+/*
+ * Contribution to the hash of every value of each input byte, so that
+ * hashing takes a lookup per byte rather than a step per bit.
+ */
+typedef struct NetToeplitzTable {
+    uint32_t v[NET_TOEPLITZ_MAX_INPUT][256];
+} NetToeplitzTable;
+
+/* @key_bytes must be NET_TOEPLITZ_MAX_INPUT + 4 bytes long */
+static inline
+void net_toeplitz_table_init(NetToeplitzTable *table,
+                             const uint8_t *key_bytes)
+{
+    uint32_t i, j, v;
+
+    for (i = 0; i < NET_TOEPLITZ_MAX_INPUT; i++) {
+        /* key bits 8 * i to 8 * i + 39 */
+        uint64_t k = (uint64_t)ldl_be_p(key_bytes + i) << 8 | key_bytes[i + 4];
+        uint32_t window[8];
+
+        /* window[j] is what input bit j of the byte (MSB first) adds */
+        for (j = 0; j < 8; j++) {
+            window[j] = k >> (8 - j);
+        }
+
+        table->v[i][0] = 0;
+        for (v = 1; v < 256; v++) {
+            table->v[i][v] = table->v[i][v & (v - 1)] ^ window[7 - ctz32(v)];
+        }
+    }
+}
+
+/* Same result as net_toeplitz_add() on a zero hash, for the table's key */
+static inline
+uint32_t net_toeplitz_table_hash(const NetToeplitzTable *table,
+                                 const uint8_t *input, uint32_t len)
+{
+    uint32_t hash = 0;
+    uint32_t i;
+
+    assert(len <= NET_TOEPLITZ_MAX_INPUT);
+    for (i = 0; i < len; i++) {
+        hash ^= table->v[i][input[i]];
+    }
+    return hash;
+}
+
 #endif /* QEMU_NET_CHECKSUM_H */
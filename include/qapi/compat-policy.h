@@ -35,4 +35,13 @@ Visitor *qobject_input_visitor_new_qmp(QObject *obj);
  */
 Visitor *qobject_output_visitor_new_qmp(QObject **result);
 
+/*
+ * Create an output visitor for the return value of a QMP command
+ *
+ * When the command runs under qmp_dispatch_json(), this is a JSON
+ * output visitor that writes the value straight into the response, and
+ * @result is left null.  Otherwise, it is qobject_output_visitor_new_qmp().
+ */
+Visitor *qmp_return_visitor_new(QObject **result);
+
 #endif
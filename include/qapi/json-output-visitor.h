@@ -0,0 +1,41 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#ifndef JSON_OUTPUT_VISITOR_H
+#define JSON_OUTPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+#include "qapi/qapi-types-compat.h"
+
+typedef struct JSONOutputVisitor JSONOutputVisitor;
+
+/**
+ * Create a JSON output visitor writing to @writer
+ *
+ * A JSON output visitor visit writes a QAPI object as JSON text, the
+ * same text that qobject_to_json() would produce for the QObject
+ * built by a QObject output visitor visit, except for the order of
+ * object members, which follows the QAPI schema.  No QObject is
+ * built, except for type 'any', whose QObject is written as is.
+ *
+ * The value is written as the next value of @writer.  If @writer is
+ * inside an object, it is written as member @name; the name passed
+ * to the root visit is ignored.
+ *
+ * visit_complete() does nothing; the text is in @writer once the
+ * root visit ends.  Errors are not expected to happen.
+ *
+ * The caller is responsible for freeing the visitor with
+ * visit_free(), and @writer with json_writer_free().
+ */
+Visitor *json_output_visitor_new(JSONWriter *writer, const char *name);
+
+void json_output_visitor_set_policy(Visitor *v,
+                                    CompatPolicyOutput deprecated);
+
+#endif
@@ -57,6 +57,9 @@ bool qmp_has_success_response(const QmpCommand *cmd);
 QDict *qmp_error_response(Error *err);
 QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
                     bool allow_oob, Monitor *cur_mon);
+QDict *qmp_dispatch_json(const QmpCommandList *cmds, QObject *request,
+                         bool allow_oob, Monitor *cur_mon,
+                         JSONWriter *writer);
 bool qmp_is_oob(const QDict *dict);
 
 typedef void (*qmp_cmd_callback_fn)(const QmpCommand *cmd, void *opaque);
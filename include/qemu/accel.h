@@ -29,6 +29,11 @@
 typedef struct AccelState {
     /*< private >*/
     Object parent_obj;
+
+    /* Userspace halt polling of vCPUs, see qemu_wait_io_event() */
+    int64_t halt_poll_max_ns;
+    int64_t halt_poll_grow;
+    int64_t halt_poll_shrink;
 } AccelState;
 
 typedef struct AccelClass {
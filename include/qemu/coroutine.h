@@ -159,7 +159,14 @@ void qemu_co_mutex_init(CoMutex *mutex);
  * Locks the mutex. If the lock cannot be taken immediately, control is
  * transferred to the caller of the current coroutine.
  */
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex);
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex,
+                                          const char *file, int line);
+#define qemu_co_mutex_lock(m) qemu_co_mutex_lock_impl(m, __FILE__, __LINE__)
+
+static inline void coroutine_fn (qemu_co_mutex_lock)(CoMutex *mutex)
+{
+    qemu_co_mutex_lock(mutex);
+}
 
 /**
  * Unlocks the mutex and schedules the next coroutine that was waiting for this
@@ -261,7 +268,9 @@ void qemu_co_rwlock_init(CoRwlock *lock);
  * of a parallel writer, control is transferred to the caller of the current
  * coroutine.
  */
-void qemu_co_rwlock_rdlock(CoRwlock *lock);
+void qemu_co_rwlock_rdlock_impl(CoRwlock *lock, const char *file, int line);
+#define qemu_co_rwlock_rdlock(l) \
+        qemu_co_rwlock_rdlock_impl(l, __FILE__, __LINE__)
 
 /**
  * Write Locks the CoRwlock from a reader.  This is a bit more efficient than
@@ -270,7 +279,9 @@ void qemu_co_rwlock_rdlock(CoRwlock *lock);
  * to the caller of the current coroutine; another writer might run while
  * @qemu_co_rwlock_upgrade blocks.
  */
-void qemu_co_rwlock_upgrade(CoRwlock *lock);
+void qemu_co_rwlock_upgrade_impl(CoRwlock *lock, const char *file, int line);
+#define qemu_co_rwlock_upgrade(l) \
+        qemu_co_rwlock_upgrade_impl(l, __FILE__, __LINE__)
 
 /**
  * Downgrades a write-side critical section to a reader.  Downgrading with
@@ -285,7 +296,9 @@ void qemu_co_rwlock_downgrade(CoRwlock *lock);
  * of a parallel reader, control is transferred to the caller of the current
  * coroutine.
  */
-void qemu_co_rwlock_wrlock(CoRwlock *lock);
+void qemu_co_rwlock_wrlock_impl(CoRwlock *lock, const char *file, int line);
+#define qemu_co_rwlock_wrlock(l) \
+        qemu_co_rwlock_wrlock_impl(l, __FILE__, __LINE__)
 
 /**
  * Unlocks the read/write lock and schedules the next coroutine that was
@@ -35,6 +35,12 @@ extern __thread void *__safestack_unsafe_stack_ptr;
 
 #define COROUTINE_STACK_SIZE (1 << 20)
 
+/*
+ * Part of the stack of a terminated coroutine that the backend may still
+ * use, where it is suspended until the coroutine is reused.
+ */
+#define COROUTINE_STACK_KEEP (64 << 10)
+
 typedef enum {
     COROUTINE_YIELD = 1,
     COROUTINE_TERMINATE = 2,
@@ -71,6 +77,8 @@ struct Coroutine {
 
 Coroutine *qemu_coroutine_new(void);
 void qemu_coroutine_delete(Coroutine *co);
+/* Give memory of a terminated coroutine's stack back to the host */
+void qemu_coroutine_discard_stack(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 
@@ -28,6 +28,9 @@
 #ifndef bit_SSE4_1
 #define bit_SSE4_1      (1 << 19)
 #endif
+#ifndef bit_AES
+#define bit_AES         (1 << 25)
+#endif
 #ifndef bit_MOVBE
 #define bit_MOVBE       (1 << 22)
 #endif
@@ -48,6 +51,9 @@
 #ifndef bit_AVX512F
 #define bit_AVX512F        (1 << 16)
 #endif
+#ifndef bit_AVX512BW
+#define bit_AVX512BW       (1 << 30)
+#endif
 #ifndef bit_BMI2
 #define bit_BMI2        (1 << 8)
 #endif
@@ -255,6 +255,44 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
 void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish);
 
+/**
+ * hbitmap_serialize_runs
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer to store the runs.
+ * @size: Size of @buf.
+ * @start: First bit to store.
+ * @count: Number of bits to store.
+ *
+ * Stores HBitmap data corresponding to given region as the lengths, in
+ * units of the granularity, of the alternating runs of clear and set bits,
+ * starting with a clear run.  Each length is encoded as ULEB128.  Sparse or
+ * clustered bitmaps are much smaller in this format than with
+ * hbitmap_serialize_part.
+ *
+ * Returns the number of bytes used, or 0 if the runs do not fit in @size.
+ */
+size_t hbitmap_serialize_runs(const HBitmap *hb, uint8_t *buf, size_t size,
+                              uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_deserialize_runs
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer to restore bitmap data from.
+ * @size: Size of @buf.
+ * @start: First bit to restore.
+ * @count: Number of bits to restore.
+ * @finish: Whether to call hbitmap_deserialize_finish automatically.
+ *
+ * Restores HBitmap data corresponding to given region from the runs stored
+ * by hbitmap_serialize_runs.
+ *
+ * Returns 0 on success, or -EINVAL if the runs do not cover exactly the
+ * region.  If @finish is false, caller must call hbitmap_serialize_finish
+ * before using the bitmap.
+ */
+int hbitmap_deserialize_runs(HBitmap *hb, const uint8_t *buf, size_t size,
+                             uint64_t start, uint64_t count, bool finish);
+
 /**
  * hbitmap_deserialize_finish
  * @hb: HBitmap to operate on.
@@ -471,6 +471,11 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #else
 #define QEMU_MADV_REMOVE QEMU_MADV_DONTNEED
 #endif
+#ifdef MADV_POPULATE_WRITE
+#define QEMU_MADV_POPULATE_WRITE MADV_POPULATE_WRITE
+#else
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#endif
 
 #elif defined(CONFIG_POSIX_MADVISE)
 
@@ -484,6 +489,7 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_DONTNEED
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #else /* no-op */
 
@@ -497,6 +503,7 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #endif
 
@@ -687,8 +694,32 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor of the memory, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory
+ * @smp_cpus: maximum number of threads to use
+ * @affinity: bitmap of host CPUs to run the threads on, or %NULL
+ * @naffinity: number of bits in @affinity
+ * @async: return without waiting for the threads, if possible
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Fault in all pages of @area.  With @async, the preallocation may still
+ * be running when this returns; os_mem_prealloc_finish() then waits for
+ * it and reports its errors.
+ */
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
-                     Error **errp);
+                     const unsigned long *affinity, unsigned long naffinity,
+                     bool async, Error **errp);
+
+/**
+ * os_mem_prealloc_finish:
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait for the preallocations that os_mem_prealloc() left running.
+ */
+void os_mem_prealloc_finish(Error **errp);
 
 /**
  * qemu_get_pid_name:
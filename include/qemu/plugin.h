@@ -68,6 +68,7 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,         /* not used for mem callbacks */
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -84,10 +85,22 @@ struct qemu_plugin_dyn_cb {
     enum qemu_plugin_mem_rw rw;
     /* fields specific to each dyn_cb type go here */
     union {
+        /* @entry.score is NULL if the op applies to @userp */
         struct {
             enum qemu_plugin_op op;
+            qemu_plugin_u64 entry;
             uint64_t imm;
         } inline_insn;
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
+        /* mem callbacks only; @filtered is false for the plain ones */
+        struct {
+            bool filtered;
+            struct qemu_plugin_mem_filter filter;
+        } mem;
     };
 };
 
@@ -182,12 +195,26 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
 
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t meminfo);
 
+/*
+ * Called from the generated code in place of a filtered mem callback;
+ * @udata points to a copy of its qemu_plugin_dyn_cb.
+ */
+void qemu_plugin_vcpu_mem_filtered_cb(unsigned int vcpu_index,
+                                      qemu_plugin_meminfo_t info,
+                                      uint64_t vaddr, void *udata);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
 
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
 
+/*
+ * Return the address of @entry for vCPU 0, and in @stride the distance
+ * between the entries of two consecutive vCPUs.
+ */
+void *qemu_plugin_u64_base(qemu_plugin_u64 entry, size_t *stride);
+
 void qemu_plugin_disable_mem_helpers(CPUState *cpu);
 
 #else /* !CONFIG_PLUGIN */
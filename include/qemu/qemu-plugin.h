@@ -50,7 +50,14 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+/*
+ * Version history:
+ *
+ * 1: initial version
+ * 2: added per-vCPU scoreboards, qemu_plugin_u64 inline operations,
+ *    conditional callbacks and filtered memory callbacks
+ */
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -273,14 +280,119 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
  * enum qemu_plugin_op - describes an inline op
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
- *
- * Note: currently only a single inline op is supported.
+ * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
 };
 
+/**
+ * enum qemu_plugin_cond - condition to enable a callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: false
+ * @QEMU_PLUGIN_COND_ALWAYS: true
+ * @QEMU_PLUGIN_COND_EQ: is equal?
+ * @QEMU_PLUGIN_COND_NE: is not equal?
+ * @QEMU_PLUGIN_COND_LT: is less than?
+ * @QEMU_PLUGIN_COND_LE: is less than or equal?
+ * @QEMU_PLUGIN_COND_GT: is greater than?
+ * @QEMU_PLUGIN_COND_GE: is greater than or equal?
+ *
+ * The comparisons are unsigned.
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
+};
+
+/**
+ * struct qemu_plugin_scoreboard - opaque handle for a scoreboard
+ *
+ * A scoreboard is an array of elements of the same size, one per vCPU,
+ * that inline operations can update without synchronisation between
+ * vCPUs.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of an entry in a scoreboard
+ * @score: the scoreboard
+ * @offset: offset of the uint64_t in an element of @score
+ *
+ * This is used to access a counter of a specific vCPU, or to sum that
+ * counter over all vCPUs.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
+/**
+ * qemu_plugin_scoreboard_new() - allocate a new scoreboard
+ * @element_size: size in bytes of the element of each vCPU
+ *
+ * The elements are zeroed.  A scoreboard must not be freed while
+ * translated code that updates it may still execute, e.g. it can be
+ * freed from the atexit callback.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get the element of a vCPU
+ * @score: scoreboard to query
+ * @vcpu_index: index of the vCPU
+ *
+ * The returned pointer is only valid until the next vCPU is created,
+ * since that may move the scoreboard.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_add() - add a value to a qemu_plugin_u64 of a vCPU
+ * @entry: the entry to update
+ * @vcpu_index: index of the vCPU
+ * @added: value to add
+ */
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get the value of a qemu_plugin_u64 of a vCPU
+ * @entry: the entry to read
+ * @vcpu_index: index of the vCPU
+ */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set the value of a qemu_plugin_u64 of a vCPU
+ * @entry: the entry to update
+ * @vcpu_index: index of the vCPU
+ * @val: new value
+ */
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - sum a qemu_plugin_u64 over all vCPUs
+ * @entry: the entry to sum
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
 /**
  * qemu_plugin_register_vcpu_tb_exec_inline() - execution inline op
  * @tb: the opaque qemu_plugin_tb handle for the translation
@@ -299,6 +411,46 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the entry of the scoreboard to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op is applied
+ * to the element of the executing vCPU, so the results are exact even
+ * when several vCPUs run in parallel.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - conditional TB execution cb
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable the callback
+ * @entry: first operand of the condition, read for the executing vCPU
+ * @imm: second operand of the condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time a translated unit executes and
+ * @entry @cond @imm holds.  The check is done inline, so combined with
+ * inline ops this can be used to only call out when a counter reaches
+ * a threshold.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *userdata);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -327,6 +479,44 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the entry of the scoreboard to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_insn_exec_inline(), but the op is
+ * applied to the element of the executing vCPU.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable the callback
+ * @entry: first operand of the condition, read for the executing vCPU
+ * @imm: second operand of the condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time an instruction executes and
+ * @entry @cond @imm holds.
+ */
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *userdata);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -496,7 +686,71 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU mem inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @rw: monitor reads, writes or both
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the entry of the scoreboard to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_mem_inline(), but the op is applied to
+ * the element of the executing vCPU.
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
 
+/**
+ * enum qemu_plugin_mem_attr - the kind of memory a mem filter accepts
+ *
+ * @QEMU_PLUGIN_MEM_ATTR_ANY: any memory
+ * @QEMU_PLUGIN_MEM_ATTR_RAM: RAM only (all accesses in user mode)
+ * @QEMU_PLUGIN_MEM_ATTR_IO: MMIO only (no accesses in user mode)
+ */
+enum qemu_plugin_mem_attr {
+    QEMU_PLUGIN_MEM_ATTR_ANY,
+    QEMU_PLUGIN_MEM_ATTR_RAM,
+    QEMU_PLUGIN_MEM_ATTR_IO,
+};
+
+/**
+ * struct qemu_plugin_mem_filter - the accesses a mem callback is called for
+ *
+ * @start: lowest guest virtual address of the range
+ * @end: highest guest virtual address of the range (inclusive)
+ * @attr: the kind of memory the access must target
+ */
+struct qemu_plugin_mem_filter {
+    uint64_t start;
+    uint64_t end;
+    enum qemu_plugin_mem_attr attr;
+};
+
+/**
+ * qemu_plugin_register_vcpu_mem_cb_filtered() - register a filtered mem cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback of type qemu_plugin_vcpu_mem_cb_t
+ * @flags: (currently unused) callback flags
+ * @rw: monitor reads, writes or both
+ * @filter: the accesses @cb is called for; it is copied
+ * @userdata: opaque pointer for userdata
+ *
+ * Like qemu_plugin_register_vcpu_mem_cb(), but QEMU only calls into the
+ * plugin for the accesses that match @filter. The address range is
+ * checked first, so the attributes are only looked up for accesses
+ * within it.
+ */
+void qemu_plugin_register_vcpu_mem_cb_filtered(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_mem_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_mem_rw rw,
+    const struct qemu_plugin_mem_filter *filter,
+    void *userdata);
 
 typedef void
 (*qemu_plugin_vcpu_syscall_cb_t)(qemu_plugin_id_t id, unsigned int vcpu_index,
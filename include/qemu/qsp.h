@@ -16,12 +16,89 @@ enum QSPSortBy {
     QSP_SORT_BY_AVG_WAIT_TIME,
 };
 
+enum QSPType {
+    QSP_MUTEX,
+    QSP_BQL_MUTEX,
+    QSP_REC_MUTEX,
+    QSP_CONDVAR,
+    QSP_CO_MUTEX,
+    QSP_CO_RWLOCK_RD,
+    QSP_CO_RWLOCK_WR,
+    QSP_LOCKCNT,
+    QSP_TYPE__MAX,
+};
+
+/*
+ * Wait time histogram: bucket 0 counts waits shorter than 2^QSP_HIST_SHIFT
+ * ns, bucket i counts waits in [2^(i + QSP_HIST_SHIFT - 1),
+ * 2^(i + QSP_HIST_SHIFT)) ns, and the last bucket also counts longer waits.
+ */
+#define QSP_HIST_SHIFT 7
+#define QSP_HIST_BUCKETS 20
+
+typedef struct QSPReportEntry {
+    const void *obj;
+    char *callsite_at;
+    enum QSPType type;
+    uint64_t ns;
+    uint64_t n_acqs;
+    unsigned int n_objs;
+    uint64_t hist[QSP_HIST_BUCKETS];
+} QSPReportEntry;
+
 void qsp_report(size_t max, enum QSPSortBy sort_by,
                 bool callsite_coalesce);
 
+/*
+ * Fill @entries with up to @max entries, as qsp_report() would print.
+ * Returns the number of entries; free them with qsp_report_free().
+ */
+size_t qsp_get_report(size_t max, enum QSPSortBy sort_by,
+                      bool callsite_coalesce, QSPReportEntry **entries);
+void qsp_report_free(QSPReportEntry *entries, size_t n_entries);
+
 bool qsp_is_enabled(void);
 void qsp_enable(void);
 void qsp_disable(void);
 void qsp_reset(void);
 
+/*
+ * Only time one in @period operations, and scale what is recorded by
+ * @period.  A period of 1 (the default) times every operation.
+ */
+void qsp_set_sample_period(unsigned int period);
+unsigned int qsp_get_sample_period(void);
+
+/*
+ * Primitives that are not wrapped by qsp.c, such as coroutine locks and
+ * lockcnts, time their slow paths with these:
+ *
+ *     QSPSample s;
+ *     bool sampled = qsp_sample_start(&s);
+ *
+ *     ... wait for the lock ...
+ *
+ *     if (sampled) {
+ *         qsp_sample_end(&s, obj, file, line, QSP_...);
+ *     }
+ */
+typedef struct QSPSample {
+    int64_t t0;
+    unsigned int weight;
+} QSPSample;
+
+extern bool qsp_enabled;
+
+bool qsp_sample_start__slowpath(QSPSample *s);
+void qsp_sample_end(QSPSample *s, const void *obj, const char *file, int line,
+                    enum QSPType type);
+
+static inline bool qsp_sample_start(QSPSample *s)
+{
+    if (likely(!qatomic_read(&qsp_enabled))) {
+        return false;
+    }
+    return qsp_sample_start__slowpath(s);
+}
+
 #endif /* QEMU_QSP_H */
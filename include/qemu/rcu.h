@@ -63,6 +63,13 @@ struct rcu_reader_data {
 
     /* Data used by reader only */
     unsigned depth;
+    bool registered;
+
+    /*
+     * Callbacks queued by call_rcu1() on this thread, newest first.  The
+     * call_rcu thread takes the whole list at once.
+     */
+    struct rcu_head *callbacks;
 
     /* Data used for registry, protected by rcu_registry_lock */
     QLIST_ENTRY(rcu_reader_data) node;
@@ -135,6 +142,16 @@ struct rcu_head {
 extern void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 extern void drain_call_rcu(void);
 
+typedef struct RCUStats {
+    uint64_t grace_periods;         /* synchronize_rcu() calls */
+    uint64_t grace_period_ns;       /* total time spent in them */
+    uint64_t max_grace_period_ns;
+    uint64_t callbacks;             /* callbacks run by the call_rcu thread */
+    uint64_t callback_batches;      /* grace periods it waited for them */
+} RCUStats;
+
+extern void rcu_get_stats(RCUStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
@@ -0,0 +1,56 @@
+/*
+ * Host CPU placement of QEMU threads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_THREAD_PLACEMENT_H
+#define QEMU_THREAD_PLACEMENT_H
+
+#include "qemu/thread.h"
+#include "qapi/qapi-types-qom.h"
+
+/*
+ * Called with the placement lock held, so implementations may keep
+ * round-robin state without further locking.
+ */
+typedef void QemuThreadPlacementFunc(QemuThread *thread, void *opaque);
+
+/**
+ * qemu_thread_placement_register:
+ * @role: the kind of threads to place
+ * @fn: the function that places each new thread of @role
+ * @opaque: passed to @fn
+ *
+ * Install the placement policy for threads of @role.  Only one policy
+ * can be installed per role.
+ *
+ * Returns: false if @role already has a placement policy.
+ */
+bool qemu_thread_placement_register(ThreadPlacementRole role,
+                                    QemuThreadPlacementFunc *fn,
+                                    void *opaque);
+
+/**
+ * qemu_thread_placement_unregister:
+ * @role: the kind of threads
+ * @opaque: the value passed to qemu_thread_placement_register()
+ *
+ * Remove the placement policy for @role.  Threads that were already
+ * placed keep their affinity.
+ */
+void qemu_thread_placement_unregister(ThreadPlacementRole role,
+                                      void *opaque);
+
+/**
+ * qemu_thread_place:
+ * @thread: a thread returned by qemu_thread_create()
+ * @role: the kind of thread
+ *
+ * Apply the placement policy for @role, if any, to @thread.  Call this
+ * right after creating the thread.
+ */
+void qemu_thread_place(QemuThread *thread, ThreadPlacementRole role);
+
+#endif
@@ -189,6 +189,18 @@ void *qemu_thread_join(QemuThread *thread);
 void qemu_thread_get_self(QemuThread *thread);
 bool qemu_thread_is_self(QemuThread *thread);
 void qemu_thread_exit(void *retval) QEMU_NORETURN;
+
+/**
+ * qemu_thread_set_affinity:
+ * @thread: the thread to pin
+ * @host_cpus: bitmap of the host CPUs @thread may run on
+ * @nbits: the number of bits in @host_cpus
+ *
+ * Returns: 0 on success, a negative errno value on failure or if the
+ * host does not support setting the affinity of a thread.
+ */
+int qemu_thread_set_affinity(QemuThread *thread, unsigned long *host_cpus,
+                             unsigned long nbits);
 void qemu_thread_naming(bool enable);
 
 struct Notifier;
@@ -330,7 +342,8 @@ void qemu_lockcnt_destroy(QemuLockCnt *lockcnt);
  *            qemu_lockcnt_inc(&lc2);
  *                                          qemu_lockcnt_inc(&lc1);
  */
-void qemu_lockcnt_inc(QemuLockCnt *lockcnt);
+void qemu_lockcnt_inc_impl(QemuLockCnt *lockcnt, const char *file, int line);
+#define qemu_lockcnt_inc(l) qemu_lockcnt_inc_impl(l, __FILE__, __LINE__)
 
 /**
  * qemu_lockcnt_dec: decrement a QemuLockCnt's counter
@@ -346,7 +359,10 @@ void qemu_lockcnt_dec(QemuLockCnt *lockcnt);
  * Decrement lockcnt's count.  If the new count is zero, lock
  * the mutex and return true.  Otherwise, return false.
  */
-bool qemu_lockcnt_dec_and_lock(QemuLockCnt *lockcnt);
+bool qemu_lockcnt_dec_and_lock_impl(QemuLockCnt *lockcnt,
+                                    const char *file, int line);
+#define qemu_lockcnt_dec_and_lock(l) \
+        qemu_lockcnt_dec_and_lock_impl(l, __FILE__, __LINE__)
 
 /**
  * qemu_lockcnt_dec_if_lock: possibly decrement a QemuLockCnt's counter and
@@ -366,7 +382,8 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt);
  * also zero.  You can use qemu_lockcnt_count to check for this inside a
  * critical section.
  */
-void qemu_lockcnt_lock(QemuLockCnt *lockcnt);
+void qemu_lockcnt_lock_impl(QemuLockCnt *lockcnt, const char *file, int line);
+#define qemu_lockcnt_lock(l) qemu_lockcnt_lock_impl(l, __FILE__, __LINE__)
 
 /**
  * qemu_lockcnt_unlock: release a QemuLockCnt's mutex.
@@ -0,0 +1,50 @@
+/*
+ * Startup timeline recorder
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_TIMELINE_H
+#define QEMU_TIMELINE_H
+
+/*
+ * The timeline records spans of work that make up the startup of QEMU
+ * (machine phases, device realization, block device opening, RAM
+ * preallocation, firmware loading, incoming migration).  It is always
+ * compiled in: only a bounded number of coarse events are recorded,
+ * so the cost is a clock read and a short critical section per event.
+ */
+#define TIMELINE_MAX_EVENTS 4096
+
+typedef struct TimelineEvent {
+    const char *category;
+    char *name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    int thread_id;
+} TimelineEvent;
+
+/* Return the timestamp to pass to timeline_record() */
+int64_t timeline_start(void);
+
+/*
+ * Record a span of @category (a string literal) called @name, from
+ * @start_ns until now.  Events beyond TIMELINE_MAX_EVENTS are dropped.
+ */
+void timeline_record(const char *category, const char *name,
+                     int64_t start_ns);
+
+/*
+ * Copy the recorded events in *@events, sorted by start time, and
+ * return their number.  Free the copy with timeline_free().
+ */
+size_t timeline_get(TimelineEvent **events);
+void timeline_free(TimelineEvent *events, size_t n);
+
+/* Return the number of events dropped because the timeline was full */
+uint64_t timeline_dropped(void);
+
+/* Write the timeline to @filename in the Chrome trace event format */
+bool timeline_dump_chrome(const char *filename, Error **errp);
+
+#endif
@@ -86,7 +86,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* orders timers with equal expire_time */
+    size_t heap_index;          /* position in timer_list, while pending */
     int attributes;
     int scale;
 };
@@ -190,6 +191,19 @@ bool qemu_clock_use_for_deadline(QEMUClockType type);
  */
 int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask);
 
+/**
+ * qemu_clock_deadline_gen:
+ * @type: the clock type
+ *
+ * Return a counter that changes whenever a timer of the clock is armed
+ * to expire before all the other pending ones, or the clock is enabled.
+ * As long as it does not change, the absolute expiry time found by
+ * qemu_clock_deadline_ns_all() can only stay the same or move later.
+ *
+ * Returns: the deadline generation of the clock
+ */
+unsigned qemu_clock_deadline_gen(QEMUClockType type);
+
 /**
  * qemu_clock_get_main_loop_timerlist:
  * @type: the clock type
@@ -137,6 +137,14 @@ struct ObjectClass
     ObjectUnparent *unparent;
 
     GHashTable *properties;
+
+    /*
+     * Properties of the class and all its parents, by name, built on
+     * the first lookup.  @prop_table_inherited is set once a subclass
+     * has copied the table into its own.
+     */
+    GHashTable *prop_table;
+    bool prop_table_inherited;
 };
 
 /**
@@ -49,6 +49,17 @@ void cpu_throttle_set(int new_throttle_pct);
  */
 void cpu_throttle_stop(void);
 
+/**
+ * cpu_throttle_set_exempt:
+ * @cpu: The vCPU to configure.
+ * @exempt: %true to let @cpu run at full speed while throttling is active.
+ *
+ * Excludes a single vcpu from the throttling started by cpu_throttle_set,
+ * or includes it again.  All the exemptions are dropped by
+ * cpu_throttle_stop.
+ */
+void cpu_throttle_set_exempt(CPUState *cpu, bool exempt);
+
 /**
  * cpu_throttle_active:
  *
@@ -32,6 +32,7 @@
 #define DUMP_DH_COMPRESSED_ZLIB     (0x1)
 #define DUMP_DH_COMPRESSED_LZO      (0x2)
 #define DUMP_DH_COMPRESSED_SNAPPY   (0x4)
+#define DUMP_DH_COMPRESSED_ZSTD     (0x20)
 
 #define KDUMP_SIGNATURE             "KDUMP   "
 #define SIG_LEN                     (sizeof(KDUMP_SIGNATURE) - 1)
@@ -162,6 +163,7 @@ typedef struct DumpState {
     ssize_t note_size;
     hwaddr memory_offset;
     int fd;
+    bool sparse;                /* zero pages can be left as holes */
 
     GuestPhysBlock *next_block;
     ram_addr_t start;
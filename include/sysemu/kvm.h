@@ -213,6 +213,22 @@ typedef struct Notifier Notifier;
 
 bool kvm_has_free_slot(MachineState *ms);
 bool kvm_has_sync_mmu(void);
+bool kvm_dirty_ring_enabled(void);
+
+typedef void KVMDirtyPageCountFn(void *host, uint64_t size,
+                                 uint64_t dirty_pages, void *opaque);
+
+/**
+ * kvm_dirty_page_counts - report the dirty page counter of each memslot
+ * @fn: called with the host address and size of each slot, and the number
+ *      of pages that KVM reported dirty in it, either through the dirty
+ *      ring or through KVM_GET_DIRTY_LOG, since the slot was created
+ * @opaque: passed to @fn
+ *
+ * The counters only move while dirty logging is enabled.  @fn is called
+ * with the memslots lock held and must not call back into KVM.
+ */
+void kvm_dirty_page_counts(KVMDirtyPageCountFn *fn, void *opaque);
 int kvm_has_vcpu_events(void);
 int kvm_has_robust_singlestep(void);
 int kvm_has_debugregs(void);
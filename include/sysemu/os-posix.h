@@ -84,6 +84,18 @@ void *qemu_alloc_stack(size_t *sz);
  */
 void qemu_free_stack(void *stack, size_t sz);
 
+/**
+ * qemu_discard_stack:
+ * @stack: stack allocated via qemu_alloc_stack()
+ * @sz: size of stack in bytes, as returned by qemu_alloc_stack()
+ * @keep: number of bytes to keep at the start (top) of the stack
+ *
+ * Give the memory of a stack back to the host, except for the @keep bytes
+ * where the stack starts growing from.  The memory reads as zero when it
+ * is used again.  This is a hint, it may do nothing on some hosts.
+ */
+void qemu_discard_stack(void *stack, size_t sz, size_t keep);
+
 /* POSIX and Mingw32 differ in the name of the stdio lock functions.  */
 
 static inline void qemu_flockfile(FILE *f)
@@ -0,0 +1,64 @@
+/*
+ * Statistics reported by query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "qapi/qapi-types-stats.h"
+
+/*
+ * Add to @result the statistics of the objects of kind @target.  Only
+ * the objects whose QOM path is in @targets and the statistics whose
+ * name is in @names are returned; a null list matches everything.
+ */
+typedef void StatsRetrieveFunc(StatsResultList **result, StatsTarget target,
+                               strList *targets, strList *names,
+                               Error **errp);
+
+/* Add to @result the schemas of the provider, one per target */
+typedef void StatsSchemaRetrieveFunc(StatsSchemaList **result, Error **errp);
+
+/*
+ * Register the callbacks of @provider.  Called once per provider while
+ * QEMU starts, from the main thread.
+ */
+void add_stats_callbacks(StatsProvider provider,
+                         StatsRetrieveFunc *stats_fn,
+                         StatsSchemaRetrieveFunc *schemas_fn);
+
+/* Helpers for providers */
+
+typedef struct StatsDescriptor {
+    const char *name;
+    StatsType type;
+    bool has_unit;
+    StatsUnit unit;
+} StatsDescriptor;
+
+/* Whether @string is in @list, or @list is null */
+bool apply_str_list_filter(const char *string, strList *list);
+
+/* Add a schema for @target, with the @n statistics in @desc */
+void stats_add_schema(StatsSchemaList **result, StatsProvider provider,
+                      StatsTarget target, const StatsDescriptor *desc,
+                      size_t n);
+
+/* Add statistic @name to @stats, unless @names filters it out */
+void stats_add_value(StatsList **stats, strList *names, const char *name,
+                     uint64_t value);
+void stats_add_values(StatsList **stats, strList *names, const char *name,
+                      const uint64_t *values, size_t n);
+
+/*
+ * Add the statistics in @stats to @result, for the object at @qom_path
+ * (which may be null).  Nothing is added if @stats is empty, e.g.
+ * because @names filtered out everything.
+ */
+void stats_add_result(StatsResultList **result, StatsProvider provider,
+                      const char *qom_path, StatsList *stats);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TCG_PERF_H
+#define TCG_PERF_H
+
+/* Start writing the perf map (/tmp/perf-<pid>.map) */
+void perf_enable_perfmap(void);
+
+/* Start writing the jitdump (jit-<pid>.dump in the current directory) */
+void perf_enable_jitdump(void);
+
+/* Add information about the TCG prologue to the enabled outputs */
+void perf_report_prologue(const void *start, size_t size);
+
+/* Add information about a translation block to the enabled outputs */
+void perf_report_code(uint64_t guest_pc, const void *start, size_t size);
+
+#endif /* TCG_PERF_H */
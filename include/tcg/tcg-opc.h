@@ -279,6 +279,8 @@ DEF(last_generic, 0, 0, 0, TCG_OPF_NOT_PRESENT)
 /* These opcodes are only for use between the tci generator and interpreter. */
 DEF(tci_movi, 1, 0, 1, TCG_OPF_NOT_PRESENT)
 DEF(tci_movl, 1, 0, 1, TCG_OPF_NOT_PRESENT)
+DEF(tci_brcond_i32, 0, 2, 2, TCG_OPF_NOT_PRESENT)
+DEF(tci_brcond_i64, 0, 2, 2, TCG_OPF_NOT_PRESENT)
 #endif
 
 #undef TLADDR_ARGS
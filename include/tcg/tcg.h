@@ -533,6 +533,19 @@ typedef struct TCGProfile {
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
+/*
+ * Translation counters.  Unlike TCGProfile they are always kept, since
+ * they cost a handful of additions per TB; see tcg_gen_stats().
+ */
+typedef struct TCGGenStats {
+    size_t tb_count;        /* TBs whose code generation completed */
+    size_t guest_insns;
+    size_t guest_bytes;
+    size_t host_bytes;
+    size_t helper_calls;    /* call ops emitted, i.e. helpers per TB */
+    uint64_t gen_time_ns;   /* time spent in tb_gen_code() */
+} TCGGenStats;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -580,6 +593,9 @@ struct TCGContext {
     void *code_gen_highwater;
 
     size_t tb_phys_invalidate_count;
+    TCGGenStats gen_stats;
+    /* Number of call ops in the code emitted by the last tcg_gen_code() */
+    int gen_nb_calls;
 
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
@@ -817,6 +833,8 @@ size_t tcg_code_capacity(void);
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 size_t tcg_tb_phys_invalidate_count(void);
+/* Sum the TCGGenStats of all TCG contexts into @stats */
+void tcg_gen_stats(TCGGenStats *stats);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
@@ -26,6 +26,13 @@
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
+#ifdef CONFIG_LINUX
+#include <linux/errqueue.h>
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#endif
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -135,6 +142,22 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+/*
+ * Let sends on the socket use MSG_ZEROCOPY.  This has no cost for writes
+ * that do not ask for zero-copy, so it is done for all TCP sockets.
+ */
+static void qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    }
+#endif
+}
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -153,6 +176,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         close(fd);
         return -1;
     }
+    qio_channel_socket_enable_zero_copy(ioc);
 
     return 0;
 }
@@ -384,6 +408,8 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
     if (cioc->localAddr.ss_family == AF_UNIX) {
         QIOChannel *ioc_local = QIO_CHANNEL(cioc);
         qio_channel_set_feature(ioc_local, QIO_CHANNEL_FEATURE_FD_PASS);
+    } else {
+        qio_channel_socket_enable_zero_copy(cioc);
     }
 #endif /* WIN32 */
 
@@ -525,6 +551,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          size_t niov,
                                          int *fds,
                                          size_t nfds,
+                                         int flags,
                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
@@ -533,6 +560,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     char control[CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS)];
     size_t fdsize = sizeof(int) * nfds;
     struct cmsghdr *cmsg;
+    int sflags = 0;
 
     memset(control, 0, CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS));
 
@@ -557,8 +585,14 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         memcpy(CMSG_DATA(cmsg), fds, fdsize);
     }
 
+#ifdef QEMU_MSG_ZEROCOPY
+    if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+        sflags = MSG_ZEROCOPY;
+    }
+#endif
+
  retry:
-    ret = sendmsg(sioc->fd, &msg, 0);
+    ret = sendmsg(sioc->fd, &msg, sflags);
     if (ret <= 0) {
         if (errno == EAGAIN) {
             return QIO_CHANNEL_ERR_BLOCK;
@@ -566,12 +600,208 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         if (errno == EINTR) {
             goto retry;
         }
+#ifdef QEMU_MSG_ZEROCOPY
+        if (errno == ENOBUFS && sflags) {
+            /* Over the locked memory limit, copy the data instead */
+            trace_qio_channel_socket_zero_copy_fallback(sioc);
+            sflags = 0;
+            goto retry;
+        }
+#endif
         error_setg_errno(errp, errno,
                          "Unable to write to socket");
         return -1;
     }
+    if (sflags) {
+        sioc->zero_copy_queued++;
+    }
+    return ret;
+}
+
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Read the zero-copy completions from the socket error queue, waiting for
+ * new ones if @block is true, until all queued zero-copy writes completed.
+ * Returns -1 on error, 1 if the kernel copied the data of all completed
+ * writes anyway, 0 otherwise.
+ */
+static int qio_channel_socket_read_errqueue(QIOChannelSocket *sioc,
+                                            bool block,
+                                            Error **errp)
+{
+    struct msghdr msg = {};
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    char control[CMSG_SPACE(sizeof(*serr))];
+    int received;
+    int ret = 1;
+
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (received < 0) {
+            switch (errno) {
+            case EAGAIN:
+                if (!block) {
+                    return ret;
+                }
+                /* Nothing on the error queue, wait until there is */
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
+                continue;
+            case EINTR:
+                continue;
+            default:
+                error_setg_errno(errp, errno,
+                                 "Unable to read errqueue");
+                return -1;
+            }
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (!cm ||
+            !((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+            error_setg_errno(errp, EPROTOTYPE,
+                             "Wrong cmsg in errqueue");
+            return -1;
+        }
+
+        serr = (void *) CMSG_DATA(cm);
+        if (serr->ee_errno != 0) {
+            error_setg_errno(errp, serr->ee_errno,
+                             "Error on socket");
+            return -1;
+        }
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, serr->ee_origin,
+                             "Error not from zero copy");
+            return -1;
+        }
+
+        /* No errors, count the completed range of sendmsg() calls */
+        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+
+        /* Whether any sendmsg() was really done without copying */
+        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+
+    return qio_channel_socket_read_errqueue(sioc, true, errp);
+}
+
+int qio_channel_socket_poll_zero_copy(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+    return qio_channel_socket_read_errqueue(ioc, false, errp) < 0 ? -1 : 0;
+}
+#endif /* QEMU_MSG_ZEROCOPY */
+
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct {
+    CqeHandler cqe_handler;
+    Coroutine *co;
+    int fd;
+    bool write;
+    struct msghdr msg;
+} QIOChannelSocketUringRequest;
+
+static void qio_channel_socket_uring_prep(struct io_uring_sqe *sqe,
+                                          void *opaque)
+{
+    QIOChannelSocketUringRequest *req = opaque;
+
+    if (req->write) {
+        io_uring_prep_sendmsg(sqe, req->fd, &req->msg, 0);
+    } else {
+        io_uring_prep_recvmsg(sqe, req->fd, &req->msg, 0);
+    }
+}
+
+static void qio_channel_socket_uring_done(CqeHandler *cqe_handler)
+{
+    QIOChannelSocketUringRequest *req =
+        container_of(cqe_handler, QIOChannelSocketUringRequest, cqe_handler);
+
+    aio_co_wake(req->co);
+}
+
+/*
+ * The kernel waits for the socket to become ready and then does the
+ * transfer, so that neither the readiness notification nor the
+ * recvmsg/sendmsg cost a system call of their own.
+ */
+static ssize_t coroutine_fn
+qio_channel_socket_co_rw_io_uring(QIOChannelSocket *sioc,
+                                  const struct iovec *iov,
+                                  size_t niov,
+                                  bool write,
+                                  Error **errp)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    QIOChannelSocketUringRequest req = {
+        .cqe_handler.cb = qio_channel_socket_uring_done,
+        .co = qemu_coroutine_self(),
+        .fd = sioc->fd,
+        .write = write,
+        .msg.msg_iov = (struct iovec *)iov,
+        .msg.msg_iovlen = niov,
+    };
+    int ret;
+
+    if (QIO_CHANNEL(sioc)->ctx != ctx || !aio_has_io_uring(ctx)) {
+        return QIO_CHANNEL_ERR_BLOCK;
+    }
+
+    trace_qio_channel_socket_io_uring(sioc, write);
+    do {
+        aio_add_sqe(qio_channel_socket_uring_prep, &req, &req.cqe_handler);
+        qemu_coroutine_yield();
+        ret = req.cqe_handler.cqe.res;
+    } while (ret == -EINTR);
+
+    if (ret == -EAGAIN) {
+        return QIO_CHANNEL_ERR_BLOCK;
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, write ? "Unable to write to socket" :
+                                             "Unable to read from socket");
+        return -1;
+    }
     return ret;
 }
+
+static ssize_t coroutine_fn
+qio_channel_socket_co_readv(QIOChannel *ioc,
+                            const struct iovec *iov,
+                            size_t niov,
+                            Error **errp)
+{
+    return qio_channel_socket_co_rw_io_uring(QIO_CHANNEL_SOCKET(ioc),
+                                             iov, niov, false, errp);
+}
+
+static ssize_t coroutine_fn
+qio_channel_socket_co_writev(QIOChannel *ioc,
+                             const struct iovec *iov,
+                             size_t niov,
+                             Error **errp)
+{
+    return qio_channel_socket_co_rw_io_uring(QIO_CHANNEL_SOCKET(ioc),
+                                             iov, niov, true, errp);
+}
+#endif /* CONFIG_LINUX_IO_URING */
 #else /* WIN32 */
 static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
                                         const struct iovec *iov,
@@ -620,6 +850,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          size_t niov,
                                          int *fds,
                                          size_t nfds,
+                                         int flags,
                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
@@ -658,6 +889,14 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 }
 #endif /* WIN32 */
 
+#ifndef QEMU_MSG_ZEROCOPY
+int qio_channel_socket_poll_zero_copy(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+    return 0;
+}
+#endif
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -787,6 +1026,13 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
     ioc_klass->io_set_delay = qio_channel_socket_set_delay;
     ioc_klass->io_create_watch = qio_channel_socket_create_watch;
     ioc_klass->io_set_aio_fd_handler = qio_channel_socket_set_aio_fd_handler;
+#ifdef QEMU_MSG_ZEROCOPY
+    ioc_klass->io_flush = qio_channel_socket_flush;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    ioc_klass->io_co_readv = qio_channel_socket_co_readv;
+    ioc_klass->io_co_writev = qio_channel_socket_co_writev;
+#endif
 }
 
 static const TypeInfo qio_channel_socket_info = {
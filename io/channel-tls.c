@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
@@ -152,6 +153,17 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+static void qio_channel_tls_enable_ktls(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc = (QIOChannelSocket *)
+        object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET);
+
+    if (sioc) {
+        ioc->ktls = qcrypto_tls_session_enable_ktls(ioc->session, sioc->fd);
+        trace_qio_channel_tls_ktls(ioc, ioc->ktls);
+    }
+}
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -175,6 +187,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_enable_ktls(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -266,6 +279,21 @@ static ssize_t qio_channel_tls_readv(QIOChannel *ioc,
     size_t i;
     ssize_t got = 0;
 
+    if (tioc->ktls & QCRYPTO_TLS_KTLS_RX) {
+        /* The kernel decrypts into the whole vector at once */
+        got = qcrypto_tls_session_ktls_readv(
+            tioc->session, QIO_CHANNEL_SOCKET(tioc->master)->fd, iov, niov);
+        if (got < 0) {
+            if (errno == EAGAIN) {
+                return QIO_CHANNEL_ERR_BLOCK;
+            }
+            error_setg_errno(errp, errno,
+                             "Cannot read from TLS channel");
+            return -1;
+        }
+        return got;
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_read(tioc->session,
                                                iov[i].iov_base,
@@ -301,12 +329,19 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
                                       size_t niov,
                                       int *fds,
                                       size_t nfds,
+                                      int flags,
                                       Error **errp)
 {
     QIOChannelTLS *tioc = QIO_CHANNEL_TLS(ioc);
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->ktls & QCRYPTO_TLS_KTLS_TX) {
+        /* The kernel encrypts what the socket sends */
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, 0, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
@@ -16,13 +16,16 @@
 #include "qom/object_interfaces.h"
 #include "qemu/module.h"
 #include "block/aio.h"
+#include "block/aio-wait.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread-placement.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -190,6 +193,7 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                         object_get_canonical_path_component(OBJECT(obj)));
     qemu_thread_create(&iothread->thread, thread_name, iothread_run,
                        iothread, QEMU_THREAD_JOINABLE);
+    qemu_thread_place(&iothread->thread, THREAD_PLACEMENT_ROLE_IOTHREAD);
     g_free(thread_name);
 
     /* Wait for initialization to complete */
@@ -301,6 +305,46 @@ AioContext *iothread_get_aio_context(IOThread *iothread)
     return iothread->ctx;
 }
 
+typedef struct {
+    AioContext *ctx;
+    AioPollStats *stats;
+    size_t n;
+} IOThreadPollStats;
+
+static void iothread_get_poll_stats_bh(void *opaque)
+{
+    IOThreadPollStats *data = opaque;
+
+    data->n = aio_context_get_poll_stats(data->ctx, &data->stats);
+}
+
+static IOThreadPollHandlerInfoList *
+iothread_get_poll_handlers(IOThread *iothread)
+{
+    IOThreadPollStats data = { .ctx = iothread->ctx };
+    IOThreadPollHandlerInfoList *head = NULL, **tail = &head;
+    size_t i;
+
+    /* The statistics are only updated in the IOThread, read them there */
+    aio_context_acquire(iothread->ctx);
+    aio_wait_bh_oneshot(iothread->ctx, iothread_get_poll_stats_bh, &data);
+    aio_context_release(iothread->ctx);
+
+    for (i = 0; i < data.n; i++) {
+        IOThreadPollHandlerInfo *info = g_new0(IOThreadPollHandlerInfo, 1);
+
+        info->fd = data.stats[i].fd;
+        info->polling = data.stats[i].polling;
+        info->sessions = data.stats[i].sessions;
+        info->successes = data.stats[i].successes;
+        info->removals = data.stats[i].removals;
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    g_free(data.stats);
+    return head;
+}
+
 static int query_one_iothread(Object *object, void *opaque)
 {
     IOThreadInfoList ***tail = opaque;
@@ -318,6 +362,8 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->has_poll_handlers = true;
+    info->poll_handlers = iothread_get_poll_handlers(iothread);
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
@@ -333,6 +379,53 @@ IOThreadInfoList *qmp_query_iothreads(Error **errp)
     return head;
 }
 
+static void query_one_thread_pool(ThreadPoolInfoList ***tail,
+                                  AioContext *ctx, const char *id)
+{
+    ThreadPoolInfo *info;
+    ThreadPoolStats stats;
+
+    if (!ctx->thread_pool) {
+        return;
+    }
+
+    thread_pool_get_stats(ctx->thread_pool, &stats);
+    info = g_new0(ThreadPoolInfo, 1);
+    info->has_iothread = !!id;
+    info->iothread = g_strdup(id);
+    info->threads = stats.threads;
+    info->idle_threads = stats.idle_threads;
+    info->queue_depth = stats.queue_depth;
+    info->requests = stats.requests;
+    info->wait_ns = stats.wait_ns;
+
+    QAPI_LIST_APPEND(*tail, info);
+}
+
+static int query_one_iothread_thread_pool(Object *object, void *opaque)
+{
+    IOThread *iothread;
+
+    iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
+    if (iothread && iothread->ctx) {
+        g_autofree char *id = iothread_get_id(iothread);
+
+        query_one_thread_pool(opaque, iothread->ctx, id);
+    }
+    return 0;
+}
+
+ThreadPoolInfoList *qmp_query_thread_pools(Error **errp)
+{
+    ThreadPoolInfoList *head = NULL;
+    ThreadPoolInfoList **prev = &head;
+
+    query_one_thread_pool(&prev, qemu_get_aio_context(), NULL);
+    object_child_foreach(object_get_objects_root(),
+                         query_one_iothread_thread_pool, &prev);
+    return head;
+}
+
 GMainContext *iothread_get_g_main_context(IOThread *iothread)
 {
     qatomic_set(&iothread->run_gcontext, 1);
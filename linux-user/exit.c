@@ -36,4 +36,16 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
         gdb_exit(code);
         qemu_plugin_atexit_cb();
+
+        if (exec_stats_filename) {
+            FILE *f = fopen(exec_stats_filename, "w");
+
+            if (f) {
+                dump_exec_stats_json(f);
+                fclose(f);
+            } else {
+                fprintf(stderr, "qemu: could not open %s: %s\n",
+                        exec_stats_filename, strerror(errno));
+            }
+        }
 }
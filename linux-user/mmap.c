@@ -297,7 +297,7 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size,
             } else if (addr && addr + size == end_addr) {
                 /* Success!  All pages between ADDR and END_ADDR are free.  */
                 if (start == mmap_next_start) {
-                    mmap_next_start = addr;
+                    qatomic_set(&mmap_next_start, addr);
                 }
                 return addr;
             }
@@ -363,7 +363,7 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
             if ((addr & (align - 1)) == 0) {
                 /* Success.  */
                 if (start == mmap_next_start && addr >= TASK_UNMAPPED_BASE) {
-                    mmap_next_start = addr + size;
+                    qatomic_set(&mmap_next_start, addr + size);
                 }
                 return addr;
             }
@@ -418,6 +418,57 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
     }
 }
 
+#if HOST_LONG_BITS >= TARGET_ABI_BITS
+/*
+ * Map a new region wherever the kernel finds room for it, without holding
+ * mmap_lock across the host system calls.  This is safe because the range
+ * returned by the kernel is not known to any other thread until its page
+ * flags are set, and that is done under the lock.  It is only possible
+ * when the guest address space is not reserved up front and host and
+ * target pages have the same size, so that no fragments of host pages
+ * need to be handled.
+ *
+ * Return the guest address of the mapping, -1 with errno set on failure,
+ * or -2 if the kernel's choice is unusable and the caller must take the
+ * slow path.
+ */
+static abi_long target_mmap_unlocked(abi_ulong start, abi_ulong len,
+                                     int host_prot, int page_flags,
+                                     int flags, int fd, abi_ulong offset)
+{
+    abi_ulong hint = start ? start & qemu_host_page_mask
+                           : qatomic_read(&mmap_next_start);
+    abi_ulong host_len = HOST_PAGE_ALIGN(len);
+    void *p;
+
+    p = mmap(g2h_untagged(hint), host_len, host_prot, flags, fd, offset);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    if (!h2g_valid(p + host_len - 1)) {
+        munmap(p, host_len);
+        return -2;
+    }
+
+    mmap_lock();
+    start = h2g(p);
+    if (hint == mmap_next_start && start >= TASK_UNMAPPED_BASE) {
+        qatomic_set(&mmap_next_start, start + host_len);
+    }
+    if (flags & MAP_ANONYMOUS) {
+        page_flags |= PAGE_ANON;
+    }
+    page_set_flags(start, start + len, page_flags | PAGE_RESET);
+    trace_target_mmap_complete(start);
+    if (qemu_loglevel_mask(CPU_LOG_PAGE)) {
+        log_page_dump(__func__);
+    }
+    tb_invalidate_phys_range(start, start + len);
+    mmap_unlock();
+    return start;
+}
+#endif
+
 /* NOTE: all the constants are the HOST ones */
 abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
                      int flags, int fd, abi_ulong offset)
@@ -465,6 +516,27 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
         }
     }
 
+#if HOST_LONG_BITS >= TARGET_ABI_BITS
+    /*
+     * Threads of a JIT or of a memory allocator tend to create mappings
+     * all the time; do not serialize the host mmap() calls of each other
+     * and of code translation, which also takes mmap_lock.
+     */
+    if (!(flags & MAP_FIXED) && !reserved_va &&
+        qemu_host_page_size == qemu_real_host_page_size &&
+        !(offset & ~qemu_host_page_mask)) {
+        abi_long r;
+
+        mmap_unlock();
+        r = target_mmap_unlocked(start, len, host_prot, page_flags,
+                                 flags, fd, offset);
+        if (r != -2) {
+            return r;
+        }
+        mmap_lock();
+    }
+#endif
+
     real_start = start & qemu_host_page_mask;
     host_offset = offset & qemu_host_page_mask;
 
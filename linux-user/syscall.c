@@ -13251,6 +13251,94 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
     return ret;
 }
 
+/*
+ * When guest and host share the same ABI, system calls whose arguments are
+ * a file descriptor, integers and one flat buffer need no conversion: the
+ * guest's syscall number, flags, structures and errno values are also the
+ * host's.  Forward those directly instead of going through do_syscall1().
+ * Anything involving paths, memory mappings, signals, threads or file
+ * descriptors with an fd_trans translator still takes the slow path.
+ */
+#if ((defined(TARGET_X86_64) && defined(__x86_64__)) || \
+     (defined(TARGET_AARCH64) && defined(__aarch64__))) && \
+    !defined(__ILP32__) && \
+    defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
+#define SYSCALL_PASSTHROUGH
+
+typedef struct SyscallPassthrough {
+    bool valid;
+    int type;           /* VERIFY_READ or VERIFY_WRITE for the buffer */
+    int buf_arg;        /* 1-based index of the buffer argument, or 0 */
+    int len_arg;        /* 1-based index of the buffer length, or 0 */
+    size_t len;         /* length of the buffer if len_arg is 0 */
+} SyscallPassthrough;
+
+static const SyscallPassthrough syscall_passthrough[] = {
+    [TARGET_NR_read] = { true, VERIFY_WRITE, 2, 3 },
+    [TARGET_NR_write] = { true, VERIFY_READ, 2, 3 },
+    [TARGET_NR_pread64] = { true, VERIFY_WRITE, 2, 3 },
+    [TARGET_NR_pwrite64] = { true, VERIFY_READ, 2, 3 },
+    [TARGET_NR_fstat] = { true, VERIFY_WRITE, 2, 0,
+                          sizeof(struct target_stat) },
+    [TARGET_NR_lseek] = { true },
+    [TARGET_NR_fsync] = { true },
+    [TARGET_NR_fdatasync] = { true },
+};
+
+QEMU_BUILD_BUG_ON(sizeof(struct stat) != sizeof(struct target_stat));
+
+/*
+ * Return true and store the result in @ret if the system call was
+ * forwarded to the host.
+ */
+static bool do_syscall_passthrough(int num, abi_long *ret,
+                                   abi_long *args)
+{
+    const SyscallPassthrough *sp;
+    abi_ulong addr = 0;
+    abi_long len = 0;
+    void *p = NULL;
+
+    if (num < 0 || num >= ARRAY_SIZE(syscall_passthrough) ||
+        !syscall_passthrough[num].valid) {
+        return false;
+    }
+    if (fd_trans_target_to_host_data(args[0]) ||
+        fd_trans_host_to_target_data(args[0])) {
+        return false;
+    }
+
+    sp = &syscall_passthrough[num];
+    if (sp->buf_arg) {
+        addr = args[sp->buf_arg - 1];
+        len = sp->len_arg ? args[sp->len_arg - 1] : sp->len;
+        if (len < 0) {
+            return false;
+        }
+        /* checks the guest's permissions and unprotects code pages */
+        p = lock_user(sp->type, addr, len, sp->type == VERIFY_READ);
+        if (!p) {
+            *ret = -TARGET_EFAULT;
+            return true;
+        }
+        args[sp->buf_arg - 1] = (abi_long)(uintptr_t)p;
+    }
+
+    *ret = get_errno(safe_syscall(num, args[0], args[1], args[2],
+                                  args[3], args[4], args[5]));
+
+    if (p) {
+        if (sp->type == VERIFY_WRITE && !is_error(*ret)) {
+            len = sp->len_arg ? *ret : len;
+        } else {
+            len = 0;
+        }
+        unlock_user(p, addr, len);
+    }
+    return true;
+}
+#endif
+
 abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
                     abi_long arg2, abi_long arg3, abi_long arg4,
                     abi_long arg5, abi_long arg6, abi_long arg7,
@@ -13280,8 +13368,19 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         print_syscall(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6);
     }
 
+#ifdef SYSCALL_PASSTHROUGH
+    {
+        abi_long args[6] = { arg1, arg2, arg3, arg4, arg5, arg6 };
+
+        if (!do_syscall_passthrough(num, &ret, args)) {
+            ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
+                              arg5, arg6, arg7, arg8);
+        }
+    }
+#else
     ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                       arg5, arg6, arg7, arg8);
+#endif
 
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         print_syscall_ret(cpu_env, num, ret, arg1, arg2,
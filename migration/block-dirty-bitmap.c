@@ -53,6 +53,11 @@
  * [ be64: buffer size  ] \ ! (flags & ZEROES)
  * [ n bytes: buffer    ] /
  *
+ * With flags & RUNS, the buffer holds the lengths of the alternating runs of
+ * clear and set bits of the chunk, starting with a clear run, in units of
+ * the bitmap granularity and encoded as ULEB128.  Otherwise it holds the
+ * bits themselves (see hbitmap_serialize_part).
+ *
  * The last chunk in stream should contain flags & EOS. The chunk may skip
  * device and/or bitmap names, assuming them to be the same with the previous
  * chunk.
@@ -99,6 +104,9 @@
 
 #define DIRTY_BITMAP_MIG_EXTRA_FLAGS        0x80
 
+/* Flags that need the two bytes form, only sent with dirty-bitmaps-runs */
+#define DIRTY_BITMAP_MIG_FLAG_RUNS          0x0100
+
 #define DIRTY_BITMAP_MIG_START_FLAG_ENABLED          0x01
 #define DIRTY_BITMAP_MIG_START_FLAG_PERSISTENT       0x02
 /* 0x04 was "AUTOLOAD" flags on older versions, now it is ignored */
@@ -356,7 +364,7 @@ bool check_dirty_bitmap_mig_alias_map(const BitmapMigrationNodeAliasList *bbm,
 
 static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 {
-    uint8_t flags = qemu_get_byte(f);
+    uint32_t flags = qemu_get_byte(f);
     if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
         flags = flags << 8 | qemu_get_byte(f);
         if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
@@ -369,10 +377,15 @@ static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 
 static void qemu_put_bitmap_flags(QEMUFile *f, uint32_t flags)
 {
-    /* The code currently does not send flags as more than one byte */
-    assert(!(flags & (0xffffff00 | DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
+    /* The code currently does not send flags as more than two bytes */
+    assert(!(flags & (0xffff0000 | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8 |
+                      DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
 
-    qemu_put_byte(f, flags);
+    if (flags & 0xff00) {
+        qemu_put_be16(f, flags | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8);
+    } else {
+        qemu_put_byte(f, flags);
+    }
 }
 
 static void send_bitmap_header(QEMUFile *f, DBMSaveState *s,
@@ -440,6 +453,20 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
         g_free(buf);
         buf = NULL;
         flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+    } else if (migrate_dirty_bitmaps_runs()) {
+        uint8_t *runs = g_malloc(buf_size);
+        size_t runs_size = bdrv_dirty_bitmap_serialize_runs(
+            dbms->bitmap, runs, buf_size - 1, start_sector << BDRV_SECTOR_BITS,
+            (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
+
+        if (runs_size) {
+            g_free(buf);
+            buf = runs;
+            buf_size = runs_size;
+            flags |= DIRTY_BITMAP_MIG_FLAG_RUNS;
+        } else {
+            g_free(runs);
+        }
     }
 
     trace_send_bitmap_bits(flags, start_sector, nr_sectors, buf_size);
@@ -1019,6 +1046,18 @@ static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
             return 0;
         }
 
+        if (s->flags & DIRTY_BITMAP_MIG_FLAG_RUNS) {
+            if (bdrv_dirty_bitmap_deserialize_runs(s->bitmap, buf, buf_size,
+                                                   first_byte, nr_bytes,
+                                                   false) < 0) {
+                error_report("Migrated bitmap runs don't match the "
+                             "destination bitmap '%s'",
+                             bdrv_dirty_bitmap_name(s->bitmap));
+                cancel_incoming_locked(s);
+            }
+            return 0;
+        }
+
         needed_size = bdrv_dirty_bitmap_serialization_size(s->bitmap,
                                                            first_byte,
                                                            nr_bytes);
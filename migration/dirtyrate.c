@@ -15,8 +15,15 @@
 #include "qapi/error.h"
 #include "cpu.h"
 #include "exec/ramblock.h"
+#include "exec/memory.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "sysemu/kvm.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-events-migration.h"
+#include "qapi/qapi-visit-migration.h"
 #include "ram.h"
 #include "trace.h"
 #include "dirtyrate.h"
@@ -451,6 +458,315 @@ struct DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
     return query_dirty_rate_info();
 }
 
+/*
+ * Continuous dirty rate monitor
+ *
+ * Instead of hashing sampled pages, the monitor keeps KVM dirty tracking
+ * enabled and turns the dirty page counters of the vCPUs (dirty ring) and
+ * of the memory slots into rates at the end of every period.
+ */
+typedef struct DirtyRateMonitor {
+    QemuThread thread;
+    QemuSemaphore stop_sem;
+    bool running;
+    bool events;
+    DirtyRateMeasureMode mode;
+    int64_t period;
+    /* The fields below are protected by the BQL */
+    int64_t last_time;
+    GHashTable *vcpu_pages;     /* cpu_index -> dirty pages, last period */
+    GHashTable *ramblock_pages; /* idstr -> dirty pages, last period */
+    DirtyRateSample *sample;
+} DirtyRateMonitor;
+
+static DirtyRateMonitor dirty_rate_monitor;
+
+static int64_t dirty_rate_monitor_rate(uint64_t pages, int64_t msec)
+{
+    return pages * qemu_real_host_page_size * 1000 / MiB / MAX(msec, 1);
+}
+
+/*
+ * Move the counter of @key from @prev to @next and return how far it
+ * moved.  A counter that went backwards belongs to a memory slot that was
+ * recreated, and restarted from zero.
+ */
+static uint64_t dirty_rate_monitor_delta(GHashTable *prev, GHashTable *next,
+                                         gpointer key, uint64_t pages)
+{
+    uint64_t *last = g_hash_table_lookup(prev, key);
+    uint64_t *counter = g_new(uint64_t, 1);
+
+    *counter = pages;
+    g_hash_table_insert(next, key, counter);
+    return last && *last <= pages ? pages - *last : pages;
+}
+
+static void dirty_rate_monitor_count_slot(void *host, uint64_t size,
+                                          uint64_t dirty_pages, void *opaque)
+{
+    GHashTable *totals = opaque;
+    RAMBlock *block;
+    ram_addr_t offset;
+    uint64_t *total;
+
+    block = host ? qemu_ram_block_from_host(host, false, &offset) : NULL;
+    if (!block || !qemu_ram_is_migratable(block)) {
+        return;
+    }
+
+    total = g_hash_table_lookup(totals, block->idstr);
+    if (!total) {
+        total = g_new0(uint64_t, 1);
+        g_hash_table_insert(totals, block->idstr, total);
+    }
+    *total += dirty_pages;
+}
+
+/*
+ * Close the current period.  With @publish false the counters are only
+ * recorded, to serve as the starting point of the next period.
+ *
+ * Called with the BQL and the RCU read lock held.
+ */
+static void dirty_rate_monitor_sample(DirtyRateMonitor *m, bool publish)
+{
+    g_autoptr(GHashTable) totals = g_hash_table_new_full(g_str_hash,
+                                                         g_str_equal,
+                                                         NULL, g_free);
+    GHashTable *vcpu_pages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    GHashTable *ramblock_pages = g_hash_table_new_full(g_str_hash,
+                                                       g_str_equal,
+                                                       g_free, g_free);
+    DirtyRateSample *sample = g_new0(DirtyRateSample, 1);
+    DirtyRateVcpuList **vcpu_tail = &sample->vcpus;
+    DirtyRateRAMBlockList **block_tail = &sample->ramblocks;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    int64_t msec = now - m->last_time;
+    uint64_t total_pages = 0;
+    RAMBlock *block;
+    CPUState *cpu;
+
+    if (m->mode == DIRTY_RATE_MEASURE_MODE_DIRTY_BITMAP) {
+        memory_global_dirty_log_sync();
+    }
+    kvm_dirty_page_counts(dirty_rate_monitor_count_slot, totals);
+
+    if (m->mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        sample->has_vcpus = true;
+        CPU_FOREACH(cpu) {
+            DirtyRateVcpu *vcpu = g_new0(DirtyRateVcpu, 1);
+            uint64_t pages;
+
+            pages = dirty_rate_monitor_delta(m->vcpu_pages, vcpu_pages,
+                                             GINT_TO_POINTER(cpu->cpu_index),
+                                             cpu->dirty_pages);
+            vcpu->id = cpu->cpu_index;
+            vcpu->dirty_rate = dirty_rate_monitor_rate(pages, msec);
+            QAPI_LIST_APPEND(vcpu_tail, vcpu);
+        }
+    }
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        DirtyRateRAMBlock *info = g_new0(DirtyRateRAMBlock, 1);
+        uint64_t *total = g_hash_table_lookup(totals, block->idstr);
+        uint64_t pages;
+
+        pages = dirty_rate_monitor_delta(m->ramblock_pages, ramblock_pages,
+                                         g_strdup(block->idstr),
+                                         total ? *total : 0);
+        total_pages += pages;
+        info->id = g_strdup(block->idstr);
+        info->dirty_rate = dirty_rate_monitor_rate(pages, msec);
+        QAPI_LIST_APPEND(block_tail, info);
+
+        /*
+         * With manual dirty log protection KVM only write-protects the
+         * pages again when they are cleared.  Migration clears the pages
+         * as it sends them, so leave them alone while it runs.
+         */
+        if (m->mode == DIRTY_RATE_MEASURE_MODE_DIRTY_BITMAP &&
+            !(global_dirty_log & GLOBAL_DIRTY_MIGRATION)) {
+            memory_region_clear_dirty_bitmap(block->mr, 0,
+                                             block->used_length);
+        }
+    }
+
+    g_hash_table_destroy(m->vcpu_pages);
+    m->vcpu_pages = vcpu_pages;
+    g_hash_table_destroy(m->ramblock_pages);
+    m->ramblock_pages = ramblock_pages;
+    m->last_time = now;
+
+    if (!publish) {
+        qapi_free_DirtyRateSample(sample);
+        return;
+    }
+
+    sample->timestamp = now;
+    sample->period = msec;
+    sample->dirty_rate = dirty_rate_monitor_rate(total_pages, msec);
+    trace_dirty_rate_monitor_sample(msec, sample->dirty_rate);
+
+    qapi_free_DirtyRateSample(m->sample);
+    m->sample = sample;
+    if (m->events) {
+        qapi_event_send_dirty_rate_sample(sample);
+    }
+}
+
+static void *dirty_rate_monitor_thread(void *opaque)
+{
+    DirtyRateMonitor *m = opaque;
+
+    rcu_register_thread();
+
+    /* The semaphore is only posted to stop the monitor */
+    while (qemu_sem_timedwait(&m->stop_sem, m->period) < 0) {
+        qemu_mutex_lock_iothread();
+        WITH_RCU_READ_LOCK_GUARD() {
+            dirty_rate_monitor_sample(m, true);
+        }
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void qmp_start_dirty_rate_monitor(bool has_mode, DirtyRateMeasureMode mode,
+                                  bool has_period, int64_t period,
+                                  bool has_events, bool events, Error **errp)
+{
+    DirtyRateMonitor *m = &dirty_rate_monitor;
+
+    if (m->running) {
+        error_setg(errp, "the dirty rate monitor is already running.");
+        return;
+    }
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "the dirty rate monitor requires KVM.");
+        return;
+    }
+
+    if (!has_mode) {
+        mode = kvm_dirty_ring_enabled() ? DIRTY_RATE_MEASURE_MODE_DIRTY_RING :
+                                          DIRTY_RATE_MEASURE_MODE_DIRTY_BITMAP;
+    } else if (mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING &&
+               !kvm_dirty_ring_enabled()) {
+        error_setg(errp, "dirty-ring mode requires the KVM dirty ring, "
+                   "see the dirty-ring-size property of the kvm accelerator.");
+        return;
+    }
+
+    if (!has_period) {
+        period = DIRTY_RATE_MONITOR_DEFAULT_PERIOD_MS;
+    } else if (period < DIRTY_RATE_MONITOR_MIN_PERIOD_MS ||
+               period > DIRTY_RATE_MONITOR_MAX_PERIOD_MS) {
+        error_setg(errp, "period is out of range[%d, %d].",
+                   DIRTY_RATE_MONITOR_MIN_PERIOD_MS,
+                   DIRTY_RATE_MONITOR_MAX_PERIOD_MS);
+        return;
+    }
+
+    m->mode = mode;
+    m->period = period;
+    m->events = has_events && events;
+    m->vcpu_pages = g_hash_table_new(NULL, NULL);
+    m->ramblock_pages = g_hash_table_new(g_str_hash, g_str_equal);
+
+    memory_global_dirty_log_start(GLOBAL_DIRTY_DIRTY_RATE);
+
+    /* Record the counters that the first period starts from */
+    m->last_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    WITH_RCU_READ_LOCK_GUARD() {
+        dirty_rate_monitor_sample(m, false);
+    }
+
+    trace_dirty_rate_monitor_start(DirtyRateMeasureMode_str(mode), period);
+    qemu_sem_init(&m->stop_sem, 0);
+    m->running = true;
+    qemu_thread_create(&m->thread, "dirtyrate-mon", dirty_rate_monitor_thread,
+                       m, QEMU_THREAD_JOINABLE);
+}
+
+void qmp_stop_dirty_rate_monitor(Error **errp)
+{
+    DirtyRateMonitor *m = &dirty_rate_monitor;
+
+    if (!m->running) {
+        error_setg(errp, "the dirty rate monitor is not running.");
+        return;
+    }
+
+    /* The thread takes the BQL to sample */
+    qemu_sem_post(&m->stop_sem);
+    qemu_mutex_unlock_iothread();
+    qemu_thread_join(&m->thread);
+    qemu_mutex_lock_iothread();
+    qemu_sem_destroy(&m->stop_sem);
+    m->running = false;
+
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_DIRTY_RATE);
+
+    g_hash_table_destroy(m->vcpu_pages);
+    m->vcpu_pages = NULL;
+    g_hash_table_destroy(m->ramblock_pages);
+    m->ramblock_pages = NULL;
+    qapi_free_DirtyRateSample(m->sample);
+    m->sample = NULL;
+    trace_dirty_rate_monitor_stop();
+}
+
+DirtyRateMonitorInfo *qmp_query_dirty_rate_monitor(Error **errp)
+{
+    DirtyRateMonitor *m = &dirty_rate_monitor;
+    DirtyRateMonitorInfo *info = g_new0(DirtyRateMonitorInfo, 1);
+
+    info->enabled = m->running;
+    if (m->running) {
+        info->has_mode = true;
+        info->mode = m->mode;
+        info->has_period = true;
+        info->period = m->period;
+    }
+    if (m->sample) {
+        info->has_sample = true;
+        info->sample = QAPI_CLONE(DirtyRateSample, m->sample);
+    }
+    return info;
+}
+
+static void hmp_info_dirty_rate_monitor(Monitor *mon)
+{
+    g_autoptr(DirtyRateMonitorInfo) info = qmp_query_dirty_rate_monitor(NULL);
+    DirtyRateVcpuList *vcpu;
+    DirtyRateRAMBlockList *block;
+
+    if (!info->enabled) {
+        return;
+    }
+
+    monitor_printf(mon, "\nContinuous monitor (%s, period %"PRIi64" ms):\n",
+                   DirtyRateMeasureMode_str(info->mode), info->period);
+    if (!info->has_sample) {
+        monitor_printf(mon, "Dirty rate: (not ready)\n");
+        return;
+    }
+
+    monitor_printf(mon, "Dirty rate: %"PRIi64" (MB/s)\n",
+                   info->sample->dirty_rate);
+    for (vcpu = info->sample->vcpus; vcpu; vcpu = vcpu->next) {
+        monitor_printf(mon, "  vCPU %"PRIi64": %"PRIi64" (MB/s)\n",
+                       vcpu->value->id, vcpu->value->dirty_rate);
+    }
+    for (block = info->sample->ramblocks; block; block = block->next) {
+        monitor_printf(mon, "  %s: %"PRIi64" (MB/s)\n",
+                       block->value->id, block->value->dirty_rate);
+    }
+}
+
 void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
 {
     DirtyRateInfo *info = query_dirty_rate_info();
@@ -470,6 +786,8 @@ void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "(not ready)\n");
     }
     g_free(info);
+
+    hmp_info_dirty_rate_monitor(mon);
 }
 
 void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
@@ -40,6 +40,13 @@
 #define MIN_SAMPLE_PAGE_COUNT                     128
 #define MAX_SAMPLE_PAGE_COUNT                     16384
 
+/*
+ * Sampling period of the continuous dirty rate monitor, in milliseconds
+ */
+#define DIRTY_RATE_MONITOR_DEFAULT_PERIOD_MS      1000
+#define DIRTY_RATE_MONITOR_MIN_PERIOD_MS          100
+#define DIRTY_RATE_MONITOR_MAX_PERIOD_MS          60000
+
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
     int64_t sample_period_seconds; /* time duration between two sampling */
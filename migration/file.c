@@ -0,0 +1,182 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "trace.h"
+
+/* The file of the current outgoing or incoming migration */
+static char *file_name;
+
+static void file_set_name(const char *filename)
+{
+    g_free(file_name);
+    file_name = g_strdup(filename);
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_setg(errp, "TLS is not supported when migrating to a file");
+        return;
+    }
+    if (migrate_use_multifd() && !migrate_fixed_ram()) {
+        error_setg(errp, "Migrating to a file with multifd requires "
+                   "x-fixed-ram");
+        return;
+    }
+    if (migrate_fixed_ram() &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        error_setg(errp, "x-fixed-ram is not compatible with multifd "
+                   "compression");
+        return;
+    }
+
+    trace_migration_file_outgoing(filename);
+    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+
+    file_set_name(filename);
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(fioc), NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_incoming(filename);
+    fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+
+    file_set_name(filename);
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(fioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
+
+/**
+ * file_open_ram: open the migration file again, to access its RAM
+ *
+ * With x-fixed-ram, the pages of RAM are written and read at fixed
+ * offsets of the migration file, with pwrite() and pread() on file
+ * descriptors of their own.
+ *
+ * Returns the file descriptor, or -1 on error
+ *
+ * @write: whether to open the file for writing
+ * @direct: whether to bypass the page cache with O_DIRECT
+ */
+int file_open_ram(bool write, bool direct, Error **errp)
+{
+    int flags = write ? O_WRONLY : O_RDONLY;
+    int fd;
+
+    if (direct) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        error_setg(errp, "O_DIRECT is not supported on this host");
+        return -1;
+#endif
+    }
+
+    fd = qemu_open_old(file_name, flags);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "cannot open migration file '%s'",
+                         file_name);
+    }
+    return fd;
+}
+
+/* Create a multifd channel, like socket_send_channel_create() */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *fioc = NULL;
+    Error *err = NULL;
+    QIOTask *task;
+    int fd;
+
+    fd = file_open_ram(true, migrate_fixed_ram_direct_io(), &err);
+    if (fd >= 0) {
+        fioc = qio_channel_file_new_fd(fd);
+    }
+
+    task = qio_task_new(OBJECT(fioc), f, data, NULL);
+    if (err) {
+        qio_task_set_error(task, err);
+    }
+    qio_task_complete(task);
+}
+
+int file_pwrite_all(int fd, const void *buf, size_t len, off_t offset,
+                    Error **errp)
+{
+    while (len) {
+        ssize_t ret = pwrite(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "cannot write migration file");
+            return -errno;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+int file_pread_all(int fd, void *buf, size_t len, off_t offset,
+                   Error **errp)
+{
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "cannot read migration file");
+            return -errno;
+        }
+        if (ret == 0) {
+            error_setg(errp, "migration file is truncated");
+            return -EIO;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
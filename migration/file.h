@@ -0,0 +1,25 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FILE_H
+#define QEMU_MIGRATION_FILE_H
+
+#include "io/task.h"
+
+void file_start_incoming_migration(const char *filename, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp);
+
+int file_open_ram(bool write, bool direct, Error **errp);
+void file_send_channel_create(QIOTaskFunc f, void *data);
+
+int file_pwrite_all(int fd, const void *buf, size_t len, off_t offset,
+                    Error **errp);
+int file_pread_all(int fd, void *buf, size_t len, off_t offset,
+                   Error **errp);
+#endif
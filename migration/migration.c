@@ -20,6 +20,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
@@ -46,6 +47,7 @@
 #include "block.h"
 #include "postcopy-ram.h"
 #include "qemu/thread.h"
+#include "qemu/thread-placement.h"
 #include "trace.h"
 #include "exec/target_page.h"
 #include "io/channel-buffer.h"
@@ -58,6 +60,7 @@
 #include "qemu/queue.h"
 #include "multifd.h"
 #include "qemu/yank.h"
+#include "qemu/timeline.h"
 #include "sysemu/cpus.h"
 
 #define MAX_THROTTLE  (128 << 20)      /* Migration transfer speed throttling */
@@ -105,6 +108,10 @@
  */
 #define DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH 0
 
+/* Host pages requested past a postcopy fault, 0 means no prefetching */
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 0
+#define MAX_POSTCOPY_PREFETCH_PAGES 256
+
 /*
  * Parameters for self_announce_delay giving a stream of RARP/ARP
  * packets after migration.
@@ -153,7 +160,6 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME,
     MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE,
     MIGRATION_CAPABILITY_RETURN_PATH,
-    MIGRATION_CAPABILITY_MULTIFD,
     MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER,
     MIGRATION_CAPABILITY_AUTO_CONVERGE,
     MIGRATION_CAPABILITY_RELEASE_RAM,
@@ -208,6 +214,8 @@ void migration_object_init(void)
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_mutex_init(&current_incoming->page_request_mutex);
     current_incoming->page_requested = g_tree_new(page_request_addr_cmp);
+    qemu_mutex_init(&current_incoming->postcopy_host_pages_mutex);
+    qemu_event_init(&current_incoming->postcopy_listen_event, false);
 
     if (!migration_object_check(current_migration, &err)) {
         error_report_err(err);
@@ -217,6 +225,7 @@ void migration_object_init(void)
     blk_mig_init();
     ram_mig_init();
     dirty_bitmap_mig_init();
+    savevm_early_init();
 }
 
 void migration_cancel(void)
@@ -285,6 +294,7 @@ void migration_incoming_state_destroy(void)
     }
 
     qemu_event_reset(&mis->main_thread_load_event);
+    qemu_event_reset(&mis->postcopy_listen_event);
 
     if (mis->page_requested) {
         g_tree_destroy(mis->page_requested);
@@ -349,17 +359,17 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     return ret;
 }
 
-/* Request one page from the source VM at the given start address.
+/* Request pages from the source VM at the given start address.
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -391,8 +401,14 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
     return migrate_send_rp_message(mis, msg_type, msglen, bufc);
 }
 
+/*
+ * Request the host page of @haddr, and the following ones up to @len
+ * bytes from @start.  Only the first one is tracked in page_requested,
+ * the others are a prefetch.
+ */
 int migrate_send_rp_req_pages(MigrationIncomingState *mis,
-                              RAMBlock *rb, ram_addr_t start, uint64_t haddr)
+                              RAMBlock *rb, ram_addr_t start, uint64_t haddr,
+                              size_t len)
 {
     void *aligned = (void *)(uintptr_t)(haddr & (-qemu_ram_pagesize(rb)));
     bool received = false;
@@ -419,7 +435,7 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start, len);
 }
 
 static bool migration_colo_enabled;
@@ -457,6 +473,11 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
     const char *p = NULL;
 
     qapi_event_send_migration(MIGRATION_STATUS_SETUP);
+    if (migrate_fixed_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "x-fixed-ram requires a file: migration URI");
+        return;
+    }
+
     if (strstart(uri, "tcp:", &p) ||
         strstart(uri, "unix:", NULL) ||
         strstart(uri, "vsock:", NULL)) {
@@ -469,6 +490,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -542,6 +565,7 @@ static void process_incoming_migration_co(void *opaque)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyState ps;
+    int64_t start_ns;
     int ret;
     Error *local_err = NULL;
 
@@ -551,7 +575,9 @@ static void process_incoming_migration_co(void *opaque)
     postcopy_state_set(POSTCOPY_INCOMING_NONE);
     migrate_set_state(&mis->state, MIGRATION_STATUS_NONE,
                       MIGRATION_STATUS_ACTIVE);
+    start_ns = timeline_start();
     ret = qemu_loadvm_state(mis->from_src_file);
+    timeline_record("migration", "incoming", start_ns);
 
     ps = postcopy_state_get();
     trace_process_incoming_migration_co_end(ret, ps);
@@ -716,8 +742,9 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
         /*
          * Common migration only needs one channel, so we can start
          * right now.  Multifd needs more than one channel, we wait.
+         * With fixed-ram, the RAM is read from the file directly.
          */
-        start_migration = !migrate_use_multifd();
+        start_migration = !migrate_use_multifd() || migrate_fixed_ram();
     } else {
         /* Multiple connections */
         assert(migrate_use_multifd());
@@ -868,6 +895,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->cpu_throttle_increment = s->parameters.cpu_throttle_increment;
     params->has_cpu_throttle_tailslow = true;
     params->cpu_throttle_tailslow = s->parameters.cpu_throttle_tailslow;
+    params->has_cpu_throttle_per_vcpu = true;
+    params->cpu_throttle_per_vcpu = s->parameters.cpu_throttle_per_vcpu;
     params->has_tls_creds = true;
     params->tls_creds = g_strdup(s->parameters.tls_creds);
     params->has_tls_hostname = true;
@@ -897,6 +926,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->max_postcopy_bandwidth = s->parameters.max_postcopy_bandwidth;
     params->has_max_cpu_throttle = true;
     params->max_cpu_throttle = s->parameters.max_cpu_throttle;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
     params->has_announce_initial = true;
     params->announce_initial = s->parameters.announce_initial;
     params->has_announce_max = true;
@@ -1212,6 +1243,59 @@ static bool migrate_caps_check(bool *cap_list,
             error_setg(errp, "Postcopy is not compatible with ignore-shared");
             return false;
         }
+
+        if (cap_list[MIGRATION_CAPABILITY_X_FILE_BACKED_RAM]) {
+            error_setg(errp,
+                       "Postcopy is not compatible with file-backed-ram");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_X_FIXED_RAM]) {
+            error_setg(errp, "Postcopy is not compatible with fixed-ram");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_X_FIXED_RAM] &&
+        (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+         cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+         cap_list[MIGRATION_CAPABILITY_X_FILE_BACKED_RAM])) {
+        error_setg(errp, "Fixed-ram is not compatible with xbzrle, "
+                   "compress and file-backed-ram");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_X_FIXED_RAM_DIRECT_IO] &&
+        !cap_list[MIGRATION_CAPABILITY_X_FIXED_RAM]) {
+        error_setg(errp, "Fixed-ram-direct-io requires fixed-ram");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+#ifndef CONFIG_LINUX
+        error_setg(errp, "Zero-copy-send is only available on Linux");
+        return false;
+#endif
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Zero-copy-send requires multifd");
+            return false;
+        }
+        /* The pages must not change before the kernel has sent them */
+        if (cap_list[MIGRATION_CAPABILITY_RELEASE_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT] ||
+            cap_list[MIGRATION_CAPABILITY_X_FIXED_RAM]) {
+            error_setg(errp, "Zero-copy-send is not compatible with "
+                       "release-ram, background-snapshot and fixed-ram");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY] &&
+        (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+         !cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM])) {
+        error_setg(errp, "Multifd-postcopy requires both multifd and "
+                   "postcopy-ram");
+        return false;
     }
 
     if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
@@ -1245,6 +1329,17 @@ static bool migrate_caps_check(bool *cap_list,
                 return false;
             }
         }
+
+        /*
+         * The multifd channels release the write protection of the pages
+         * that they save, so a page must not span two channels.
+         */
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD] &&
+            qemu_target_page_size() != qemu_real_host_page_size) {
+            error_setg(errp, "Background-snapshot with multifd needs the "
+                       "target page size to match the host page size");
+            return false;
+        }
     }
 
     return true;
@@ -1426,6 +1521,15 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_postcopy_prefetch_pages &&
+        params->postcopy_prefetch_pages > MAX_POSTCOPY_PREFETCH_PAGES) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_pages",
+                   "an integer in the range of 0 to "
+                   stringify(MAX_POSTCOPY_PREFETCH_PAGES));
+        return false;
+    }
+
     if (params->has_announce_initial &&
         params->announce_initial > 100000) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
@@ -1503,6 +1607,9 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_cpu_throttle_tailslow) {
         dest->cpu_throttle_tailslow = params->cpu_throttle_tailslow;
     }
+    if (params->has_cpu_throttle_per_vcpu) {
+        dest->cpu_throttle_per_vcpu = params->cpu_throttle_per_vcpu;
+    }
 
     if (params->has_tls_creds) {
         assert(params->tls_creds->type == QTYPE_QSTRING);
@@ -1544,6 +1651,9 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_max_cpu_throttle) {
         dest->max_cpu_throttle = params->max_cpu_throttle;
     }
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
     if (params->has_announce_initial) {
         dest->announce_initial = params->announce_initial;
     }
@@ -1600,6 +1710,9 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_cpu_throttle_tailslow) {
         s->parameters.cpu_throttle_tailslow = params->cpu_throttle_tailslow;
     }
+    if (params->has_cpu_throttle_per_vcpu) {
+        s->parameters.cpu_throttle_per_vcpu = params->cpu_throttle_per_vcpu;
+    }
 
     if (params->has_tls_creds) {
         g_free(s->parameters.tls_creds);
@@ -1661,6 +1774,9 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_max_cpu_throttle) {
         s->parameters.max_cpu_throttle = params->max_cpu_throttle;
     }
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
     if (params->has_announce_initial) {
         s->parameters.announce_initial = params->announce_initial;
     }
@@ -2268,6 +2384,11 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
     MigrationState *s = migrate_get_current();
     const char *p = NULL;
 
+    if (migrate_fixed_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "x-fixed-ram requires a file: migration URI");
+        return;
+    }
+
     if (!migrate_prepare(s, has_blk && blk, has_inc && inc,
                          has_resume && resume, errp)) {
         /* Error detected, put into errp */
@@ -2292,6 +2413,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2434,6 +2557,34 @@ bool migrate_dirty_bitmaps(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_BITMAPS];
 }
 
+bool migrate_dirty_bitmaps_runs(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_BITMAPS_RUNS];
+}
+
+bool migrate_early_device_state(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_EARLY_DEVICE_STATE];
+}
+
+bool migrate_parallel_device_state(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[
+        MIGRATION_CAPABILITY_X_PARALLEL_DEVICE_STATE];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s;
@@ -2443,6 +2594,34 @@ bool migrate_ignore_shared(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_X_IGNORE_SHARED];
 }
 
+bool migrate_file_backed_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_FILE_BACKED_RAM];
+}
+
+bool migrate_fixed_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_FIXED_RAM];
+}
+
+bool migrate_fixed_ram_direct_io(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[
+        MIGRATION_CAPABILITY_X_FIXED_RAM_DIRECT_IO];
+}
+
 bool migrate_validate_uuid(void)
 {
     MigrationState *s;
@@ -2470,6 +2649,43 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_use_zero_copy_send(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+}
+
+bool migrate_use_multifd_adaptive_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[
+        MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_COMPRESSION];
+}
+
+bool migrate_multifd_postcopy(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2543,6 +2759,15 @@ static int64_t migrate_max_postcopy_bandwidth(void)
     return s->parameters.max_postcopy_bandwidth;
 }
 
+uint32_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
 bool migrate_use_block(void)
 {
     MigrationState *s;
@@ -4031,6 +4256,7 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         qemu_thread_create(&s->thread, "live_migration",
                 migration_thread, s, QEMU_THREAD_JOINABLE);
     }
+    qemu_thread_place(&s->thread, THREAD_PLACEMENT_ROLE_MIGRATION);
     s->migration_thread_running = true;
 }
 
@@ -4091,6 +4317,8 @@ static Property migration_properties[] = {
                       DEFAULT_MIGRATE_CPU_THROTTLE_INCREMENT),
     DEFINE_PROP_BOOL("x-cpu-throttle-tailslow", MigrationState,
                       parameters.cpu_throttle_tailslow, false),
+    DEFINE_PROP_BOOL("x-cpu-throttle-per-vcpu", MigrationState,
+                      parameters.cpu_throttle_per_vcpu, false),
     DEFINE_PROP_SIZE("x-max-bandwidth", MigrationState,
                       parameters.max_bandwidth, MAX_THROTTLE),
     DEFINE_PROP_UINT64("x-downtime-limit", MigrationState,
@@ -4120,6 +4348,9 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("max-cpu-throttle", MigrationState,
                       parameters.max_cpu_throttle,
                       DEFAULT_MIGRATE_MAX_CPU_THROTTLE),
+    DEFINE_PROP_UINT32("x-postcopy-prefetch-pages", MigrationState,
+                       parameters.postcopy_prefetch_pages,
+                       DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
     DEFINE_PROP_SIZE("announce-initial", MigrationState,
                       parameters.announce_initial,
                       DEFAULT_MIGRATE_ANNOUNCE_INITIAL),
@@ -4146,8 +4377,14 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+            MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-multifd-postcopy",
+            MIGRATION_CAPABILITY_MULTIFD_POSTCOPY),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-zero-copy-send",
+            MIGRATION_CAPABILITY_ZERO_COPY_SEND),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -4200,6 +4437,7 @@ static void migration_instance_init(Object *obj)
     params->has_cpu_throttle_initial = true;
     params->has_cpu_throttle_increment = true;
     params->has_cpu_throttle_tailslow = true;
+    params->has_cpu_throttle_per_vcpu = true;
     params->has_max_bandwidth = true;
     params->has_downtime_limit = true;
     params->has_x_checkpoint_delay = true;
@@ -4211,6 +4449,7 @@ static void migration_instance_init(Object *obj)
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
+    params->has_postcopy_prefetch_pages = true;
     params->has_announce_initial = true;
     params->has_announce_max = true;
     params->has_announce_rounds = true;
@@ -81,6 +81,15 @@ struct MigrationIncomingState {
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
     /* RAMBlock of last request sent to source */
     RAMBlock *last_rb;
+    /*
+     * Postcopy prefetch state, only used by the fault thread: the last
+     * range requested from prefetch_rb, and the number of pages that
+     * were requested past the faulting one.
+     */
+    RAMBlock *prefetch_rb;
+    ram_addr_t prefetch_start;
+    ram_addr_t prefetch_end;
+    uint32_t prefetch_window;
     void     *postcopy_tmp_page;
     void     *postcopy_tmp_zero_page;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
@@ -126,6 +135,18 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /*
+     * Host pages that the multifd channels are assembling in postcopy,
+     * indexed by their host address, and the lock protecting the table.
+     */
+    GHashTable *postcopy_host_pages;
+    QemuMutex postcopy_host_pages_mutex;
+    /*
+     * Set once the guest RAM is registered with userfaultfd, the multifd
+     * channels wait for it before placing postcopy pages.
+     */
+    QemuEvent postcopy_listen_event;
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -319,11 +340,21 @@ bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
+bool migrate_dirty_bitmaps_runs(void);
+bool migrate_parallel_device_state(void);
+bool migrate_early_device_state(void);
 bool migrate_ignore_shared(void);
+bool migrate_file_backed_ram(void);
+bool migrate_fixed_ram(void);
+bool migrate_fixed_ram_direct_io(void);
 bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_use_multifd_zero_page(void);
+bool migrate_use_zero_copy_send(void);
+bool migrate_use_multifd_adaptive_compression(void);
+bool migrate_multifd_postcopy(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
@@ -337,6 +368,7 @@ bool migrate_colo_enabled(void);
 bool migrate_use_block(void);
 bool migrate_use_block_incremental(void);
 int migrate_max_cpu_throttle(void);
+uint32_t migrate_postcopy_prefetch_pages(void);
 bool migrate_use_return_path(void);
 
 uint64_t ram_get_total_transferred_pages(void);
@@ -356,9 +388,10 @@ void migrate_send_rp_shut(MigrationIncomingState *mis,
 void migrate_send_rp_pong(MigrationIncomingState *mis,
                           uint32_t value);
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
-                              ram_addr_t start, uint64_t haddr);
+                              ram_addr_t start, uint64_t haddr, size_t len);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -0,0 +1,326 @@
+/*
+ * Multifd QATzip compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <qatzip.h>
+#include "qemu/rcu.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+struct qatzip_data {
+    /* QATzip session, one per channel */
+    QzSession_T sess;
+    /* the pages of a packet, QATzip only works on flat buffers */
+    uint8_t *in_buf;
+    /* size of in_buf */
+    uint32_t in_len;
+    /* compressed buffer */
+    uint8_t *out_buf;
+    /* size of compressed buffer */
+    uint32_t out_len;
+};
+
+/**
+ * qatzip_setup: create the QATzip session and the buffers of a channel
+ *
+ * The session is created with software fallback enabled, so that the
+ * compression is done on the CPU when there is no QAT device or when
+ * all of its instances are busy.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @q: QATzip data of the channel
+ * @id: channel number
+ * @dir: QZ_DIR_COMPRESS or QZ_DIR_DECOMPRESS
+ * @errp: pointer to an error
+ */
+static int qatzip_setup(struct qatzip_data *q, uint8_t id, QzDirection_T dir,
+                        Error **errp)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    QzSessionParamsDeflate_T params;
+    int ret;
+
+    ret = qzInit(&q->sess, true);
+    if (ret != QZ_OK && ret != QZ_DUPLICATE) {
+        error_setg(errp, "multifd %d: qzInit failed with error %d", id, ret);
+        return -1;
+    }
+
+    ret = qzGetDefaultsDeflate(&params);
+    if (ret != QZ_OK) {
+        error_setg(errp, "multifd %d: qzGetDefaultsDeflate failed with "
+                   "error %d", id, ret);
+        goto err_close;
+    }
+    params.common_params.direction = dir;
+    params.common_params.comp_lvl = migrate_multifd_zlib_level();
+    params.common_params.sw_backup = true;
+
+    ret = qzSetupSessionDeflate(&q->sess, &params);
+    if (ret != QZ_OK && ret != QZ_DUPLICATE) {
+        error_setg(errp, "multifd %d: qzSetupSessionDeflate failed with "
+                   "error %d", id, ret);
+        goto err_close;
+    }
+
+    /* We will never have more than page_count pages */
+    q->in_len = page_count * qemu_target_page_size();
+    q->in_buf = g_try_malloc(q->in_len);
+    if (!q->in_buf) {
+        error_setg(errp, "multifd %d: out of memory for in_buf", id);
+        goto err_teardown;
+    }
+
+    q->out_len = qzMaxCompressedLength(q->in_len, &q->sess);
+    q->out_buf = g_try_malloc(q->out_len);
+    if (!q->out_buf) {
+        error_setg(errp, "multifd %d: out of memory for out_buf", id);
+        goto err_teardown;
+    }
+    return 0;
+
+err_teardown:
+    g_free(q->in_buf);
+    q->in_buf = NULL;
+    qzTeardownSession(&q->sess);
+err_close:
+    qzClose(&q->sess);
+    return -1;
+}
+
+/**
+ * qatzip_cleanup: free the QATzip session and the buffers of a channel
+ *
+ * @q: QATzip data of the channel
+ */
+static void qatzip_cleanup(struct qatzip_data *q)
+{
+    qzTeardownSession(&q->sess);
+    qzClose(&q->sess);
+    g_free(q->in_buf);
+    g_free(q->out_buf);
+    g_free(q);
+}
+
+/* Multifd QATzip compression */
+
+/**
+ * qatzip_send_setup: setup send side
+ *
+ * Setup each channel with a QATzip compression session.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int qatzip_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct qatzip_data *q = g_new0(struct qatzip_data, 1);
+
+    if (qatzip_setup(q, p->id, QZ_DIR_COMPRESS, errp) < 0) {
+        g_free(q);
+        return -1;
+    }
+    p->data = q;
+    return 0;
+}
+
+/**
+ * qatzip_send_cleanup: cleanup send side
+ *
+ * Close the session and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void qatzip_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    qatzip_cleanup(p->data);
+    p->data = NULL;
+}
+
+/**
+ * qatzip_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int qatzip_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct qatzip_data *q = p->data;
+    unsigned int in_len = 0;
+    unsigned int out_len = q->out_len;
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < used; i++) {
+        memcpy(q->in_buf + in_len, iov[i].iov_base, iov[i].iov_len);
+        in_len += iov[i].iov_len;
+    }
+
+    ret = qzCompress(&q->sess, q->in_buf, &in_len, q->out_buf, &out_len, 1);
+    if (ret != QZ_OK) {
+        error_setg(errp, "multifd %d: qzCompress failed with error %d",
+                   p->id, ret);
+        return -1;
+    }
+    if (in_len != used * qemu_target_page_size()) {
+        error_setg(errp, "multifd %d: qzCompress consumed %u of %u bytes",
+                   p->id, in_len, used * qemu_target_page_size());
+        return -1;
+    }
+
+    p->next_packet_size = out_len;
+    p->flags |= MULTIFD_FLAG_QATZIP;
+
+    return 0;
+}
+
+/**
+ * qatzip_send_write: do the actual write of the data
+ *
+ * Do the actual write of the comprresed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int qatzip_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct qatzip_data *q = p->data;
+
+    return qio_channel_write_all(p->c, (void *)q->out_buf,
+                                 p->next_packet_size, errp);
+}
+
+/**
+ * qatzip_recv_setup: setup receive side
+ *
+ * Create the decompression session and buffers.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int qatzip_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct qatzip_data *q = g_new0(struct qatzip_data, 1);
+
+    if (qatzip_setup(q, p->id, QZ_DIR_DECOMPRESS, errp) < 0) {
+        g_free(q);
+        return -1;
+    }
+    p->data = q;
+    return 0;
+}
+
+/**
+ * qatzip_recv_cleanup: cleanup receive side
+ *
+ * Close the session and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void qatzip_recv_cleanup(MultiFDRecvParams *p)
+{
+    qatzip_cleanup(p->data);
+    p->data = NULL;
+}
+
+/**
+ * qatzip_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int qatzip_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct qatzip_data *q = p->data;
+    unsigned int in_len = p->next_packet_size;
+    unsigned int out_len = q->in_len;
+    uint32_t expected_size = used * qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t offset = 0;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_QATZIP) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_QATZIP);
+        return -1;
+    }
+    if (in_len > q->out_len) {
+        error_setg(errp, "multifd %d: packet size received %u maximum %u",
+                   p->id, in_len, q->out_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)q->out_buf, in_len, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = qzDecompress(&q->sess, q->out_buf, &in_len, q->in_buf, &out_len);
+    if (ret != QZ_OK) {
+        error_setg(errp, "multifd %d: qzDecompress failed with error %d",
+                   p->id, ret);
+        return -1;
+    }
+    if (out_len != expected_size) {
+        error_setg(errp, "multifd %d: packet size received %u size expected %u",
+                   p->id, out_len, expected_size);
+        return -1;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+
+        memcpy(iov->iov_base, q->in_buf + offset, iov->iov_len);
+        offset += iov->iov_len;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_qatzip_ops = {
+    .send_setup = qatzip_send_setup,
+    .send_cleanup = qatzip_send_cleanup,
+    .send_prepare = qatzip_send_prepare,
+    .send_write = qatzip_send_write,
+    .recv_setup = qatzip_recv_setup,
+    .recv_cleanup = qatzip_recv_cleanup,
+    .recv_pages = qatzip_recv_pages
+};
+
+static void multifd_qatzip_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_QATZIP, &multifd_qatzip_ops);
+}
+
+migration_init(multifd_qatzip_register);
@@ -0,0 +1,406 @@
+/*
+ * Multifd XBZRLE encoding
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "exec/target_page.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "ram.h"
+#include "xbzrle.h"
+#include "multifd.h"
+
+/*
+ * Payload of a MULTIFD_FLAG_XBZRLE packet: one header per data page,
+ * followed by the data of every page that has some.
+ */
+/* the page has not changed since it was cached, no data */
+#define XBZRLE_HDR_UNCHANGED 0
+/* the data is the whole page */
+#define XBZRLE_HDR_RAW UINT32_MAX
+/* any other value is the size of the XBZRLE encoded data */
+
+struct xbzrle_send_data {
+    /* be32 header of each page */
+    uint32_t *hdr;
+    /* copy of the pages, the guest may change them while we encode */
+    uint8_t *copy;
+    /* XBZRLE encoded pages */
+    uint8_t *encoded;
+    /* a page full of zeros */
+    uint8_t *zero_page;
+    /* headers and data to write */
+    struct iovec *iov;
+    uint32_t iovcnt;
+    /* counters not yet accounted by the migration thread */
+    uint64_t pending_hits;
+    uint64_t pending_encoded;
+    uint64_t pending_misses;
+    uint64_t pending_overflows;
+    uint64_t pending_bytes;
+};
+
+struct xbzrle_recv_data {
+    /* be32 header of each page */
+    uint32_t *hdr;
+    /* XBZRLE encoded pages */
+    uint8_t *encoded;
+    /* headers and data to read */
+    struct iovec *iov;
+    /* number of pages the buffers can hold */
+    uint32_t allocated;
+};
+
+/**
+ * multifd_xbzrle_send_setup: allocate the buffers of a channel
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    struct xbzrle_send_data *x = g_new0(struct xbzrle_send_data, 1);
+
+    x->hdr = g_new0(uint32_t, page_count);
+    x->iov = g_new0(struct iovec, page_count + 1);
+    x->copy = g_try_malloc(MULTIFD_PACKET_SIZE);
+    x->encoded = g_try_malloc(MULTIFD_PACKET_SIZE);
+    x->zero_page = g_try_malloc0(qemu_target_page_size());
+    p->xbzrle_data = x;
+    if (!x->copy || !x->encoded || !x->zero_page) {
+        error_setg(errp, "multifd %d: out of memory for XBZRLE", p->id);
+        multifd_xbzrle_send_cleanup(p);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * multifd_xbzrle_send_cleanup: free the buffers of a channel
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_xbzrle_send_cleanup(MultiFDSendParams *p)
+{
+    struct xbzrle_send_data *x = p->xbzrle_data;
+
+    if (!x) {
+        return;
+    }
+    g_free(x->hdr);
+    g_free(x->iov);
+    g_free(x->copy);
+    g_free(x->encoded);
+    g_free(x->zero_page);
+    g_free(x);
+    p->xbzrle_data = NULL;
+}
+
+/**
+ * multifd_xbzrle_send_zero_pages: update the cache with the zero pages
+ *
+ * Like for pages written by the migration thread, a previous version
+ * of a zero page in the cache would be stale.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_xbzrle_send_zero_pages(MultiFDSendParams *p)
+{
+    struct xbzrle_send_data *x = p->xbzrle_data;
+    MultiFDPages_t *pages = p->pages;
+    PageCache *cache;
+    uint32_t i;
+
+    RCU_READ_LOCK_GUARD();
+    cache = xbzrle_cache_get_rcu();
+    if (!cache) {
+        return;
+    }
+    for (i = pages->used; i < pages->used + pages->zero_num; i++) {
+        uint64_t addr = pages->block->offset + pages->offset[i];
+
+        cache_lock(cache, addr);
+        cache_insert(cache, addr, x->zero_page, p->xbzrle_age);
+        cache_unlock(cache, addr);
+    }
+}
+
+/**
+ * multifd_xbzrle_encode_page: encode one page against its cached version
+ *
+ * Returns the header of the page and sets *data to the data to send.
+ *
+ * @p: Params for the channel that we are using
+ * @cache: XBZRLE cache, or NULL if it has already been freed
+ * @addr: ram_addr_t of the page
+ * @page: copy of the page contents
+ * @encoded: where to put the encoded data
+ * @data: data to send for the page
+ */
+static uint32_t multifd_xbzrle_encode_page(MultiFDSendParams *p,
+                                           PageCache *cache, uint64_t addr,
+                                           uint8_t *page, uint8_t *encoded,
+                                           uint8_t **data)
+{
+    struct xbzrle_send_data *x = p->xbzrle_data;
+    size_t page_size = qemu_target_page_size();
+    uint8_t *prev_cached_page;
+    int encoded_len;
+
+    *data = page;
+    if (!cache) {
+        return XBZRLE_HDR_RAW;
+    }
+
+    cache_lock(cache, addr);
+    if (!cache_is_cached(cache, addr, p->xbzrle_age)) {
+        x->pending_misses++;
+        /* we send the copy, so the cache matches what the destination has */
+        cache_insert(cache, addr, page, p->xbzrle_age);
+        cache_unlock(cache, addr);
+        return XBZRLE_HDR_RAW;
+    }
+
+    x->pending_hits++;
+    prev_cached_page = get_cached_data(cache, addr);
+    encoded_len = xbzrle_encode_buffer(prev_cached_page, page, page_size,
+                                       encoded, page_size);
+    if (encoded_len != 0) {
+        memcpy(prev_cached_page, page, page_size);
+    }
+    cache_unlock(cache, addr);
+
+    if (encoded_len == 0) {
+        x->pending_encoded++;
+        return XBZRLE_HDR_UNCHANGED;
+    } else if (encoded_len == -1) {
+        x->pending_overflows++;
+        x->pending_bytes += page_size;
+        return XBZRLE_HDR_RAW;
+    }
+
+    x->pending_encoded++;
+    x->pending_bytes += encoded_len + sizeof(uint32_t);
+    *data = encoded;
+    return encoded_len;
+}
+
+/**
+ * multifd_xbzrle_send_prepare: encode the pages of a packet
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                                Error **errp)
+{
+    struct xbzrle_send_data *x = p->xbzrle_data;
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint8_t *encoded = x->encoded;
+    PageCache *cache;
+    uint32_t i;
+
+    x->iov[0].iov_base = x->hdr;
+    x->iov[0].iov_len = used * sizeof(uint32_t);
+    x->iovcnt = 1;
+    p->next_packet_size = x->iov[0].iov_len;
+
+    RCU_READ_LOCK_GUARD();
+    cache = xbzrle_cache_get_rcu();
+    for (i = 0; i < used; i++) {
+        uint64_t addr = pages->block->offset + pages->offset[i];
+        uint8_t *page = x->copy + i * page_size;
+        uint8_t *data;
+        uint32_t hdr;
+
+        memcpy(page, pages->iov[i].iov_base, page_size);
+        hdr = multifd_xbzrle_encode_page(p, cache, addr, page, encoded,
+                                         &data);
+        x->hdr[i] = cpu_to_be32(hdr);
+        if (hdr == XBZRLE_HDR_UNCHANGED) {
+            continue;
+        }
+        x->iov[x->iovcnt].iov_base = data;
+        x->iov[x->iovcnt].iov_len = hdr == XBZRLE_HDR_RAW ? page_size : hdr;
+        p->next_packet_size += x->iov[x->iovcnt].iov_len;
+        x->iovcnt++;
+        if (data == encoded) {
+            encoded += hdr;
+        }
+    }
+
+    p->flags |= MULTIFD_FLAG_NOCOMP | MULTIFD_FLAG_XBZRLE;
+    return 0;
+}
+
+/**
+ * multifd_xbzrle_send_write: write the headers and data of a packet
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                              Error **errp)
+{
+    struct xbzrle_send_data *x = p->xbzrle_data;
+
+    return qio_channel_writev_all(p->c, x->iov, x->iovcnt, errp);
+}
+
+/**
+ * multifd_xbzrle_send_account: account the XBZRLE work of a channel
+ *
+ * Must be called from the migration thread with p->mutex held, see
+ * multifd_send_account.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_xbzrle_send_account(MultiFDSendParams *p)
+{
+    struct xbzrle_send_data *x = p->xbzrle_data;
+
+    if (!x) {
+        return;
+    }
+    xbzrle_counters.pages += x->pending_hits;
+    xbzrle_counters.cache_miss += x->pending_misses;
+    xbzrle_counters.overflow += x->pending_overflows;
+    xbzrle_counters.bytes += x->pending_bytes;
+    /* ram_save_multifd_page() accounted them as normal pages */
+    ram_counters.normal -= x->pending_encoded;
+    x->pending_hits = 0;
+    x->pending_misses = 0;
+    x->pending_overflows = 0;
+    x->pending_bytes = 0;
+    x->pending_encoded = 0;
+}
+
+/**
+ * multifd_xbzrle_recv_pages: read and decode the pages of a packet
+ *
+ * The migration capability is only needed on the source, so the
+ * buffers are allocated the first time that a channel receives an
+ * XBZRLE packet.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                              Error **errp)
+{
+    struct xbzrle_recv_data *x = p->xbzrle_data;
+    size_t page_size = qemu_target_page_size();
+    uint32_t expected_size = used * sizeof(uint32_t);
+    uint8_t *encoded;
+    uint32_t i, iovcnt = 0;
+    int ret;
+
+    if (!x) {
+        x = p->xbzrle_data = g_new0(struct xbzrle_recv_data, 1);
+    }
+    if (x->allocated < used) {
+        g_free(x->hdr);
+        g_free(x->encoded);
+        g_free(x->iov);
+        x->hdr = g_new(uint32_t, used);
+        x->encoded = g_malloc(used * page_size);
+        x->iov = g_new(struct iovec, used);
+        x->allocated = used;
+    }
+
+    if (p->next_packet_size < expected_size) {
+        error_setg(errp, "multifd %d: packet size received %u size expected "
+                   "at least %u", p->id, p->next_packet_size, expected_size);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)x->hdr, expected_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    encoded = x->encoded;
+    for (i = 0; i < used; i++) {
+        uint32_t hdr = be32_to_cpu(x->hdr[i]);
+
+        x->hdr[i] = hdr;
+        if (hdr == XBZRLE_HDR_UNCHANGED) {
+            continue;
+        }
+        if (hdr == XBZRLE_HDR_RAW) {
+            x->iov[iovcnt] = p->pages->iov[i];
+        } else if (hdr <= page_size) {
+            x->iov[iovcnt].iov_base = encoded;
+            x->iov[iovcnt].iov_len = hdr;
+            encoded += hdr;
+        } else {
+            error_setg(errp, "multifd %d: XBZRLE page %u with size %u",
+                       p->id, i, hdr);
+            return -1;
+        }
+        expected_size += x->iov[iovcnt].iov_len;
+        iovcnt++;
+    }
+    if (p->next_packet_size != expected_size) {
+        error_setg(errp, "multifd %d: packet size received %u size expected "
+                   "%u", p->id, p->next_packet_size, expected_size);
+        return -1;
+    }
+
+    ret = qio_channel_readv_all(p->c, x->iov, iovcnt, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    encoded = x->encoded;
+    for (i = 0; i < used; i++) {
+        uint32_t hdr = x->hdr[i];
+
+        if (hdr == XBZRLE_HDR_UNCHANGED || hdr == XBZRLE_HDR_RAW) {
+            continue;
+        }
+        if (xbzrle_decode_buffer(encoded, hdr, p->pages->iov[i].iov_base,
+                                 page_size) < 0) {
+            error_setg(errp, "multifd %d: failed to decode XBZRLE page %u",
+                       p->id, i);
+            return -1;
+        }
+        encoded += hdr;
+    }
+    return 0;
+}
+
+/**
+ * multifd_xbzrle_recv_cleanup: free the buffers of a channel
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_recv_data *x = p->xbzrle_data;
+
+    if (!x) {
+        return;
+    }
+    g_free(x->hdr);
+    g_free(x->encoded);
+    g_free(x->iov);
+    g_free(x);
+    p->xbzrle_data = NULL;
+}
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include <zstd.h>
 #include "qemu/rcu.h"
+#include "qemu/host-utils.h"
 #include "exec/target_page.h"
 #include "qapi/error.h"
 #include "migration.h"
@@ -31,8 +32,68 @@ struct zstd_data {
     uint8_t *zbuff;
     /* size of compressed buffer */
     uint32_t zbuff_len;
+    /* pages sent without compression, one bit per page */
+    uint8_t *raw_bitmap;
+    /* number of pages sent without compression */
+    uint32_t raw_num;
+    /* bitmap, compressed buffer and uncompressed pages to send */
+    struct iovec *iov;
 };
 
+/* Bytes read at each sampling point of a page */
+#define ZSTD_SAMPLE_SIZE 16
+/* Distance between two sampling points */
+#define ZSTD_SAMPLE_STRIDE 128
+/* Percentage of the maximum entropy above which we don't compress */
+#define ZSTD_ENTROPY_THRESHOLD 80
+
+/* log2(x^4), keeps two fractional bits of the logarithm */
+static inline uint32_t zstd_ilog2_w(uint64_t x)
+{
+    return 63 - clz64(x * x * x * x);
+}
+
+/**
+ * zstd_page_is_compressible: guess if compressing a page is worth it
+ *
+ * Estimate the Shannon entropy of the page from a sample of its bytes.
+ * Pages that are already compressed or encrypted have a byte
+ * distribution close to random, and zstd can't make them smaller.
+ *
+ * @buf: contents of the page
+ * @len: size of the page
+ */
+static bool zstd_page_is_compressible(const uint8_t *buf, size_t len)
+{
+    uint32_t count[256] = { 0 };
+    uint32_t samples = 0;
+    uint64_t entropy = 0;
+    uint32_t samples_log;
+    size_t i, j;
+
+    for (i = 0; i + ZSTD_SAMPLE_SIZE <= len; i += ZSTD_SAMPLE_STRIDE) {
+        for (j = 0; j < ZSTD_SAMPLE_SIZE; j++) {
+            count[buf[i + j]]++;
+        }
+        samples += ZSTD_SAMPLE_SIZE;
+    }
+    if (!samples) {
+        return true;
+    }
+
+    /* sum(c/n * log2(n/c)) for each byte value that appears c times */
+    samples_log = zstd_ilog2_w(samples);
+    for (i = 0; i < ARRAY_SIZE(count); i++) {
+        if (count[i]) {
+            entropy += count[i] * (samples_log - zstd_ilog2_w(count[i]));
+        }
+    }
+    entropy /= samples;
+
+    /* the maximum is 8 bits per byte, i.e. 8 * 4 with zstd_ilog2_w */
+    return entropy * 100 < ZSTD_ENTROPY_THRESHOLD * 8 * 4;
+}
+
 /* Multifd zstd compression */
 
 /**
@@ -77,6 +138,8 @@ static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
         error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
         return -1;
     }
+    z->raw_bitmap = g_new0(uint8_t, DIV_ROUND_UP(page_count, BITS_PER_BYTE));
+    z->iov = g_new0(struct iovec, page_count + 2);
     return 0;
 }
 
@@ -95,6 +158,10 @@ static void zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
     z->zcs = NULL;
     g_free(z->zbuff);
     z->zbuff = NULL;
+    g_free(z->raw_bitmap);
+    z->raw_bitmap = NULL;
+    g_free(z->iov);
+    z->iov = NULL;
     g_free(p->data);
     p->data = NULL;
 }
@@ -105,6 +172,10 @@ static void zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
  * Create a compressed buffer with all the pages that we are going to
  * send.
  *
+ * With adaptive compression, the pages that don't look compressible
+ * are left out of the compressed buffer and sent as they are after
+ * it.  The packet payload then starts with a bitmap of those pages.
+ *
  * Returns 0 for success or -1 for error
  *
  * @p: Params for the channel that we are using
@@ -114,17 +185,38 @@ static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
     struct iovec *iov = p->pages->iov;
     struct zstd_data *z = p->data;
+    uint32_t bitmap_len = 0;
+    uint32_t last = used - 1;
     int ret;
     uint32_t i;
 
     z->out.dst = z->zbuff;
     z->out.size = z->zbuff_len;
     z->out.pos = 0;
+    z->raw_num = 0;
+
+    if (migrate_use_multifd_adaptive_compression()) {
+        bitmap_len = DIV_ROUND_UP(used, BITS_PER_BYTE);
+        memset(z->raw_bitmap, 0, bitmap_len);
+        for (i = 0; i < used; i++) {
+            if (zstd_page_is_compressible(iov[i].iov_base, iov[i].iov_len)) {
+                last = i;
+            } else {
+                z->raw_bitmap[i / BITS_PER_BYTE] |= 1 << (i % BITS_PER_BYTE);
+                z->iov[z->raw_num + 2] = iov[i];
+                z->raw_num++;
+            }
+        }
+    }
 
-    for (i = 0; i < used; i++) {
+    for (i = 0; i < used && z->raw_num < used; i++) {
         ZSTD_EndDirective flush = ZSTD_e_continue;
 
-        if (i == used - 1) {
+        if (bitmap_len &&
+            z->raw_bitmap[i / BITS_PER_BYTE] & (1 << (i % BITS_PER_BYTE))) {
+            continue;
+        }
+        if (i == last) {
             flush = ZSTD_e_flush;
         }
         z->in.src = iov[i].iov_base;
@@ -157,6 +249,16 @@ static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
     p->next_packet_size = z->out.pos;
     p->flags |= MULTIFD_FLAG_ZSTD;
 
+    if (bitmap_len) {
+        z->iov[0].iov_base = z->raw_bitmap;
+        z->iov[0].iov_len = bitmap_len;
+        z->iov[1].iov_base = z->zbuff;
+        z->iov[1].iov_len = z->out.pos;
+        p->next_packet_size += bitmap_len +
+                               z->raw_num * qemu_target_page_size();
+        p->flags |= MULTIFD_FLAG_RAW_BITMAP;
+    }
+
     return 0;
 }
 
@@ -175,6 +277,9 @@ static int zstd_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
     struct zstd_data *z = p->data;
 
+    if (migrate_use_multifd_adaptive_compression()) {
+        return qio_channel_writev_all(p->c, z->iov, z->raw_num + 2, errp);
+    }
     return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
                                  errp);
 }
@@ -223,6 +328,8 @@ static int zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
         error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
         return -1;
     }
+    z->raw_bitmap = g_new0(uint8_t, DIV_ROUND_UP(page_count, BITS_PER_BYTE));
+    z->iov = g_new0(struct iovec, page_count + 2);
     return 0;
 }
 
@@ -241,6 +348,10 @@ static void zstd_recv_cleanup(MultiFDRecvParams *p)
     z->zds = NULL;
     g_free(z->zbuff);
     z->zbuff = NULL;
+    g_free(z->raw_bitmap);
+    z->raw_bitmap = NULL;
+    g_free(z->iov);
+    z->iov = NULL;
     g_free(p->data);
     p->data = NULL;
 }
@@ -264,6 +375,7 @@ static int zstd_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
     uint32_t expected_size = used * qemu_target_page_size();
     uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
     struct zstd_data *z = p->data;
+    uint32_t bitmap_len = 0;
     int ret;
     int i;
 
@@ -272,19 +384,68 @@ static int zstd_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
                    p->id, flags, MULTIFD_FLAG_ZSTD);
         return -1;
     }
+
+    z->raw_num = 0;
+    if (p->flags & MULTIFD_FLAG_RAW_BITMAP) {
+        uint32_t raw_size;
+
+        bitmap_len = DIV_ROUND_UP(used, BITS_PER_BYTE);
+        if (in_size < bitmap_len) {
+            error_setg(errp, "multifd %d: packet size received %d too small "
+                       "for a bitmap of %d pages", p->id, in_size, used);
+            return -1;
+        }
+        ret = qio_channel_read_all(p->c, (void *)z->raw_bitmap, bitmap_len,
+                                   errp);
+        if (ret != 0) {
+            return ret;
+        }
+        for (i = 0; i < used; i++) {
+            if (z->raw_bitmap[i / BITS_PER_BYTE] & (1 << (i % BITS_PER_BYTE))) {
+                z->iov[z->raw_num++] = p->pages->iov[i];
+            }
+        }
+        raw_size = z->raw_num * qemu_target_page_size();
+        if (in_size - bitmap_len < raw_size) {
+            error_setg(errp, "multifd %d: packet size received %d too small "
+                       "for %d uncompressed pages", p->id, in_size,
+                       z->raw_num);
+            return -1;
+        }
+        in_size -= bitmap_len + raw_size;
+        expected_size -= raw_size;
+    }
+
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %d maximum %d",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
     ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
 
     if (ret != 0) {
         return ret;
     }
 
+    if (z->raw_num) {
+        ret = qio_channel_readv_all(p->c, z->iov, z->raw_num, errp);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
     z->in.src = z->zbuff;
     z->in.size = in_size;
     z->in.pos = 0;
 
-    for (i = 0; i < used; i++) {
+    for (i = 0; i < used && z->raw_num < used; i++) {
         struct iovec *iov = &p->pages->iov[i];
 
+        if (bitmap_len &&
+            z->raw_bitmap[i / BITS_PER_BYTE] & (1 << (i % BITS_PER_BYTE))) {
+            continue;
+        }
+
         z->out.dst = iov->iov_base;
         z->out.size = iov->iov_len;
         z->out.pos = 0;
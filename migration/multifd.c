@@ -12,6 +12,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
+#include "qemu/thread-placement.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -20,13 +22,17 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "postcopy-ram.h"
+#include "migration/colo.h"
 
 #include "qemu/yank.h"
 #include "io/channel-socket.h"
+#include "io/channel-file.h"
 #include "yank_functions.h"
 
 /* Multiple fd's */
@@ -87,6 +93,9 @@ static void nocomp_send_cleanup(MultiFDSendParams *p, Error **errp)
 static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
                                Error **errp)
 {
+    if (p->xbzrle) {
+        return multifd_xbzrle_send_prepare(p, used, errp);
+    }
     p->next_packet_size = used * qemu_target_page_size();
     p->flags |= MULTIFD_FLAG_NOCOMP;
     return 0;
@@ -105,7 +114,11 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+    if (p->xbzrle) {
+        return multifd_xbzrle_send_write(p, used, errp);
+    }
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, NULL, 0,
+                                       p->write_flags, errp);
 }
 
 /**
@@ -137,7 +150,8 @@ static void nocomp_recv_cleanup(MultiFDRecvParams *p)
 /**
  * nocomp_recv_pages: read the data from the channel into actual pages
  *
- * For no compression we just need to read things into the correct place.
+ * For no compression we just need to read things into the correct place,
+ * unless the pages are XBZRLE encoded.
  *
  * Returns 0 for success or -1 for error
  *
@@ -154,6 +168,9 @@ static int nocomp_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
                    p->id, flags, MULTIFD_FLAG_NOCOMP);
         return -1;
     }
+    if (p->flags & MULTIFD_FLAG_XBZRLE) {
+        return multifd_xbzrle_recv_pages(p, used, errp);
+    }
     return qio_channel_readv_all(p->c, p->pages->iov, used, errp);
 }
 
@@ -253,6 +270,7 @@ static MultiFDPages_t *multifd_pages_init(size_t size)
 static void multifd_pages_clear(MultiFDPages_t *pages)
 {
     pages->used = 0;
+    pages->zero_num = 0;
     pages->allocated = 0;
     pages->packet_num = 0;
     pages->block = NULL;
@@ -271,6 +289,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->pages_used = cpu_to_be32(p->pages->used);
+    packet->zero_pages = cpu_to_be32(p->pages->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -278,7 +297,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero_num; i++) {
         /* there are architectures where ram_addr_t is 32 bit */
         uint64_t temp = p->pages->offset[i];
 
@@ -291,6 +310,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     MultiFDPacket_t *packet = p->packet;
     uint32_t pages_max = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     RAMBlock *block;
+    uint8_t *host;
     int i;
 
     packet->magic = be32_to_cpu(packet->magic);
@@ -339,10 +359,22 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    /*
+     * Senders that don't detect zero pages leave this field as zero,
+     * it used to be reserved.
+     */
+    p->pages->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->pages->zero_num > packet->pages_alloc - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum pages are %d",
+                   p->pages->zero_num, packet->pages_alloc - p->pages->used);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used + p->pages->zero_num == 0) {
         return 0;
     }
 
@@ -355,7 +387,22 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    /*
+     * In the COLO stage, the pages of a checkpoint go to the COLO
+     * cache; they are flushed into the secondary's RAM only once
+     * the whole checkpoint has been received.
+     */
+    host = block->host;
+    if (migration_incoming_in_colo_state()) {
+        if (!block->colo_cache) {
+            error_setg(errp, "multifd: no COLO cache for ram block %s",
+                       block->idstr);
+            return -1;
+        }
+        host = block->colo_cache;
+    }
+
+    for (i = 0; i < p->pages->used + p->pages->zero_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
         if (offset > (block->used_length - qemu_target_page_size())) {
@@ -364,9 +411,16 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->used_length);
             return -1;
         }
-        p->pages->iov[i].iov_base = block->host + offset;
+        p->pages->offset[i] = offset;
+        p->pages->iov[i].iov_base = host + offset;
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
+    p->pages->block = block;
+
+    if (host == block->colo_cache) {
+        colo_record_bitmap(block, p->pages->offset,
+                           p->pages->used + p->pages->zero_num);
+    }
 
     return 0;
 }
@@ -407,13 +461,38 @@ struct {
  * false.
  */
 
+/**
+ * multifd_send_account: account the work already done by a channel
+ *
+ * The channel threads only know how many bytes they really put on
+ * the wire (zero pages are not sent) once they have processed the
+ * pages, so the migration thread updates the global counters when
+ * it is sure that the channel has finished with its previous job.
+ *
+ * Must be called from the migration thread with p->mutex held.
+ *
+ * @f: QEMUFile used for rate limiting
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_account(QEMUFile *f, MultiFDSendParams *p)
+{
+    qemu_file_update_transfer(f, p->pending_bytes);
+    ram_counters.multifd_bytes += p->pending_bytes;
+    ram_counters.transferred += p->pending_bytes;
+    /* ram_save_multifd_page() accounted them as normal pages */
+    ram_counters.normal -= p->pending_zero_pages;
+    ram_counters.duplicate += p->pending_zero_pages;
+    p->pending_bytes = 0;
+    p->pending_zero_pages = 0;
+    multifd_xbzrle_send_account(p);
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
     static int next_channel;
     MultiFDSendParams *p = NULL; /* make happy gcc */
     MultiFDPages_t *pages = multifd_send_state->pages;
-    uint64_t transferred;
 
     if (qatomic_read(&multifd_send_state->exiting)) {
         return -1;
@@ -445,14 +524,14 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->used);
     assert(!p->pages->block);
 
+    multifd_send_account(f, p);
     p->packet_num = multifd_send_state->packet_num++;
+    p->xbzrle = p->xbzrle_data && ram_xbzrle_multifd_age(&p->xbzrle_age);
+    if (migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->used) * qemu_target_page_size()
-                + p->packet_len;
-    qemu_file_update_transfer(f, transferred);
-    ram_counters.multifd_bytes += transferred;
-    ram_counters.transferred += transferred;
     qemu_mutex_unlock(&p->mutex);
     qemu_sem_post(&p->sem);
 
@@ -565,6 +644,7 @@ void multifd_save_cleanup(void)
             migrate_set_error(migrate_get_current(), local_err);
             error_free(local_err);
         }
+        multifd_xbzrle_send_cleanup(p);
     }
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     g_free(multifd_send_state->params);
@@ -604,9 +684,11 @@ void multifd_send_sync_main(QEMUFile *f)
         p->packet_num = multifd_send_state->packet_num++;
         p->flags |= MULTIFD_FLAG_SYNC;
         p->pending_job++;
-        qemu_file_update_transfer(f, p->packet_len);
-        ram_counters.multifd_bytes += p->packet_len;
-        ram_counters.transferred += p->packet_len;
+        if (!migrate_fixed_ram()) {
+            qemu_file_update_transfer(f, p->packet_len);
+            ram_counters.multifd_bytes += p->packet_len;
+            ram_counters.transferred += p->packet_len;
+        }
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_post(&p->sem);
     }
@@ -615,10 +697,132 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        WITH_QEMU_LOCK_GUARD(&p->mutex) {
+            multifd_send_account(f, p);
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/**
+ * multifd_send_zero_page_detect: find the zero pages of a packet
+ *
+ * Reorder the pages so that the ones with data come first and the
+ * zero pages are left at the end of the array.  Only the offsets of
+ * the zero pages are sent, as part of the packet header.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i = 0;
+    uint32_t j = pages->used;
+
+    if (!migrate_use_multifd_zero_page() && !migrate_fixed_ram()) {
+        return;
+    }
+
+    while (i < j) {
+        ram_addr_t offset;
+        struct iovec iov;
+
+        if (!buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            i++;
+            continue;
+        }
+        j--;
+        /* page i is zero, swap it with the last unchecked one */
+        offset = pages->offset[i];
+        pages->offset[i] = pages->offset[j];
+        pages->offset[j] = offset;
+        iov = pages->iov[i];
+        pages->iov[i] = pages->iov[j];
+        pages->iov[j] = iov;
+    }
+
+    pages->zero_num = pages->used - i;
+    pages->used = i;
+}
+
+/**
+ * multifd_send_fixed_ram: write the pages of a job to the file
+ *
+ * With fixed-ram there are no packets: each page is written at its
+ * offset in the region of its block, merging runs of contiguous pages,
+ * and the bitmap of the block records whether the file holds the page
+ * or the page is zero.  Called with p->mutex held, returns with it
+ * released.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_send_fixed_ram(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    RAMBlock *block = pages->block;
+    size_t page_size = qemu_target_page_size();
+    int fd = QIO_CHANNEL_FILE(p->c)->fd;
+    uint32_t flags = p->flags;
+    uint32_t used, zero_num, i, j, k;
+
+    multifd_send_zero_page_detect(p);
+    used = pages->used;
+    zero_num = pages->zero_num;
+    p->flags = 0;
+    p->num_pages += used;
+    p->num_zero_pages += zero_num;
+    p->pending_bytes += used * page_size;
+    p->pending_zero_pages += zero_num;
+    qemu_mutex_unlock(&p->mutex);
+
+    trace_multifd_send(p->id, 0, used, zero_num, flags, used * page_size);
+
+    for (i = used; i < used + zero_num; i++) {
+        clear_bit_atomic(pages->offset[i] / page_size, block->file_bmap);
+    }
+    for (i = 0; i < used; i = j) {
+        for (j = i + 1; j < used; j++) {
+            if (pages->offset[j] != pages->offset[j - 1] + page_size) {
+                break;
+            }
+        }
+        if (file_pwrite_all(fd, block->host + pages->offset[i],
+                            (j - i) * page_size,
+                            block->pages_offset + pages->offset[i],
+                            errp) < 0) {
+            return -1;
+        }
+        for (k = i; k < j; k++) {
+            set_bit_atomic(pages->offset[k] / page_size, block->file_bmap);
+        }
+    }
+
+    if (used + zero_num && migrate_background_snapshot() &&
+        ram_write_tracking_release(block, pages->offset, used + zero_num)) {
+        error_setg(errp, "multifd %u: cannot release write protection",
+                   p->id);
+        return -1;
+    }
+
+    qemu_mutex_lock(&p->mutex);
+    pages->used = 0;
+    pages->zero_num = 0;
+    pages->block = NULL;
+    p->pending_job--;
+    qemu_mutex_unlock(&p->mutex);
+
+    if (flags & MULTIFD_FLAG_SYNC) {
+        qemu_sem_post(&p->sem_sync);
+    }
+    qemu_sem_post(&multifd_send_state->channels_ready);
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -629,12 +833,14 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    if (!migrate_fixed_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -644,11 +850,25 @@ static void *multifd_send_thread(void *opaque)
         }
         qemu_mutex_lock(&p->mutex);
 
-        if (p->pending_job) {
-            uint32_t used = p->pages->used;
+        if (p->pending_job && migrate_fixed_ram()) {
+            ret = multifd_send_fixed_ram(p, &local_err);
+            if (ret != 0) {
+                break;
+            }
+        } else if (p->pending_job) {
+            bool has_pages = p->pages->used != 0;
             uint64_t packet_num = p->packet_num;
+            RAMBlock *block = p->pages->block;
+            uint32_t used, zero_num;
             flags = p->flags;
 
+            multifd_send_zero_page_detect(p);
+            used = p->pages->used;
+            zero_num = p->pages->zero_num;
+            if (p->xbzrle && zero_num) {
+                multifd_xbzrle_send_zero_pages(p);
+            }
+
             if (used) {
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
@@ -661,11 +881,19 @@ static void *multifd_send_thread(void *opaque)
             p->flags = 0;
             p->num_packets++;
             p->num_pages += used;
+            p->num_zero_pages += zero_num;
+            /* packets without pages are accounted by multifd_send_sync_main */
+            if (has_pages) {
+                p->pending_bytes += (used ? p->next_packet_size : 0)
+                                  + p->packet_len;
+                p->pending_zero_pages += zero_num;
+            }
             p->pages->used = 0;
+            p->pages->zero_num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, used, flags,
+            trace_multifd_send(p->id, packet_num, used, zero_num, flags,
                                p->next_packet_size);
 
             ret = qio_channel_write_all(p->c, (void *)p->packet,
@@ -681,6 +909,31 @@ static void *multifd_send_thread(void *opaque)
                 }
             }
 
+            /* The pages are saved, wake up the vCPUs that wait for them */
+            if (has_pages && migrate_background_snapshot()) {
+                ret = ram_write_tracking_release(block, p->pages->offset,
+                                                 used + zero_num);
+                if (ret != 0) {
+                    error_setg(&local_err, "multifd %u: cannot release "
+                               "write protection", p->id);
+                    break;
+                }
+            }
+
+            /*
+             * Pages of the next round may go through other channels, so
+             * the zero-copy sends of this one must have left first.
+             */
+            if ((flags & MULTIFD_FLAG_SYNC) &&
+                (p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY)) {
+                ret = qio_channel_flush(p->c, &local_err);
+                if (ret < 0) {
+                    break;
+                }
+                trace_multifd_send_flush(p->id, ret == 1);
+                ret = 0;
+            }
+
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
             qemu_mutex_unlock(&p->mutex);
@@ -719,7 +972,8 @@ out:
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages,
+                                  p->num_zero_pages);
 
     return NULL;
 }
@@ -817,6 +1071,7 @@ static bool multifd_channel_connect(MultiFDSendParams *p,
             p->c = ioc;
             qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
                                    QEMU_THREAD_JOINABLE);
+            qemu_thread_place(&p->thread, THREAD_PLACEMENT_ROLE_MULTIFD);
        }
        return true;
     }
@@ -851,6 +1106,13 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     if (qio_task_propagate_error(task, &local_err)) {
         goto cleanup;
     } else {
+        if ((p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+            !qio_channel_has_feature(sioc,
+                                     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+            error_setg(&local_err, "multifd %u: the channel does not "
+                       "support zero-copy-send", p->id);
+            goto cleanup;
+        }
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
         p->running = true;
@@ -875,6 +1137,13 @@ int multifd_save_setup(Error **errp)
         return 0;
     }
     s = migrate_get_current();
+    if (migrate_use_zero_copy_send() &&
+        (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE ||
+         (s->parameters.tls_creds && *s->parameters.tls_creds))) {
+        error_setg(errp, "Zero-copy-send requires multifd-compression "
+                   "none and no TLS");
+        return -1;
+    }
     thread_count = migrate_multifd_channels();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
@@ -900,7 +1169,14 @@ int multifd_save_setup(Error **errp)
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
         p->tls_hostname = g_strdup(s->hostname);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (migrate_use_zero_copy_send()) {
+            p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+        }
+        if (migrate_fixed_ram()) {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -913,6 +1189,14 @@ int multifd_save_setup(Error **errp)
             error_propagate(errp, local_err);
             return ret;
         }
+        /* compressed packets can't carry XBZRLE pages */
+        if (migrate_use_xbzrle() &&
+            migrate_multifd_compression() == MULTIFD_COMPRESSION_NONE) {
+            ret = multifd_xbzrle_send_setup(p, errp);
+            if (ret) {
+                return ret;
+            }
+        }
     }
     return 0;
 }
@@ -967,10 +1251,12 @@ int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_fixed_ram()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
+    /* Wake up the threads that wait to place postcopy pages */
+    qemu_event_set(&migration_incoming_get_current()->postcopy_listen_event);
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
@@ -1007,6 +1293,10 @@ int multifd_load_cleanup(Error **errp)
         g_free(p->packet);
         p->packet = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
+        multifd_xbzrle_recv_cleanup(p);
+        g_free(p->postcopy_buf);
+        p->postcopy_buf = NULL;
+        p->postcopy_buf_len = 0;
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
@@ -1021,7 +1311,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_fixed_ram()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1044,6 +1334,98 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/**
+ * multifd_recv_postcopy_pages: receive and place the pages of a packet
+ * sent in postcopy
+ *
+ * The guest is already running and its RAM is registered with
+ * userfaultfd, so the pages can't be written in place.  They are
+ * received into a buffer of the channel, and each host page is placed
+ * atomically once all of its target pages have arrived, possibly
+ * through other channels.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages with data
+ * @zero_num: number of zero pages, after the used ones
+ * @errp: pointer to an error
+ */
+static int multifd_recv_postcopy_pages(MultiFDRecvParams *p, uint32_t used,
+                                       uint32_t zero_num, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    size_t page_size = qemu_target_page_size();
+    uint32_t i;
+    int ret;
+
+    if (p->flags & MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %d: XBZRLE pages received in postcopy",
+                   p->id);
+        return -1;
+    }
+
+    if (p->postcopy_buf_len < p->pages->allocated * page_size) {
+        g_free(p->postcopy_buf);
+        p->postcopy_buf_len = p->pages->allocated * page_size;
+        p->postcopy_buf = g_malloc(p->postcopy_buf_len);
+    }
+
+    for (i = 0; i < used + zero_num; i++) {
+        p->pages->iov[i].iov_base = p->postcopy_buf + i * page_size;
+    }
+    if (used) {
+        ret = multifd_recv_state->ops->recv_pages(p, used, errp);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    memset(p->postcopy_buf + used * page_size, 0, zero_num * page_size);
+
+    /* The source can switch to postcopy before we start listening */
+    qemu_event_wait(&mis->postcopy_listen_event);
+    if (p->quit) {
+        return 0;
+    }
+
+    for (i = 0; i < used + zero_num; i++) {
+        ret = postcopy_place_page_part(mis, p->pages->block,
+                                       p->pages->offset[i],
+                                       p->pages->iov[i].iov_base);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %d: failed to place the "
+                             "page at 0x" RAM_ADDR_FMT " of %s", p->id,
+                             p->pages->offset[i], p->pages->block->idstr);
+            return -1;
+        }
+    }
+    trace_multifd_recv_postcopy_pages(p->id, used, zero_num);
+
+    return 0;
+}
+
+/**
+ * multifd_recv_colo_backup: copy received pages into the COLO cache
+ *
+ * Before the COLO stage starts, the secondary keeps a copy of all
+ * the pages that it loads, like ram_load_precopy() does for the main
+ * stream, so that it doesn't have to copy the whole RAM when it
+ * enters the COLO stage.
+ *
+ * @p: Params for the channel that we are using
+ * @num: number of pages in the packet
+ */
+static void multifd_recv_colo_backup(MultiFDRecvParams *p, uint32_t num)
+{
+    RAMBlock *block = p->pages->block;
+    uint32_t i;
+
+    for (i = 0; i < num; i++) {
+        memcpy(block->colo_cache + p->pages->offset[i],
+               p->pages->iov[i].iov_base, p->pages->iov[i].iov_len);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1055,7 +1437,9 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t zero_num;
         uint32_t flags;
+        uint32_t i;
 
         if (p->quit) {
             break;
@@ -1078,20 +1462,43 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero_num = p->pages->zero_num;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, used, flags,
+        trace_multifd_recv(p->id, p->packet_num, used, zero_num, flags,
                            p->next_packet_size);
         p->num_packets++;
         p->num_pages += used;
+        p->num_zero_pages += zero_num;
         qemu_mutex_unlock(&p->mutex);
 
-        if (used) {
-            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+        if (flags & MULTIFD_FLAG_POSTCOPY) {
+            ret = multifd_recv_postcopy_pages(p, used, zero_num,
+                                              &local_err);
             if (ret != 0) {
                 break;
             }
+        } else {
+            if (used) {
+                ret = multifd_recv_state->ops->recv_pages(p, used,
+                                                          &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
+
+            /* zero pages have no data, they come after the used ones */
+            for (i = used; i < used + zero_num; i++) {
+                ram_handle_compressed(p->pages->iov[i].iov_base, 0,
+                                      p->pages->iov[i].iov_len);
+            }
+
+            if (migration_incoming_colo_enabled() &&
+                !migration_incoming_in_colo_state() &&
+                p->pages->block && p->pages->block->colo_cache) {
+                multifd_recv_colo_backup(p, used + zero_num);
+            }
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1109,7 +1516,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages,
+                                  p->num_zero_pages);
 
     return NULL;
 }
@@ -1120,7 +1528,8 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    /* with fixed-ram, ram_load() reads the pages with its own threads */
+    if (!migrate_use_multifd() || migrate_fixed_ram()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1162,7 +1571,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_fixed_ram()) {
         return true;
     }
 
@@ -1213,6 +1622,7 @@ bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     p->running = true;
     qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
                        QEMU_THREAD_JOINABLE);
+    qemu_thread_place(&p->thread, THREAD_PLACEMENT_ROLE_MULTIFD);
     qatomic_inc(&multifd_recv_state->count);
     return qatomic_read(&multifd_recv_state->count) ==
            migrate_multifd_channels();
@@ -32,6 +32,16 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_QATZIP (3 << 1)
+
+/* The payload starts with a bitmap of the pages sent uncompressed */
+#define MULTIFD_FLAG_RAW_BITMAP (1 << 4)
+
+/* The pages are XBZRLE encoded against the ones sent before */
+#define MULTIFD_FLAG_XBZRLE (1 << 5)
+
+/* The pages were sent in postcopy, they must be placed atomically */
+#define MULTIFD_FLAG_POSTCOPY (1 << 6)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -46,7 +56,10 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* number of zero pages, their offsets follow the used ones */
+    uint32_t zero_pages;
+    uint32_t unused32[1];  /* Reserved for future use */
+    uint64_t unused64[3];  /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -54,6 +67,8 @@ typedef struct {
 typedef struct {
     /* number of used pages */
     uint32_t used;
+    /* number of zero pages, stored after the used ones */
+    uint32_t zero_num;
     /* number of allocated pages */
     uint32_t allocated;
     /* global number of generated multifd packets */
@@ -77,6 +92,8 @@ typedef struct {
     QemuThread thread;
     /* communication channel */
     QIOChannel *c;
+    /* QIO_CHANNEL_WRITE_FLAG_* used to send the pages */
+    int write_flags;
     /* sem where to wait for more work */
     QemuSemaphore sem;
     /* this mutex protects the following parameters */
@@ -104,6 +121,18 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages found by this channel */
+    uint64_t num_zero_pages;
+    /* bytes sent and not yet accounted by the migration thread */
+    uint64_t pending_bytes;
+    /* zero pages found and not yet accounted by the migration thread */
+    uint64_t pending_zero_pages;
+    /* XBZRLE encode the pages of the current job */
+    bool xbzrle;
+    /* XBZRLE cache age of the pages of the current job */
+    uint64_t xbzrle_age;
+    /* used for XBZRLE encoding */
+    void *xbzrle_data;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -143,6 +172,14 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages received through this channel */
+    uint64_t num_zero_pages;
+    /* used for XBZRLE decoding */
+    void *xbzrle_data;
+    /* where the pages of postcopy packets are received */
+    uint8_t *postcopy_buf;
+    /* size of postcopy_buf */
+    size_t postcopy_buf_len;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
@@ -168,5 +205,18 @@ typedef struct {
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
 
+/* XBZRLE encoding, only available without compression */
+int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp);
+void multifd_xbzrle_send_cleanup(MultiFDSendParams *p);
+void multifd_xbzrle_send_zero_pages(MultiFDSendParams *p);
+int multifd_xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                                Error **errp);
+int multifd_xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                              Error **errp);
+void multifd_xbzrle_send_account(MultiFDSendParams *p);
+int multifd_xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                              Error **errp);
+void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p);
+
 #endif
 
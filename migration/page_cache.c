@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set-associative cache indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -14,6 +14,8 @@
 
 #include "qemu/osdep.h"
 
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
@@ -23,24 +25,43 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* number of pages that can share the same hash */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
     uint64_t it_age;
     uint8_t *it_data;
+    /* set on cache hits, cleared when the clock hand passes over */
+    bool it_ref;
 };
 
+/*
+ * Each set has its own lock, so that threads working on pages of
+ * different sets never wait for each other.
+ */
+typedef struct CacheSet {
+    QemuSpin lock;
+    /* next way to consider for replacement */
+    unsigned int hand;
+    CacheItem items[CACHE_WAYS];
+} CacheSet;
+
 struct PageCache {
-    CacheItem *page_cache;
+    struct rcu_head rcu;
+    CacheSet *sets;
     size_t page_size;
+    size_t num_sets;
+    size_t num_ways;
     size_t max_num_items;
     size_t num_items;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
 {
-    int64_t i;
+    int64_t i, j;
     size_t num_pages = new_size / page_size;
     PageCache *cache;
 
@@ -66,22 +87,30 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
     trace_migration_pagecache_init(cache->max_num_items);
 
     /* We prefer not to abort if there is no memory */
-    cache->page_cache = g_try_malloc((cache->max_num_items) *
-                                     sizeof(*cache->page_cache));
-    if (!cache->page_cache) {
+    cache->sets = g_try_malloc(cache->num_sets * sizeof(*cache->sets));
+    if (!cache->sets) {
         error_setg(errp, "Failed to allocate page cache");
         g_free(cache);
         return NULL;
     }
 
-    for (i = 0; i < cache->max_num_items; i++) {
-        cache->page_cache[i].it_data = NULL;
-        cache->page_cache[i].it_age = 0;
-        cache->page_cache[i].it_addr = -1;
+    for (i = 0; i < cache->num_sets; i++) {
+        CacheSet *set = &cache->sets[i];
+
+        qemu_spin_init(&set->lock);
+        set->hand = 0;
+        for (j = 0; j < CACHE_WAYS; j++) {
+            set->items[j].it_data = NULL;
+            set->items[j].it_age = 0;
+            set->items[j].it_addr = -1;
+            set->items[j].it_ref = false;
+        }
     }
 
     return cache;
@@ -89,42 +118,102 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
 
 void cache_fini(PageCache *cache)
 {
-    int64_t i;
+    int64_t i, j;
 
     g_assert(cache);
-    g_assert(cache->page_cache);
+    g_assert(cache->sets);
 
-    for (i = 0; i < cache->max_num_items; i++) {
-        g_free(cache->page_cache[i].it_data);
+    for (i = 0; i < cache->num_sets; i++) {
+        for (j = 0; j < cache->num_ways; j++) {
+            g_free(cache->sets[i].items[j].it_data);
+        }
+        qemu_spin_destroy(&cache->sets[i].lock);
     }
 
-    g_free(cache->page_cache);
-    cache->page_cache = NULL;
+    g_free(cache->sets);
+    cache->sets = NULL;
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+void cache_fini_rcu(PageCache *cache)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    call_rcu(cache, cache_fini, rcu);
 }
 
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+static CacheSet *cache_get_set(const PageCache *cache, uint64_t address)
 {
     size_t pos;
 
     g_assert(cache);
-    g_assert(cache->page_cache);
+    g_assert(cache->sets);
+
+    pos = (address / cache->page_size) & (cache->num_sets - 1);
+
+    return &cache->sets[pos];
+}
+
+void cache_lock(PageCache *cache, uint64_t addr)
+{
+    qemu_spin_lock(&cache_get_set(cache, addr)->lock);
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_spin_unlock(&cache_get_set(cache, addr)->lock);
+}
+
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheSet *set = cache_get_set(cache, addr);
+    size_t i;
 
-    pos = cache_get_cache_pos(cache, addr);
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set->items[i].it_addr == addr) {
+            return &set->items[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Pick the way that a new page replaces: a free one if there is any,
+ * otherwise the first page found by the clock hand that has not been
+ * hit since the hand last passed over it and is not fresh anymore.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr,
+                                   uint64_t current_age)
+{
+    CacheSet *set = cache_get_set(cache, addr);
+    CacheItem *it;
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (!set->items[i].it_data) {
+            return &set->items[i];
+        }
+    }
+
+    /* two rounds: the first one may only clear the reference bits */
+    for (i = 0; i < 2 * cache->num_ways; i++) {
+        it = &set->items[set->hand];
+        set->hand = (set->hand + 1) % cache->num_ways;
+
+        if (it->it_ref) {
+            it->it_ref = false;
+        } else if (it->it_age + CACHED_PAGE_LIFETIME <= current_age) {
+            return it;
+        }
+    }
 
-    return &cache->page_cache[pos];
+    /* all the cached pages are fresh, don't replace them */
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -134,9 +223,10 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
+        it->it_ref = true;
         return true;
     }
     return false;
@@ -150,12 +240,13 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    if (!it) {
+        it = cache_get_victim(cache, addr, current_age);
+        if (!it) {
+            return -1;
+        }
     }
+
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
@@ -163,13 +254,14 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             trace_migration_pagecache_insert();
             return -1;
         }
-        cache->num_items++;
+        qatomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
 
     it->it_age = current_age;
     it->it_addr = addr;
+    it->it_ref = false;
 
     return 0;
 }
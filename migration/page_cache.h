@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set-associative cache indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -15,7 +15,14 @@
 #ifndef PAGE_CACHE_H
 #define PAGE_CACHE_H
 
-/* Page cache for storing guest pages */
+/*
+ * Page cache for storing guest pages
+ *
+ * The cache may be used by several threads at the same time: all the
+ * accesses to a given address, including the use of the pointer
+ * returned by get_cached_data, must happen between cache_lock and
+ * cache_unlock for that address.
+ */
 typedef struct PageCache PageCache;
 
 /**
@@ -35,6 +42,31 @@ PageCache *cache_init(uint64_t cache_size, size_t page_size, Error **errp);
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_fini_rcu: free all cache resources after an RCU grace period
+ *
+ * For caches that are looked up from RCU read-side critical sections.
+ *
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
+/**
+ * cache_lock: lock the part of the cache that holds an address
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock: unlock the part of the cache locked by cache_lock
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
@@ -59,7 +91,9 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 
 /**
  * cache_insert: insert the page into the cache. the page cache
- * will dup the data on insert. the previous value will be overwritten
+ * will dup the data on insert. the previous value will be overwritten.
+ * When all the pages that the new one could replace have been used
+ * recently, the page is not inserted.
  *
  * Returns -1 when the page isn't inserted into cache
  *
@@ -29,6 +29,7 @@
 #include "qemu/rcu.h"
 #include "sysemu/sysemu.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "trace.h"
 #include "hw/boards.h"
 #include "exec/ramblock.h"
@@ -114,6 +115,22 @@ typedef struct PostcopyBlocktimeContext {
     Notifier exit_notifier;
 } PostcopyBlocktimeContext;
 
+/* A host page that the multifd channels are filling in postcopy */
+typedef struct PostcopyHostPage {
+    /* contents of the host page */
+    void *buf;
+    /* bytes of buf that have been filled */
+    size_t received;
+} PostcopyHostPage;
+
+static void postcopy_host_page_free(gpointer data)
+{
+    PostcopyHostPage *hp = data;
+
+    qemu_vfree(hp->buf);
+    g_free(hp);
+}
+
 static void destroy_blocktime_context(struct PostcopyBlocktimeContext *ctx)
 {
     g_free(ctx->page_fault_vcpu_time);
@@ -574,6 +591,12 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
         mis->postcopy_tmp_zero_page = NULL;
     }
+    WITH_QEMU_LOCK_GUARD(&mis->postcopy_host_pages_mutex) {
+        if (mis->postcopy_host_pages) {
+            g_hash_table_destroy(mis->postcopy_host_pages);
+            mis->postcopy_host_pages = NULL;
+        }
+    }
     trace_postcopy_ram_incoming_cleanup_blocktime(
             get_postcopy_total_blocktime());
 
@@ -690,10 +713,66 @@ int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                         qemu_ram_get_idstr(rb), rb_offset);
         return postcopy_wake_shared(pcfd, client_addr, rb);
     }
-    migrate_send_rp_req_pages(mis, rb, aligned_rbo, client_addr);
+    migrate_send_rp_req_pages(mis, rb, aligned_rbo, client_addr, pagesize);
     return 0;
 }
 
+/*
+ * Work out how many bytes to request for a fault at @offset of @rb.
+ *
+ * Faults that follow the previous request window (i.e. a guest that
+ * walks memory sequentially) double the number of pages requested past
+ * the faulting one, up to the postcopy-prefetch-pages parameter; any
+ * other fault resets the window.  A fault inside a window that is still
+ * in flight only asks for its own page, which the source will send
+ * first as an urgent page.  The request stops at the first page that
+ * has already been received and at the end of the RAMBlock.
+ * Note: Only for use by the fault thread
+ */
+static size_t postcopy_prefetch_len(MigrationIncomingState *mis,
+                                    RAMBlock *rb, ram_addr_t offset)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    uint32_t max_pages = migrate_postcopy_prefetch_pages();
+    ram_addr_t limit, end;
+
+    if (!max_pages) {
+        return pagesize;
+    }
+
+    if (rb == mis->prefetch_rb && offset >= mis->prefetch_start &&
+        offset < mis->prefetch_end) {
+        return pagesize;
+    }
+
+    if (rb == mis->prefetch_rb && offset >= mis->prefetch_end &&
+        offset < mis->prefetch_end +
+                 (ram_addr_t)MAX(mis->prefetch_window, 1) * pagesize) {
+        mis->prefetch_window = MIN(MAX(mis->prefetch_window * 2, 1),
+                                   max_pages);
+    } else {
+        mis->prefetch_window = 0;
+    }
+
+    /* The length goes into a 32 bit field of the request message */
+    limit = MIN(offset + ((ram_addr_t)mis->prefetch_window + 1) * pagesize,
+                offset + (UINT32_MAX & -pagesize));
+    limit = MIN(limit, rb->used_length);
+    for (end = offset + pagesize; end < limit; end += pagesize) {
+        if (ramblock_recv_bitmap_test_byte_offset(rb, end)) {
+            break;
+        }
+    }
+
+    mis->prefetch_rb = rb;
+    mis->prefetch_start = offset;
+    mis->prefetch_end = end;
+    trace_postcopy_prefetch(qemu_ram_get_idstr(rb), offset, end - offset,
+                            mis->prefetch_window);
+
+    return end - offset;
+}
+
 static int get_mem_fault_cpu_index(uint32_t pid)
 {
     CPUState *cpu_iter;
@@ -865,6 +944,8 @@ static void *postcopy_ram_fault_thread(void *opaque)
     trace_postcopy_ram_fault_thread_entry();
     rcu_register_thread();
     mis->last_rb = NULL; /* last RAMBlock we sent part of */
+    mis->prefetch_rb = NULL;
+    mis->prefetch_window = 0;
     qemu_sem_post(&mis->fault_thread_sem);
 
     struct pollfd *pfd;
@@ -888,6 +969,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
     while (true) {
         ram_addr_t rb_offset;
+        size_t len;
         int poll_result;
 
         /*
@@ -979,13 +1061,15 @@ static void *postcopy_ram_fault_thread(void *opaque)
                     (uintptr_t)(msg.arg.pagefault.address),
                                 msg.arg.pagefault.feat.ptid, rb);
 
+            len = postcopy_prefetch_len(mis, rb, rb_offset);
 retry:
             /*
              * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
+             * of our host page sizes (which is >= TPS), plus any pages
+             * that the prefetcher added
              */
             ret = migrate_send_rp_req_pages(mis, rb, rb_offset,
-                                            msg.arg.pagefault.address);
+                                            msg.arg.pagefault.address, len);
             if (ret) {
                 /* May be network failure, try to wait for recovery */
                 if (ret == -EIO && postcopy_pause_fault_thread(mis)) {
@@ -1128,6 +1212,14 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
     }
     memset(mis->postcopy_tmp_zero_page, '\0', mis->largest_page_size);
 
+    WITH_QEMU_LOCK_GUARD(&mis->postcopy_host_pages_mutex) {
+        mis->postcopy_host_pages =
+            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                  postcopy_host_page_free);
+    }
+    /* The multifd channels can place pages from now on */
+    qemu_event_set(&mis->postcopy_listen_event);
+
     trace_postcopy_ram_enable_notify();
 
     return 0;
@@ -1215,6 +1307,58 @@ int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from,
                                        qemu_ram_block_host_offset(rb, host));
 }
 
+int postcopy_place_page_part(MigrationIncomingState *mis, RAMBlock *rb,
+                             ram_addr_t offset, void *from)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    size_t tps = qemu_target_page_size();
+    void *host = rb->host + (offset & ~(pagesize - 1));
+    PostcopyHostPage *hp;
+    bool complete;
+    int ret;
+
+    if (pagesize == tps) {
+        return postcopy_place_page(mis, host, from, rb);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&mis->postcopy_host_pages_mutex) {
+        hp = g_hash_table_lookup(mis->postcopy_host_pages, host);
+        if (!hp) {
+            hp = g_new0(PostcopyHostPage, 1);
+            hp->buf = qemu_try_memalign(qemu_real_host_page_size, pagesize);
+            if (!hp->buf) {
+                g_free(hp);
+                error_report("%s: Failed to allocate a %zu bytes page",
+                             __func__, pagesize);
+                return -ENOMEM;
+            }
+            g_hash_table_insert(mis->postcopy_host_pages, host, hp);
+        }
+    }
+
+    /*
+     * Only the thread that completes the page frees it, and it can't
+     * do that before this part is accounted below.
+     */
+    memcpy(hp->buf + (offset & (pagesize - 1)), from, tps);
+
+    WITH_QEMU_LOCK_GUARD(&mis->postcopy_host_pages_mutex) {
+        hp->received += tps;
+        complete = hp->received == pagesize;
+        if (complete) {
+            g_hash_table_steal(mis->postcopy_host_pages, host);
+        }
+    }
+    if (!complete) {
+        return 0;
+    }
+
+    trace_postcopy_place_page_part(host, pagesize);
+    ret = postcopy_place_page(mis, host, hp->buf, rb);
+    postcopy_host_page_free(hp);
+    return ret;
+}
+
 /*
  * Place a zero page at (host) atomically
  * returns 0 on success
@@ -1301,6 +1445,13 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     return -1;
 }
 
+int postcopy_place_page_part(MigrationIncomingState *mis, RAMBlock *rb,
+                             ram_addr_t offset, void *from)
+{
+    assert(0);
+    return -1;
+}
+
 int postcopy_wake_shared(struct PostCopyFD *pcfd,
                          uint64_t client_addr,
                          RAMBlock *rb)
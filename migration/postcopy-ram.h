@@ -78,6 +78,16 @@ int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from,
 int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
                              RAMBlock *rb);
 
+/*
+ * Copy one target page (from) received for (offset) of (rb), and place
+ * its whole host page once all of the target pages are there.  Can be
+ * called from several threads at once, as long as each target page is
+ * only given once.
+ * returns 0 on success
+ */
+int postcopy_place_page_part(MigrationIncomingState *mis, RAMBlock *rb,
+                             ram_addr_t offset, void *from);
+
 /* The current postcopy state is read/set by postcopy_state_get/set
  * which update it atomically.
  * The state is updated as postcopy messages are received, and
@@ -156,6 +156,16 @@ static int channel_set_blocking(void *opaque,
     return 0;
 }
 
+static int channel_seek(void *opaque, int64_t offset, Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (qio_channel_io_seek(ioc, offset, SEEK_SET, errp) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
 static QEMUFile *channel_get_input_return_path(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -176,6 +186,7 @@ static const QEMUFileOps channel_input_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .seek = channel_seek,
 };
 
 
@@ -185,6 +196,7 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .seek = channel_seek,
 };
 
 
@@ -662,6 +662,43 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Continue the stream at @offset of the backing file, skipping a region
+ * that is accessed out of band, e.g. the RAM of a fixed-ram migration.
+ * Buffered input is discarded.
+ *
+ * Returns 0 on success, -err on error
+ */
+int qemu_file_seek(QEMUFile *f, int64_t offset)
+{
+    Error *local_error = NULL;
+    int ret;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return -ENOTSUP;
+    }
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        ret = qemu_file_get_error(f);
+        if (ret) {
+            return ret;
+        }
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = f->ops->seek(f->opaque, offset, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+        return ret;
+    }
+    f->pos = offset;
+    return 0;
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->shutdown) {
@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
@@ -51,15 +52,25 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
+#include "hw/core/cpu.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "file.h"
 #include "sysemu/runstate.h"
+#include "sysemu/stats.h"
 
 #if defined(__linux__)
+#include <poll.h>
+#include "qemu/event_notifier.h"
 #include "qemu/userfaultfd.h"
 #endif /* defined(__linux__) */
 
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+#include <linux/falloc.h>
+#endif
+
 /***********************************************************/
 /* ram save/restore */
 
@@ -93,7 +104,11 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /*
+     * Cache for XBZRLE, Protected by lock.  The multifd channels don't
+     * take the lock: they access the cache within RCU critical sections
+     * and the lock of each page is in the cache itself.
+     */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -131,7 +146,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(uint64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -155,8 +170,9 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        old_cache = XBZRLE.cache;
+        qatomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_fini_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -169,6 +185,15 @@ bool ramblock_is_ignored(RAMBlock *block)
            (migrate_ignore_shared() && qemu_ram_is_shared(block));
 }
 
+/*
+ * With file-backed-ram, the pages of blocks that map a file are written
+ * to that file rather than to the migration stream.
+ */
+static bool ramblock_is_file_backed(RAMBlock *block)
+{
+    return migrate_file_backed_ram() && block->fd >= 0;
+}
+
 #undef RAMBLOCK_FOREACH
 
 int foreach_not_ignored_block(RAMBlockIterFunc func, void *opaque)
@@ -303,6 +328,8 @@ struct RAMState {
     QEMUFile *f;
     /* UFFD file descriptor, used in 'write-tracking' migration */
     int uffdio_fd;
+    /* Migration file, used for the pages and bitmaps of fixed-ram */
+    int fixed_ram_fd;
     /* Last block that we have visited searching for dirty pages */
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
@@ -397,6 +424,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* The destination asked for this page */
+    bool         postcopy_requested;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -659,8 +688,44 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
+    cache_lock(XBZRLE.cache, current_addr);
     cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
                  ram_counters.dirty_sync_count);
+    cache_unlock(XBZRLE.cache, current_addr);
+}
+
+/**
+ * xbzrle_cache_get_rcu: get the XBZRLE cache for the multifd channels
+ *
+ * Returns the cache, or NULL if XBZRLE is not in use anymore.  It
+ * stays valid until the end of the RCU critical section.
+ */
+PageCache *xbzrle_cache_get_rcu(void)
+{
+    return qatomic_rcu_read(&XBZRLE.cache);
+}
+
+/**
+ * ram_xbzrle_multifd_age: check if the multifd pages use XBZRLE
+ *
+ * Like ram_save_page, multifd only uses XBZRLE once the first round
+ * over the RAM is done and never in postcopy.
+ *
+ * Returns true and the current cache age in @age if the pages queued
+ * now must be XBZRLE encoded by the channels.
+ *
+ * @age: where to store the current cache age
+ */
+bool ram_xbzrle_multifd_age(uint64_t *age)
+{
+    RAMState *rs = ram_state;
+
+    if (!migrate_use_xbzrle() || !rs || !rs->xbzrle_enabled ||
+        migration_in_postcopy()) {
+        return false;
+    }
+    *age = ram_counters.dirty_sync_count;
+    return true;
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -686,19 +751,23 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
 
+    /*
+     * Only the migration thread uses XBZRLE without multifd, so the
+     * cached page can be used after unlocking it.
+     */
+    cache_lock(XBZRLE.cache, current_addr);
     if (!cache_is_cached(XBZRLE.cache, current_addr,
                          ram_counters.dirty_sync_count)) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
             if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
-                return -1;
-            } else {
+                             ram_counters.dirty_sync_count) == 0) {
                 /* update *current_data when the page has been
                    inserted into cache */
                 *current_data = get_cached_data(XBZRLE.cache, current_addr);
             }
         }
+        cache_unlock(XBZRLE.cache, current_addr);
         return -1;
     }
 
@@ -715,6 +784,7 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
      */
     xbzrle_counters.pages++;
     prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    cache_unlock(XBZRLE.cache, current_addr);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -789,22 +859,10 @@ unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     return find_next_bit(bitmap, size, start);
 }
 
-static inline bool migration_bitmap_clear_dirty(RAMState *rs,
-                                                RAMBlock *rb,
-                                                unsigned long page)
+/* Called with bitmap_mutex held */
+static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
+                                                       unsigned long page)
 {
-    bool ret;
-
-    QEMU_LOCK_GUARD(&rs->bitmap_mutex);
-
-    /*
-     * Clear dirty bitmap if needed.  This _must_ be called before we
-     * send any of the page in the chunk because we need to make sure
-     * we can capture further page content changes when we sync dirty
-     * log the next time.  So as long as we are going to send any of
-     * the page in the chunk we clear the remote dirty bitmap for all.
-     * Clearing it earlier won't be a problem, but too late will.
-     */
     if (rb->clear_bmap && clear_bmap_test_and_clear(rb, page)) {
         uint8_t shift = rb->clear_bmap_shift;
         hwaddr size = 1ULL << (TARGET_PAGE_BITS + shift);
@@ -822,6 +880,43 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
         trace_migration_bitmap_clear_dirty(rb->idstr, start, size, page);
         memory_region_clear_dirty_bitmap(rb->mr, start, size);
     }
+}
+
+/* Called with bitmap_mutex held */
+static void migration_clear_memory_region_dirty_bitmap_range(RAMBlock *rb,
+                                                     unsigned long start,
+                                                     unsigned long npages)
+{
+    unsigned long chunk_pages = 1UL << rb->clear_bmap_shift;
+    unsigned long page = QEMU_ALIGN_DOWN(start, chunk_pages);
+
+    if (!rb->clear_bmap) {
+        return;
+    }
+
+    /* Clear the remote dirty bitmap of every chunk the range touches */
+    for (; page < start + npages; page += chunk_pages) {
+        migration_clear_memory_region_dirty_bitmap(rb, page);
+    }
+}
+
+static inline bool migration_bitmap_clear_dirty(RAMState *rs,
+                                                RAMBlock *rb,
+                                                unsigned long page)
+{
+    bool ret;
+
+    QEMU_LOCK_GUARD(&rs->bitmap_mutex);
+
+    /*
+     * Clear dirty bitmap if needed.  This _must_ be called before we
+     * send any of the page in the chunk because we need to make sure
+     * we can capture further page content changes when we sync dirty
+     * log the next time.  So as long as we are going to send any of
+     * the page in the chunk we clear the remote dirty bitmap for all.
+     * Clearing it earlier won't be a problem, but too late will.
+     */
+    migration_clear_memory_region_dirty_bitmap(rb, page);
 
     ret = test_and_clear_bit(page, rb->bmap);
 
@@ -842,6 +937,134 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Big RAMBlocks are synced in ranges of this size (in bytes) by a pool
+ * of threads.  It must be a multiple of BITS_PER_LONG pages so that
+ * two ranges never share a word of the bitmaps.
+ */
+#define DIRTY_SYNC_SHARD_SIZE (16 * GiB)
+#define DIRTY_SYNC_MAX_THREADS 8
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t num_dirty;
+} DirtySyncShard;
+
+typedef struct {
+    DirtySyncShard *shards;
+    int num_shards;
+    /* next shard to sync, accessed atomically */
+    int next;
+} DirtySyncJob;
+
+static void dirty_sync_run(DirtySyncJob *job)
+{
+    int i;
+
+    while ((i = qatomic_fetch_inc(&job->next)) < job->num_shards) {
+        DirtySyncShard *shard = &job->shards[i];
+
+        shard->num_dirty = cpu_physical_memory_sync_dirty_bitmap(
+            shard->block, shard->start, shard->length);
+    }
+}
+
+static void *dirty_sync_thread(void *opaque)
+{
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        dirty_sync_run(opaque);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static bool ramblock_sync_can_shard(RAMBlock *rb)
+{
+    /* shards must be aligned to the words of the global dirty bitmap */
+    return rb->clear_bmap && rb->used_length > DIRTY_SYNC_SHARD_SIZE &&
+           !((rb->offset >> TARGET_PAGE_BITS) % BITS_PER_LONG) &&
+           !((rb->used_length >> TARGET_PAGE_BITS) % BITS_PER_LONG);
+}
+
+/**
+ * migration_bitmap_sync_ramblocks: sync the dirty bitmap of all RAMBlocks
+ *
+ * Small RAMBlocks are synced by the caller, big ones are split in
+ * ranges that are synced in parallel by a pool of threads.
+ *
+ * Called with RCU critical section and bitmap_mutex held.
+ *
+ * @rs: current RAM state
+ */
+static void migration_bitmap_sync_ramblocks(RAMState *rs)
+{
+    DirtySyncJob job = {};
+    QemuThread *threads;
+    int num_threads;
+    long host_procs;
+    RAMBlock *block;
+    int i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (ramblock_sync_can_shard(block)) {
+            job.num_shards += DIV_ROUND_UP(block->used_length,
+                                           DIRTY_SYNC_SHARD_SIZE);
+        } else {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+    }
+    if (!job.num_shards) {
+        return;
+    }
+
+    job.shards = g_new0(DirtySyncShard, job.num_shards);
+    i = 0;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        if (!ramblock_sync_can_shard(block)) {
+            continue;
+        }
+        for (start = 0; start < block->used_length;
+             start += DIRTY_SYNC_SHARD_SIZE) {
+            job.shards[i].block = block;
+            job.shards[i].start = start;
+            job.shards[i].length = MIN(DIRTY_SYNC_SHARD_SIZE,
+                                       block->used_length - start);
+            i++;
+        }
+    }
+
+    host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = MIN(job.num_shards, DIRTY_SYNC_MAX_THREADS);
+    if (host_procs > 0) {
+        num_threads = MIN(num_threads, host_procs);
+    }
+
+    /* the migration thread is one of the workers */
+    threads = g_new0(QemuThread, num_threads);
+    for (i = 1; i < num_threads; i++) {
+        qemu_thread_create(&threads[i], "mig/dirty-sync", dirty_sync_thread,
+                           &job, QEMU_THREAD_JOINABLE);
+    }
+    dirty_sync_run(&job);
+    for (i = 1; i < num_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (i = 0; i < job.num_shards; i++) {
+        rs->migration_dirty_pages += job.shards[i].num_dirty;
+        rs->num_dirty_pages_period += job.shards[i].num_dirty;
+    }
+    trace_migration_bitmap_sync_parallel(job.num_shards, num_threads);
+
+    g_free(threads);
+    g_free(job.shards);
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -921,6 +1144,57 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 }
 
+/**
+ * mig_throttle_update_exempt: choose the vCPUs that escape the throttle
+ *
+ * Each vCPU gets an equal share of the dirty pages allowed in the last
+ * period by throttle-trigger-threshold.  The vCPUs that stayed below
+ * their share are exempted from the throttle, so that only the ones
+ * dirtying memory quickly are slowed down.  Without the per-vCPU
+ * counters of the KVM dirty ring, no vCPU is exempted.
+ *
+ * Called with the iothread lock held.
+ *
+ * @bytes_dirty_threshold: number of dirty bytes allowed in the period
+ */
+static void mig_throttle_update_exempt(uint64_t bytes_dirty_threshold)
+{
+    MigrationState *s = migrate_get_current();
+    bool per_vcpu = s->parameters.cpu_throttle_per_vcpu &&
+                    kvm_dirty_ring_enabled();
+    uint64_t quota, dirty;
+    unsigned int nr_cpus = 0;
+    unsigned int nr_exempt = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+    quota = bytes_dirty_threshold / TARGET_PAGE_SIZE / MAX(nr_cpus, 1);
+
+    CPU_FOREACH(cpu) {
+        bool exempt = false;
+
+        dirty = cpu->dirty_pages - cpu->throttle_dirty_pages;
+        cpu->throttle_dirty_pages = cpu->dirty_pages;
+        if (per_vcpu && dirty <= quota) {
+            exempt = true;
+            nr_exempt++;
+        }
+        cpu_throttle_set_exempt(cpu, exempt);
+        trace_migration_throttle_vcpu(cpu->cpu_index, dirty, quota, exempt);
+    }
+    if (per_vcpu && nr_exempt == nr_cpus) {
+        /*
+         * Every vCPU is within its share but the guest as a whole still
+         * dirties memory too fast: fall back to throttling all of them.
+         */
+        CPU_FOREACH(cpu) {
+            cpu_throttle_set_exempt(cpu, false);
+        }
+    }
+}
+
 static void migration_trigger_throttle(RAMState *rs)
 {
     MigrationState *s = migrate_get_current();
@@ -947,12 +1221,14 @@ static void migration_trigger_throttle(RAMState *rs)
             mig_throttle_guest_down(bytes_dirty_period,
                                     bytes_dirty_threshold);
         }
+        if (cpu_throttle_active()) {
+            mig_throttle_update_exempt(bytes_dirty_threshold);
+        }
     }
 }
 
 static void migration_bitmap_sync(RAMState *rs)
 {
-    RAMBlock *block;
     int64_t end_time;
 
     ram_counters.dirty_sync_count++;
@@ -966,9 +1242,7 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
-        }
+        migration_bitmap_sync_ramblocks(rs);
         ram_counters.remaining = ram_bytes_remaining();
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
@@ -1418,37 +1692,357 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
-#if defined(__linux__)
+#if defined(__linux__)
+/* Number of threads that handle the write faults of background snapshots */
+#define RAM_WT_FAULT_THREADS 4
+/* Number of host pages that they can copy before the copies are saved */
+#define RAM_WT_COPY_BUFFERS 1024
+
+typedef struct RAMFaultPage {
+    RAMBlock *block;
+    /* offset of the host page in the block */
+    ram_addr_t offset;
+    /* copy of the host page taken before unprotecting it */
+    uint8_t *buf;
+    QSIMPLEQ_ENTRY(RAMFaultPage) next;
+} RAMFaultPage;
+
+/*
+ * Write faults are handled by dedicated threads rather than by the
+ * migration thread, so that the vCPUs do not wait behind the bulk
+ * saving.  A fault thread copies the faulting page, which is still
+ * write-protected, to a buffer, clears it from the dirty bitmap and
+ * releases the protection right away; the migration thread saves the
+ * copy later.  A page whose saving by the migration thread (or by a
+ * multifd channel) is already under way is released by whoever saves
+ * it; so are faults that find no free buffer, which are queued like
+ * the faults of the old single-threaded scheme.
+ */
+static struct {
+    bool running;
+    QemuThread threads[RAM_WT_FAULT_THREADS];
+    EventNotifier quit;
+    /* Protects the rest of the fields */
+    QemuMutex lock;
+    /* Copied pages, to be saved from their buffer */
+    QSIMPLEQ_HEAD(, RAMFaultPage) copies;
+    /* Faults to be saved from guest memory and then released */
+    QSIMPLEQ_HEAD(, RAMFaultPage) faults;
+    uint8_t *pool;
+    uint8_t *free_buffers[RAM_WT_COPY_BUFFERS];
+    unsigned int nr_free;
+} ram_wt;
+
+static uint8_t *ram_wt_get_buffer(void)
+{
+    QEMU_LOCK_GUARD(&ram_wt.lock);
+    return ram_wt.nr_free ? ram_wt.free_buffers[--ram_wt.nr_free] : NULL;
+}
+
+static void ram_wt_put_buffer(uint8_t *buf)
+{
+    QEMU_LOCK_GUARD(&ram_wt.lock);
+    ram_wt.free_buffers[ram_wt.nr_free++] = buf;
+}
+
+static void ram_wt_handle_fault(RAMState *rs, void *host)
+{
+    size_t page_size = qemu_real_host_page_size;
+    unsigned long npages = page_size >> TARGET_PAGE_BITS;
+    unsigned long start;
+    RAMFaultPage *fp;
+    RAMBlock *block;
+    ram_addr_t offset;
+
+    host = QEMU_ALIGN_PTR_DOWN(host, page_size);
+    block = qemu_ram_block_from_host(host, false, &offset);
+    assert(block && (block->flags & RAM_UF_WRITEPROTECT) != 0);
+
+    if (offset >= block->used_length) {
+        /* Not part of the snapshot */
+        uffd_change_protection(rs->uffdio_fd, host, page_size, false, false);
+        return;
+    }
+
+    start = offset >> TARGET_PAGE_BITS;
+    fp = g_new0(RAMFaultPage, 1);
+    fp->block = block;
+    fp->offset = offset;
+    if (block->page_size == page_size) {
+        fp->buf = ram_wt_get_buffer();
+    }
+
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    if (find_next_zero_bit(block->bmap, start + npages, start) <
+        start + npages) {
+        /* Already being saved, the saver releases the protection */
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+        trace_ram_write_tracking_fault(block->idstr, offset, "saving");
+        if (fp->buf) {
+            ram_wt_put_buffer(fp->buf);
+        }
+        g_free(fp);
+        return;
+    }
+
+    if (!fp->buf) {
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+        trace_ram_write_tracking_fault(block->idstr, offset, "queued");
+        WITH_QEMU_LOCK_GUARD(&ram_wt.lock) {
+            QSIMPLEQ_INSERT_TAIL(&ram_wt.faults, fp, next);
+        }
+        return;
+    }
+
+    memcpy(fp->buf, host, page_size);
+    WITH_QEMU_LOCK_GUARD(&ram_wt.lock) {
+        QSIMPLEQ_INSERT_TAIL(&ram_wt.copies, fp, next);
+    }
+    /*
+     * Queue the copy before clearing the bits, see the end of
+     * ram_find_and_save_block().
+     */
+    smp_wmb();
+    bitmap_clear(block->bmap, start, npages);
+    rs->migration_dirty_pages -= npages;
+    qemu_mutex_unlock(&rs->bitmap_mutex);
+
+    trace_ram_write_tracking_fault(block->idstr, offset, "copied");
+    uffd_change_protection(rs->uffdio_fd, host, page_size, false, false);
+}
+
+static void *ram_wt_fault_thread(void *opaque)
+{
+    RAMState *rs = opaque;
+    struct pollfd pfd[2] = {
+        { .fd = rs->uffdio_fd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&ram_wt.quit), .events = POLLIN },
+    };
+
+    rcu_register_thread();
+
+    while (true) {
+        struct uffd_msg uffd_msg;
+
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+        /* Another fault thread may have read the event */
+        if (uffd_read_events(rs->uffdio_fd, &uffd_msg, 1) <= 0) {
+            continue;
+        }
+        if (uffd_msg.event == UFFD_EVENT_PAGEFAULT) {
+            ram_wt_handle_fault(rs,
+                (void *)(uintptr_t) uffd_msg.arg.pagefault.address);
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void ram_wt_threads_start(RAMState *rs)
+{
+    size_t page_size = qemu_real_host_page_size;
+    int i;
+
+    qemu_mutex_init(&ram_wt.lock);
+    QSIMPLEQ_INIT(&ram_wt.copies);
+    QSIMPLEQ_INIT(&ram_wt.faults);
+    event_notifier_init(&ram_wt.quit, false);
+    ram_wt.pool = qemu_memalign(page_size, RAM_WT_COPY_BUFFERS * page_size);
+    for (i = 0; i < RAM_WT_COPY_BUFFERS; i++) {
+        ram_wt.free_buffers[i] = ram_wt.pool + i * page_size;
+    }
+    ram_wt.nr_free = RAM_WT_COPY_BUFFERS;
+
+    for (i = 0; i < RAM_WT_FAULT_THREADS; i++) {
+        qemu_thread_create(&ram_wt.threads[i], "bg_snapshot_wp",
+                           ram_wt_fault_thread, rs, QEMU_THREAD_JOINABLE);
+    }
+    ram_wt.running = true;
+}
+
+static void ram_wt_threads_stop(void)
+{
+    RAMFaultPage *fp, *next;
+    int i;
+
+    if (!ram_wt.running) {
+        return;
+    }
+    ram_wt.running = false;
+
+    event_notifier_set(&ram_wt.quit);
+    for (i = 0; i < RAM_WT_FAULT_THREADS; i++) {
+        qemu_thread_join(&ram_wt.threads[i]);
+    }
+    event_notifier_cleanup(&ram_wt.quit);
+
+    /* Left over if the snapshot failed; the faults are woken up anyway */
+    QSIMPLEQ_FOREACH_SAFE(fp, &ram_wt.copies, next, next) {
+        g_free(fp);
+    }
+    QSIMPLEQ_FOREACH_SAFE(fp, &ram_wt.faults, next, next) {
+        g_free(fp);
+    }
+    qemu_vfree(ram_wt.pool);
+    ram_wt.pool = NULL;
+    qemu_mutex_destroy(&ram_wt.lock);
+}
+
+/**
+ * poll_fault_page: get the next write fault that the fault threads
+ *   could not copy and, if one is pending, return RAM block pointer and
+ *   page offset
+ *
+ * Returns pointer to the RAMBlock containing faulting page,
+ *   NULL if no write faults are pending
+ *
+ * @rs: current RAM state
+ * @offset: page offset from the beginning of the block
+ */
+static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
+{
+    RAMFaultPage *fp;
+    RAMBlock *block;
+
+    if (!ram_wt.running || QSIMPLEQ_EMPTY_ATOMIC(&ram_wt.faults)) {
+        return NULL;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&ram_wt.lock) {
+        fp = QSIMPLEQ_FIRST(&ram_wt.faults);
+        if (fp) {
+            QSIMPLEQ_REMOVE_HEAD(&ram_wt.faults, next);
+        }
+    }
+    if (!fp) {
+        return NULL;
+    }
+
+    block = fp->block;
+    *offset = fp->offset;
+    g_free(fp);
+    return block;
+}
+
+/*
+ * Save the copy of a host page taken by a fault thread.  Returns the
+ * number of pages written, or negative on error.
+ */
+static int ram_save_copied_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset, uint8_t *buf)
+{
+    size_t len = qemu_real_host_page_size;
+    Error *local_err = NULL;
+    ram_addr_t off;
+
+    for (off = 0; off < len; off += TARGET_PAGE_SIZE) {
+        uint8_t *p = buf + off;
+        unsigned long page = (offset + off) >> TARGET_PAGE_BITS;
+        bool zero = buffer_is_zero(p, TARGET_PAGE_SIZE);
+
+        if (migrate_fixed_ram()) {
+            if (zero) {
+                clear_bit_atomic(page, block->file_bmap);
+                ram_counters.duplicate++;
+                continue;
+            }
+            if (file_pwrite_all(rs->fixed_ram_fd, p, TARGET_PAGE_SIZE,
+                                block->pages_offset + offset + off,
+                                &local_err) < 0) {
+                error_report_err(local_err);
+                return -EIO;
+            }
+            set_bit_atomic(page, block->file_bmap);
+            ram_counters.transferred += TARGET_PAGE_SIZE;
+            ram_counters.normal++;
+        } else if (zero) {
+            ram_counters.transferred +=
+                save_page_header(rs, rs->f, block,
+                                 (offset + off) | RAM_SAVE_FLAG_ZERO);
+            qemu_put_byte(rs->f, 0);
+            ram_counters.transferred += 1;
+            ram_counters.duplicate++;
+        } else {
+            save_normal_page(rs, block, offset + off, p, false);
+        }
+    }
+    return len >> TARGET_PAGE_BITS;
+}
+
+/**
+ * ram_save_fault_copies: save the pages copied by the fault threads
+ *
+ * Returns the number of pages written, or negative on error
+ *
+ * @rs: current RAM state
+ */
+static int ram_save_fault_copies(RAMState *rs)
+{
+    int pages = 0;
+
+    if (!ram_wt.running) {
+        return 0;
+    }
+
+    /* Only the migration thread removes copies */
+    while (!QSIMPLEQ_EMPTY_ATOMIC(&ram_wt.copies)) {
+        RAMFaultPage *fp;
+        int ret;
+
+        WITH_QEMU_LOCK_GUARD(&ram_wt.lock) {
+            fp = QSIMPLEQ_FIRST(&ram_wt.copies);
+            QSIMPLEQ_REMOVE_HEAD(&ram_wt.copies, next);
+        }
+        ret = ram_save_copied_page(rs, fp->block, fp->offset, fp->buf);
+        ram_wt_put_buffer(fp->buf);
+        g_free(fp);
+        if (ret < 0) {
+            return ret;
+        }
+        pages += ret;
+    }
+    return pages;
+}
+
 /**
- * poll_fault_page: try to get next UFFD write fault page and, if pending fault
- *   is found, return RAM block pointer and page offset
+ * ram_write_tracking_release: release UFFD write protection of pages
+ *   that a multifd channel has saved
  *
- * Returns pointer to the RAMBlock containing faulting page,
- *   NULL if no write faults are pending
+ * Returns 0 on success, negative value in case of an error
  *
- * @rs: current RAM state
- * @offset: page offset from the beginning of the block
+ * @block: block that contains the pages
+ * @offsets: offsets of the pages inside the block
+ * @n: number of pages
  */
-static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
+int ram_write_tracking_release(RAMBlock *block, const ram_addr_t *offsets,
+                               uint32_t n)
 {
-    struct uffd_msg uffd_msg;
-    void *page_address;
-    RAMBlock *block;
-    int res;
+    RAMState *rs = ram_state;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i, j;
 
-    if (!migrate_background_snapshot()) {
-        return NULL;
+    if (!(block->flags & RAM_UF_WRITEPROTECT)) {
+        return 0;
     }
 
-    res = uffd_read_events(rs->uffdio_fd, &uffd_msg, 1);
-    if (res <= 0) {
-        return NULL;
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n; j++) {
+            if (offsets[j] != offsets[j - 1] + page_size) {
+                break;
+            }
+        }
+        if (uffd_change_protection(rs->uffdio_fd, block->host + offsets[i],
+                                   (j - i) * page_size, false, false)) {
+            return -1;
+        }
     }
-
-    page_address = (void *)(uintptr_t) uffd_msg.arg.pagefault.address;
-    block = qemu_ram_block_from_host(page_address, false, offset);
-    assert(block && (block->flags & RAM_UF_WRITEPROTECT) != 0);
-    return block;
+    return 0;
 }
 
 /**
@@ -1466,6 +2060,11 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
 {
     int res = 0;
 
+    /* The multifd channels release the pages that they save */
+    if (migrate_use_multifd() && !ramblock_is_file_backed(pss->block)) {
+        return 0;
+    }
+
     /* Check if page is from UFFD-managed region. */
     if (pss->block->flags & RAM_UF_WRITEPROTECT) {
         void *page_address = pss->block->host + (start_page << TARGET_PAGE_BITS);
@@ -1630,6 +2229,7 @@ int ram_write_tracking_start(void)
                 block->host, block->max_length);
     }
 
+    ram_wt_threads_start(rs);
     return 0;
 
 fail:
@@ -1664,6 +2264,8 @@ void ram_write_tracking_stop(void)
     RAMState *rs = ram_state;
     RAMBlock *block;
 
+    ram_wt_threads_stop();
+
     RCU_READ_LOCK_GUARD();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -1709,6 +2311,17 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
     return 0;
 }
 
+static int ram_save_fault_copies(RAMState *rs)
+{
+    return 0;
+}
+
+int ram_write_tracking_release(RAMBlock *block, const ram_addr_t *offsets,
+                               uint32_t n)
+{
+    return 0;
+}
+
 bool ram_write_tracking_available(void)
 {
     return false;
@@ -1937,6 +2550,181 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
     return false;
 }
 
+/**
+ * ram_save_file_page: write a page to the file of its RAMBlock
+ *
+ * Returns the number of pages written, or negative on error
+ *
+ * A shared mapping already is the file, so there is nothing to write.
+ * Zero pages become holes in the file.  This is safe while the guest
+ * runs: if the guest writes a page after it was found to be zero, the
+ * private mapping gets its own copy of the page, which the hole does
+ * not affect, and the write is dirtied and saved again later.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_file_page(RAMState *rs, RAMBlock *block,
+                              ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    off_t file_offset = block->fd_offset + offset;
+    ssize_t ret;
+
+    if (qemu_ram_is_shared(block)) {
+        ram_counters.normal++;
+        return 1;
+    }
+
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+        if (!fallocate(block->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       file_offset, TARGET_PAGE_SIZE)) {
+            ram_counters.duplicate++;
+            return 1;
+        }
+#endif
+    }
+
+    do {
+        ret = pwrite(block->fd, p, TARGET_PAGE_SIZE, file_offset);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != TARGET_PAGE_SIZE) {
+        int err = ret < 0 ? -errno : -EIO;
+
+        error_report("%s: cannot write page 0x" RAM_ADDR_FMT " of block %s "
+                     "to its file: %s", __func__, offset, block->idstr,
+                     strerror(-err));
+        return err;
+    }
+    ram_counters.normal++;
+    return 1;
+}
+
+/* Make sure the pages written by ram_save_file_page() are on disk */
+static int ram_sync_file_backed_blocks(void)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (ramblock_is_file_backed(block) && qemu_fdatasync(block->fd)) {
+            error_report("%s: cannot sync the file of block %s: %s",
+                         __func__, block->idstr, strerror(errno));
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+/* With fixed-ram, the pages of each block start on such a boundary */
+#define FIXED_RAM_PAGES_ALIGN (1 * MiB)
+
+/* Size of the bitmap of a block in the file, a whole number of be64 */
+static size_t fixed_ram_bitmap_size(ram_addr_t length)
+{
+    return DIV_ROUND_UP(length >> TARGET_PAGE_BITS, 64) * sizeof(uint64_t);
+}
+
+/**
+ * ram_save_fixed_ram_setup: lay out the region of a block in the file
+ *
+ * Returns zero for success or negative on error
+ *
+ * With fixed-ram, each page of the block has a fixed place in the
+ * file, so the pages can be written in any order and any number of
+ * times, by any number of threads.  The region of the block, right
+ * after its record in the stream, holds the bitmap of the pages that
+ * the file holds, then the pages.  The stream continues after it.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block to lay out
+ */
+static int ram_save_fixed_ram_setup(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    int64_t pos = qemu_ftell(f) + 2 * sizeof(uint64_t);
+
+    block->bitmap_offset = ROUND_UP(pos, qemu_target_page_size());
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   fixed_ram_bitmap_size(block->used_length),
+                                   FIXED_RAM_PAGES_ALIGN);
+    block->file_bmap = bitmap_new(pages);
+
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+    return qemu_file_seek(f, block->pages_offset + block->used_length);
+}
+
+/**
+ * ram_save_fixed_ram_page: write one page at its place in the file
+ *
+ * Returns the number of pages written, or negative on error
+ *
+ * Zero pages are not written, their bit in the bitmap of the block is
+ * cleared instead, in case the file holds an older version of them.
+ * When multifd is used, the channels do this themselves.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_fixed_ram_page(RAMState *rs, RAMBlock *block,
+                                   ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    Error *local_err = NULL;
+    int ret;
+
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    ret = file_pwrite_all(rs->fixed_ram_fd, p, TARGET_PAGE_SIZE,
+                          block->pages_offset + offset, &local_err);
+    if (ret < 0) {
+        error_report_err(local_err);
+        return ret;
+    }
+    set_bit(page, block->file_bmap);
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
+/* Write the bitmaps of the blocks and make sure that the file is on disk */
+static int ram_save_fixed_ram_finish(RAMState *rs)
+{
+    RAMBlock *block;
+    Error *local_err = NULL;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t size = fixed_ram_bitmap_size(block->used_length);
+        g_autofree unsigned long *le = g_malloc0(size);
+        int ret;
+
+        bitmap_to_le(le, block->file_bmap, pages);
+        ret = file_pwrite_all(rs->fixed_ram_fd, le, size,
+                              block->bitmap_offset, &local_err);
+        if (ret < 0) {
+            error_report_err(local_err);
+            return ret;
+        }
+    }
+
+    if (qemu_fdatasync(rs->fixed_ram_fd)) {
+        error_report("%s: cannot sync the migration file: %s",
+                     __func__, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -1953,6 +2741,21 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     int res;
 
+    if (ramblock_is_file_backed(block)) {
+        return ram_save_file_page(rs, block, offset);
+    }
+
+    if (migrate_fixed_ram()) {
+        return migrate_use_multifd() ? ram_save_multifd_page(rs, block, offset)
+                                     : ram_save_fixed_ram_page(rs, block,
+                                                               offset);
+    }
+
+    /* The multifd channel releases the write protection once it is saved */
+    if (migrate_background_snapshot() && migrate_use_multifd()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
@@ -1961,6 +2764,27 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return 1;
     }
 
+    /*
+     * With multifd-postcopy, the destination assembles the host pages
+     * that come through the multifd channels, so all the target pages of
+     * a host page, zero or not, must go the same way.  The pages that the
+     * destination asked for stay on the main stream, which is flushed as
+     * soon as they are sent.
+     */
+    if (migration_in_postcopy() && migrate_multifd_postcopy() &&
+        !pss->postcopy_requested && !save_page_use_compression(rs)) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
+    /*
+     * The multifd channels find the zero pages by themselves, so don't
+     * scan them here (see the multifd conditions below).
+     */
+    if (migrate_use_multifd_zero_page() && !save_page_use_compression(rs) &&
+        migrate_use_multifd() && !migration_in_postcopy()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2070,7 +2894,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 {
     PageSearchStatus pss;
     int pages = 0;
-    bool again, found;
+    bool again, found, urgent;
 
     /* No dirty page as there is zero RAM */
     if (!ram_bytes_total()) {
@@ -2085,9 +2909,16 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         pss.block = QLIST_FIRST_RCU(&ram_list.blocks);
     }
 
+    /* Background snapshot: first free the buffers of the fault threads */
+    pages = ram_save_fault_copies(rs);
+    if (pages) {
+        return pages;
+    }
+
     do {
         again = true;
-        found = get_queued_page(rs, &pss);
+        found = urgent = get_queued_page(rs, &pss);
+        pss.postcopy_requested = urgent;
 
         if (!found) {
             /* priority queue empty, so just search for something dirty */
@@ -2099,6 +2930,25 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         }
     } while (!pages && again);
 
+    if (!pages) {
+        /*
+         * A fault thread may have copied the last dirty pages after we
+         * looked; it queues them before clearing their dirty bits.
+         */
+        smp_rmb();
+        pages = ram_save_fault_copies(rs);
+    }
+
+    /*
+     * A vCPU on the destination is waiting for the pages it asked for;
+     * don't leave them in the QEMUFile buffer behind background pages.
+     */
+    if (urgent && pages > 0 && migration_in_postcopy() &&
+        QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests)) {
+        trace_ram_find_and_save_block_flush_urgent(pages);
+        qemu_fflush(rs->f);
+    }
+
     rs->last_seen_block = pss.block;
     rs->last_page = pss.page;
 
@@ -2168,11 +3018,14 @@ static void xbzrle_cleanup(void)
 {
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+        PageCache *cache = XBZRLE.cache;
+
+        /* the multifd channels may still be using it */
+        qatomic_rcu_set(&XBZRLE.cache, NULL);
+        cache_fini_rcu(cache);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
-        XBZRLE.cache = NULL;
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
         XBZRLE.zero_target_page = NULL;
@@ -2190,7 +3043,7 @@ static void ram_save_cleanup(void *opaque)
         /* caller have hold iothread lock or is in a bh, so there is
          * no writing race against the migration bitmap
          */
-        memory_global_dirty_log_stop();
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
     }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -2198,6 +3051,13 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+
+    if (*rsp && (*rsp)->fixed_ram_fd >= 0) {
+        close((*rsp)->fixed_ram_fd);
+        (*rsp)->fixed_ram_fd = -1;
     }
 
     xbzrle_cleanup();
@@ -2591,6 +3451,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    (*rsp)->fixed_ram_fd = -1;
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -2652,7 +3513,7 @@ static void ram_init_bitmaps(RAMState *rs)
         ram_list_init_bitmaps();
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
-            memory_global_dirty_log_start();
+            memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
             migration_bitmap_sync_precopy(rs);
         }
     }
@@ -2708,6 +3569,12 @@ static void ram_state_resume_prepare(RAMState *rs, QEMUFile *out)
  * migration dirty bitmap. @addr is the host address corresponding to the
  * start of the continuous guest free pages, and @len is the total bytes of
  * those pages.
+ *
+ * It can be called at any time while migrating, for example whenever the
+ * guest reports free pages: a page the guest writes again afterwards is
+ * dirtied in the log, and sent by a later iteration.  For that, the remote
+ * dirty bitmap of the pages is cleared here too.  Otherwise writes logged
+ * before the pages were freed would make the next sync set them again.
  */
 void qemu_guest_free_page_hint(void *addr, size_t len)
 {
@@ -2717,10 +3584,12 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     MigrationState *s = migrate_get_current();
 
     /* This function is currently expected to be used during live migration */
-    if (!migration_is_setup_or_active(s->state)) {
+    if (!migration_is_setup_or_active(s->state) || !ram_state) {
         return;
     }
 
+    RCU_READ_LOCK_GUARD();
+
     for (; len > 0; len -= used_len, addr += used_len) {
         block = qemu_ram_block_from_host(addr, false, &offset);
         if (unlikely(!block || offset >= block->used_length)) {
@@ -2743,6 +3612,13 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
         npages = used_len >> TARGET_PAGE_BITS;
 
         qemu_mutex_lock(&ram_state->bitmap_mutex);
+        /* Reported before ram_init_bitmaps() or outside migrated RAM */
+        if (!block->bmap) {
+            qemu_mutex_unlock(&ram_state->bitmap_mutex);
+            continue;
+        }
+        migration_clear_memory_region_dirty_bitmap_range(block, start,
+                                                         npages);
         ram_state->migration_dirty_pages -=
                       bitmap_count_one_with_offset(block->bmap, start, npages);
         bitmap_clear(block->bmap, start, npages);
@@ -2783,6 +3659,22 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->f = f;
 
+    if (migrate_fixed_ram()) {
+        Error *local_err = NULL;
+
+        if (migrate_fixed_ram_direct_io() &&
+            qemu_target_page_size() % qemu_real_host_page_size) {
+            error_report("x-fixed-ram-direct-io needs target pages that "
+                         "are a multiple of the host page size");
+            return -1;
+        }
+        (*rsp)->fixed_ram_fd = file_open_ram(true, false, &local_err);
+        if ((*rsp)->fixed_ram_fd < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
 
@@ -2797,6 +3689,13 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_file_backed_ram()) {
+                qemu_put_byte(f, ramblock_is_file_backed(block));
+            }
+            if (migrate_fixed_ram() &&
+                ram_save_fixed_ram_setup(f, block) < 0) {
+                return -1;
+            }
         }
     }
 
@@ -2904,6 +3803,15 @@ out:
     if (ret >= 0
         && migration_is_setup_or_active(migrate_get_current()->state)) {
         multifd_send_sync_main(rs->f);
+        /* Background snapshots complete without ram_save_complete() */
+        if (done && migrate_background_snapshot() && migrate_fixed_ram()) {
+            WITH_RCU_READ_LOCK_GUARD() {
+                ret = ram_save_fixed_ram_finish(rs);
+            }
+            if (ret < 0) {
+                return ret;
+            }
+        }
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
         ram_counters.transferred += 8;
@@ -2959,10 +3867,22 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         flush_compressed_data(rs);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
+
+        if (ret >= 0 && migrate_file_backed_ram()) {
+            ret = ram_sync_file_backed_blocks();
+        }
     }
 
     if (ret >= 0) {
         multifd_send_sync_main(rs->f);
+        if (migrate_fixed_ram()) {
+            WITH_RCU_READ_LOCK_GUARD() {
+                ret = ram_save_fixed_ram_finish(rs);
+            }
+            if (ret < 0) {
+                return ret;
+            }
+        }
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
@@ -3116,13 +4036,34 @@ static inline void *colo_cache_from_block_offset(RAMBlock *block,
     * It help us to decide which pages in ram cache should be flushed
     * into VM's RAM later.
     */
-    if (record_bitmap &&
-        !test_and_set_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
-        ram_state->migration_dirty_pages++;
+    if (record_bitmap) {
+        colo_record_bitmap(block, &offset, 1);
     }
     return block->colo_cache + offset;
 }
 
+/**
+ * colo_record_bitmap: mark pages received during a COLO checkpoint
+ *
+ * The multifd channels receive pages concurrently with the main
+ * stream, so the bitmap is updated under the bitmap mutex.
+ *
+ * @block: RAMBlock of the pages
+ * @offsets: offsets of the pages in @block
+ * @num: number of pages
+ */
+void colo_record_bitmap(RAMBlock *block, ram_addr_t *offsets, uint32_t num)
+{
+    uint32_t i;
+
+    QEMU_LOCK_GUARD(&ram_state->bitmap_mutex);
+    for (i = 0; i < num; i++) {
+        if (!test_and_set_bit(offsets[i] >> TARGET_PAGE_BITS, block->bmap)) {
+            ram_state->migration_dirty_pages++;
+        }
+    }
+}
+
 /**
  * ram_handle_compressed: handle the zero page case
  *
@@ -3392,7 +4333,7 @@ void colo_incoming_start_dirty_log(void)
             /* Discard this dirty bitmap record */
             bitmap_zero(block->bmap, block->max_length >> TARGET_PAGE_BITS);
         }
-        memory_global_dirty_log_start();
+        memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
     }
     ram_state->migration_dirty_pages = 0;
     qemu_mutex_unlock_ramlist();
@@ -3404,7 +4345,7 @@ void colo_release_ram_cache(void)
 {
     RAMBlock *block;
 
-    memory_global_dirty_log_stop();
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->bmap);
         block->bmap = NULL;
@@ -3712,6 +4653,135 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+typedef struct FixedRamLoadJob {
+    QemuThread thread;
+    RAMBlock *block;
+    unsigned long *bmap;
+    /* pages [start, end) of the block */
+    unsigned long start;
+    unsigned long end;
+    int fd;
+    off_t pages_offset;
+    int ret;
+    Error *err;
+} FixedRamLoadJob;
+
+static void *ram_load_fixed_ram_thread(void *opaque)
+{
+    FixedRamLoadJob *job = opaque;
+    unsigned long page = find_next_bit(job->bmap, job->end, job->start);
+
+    while (page < job->end) {
+        unsigned long last = find_next_zero_bit(job->bmap, job->end, page);
+        ram_addr_t offset = (ram_addr_t)page << TARGET_PAGE_BITS;
+
+        job->ret = file_pread_all(job->fd, job->block->host + offset,
+                                  (last - page) << TARGET_PAGE_BITS,
+                                  job->pages_offset + offset, &job->err);
+        if (job->ret < 0) {
+            break;
+        }
+        page = find_next_bit(job->bmap, job->end, last);
+    }
+    return NULL;
+}
+
+/**
+ * ram_load_fixed_ram_block: read the pages of a block from the file
+ *
+ * Returns zero for success or negative on error
+ *
+ * The runs of pages that the bitmap marks as present are read straight
+ * into guest memory, split across one thread per multifd channel.  The
+ * pages that the file does not hold are zero.
+ *
+ * @f: QEMUFile where to read the data from
+ * @block: block to load
+ * @length: length of the block on the source
+ */
+static int ram_load_fixed_ram_block(QEMUFile *f, RAMBlock *block,
+                                    ram_addr_t length)
+{
+    uint64_t bitmap_offset = qemu_get_be64(f);
+    uint64_t pages_offset = qemu_get_be64(f);
+    unsigned long pages = length >> TARGET_PAGE_BITS;
+    size_t size = fixed_ram_bitmap_size(length);
+    int n = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    g_autofree unsigned long *le = g_malloc0(size);
+    g_autofree unsigned long *bmap = bitmap_new(pages);
+    g_autofree FixedRamLoadJob *jobs = g_new0(FixedRamLoadJob, n);
+    bool direct = migrate_fixed_ram_direct_io();
+    Error *local_err = NULL;
+    int fd, data_fd = -1;
+    int ret, i;
+
+    if (direct && qemu_target_page_size() % qemu_real_host_page_size) {
+        error_report("x-fixed-ram-direct-io needs target pages that "
+                     "are a multiple of the host page size");
+        return -EINVAL;
+    }
+
+    fd = file_open_ram(false, false, &local_err);
+    if (fd < 0) {
+        error_report_err(local_err);
+        return fd;
+    }
+    ret = file_pread_all(fd, le, size, bitmap_offset, &local_err);
+    if (ret < 0) {
+        goto out;
+    }
+    bitmap_from_le(bmap, le, pages);
+
+    data_fd = direct ? file_open_ram(false, true, &local_err) : fd;
+    if (data_fd < 0) {
+        ret = data_fd;
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        FixedRamLoadJob *job = &jobs[i];
+
+        job->block = block;
+        job->bmap = bmap;
+        job->start = pages * i / n;
+        job->end = pages * (i + 1) / n;
+        job->fd = data_fd;
+        job->pages_offset = pages_offset;
+        if (n == 1) {
+            ram_load_fixed_ram_thread(job);
+        } else {
+            qemu_thread_create(&job->thread, "fixed-ram-load",
+                               ram_load_fixed_ram_thread, job,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (n > 1) {
+            qemu_thread_join(&jobs[i].thread);
+        }
+        if (jobs[i].ret < 0 && !ret) {
+            ret = jobs[i].ret;
+            error_propagate(&local_err, jobs[i].err);
+        } else {
+            error_free(jobs[i].err);
+        }
+    }
+
+    if (!ret) {
+        ret = qemu_file_seek(f, pages_offset + length);
+    }
+
+out:
+    if (local_err) {
+        error_report_err(local_err);
+    }
+    if (data_fd >= 0 && data_fd != fd) {
+        close(data_fd);
+    }
+    close(fd);
+    return ret;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3851,6 +4921,16 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (migrate_file_backed_ram() && qemu_get_byte(f) &&
+                        block->fd < 0) {
+                        error_report("RAM of block %s was saved to its "
+                                     "backend file, which the destination "
+                                     "does not map", id);
+                        ret = -EINVAL;
+                    }
+                    if (!ret && migrate_fixed_ram()) {
+                        ret = ram_load_fixed_ram_block(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4170,9 +5250,54 @@ static RAMBlockNotifier ram_mig_ram_notifier = {
     .ram_block_resized = ram_mig_ram_block_resized,
 };
 
+static const StatsDescriptor ram_stats[] = {
+    { "transferred", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES },
+    { "duplicate", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_PAGES },
+    { "normal", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_PAGES },
+    { "normal-bytes", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES },
+    { "dirty-sync-count", STATS_TYPE_CUMULATIVE },
+    { "postcopy-requests", STATS_TYPE_CUMULATIVE },
+    { "multifd-bytes", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES },
+};
+
+/*
+ * The counters are those of the last migration, as in query-migrate.
+ * They are updated by the migration thread and read without a lock.
+ */
+static void ram_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *targets, strList *names, Error **errp)
+{
+    StatsList *stats = NULL;
+
+    if (target != STATS_TARGET_VM || targets) {
+        return;
+    }
+
+    stats_add_value(&stats, names, "transferred", ram_counters.transferred);
+    stats_add_value(&stats, names, "duplicate", ram_counters.duplicate);
+    stats_add_value(&stats, names, "normal", ram_counters.normal);
+    stats_add_value(&stats, names, "normal-bytes",
+                    ram_counters.normal * qemu_target_page_size());
+    stats_add_value(&stats, names, "dirty-sync-count",
+                    ram_counters.dirty_sync_count);
+    stats_add_value(&stats, names, "postcopy-requests",
+                    ram_counters.postcopy_requests);
+    stats_add_value(&stats, names, "multifd-bytes",
+                    ram_counters.multifd_bytes);
+    stats_add_result(result, STATS_PROVIDER_MIGRATION, NULL, stats);
+}
+
+static void ram_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    stats_add_schema(result, STATS_PROVIDER_MIGRATION, STATS_TARGET_VM,
+                     ram_stats, ARRAY_SIZE(ram_stats));
+}
+
 void ram_mig_init(void)
 {
     qemu_mutex_init(&XBZRLE.lock);
     register_savevm_live("ram", 0, 4, &savevm_ram_handlers, &ram_state);
     ram_block_notifier_add(&ram_mig_ram_notifier);
+    add_stats_callbacks(STATS_PROVIDER_MIGRATION, ram_stats_cb,
+                        ram_stats_schemas_cb);
 }
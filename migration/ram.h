@@ -32,6 +32,7 @@
 #include "qapi/qapi-types-migration.h"
 #include "exec/cpu-common.h"
 #include "io/channel.h"
+#include "page_cache.h"
 
 extern MigrationStats ram_counters;
 extern XBZRLECacheStats xbzrle_counters;
@@ -48,6 +49,9 @@ bool ramblock_is_ignored(RAMBlock *block);
         if (!qemu_ram_is_migratable(block)) {} else
 
 int xbzrle_cache_resize(uint64_t new_size, Error **errp);
+/* To be called within a RCU critical section, may return NULL */
+PageCache *xbzrle_cache_get_rcu(void);
+bool ram_xbzrle_multifd_age(uint64_t *age);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_total(void);
 
@@ -76,6 +80,7 @@ int ram_dirty_bitmap_reload(MigrationState *s, RAMBlock *rb);
 /* ram cache */
 int colo_init_ram_cache(void);
 void colo_flush_ram_cache(void);
+void colo_record_bitmap(RAMBlock *block, ram_addr_t *offsets, uint32_t num);
 void colo_release_ram_cache(void);
 void colo_incoming_start_dirty_log(void);
 
@@ -85,5 +90,7 @@ bool ram_write_tracking_compatible(void);
 void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
 void ram_write_tracking_stop(void);
+int ram_write_tracking_release(RAMBlock *block, const ram_addr_t *offsets,
+                               uint32_t n);
 
 #endif
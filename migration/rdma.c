@@ -76,12 +76,19 @@
  * Capabilities for negotiation.
  */
 #define RDMA_CAPABILITY_PIN_ALL 0x01
+/*
+ * Register whole RAMBlocks as on-demand paging (ODP) memory regions,
+ * which are faulted in by the NIC instead of being pinned, rather than
+ * registering chunks on demand.
+ */
+#define RDMA_CAPABILITY_ODP     0x02
 
 /*
  * Add the other flags above to this list of known capabilities
  * as they are introduced.
  */
-static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL;
+static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL |
+                                     RDMA_CAPABILITY_ODP;
 
 #define CHECK_ERROR_STATE() \
     do { \
@@ -343,6 +350,8 @@ typedef struct RDMAContext {
     int current_chunk;
 
     bool pin_all;
+    /* whole RAMBlocks are registered as on-demand paging regions */
+    bool odp;
 
     /*
      * infiniband-specific variables for opening the device
@@ -1117,19 +1126,44 @@ static int qemu_rdma_alloc_qp(RDMAContext *rdma)
     return 0;
 }
 
+/*
+ * Whether memory regions registered with IBV_ACCESS_ON_DEMAND can be
+ * the target of RDMA WRITEs (@dest) or the source of their data.
+ */
+static bool qemu_rdma_odp_supported(struct ibv_context *verbs, bool dest)
+{
+#ifdef CONFIG_RDMA_ODP
+    struct ibv_device_attr_ex attr = {};
+    uint32_t need = dest ? IBV_ODP_SUPPORT_WRITE : IBV_ODP_SUPPORT_SEND;
+
+    if (ibv_query_device_ex(verbs, NULL, &attr)) {
+        return false;
+    }
+    return (attr.odp_caps.general_caps & IBV_ODP_SUPPORT) &&
+           (attr.odp_caps.per_transport_caps.rc_odp_caps & need) == need;
+#else
+    return false;
+#endif
+}
+
 static int qemu_rdma_reg_whole_ram_blocks(RDMAContext *rdma)
 {
     int i;
     RDMALocalBlocks *local = &rdma->local_ram_blocks;
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE;
+
+#ifdef CONFIG_RDMA_ODP
+    if (rdma->odp) {
+        access |= IBV_ACCESS_ON_DEMAND;
+    }
+#endif
 
     for (i = 0; i < local->nb_blocks; i++) {
         local->block[i].mr =
             ibv_reg_mr(rdma->pd,
                     local->block[i].local_host_addr,
                     local->block[i].length,
-                    IBV_ACCESS_LOCAL_WRITE |
-                    IBV_ACCESS_REMOTE_WRITE
-                    );
+                    access);
         if (!local->block[i].mr) {
             perror("Failed to register local dest ram block!\n");
             break;
@@ -2517,6 +2551,11 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp, bool return_path)
         cap.flags |= RDMA_CAPABILITY_PIN_ALL;
     }
 
+    /* ODP is used whenever both sides support it */
+    if (qemu_rdma_odp_supported(rdma->verbs, false)) {
+        cap.flags |= RDMA_CAPABILITY_ODP;
+    }
+
     caps_to_network(&cap);
 
     ret = qemu_rdma_post_recv_control(rdma, RDMA_WRID_READY);
@@ -2564,7 +2603,13 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp, bool return_path)
         rdma->pin_all = false;
     }
 
+    if (cap.flags & RDMA_CAPABILITY_ODP) {
+        rdma->pin_all = true;
+        rdma->odp = true;
+    }
+
     trace_qemu_rdma_connect_pin_all_outcome(rdma->pin_all);
+    trace_qemu_rdma_odp_outcome(rdma->odp);
 
     rdma_ack_cm_event(cm_event);
 
@@ -2712,6 +2757,7 @@ static ssize_t qio_channel_rdma_writev(QIOChannel *ioc,
                                        size_t niov,
                                        int *fds,
                                        size_t nfds,
+                                       int flags,
                                        Error **errp)
 {
     QIOChannelRDMA *rioc = QIO_CHANNEL_RDMA(ioc);
@@ -3376,9 +3422,23 @@ static int qemu_rdma_accept(RDMAContext *rdma)
     rdma->cm_id = cm_event->id;
     verbs = cm_event->id->verbs;
 
+    /*
+     * With ODP, the whole RAMBlocks are registered without pinning
+     * them, so it replaces the chunk registration.
+     */
+    if ((cap.flags & RDMA_CAPABILITY_ODP) &&
+        qemu_rdma_odp_supported(verbs, true)) {
+        rdma->pin_all = true;
+        rdma->odp = true;
+        cap.flags |= RDMA_CAPABILITY_PIN_ALL;
+    } else {
+        cap.flags &= ~RDMA_CAPABILITY_ODP;
+    }
+
     rdma_ack_cm_event(cm_event);
 
     trace_qemu_rdma_accept_pin_state(rdma->pin_all);
+    trace_qemu_rdma_odp_outcome(rdma->odp);
 
     caps_to_network(&cap);
 
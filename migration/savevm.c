@@ -49,11 +49,14 @@
 #include "qemu/error-report.h"
 #include "sysemu/cpus.h"
 #include "exec/memory.h"
+#include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "trace.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "block/snapshot.h"
+#include "block/thread-pool.h"
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
 #include "io/channel-file.h"
@@ -248,6 +251,9 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /* state sent or received during precopy, see savevm_early_send() */
+    uint8_t *early_data;
+    size_t early_len;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -1393,21 +1399,515 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
+/*
+ * Early device state
+ *
+ * With the x-early-device-state capability, the state of the devices
+ * whose VMStateDescription sets early_precopy is sent during precopy by
+ * the "device-precopy" iterative section.  At switchover, it is compared
+ * with what was sent and only the chunks that changed are sent, in a
+ * QEMU_VM_SECTION_FULL_DELTA section.  The destination keeps the early
+ * state in memory and only loads it into the device at switchover.
+ */
+
+/* Granularity of the comparison with the early state */
+#define SAVEVM_EARLY_CHUNK          64
+/* Minimum time between two refreshes of the early state */
+#define SAVEVM_EARLY_REFRESH_MS     100
+
+#define SAVEVM_EARLY_FLAG_STATE     0x01
+#define SAVEVM_EARLY_FLAG_EOS       0x02
+
+typedef struct SaveEarlyRun {
+    uint32_t offset;
+    uint32_t len;
+} SaveEarlyRun;
+
+static int64_t savevm_early_refresh_time;
+
+static SaveStateEntry *find_se(const char *idstr, uint32_t instance_id);
+
+static bool savevm_se_early(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->early_precopy &&
+           migrate_early_device_state();
+}
+
+/* Save the state of @se into a new buffer */
+static int savevm_early_save(SaveStateEntry *se, uint8_t **data, size_t *len)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(4096);
+    QEMUFile *f;
+    int ret;
+
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-savevm-early");
+    f = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    ret = vmstate_save(f, se, NULL);
+    qemu_fflush(f);
+    if (!ret) {
+        ret = qemu_file_get_error(f);
+    }
+    if (!ret && bioc->usage > UINT32_MAX) {
+        error_report("%s: state of %s is too large", __func__, se->idstr);
+        ret = -EFBIG;
+    }
+
+    /* Closing the channel frees its buffer, take it over first */
+    *data = bioc->data;
+    *len = bioc->usage;
+    bioc->data = NULL;
+    bioc->capacity = bioc->usage = 0;
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+
+    if (ret) {
+        g_free(*data);
+        *data = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Send @data as a delta to @old: the new length, the number of runs of
+ * chunks that differ, and the runs.  Returns the bytes of state sent.
+ */
+static size_t savevm_early_put_delta(QEMUFile *f, const uint8_t *old,
+                                     size_t old_len, const uint8_t *data,
+                                     size_t len)
+{
+    g_autoptr(GArray) runs = g_array_new(false, false, sizeof(SaveEarlyRun));
+    size_t offset = 0, sent = 0;
+    guint i;
+
+    while (offset < len) {
+        size_t n = MIN(SAVEVM_EARLY_CHUNK, len - offset);
+        SaveEarlyRun run;
+
+        if (offset + n <= old_len && !memcmp(old + offset, data + offset, n)) {
+            offset += n;
+            continue;
+        }
+
+        run.offset = offset;
+        do {
+            offset += n;
+            n = MIN(SAVEVM_EARLY_CHUNK, len - offset);
+        } while (offset < len &&
+                 (offset + n > old_len ||
+                  memcmp(old + offset, data + offset, n)));
+        run.len = offset - run.offset;
+        g_array_append_val(runs, run);
+    }
+
+    qemu_put_be32(f, len);
+    qemu_put_be32(f, runs->len);
+    for (i = 0; i < runs->len; i++) {
+        SaveEarlyRun *run = &g_array_index(runs, SaveEarlyRun, i);
+
+        qemu_put_be32(f, run->offset);
+        qemu_put_be32(f, run->len);
+        qemu_put_buffer(f, data + run->offset, run->len);
+        sent += run->len;
+    }
+
+    return sent;
+}
+
+/* Apply a delta sent by savevm_early_put_delta() to the early state */
+static int savevm_early_get_delta(QEMUFile *f, SaveStateEntry *se)
+{
+    uint32_t len, nr_runs, i;
+
+    len = qemu_get_be32(f);
+    nr_runs = qemu_get_be32(f);
+    if (len > se->early_len) {
+        se->early_data = g_realloc(se->early_data, len);
+        memset(se->early_data + se->early_len, 0, len - se->early_len);
+    }
+    se->early_len = len;
+    trace_loadvm_early_delta(se->idstr, len, nr_runs);
+
+    for (i = 0; i < nr_runs; i++) {
+        uint32_t offset = qemu_get_be32(f);
+        uint32_t n = qemu_get_be32(f);
+
+        if (offset > len || n > len - offset) {
+            error_report("%s: invalid delta for %s", __func__, se->idstr);
+            return -EINVAL;
+        }
+        if (qemu_get_buffer(f, se->early_data + offset, n) != n) {
+            break;
+        }
+    }
+
+    return qemu_file_get_error(f);
+}
+
+/*
+ * Send the state of @se if it changed since it was last sent.  Called
+ * with the BQL.
+ */
+static int savevm_early_send(QEMUFile *f, SaveStateEntry *se)
+{
+    uint8_t *data;
+    size_t len, sent;
+    int ret;
+
+    ret = savevm_early_save(se, &data, &len);
+    if (ret) {
+        return ret;
+    }
+    if (se->early_data && len == se->early_len &&
+        !memcmp(data, se->early_data, len)) {
+        g_free(data);
+        return 0;
+    }
+
+    qemu_put_byte(f, SAVEVM_EARLY_FLAG_STATE);
+    qemu_put_counted_string(f, se->idstr);
+    qemu_put_be32(f, se->instance_id);
+    sent = savevm_early_put_delta(f, se->early_data, se->early_len,
+                                  data, len);
+    trace_savevm_early_send(se->idstr, len, sent);
+
+    g_free(se->early_data);
+    se->early_data = data;
+    se->early_len = len;
+    return 0;
+}
+
+static int savevm_early_save_setup(QEMUFile *f, void *opaque)
+{
+    SaveStateEntry *se;
+    int ret = 0;
+
+    qemu_mutex_lock_iothread();
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (!savevm_se_early(se) ||
+            !vmstate_save_needed(se->vmsd, se->opaque)) {
+            continue;
+        }
+        if (se->vmsd->state_dirty) {
+            /* Start tracking changes from the state sent now */
+            se->vmsd->state_dirty(se->opaque);
+        }
+        ret = savevm_early_send(f, se);
+        if (ret) {
+            break;
+        }
+    }
+    qemu_mutex_unlock_iothread();
+
+    qemu_put_byte(f, SAVEVM_EARLY_FLAG_EOS);
+    savevm_early_refresh_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    return ret;
+}
+
+/*
+ * Send again the state of the devices that report a change.  Devices
+ * without a state_dirty hook are only compared at switchover.
+ */
+static int savevm_early_save_iterate(QEMUFile *f, void *opaque)
+{
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    SaveStateEntry *se;
+    int ret = 0;
+
+    if (now - savevm_early_refresh_time >= SAVEVM_EARLY_REFRESH_MS) {
+        savevm_early_refresh_time = now;
+        qemu_mutex_lock_iothread();
+        QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+            if (!se->early_data || !se->vmsd->state_dirty ||
+                !se->vmsd->state_dirty(se->opaque)) {
+                continue;
+            }
+            ret = savevm_early_send(f, se);
+            if (ret) {
+                break;
+            }
+        }
+        qemu_mutex_unlock_iothread();
+    }
+
+    qemu_put_byte(f, SAVEVM_EARLY_FLAG_EOS);
+
+    /* Never hold back the following handlers */
+    return ret < 0 ? ret : 1;
+}
+
+/* Called with iothread lock taken.  */
+static int savevm_early_save_complete(QEMUFile *f, void *opaque)
+{
+    /* The final state goes with the other devices */
+    qemu_put_byte(f, SAVEVM_EARLY_FLAG_EOS);
+    return 0;
+}
+
+/*
+ * Send the state of @se at switchover, as a delta to its early state.
+ * Called with the BQL.
+ */
+static int savevm_early_put_final(QEMUFile *f, SaveStateEntry *se)
+{
+    uint8_t *data;
+    size_t len, sent = 0;
+    int ret;
+
+    if (se->vmsd->state_dirty && !se->vmsd->state_dirty(se->opaque)) {
+        save_section_header(f, se, QEMU_VM_SECTION_FULL_DELTA);
+        qemu_put_be32(f, se->early_len);
+        qemu_put_be32(f, 0);
+        save_section_footer(f, se);
+        trace_savevm_early_final(se->idstr, se->early_len, sent);
+        return 0;
+    }
+
+    ret = savevm_early_save(se, &data, &len);
+    if (ret) {
+        return ret;
+    }
+    save_section_header(f, se, QEMU_VM_SECTION_FULL_DELTA);
+    sent = savevm_early_put_delta(f, se->early_data, se->early_len,
+                                  data, len);
+    save_section_footer(f, se);
+    trace_savevm_early_final(se->idstr, len, sent);
+    g_free(data);
+
+    return 0;
+}
+
+static int savevm_early_load(QEMUFile *f, void *opaque, int version_id)
+{
+    uint8_t flags;
+    int ret;
+
+    while ((flags = qemu_get_byte(f)) != SAVEVM_EARLY_FLAG_EOS) {
+        SaveStateEntry *se;
+        uint32_t instance_id;
+        char idstr[256];
+
+        if (flags != SAVEVM_EARLY_FLAG_STATE) {
+            error_report("%s: unknown flags 0x%x", __func__, flags);
+            return -EINVAL;
+        }
+        if (!qemu_get_counted_string(f, idstr)) {
+            error_report("%s: unable to read ID string", __func__);
+            return -EINVAL;
+        }
+        instance_id = qemu_get_be32(f);
+        se = find_se(idstr, instance_id);
+        if (!se || !se->vmsd) {
+            error_report("%s: unknown device '%s' %"PRIu32, __func__,
+                         idstr, instance_id);
+            return -EINVAL;
+        }
+
+        ret = savevm_early_get_delta(f, se);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return qemu_file_get_error(f);
+}
+
+static void savevm_early_free(void)
+{
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        g_free(se->early_data);
+        se->early_data = NULL;
+        se->early_len = 0;
+    }
+}
+
+static void savevm_early_save_cleanup(void *opaque)
+{
+    savevm_early_free();
+}
+
+static int savevm_early_load_cleanup(void *opaque)
+{
+    savevm_early_free();
+    return 0;
+}
+
+static bool savevm_early_is_active(void *opaque)
+{
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (savevm_se_early(se)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static SaveVMHandlers savevm_early_handlers = {
+    .save_setup = savevm_early_save_setup,
+    .save_live_iterate = savevm_early_save_iterate,
+    .save_live_complete_precopy = savevm_early_save_complete,
+    .save_cleanup = savevm_early_save_cleanup,
+    .is_active = savevm_early_is_active,
+    .load_state = savevm_early_load,
+    .load_cleanup = savevm_early_load_cleanup,
+};
+
+void savevm_early_init(void)
+{
+    register_savevm_live("device-precopy", 0, 1, &savevm_early_handlers,
+                         NULL);
+}
+
+/* Maximum number of threads saving device state in parallel */
+#define SAVEVM_PARALLEL_THREADS 8
+
+/* The state of a device saved by a savevm_parallel_thread() */
+typedef struct SaveParallelEntry {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    JSONWriter *vmdesc;
+    int ret;
+    QemuEvent done;
+} SaveParallelEntry;
+
+typedef struct SaveParallelState {
+    SaveParallelEntry *entries;
+    int nr;
+    int next;
+    QemuThread threads[SAVEVM_PARALLEL_THREADS];
+    int nr_threads;
+} SaveParallelState;
+
+static bool savevm_se_parallel(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->parallel && !savevm_se_early(se) &&
+           migrate_parallel_device_state();
+}
+
+static void *savevm_parallel_thread(void *opaque)
+{
+    SaveParallelState *s = opaque;
+    int i;
+
+    rcu_register_thread();
+    while ((i = qatomic_fetch_inc(&s->next)) < s->nr) {
+        SaveParallelEntry *e = &s->entries[i];
+        SaveStateEntry *se = e->se;
+
+        e->bioc = qio_channel_buffer_new(4096);
+        qio_channel_set_name(QIO_CHANNEL(e->bioc), "migration-savevm-parallel");
+        e->f = qemu_fopen_channel_output(QIO_CHANNEL(e->bioc));
+
+        e->vmdesc = json_writer_new(false);
+        json_writer_start_object(e->vmdesc, NULL);
+        json_writer_str(e->vmdesc, "name", se->idstr);
+        json_writer_int64(e->vmdesc, "instance_id", se->instance_id);
+        e->ret = vmstate_save(e->f, se, e->vmdesc);
+        json_writer_end_object(e->vmdesc);
+
+        qemu_fflush(e->f);
+        if (!e->ret) {
+            e->ret = qemu_file_get_error(e->f);
+        }
+        qemu_event_set(&e->done);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Start saving the devices that can be saved in parallel, each into its
+ * own buffer.  The migration thread writes them out in stream order.
+ */
+static void savevm_parallel_start(SaveParallelState *s,
+                                  SaveStateEntry **list, int nr)
+{
+    int i;
+
+    s->entries = g_new0(SaveParallelEntry, nr);
+    for (i = 0; i < nr; i++) {
+        if (savevm_se_parallel(list[i])) {
+            s->entries[s->nr].se = list[i];
+            qemu_event_init(&s->entries[s->nr].done, false);
+            s->nr++;
+        }
+    }
+
+    s->nr_threads = MIN(s->nr, SAVEVM_PARALLEL_THREADS);
+    for (i = 0; i < s->nr_threads; i++) {
+        qemu_thread_create(&s->threads[i], "savevm-parallel",
+                           savevm_parallel_thread, s, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void savevm_parallel_finish(SaveParallelState *s)
+{
+    int i;
+
+    for (i = 0; i < s->nr_threads; i++) {
+        qemu_thread_join(&s->threads[i]);
+    }
+    for (i = 0; i < s->nr; i++) {
+        SaveParallelEntry *e = &s->entries[i];
+
+        if (e->f) {
+            qemu_fclose(e->f);
+            object_unref(OBJECT(e->bioc));
+            json_writer_free(e->vmdesc);
+        }
+        qemu_event_destroy(&e->done);
+    }
+    g_free(s->entries);
+}
+
+/* Write out a device state saved by savevm_parallel_thread() */
+static int savevm_parallel_put(QEMUFile *f, SaveParallelEntry *e,
+                               JSONWriter *vmdesc)
+{
+    SaveStateEntry *se = e->se;
+
+    qemu_event_wait(&e->done);
+    if (e->ret) {
+        return e->ret;
+    }
+    if (e->bioc->usage > UINT32_MAX) {
+        error_report("%s: state of %s is too large", __func__, se->idstr);
+        return -EFBIG;
+    }
+
+    trace_savevm_section_parallel(se->idstr, se->section_id, e->bioc->usage);
+    save_section_header(f, se, QEMU_VM_SECTION_FULL_SIZED);
+    qemu_put_be32(f, e->bioc->usage);
+    qemu_put_buffer(f, e->bioc->data, e->bioc->usage);
+    save_section_footer(f, se);
+    json_writer_raw(vmdesc, NULL, json_writer_get(e->vmdesc));
+
+    return 0;
+}
+
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
 {
     g_autoptr(JSONWriter) vmdesc = NULL;
+    g_autofree SaveStateEntry **list = NULL;
+    SaveParallelState parallel = {};
     int vmdesc_len;
     SaveStateEntry *se;
-    int ret;
+    int ret = 0;
+    int i, nr = 0, next_parallel = 0;
 
-    vmdesc = json_writer_new(false);
-    json_writer_start_object(vmdesc, NULL);
-    json_writer_int64(vmdesc, "page_size", qemu_target_page_size());
-    json_writer_start_array(vmdesc, "devices");
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
-
+        nr++;
+    }
+    list = g_new(SaveStateEntry *, nr);
+    nr = 0;
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
             continue;
         }
@@ -1415,9 +1915,40 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
             trace_savevm_section_skip(se->idstr, se->section_id);
             continue;
         }
+        list[nr++] = se;
+    }
+    savevm_parallel_start(&parallel, list, nr);
+
+    vmdesc = json_writer_new(false);
+    json_writer_start_object(vmdesc, NULL);
+    json_writer_int64(vmdesc, "page_size", qemu_target_page_size());
+    json_writer_start_array(vmdesc, "devices");
+    for (i = 0; i < nr; i++) {
+        se = list[i];
 
         trace_savevm_section_start(se->idstr, se->section_id);
 
+        if (savevm_se_early(se) && se->early_data) {
+            ret = savevm_early_put_final(f, se);
+            if (ret) {
+                qemu_file_set_error(f, ret);
+                goto out;
+            }
+            trace_savevm_section_end(se->idstr, se->section_id, 0);
+            continue;
+        }
+
+        if (savevm_se_parallel(se)) {
+            ret = savevm_parallel_put(f, &parallel.entries[next_parallel++],
+                                      vmdesc);
+            if (ret) {
+                qemu_file_set_error(f, ret);
+                goto out;
+            }
+            trace_savevm_section_end(se->idstr, se->section_id, 0);
+            continue;
+        }
+
         json_writer_start_object(vmdesc, NULL);
         json_writer_str(vmdesc, "name", se->idstr);
         json_writer_int64(vmdesc, "instance_id", se->instance_id);
@@ -1426,13 +1957,14 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
             qemu_file_set_error(f, ret);
-            return ret;
+            goto out;
         }
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
 
         json_writer_end_object(vmdesc);
     }
+    savevm_parallel_finish(&parallel);
 
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
@@ -1461,6 +1993,10 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     }
 
     return 0;
+
+out:
+    savevm_parallel_finish(&parallel);
+    return ret;
 }
 
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
@@ -2074,7 +2610,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2378,8 +2915,11 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
-static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+/*
+ * Read the header of a QEMU_VM_SECTION_START, FULL or FULL_SIZED section
+ * and look up the device it belongs to.
+ */
+static int qemu_loadvm_section_header(QEMUFile *f, SaveStateEntry **sep)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
@@ -2430,10 +2970,25 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    *sep = se;
+    return 0;
+}
+
+static int
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+{
+    SaveStateEntry *se;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
-                     " device '%s'", instance_id, idstr);
+                     " device '%s'", se->instance_id, se->idstr);
         return ret;
     }
     if (!check_section_footer(f, se)) {
@@ -2443,6 +2998,173 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     return 0;
 }
 
+/* A QEMU_VM_SECTION_FULL_SIZED section being loaded by the thread pool */
+typedef struct LoadParallelEntry {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+} LoadParallelEntry;
+
+/*
+ * Device states loaded in the thread pool.  Loads only overlap with each
+ * other: qemu_loadvm_state_main() waits for them to complete before it
+ * handles any other kind of section, a device that did not opt in, or a
+ * device of another migration priority.
+ */
+static struct {
+    int pending;
+    int ret;
+    MigrationPriority priority;
+    Coroutine *waiter;
+} loadvm_parallel;
+
+static int loadvm_parallel_func(void *opaque)
+{
+    LoadParallelEntry *e = opaque;
+
+    return vmstate_load(e->f, e->se);
+}
+
+static void loadvm_parallel_done(void *opaque, int ret)
+{
+    LoadParallelEntry *e = opaque;
+
+    trace_loadvm_section_parallel_done(e->se->idstr, ret);
+    if (ret < 0) {
+        error_report("error while loading state for instance 0x%"PRIx32" of"
+                     " device '%s'", e->se->instance_id, e->se->idstr);
+        if (!loadvm_parallel.ret) {
+            loadvm_parallel.ret = ret;
+        }
+    }
+    qemu_fclose(e->f);
+    object_unref(OBJECT(e->bioc));
+    g_free(e);
+
+    if (--loadvm_parallel.pending == 0 && loadvm_parallel.waiter) {
+        Coroutine *co = loadvm_parallel.waiter;
+
+        loadvm_parallel.waiter = NULL;
+        aio_co_wake(co);
+    }
+}
+
+/* Wait for the device states being loaded in parallel */
+static int loadvm_parallel_wait(void)
+{
+    int ret;
+
+    while (loadvm_parallel.pending) {
+        if (qemu_in_coroutine()) {
+            loadvm_parallel.waiter = qemu_coroutine_self();
+            qemu_coroutine_yield();
+        } else {
+            aio_poll(qemu_get_aio_context(), true);
+        }
+    }
+
+    ret = loadvm_parallel.ret;
+    loadvm_parallel.ret = 0;
+    return ret;
+}
+
+static int
+qemu_loadvm_section_full_sized(QEMUFile *f, MigrationIncomingState *mis)
+{
+    LoadParallelEntry *e;
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    uint32_t length;
+    bool parallel;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+
+    length = qemu_get_be32(f);
+    bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-loadvm-parallel");
+    if (qemu_get_buffer(f, bioc->data, length) != length ||
+        !check_section_footer(f, se)) {
+        object_unref(OBJECT(bioc));
+        ret = qemu_file_get_error(f);
+        return ret < 0 ? ret : -EINVAL;
+    }
+    bioc->usage = length;
+
+    /* The thread pool completes requests in the main loop */
+    parallel = savevm_se_parallel(se) && qemu_mutex_iothread_locked();
+    if (!parallel || se->vmsd->priority != loadvm_parallel.priority) {
+        ret = loadvm_parallel_wait();
+        if (ret < 0) {
+            object_unref(OBJECT(bioc));
+            return ret;
+        }
+    }
+
+    e = g_new0(LoadParallelEntry, 1);
+    e->se = se;
+    e->bioc = bioc;
+    e->f = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+    trace_loadvm_section_parallel(se->idstr, length, parallel);
+
+    if (!parallel) {
+        ret = vmstate_load(e->f, se);
+        loadvm_parallel.pending++;
+        loadvm_parallel_done(e, ret);
+        return loadvm_parallel_wait();
+    }
+
+    loadvm_parallel.priority = se->vmsd->priority;
+    loadvm_parallel.pending++;
+    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+                           loadvm_parallel_func, e, loadvm_parallel_done, e);
+    return 0;
+}
+
+/* Load a device state sent as a delta to its early state */
+static int
+qemu_loadvm_section_full_delta(QEMUFile *f, MigrationIncomingState *mis)
+{
+    QIOChannelBuffer *bioc;
+    SaveStateEntry *se;
+    QEMUFile *bf;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = savevm_early_get_delta(f, se);
+    if (ret < 0) {
+        return ret;
+    }
+    if (!check_section_footer(f, se)) {
+        return -EINVAL;
+    }
+
+    /* The early state is not needed anymore, hand it over to the channel */
+    bioc = qio_channel_buffer_new(0);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-loadvm-early");
+    bioc->data = se->early_data;
+    bioc->capacity = bioc->usage = se->early_len;
+    se->early_data = NULL;
+    se->early_len = 0;
+    bf = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+
+    ret = vmstate_load(bf, se);
+    if (ret < 0) {
+        error_report("error while loading state for instance 0x%"PRIx32" of"
+                     " device '%s'", se->instance_id, se->idstr);
+    }
+    qemu_fclose(bf);
+    object_unref(OBJECT(bioc));
+
+    return ret;
+}
+
 static int
 qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
 {
@@ -2613,7 +3335,25 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+        if (section_type != QEMU_VM_SECTION_FULL_SIZED) {
+            ret = loadvm_parallel_wait();
+            if (ret < 0) {
+                goto out;
+            }
+        }
         switch (section_type) {
+        case QEMU_VM_SECTION_FULL_SIZED:
+            ret = qemu_loadvm_section_full_sized(f, mis);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
+        case QEMU_VM_SECTION_FULL_DELTA:
+            ret = qemu_loadvm_section_full_delta(f, mis);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
             ret = qemu_loadvm_section_start_full(f, mis);
@@ -2646,6 +3386,11 @@ retry:
     }
 
 out:
+    if (loadvm_parallel.pending) {
+        int wait_ret = loadvm_parallel_wait();
+
+        ret = ret < 0 ? ret : wait_ret;
+    }
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
@@ -2980,6 +3725,144 @@ void qmp_xen_load_devices_state(const char *filename, Error **errp)
     migration_incoming_state_destroy();
 }
 
+/*
+ * A clone template is saved with x-file-backed-ram, so the stream only
+ * holds the device state and the RAM blocks that do not map a file.
+ * Select that format for the duration of a save or load, and return
+ * the previous setting.
+ */
+static bool clone_template_set_format(bool file_backed_ram)
+{
+    MigrationState *s = migrate_get_current();
+    bool *cap = &s->enabled_capabilities[
+        MIGRATION_CAPABILITY_X_FILE_BACKED_RAM];
+    bool old = *cap;
+
+    *cap = file_backed_ram;
+    return old;
+}
+
+void qmp_x_clone_template_save(const char *filename, Error **errp)
+{
+    QEMUFile *f;
+    QIOChannelFile *ioc;
+    bool old_format;
+    int ret, ret2;
+
+    if (runstate_is_running()) {
+        error_setg(errp, "The VM must be paused to save a clone template");
+        return;
+    }
+    if (migrate_postcopy_ram() || migrate_fixed_ram()) {
+        error_setg(errp, "Clone templates are not compatible with "
+                   "postcopy-ram and x-fixed-ram");
+        return;
+    }
+
+    ioc = qio_channel_file_new_path(filename, O_WRONLY | O_CREAT | O_TRUNC,
+                                    0660, errp);
+    if (!ioc) {
+        return;
+    }
+    qio_channel_set_name(QIO_CHANNEL(ioc), "migration-clone-template-save");
+    f = qemu_fopen_channel_output(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    old_format = clone_template_set_format(true);
+    ret = qemu_savevm_state(f, errp);
+    clone_template_set_format(old_format);
+    ret2 = qemu_fclose(f);
+    if (ret < 0) {
+        return;
+    }
+    if (ret2 < 0) {
+        error_setg_errno(errp, -ret2, "Could not write clone template '%s'",
+                         filename);
+        return;
+    }
+
+    /*
+     * Release the image locks: the clones open the disks as the backing
+     * files of their overlays.  qmp_cont() activates them again.
+     */
+    ret = bdrv_inactivate_all();
+    if (ret) {
+        error_setg_errno(errp, -ret, "Could not inactivate the block devices");
+        return;
+    }
+    trace_clone_template_save(filename);
+}
+
+/*
+ * The RAM of a clone is the template's, so a clone must not write back
+ * to the files it maps.
+ */
+static bool clone_template_check_ram(Error **errp)
+{
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        if (block->fd >= 0 && qemu_ram_is_shared(block)) {
+            error_setg(errp, "RAM block '%s' maps its file with share=on, "
+                       "a clone must use share=off", block->idstr);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_clone_template(const char *filename, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    GError *gerr = NULL;
+    gchar *data;
+    gsize len;
+    bool old_format;
+    int ret;
+
+    if (!clone_template_check_ram(errp)) {
+        return false;
+    }
+
+    /*
+     * Without the RAM of the memory backends the template is small, so
+     * read it at once and parse it from memory.
+     */
+    if (!g_file_get_contents(filename, &data, &len, &gerr)) {
+        error_setg(errp, "Could not read clone template: %s", gerr->message);
+        g_error_free(gerr);
+        return false;
+    }
+    bioc = qio_channel_buffer_new(0);
+    bioc->data = (uint8_t *)data;
+    bioc->capacity = bioc->usage = len;
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-clone-template-load");
+    f = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
+        qemu_fclose(f);
+        return false;
+    }
+    mis->from_src_file = f;
+
+    old_format = clone_template_set_format(true);
+    ret = qemu_loadvm_state(f);
+    clone_template_set_format(old_format);
+    migration_incoming_state_destroy();
+
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading clone template '%s'",
+                   ret, filename);
+        return false;
+    }
+    trace_load_clone_template(filename, len);
+    return true;
+}
+
 bool load_snapshot(const char *name, const char *vmstate,
                    bool has_devices, strList *devices, Error **errp)
 {
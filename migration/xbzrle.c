@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,8 +25,8 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -126,6 +127,270 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * The vector encoders below only differ from xbzrle_encode_buffer_int
+ * in how they find the end of a run: a run of equal bytes ends at the
+ * first differing byte and vice versa, they produce exactly the same
+ * stream.
+ */
+typedef int (*xbzrle_run_fn)(const uint8_t *old_buf, const uint8_t *new_buf,
+                             int i, int slen, bool equal);
+
+static inline int xbzrle_run_tail(const uint8_t *old_buf,
+                                  const uint8_t *new_buf,
+                                  int i, int slen, bool equal)
+{
+    while (i < slen && (old_buf[i] == new_buf[i]) == equal) {
+        i++;
+    }
+    return i;
+}
+
+static inline __attribute__((always_inline))
+int xbzrle_encode_runs(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                       uint8_t *dst, int dlen, xbzrle_run_fn run)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, next;
+
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        next = run(old_buf, new_buf, i, slen, true);
+        zrun_len = next - i;
+        i = next;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        next = run(old_buf, new_buf, i, slen, false);
+        nzrun_len = next - i;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + i, nzrun_len);
+        d += nzrun_len;
+        i = next;
+    }
+
+    return d;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static int xbzrle_run_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                           int i, int slen, bool equal)
+{
+    uint32_t flip = equal ? 0 : -1;
+
+    while (i + 32 <= slen) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        /* one bit per byte that ends the run */
+        uint32_t end = ~(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) ^ flip);
+
+        if (end) {
+            return i + ctz32(end);
+        }
+        i += 32;
+    }
+    return xbzrle_run_tail(old_buf, new_buf, i, slen, equal);
+}
+
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_run_avx2);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+static int xbzrle_run_avx512(const uint8_t *old_buf, const uint8_t *new_buf,
+                             int i, int slen, bool equal)
+{
+    uint64_t flip = equal ? 0 : -1;
+
+    while (i + 64 <= slen) {
+        __m512i a = _mm512_loadu_si512(old_buf + i);
+        __m512i b = _mm512_loadu_si512(new_buf + i);
+        /* one bit per byte that ends the run */
+        uint64_t end = ~(_mm512_cmpeq_epi8_mask(a, b) ^ flip);
+
+        if (end) {
+            return i + ctz64(end);
+        }
+        i += 64;
+    }
+    return xbzrle_run_tail(old_buf, new_buf, i, slen, equal);
+}
+
+static int xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf,
+                                       int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_run_avx512);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+#ifdef __aarch64__
+#include <arm_neon.h>
+
+static int xbzrle_run_neon(const uint8_t *old_buf, const uint8_t *new_buf,
+                           int i, int slen, bool equal)
+{
+    uint64_t flip = equal ? 0 : -1;
+
+    while (i + 16 <= slen) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf + i), vld1q_u8(new_buf + i));
+        /* narrow the 0x00/0xff bytes to one nibble per byte */
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        uint64_t end = ~(mask ^ flip);
+
+        if (end) {
+            return i + ctz64(end) / 4;
+        }
+        i += 16;
+    }
+    return xbzrle_run_tail(old_buf, new_buf, i, slen, equal);
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_run_neon);
+}
+#endif /* __aarch64__ */
+
+/*
+ * Like in util/bufferiszero.c, the bits of cpuid_cache are ordered from
+ * the most to the least preferred encoder, so that
+ * xbzrle_encode_next_accel can walk through all of them.
+ */
+#define CACHE_AVX512BW 1
+#define CACHE_AVX2     2
+#define CACHE_NEON     4
+
+#ifdef __aarch64__
+static unsigned cpuid_cache = CACHE_NEON;
+#else
+static unsigned cpuid_cache;
+#endif
+
+typedef int (*xbzrle_encode_fn)(uint8_t *old_buf, uint8_t *new_buf,
+                                int slen, uint8_t *dst, int dlen);
+
+#ifdef __aarch64__
+static xbzrle_encode_fn encode_accel = xbzrle_encode_buffer_neon;
+#else
+static xbzrle_encode_fn encode_accel = xbzrle_encode_buffer_int;
+#endif
+
+static void init_accel(unsigned cache)
+{
+    xbzrle_encode_fn fn = xbzrle_encode_buffer_int;
+
+#ifdef __aarch64__
+    if (cache & CACHE_NEON) {
+        fn = xbzrle_encode_buffer_neon;
+    }
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_encode_buffer_avx512;
+    }
+#endif
+    encode_accel = fn;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* OPMASK and ZMM state enabled by OS, see bufferiszero.c */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif
+
+bool xbzrle_encode_next_accel(void)
+{
+    /* No bits set: xbzrle_encode_buffer_int was just tested. */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the encoder we used before and select a new one. */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -444,10 +444,18 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_CPU_THROTTLE_TAILSLOW),
             params->cpu_throttle_tailslow ? "on" : "off");
+        assert(params->has_cpu_throttle_per_vcpu);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_CPU_THROTTLE_PER_VCPU),
+            params->cpu_throttle_per_vcpu ? "on" : "off");
         assert(params->has_max_cpu_throttle);
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MAX_CPU_THROTTLE),
             params->max_cpu_throttle);
+        assert(params->has_postcopy_prefetch_pages);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
         assert(params->has_tls_creds);
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_CREDS),
@@ -966,13 +974,27 @@ void hmp_stop(Monitor *mon, const QDict *qdict)
 void hmp_sync_profile(Monitor *mon, const QDict *qdict)
 {
     const char *op = qdict_get_try_str(qdict, "op");
+    int64_t period = qdict_get_try_int(qdict, "period", 0);
 
     if (op == NULL) {
         bool on = qsp_is_enabled();
 
-        monitor_printf(mon, "sync-profile is %s\n", on ? "on" : "off");
+        monitor_printf(mon, "sync-profile is %s, sampling 1 in %u "
+                       "operations\n", on ? "on" : "off",
+                       qsp_get_sample_period());
+        return;
+    }
+    if (period < 0 || period > UINT_MAX) {
+        Error *err = NULL;
+
+        error_setg(&err, QERR_INVALID_PARAMETER_VALUE, "period",
+                   "a positive 32-bit integer");
+        hmp_handle_error(mon, err);
         return;
     }
+    if (period) {
+        qsp_set_sample_period(period);
+    }
     if (!strcmp(op, "on")) {
         qsp_enable();
     } else if (!strcmp(op, "off")) {
@@ -1299,10 +1321,18 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_cpu_throttle_tailslow = true;
         visit_type_bool(v, param, &p->cpu_throttle_tailslow, &err);
         break;
+    case MIGRATION_PARAMETER_CPU_THROTTLE_PER_VCPU:
+        p->has_cpu_throttle_per_vcpu = true;
+        visit_type_bool(v, param, &p->cpu_throttle_per_vcpu, &err);
+        break;
     case MIGRATION_PARAMETER_MAX_CPU_THROTTLE:
         p->has_max_cpu_throttle = true;
         visit_type_uint8(v, param, &p->max_cpu_throttle, &err);
         break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_uint32(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
     case MIGRATION_PARAMETER_TLS_CREDS:
         p->has_tls_creds = true;
         p->tls_creds = g_new0(StrOrNull, 1);
@@ -1885,6 +1915,7 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     IOThreadInfoList *info_list = qmp_query_iothreads(NULL);
     IOThreadInfoList *info;
     IOThreadInfo *value;
+    IOThreadPollHandlerInfoList *handler;
 
     for (info = info_list; info; info = info->next) {
         value = info->value;
@@ -1893,6 +1924,15 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        for (handler = value->poll_handlers; handler; handler = handler->next) {
+            IOThreadPollHandlerInfo *h = handler->value;
+
+            monitor_printf(mon, "  poll handler fd=%" PRId64 ": %s, "
+                           "%" PRId64 "/%" PRId64 " sessions with progress, "
+                           "%" PRId64 " removals\n",
+                           h->fd, h->polling ? "polling" : "fd monitoring",
+                           h->successes, h->sessions, h->removals);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -2226,6 +2266,11 @@ void hmp_info_memory_size_summary(Monitor *mon, const QDict *qdict)
                            info->plugged_memory);
         }
 
+        if (info->has_merged_memory) {
+            monitor_printf(mon, "merged memory: %" PRIu64 "\n",
+                           info->merged_memory);
+        }
+
         qapi_free_MemoryInfo(info);
     }
     hmp_handle_error(mon, err);
@@ -336,6 +336,47 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
 {
     dump_opcount_info();
 }
+
+static void hmp_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_try_str(qdict, "op");
+
+    if (!tcg_enabled()) {
+        error_report("TB profiling is only available with accel=tcg");
+        return;
+    }
+
+    if (op == NULL) {
+        bool on = tb_profile_is_enabled();
+
+        monitor_printf(mon, "tb-profile is %s\n", on ? "on" : "off");
+        return;
+    }
+    if (!strcmp(op, "on")) {
+        tb_profile_enable();
+    } else if (!strcmp(op, "off")) {
+        tb_profile_disable();
+    } else if (!strcmp(op, "reset")) {
+        tb_profile_reset();
+    } else {
+        Error *err = NULL;
+
+        error_setg(&err, QERR_INVALID_PARAMETER, op);
+        hmp_handle_error(mon, err);
+    }
+}
+
+static void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 20);
+
+    if (!tcg_enabled()) {
+        error_report("TB profiling is only available with accel=tcg");
+        return;
+    }
+
+    tb_profile_report(max);
+}
 #endif
 
 static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
@@ -17,6 +17,9 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/option.h"
+#include "qemu/thread.h"
+#include "qemu/timeline.h"
+#include "qemu/module.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "qemu/config-file.h"
@@ -29,6 +32,7 @@
 #include "sysemu/runstate-action.h"
 #include "sysemu/arch_init.h"
 #include "sysemu/blockdev.h"
+#include "sysemu/stats.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-acpi.h"
@@ -36,6 +40,7 @@
 #include "qapi/qapi-commands-control.h"
 #include "qapi/qapi-commands-machine.h"
 #include "qapi/qapi-commands-misc.h"
+#include "qapi/qapi-commands-stats.h"
 #include "qapi/qapi-commands-ui.h"
 #include "qapi/qmp/qerror.h"
 #include "hw/mem/memory-device.h"
@@ -321,10 +326,30 @@ ACPIOSTInfoList *qmp_query_acpi_ospm_status(Error **errp)
     return head;
 }
 
+/*
+ * Number of pages of this process that KSM currently merges, as reported
+ * by Linux 5.19 and later.  Returns false if it is not available.
+ */
+static bool get_ksm_merging_pages(uint64_t *pages)
+{
+#ifdef CONFIG_LINUX
+    g_autofree char *contents = NULL;
+
+    if (!g_file_get_contents("/proc/self/ksm_merging_pages", &contents,
+                             NULL, NULL)) {
+        return false;
+    }
+    return !qemu_strtou64(g_strchomp(contents), NULL, 10, pages);
+#else
+    return false;
+#endif
+}
+
 MemoryInfo *qmp_query_memory_size_summary(Error **errp)
 {
     MemoryInfo *mem_info = g_malloc0(sizeof(MemoryInfo));
     MachineState *ms = MACHINE(qdev_get_machine());
+    uint64_t merged_pages;
 
     mem_info->base_memory = ms->ram_size;
 
@@ -332,6 +357,11 @@ MemoryInfo *qmp_query_memory_size_summary(Error **errp)
     mem_info->has_plugged_memory =
         mem_info->plugged_memory != (uint64_t)-1;
 
+    if (get_ksm_merging_pages(&merged_pages)) {
+        mem_info->has_merged_memory = true;
+        mem_info->merged_memory = merged_pages * qemu_real_host_page_size;
+    }
+
     return mem_info;
 }
 
@@ -351,3 +381,333 @@ void qmp_display_reload(DisplayReloadOptions *arg, Error **errp)
         abort();
     }
 }
+
+static const SyncProfileObjectType qsp_type_to_qapi[QSP_TYPE__MAX] = {
+    [QSP_MUTEX] = SYNC_PROFILE_OBJECT_TYPE_MUTEX,
+    [QSP_BQL_MUTEX] = SYNC_PROFILE_OBJECT_TYPE_BQL_MUTEX,
+    [QSP_REC_MUTEX] = SYNC_PROFILE_OBJECT_TYPE_REC_MUTEX,
+    [QSP_CONDVAR] = SYNC_PROFILE_OBJECT_TYPE_CONDVAR,
+    [QSP_CO_MUTEX] = SYNC_PROFILE_OBJECT_TYPE_CO_MUTEX,
+    [QSP_CO_RWLOCK_RD] = SYNC_PROFILE_OBJECT_TYPE_CO_RWLOCK_RD,
+    [QSP_CO_RWLOCK_WR] = SYNC_PROFILE_OBJECT_TYPE_CO_RWLOCK_WR,
+    [QSP_LOCKCNT] = SYNC_PROFILE_OBJECT_TYPE_LOCKCNT,
+};
+
+SyncProfileInfo *qmp_query_sync_profile(bool has_max, uint32_t max,
+                                        bool has_sort_by,
+                                        SyncProfileSortBy sort_by,
+                                        bool has_coalesce, bool coalesce,
+                                        Error **errp)
+{
+    SyncProfileInfo *info = g_new0(SyncProfileInfo, 1);
+    SyncProfileEntryList **tail = &info->entries;
+    enum QSPSortBy qsp_sort_by = QSP_SORT_BY_TOTAL_WAIT_TIME;
+    QSPReportEntry *entries;
+    size_t n_entries, i;
+    int j;
+
+    if (has_sort_by && sort_by == SYNC_PROFILE_SORT_BY_MEAN) {
+        qsp_sort_by = QSP_SORT_BY_AVG_WAIT_TIME;
+    }
+    n_entries = qsp_get_report(has_max ? max : 10, qsp_sort_by,
+                               has_coalesce ? coalesce : true, &entries);
+
+    for (i = 0; i < n_entries; i++) {
+        const QSPReportEntry *e = &entries[i];
+        SyncProfileEntry *entry = g_new0(SyncProfileEntry, 1);
+        uint64List **hist_tail = &entry->histogram;
+
+        entry->type = qsp_type_to_qapi[e->type];
+        entry->objects = MAX(e->n_objs, 1);
+        entry->has_object = entry->objects == 1;
+        entry->object = (uintptr_t)e->obj;
+        entry->callsite = g_strdup(e->callsite_at);
+        entry->wait_time = e->ns;
+        entry->count = e->n_acqs;
+        for (j = 0; j < QSP_HIST_BUCKETS; j++) {
+            QAPI_LIST_APPEND(hist_tail, e->hist[j]);
+        }
+        QAPI_LIST_APPEND(tail, entry);
+    }
+    qsp_report_free(entries, n_entries);
+
+    info->enabled = qsp_is_enabled();
+    info->sample_period = qsp_get_sample_period();
+    return info;
+}
+
+void qmp_set_sync_profile(bool enable, bool has_sample_period,
+                          uint32_t sample_period, Error **errp)
+{
+    if (has_sample_period) {
+        if (!sample_period) {
+            error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "sample-period",
+                       "a positive integer");
+            return;
+        }
+        qsp_set_sample_period(sample_period);
+    }
+    if (enable) {
+        qsp_enable();
+    } else {
+        qsp_disable();
+    }
+}
+
+void qmp_reset_sync_profile(Error **errp)
+{
+    qsp_reset();
+}
+
+TimelineInfo *qmp_query_timeline(Error **errp)
+{
+    TimelineInfo *info = g_new0(TimelineInfo, 1);
+    TimelineEventInfoList **tail = &info->events;
+    TimelineEvent *events;
+    size_t n, i;
+
+    n = timeline_get(&events);
+    for (i = 0; i < n; i++) {
+        TimelineEventInfo *ev = g_new0(TimelineEventInfo, 1);
+
+        ev->category = g_strdup(events[i].category);
+        ev->name = g_strdup(events[i].name);
+        ev->start_ns = events[i].start_ns;
+        ev->duration_ns = events[i].duration_ns;
+        ev->thread_id = events[i].thread_id;
+        QAPI_LIST_APPEND(tail, ev);
+    }
+    timeline_free(events, n);
+
+    info->dropped = timeline_dropped();
+    return info;
+}
+
+void qmp_dump_timeline(const char *filename, Error **errp)
+{
+    timeline_dump_chrome(filename, errp);
+}
+
+typedef struct StatsCallbacks {
+    StatsProvider provider;
+    StatsRetrieveFunc *stats_cb;
+    StatsSchemaRetrieveFunc *schemas_cb;
+    QTAILQ_ENTRY(StatsCallbacks) next;
+} StatsCallbacks;
+
+static QTAILQ_HEAD(, StatsCallbacks) stats_callbacks =
+    QTAILQ_HEAD_INITIALIZER(stats_callbacks);
+
+void add_stats_callbacks(StatsProvider provider,
+                         StatsRetrieveFunc *stats_fn,
+                         StatsSchemaRetrieveFunc *schemas_fn)
+{
+    StatsCallbacks *entry = g_new(StatsCallbacks, 1);
+
+    entry->provider = provider;
+    entry->stats_cb = stats_fn;
+    entry->schemas_cb = schemas_fn;
+    QTAILQ_INSERT_TAIL(&stats_callbacks, entry, next);
+}
+
+bool apply_str_list_filter(const char *string, strList *list)
+{
+    strList *str_list;
+
+    if (!list) {
+        return true;
+    }
+    for (str_list = list; str_list; str_list = str_list->next) {
+        if (g_str_equal(string, str_list->value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void stats_add_schema(StatsSchemaList **result, StatsProvider provider,
+                      StatsTarget target, const StatsDescriptor *desc,
+                      size_t n)
+{
+    StatsSchema *schema = g_new0(StatsSchema, 1);
+    StatsSchemaValueList **tail = &schema->stats;
+    size_t i;
+
+    schema->provider = provider;
+    schema->target = target;
+    for (i = 0; i < n; i++) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(desc[i].name);
+        value->type = desc[i].type;
+        value->has_unit = desc[i].has_unit;
+        value->unit = desc[i].unit;
+        QAPI_LIST_APPEND(tail, value);
+    }
+    QAPI_LIST_PREPEND(*result, schema);
+}
+
+void stats_add_value(StatsList **stats, strList *names, const char *name,
+                     uint64_t value)
+{
+    Stats *s;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+    s = g_new0(Stats, 1);
+    s->name = g_strdup(name);
+    s->has_value = true;
+    s->value = value;
+    QAPI_LIST_PREPEND(*stats, s);
+}
+
+void stats_add_values(StatsList **stats, strList *names, const char *name,
+                      const uint64_t *values, size_t n)
+{
+    uint64List **tail;
+    Stats *s;
+    size_t i;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+    s = g_new0(Stats, 1);
+    s->name = g_strdup(name);
+    s->has_values = true;
+    tail = &s->values;
+    for (i = 0; i < n; i++) {
+        QAPI_LIST_APPEND(tail, values[i]);
+    }
+    QAPI_LIST_PREPEND(*stats, s);
+}
+
+void stats_add_result(StatsResultList **result, StatsProvider provider,
+                      const char *qom_path, StatsList *stats)
+{
+    StatsResult *entry;
+
+    if (!stats) {
+        return;
+    }
+    entry = g_new0(StatsResult, 1);
+    entry->provider = provider;
+    entry->has_qom_path = !!qom_path;
+    entry->qom_path = g_strdup(qom_path);
+    entry->stats = stats;
+    QAPI_LIST_PREPEND(*result, entry);
+}
+
+static bool stats_provider_requested(StatsProvider provider,
+                                     StatsProviderList *providers)
+{
+    for (; providers; providers = providers->next) {
+        if (providers->value == provider) {
+            return true;
+        }
+    }
+    return false;
+}
+
+StatsResultList *qmp_query_stats(StatsTarget target,
+                                 bool has_providers,
+                                 StatsProviderList *providers,
+                                 bool has_targets, strList *targets,
+                                 bool has_names, strList *names,
+                                 Error **errp)
+{
+    ERRP_GUARD();
+    StatsResultList *result = NULL;
+    StatsCallbacks *entry;
+
+    QTAILQ_FOREACH(entry, &stats_callbacks, next) {
+        if (has_providers &&
+            !stats_provider_requested(entry->provider, providers)) {
+            continue;
+        }
+        entry->stats_cb(&result, target, has_targets ? targets : NULL,
+                        has_names ? names : NULL, errp);
+        if (*errp) {
+            qapi_free_StatsResultList(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+StatsSchemaList *qmp_query_stats_schemas(bool has_provider,
+                                         StatsProvider provider,
+                                         Error **errp)
+{
+    ERRP_GUARD();
+    StatsSchemaList *result = NULL;
+    StatsCallbacks *entry;
+
+    QTAILQ_FOREACH(entry, &stats_callbacks, next) {
+        if (has_provider && entry->provider != provider) {
+            continue;
+        }
+        entry->schemas_cb(&result, errp);
+        if (*errp) {
+            qapi_free_StatsSchemaList(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+static const StatsDescriptor thread_pool_stats[] = {
+    { "threads", STATS_TYPE_INSTANT },
+    { "idle-threads", STATS_TYPE_INSTANT },
+    { "queue-depth", STATS_TYPE_INSTANT },
+    { "requests", STATS_TYPE_CUMULATIVE },
+    { "wait-time", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_NANOSECONDS },
+};
+
+/* The main loop's pool is reported as an I/O thread without QOM path */
+static void thread_pool_stats_cb(StatsResultList **result,
+                                 StatsTarget target, strList *targets,
+                                 strList *names, Error **errp)
+{
+    ThreadPoolInfoList *pools, *pool;
+
+    if (target != STATS_TARGET_IOTHREAD) {
+        return;
+    }
+
+    pools = qmp_query_thread_pools(errp);
+    for (pool = pools; pool; pool = pool->next) {
+        ThreadPoolInfo *info = pool->value;
+        g_autofree char *path = NULL;
+        StatsList *stats = NULL;
+
+        if (info->has_iothread) {
+            path = g_strdup_printf("/objects/%s", info->iothread);
+        }
+        if (targets && (!path || !apply_str_list_filter(path, targets))) {
+            continue;
+        }
+        stats_add_value(&stats, names, "threads", info->threads);
+        stats_add_value(&stats, names, "idle-threads", info->idle_threads);
+        stats_add_value(&stats, names, "queue-depth", info->queue_depth);
+        stats_add_value(&stats, names, "requests", info->requests);
+        stats_add_value(&stats, names, "wait-time", info->wait_ns);
+        stats_add_result(result, STATS_PROVIDER_THREAD_POOL, path, stats);
+    }
+    qapi_free_ThreadPoolInfoList(pools);
+}
+
+static void thread_pool_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    stats_add_schema(result, STATS_PROVIDER_THREAD_POOL,
+                     STATS_TARGET_IOTHREAD, thread_pool_stats,
+                     ARRAY_SIZE(thread_pool_stats));
+}
+
+static void thread_pool_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_THREAD_POOL, thread_pool_stats_cb,
+                        thread_pool_schemas_cb);
+}
+
+block_init(thread_pool_stats_init);
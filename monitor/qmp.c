@@ -28,6 +28,7 @@
 #include "monitor-internal.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-control.h"
+#include "qapi/qmp/json-writer.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlist.h"
@@ -105,13 +106,8 @@ static void monitor_qmp_cleanup_queue_and_resume(MonitorQMP *mon)
 
 }
 
-void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
+static void qmp_send_json(MonitorQMP *mon, GString *json)
 {
-    const QObject *data = QOBJECT(rsp);
-    GString *json;
-
-    json = qobject_to_json_pretty(data, mon->pretty);
-    assert(json != NULL);
     trace_monitor_qmp_respond(mon, json->str);
 
     g_string_append_c(json, '\n');
@@ -120,6 +116,14 @@ void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
     g_string_free(json, true);
 }
 
+void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
+{
+    GString *json = qobject_to_json_pretty(QOBJECT(rsp), mon->pretty);
+
+    assert(json != NULL);
+    qmp_send_json(mon, json);
+}
+
 /*
  * Emit QMP response @rsp to @mon.
  * Null @rsp can only happen for commands with QCO_NO_SUCCESS_RESP.
@@ -138,11 +142,18 @@ static void monitor_qmp_respond(MonitorQMP *mon, QDict *rsp)
  */
 static void monitor_qmp_dispatch(MonitorQMP *mon, QObject *req)
 {
+    JSONWriter *writer = json_writer_new(mon->pretty);
+    const QDictEntry *ent;
     QDict *rsp;
     QDict *error;
 
-    rsp = qmp_dispatch(mon->commands, req, qmp_oob_enabled(mon),
-                       &mon->common);
+    /*
+     * The return value is written straight into the response, without
+     * building a QObject for it.
+     */
+    json_writer_start_object(writer, NULL);
+    rsp = qmp_dispatch_json(mon->commands, req, qmp_oob_enabled(mon),
+                            &mon->common, writer);
 
     if (mon->commands == &qmp_cap_negotiation_commands) {
         error = qdict_get_qdict(rsp, "error");
@@ -156,7 +167,17 @@ static void monitor_qmp_dispatch(MonitorQMP *mon, QObject *req)
         }
     }
 
-    monitor_qmp_respond(mon, rsp);
+    if (!rsp) {
+        json_writer_free(writer);
+        return;
+    }
+
+    for (ent = qdict_first(rsp); ent; ent = qdict_next(rsp, ent)) {
+        qobject_write_json(writer, qdict_entry_key(ent),
+                           qdict_entry_value(ent));
+    }
+    json_writer_end_object(writer);
+    qmp_send_json(mon, json_writer_get_and_free(writer));
     qobject_unref(rsp);
 }
 
@@ -39,6 +39,13 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads smaller than this are sent by copying them into the
+ * socket: pinning the pages and waiting for completions costs more
+ * than the copy.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (64 * KiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -83,6 +90,16 @@ struct NBDRequestData {
     bool complete;
 };
 
+/*
+ * Request buffer that may still be referenced by a zero-copy send; it is
+ * freed once the socket reported @seq zero-copy sends as completed.
+ */
+typedef struct NBDZeroCopyBuffer {
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuffer) entry;
+    uint8_t *data;
+    ssize_t seq;
+} NBDZeroCopyBuffer;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,6 +116,8 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -144,6 +163,11 @@ struct NBDClient {
     bool structured_reply;
     NBDExportMetaContexts export_meta;
 
+    /* Send read payloads with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY */
+    bool zero_copy;
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuffer) zero_copy_buffers;
+    unsigned int nb_zero_copy_buffers;
+
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
@@ -1349,6 +1373,14 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
     }
 
+    /*
+     * Request payloads and replies are transferred by the request
+     * coroutines, which are only entered by their own I/O and which drained
+     * sections wait for.  The request header is read with qio_channel_yield()
+     * so that nbd_drained_poll() can still interrupt it.
+     */
+    qio_channel_set_io_uring(client->ioc, true);
+
     assert(!client->optlen);
     trace_nbd_negotiate_success();
 
@@ -1449,11 +1481,23 @@ void nbd_client_get(NBDClient *client)
 void nbd_client_put(NBDClient *client)
 {
     if (--client->refcount == 0) {
+        NBDZeroCopyBuffer *zbuf, *next;
+
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
         assert(client->closing);
 
+        /*
+         * The connection is shut down, so nobody cares any more about the
+         * data of zero-copy sends that are still in flight.  The kernel
+         * holds its own references to the pages, freeing them is safe.
+         */
+        QSIMPLEQ_FOREACH_SAFE(zbuf, &client->zero_copy_buffers, entry, next) {
+            qemu_vfree(zbuf->data);
+            g_free(zbuf);
+        }
+
         qio_channel_detach_aio_context(client->ioc);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
@@ -1503,11 +1547,46 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     return req;
 }
 
+/* Free the buffers whose zero-copy sends have completed */
+static void nbd_client_reap_zero_copy(NBDClient *client)
+{
+    NBDZeroCopyBuffer *zbuf;
+    Error *local_err = NULL;
+
+    if (qio_channel_socket_poll_zero_copy(client->sioc, &local_err) < 0) {
+        /* The buffers are freed together with the client */
+        error_reportf_err(local_err, "Disconnect client, due to: ");
+        client_close(client, true);
+        return;
+    }
+
+    while ((zbuf = QSIMPLEQ_FIRST(&client->zero_copy_buffers)) &&
+           zbuf->seq <= client->sioc->zero_copy_sent) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_buffers, entry);
+        client->nb_zero_copy_buffers--;
+        qemu_vfree(zbuf->data);
+        g_free(zbuf);
+    }
+}
+
 static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
+    QIOChannelSocket *sioc = client->sioc;
+
+    if (!client->closing && sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        nbd_client_reap_zero_copy(client);
+    }
 
-    if (req->data) {
+    if (req->data && sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        /* One of the zero-copy sends in flight may be from req->data */
+        NBDZeroCopyBuffer *zbuf = g_new(NBDZeroCopyBuffer, 1);
+
+        zbuf->data = req->data;
+        zbuf->seq = sioc->zero_copy_queued;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_buffers, zbuf, entry);
+        client->nb_zero_copy_buffers++;
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1633,7 +1712,6 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     int64_t size;
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
-    bool shared = !exp_args->writable;
     strList *bitmaps;
     size_t i;
     int ret;
@@ -1684,11 +1762,18 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     exp->description = g_strdup(arg->description);
     exp->nbdflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
+
+    /*
+     * All clients of an export share its BlockBackend, so a flush (or FUA)
+     * on one connection also covers the writes that were completed on all
+     * other connections: the export is cache consistent across
+     * connections.  Read-only exports are trivially consistent.
+     */
+    if (readonly || nbd_server_max_connections() != 1) {
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
@@ -1744,6 +1829,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1860,6 +1946,46 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Send a reply whose payload is read data from the request buffer: iov[0]
+ * is the reply header, the rest of @iov the payload.  Large payloads are
+ * sent without copying them if the client uses zero-copy; the request
+ * buffer is then kept alive by nbd_request_put() until the send completed.
+ */
+static int coroutine_fn nbd_co_send_payload(NBDClient *client,
+                                            struct iovec *iov,
+                                            unsigned niov, Error **errp)
+{
+    int ret;
+
+    assert(niov > 1);
+    if (!client->zero_copy ||
+        iov_size(&iov[1], niov - 1) < NBD_ZERO_COPY_MIN_SIZE ||
+        client->nb_zero_copy_buffers >= MAX_NBD_REQUESTS) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* The header lives on the stack of the caller and must be copied */
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, &iov[1], niov - 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+    qio_channel_set_cork(client->ioc, false);
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1886,7 +2012,10 @@ static int nbd_co_send_simple_reply(NBDClient *client,
                                    len);
     set_be_simple_reply(&reply, nbd_err, handle);
 
-    return nbd_co_send_iov(client, iov, len ? 2 : 1, errp);
+    if (len) {
+        return nbd_co_send_payload(client, iov, 2, errp);
+    }
+    return nbd_co_send_iov(client, iov, 1, errp);
 }
 
 static inline void set_be_chunk(NBDStructuredReplyChunk *chunk, uint16_t flags,
@@ -1935,7 +2064,7 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_payload(client, iov, 2, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
@@ -2719,6 +2848,12 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /* TLS encrypts into its own buffers, there is nothing to gain there */
+    client->zero_copy = client->exp->zero_copy &&
+        client->ioc == QIO_CHANNEL(client->sioc) &&
+        qio_channel_has_feature(client->ioc,
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+
     nbd_client_receive_next_request(client);
 }
 
@@ -2747,6 +2882,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
+    QSIMPLEQ_INIT(&client->zero_copy_buffers);
 
     co = qemu_coroutine_create(nbd_co_client_start, client);
     qemu_coroutine_enter(co);
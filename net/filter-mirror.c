@@ -47,21 +47,24 @@ static int filter_send(MirrorState *s,
                        int iovcnt)
 {
     NetFilterState *nf = NETFILTER(s);
+    g_autofree struct iovec *out = NULL;
+    uint32_t len[2];
     int ret = 0;
     ssize_t size = 0;
-    uint32_t len = 0;
-    char *buf;
 
     size = iov_size(iov, iovcnt);
     if (!size) {
         return 0;
     }
 
-    len = htonl(size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-    if (ret != sizeof(len)) {
-        goto err;
-    }
+    /*
+     * Send the lengths and the packet with a single write, straight
+     * from the sender's buffers when the chardev supports it.
+     */
+    out = g_new(struct iovec, iovcnt + 1);
+    out[0].iov_base = len;
+    out[0].iov_len = sizeof(len[0]);
+    len[0] = htonl(size);
 
     if (s->vnet_hdr) {
         /*
@@ -69,22 +72,13 @@ static int filter_send(MirrorState *s,
          * module(like colo-compare) know how to parse net
          * packet correctly.
          */
-        ssize_t vnet_hdr_len;
-
-        vnet_hdr_len = nf->netdev->vnet_hdr_len;
-
-        len = htonl(vnet_hdr_len);
-        ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-        if (ret != sizeof(len)) {
-            goto err;
-        }
+        len[1] = htonl(nf->netdev->vnet_hdr_len);
+        out[0].iov_len += sizeof(len[1]);
     }
+    memcpy(out + 1, iov, iovcnt * sizeof(*iov));
 
-    buf = g_malloc(size);
-    iov_to_buf(iov, iovcnt, 0, buf, size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)buf, size);
-    g_free(buf);
-    if (ret != size) {
+    ret = qemu_chr_fe_writev_all(&s->chr_out, out, iovcnt + 1);
+    if (ret != out[0].iov_len + size) {
         goto err;
     }
 
@@ -807,6 +807,36 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                    iov, iovcnt, sent_cb);
 }
 
+/*
+ * Tell the peer of @sender that several packets are about to be sent, so
+ * that it can process them together in qemu_net_end_batch().  If this
+ * returns true, the peer may keep pointers to the memory that the iovecs
+ * given to qemu_sendv_packet_async() point to (but not to the iovec
+ * arrays themselves) until qemu_net_end_batch(), and the sender must not
+ * reuse or release that memory before.  Batches are not used when filters
+ * are attached to either side.
+ */
+bool qemu_net_begin_batch(NetClientState *sender)
+{
+    NetClientState *peer = sender->peer;
+
+    if (!peer || !peer->info->begin_batch ||
+        !QTAILQ_EMPTY(&sender->filters) || !QTAILQ_EMPTY(&peer->filters)) {
+        return false;
+    }
+    return peer->info->begin_batch(peer);
+}
+
+/* Close a batch opened by a successful qemu_net_begin_batch() */
+void qemu_net_end_batch(NetClientState *sender)
+{
+    NetClientState *peer = sender->peer;
+
+    if (peer && peer->info->end_batch) {
+        peer->info->end_batch(peer);
+    }
+}
+
 ssize_t
 qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
 {
@@ -988,6 +1018,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1081,6 +1114,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -34,6 +34,7 @@
 
 #include "net/eth.h"
 #include "net/net.h"
+#include "qemu/iov.h"
 #include "clients.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
@@ -48,6 +49,29 @@
 
 #include "net/vhost_net.h"
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+
+/* Packets and iovecs that a batch of writes can hold */
+#define TAP_BATCH_PACKETS 32
+#define TAP_BATCH_IOV 256
+
+/*
+ * Packets received from the peer between qemu_net_begin_batch() and
+ * qemu_net_end_batch() are written with one io_uring submission.
+ */
+typedef struct TAPBatch {
+    struct io_uring ring;
+    bool active;
+    struct io_uring_sqe *last;
+    unsigned int packets;
+    unsigned int iovcnt;
+    struct iovec iov[TAP_BATCH_IOV];
+    unsigned int pkt_iov[TAP_BATCH_PACKETS];
+    unsigned int pkt_iovcnt[TAP_BATCH_PACKETS];
+} TAPBatch;
+#endif
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -62,6 +86,9 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+#ifdef CONFIG_LINUX_IO_URING
+    TAPBatch *batch;
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -115,22 +142,165 @@ static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt
     return len;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_batch_init(TAPState *s)
+{
+    s->batch = g_new0(TAPBatch, 1);
+    if (io_uring_queue_init(TAP_BATCH_PACKETS, &s->batch->ring, 0) < 0) {
+        g_free(s->batch);
+        s->batch = NULL;
+    }
+}
+
+static void tap_batch_cleanup(TAPState *s)
+{
+    if (s->batch) {
+        io_uring_queue_exit(&s->batch->ring);
+        g_free(s->batch);
+        s->batch = NULL;
+    }
+}
+
+/*
+ * Write the packets of the batch.  The writes are linked so that they
+ * happen in order; those that could not be done because the tap was
+ * full, or because an earlier one failed, are retried one at a time.
+ * The peer was already told that the packets were sent, so the ones
+ * that still fail are dropped.  If io_uring fails, batching is disabled.
+ */
+static void tap_batch_flush(TAPState *s)
+{
+    TAPBatch *b = s->batch;
+    int res[TAP_BATCH_PACKETS];
+    unsigned int i, submitted;
+    int ret;
+
+    if (!b->packets) {
+        return;
+    }
+
+    for (i = 0; i < b->packets; i++) {
+        res[i] = -ECANCELED;
+    }
+
+    do {
+        ret = io_uring_submit_and_wait(&b->ring, b->packets);
+    } while (ret == -EINTR);
+    submitted = MAX(ret, 0);
+
+    for (i = 0; i < submitted; i++) {
+        struct io_uring_cqe *cqe;
+
+        do {
+            ret = io_uring_wait_cqe(&b->ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            break;
+        }
+        res[(uintptr_t)io_uring_cqe_get_data(cqe)] = cqe->res;
+        io_uring_cqe_seen(&b->ring, cqe);
+    }
+
+    for (i = 0; i < b->packets; i++) {
+        if (res[i] == -EAGAIN || res[i] == -ECANCELED) {
+            ssize_t len;
+
+            do {
+                len = writev(s->fd, &b->iov[b->pkt_iov[i]], b->pkt_iovcnt[i]);
+            } while (len == -1 && errno == EINTR);
+        }
+    }
+
+    if (submitted < b->packets || ret < 0) {
+        /* this also drops the requests that were not submitted */
+        tap_batch_cleanup(s);
+        return;
+    }
+
+    b->packets = 0;
+    b->iovcnt = 0;
+    b->last = NULL;
+}
+
+static ssize_t tap_batch_add(TAPState *s, const struct iovec *iov, int iovcnt)
+{
+    TAPBatch *b = s->batch;
+    struct io_uring_sqe *sqe;
+
+    if (b->packets == TAP_BATCH_PACKETS ||
+        b->iovcnt + iovcnt > TAP_BATCH_IOV) {
+        tap_batch_flush(s);
+        b = s->batch;
+    }
+    if (!b || iovcnt > TAP_BATCH_IOV) {
+        return tap_write_packet(s, iov, iovcnt);
+    }
+
+    /* the ring has room for a full batch, so this cannot fail */
+    sqe = io_uring_get_sqe(&b->ring);
+    memcpy(&b->iov[b->iovcnt], iov, iovcnt * sizeof(*iov));
+    io_uring_prep_writev(sqe, s->fd, &b->iov[b->iovcnt], iovcnt, 0);
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)b->packets);
+    if (b->last) {
+        b->last->flags |= IOSQE_IO_LINK;
+    }
+    b->last = sqe;
+
+    b->pkt_iov[b->packets] = b->iovcnt;
+    b->pkt_iovcnt[b->packets] = iovcnt;
+    b->iovcnt += iovcnt;
+    b->packets++;
+
+    return iov_size(iov, iovcnt);
+}
+
+static bool tap_begin_batch(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (!s->batch) {
+        return false;
+    }
+    s->batch->active = true;
+    return true;
+}
+
+static void tap_end_batch(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->batch) {
+        tap_batch_flush(s);
+    }
+    if (s->batch) {
+        s->batch->active = false;
+    }
+}
+#endif
+
 static ssize_t tap_receive_iov(NetClientState *nc, const struct iovec *iov,
                                int iovcnt)
 {
+    /* not on the stack, a batched write may use it after we return */
+    static const struct virtio_net_hdr_mrg_rxbuf hdr;
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     const struct iovec *iovp = iov;
     struct iovec iov_copy[iovcnt + 1];
-    struct virtio_net_hdr_mrg_rxbuf hdr = { };
 
     if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-        iov_copy[0].iov_base = &hdr;
+        iov_copy[0].iov_base = (void *)&hdr;
         iov_copy[0].iov_len =  s->host_vnet_hdr_len;
         memcpy(&iov_copy[1], iov, iovcnt * sizeof(*iov));
         iovp = iov_copy;
         iovcnt++;
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->batch && s->batch->active) {
+        return tap_batch_add(s, iovp, iovcnt);
+    }
+#endif
+
     return tap_write_packet(s, iovp, iovcnt);
 }
 
@@ -187,6 +357,8 @@ static void tap_send(void *opaque)
     TAPState *s = opaque;
     int size;
     int packets = 0;
+    /* let the peer signal the guest once for all packets read here */
+    bool batch = qemu_net_begin_batch(&s->nc);
 
     while (true) {
         uint8_t *buf = s->buf;
@@ -229,6 +401,10 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    if (batch) {
+        qemu_net_end_batch(&s->nc);
+    }
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -336,6 +512,9 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+#ifdef CONFIG_LINUX_IO_URING
+    tap_batch_cleanup(s);
+#endif
     close(s->fd);
     s->fd = -1;
 }
@@ -381,6 +560,10 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+#ifdef CONFIG_LINUX_IO_URING
+    .begin_batch = tap_begin_batch,
+    .end_batch = tap_end_batch,
+#endif
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -411,6 +594,9 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     }
     tap_read_poll(s, true);
     s->vhost_net = NULL;
+#ifdef CONFIG_LINUX_IO_URING
+    tap_batch_init(s);
+#endif
 
     s->exit.notify = tap_exit_notify;
     qemu_add_exit_notifier(&s->exit);
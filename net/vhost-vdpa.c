@@ -18,6 +18,8 @@
 #include "qemu/error-report.h"
 #include "qemu/option.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "migration/misc.h"
 #include <sys/ioctl.h>
 #include <err.h>
 #include "standard-headers/linux/virtio_net.h"
@@ -28,6 +30,7 @@
 typedef struct VhostVDPAState {
     NetClientState nc;
     struct vhost_vdpa vhost_vdpa;
+    Notifier migration_state;
     VHostNetState *vhost_net;
     uint64_t acked_features;
     bool started;
@@ -133,6 +136,11 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
 {
     VhostVDPAState *s = DO_UPCAST(VhostVDPAState, nc, nc);
 
+    if (s->migration_state.notify) {
+        remove_migration_state_change_notifier(&s->migration_state);
+        s->migration_state.notify = NULL;
+    }
+
     if (s->vhost_net) {
         vhost_net_cleanup(s->vhost_net);
         g_free(s->vhost_net);
@@ -170,8 +178,76 @@ static NetClientInfo net_vhost_vdpa_info = {
         .has_ufo = vhost_vdpa_has_ufo,
 };
 
+/*
+ * Restart the device with or without shadow virtqueues.  Unlike QEMU, the
+ * device does not tell which buffers it still had, so when they start,
+ * the buffers that it had not used are made available again.
+ */
+static int vhost_vdpa_net_switch_svq(VhostVDPAState *s, bool enable,
+                                     Error **errp)
+{
+    struct vhost_vdpa *v = &s->vhost_vdpa;
+    struct vhost_dev *dev = v->dev;
+    VirtIODevice *vdev = dev->vdev;
+    int i, r;
+
+    if (v->shadow_vqs_enabled == enable) {
+        return 0;
+    }
+    if (!dev->started) {
+        /* applied when the guest starts the device */
+        v->shadow_vqs_enabled = enable;
+        return 0;
+    }
+    if (enable && !vhost_svq_valid_features(vdev, errp)) {
+        return -ENOTSUP;
+    }
+
+    vhost_net_stop(vdev, s->nc.peer, 1);
+    if (enable) {
+        for (i = 0; i < dev->nvqs; i++) {
+            virtio_queue_restore_last_avail_idx(vdev, dev->vq_index + i);
+        }
+    }
+
+    v->shadow_vqs_enabled = enable;
+    r = vhost_net_start(vdev, s->nc.peer, 1);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "Cannot restart the device");
+        v->shadow_vqs_enabled = !enable;
+        if (vhost_net_start(vdev, s->nc.peer, 1) < 0) {
+            error_report("vhost-vdpa: %s is stopped", s->nc.name);
+        }
+    }
+    return r;
+}
+
+static void vhost_vdpa_net_migration_state_notifier(Notifier *notifier,
+                                                    void *data)
+{
+    VhostVDPAState *s = container_of(notifier, VhostVDPAState,
+                                     migration_state);
+    MigrationState *migration = data;
+    Error *err = NULL;
+
+    if (migration_in_setup(migration)) {
+        if (vhost_vdpa_net_switch_svq(s, true, &err) < 0) {
+            error_prepend(&err, "%s: cannot shadow the virtqueues: ",
+                          s->nc.name);
+            error_report_err(err);
+            /* the pages written by the device would not be migrated */
+            qmp_migrate_cancel(NULL);
+        }
+    } else if (migration_has_failed(migration)) {
+        if (vhost_vdpa_net_switch_svq(s, false, &err) < 0) {
+            error_report_err(err);
+        }
+    }
+}
+
 static int net_vhost_vdpa_init(NetClientState *peer, const char *device,
-                               const char *name, const char *vhostdev)
+                               const char *name, const char *vhostdev,
+                               bool svq)
 {
     NetClientState *nc = NULL;
     VhostVDPAState *s;
@@ -187,7 +263,12 @@ static int net_vhost_vdpa_init(NetClientState *peer, const char *device,
         return -errno;
     }
     s->vhost_vdpa.device_fd = vdpa_device_fd;
+    s->vhost_vdpa.shadow_vqs_allowed = svq;
     ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa);
+    if (svq) {
+        s->migration_state.notify = vhost_vdpa_net_migration_state_notifier;
+        add_migration_state_change_notifier(&s->migration_state);
+    }
     assert(s->vhost_net);
     return ret;
 }
@@ -222,5 +303,6 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
                           (char *)name, errp)) {
         return -1;
     }
-    return net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name, opts->vhostdev);
+    return net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name, opts->vhostdev,
+                               opts->has_x_svq && opts->x_svq);
 }
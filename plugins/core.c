@@ -211,11 +211,63 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->data = g_array_new(false, true, element_size);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
+/*
+ * Make room in the scoreboards for @cpu.  The translated code has the
+ * address of the scoreboards embedded, so if there are any, the resize
+ * is deferred to the code cache flush that is requested here.  The new
+ * vCPU processes that request before it runs any code.
+ */
+static void plugin_grow_scoreboards__locked(CPUState *cpu)
+{
+    size_t size = plugin.scoreboard_alloc_size;
+
+    if (cpu->cpu_index < size) {
+        return;
+    }
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        plugin.scoreboard_alloc_size = size;
+        return;
+    }
+    plugin.scoreboard_pending_size = MAX(plugin.scoreboard_pending_size,
+                                         size);
+    tb_flush(cpu);
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    plugin_grow_scoreboards__locked(cpu);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -292,6 +344,24 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = (qemu_plugin_u64) { NULL, 0 };
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.imm = imm;
 }
 
@@ -308,10 +378,30 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.imm = imm;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
                                  enum qemu_plugin_mem_rw rw,
+                                 const struct qemu_plugin_mem_filter *filter,
                                  void *udata)
 {
     struct qemu_plugin_dyn_cb *dyn_cb;
@@ -322,6 +412,10 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
     dyn_cb->rw = rw;
     dyn_cb->f.generic = cb;
+    dyn_cb->mem.filtered = filter != NULL;
+    if (filter) {
+        dyn_cb->mem.filter = *filter;
+    }
 }
 
 /*
@@ -369,6 +463,51 @@ qemu_plugin_vcpu_syscall(CPUState *cpu, int64_t num, uint64_t a1, uint64_t a2,
     }
 }
 
+/*
+ * Check the access at @vaddr against the filter of @cb.  The range is
+ * checked first, since the attributes need a TLB lookup.
+ */
+static bool plugin_mem_filter_match(const struct qemu_plugin_dyn_cb *cb,
+                                    qemu_plugin_meminfo_t info,
+                                    uint64_t vaddr)
+{
+    const struct qemu_plugin_mem_filter *filter = &cb->mem.filter;
+    struct qemu_plugin_hwaddr *hwaddr;
+    bool is_io;
+
+    if (!cb->mem.filtered) {
+        return true;
+    }
+    if (vaddr < filter->start || vaddr > filter->end) {
+        return false;
+    }
+    if (filter->attr == QEMU_PLUGIN_MEM_ATTR_ANY) {
+        return true;
+    }
+
+    /* there is no hwaddr in user mode, where all accesses are to RAM */
+    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    is_io = hwaddr && qemu_plugin_hwaddr_is_io(hwaddr);
+    return is_io == (filter->attr == QEMU_PLUGIN_MEM_ATTR_IO);
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void qemu_plugin_vcpu_mem_filtered_cb(unsigned int vcpu_index,
+                                      qemu_plugin_meminfo_t info,
+                                      uint64_t vaddr, void *udata)
+{
+    struct qemu_plugin_dyn_cb *cb = udata;
+
+    if (plugin_mem_filter_match(cb, info, vaddr)) {
+        cb->f.vcpu_mem(vcpu_index, info, vaddr, cb->userp);
+    }
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -427,20 +566,50 @@ static bool free_dyn_cb_arr(void *p, uint32_t h, void *userp)
 
 void qemu_plugin_flush_cb(void)
 {
+    struct qemu_plugin_scoreboard *score;
+
     qht_iter_remove(&plugin.dyn_cb_arr_ht, free_dyn_cb_arr, NULL);
     qht_reset(&plugin.dyn_cb_arr_ht);
 
+    /* No translated code refers to the scoreboards anymore */
+    qemu_rec_mutex_lock(&plugin.lock);
+    if (plugin.scoreboard_pending_size > plugin.scoreboard_alloc_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, plugin.scoreboard_pending_size);
+        }
+        plugin.scoreboard_alloc_size = plugin.scoreboard_pending_size;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void *qemu_plugin_u64_base(qemu_plugin_u64 entry, size_t *stride)
+{
+    GArray *data = entry.score->data;
+
+    *stride = g_array_get_element_size(data);
+    return data->data + entry.offset;
+}
+
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
     uint64_t *val = cb->userp;
+    size_t stride;
+
+    if (cb->inline_insn.entry.score) {
+        char *base = qemu_plugin_u64_base(cb->inline_insn.entry, &stride);
+
+        val = (uint64_t *)(base + cpu_index * stride);
+    }
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -464,10 +633,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
-            cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
+            if (plugin_mem_filter_match(cb, info, vaddr)) {
+                cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
+            }
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -515,5 +686,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     atexit(qemu_plugin_atexit_cb);
 }
@@ -0,0 +1,198 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/compat-policy.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/visitor-impl.h"
+#include "qapi/qmp/json-writer.h"
+#include "qapi/qmp/qjson.h"
+
+struct JSONOutputVisitor {
+    Visitor visitor;
+    CompatPolicyOutput deprecated_policy;
+
+    JSONWriter *writer;
+    const char *root_name;
+    unsigned depth; /* Number of unfinished containers */
+};
+
+static JSONOutputVisitor *to_jov(Visitor *v)
+{
+    return container_of(v, JSONOutputVisitor, visitor);
+}
+
+static const char *json_output_name(JSONOutputVisitor *jov, const char *name)
+{
+    return jov->depth ? name : jov->root_name;
+}
+
+static bool json_output_start_struct(Visitor *v, const char *name,
+                                     void **obj, size_t unused, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_start_object(jov->writer, json_output_name(jov, name));
+    jov->depth++;
+    return true;
+}
+
+static void json_output_end_struct(Visitor *v, void **obj)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    assert(jov->depth);
+    jov->depth--;
+    json_writer_end_object(jov->writer);
+}
+
+static bool json_output_start_list(Visitor *v, const char *name,
+                                   GenericList **listp, size_t size,
+                                   Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_start_array(jov->writer, json_output_name(jov, name));
+    jov->depth++;
+    return true;
+}
+
+static GenericList *json_output_next_list(Visitor *v, GenericList *tail,
+                                          size_t size)
+{
+    return tail->next;
+}
+
+static void json_output_end_list(Visitor *v, void **obj)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    assert(jov->depth);
+    jov->depth--;
+    json_writer_end_array(jov->writer);
+}
+
+static bool json_output_type_int64(Visitor *v, const char *name,
+                                   int64_t *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_int64(jov->writer, json_output_name(jov, name), *obj);
+    return true;
+}
+
+static bool json_output_type_uint64(Visitor *v, const char *name,
+                                    uint64_t *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_uint64(jov->writer, json_output_name(jov, name), *obj);
+    return true;
+}
+
+static bool json_output_type_bool(Visitor *v, const char *name, bool *obj,
+                                  Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_bool(jov->writer, json_output_name(jov, name), *obj);
+    return true;
+}
+
+static bool json_output_type_str(Visitor *v, const char *name, char **obj,
+                                 Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_str(jov->writer, json_output_name(jov, name), *obj ?: "");
+    return true;
+}
+
+static bool json_output_type_number(Visitor *v, const char *name,
+                                    double *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_double(jov->writer, json_output_name(jov, name), *obj);
+    return true;
+}
+
+static bool json_output_type_any(Visitor *v, const char *name,
+                                 QObject **obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    qobject_write_json(jov->writer, json_output_name(jov, name), *obj);
+    return true;
+}
+
+static bool json_output_type_null(Visitor *v, const char *name,
+                                  QNull **obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_writer_null(jov->writer, json_output_name(jov, name));
+    return true;
+}
+
+static bool json_output_deprecated(Visitor *v, const char *name)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    return jov->deprecated_policy != COMPAT_POLICY_OUTPUT_HIDE;
+}
+
+static void json_output_complete(Visitor *v, void *opaque)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    /* A visit must have occurred, with each start paired with end.  */
+    assert(!jov->depth);
+}
+
+static void json_output_free(Visitor *v)
+{
+    g_free(to_jov(v));
+}
+
+Visitor *json_output_visitor_new(JSONWriter *writer, const char *name)
+{
+    JSONOutputVisitor *v;
+
+    v = g_malloc0(sizeof(*v));
+
+    v->visitor.type = VISITOR_OUTPUT;
+    v->visitor.start_struct = json_output_start_struct;
+    v->visitor.end_struct = json_output_end_struct;
+    v->visitor.start_list = json_output_start_list;
+    v->visitor.next_list = json_output_next_list;
+    v->visitor.end_list = json_output_end_list;
+    v->visitor.type_int64 = json_output_type_int64;
+    v->visitor.type_uint64 = json_output_type_uint64;
+    v->visitor.type_bool = json_output_type_bool;
+    v->visitor.type_str = json_output_type_str;
+    v->visitor.type_number = json_output_type_number;
+    v->visitor.type_any = json_output_type_any;
+    v->visitor.type_null = json_output_type_null;
+    v->visitor.deprecated = json_output_deprecated;
+    v->visitor.complete = json_output_complete;
+    v->visitor.free = json_output_free;
+
+    v->writer = writer;
+    v->root_name = name;
+
+    return &v->visitor;
+}
+
+void json_output_visitor_set_policy(Visitor *v,
+                                    CompatPolicyOutput deprecated)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    jov->deprecated_policy = deprecated;
+}
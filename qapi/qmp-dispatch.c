@@ -21,6 +21,7 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/qobject-output-visitor.h"
+#include "qapi/json-output-visitor.h"
 #include "sysemu/runstate.h"
 #include "qapi/qmp/qbool.h"
 #include "qemu/coroutine.h"
@@ -44,6 +45,45 @@ Visitor *qobject_output_visitor_new_qmp(QObject **result)
     return v;
 }
 
+typedef struct QmpReturnWriter {
+    JSONWriter *writer;
+    bool written;
+} QmpReturnWriter;
+
+/*
+ * Where the command being run writes its return value.  Commands of a
+ * thread never run concurrently: main loop commands all come from the
+ * single QMP dispatcher coroutine, out-of-band ones from the monitor
+ * I/O thread.
+ */
+static __thread QmpReturnWriter *qmp_return_writer;
+
+Visitor *qmp_return_visitor_new(QObject **result)
+{
+    QmpReturnWriter *rw = qmp_return_writer;
+    Visitor *v;
+
+    if (!rw || rw->written) {
+        return qobject_output_visitor_new_qmp(result);
+    }
+
+    rw->written = true;
+    *result = NULL;
+    v = json_output_visitor_new(rw->writer, "return");
+    json_output_visitor_set_policy(v, compat_policy.deprecated_output);
+    return v;
+}
+
+static void qmp_run_command(const QmpCommand *cmd, QmpReturnWriter *rw,
+                            QDict *args, QObject **ret, Error **errp)
+{
+    QmpReturnWriter *saved = qmp_return_writer;
+
+    qmp_return_writer = rw;
+    cmd->fn(args, ret, errp);
+    qmp_return_writer = saved;
+}
+
 static QDict *qmp_dispatch_check_obj(QDict *dict, bool allow_oob,
                                      Error **errp)
 {
@@ -115,6 +155,7 @@ bool qmp_is_oob(const QDict *dict)
 
 typedef struct QmpDispatchBH {
     const QmpCommand *cmd;
+    QmpReturnWriter *rw;
     Monitor *cur_mon;
     QDict *args;
     QObject **ret;
@@ -128,7 +169,7 @@ static void do_qmp_dispatch_bh(void *opaque)
 
     assert(monitor_cur() == NULL);
     monitor_set_cur(qemu_coroutine_self(), data->cur_mon);
-    data->cmd->fn(data->args, data->ret, data->errp);
+    qmp_run_command(data->cmd, data->rw, data->args, data->ret, data->errp);
     monitor_set_cur(qemu_coroutine_self(), NULL);
     aio_co_wake(data->co);
 }
@@ -136,10 +177,17 @@ static void do_qmp_dispatch_bh(void *opaque)
 /*
  * Runs outside of coroutine context for OOB commands, but in coroutine
  * context for everything else.
+ *
+ * If @writer is non-null, it must be inside an object.  The return
+ * value of a successful command may then be written to it directly as
+ * member "return", in which case the response lacks that member, and
+ * the caller should add the members of the response to @writer.
  */
-QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
-                    bool allow_oob, Monitor *cur_mon)
+QDict *qmp_dispatch_json(const QmpCommandList *cmds, QObject *request,
+                         bool allow_oob, Monitor *cur_mon,
+                         JSONWriter *writer)
 {
+    QmpReturnWriter rw = { .writer = writer };
     Error *err = NULL;
     bool oob;
     const char *command;
@@ -219,7 +267,7 @@ QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
     assert(monitor_cur() == NULL);
     if (!!(cmd->options & QCO_COROUTINE) == qemu_in_coroutine()) {
         monitor_set_cur(qemu_coroutine_self(), cur_mon);
-        cmd->fn(args, &ret, &err);
+        qmp_run_command(cmd, writer ? &rw : NULL, args, &ret, &err);
         monitor_set_cur(qemu_coroutine_self(), NULL);
     } else {
        /*
@@ -239,6 +287,7 @@ QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
         QmpDispatchBH data = {
             .cur_mon    = cur_mon,
             .cmd        = cmd,
+            .rw         = writer ? &rw : NULL,
             .args       = args,
             .ret        = &ret,
             .errp       = &err,
@@ -252,12 +301,17 @@ QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
     if (err) {
         /* or assert(!ret) after reviewing all handlers: */
         qobject_unref(ret);
+        g_assert(!rw.written);
         goto out;
     }
 
     if (cmd->options & QCO_NO_SUCCESS_RESP) {
-        g_assert(!ret);
+        g_assert(!ret && !rw.written);
         return NULL;
+    } else if (rw.written) {
+        g_assert(!ret);
+        rsp = qdict_new();
+        goto out;
     } else if (!ret) {
         /*
          * When the command's schema has no 'returns', cmd->fn()
@@ -284,3 +338,9 @@ out:
 
     return rsp;
 }
+
+QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
+                    bool allow_oob, Monitor *cur_mon)
+{
+    return qmp_dispatch_json(cmds, request, allow_oob, cur_mon, NULL);
+}
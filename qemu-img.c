@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <sys/resource.h>
 
 #include "qemu-common.h"
 #include "qemu-version.h"
@@ -33,6 +34,8 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -40,6 +43,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/rcu.h"
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qom/object_interfaces.h"
@@ -82,6 +86,11 @@ enum {
     OPTION_MERGE = 274,
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
+    OPTION_JOBS = 277,
+    OPTION_IOTHREADS = 278,
+    OPTION_RANDOM = 279,
+    OPTION_RWMIX = 280,
+    OPTION_RATE = 281,
 };
 
 typedef enum OutputFormat {
@@ -1128,18 +1137,9 @@ done:
  */
 static int64_t find_nonzero(const uint8_t *buf, int64_t n)
 {
-    int64_t i;
-    int64_t end = QEMU_ALIGN_DOWN(n, BDRV_SECTOR_SIZE);
+    size_t i = buffer_find_nonzero(buf, n, BDRV_SECTOR_SIZE);
 
-    for (i = 0; i < end; i += BDRV_SECTOR_SIZE) {
-        if (!buffer_is_zero(buf + i, BDRV_SECTOR_SIZE)) {
-            return i;
-        }
-    }
-    if (i < n && !buffer_is_zero(buf + i, n - end)) {
-        return i;
-    }
-    return -1;
+    return i < n ? i : -1;
 }
 
 /*
@@ -1163,10 +1163,16 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
         return 0;
     }
     is_zero = buffer_is_zero(buf, BDRV_SECTOR_SIZE);
-    for(i = 1; i < n; i++) {
-        buf += BDRV_SECTOR_SIZE;
-        if (is_zero != buffer_is_zero(buf, BDRV_SECTOR_SIZE)) {
-            break;
+    if (is_zero) {
+        /* Zero runs can be long, scan them in large chunks */
+        i = buffer_find_nonzero(buf, (size_t)n * BDRV_SECTOR_SIZE,
+                                BDRV_SECTOR_SIZE) / BDRV_SECTOR_SIZE;
+    } else {
+        for (i = 1; i < n; i++) {
+            buf += BDRV_SECTOR_SIZE;
+            if (buffer_is_zero(buf, BDRV_SECTOR_SIZE)) {
+                break;
+            }
         }
     }
 
@@ -1278,11 +1284,11 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
  * @param bytes: Number of bytes to check
  * @param filename: Name of disk file we are checking (logging purpose)
  * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
+ * @param mismatch: Set to the offset of the first non-zero byte
  */
 static int check_empty_sectors(BlockBackend *blk, int64_t offset,
                                int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+                               uint8_t *buffer, int64_t *mismatch)
 {
     int ret = 0;
     int64_t idx;
@@ -1295,14 +1301,230 @@ static int check_empty_sectors(BlockBackend *blk, int64_t offset,
     }
     idx = find_nonzero(buffer, bytes);
     if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
+        *mismatch = offset + idx;
         return 1;
     }
 
     return 0;
 }
 
+#define COMPARE_MAX_COROUTINES 16
+
+typedef enum ImgCompareFailure {
+    COMPARE_FAIL_ERROR,     /* already reported */
+    COMPARE_FAIL_CONTENT,
+    COMPARE_FAIL_STATUS,
+} ImgCompareFailure;
+
+/* What a compare coroutine does with a chunk */
+typedef enum ImgCompareAction {
+    COMPARE_SKIP,           /* both zero or both unallocated */
+    COMPARE_DATA,           /* read both images and compare */
+    COMPARE_EMPTY1,         /* only the first image has data */
+    COMPARE_EMPTY2,         /* only the second image has data */
+} ImgCompareAction;
+
+typedef struct ImgCompareState {
+    BlockBackend *blk[2];
+    const char *filename[2];
+    int64_t total_size[2];
+    int64_t progress_base;
+    bool strict;
+
+    /*
+     * Offsets from @offset to @end remain to be compared.  With @over set,
+     * only the image at that index covers them, and they must read as
+     * zeroes.
+     */
+    int64_t offset;
+    int64_t end;
+    int over;
+
+    /* Held while choosing the next chunk */
+    CoMutex lock;
+    long num_coroutines;
+    int running_coroutines;
+
+    /*
+     * The failure at the lowest offset.  Chunks after it are not compared,
+     * but those before it still are, so that the same mismatch is reported
+     * as with a sequential comparison.
+     */
+    int64_t fail_offset;
+    ImgCompareFailure fail;
+    int ret;
+} ImgCompareState;
+
+static void img_compare_fail(ImgCompareState *s, int64_t offset, int ret,
+                             ImgCompareFailure fail)
+{
+    if (offset < s->fail_offset) {
+        s->fail_offset = offset;
+        s->fail = fail;
+        s->ret = ret;
+    }
+}
+
+/*
+ * Choose the chunk that starts at s->offset from the block status of the
+ * images, and advance s->offset past it.  Returns 0 on success and an exit
+ * status on failure.
+ */
+static int coroutine_fn img_compare_next_chunk(ImgCompareState *s,
+                                               int64_t *chunk,
+                                               ImgCompareAction *action)
+{
+    int64_t offset = s->offset;
+    int64_t pnum[2];
+    int status[2];
+    bool allocated[2];
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (s->over >= 0 && i != s->over) {
+            continue;
+        }
+        status[i] = bdrv_block_status_above(blk_bs(s->blk[i]), NULL, offset,
+                                            s->total_size[i] - offset,
+                                            &pnum[i], NULL, NULL);
+        if (status[i] < 0) {
+            error_report("Sector allocation test failed for %s",
+                         s->filename[i]);
+            img_compare_fail(s, offset, 3, COMPARE_FAIL_ERROR);
+            return 3;
+        }
+        allocated[i] = status[i] & BDRV_BLOCK_ALLOCATED;
+    }
+
+    if (s->over >= 0) {
+        i = s->over;
+        *chunk = pnum[i];
+        *action = COMPARE_SKIP;
+        if (allocated[i] && !(status[i] & BDRV_BLOCK_ZERO)) {
+            *chunk = MIN(*chunk, IO_BUF_SIZE);
+            *action = i ? COMPARE_EMPTY2 : COMPARE_EMPTY1;
+        }
+    } else {
+        assert(pnum[0] && pnum[1]);
+        *chunk = MIN(MIN(pnum[0], pnum[1]), s->end - offset);
+
+        if (s->strict && status[0] != status[1]) {
+            img_compare_fail(s, offset, 1, COMPARE_FAIL_STATUS);
+            return 1;
+        }
+
+        if ((status[0] & BDRV_BLOCK_ZERO) && (status[1] & BDRV_BLOCK_ZERO)) {
+            *action = COMPARE_SKIP;
+        } else if (allocated[0] == allocated[1]) {
+            *action = allocated[0] ? COMPARE_DATA : COMPARE_SKIP;
+        } else {
+            *action = allocated[0] ? COMPARE_EMPTY1 : COMPARE_EMPTY2;
+        }
+        if (*action != COMPARE_SKIP) {
+            *chunk = MIN(*chunk, IO_BUF_SIZE);
+        }
+    }
+
+    s->offset += *chunk;
+    return 0;
+}
+
+static int coroutine_fn img_compare_chunk(ImgCompareState *s, int64_t offset,
+                                          int64_t chunk,
+                                          ImgCompareAction action,
+                                          uint8_t *buf1, uint8_t *buf2,
+                                          int64_t *mismatch)
+{
+    int64_t pnum;
+    int ret, i;
+
+    switch (action) {
+    case COMPARE_SKIP:
+        return 0;
+
+    case COMPARE_EMPTY1:
+    case COMPARE_EMPTY2:
+        i = action == COMPARE_EMPTY2;
+        return check_empty_sectors(s->blk[i], offset, chunk, s->filename[i],
+                                   buf1, mismatch);
+
+    case COMPARE_DATA:
+        for (i = 0; i < 2; i++) {
+            ret = blk_pread(s->blk[i], offset, i ? buf2 : buf1, chunk);
+            if (ret < 0) {
+                error_report("Error while reading offset %" PRId64 " of %s: %s",
+                             offset, s->filename[i], strerror(-ret));
+                return 4;
+            }
+        }
+        ret = compare_buffers(buf1, buf2, chunk, &pnum);
+        if (ret || pnum != chunk) {
+            *mismatch = offset + (ret ? 0 : pnum);
+            return 1;
+        }
+        return 0;
+    }
+
+    abort();
+}
+
+static void coroutine_fn img_compare_co(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1 = blk_blockalign(s->blk[0], IO_BUF_SIZE);
+    uint8_t *buf2 = blk_blockalign(s->blk[1], IO_BUF_SIZE);
+
+    s->running_coroutines++;
+
+    while (true) {
+        ImgCompareAction action;
+        int64_t offset, chunk, mismatch;
+        int ret;
+
+        qemu_co_mutex_lock(&s->lock);
+        offset = s->offset;
+        if (offset >= MIN(s->end, s->fail_offset) ||
+            img_compare_next_chunk(s, &chunk, &action)) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        ret = img_compare_chunk(s, offset, chunk, action, buf1, buf2,
+                                &mismatch);
+        if (ret) {
+            img_compare_fail(s, ret == 1 ? mismatch : offset, ret,
+                             ret == 1 ? COMPARE_FAIL_CONTENT :
+                                        COMPARE_FAIL_ERROR);
+        }
+        qemu_progress_print(((float) chunk / s->progress_base) * 100, 100);
+    }
+
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
+/*
+ * Compare the range from s->offset to @end with s->num_coroutines
+ * coroutines, each reading and comparing its own chunk.
+ */
+static void img_compare_range(ImgCompareState *s, int64_t end, int over)
+{
+    int i;
+
+    s->end = end;
+    s->over = over;
+    for (i = 0; i < s->num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(img_compare_co, s);
+        qemu_coroutine_enter(co);
+    }
+
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1314,22 +1536,18 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
     int64_t total_size;
-    int64_t offset = 0;
-    int64_t chunk;
     int c;
     uint64_t progress_base;
     bool image_opts = false;
     bool force_share = false;
+    long num_coroutines = 8;
+    ImgCompareState s;
 
     cache = BDRV_DEFAULT_CACHE;
     for (;;) {
@@ -1340,7 +1558,7 @@ static int img_compare(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:T:pqsUm:",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1376,6 +1594,15 @@ static int img_compare(int argc, char **argv)
         case 'U':
             force_share = true;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > COMPARE_MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d",
+                             COMPARE_MAX_COROUTINES);
+                exit(2);
+            }
+            break;
         case OPTION_OBJECT:
             {
                 Error *local_err = NULL;
@@ -1433,11 +1660,7 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1463,131 +1686,40 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
+    s = (ImgCompareState) {
+        .blk = { blk1, blk2 },
+        .filename = { filename1, filename2 },
+        .total_size = { total_size1, total_size2 },
+        .progress_base = progress_base,
+        .strict = strict,
+        .num_coroutines = num_coroutines,
+        .fail_offset = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
 
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+    img_compare_range(&s, total_size, -1);
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, buf1, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, buf2, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    if (s.fail_offset == INT64_MAX && total_size1 != total_size2) {
+        qprintf(quiet, "Warning: Image size mismatch!\n");
+        img_compare_range(&s, progress_base, total_size1 > total_size2 ? 0 : 1);
     }
 
-    if (total_size1 != total_size2) {
-        BlockBackend *blk_over;
-        const char *filename_over;
-
-        qprintf(quiet, "Warning: Image size mismatch!\n");
-        if (total_size1 > total_size2) {
-            blk_over = blk1;
-            filename_over = filename1;
-        } else {
-            blk_over = blk2;
-            filename_over = filename2;
-        }
-
-        while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
-            if (ret < 0) {
-                ret = 3;
-                error_report("Sector allocation test failed for %s",
-                             filename_over);
-                goto out;
-
-            }
-            if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
-                if (ret) {
-                    goto out;
-                }
-            }
-            offset += chunk;
-            qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    if (s.fail_offset != INT64_MAX) {
+        if (s.fail == COMPARE_FAIL_CONTENT) {
+            qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
+                    s.fail_offset);
+        } else if (s.fail == COMPARE_FAIL_STATUS) {
+            qprintf(quiet, "Strict mode: Offset %" PRId64
+                    " block status mismatch!\n", s.fail_offset);
         }
+        ret = s.ret;
+        goto out;
     }
 
     qprintf(quiet, "Images are identical.\n");
     ret = 0;
 
 out:
-    qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1622,6 +1754,19 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/*
+ * Maximum number of block status extents that are remembered from the
+ * pass that counts the allocated sectors (24 MB worth of extents).  The
+ * copy beyond the last remembered extent queries the block status again.
+ */
+#define CONVERT_MAX_EXTENTS (1 << 20)
+
+typedef struct ImgConvertExtent {
+    int64_t start;
+    int64_t end;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1634,6 +1779,9 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents;
+    bool record_extents;
+    guint next_extent;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1668,6 +1816,35 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * Look up the block status of @sector_num in the extents that were
+ * recorded while counting the allocated sectors, so that the copy does
+ * not have to query it again under s->lock.  Returns false if the status
+ * has to be queried.
+ */
+static bool convert_lookup_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *e;
+
+    if (!s->extents || s->record_extents) {
+        return false;
+    }
+
+    while (s->next_extent < s->extents->len) {
+        e = &g_array_index(s->extents, ImgConvertExtent, s->next_extent);
+        if (e->end > sector_num) {
+            if (e->start > sector_num) {
+                return false;
+            }
+            s->status = e->status;
+            s->sector_next_status = e->end;
+            return true;
+        }
+        s->next_extent++;
+    }
+    return false;
+}
+
 static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
     int64_t src_cur_offset;
@@ -1689,7 +1866,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    if (s->sector_next_status <= sector_num &&
+        !convert_lookup_extent(s, sector_num)) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1752,6 +1930,15 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+
+        if (s->record_extents && s->extents->len < CONVERT_MAX_EXTENTS) {
+            ImgConvertExtent e = {
+                .start = sector_num,
+                .end = s->sector_next_status,
+                .status = s->status,
+            };
+            g_array_append_val(s->extents, e);
+        }
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -2044,6 +2231,8 @@ retry:
 
 static int convert_do_copy(ImgConvertState *s)
 {
+    g_autoptr(GArray) extents = g_array_new(false, false,
+                                            sizeof(ImgConvertExtent));
     int ret, i, n;
     int64_t sector_num = 0;
 
@@ -2063,9 +2252,17 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
+    /*
+     * Remember the block status while counting the allocated sectors, so
+     * that the copy coroutines only wait for each other on reads and
+     * writes and not on block status queries as well.
+     */
+    s->extents = extents;
+    s->record_extents = true;
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
         if (n < 0) {
+            s->extents = NULL;
             return n;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
@@ -2076,6 +2273,8 @@ static int convert_do_copy(ImgConvertState *s)
     }
 
     /* Do the copy */
+    s->record_extents = false;
+    s->next_extent = 0;
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
 
@@ -2089,6 +2288,7 @@ static int convert_do_copy(ImgConvertState *s)
     while (s->running_coroutines) {
         main_loop_wait(false);
     }
+    s->extents = NULL;
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2101,6 +2301,19 @@ static int convert_do_copy(ImgConvertState *s)
     return s->ret;
 }
 
+/*
+ * Write order does not matter for the layout of host block devices, so
+ * writes to them may complete out of order even without -W.
+ */
+static bool convert_target_is_host_device(BlockDriverState *bs)
+{
+    /* raw only forwards requests to its file */
+    if (!strcmp(bs->drv->format_name, "raw") && bs->file) {
+        bs = bs->file->bs;
+    }
+    return !strcmp(bs->drv->format_name, "host_device");
+}
+
 static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst)
 {
     BdrvDirtyBitmap *bm;
@@ -2670,6 +2883,10 @@ static int img_convert(int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    if (!s.compressed && convert_target_is_host_device(out_bs)) {
+        s.wr_in_order = false;
+    }
+
     if (rate_limit) {
         set_rate_limit(s.target, rate_limit);
     }
@@ -4173,8 +4390,46 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+typedef struct BenchData BenchData;
+
+/* An I/O thread running the AioContext of one instance of the image */
+typedef struct BenchIOThread {
+    QemuThread thread;
+    AioContext *ctx;
+    BlockBackend *blk;
+    bool stopping;
+} BenchIOThread;
+
+/* Completed requests of a job in one direction */
+typedef struct BenchStats {
+    uint64_t *lat_ns;
+    int64_t nr;
+    uint64_t bytes;
+} BenchStats;
+
+/* One stream of requests, with its own queue depth and statistics */
+typedef struct BenchJob {
+    BenchData *b;
+    int index;
     BlockBackend *blk;
+    AioContext *ctx;
+    GRand *rand;
+    uint8_t *buf;
+
+    int submitted;
+    int in_flight;
+    int running;
+    int next_slot;
+    bool in_flush;
+    CoQueue flush_queue;
+    uint64_t offset;
+    int64_t start_ns;
+
+    BenchStats read;
+    BenchStats write;
+} BenchJob;
+
+struct BenchData {
     uint64_t image_size;
     bool write;
     int bufsize;
@@ -4183,85 +4438,335 @@ typedef struct BenchData {
     int n;
     int flush_interval;
     bool drain_on_flush;
-    uint8_t *buf;
-    QEMUIOVector *qiov;
-
-    int in_flight;
-    bool in_flush;
+    bool random;
+    int rwmix;
+    int64_t interval_ns;
     uint64_t offset;
-} BenchData;
 
-static void bench_undrained_flush_cb(void *opaque, int ret)
+    int nr_jobs;
+    BenchJob *jobs;
+    int running;
+    QemuEvent done;
+};
+
+static void *bench_iothread_run(void *opaque)
 {
-    if (ret < 0) {
-        error_report("Failed flush request: %s", strerror(-ret));
-        exit(EXIT_FAILURE);
+    BenchIOThread *t = opaque;
+
+    rcu_register_thread();
+    qemu_set_current_aio_context(t->ctx);
+
+    while (!qatomic_read(&t->stopping)) {
+        aio_poll(t->ctx, true);
     }
+
+    rcu_unregister_thread();
+    return NULL;
 }
 
-static void bench_cb(void *opaque, int ret)
+static void bench_iothread_stop_bh(void *opaque)
 {
-    BenchData *b = opaque;
-    BlockAIOCB *acb;
+    BenchIOThread *t = opaque;
 
+    qatomic_set(&t->stopping, true);
+}
+
+static void bench_iothread_start(BenchIOThread *t)
+{
+    t->ctx = aio_context_new(&error_abort);
+    qemu_thread_create(&t->thread, "bench-iothread", bench_iothread_run, t,
+                       QEMU_THREAD_JOINABLE);
+}
+
+static void bench_iothread_join(BenchIOThread *t)
+{
+    aio_bh_schedule_oneshot(t->ctx, bench_iothread_stop_bh, t);
+    qemu_thread_join(&t->thread);
+    aio_context_unref(t->ctx);
+}
+
+static uint64_t bench_next_offset(BenchJob *job)
+{
+    BenchData *b = job->b;
+    uint64_t offset;
+
+    if (b->random) {
+        uint64_t nr_blocks = MAX(b->image_size / b->bufsize, 1);
+        uint64_t r = ((uint64_t)g_rand_int(job->rand) << 32) |
+                     g_rand_int(job->rand);
+
+        return (r % nr_blocks) * b->bufsize;
+    }
+
+    offset = job->offset;
+    job->offset += b->step;
+    job->offset %= b->image_size;
+    return offset;
+}
+
+static void coroutine_fn bench_flush(BenchJob *job)
+{
+    BenchData *b = job->b;
+    int ret;
+
+    if (b->drain_on_flush) {
+        job->in_flush = true;
+        while (job->in_flight > 0) {
+            qemu_co_queue_wait(&job->flush_queue, NULL);
+        }
+    }
+
+    ret = blk_co_flush(job->blk);
     if (ret < 0) {
-        error_report("Failed request: %s", strerror(-ret));
+        error_report("Failed flush request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
 
-    if (b->in_flush) {
-        /* Just finished a flush with drained queue: Start next requests */
-        assert(b->in_flight == 0);
-        b->in_flush = false;
-    } else if (b->in_flight > 0) {
-        int remaining = b->n - b->in_flight;
+    if (b->drain_on_flush) {
+        job->in_flush = false;
+        qemu_co_queue_restart_all(&job->flush_queue);
+    }
+}
 
-        b->n--;
-        b->in_flight--;
+/* Issue requests from one of the job's @nrreq queue slots */
+static void coroutine_fn bench_co(void *opaque)
+{
+    BenchJob *job = opaque;
+    BenchData *b = job->b;
+    QEMUIOVector qiov;
+    int slot = job->next_slot++;
+
+    qemu_iovec_init_buf(&qiov, job->buf + (size_t)slot * b->bufsize,
+                        b->bufsize);
+
+    while (job->submitted < b->n) {
+        int i = job->submitted++;
+        bool write = b->write;
+        BenchStats *stats;
+        uint64_t offset;
+        int64_t start, end;
+        int ret;
 
-        /* Time for flush? Drain queue if requested, then flush */
-        if (b->flush_interval && remaining % b->flush_interval == 0) {
-            if (!b->in_flight || !b->drain_on_flush) {
-                BlockCompletionFunc *cb;
+        if (b->flush_interval && i && i % b->flush_interval == 0) {
+            bench_flush(job);
+        }
+        while (job->in_flush) {
+            qemu_co_queue_wait(&job->flush_queue, NULL);
+        }
 
-                if (b->drain_on_flush) {
-                    b->in_flush = true;
-                    cb = bench_cb;
-                } else {
-                    cb = bench_undrained_flush_cb;
-                }
+        /*
+         * In open-loop mode, latency counts from the time the request was
+         * due, so requests delayed by a full queue are not under-reported.
+         */
+        start = get_clock();
+        if (b->interval_ns) {
+            int64_t due = job->start_ns + i * b->interval_ns;
 
-                acb = blk_aio_flush(b->blk, cb, b);
-                if (!acb) {
-                    error_report("Failed to issue flush request");
-                    exit(EXIT_FAILURE);
-                }
-            }
-            if (b->drain_on_flush) {
-                return;
+            if (due > start) {
+                qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, due - start);
             }
+            start = due;
         }
-    }
 
-    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
-        /* blk_aio_* might look for completed I/Os and kick bench_cb
-         * again, so make sure this operation is counted by in_flight
-         * and b->offset is ready for the next submission.
-         */
-        b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        if (b->rwmix >= 0) {
+            write = g_rand_int_range(job->rand, 0, 100) >= b->rwmix;
+        }
+        offset = bench_next_offset(job);
+
+        job->in_flight++;
+        if (write) {
+            ret = blk_co_pwritev(job->blk, offset, b->bufsize, &qiov, 0);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            ret = blk_co_preadv(job->blk, offset, b->bufsize, &qiov, 0);
         }
-        if (!acb) {
-            error_report("Failed to issue request");
+        job->in_flight--;
+        end = get_clock();
+
+        if (ret < 0) {
+            error_report("Failed request: %s", strerror(-ret));
             exit(EXIT_FAILURE);
         }
+
+        stats = write ? &job->write : &job->read;
+        stats->lat_ns[stats->nr++] = end - start;
+        stats->bytes += b->bufsize;
+
+        if (job->in_flush && !job->in_flight) {
+            qemu_co_queue_restart_all(&job->flush_queue);
+        }
+    }
+
+    if (--job->running == 0 && qatomic_fetch_dec(&b->running) == 1) {
+        qemu_event_set(&b->done);
+    }
+}
+
+static void bench_job_start(BenchJob *job)
+{
+    int i;
+
+    job->start_ns = get_clock();
+    job->running = job->b->nrreq;
+    for (i = 0; i < job->b->nrreq; i++) {
+        aio_co_enter(job->ctx, qemu_coroutine_create(bench_co, job));
+    }
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* @permille-th latency of the sorted array @lat with @n entries */
+static uint64_t bench_percentile(const uint64_t *lat, int64_t n,
+                                 unsigned permille)
+{
+    return lat[(n - 1) * permille / 1000];
+}
+
+static const unsigned bench_percentiles[] = { 500, 990, 999 };
+
+/* Sort @s->lat_ns and describe @s in the style of fio's JSON output */
+static QDict *bench_stats_to_qdict(BenchStats *s, int64_t runtime_ns)
+{
+    QDict *dict = qdict_new();
+    QDict *lat = qdict_new();
+    QDict *pct = qdict_new();
+    uint64_t sum = 0;
+    int64_t i;
+
+    qsort(s->lat_ns, s->nr, sizeof(uint64_t), bench_cmp_u64);
+    for (i = 0; i < s->nr; i++) {
+        sum += s->lat_ns[i];
     }
+
+    qdict_put_int(dict, "io_bytes", s->bytes);
+    qdict_put_int(dict, "total_ios", s->nr);
+    qdict_put(dict, "iops",
+              qnum_from_double((double)s->nr * NANOSECONDS_PER_SECOND /
+                               runtime_ns));
+    qdict_put(dict, "bw_bytes",
+              qnum_from_double((double)s->bytes * NANOSECONDS_PER_SECOND /
+                               runtime_ns));
+
+    if (s->nr) {
+        qdict_put_int(lat, "min", s->lat_ns[0]);
+        qdict_put_int(lat, "max", s->lat_ns[s->nr - 1]);
+        qdict_put(lat, "mean", qnum_from_double((double)sum / s->nr));
+        for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+            g_autofree char *key =
+                g_strdup_printf("%.6f", bench_percentiles[i] / 10.0);
+
+            qdict_put_int(pct, key, bench_percentile(s->lat_ns, s->nr,
+                                                     bench_percentiles[i]));
+        }
+    }
+    qdict_put(lat, "percentile", pct);
+    qdict_put(dict, "lat_ns", lat);
+
+    return dict;
+}
+
+static void bench_print_stats(const char *name, QDict *dict)
+{
+    QDict *lat = qdict_get_qdict(dict, "lat_ns");
+    QDict *pct = qdict_get_qdict(lat, "percentile");
+
+    if (!qdict_get_int(dict, "total_ios")) {
+        return;
+    }
+    printf("  %s: %" PRId64 " requests, %.0f IOPS, %.2f MiB/s, "
+           "latency mean %.0f ns, p50 %" PRId64 " ns, p99 %" PRId64 " ns, "
+           "p99.9 %" PRId64 " ns\n",
+           name, qdict_get_int(dict, "total_ios"),
+           qdict_get_double(dict, "iops"),
+           qdict_get_double(dict, "bw_bytes") / MiB,
+           qdict_get_double(lat, "mean"),
+           qdict_get_int(pct, "50.000000"), qdict_get_int(pct, "99.000000"),
+           qdict_get_int(pct, "99.900000"));
+}
+
+/* Merge the statistics of all jobs into @total */
+static void bench_stats_merge(BenchStats *total, BenchData *b, bool write)
+{
+    int i;
+
+    total->nr = 0;
+    total->bytes = 0;
+    for (i = 0; i < b->nr_jobs; i++) {
+        total->nr += write ? b->jobs[i].write.nr : b->jobs[i].read.nr;
+    }
+    total->lat_ns = g_new(uint64_t, total->nr ?: 1);
+    total->nr = 0;
+    for (i = 0; i < b->nr_jobs; i++) {
+        BenchStats *s = write ? &b->jobs[i].write : &b->jobs[i].read;
+
+        memcpy(total->lat_ns + total->nr, s->lat_ns,
+               s->nr * sizeof(uint64_t));
+        total->nr += s->nr;
+        total->bytes += s->bytes;
+    }
+}
+
+static int64_t bench_timeval_ns(const struct timeval *tv)
+{
+    return tv->tv_sec * NANOSECONDS_PER_SECOND + tv->tv_usec * SCALE_US;
+}
+
+static void bench_report(BenchData *b, int64_t runtime_ns,
+                         const struct rusage *ru1, const struct rusage *ru2,
+                         OutputFormat output_format)
+{
+    double usr = 100.0 * (bench_timeval_ns(&ru2->ru_utime) -
+                          bench_timeval_ns(&ru1->ru_utime)) / runtime_ns;
+    double sys = 100.0 * (bench_timeval_ns(&ru2->ru_stime) -
+                          bench_timeval_ns(&ru1->ru_stime)) / runtime_ns;
+    QDict *result = qdict_new();
+    QList *jobs = qlist_new();
+    QDict *total = qdict_new();
+    BenchStats all;
+    int i;
+
+    for (i = 0; i < b->nr_jobs; i++) {
+        BenchJob *job = &b->jobs[i];
+        QDict *dict = qdict_new();
+        g_autofree char *name = g_strdup_printf("job%d", i);
+
+        qdict_put_str(dict, "jobname", name);
+        qdict_put(dict, "read", bench_stats_to_qdict(&job->read, runtime_ns));
+        qdict_put(dict, "write",
+                  bench_stats_to_qdict(&job->write, runtime_ns));
+        qlist_append(jobs, dict);
+    }
+
+    bench_stats_merge(&all, b, false);
+    qdict_put(total, "read", bench_stats_to_qdict(&all, runtime_ns));
+    g_free(all.lat_ns);
+    bench_stats_merge(&all, b, true);
+    qdict_put(total, "write", bench_stats_to_qdict(&all, runtime_ns));
+    g_free(all.lat_ns);
+
+    qdict_put_int(result, "runtime_ns", runtime_ns);
+    qdict_put(result, "usr_cpu", qnum_from_double(usr));
+    qdict_put(result, "sys_cpu", qnum_from_double(sys));
+    qdict_put(result, "jobs", jobs);
+    qdict_put(result, "total", total);
+
+    if (output_format == OFORMAT_JSON) {
+        GString *str = qobject_to_json_pretty(QOBJECT(result), true);
+
+        printf("%s\n", str->str);
+        g_string_free(str, true);
+    } else {
+        printf("Run completed in %3.3f seconds.\n",
+               (double)runtime_ns / NANOSECONDS_PER_SECOND);
+        bench_print_stats("read", qdict_get_qdict(total, "read"));
+        bench_print_stats("write", qdict_get_qdict(total, "write"));
+        printf("  cpu: usr %.1f%%, sys %.1f%%\n", usr, sys);
+    }
+    qobject_unref(result);
 }
 
 static int img_bench(int argc, char **argv)
@@ -4279,12 +4784,21 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    bool random = false;
+    int rwmix = -1;
+    int64_t rate = 0;
+    int nr_jobs = 1;
+    int nr_iothreads = 0;
+    const char *output = NULL;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
+    BenchIOThread *iothreads = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
-    struct timeval t1, t2;
+    int64_t t1, t2;
+    struct rusage ru1, ru2;
     int i;
     bool force_share = false;
     size_t buf_size;
@@ -4294,9 +4808,16 @@ static int img_bench(int argc, char **argv)
             {"help", no_argument, 0, 'h'},
             {"flush-interval", required_argument, 0, OPTION_FLUSH_INTERVAL},
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
+            {"object", required_argument, 0, OPTION_OBJECT},
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"jobs", required_argument, 0, OPTION_JOBS},
+            {"iothreads", required_argument, 0, OPTION_IOTHREADS},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"rwmix", required_argument, 0, OPTION_RWMIX},
+            {"rate", required_argument, 0, OPTION_RATE},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4430,6 +4951,61 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_OBJECT:
+            user_creatable_process_cmdline(optarg);
+            break;
+        case OPTION_JOBS:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res < 1 ||
+                res > INT_MAX) {
+                error_report("Invalid number of jobs specified");
+                return 1;
+            }
+            nr_jobs = res;
+            break;
+        }
+        case OPTION_IOTHREADS:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > INT_MAX) {
+                error_report("Invalid number of iothreads specified");
+                return 1;
+            }
+            nr_iothreads = res;
+            break;
+        }
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_RWMIX:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            rwmix = res;
+            break;
+        }
+        case OPTION_RATE:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res < 1 ||
+                res > NANOSECONDS_PER_SECOND) {
+                error_report("Invalid request rate specified");
+                return 1;
+            }
+            rate = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            output = optarg;
+            break;
         }
     }
 
@@ -4438,6 +5014,15 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (output && !strcmp(output, "json")) {
+        output_format = OFORMAT_JSON;
+    } else if (output && !strcmp(output, "human")) {
+        output_format = OFORMAT_HUMAN;
+    } else if (output) {
+        error_report("--output must be used with human or json as argument.");
+        return 1;
+    }
+
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
@@ -4448,6 +5033,22 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    if (!is_write && rwmix >= 0) {
+        error_report("--rwmix is only available in write tests");
+        ret = -1;
+        goto out;
+    }
+    if (random && !bufsize) {
+        error_report("Random tests need a non-zero buffer size");
+        ret = -1;
+        goto out;
+    }
+    if (is_write && nr_iothreads > 1) {
+        /* Each I/O thread opens its own instance of the image */
+        error_report("Write tests support at most one iothread");
+        ret = -1;
+        goto out;
+    }
 
     blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
                    force_share);
@@ -4463,7 +5064,6 @@ static int img_bench(int argc, char **argv)
     }
 
     data = (BenchData) {
-        .blk            = blk,
         .image_size     = image_size,
         .bufsize        = bufsize,
         .step           = step ?: bufsize,
@@ -4473,45 +5073,117 @@ static int img_bench(int argc, char **argv)
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .random         = random,
+        .rwmix          = rwmix,
+        .interval_ns    = rate ? NANOSECONDS_PER_SECOND * nr_jobs / rate : 0,
+        .nr_jobs        = nr_jobs,
+        .running        = nr_jobs,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Sending %d %s%s requests, %d bytes each, %d in parallel "
+               "(starting at offset %" PRId64 ", step size %d)\n",
+               data.n, random ? "random " : "",
+               rwmix >= 0 ? "mixed" : data.write ? "write" : "read",
+               data.bufsize, data.nrreq, data.offset, data.step);
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
+        if (nr_jobs > 1 || nr_iothreads) {
+            printf("Running %d jobs on %d iothreads\n", nr_jobs,
+                   nr_iothreads);
+        }
+        if (rate) {
+            printf("Issuing %" PRId64 " requests per second\n", rate);
+        }
     }
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
-
-    blk_register_buf(blk, data.buf, buf_size);
-
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
+    /*
+     * An image graph is bound to a single AioContext, so every I/O thread
+     * beyond the first one drives a separate instance of the image.
+     */
+    iothreads = g_new0(BenchIOThread, nr_iothreads);
+    for (i = 0; i < nr_iothreads; i++) {
+        Error *local_err = NULL;
+        BenchIOThread *t = &iothreads[i];
+
+        t->blk = i ? img_open(image_opts, filename, fmt, flags, writethrough,
+                              quiet, force_share) : blk;
+        if (!t->blk) {
+            ret = -1;
+            goto out;
+        }
+        bench_iothread_start(t);
+        if (blk_set_aio_context(t->blk, t->ctx, &local_err) < 0) {
+            error_report_err(local_err);
+            ret = -1;
+            goto out;
+        }
     }
 
-    gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
-
-    while (data.n > 0) {
-        main_loop_wait(false);
+    qemu_event_init(&data.done, false);
+    buf_size = data.nrreq * data.bufsize;
+    data.jobs = g_new0(BenchJob, nr_jobs);
+    for (i = 0; i < nr_jobs; i++) {
+        BenchJob *job = &data.jobs[i];
+
+        job->b = &data;
+        job->index = i;
+        job->blk = nr_iothreads ? iothreads[i % nr_iothreads].blk : blk;
+        job->ctx = blk_get_aio_context(job->blk);
+        job->rand = g_rand_new_with_seed(i);
+        job->offset = data.offset;
+        job->read.lat_ns = g_new(uint64_t, data.n);
+        job->write.lat_ns = g_new(uint64_t, data.n);
+        qemu_co_queue_init(&job->flush_queue);
+        job->buf = blk_blockalign(job->blk, buf_size);
+        memset(job->buf, pattern, buf_size);
+        blk_register_buf(job->blk, job->buf, buf_size);
+    }
+
+    getrusage(RUSAGE_SELF, &ru1);
+    t1 = get_clock();
+    for (i = 0; i < nr_jobs; i++) {
+        bench_job_start(&data.jobs[i]);
+    }
+
+    if (nr_iothreads) {
+        qemu_event_wait(&data.done);
+    } else {
+        while (qatomic_read(&data.running) > 0) {
+            main_loop_wait(false);
+        }
     }
-    gettimeofday(&t2, NULL);
+    t2 = get_clock();
+    getrusage(RUSAGE_SELF, &ru2);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    bench_report(&data, t2 - t1, &ru1, &ru2, output_format);
 
 out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf);
+    for (i = 0; iothreads && i < nr_iothreads && iothreads[i].ctx; i++) {
+        BenchIOThread *t = &iothreads[i];
+
+        aio_context_acquire(t->ctx);
+        blk_set_aio_context(t->blk, qemu_get_aio_context(), NULL);
+        aio_context_release(t->ctx);
+        bench_iothread_join(t);
+    }
+    for (i = 0; data.jobs && i < data.nr_jobs; i++) {
+        BenchJob *job = &data.jobs[i];
+
+        blk_unregister_buf(job->blk, job->buf);
+        qemu_vfree(job->buf);
+        g_free(job->read.lat_ns);
+        g_free(job->write.lat_ns);
+        g_rand_free(job->rand);
+    }
+    g_free(data.jobs);
+    for (i = 1; iothreads && i < nr_iothreads && iothreads[i].blk; i++) {
+        blk_unref(iothreads[i].blk);
+    }
+    g_free(iothreads);
+    if (data.jobs) {
+        qemu_event_destroy(&data.done);
     }
-    qemu_vfree(data.buf);
     blk_unref(blk);
 
     if (ret) {
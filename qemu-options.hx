@@ -139,9 +139,15 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                perfmap=on|off (write a perf map of the TCG code, default=off)\n"
+    "                jitdump=on|off (write a perf jitdump of the TCG code, default=off)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reap-interval=n (max ms between KVM dirty ring collections, default 1000)\n"
+    "                dirty-log-threads=n (threads fetching KVM dirty bitmaps, default 4)\n"
+    "                halt-poll-max-ns=n (max ns a halted vCPU busy waits, default 0)\n"
+    "                halt-poll-grow=n, halt-poll-shrink=n (tune halt polling)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -166,6 +172,18 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``perfmap=on|off``
+        Write a ``/tmp/perf-<pid>.map`` file describing the translation
+        blocks, so that ``perf`` can attribute the time spent in the TCG
+        code cache to guest addresses (default=off). When the code cache
+        is flushed, the host addresses get reused and the map becomes
+        ambiguous; use ``jitdump`` for long runs.
+
+    ``jitdump=on|off``
+        Write a ``jit-<pid>.dump`` file in the current directory, including
+        the host code of the translation blocks, for use with
+        ``perf record -k 1`` and ``perf inject --jit`` (default=off).
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
@@ -193,6 +211,36 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reap-interval=n``
+        When the KVM dirty ring is enabled, a background thread collects
+        the dirty pages of all vCPU rings at most every n milliseconds
+        (default 1000).  The thread collects them more often, down to
+        every 10 milliseconds, when the rings fill up quickly, so that
+        vCPUs rarely have to exit because their ring is full.
+
+    ``dirty-log-threads=n``
+        When the KVM accelerator records dirty pages in bitmaps, a full
+        synchronization of the dirty log fetches the bitmaps of the memory
+        slots with up to n threads in parallel (default 4).  Set it to 1
+        to fetch them one after the other.
+
+    ``halt-poll-max-ns=n``
+        When a vCPU halts and the halt is not handled by the kernel (TCG,
+        or KVM without an in-kernel irqchip), the vCPU thread busy waits
+        for up to n nanoseconds before it goes to sleep, which shortens
+        the wakeup latency of e.g. inter-processor interrupts at the cost
+        of host CPU time (default 0, polling disabled).  Each vCPU adapts
+        its own polling time between 0 and n according to how long its
+        recent halts lasted, like the ``halt_poll_ns`` parameter of KVM.
+        ``query-stats`` reports the polling statistics of each vCPU under
+        the ``halt-poll`` provider.
+
+    ``halt-poll-grow=n``; ``halt-poll-shrink=n``
+        The multiplier used to increase the halt polling time of a vCPU
+        after a short halt (0 selects the default of 2), and the divisor
+        used to decrease it after a halt that was too long to poll for
+        (default 0, which resets the polling time to 0 instead).
+
 ERST
 
 DEF("smp", HAS_ARG, QEMU_OPTION_smp,
@@ -2598,6 +2646,19 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
+    "                use 'start-queue=m' to specify the first queue that should be used\n"
+    "                use 'inhibit=on|off' to inhibit loading of a default XDP program (default: off)\n"
+    "                with inhibit=on,\n"
+    "                  use 'sock-fds' to provide file descriptors for already open AF_XDP sockets\n"
+    "                  added to a socket map in XDP program.  One socket per queue.\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2622,6 +2683,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2646,12 +2710,15 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
 #endif
 #ifdef CONFIG_NETMAP
     "netmap|"
+#endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
 #endif
     "socket][,option][,option][,...]\n"
     "                old way to initialize a host network interface\n"
     "                (use the -netdev option if possible instead)\n", QEMU_ARCH_ALL)
 SRST
-``-nic [tap|bridge|user|l2tpv3|vde|netmap|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
+``-nic [tap|bridge|user|l2tpv3|vde|netmap|af-xdp|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
     This option is a shortcut for configuring both the on-board
     (default) guest NIC hardware and the host network backend in one go.
     The host backend options are the same as with the corresponding
@@ -3065,6 +3132,47 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket.  A specific program attach mode for a default
+    XDP program can be forced with 'mode', defaults to best-effort,
+    where the likely most performant mode will be in use.  Number of
+    queues 'n' should generally match the number of queues in the
+    interface, defaults to 1.  One AF_XDP socket is used per queue,
+    and each one is connected to a queue pair of a multiqueue guest
+    NIC.  Traffic arriving on device queues that are not configured
+    won't be received.  Packets go through a copy between the socket
+    memory (UMEM) and the guest, in each direction; the copy between
+    the NIC and UMEM is avoided when the driver supports zero-copy
+    and 'force-copy' is off.
+
+    'start-queue' option can be specified if a particular range of
+    queues [m, m + n] should be in use.  For example, this may be
+    necessary in order to use certain NICs in native mode.  Kernel
+    allows the driver to create a separate set of XDP queues on top
+    of regular ones, and only these queues can be used for AF_XDP
+    sockets.  NICs that work this way may also require an additional
+    traffic redirection with ethtool to these special queues.
+
+    'inhibit' option tells QEMU to not load the default XDP program
+    and use the one that is already loaded to the interface.  In this
+    case, file descriptors for already open AF_XDP sockets must be
+    provided with 'sock-fds', one per queue.  These sockets must not
+    be bound yet and should be added to the XSK map of the XDP
+    program.  This makes it possible to run QEMU without the
+    capabilities needed to load XDP programs.  This option is only
+    available if QEMU has been compiled with AF_XDP support enabled.
+
+    Example:
+
+    .. parsed-literal::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mq=on \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -4081,6 +4189,30 @@ SRST
     Start right away with a saved state (``loadvm`` in monitor)
 ERST
 
+DEF("clone-template", HAS_ARG, QEMU_OPTION_clone_template, \
+    "-clone-template file\n" \
+    "                start right away as a clone of a template VM\n",
+    QEMU_ARCH_ALL)
+SRST
+``-clone-template file``
+    Start right away as a clone of the template saved to file with the
+    ``x-clone-template-save`` QMP command.  The device state is loaded
+    directly, without an incoming migration.  The clone must be started
+    with the same configuration as the template, except that its memory
+    backends map the template's files with ``share=off`` and that its
+    disks are overlays whose backing files are the template's disks:
+
+    .. parsed-literal::
+
+        qemu-img create -f qcow2 -F qcow2 -b template.qcow2 clone1.qcow2
+        |qemu_system| -object memory-backend-file,id=mem,size=4G,mem-path=/dev/shm/template.ram,share=off \\
+                      -machine memory-backend=mem \\
+                      -drive file=clone1.qcow2,if=virtio \\
+                      -clone-template template.state
+
+    The clone's RAM is then shared copy-on-write with the template.
+ERST
+
 #ifndef _WIN32
 DEF("daemonize", 0, QEMU_OPTION_daemonize, \
     "-daemonize      daemonize QEMU after initializing\n", QEMU_ARCH_ALL)
@@ -4136,13 +4268,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4184,6 +4316,9 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    If ``rrcompress=on`` is given in record mode, the log is written in
+    zstd-compressed chunks by a separate thread; replay detects such logs
+    automatically.
 ERST
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -4474,10 +4609,11 @@ ERST
 
 DEF("trace", HAS_ARG, QEMU_OPTION_trace,
     "-trace [[enable=]<pattern>][,events=<file>][,file=<file>]\n"
+    "       [,file-size=<size>]\n"
     "                specify tracing options\n",
     QEMU_ARCH_ALL)
 SRST
-``-trace [[enable=]pattern][,events=file][,file=file]``
+``-trace [[enable=]pattern][,events=file][,file=file][,file-size=size]``
   .. include:: ../qemu-option-trace.rst.inc
 
 ERST
@@ -5298,6 +5434,31 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+    ``-object thread-placement,id=id,role=vcpu|iothread|migration|multifd|worker[,host-cpus=cpus][,host-nodes=nodes][,avoid-smt-siblings=on|off]``
+        Sets the host CPU affinity of every QEMU thread of the given
+        ``role`` created after the object: vCPU threads, IOThreads, the
+        outgoing migration thread, multifd channel threads or thread
+        pool workers. Only one ``thread-placement`` object can exist
+        per role. Objects for IOThreads must appear before the
+        ``-object iothread`` options on the command line. (Linux only)
+
+        The threads may run on the union of the ``host-cpus`` list and
+        the CPUs of the NUMA nodes in the ``host-nodes`` list.
+
+        With ``avoid-smt-siblings=on``, each new thread is instead
+        pinned to a single host CPU. The CPUs are handed out one
+        physical core at a time, so two threads only share a core
+        once every allowed core has a thread.
+
+        For example, to give four vCPUs a physical core each on the
+        first NUMA node:
+
+        .. parsed-literal::
+
+             # |qemu_system| \\
+                 -object thread-placement,id=tp0,role=vcpu,host-nodes=0,avoid-smt-siblings=on \\
+                 -smp 4 ...
 ERST
 
 
@@ -25,6 +25,8 @@
 #define GUEST_EXEC_MAX_OUTPUT (16 * 1024 * 1024)
 /* Allocation and I/O buffer for reading guest-exec out_data/err_data - 4KB */
 #define GUEST_EXEC_IO_SIZE (4 * 1024)
+/* Maximum buffered guest-exec stream-output data per stream - 4MB */
+#define GUEST_EXEC_STREAM_WINDOW (4 * 1024 * 1024)
 /*
  * Maximum file size to read - 48MB
  *
@@ -90,6 +92,9 @@ struct GuestExecIOData {
     gsize length;
     bool closed;
     bool truncated;
+    bool stream;
+    bool paused;
+    GIOChannel *ch;
     const char *name;
 };
 typedef struct GuestExecIOData GuestExecIOData;
@@ -99,6 +104,7 @@ struct GuestExecInfo {
     int64_t pid_numeric;
     gint status;
     bool has_output;
+    bool stream_output;
     bool finished;
     GuestExecIOData in;
     GuestExecIOData out;
@@ -147,6 +153,27 @@ static GuestExecInfo *guest_exec_info_find(int64_t pid_numeric)
     return NULL;
 }
 
+static gboolean guest_exec_output_watch(GIOChannel *ch,
+        GIOCondition cond, gpointer p_);
+
+/*
+ * Return the output captured so far as base64 and empty the buffer.
+ * If reading was paused because the buffer was full, resume it.
+ */
+static char *guest_exec_output_take(GuestExecIOData *p)
+{
+    char *b64 = g_base64_encode(p->data, p->length);
+
+    p->length = 0;
+    if (p->paused) {
+        p->paused = false;
+        g_io_add_watch(p->ch, G_IO_IN | G_IO_HUP,
+                       guest_exec_output_watch, p);
+    }
+
+    return b64;
+}
+
 GuestExecStatus *qmp_guest_exec_status(int64_t pid, Error **errp)
 {
     GuestExecInfo *gei;
@@ -172,6 +199,19 @@ GuestExecStatus *qmp_guest_exec_status(int64_t pid, Error **errp)
     }
 
     ges->exited = finished;
+
+    /* with stream-output, hand out whatever was captured since last call */
+    if (gei->stream_output) {
+        if (gei->out.length > 0) {
+            ges->has_out_data = true;
+            ges->out_data = guest_exec_output_take(&gei->out);
+        }
+        if (gei->err.length > 0) {
+            ges->has_err_data = true;
+            ges->err_data = guest_exec_output_take(&gei->err);
+        }
+    }
+
     if (finished) {
         /* Glib has no portable way to parse exit status.
          * On UNIX, we can get either exit code from normal termination
@@ -210,16 +250,16 @@ GuestExecStatus *qmp_guest_exec_status(int64_t pid, Error **errp)
         if (gei->out.length > 0) {
             ges->has_out_data = true;
             ges->out_data = g_base64_encode(gei->out.data, gei->out.length);
-            g_free(gei->out.data);
             ges->has_out_truncated = gei->out.truncated;
         }
+        g_free(gei->out.data);
 
         if (gei->err.length > 0) {
             ges->has_err_data = true;
             ges->err_data = g_base64_encode(gei->err.data, gei->err.length);
-            g_free(gei->err.data);
             ges->has_err_truncated = gei->err.truncated;
         }
+        g_free(gei->err.data);
 
         QTAILQ_REMOVE(&guest_exec_state.processes, gei, next);
         g_free(gei);
@@ -343,7 +383,30 @@ static gboolean guest_exec_output_watch(GIOChannel *ch,
         goto close;
     }
 
-    if (p->size == p->length) {
+    if (p->stream && p->length >= GUEST_EXEC_STREAM_WINDOW) {
+        /*
+         * Stop reading, so that the process blocks on a full pipe, until
+         * guest-exec-status collects the buffered data.
+         */
+        p->paused = true;
+        return false;
+    }
+
+    if (p->size == p->length && p->stream) {
+        gsize size = MIN(MAX(p->size * 2, GUEST_EXEC_IO_SIZE),
+                         GUEST_EXEC_STREAM_WINDOW);
+        gpointer t = g_try_realloc(p->data, size);
+
+        if (t == NULL) {
+            if (!p->length) {
+                goto close;
+            }
+            p->paused = true;
+            return false;
+        }
+        p->size = size;
+        p->data = t;
+    } else if (p->size == p->length) {
         gpointer t = NULL;
         if (!p->truncated && p->size < GUEST_EXEC_MAX_OUTPUT) {
             t = g_try_realloc(p->data, p->size + GUEST_EXEC_IO_SIZE);
@@ -389,6 +452,7 @@ GuestExec *qmp_guest_exec(const char *path,
                        bool has_env, strList *env,
                        bool has_input_data, const char *input_data,
                        bool has_capture_output, bool capture_output,
+                       bool has_stream_output, bool stream_output,
                        Error **errp)
 {
     GPid pid;
@@ -401,7 +465,8 @@ GuestExec *qmp_guest_exec(const char *path,
     gint in_fd, out_fd, err_fd;
     GIOChannel *in_ch, *out_ch, *err_ch;
     GSpawnFlags flags;
-    bool has_output = (has_capture_output && capture_output);
+    bool has_stream = (has_stream_output && stream_output);
+    bool has_output = (has_capture_output && capture_output) || has_stream;
     uint8_t *input = NULL;
     size_t ninput = 0;
 
@@ -438,6 +503,7 @@ GuestExec *qmp_guest_exec(const char *path,
 
     gei = guest_exec_info_add(pid);
     gei->has_output = has_output;
+    gei->stream_output = has_stream;
     g_child_watch_add(pid, guest_exec_child_watch, gei);
 
     if (has_input_data) {
@@ -469,6 +535,10 @@ GuestExec *qmp_guest_exec(const char *path,
         g_io_channel_set_buffered(err_ch, false);
         g_io_channel_set_close_on_unref(out_ch, true);
         g_io_channel_set_close_on_unref(err_ch, true);
+        gei->out.ch = out_ch;
+        gei->err.ch = err_ch;
+        gei->out.stream = has_stream;
+        gei->err.stream = has_stream;
         g_io_add_watch(out_ch, G_IO_IN | G_IO_HUP,
                 guest_exec_output_watch, &gei->out);
         g_io_add_watch(err_ch, G_IO_IN | G_IO_HUP,
@@ -342,12 +342,52 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
     }
 }
 
+/*
+ * Consume the longest run of characters at @buffer that leave @lexer
+ * in its current state, such as the contents of a string, the digits
+ * of a number or whitespace between tokens, and return its length.
+ * This is what feeding them to json_lexer_feed_char() one by one
+ * would do, with a single table lookup per character and a single
+ * append to the token.
+ */
+static size_t json_lexer_feed_run(JSONLexer *lexer, const char *buffer,
+                                  size_t size)
+{
+    const uint8_t *row = json_lexer[lexer->state];
+    uint8_t state = lexer->state;
+    /* json_lexer_feed_char() discards the token in these states */
+    bool keep = state != IN_START && state != IN_RECOVERY;
+    size_t n = 0;
+
+    if (keep) {
+        if (lexer->token->len >= MAX_TOKEN_SIZE) {
+            return 0;
+        }
+        size = MIN(size, MAX_TOKEN_SIZE - lexer->token->len);
+    }
+
+    /* Newlines are left to json_lexer_feed_char(), which counts lines */
+    while (n < size && buffer[n] != '\n' && row[(uint8_t)buffer[n]] == state) {
+        n++;
+    }
+
+    if (keep) {
+        g_string_append_len(lexer->token, buffer, n);
+    }
+    lexer->x += n;
+    return n;
+}
+
 void json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
 {
-    size_t i;
+    size_t i = 0;
 
-    for (i = 0; i < size; i++) {
-        json_lexer_feed_char(lexer, buffer[i], false);
+    while (i < size) {
+        i += json_lexer_feed_run(lexer, buffer + i, size - i);
+        if (i < size) {
+            json_lexer_feed_char(lexer, buffer[i], false);
+            i++;
+        }
     }
 }
 
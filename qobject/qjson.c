@@ -218,6 +218,16 @@ static void to_json(JSONWriter *writer, const char *name,
     }
 }
 
+/*
+ * Write @obj as the next value of @writer, as member @name if @writer
+ * is inside an object.
+ */
+void qobject_write_json(JSONWriter *writer, const char *name,
+                        const QObject *obj)
+{
+    to_json(writer, name, obj);
+}
+
 GString *qobject_to_json_pretty(const QObject *obj, bool pretty)
 {
     JSONWriter *writer = json_writer_new(pretty);
@@ -350,6 +350,8 @@ static void type_initialize(TypeImpl *ti)
 
     ti->class->properties = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
                                                   object_property_free);
+    ti->class->prop_table = NULL;
+    ti->class->prop_table_inherited = false;
 
     ti->class->type = ti;
 
@@ -390,6 +392,8 @@ static void object_post_init_with_type(Object *obj, TypeImpl *ti)
 bool object_apply_global_props(Object *obj, const GPtrArray *props,
                                Error **errp)
 {
+    const char *driver = NULL;
+    bool match = false;
     int i;
 
     if (!props) {
@@ -400,7 +404,12 @@ bool object_apply_global_props(Object *obj, const GPtrArray *props,
         GlobalProperty *p = g_ptr_array_index(props, i);
         Error *err = NULL;
 
-        if (object_dynamic_cast(obj, p->driver) == NULL) {
+        /* Compat properties come in runs with the same driver */
+        if (!driver || strcmp(driver, p->driver)) {
+            driver = p->driver;
+            match = object_dynamic_cast(obj, driver) != NULL;
+        }
+        if (!match) {
             continue;
         }
         if (p->optional && !object_property_find(obj, p->property)) {
@@ -1249,6 +1258,71 @@ object_property_add(Object *obj, const char *name, const char *type,
                                    opaque, &error_abort);
 }
 
+static GHashTable *object_class_property_table(ObjectClass *klass)
+{
+    ObjectClass *parent = object_class_get_parent(klass);
+    GHashTableIter iter;
+    gpointer key, val;
+
+    if (klass->prop_table) {
+        return klass->prop_table;
+    }
+
+    /* Names are owned by the properties, which are never freed */
+    if (parent) {
+        klass->prop_table =
+            g_hash_table_copy_deep(object_class_property_table(parent),
+                                   NULL, NULL, NULL, NULL);
+        parent->prop_table_inherited = true;
+    } else {
+        klass->prop_table = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    /* As in object_class_property_find(), parents win over subclasses */
+    g_hash_table_iter_init(&iter, klass->properties);
+    while (g_hash_table_iter_next(&iter, &key, &val)) {
+        if (!g_hash_table_contains(klass->prop_table, key)) {
+            g_hash_table_insert(klass->prop_table, key, val);
+        }
+    }
+    return klass->prop_table;
+}
+
+typedef struct ObjectClassPropertyTableAdd {
+    TypeImpl *owner;
+    ObjectProperty *prop;
+} ObjectClassPropertyTableAdd;
+
+static void object_class_property_table_add_tramp(gpointer key,
+                                                  gpointer value,
+                                                  gpointer opaque)
+{
+    ObjectClassPropertyTableAdd *data = opaque;
+    TypeImpl *type = value;
+    ObjectClass *klass = type->class;
+
+    if (klass && klass->prop_table && type_is_ancestor(type, data->owner)) {
+        g_hash_table_insert(klass->prop_table, data->prop->name, data->prop);
+    }
+}
+
+/*
+ * Properties are usually added from class_init, before any subclass
+ * exists; only then is it enough to update the table of @klass.
+ */
+static void object_class_property_table_add(ObjectClass *klass,
+                                            ObjectProperty *prop)
+{
+    if (klass->prop_table_inherited) {
+        ObjectClassPropertyTableAdd data = { klass->type, prop };
+
+        g_hash_table_foreach(type_table_get(),
+                             object_class_property_table_add_tramp, &data);
+    } else if (klass->prop_table) {
+        g_hash_table_insert(klass->prop_table, prop->name, prop);
+    }
+}
+
 ObjectProperty *
 object_class_property_add(ObjectClass *klass,
                           const char *name,
@@ -1273,6 +1347,7 @@ object_class_property_add(ObjectClass *klass,
     prop->opaque = opaque;
 
     g_hash_table_insert(klass->properties, prop->name, prop);
+    object_class_property_table_add(klass, prop);
 
     return prop;
 }
@@ -1315,8 +1390,9 @@ ObjectProperty *object_property_iter_next(ObjectPropertyIterator *iter)
         if (!iter->nextclass) {
             return NULL;
         }
-        g_hash_table_iter_init(&iter->iter, iter->nextclass->properties);
-        iter->nextclass = object_class_get_parent(iter->nextclass);
+        g_hash_table_iter_init(&iter->iter,
+                               object_class_property_table(iter->nextclass));
+        iter->nextclass = NULL;
     }
     return val;
 }
@@ -1324,24 +1400,13 @@ ObjectProperty *object_property_iter_next(ObjectPropertyIterator *iter)
 void object_class_property_iter_init(ObjectPropertyIterator *iter,
                                      ObjectClass *klass)
 {
-    g_hash_table_iter_init(&iter->iter, klass->properties);
-    iter->nextclass = object_class_get_parent(klass);
+    g_hash_table_iter_init(&iter->iter, object_class_property_table(klass));
+    iter->nextclass = NULL;
 }
 
 ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name)
 {
-    ObjectClass *parent_klass;
-
-    parent_klass = object_class_get_parent(klass);
-    if (parent_klass) {
-        ObjectProperty *prop =
-            object_class_property_find(parent_klass, name);
-        if (prop) {
-            return prop;
-        }
-    }
-
-    return g_hash_table_lookup(klass->properties, name);
+    return g_hash_table_lookup(object_class_property_table(klass), name);
 }
 
 ObjectProperty *object_class_property_find_err(ObjectClass *klass,
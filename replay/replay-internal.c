@@ -44,9 +44,19 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    if (replay_log_zstd ? !replay_log_read(buf, size)
+                        : fread(buf, 1, size, replay_file) != size) {
+        replay_read_error();
+    }
+}
+
 void replay_put_byte(uint8_t byte)
 {
-    if (replay_file) {
+    if (replay_log_zstd) {
+        replay_log_write(&byte, 1);
+    } else if (replay_file) {
         if (putc(byte, replay_file) == EOF) {
             replay_write_error();
         }
@@ -82,7 +92,9 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
+        if (replay_log_zstd) {
+            replay_log_write(buf, size);
+        } else if (fwrite(buf, 1, size, replay_file) != size) {
             replay_write_error();
         }
     }
@@ -91,7 +103,9 @@ void replay_put_array(const uint8_t *buf, size_t size)
 uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
-    if (replay_file) {
+    if (replay_log_zstd) {
+        replay_get_bytes(&byte, 1);
+    } else if (replay_file) {
         int r = getc(replay_file);
         if (r == EOF) {
             replay_read_error();
@@ -138,9 +152,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -149,9 +161,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
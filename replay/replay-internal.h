@@ -113,6 +113,26 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/* Chunked, compressed log (replay-log.c) */
+
+/*! True if the log is read or written through replay_log_*() */
+extern bool replay_log_zstd;
+
+/*! Starts compressing the events written to the log from now on. */
+void replay_log_start_record(void);
+/*! Reads a compressed log whose chunks start at file offset \p start.
+    \p index_offset is the file offset of the index, or 0 if none. */
+void replay_log_start_play(uint64_t start, uint64_t index_offset);
+void replay_log_write(const void *buf, size_t size);
+/*! \return false at the end of the log */
+bool replay_log_read(void *buf, size_t size);
+/*! Position in the uncompressed event stream, for snapshots. */
+uint64_t replay_log_tell(void);
+void replay_log_seek(uint64_t offset);
+/*! Flushes the log and writes the index.
+    \return the file offset of the index when recording */
+uint64_t replay_log_finish(void);
+
 /* Mutex functions for protecting replay log file and ensuring
  * synchronisation between vCPU and main-loop threads. */
 
@@ -0,0 +1,452 @@
+/*
+ * replay-log.c
+ *
+ * Chunked, compressed storage of the record/replay log
+ *
+ * The event stream is cut into chunks of REPLAY_CHUNK_SIZE bytes, each of
+ * which is compressed with zstd.  When recording, full chunks are handed
+ * to a writer thread, so that the vCPU thread never waits for compression
+ * or file I/O.  Every chunk starts with a header made of its 4-byte
+ * compressed size, 4-byte uncompressed size and the 8-byte icount at which
+ * it starts.
+ *
+ * At the end of recording an index with one entry per chunk is appended,
+ * and its file offset is stored in the log header.  Positions in the log,
+ * as saved in snapshots, are offsets in the uncompressed stream; the index
+ * maps them to the chunk that holds them, so seeking decompresses a single
+ * chunk.  If the index is missing, because QEMU did not exit cleanly while
+ * recording, it is rebuilt from the chunk headers.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#define REPLAY_CHUNK_SIZE       (1 * MiB)
+#define REPLAY_CHUNK_HEADER     16
+#define REPLAY_INDEX_ENTRY      28
+/* Chunks waiting for the writer thread before the vCPU thread blocks */
+#define REPLAY_MAX_QUEUED       16
+#define REPLAY_ZSTD_LEVEL       1
+
+typedef struct ReplayChunk {
+    uint8_t *data;
+    uint32_t size;
+    uint64_t icount;
+    uint64_t offset;
+    QSIMPLEQ_ENTRY(ReplayChunk) next;
+} ReplayChunk;
+
+typedef struct ReplayIndexEntry {
+    uint64_t icount;
+    uint64_t offset;
+    uint64_t file_offset;
+    uint32_t size;
+} ReplayIndexEntry;
+
+bool replay_log_zstd;
+
+/* Chunk being filled when recording, or being read when replaying */
+static ReplayChunk *cur;
+static uint32_t cur_pos;
+static int cur_index = -1;
+static GArray *replay_index;
+
+static QemuThread writer_thread;
+static QemuMutex writer_lock;
+static QemuCond writer_cond;
+static QSIMPLEQ_HEAD(, ReplayChunk) writer_queue =
+    QSIMPLEQ_HEAD_INITIALIZER(writer_queue);
+static unsigned writer_queued;
+static bool writer_exit;
+static bool writer_error;
+
+static ReplayChunk *replay_chunk_new(uint64_t offset)
+{
+    ReplayChunk *c = g_new0(ReplayChunk, 1);
+
+    c->data = g_malloc(REPLAY_CHUNK_SIZE);
+    c->offset = offset;
+    c->icount = replay_state.current_icount;
+    return c;
+}
+
+static void replay_chunk_free(ReplayChunk *c)
+{
+    if (c) {
+        g_free(c->data);
+        g_free(c);
+    }
+}
+
+static void replay_log_write_error(const char *msg)
+{
+    if (!writer_error) {
+        error_report("replay write error: %s", msg);
+        writer_error = true;
+    }
+}
+
+/* Called by the writer thread, which is the only user of replay_file */
+static void replay_chunk_write(ReplayChunk *c)
+{
+#ifdef CONFIG_ZSTD
+    size_t bound = ZSTD_compressBound(c->size);
+    uint8_t *buf = g_malloc(REPLAY_CHUNK_HEADER + bound);
+    ReplayIndexEntry e;
+    size_t csize;
+
+    csize = ZSTD_compress(buf + REPLAY_CHUNK_HEADER, bound, c->data, c->size,
+                          REPLAY_ZSTD_LEVEL);
+    if (ZSTD_isError(csize)) {
+        replay_log_write_error(ZSTD_getErrorName(csize));
+        goto out;
+    }
+    stl_be_p(buf, csize);
+    stl_be_p(buf + 4, c->size);
+    stq_be_p(buf + 8, c->icount);
+
+    e = (ReplayIndexEntry) {
+        .icount = c->icount,
+        .offset = c->offset,
+        .file_offset = ftello(replay_file),
+        .size = c->size,
+    };
+    if (fwrite(buf, 1, REPLAY_CHUNK_HEADER + csize, replay_file) !=
+        REPLAY_CHUNK_HEADER + csize) {
+        replay_log_write_error(strerror(errno));
+        goto out;
+    }
+    g_array_append_val(replay_index, e);
+
+out:
+    g_free(buf);
+#else
+    g_assert_not_reached();
+#endif
+}
+
+static void *replay_log_writer(void *opaque)
+{
+    qemu_mutex_lock(&writer_lock);
+    for (;;) {
+        ReplayChunk *c = QSIMPLEQ_FIRST(&writer_queue);
+
+        if (!c) {
+            if (writer_exit) {
+                break;
+            }
+            qemu_cond_wait(&writer_cond, &writer_lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&writer_queue, next);
+        writer_queued--;
+        qemu_cond_broadcast(&writer_cond);
+        qemu_mutex_unlock(&writer_lock);
+
+        replay_chunk_write(c);
+        replay_chunk_free(c);
+
+        qemu_mutex_lock(&writer_lock);
+    }
+    qemu_mutex_unlock(&writer_lock);
+    return NULL;
+}
+
+static void replay_log_queue_chunk(void)
+{
+    uint64_t offset = cur->offset + cur->size;
+
+    qemu_mutex_lock(&writer_lock);
+    while (writer_queued >= REPLAY_MAX_QUEUED) {
+        qemu_cond_wait(&writer_cond, &writer_lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&writer_queue, cur, next);
+    writer_queued++;
+    qemu_cond_broadcast(&writer_cond);
+    qemu_mutex_unlock(&writer_lock);
+
+    cur = replay_chunk_new(offset);
+}
+
+void replay_log_start_record(void)
+{
+    replay_index = g_array_new(false, false, sizeof(ReplayIndexEntry));
+    cur = replay_chunk_new(0);
+    qemu_mutex_init(&writer_lock);
+    qemu_cond_init(&writer_cond);
+    qemu_thread_create(&writer_thread, "replay-writer", replay_log_writer,
+                       NULL, QEMU_THREAD_JOINABLE);
+    replay_log_zstd = true;
+}
+
+void replay_log_write(const void *buf, size_t size)
+{
+    while (size) {
+        size_t n = MIN(size, REPLAY_CHUNK_SIZE - cur->size);
+
+        memcpy(cur->data + cur->size, buf, n);
+        cur->size += n;
+        buf += n;
+        size -= n;
+        if (cur->size == REPLAY_CHUNK_SIZE) {
+            replay_log_queue_chunk();
+        }
+    }
+}
+
+static bool replay_log_load_index(uint64_t index_offset)
+{
+    uint8_t buf[REPLAY_INDEX_ENTRY];
+    uint32_t count, i;
+
+    if (fseeko(replay_file, index_offset, SEEK_SET) < 0 ||
+        fread(buf, 1, 4, replay_file) != 4) {
+        return false;
+    }
+    count = ldl_be_p(buf);
+    for (i = 0; i < count; i++) {
+        ReplayIndexEntry e;
+
+        if (fread(buf, 1, REPLAY_INDEX_ENTRY, replay_file) !=
+            REPLAY_INDEX_ENTRY) {
+            g_array_set_size(replay_index, 0);
+            return false;
+        }
+        e.icount = ldq_be_p(buf);
+        e.offset = ldq_be_p(buf + 8);
+        e.file_offset = ldq_be_p(buf + 16);
+        e.size = ldl_be_p(buf + 24);
+        g_array_append_val(replay_index, e);
+    }
+    return true;
+}
+
+/*
+ * Rebuild the index from the chunk headers between @file_offset and
+ * @end, or the end of the file if @end is zero; drop a truncated tail.
+ */
+static void replay_log_scan_chunks(uint64_t file_offset, uint64_t end)
+{
+    uint8_t buf[REPLAY_CHUNK_HEADER];
+    uint64_t offset = 0;
+    uint64_t file_size = end;
+
+    if (!file_size) {
+        fseeko(replay_file, 0, SEEK_END);
+        file_size = ftello(replay_file);
+    }
+
+    while (file_offset + REPLAY_CHUNK_HEADER <= file_size) {
+        ReplayIndexEntry e;
+        uint32_t csize;
+
+        if (fseeko(replay_file, file_offset, SEEK_SET) < 0 ||
+            fread(buf, 1, REPLAY_CHUNK_HEADER, replay_file) !=
+            REPLAY_CHUNK_HEADER) {
+            break;
+        }
+        csize = ldl_be_p(buf);
+        e.size = ldl_be_p(buf + 4);
+        e.icount = ldq_be_p(buf + 8);
+        e.offset = offset;
+        e.file_offset = file_offset;
+        if (e.size > REPLAY_CHUNK_SIZE ||
+            file_offset + REPLAY_CHUNK_HEADER + csize > file_size) {
+            break;
+        }
+        g_array_append_val(replay_index, e);
+        offset += e.size;
+        file_offset += REPLAY_CHUNK_HEADER + csize;
+    }
+    clearerr(replay_file);
+}
+
+void replay_log_start_play(uint64_t start, uint64_t index_offset)
+{
+#ifdef CONFIG_ZSTD
+    replay_index = g_array_new(false, false, sizeof(ReplayIndexEntry));
+    if (!index_offset || !replay_log_load_index(index_offset)) {
+        warn_report("Replay: rebuilding the index of the replay log");
+        replay_log_scan_chunks(start, index_offset);
+    }
+    cur = g_new0(ReplayChunk, 1);
+    cur->data = g_malloc(REPLAY_CHUNK_SIZE);
+    cur_index = -1;
+    cur_pos = 0;
+    replay_log_zstd = true;
+#else
+    error_report("Replay: the log is compressed, but zstd support "
+                 "is not built in");
+    exit(1);
+#endif
+}
+
+static ReplayIndexEntry *replay_log_entry(int i)
+{
+    return &g_array_index(replay_index, ReplayIndexEntry, i);
+}
+
+static bool replay_log_load_chunk(int i)
+{
+#ifdef CONFIG_ZSTD
+    ReplayIndexEntry *e;
+    uint8_t hdr[REPLAY_CHUNK_HEADER];
+    uint8_t *buf;
+    uint32_t csize;
+    size_t r;
+
+    if (i >= replay_index->len) {
+        return false;
+    }
+    e = replay_log_entry(i);
+    if (fseeko(replay_file, e->file_offset, SEEK_SET) < 0 ||
+        fread(hdr, 1, REPLAY_CHUNK_HEADER, replay_file) !=
+        REPLAY_CHUNK_HEADER ||
+        ldl_be_p(hdr + 4) != e->size || e->size > REPLAY_CHUNK_SIZE) {
+        return false;
+    }
+    csize = ldl_be_p(hdr);
+    buf = g_malloc(csize);
+    if (fread(buf, 1, csize, replay_file) != csize) {
+        g_free(buf);
+        return false;
+    }
+    r = ZSTD_decompress(cur->data, REPLAY_CHUNK_SIZE, buf, csize);
+    g_free(buf);
+    if (ZSTD_isError(r) || r != e->size) {
+        return false;
+    }
+
+    cur->size = e->size;
+    cur->offset = e->offset;
+    cur->icount = e->icount;
+    cur_index = i;
+    cur_pos = 0;
+    return true;
+#else
+    g_assert_not_reached();
+#endif
+}
+
+bool replay_log_read(void *buf, size_t size)
+{
+    while (size) {
+        size_t n;
+
+        if (cur_index < 0 || cur_pos == cur->size) {
+            if (!replay_log_load_chunk(cur_index + 1)) {
+                return false;
+            }
+        }
+        n = MIN(size, cur->size - cur_pos);
+        memcpy(buf, cur->data + cur_pos, n);
+        cur_pos += n;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+uint64_t replay_log_tell(void)
+{
+    if (!replay_log_zstd) {
+        return ftell(replay_file);
+    }
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        return cur->offset + cur->size;
+    }
+    return cur_index < 0 ? 0 : cur->offset + cur_pos;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    int lo, hi;
+
+    if (!replay_log_zstd) {
+        fseek(replay_file, offset, SEEK_SET);
+        return;
+    }
+
+    /* find the last chunk that starts at or before @offset */
+    lo = 0;
+    hi = replay_index->len - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (replay_log_entry(mid)->offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (hi < 0 || (lo != cur_index && !replay_log_load_chunk(lo)) ||
+        offset - cur->offset > cur->size) {
+        error_report("Replay: cannot seek to offset %" PRIu64
+                     " in the replay log", offset);
+        exit(1);
+    }
+    cur_pos = offset - cur->offset;
+}
+
+/*
+ * Stop using the compressed log.  When recording, write out the pending
+ * chunks and the index, and return the file offset of the index.
+ */
+uint64_t replay_log_finish(void)
+{
+    uint64_t index_offset = 0;
+    uint8_t buf[REPLAY_INDEX_ENTRY];
+    int i;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        if (cur->size) {
+            replay_log_queue_chunk();
+        }
+        qemu_mutex_lock(&writer_lock);
+        writer_exit = true;
+        qemu_cond_broadcast(&writer_cond);
+        qemu_mutex_unlock(&writer_lock);
+        qemu_thread_join(&writer_thread);
+
+        fseeko(replay_file, 0, SEEK_END);
+        index_offset = ftello(replay_file);
+        stl_be_p(buf, replay_index->len);
+        if (fwrite(buf, 1, 4, replay_file) != 4) {
+            replay_log_write_error(strerror(errno));
+        }
+        for (i = 0; i < replay_index->len; i++) {
+            ReplayIndexEntry *e = replay_log_entry(i);
+
+            stq_be_p(buf, e->icount);
+            stq_be_p(buf + 8, e->offset);
+            stq_be_p(buf + 16, e->file_offset);
+            stl_be_p(buf + 24, e->size);
+            if (fwrite(buf, 1, REPLAY_INDEX_ENTRY, replay_file) !=
+                REPLAY_INDEX_ENTRY) {
+                replay_log_write_error(strerror(errno));
+                break;
+            }
+        }
+    }
+
+    replay_chunk_free(cur);
+    cur = NULL;
+    cur_index = -1;
+    g_array_free(replay_index, true);
+    replay_index = NULL;
+    replay_log_zstd = false;
+    return index_offset;
+}
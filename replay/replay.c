@@ -23,6 +23,8 @@
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
 #define REPLAY_VERSION              0xe0200a
+/* The same events, stored in chunks compressed with zstd */
+#define REPLAY_VERSION_ZSTD         0xe1200a
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
@@ -240,7 +242,7 @@ bool replay_has_checkpoint(void)
     return res;
 }
 
-static void replay_enable(const char *fname, int mode)
+static void replay_enable(const char *fname, int mode, bool compress)
 {
     const char *fmode = NULL;
     assert(!replay_file);
@@ -276,15 +278,25 @@ static void replay_enable(const char *fname, int mode)
 
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        if (compress) {
+            /* so that the log can be replayed even if QEMU is killed */
+            replay_put_dword(REPLAY_VERSION_ZSTD);
+            replay_put_qword(0);
+            replay_log_start_record();
+        } else {
+            fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        }
     } else if (replay_mode == REPLAY_MODE_PLAY) {
         unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        if (version == REPLAY_VERSION_ZSTD) {
+            replay_log_start_play(HEADER_SIZE, replay_get_qword());
+        } else if (version != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
+        } else {
+            /* go to the beginning */
+            fseek(replay_file, HEADER_SIZE, SEEK_SET);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
         replay_fetch_data_kind();
     }
 
@@ -296,6 +308,7 @@ void replay_configure(QemuOpts *opts)
     const char *fname;
     const char *rr;
     ReplayMode mode = REPLAY_MODE_NONE;
+    bool compress;
     Location loc;
 
     if (!opts) {
@@ -324,9 +337,17 @@ void replay_configure(QemuOpts *opts)
         exit(1);
     }
 
+    compress = qemu_opt_get_bool(opts, "rrcompress", false);
+#ifndef CONFIG_ZSTD
+    if (compress && mode == REPLAY_MODE_RECORD) {
+        error_report("rrcompress requires zstd support");
+        exit(1);
+    }
+#endif
+
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
     replay_vmstate_register();
-    replay_enable(fname, mode);
+    replay_enable(fname, mode, compress && mode == REPLAY_MODE_RECORD);
 
 out:
     loc_pop(&loc);
@@ -372,8 +393,18 @@ void replay_finish(void)
             replay_put_event(EVENT_END);
 
             /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (replay_log_zstd) {
+                uint64_t index_offset = replay_log_finish();
+
+                fseek(replay_file, 0, SEEK_SET);
+                replay_put_dword(REPLAY_VERSION_ZSTD);
+                replay_put_qword(index_offset);
+            } else {
+                fseek(replay_file, 0, SEEK_SET);
+                replay_put_dword(REPLAY_VERSION);
+            }
+        } else if (replay_log_zstd) {
+            replay_log_finish();
         }
 
         fclose(replay_file);
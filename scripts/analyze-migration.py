@@ -256,6 +256,39 @@ def getDict(self):
         return ""
 
 
+class DevicePrecopySection(object):
+    FLAG_STATE = 0x01
+    FLAG_EOS   = 0x02
+
+    def __init__(self, file, version_id, device, section_key):
+        if version_id != 1:
+            raise Exception("Unknown device precopy version %d" % version_id)
+
+        self.file = file
+        self.section_key = section_key
+
+    @staticmethod
+    def read_delta(file):
+        file.read32()
+        for i in range(file.read32()):
+            file.read32()
+            file.readvar(file.read32())
+
+    def read(self):
+        while True:
+            flags = self.file.read8()
+            if flags == self.FLAG_EOS:
+                break
+            if flags != self.FLAG_STATE:
+                raise Exception("Unknown device precopy flags %x" % flags)
+            self.file.readstr()
+            self.file.read32()
+            self.read_delta(self.file)
+
+    def getDict(self):
+        return ""
+
+
 class ConfigurationSection(object):
     def __init__(self, file):
         self.file = file
@@ -487,11 +520,14 @@ class MigrationDump(object):
     QEMU_VM_SUBSECTION    = 0x05
     QEMU_VM_VMDESCRIPTION = 0x06
     QEMU_VM_CONFIGURATION = 0x07
+    QEMU_VM_SECTION_FULL_SIZED = 0x09
+    QEMU_VM_SECTION_FULL_DELTA = 0x0a
     QEMU_VM_SECTION_FOOTER= 0x7e
 
     def __init__(self, filename):
         self.section_classes = { ( 'ram', 0 ) : [ RamSection, None ],
-                                 ( 'spapr/htab', 0) : ( HTABSection, None ) }
+                                 ( 'spapr/htab', 0) : ( HTABSection, None ),
+                                 ( 'device-precopy', 0) : ( DevicePrecopySection, None ) }
         self.filename = filename
         self.vmsd_desc = None
 
@@ -530,16 +566,26 @@ def read(self, desc_only = False, dump_memory = False, write_memory = False):
             elif section_type == self.QEMU_VM_CONFIGURATION:
                 section = ConfigurationSection(file)
                 section.read()
-            elif section_type == self.QEMU_VM_SECTION_START or section_type == self.QEMU_VM_SECTION_FULL:
+            elif section_type == self.QEMU_VM_SECTION_START or section_type == self.QEMU_VM_SECTION_FULL or section_type == self.QEMU_VM_SECTION_FULL_SIZED:
                 section_id = file.read32()
                 name = file.readstr()
                 instance_id = file.read32()
                 version_id = file.read32()
+                if section_type == self.QEMU_VM_SECTION_FULL_SIZED:
+                    # Length of the device state, which follows
+                    file.read32()
                 section_key = (name, instance_id)
                 classdesc = self.section_classes[section_key]
                 section = classdesc[0](file, version_id, classdesc[1], section_key)
                 self.sections[section_id] = section
                 section.read()
+            elif section_type == self.QEMU_VM_SECTION_FULL_DELTA:
+                # A delta to the early device state, which is not decoded
+                section_id = file.read32()
+                file.readstr()
+                file.read32()
+                file.read32()
+                DevicePrecopySection.read_delta(file)
             elif section_type == self.QEMU_VM_SECTION_PART or section_type == self.QEMU_VM_SECTION_END:
                 section_id = file.read32()
                 self.sections[section_id].read()
@@ -44,6 +44,16 @@
 insntype = 'uint32_t'
 decode_function = 'decode'
 
+# With --table, the first TABLE_LEVELS levels of the decode tree dispatch
+# through arrays of function pointers instead of switch statements.
+TABLE_LEVELS = 2
+TABLE_MAX_BITS = 8
+TABLE_MIN_SUBS = 4
+table_levels = 0
+table_depth = 0
+table_count = 0
+table_defs = []
+
 # An identifier for C.
 re_C_ident = '[a-zA-Z][a-zA-Z0-9_]*'
 
@@ -120,6 +130,52 @@ def whexC(val):
     return whex(val) + suffix
 
 
+def str_table_index(mask):
+    """Return a C expression gathering the bits of MASK from insn
+       into a dense index, least significant bit first."""
+    terms = []
+    pos = 0
+    sh = 0
+    while mask >> sh:
+        if not (mask >> sh) & 1:
+            sh += 1
+            continue
+        length = 0
+        while (mask >> (sh + length)) & 1:
+            length += 1
+        if sh:
+            t = f'((insn >> {sh}) & {(1 << length) - 1:#x})'
+        else:
+            t = f'(insn & {(1 << length) - 1:#x})'
+        if pos:
+            t = f'({t} << {pos})'
+        terms.append(t)
+        pos += length
+        sh += length
+    return ' | '.join(terms)
+
+
+def table_index(bits, mask):
+    """Return the index of BITS within the table selected by MASK"""
+    idx = 0
+    pos = 0
+    for sh in range(insnwidth):
+        if (mask >> sh) & 1:
+            idx |= ((bits >> sh) & 1) << pos
+            pos += 1
+    return idx
+
+
+def output_union(i):
+    """Output the union of all argument sets used by the patterns"""
+    ind = str_indent(i)
+    output(ind, 'union {\n')
+    for n in sorted(arguments.keys()):
+        f = arguments[n]
+        output(ind, '    ', f.struct_name(), ' f_', f.name, ';\n')
+    output(ind, '} u;\n\n')
+
+
 def str_match_bits(bits, mask):
     """Return a string pretty-printing BITS/MASK"""
     global insnwidth
@@ -532,9 +588,78 @@ def str1(self, i):
     def __str__(self):
         return self.str1(0)
 
+    def output_subfunc(self, s, outerbits, outermask):
+        """Output the decoder for subtree S into a function of its own
+           and return the function name."""
+        global output_fd
+        global table_count
+
+        name = f'{decode_function}_sub{table_count}'
+        table_count += 1
+        saved_fd = output_fd
+        output_fd = io.StringIO()
+        s.output_code(4, False, outerbits, outermask)
+        body = output_fd.getvalue()
+
+        output_fd = io.StringIO()
+        output('static bool ', name, '(DisasContext *ctx, ',
+               insntype, ' insn)\n{\n')
+        output('    /* ', str_match_bits(outerbits, outermask), ' */\n')
+        # A subtree that only dispatches to another table has no fields
+        if 'u.f_' in body:
+            output_union(4)
+        output(body)
+        output('    return false;\n}\n\n')
+        # Any tables used by S have been queued already
+        table_defs.append(output_fd.getvalue())
+        output_fd = saved_fd
+        return name
+
+    def output_table(self, i, outerbits, outermask):
+        """Dispatch through a table of functions indexed by the bits
+           of thismask.  Return False if a switch is a better fit."""
+        global table_depth
+        global table_count
+
+        nbits = bin(self.thismask).count('1')
+        if (table_depth >= table_levels or nbits > TABLE_MAX_BITS
+            or len(self.subs) < TABLE_MIN_SUBS):
+            return False
+
+        table_depth += 1
+        innermask = outermask | self.thismask
+        entries = []
+        for b, s in sorted(self.subs):
+            assert (self.thismask & ~s.fixedmask) == 0
+            fn = self.output_subfunc(s, outerbits | b, innermask)
+            entries.append((table_index(b, self.thismask), fn))
+        table_depth -= 1
+
+        name = f'{decode_function}_table{table_count}'
+        table_count += 1
+        text = (f'static {decode_function}_fn * const '
+                f'{name}[{1 << nbits}] = {{\n')
+        for idx, fn in sorted(entries):
+            text += f'    [{idx:#x}] = {fn},\n'
+        text += '};\n\n'
+        table_defs.append(text)
+
+        ind = str_indent(i)
+        output(ind, '{\n')
+        output(ind, f'    {decode_function}_fn *fn = {name}'
+               f'[{str_table_index(self.thismask)}];\n')
+        output(ind, '    if (fn && fn(ctx, insn)) {\n')
+        output(ind, '        return true;\n')
+        output(ind, '    }\n')
+        output(ind, '}\n')
+        return True
+
     def output_code(self, i, extracted, outerbits, outermask):
         ind = str_indent(i)
 
+        if self.output_table(i, outerbits, outermask):
+            return
+
         # If we identified all nodes below have the same format,
         # extract the fields now.
         if not extracted and self.base:
@@ -1286,11 +1411,12 @@ def main():
     global bitop_width
     global variablewidth
     global anyextern
+    global table_levels
 
     decode_scope = 'static '
 
     long_opts = ['decode=', 'translate=', 'output=', 'insnwidth=',
-                 'static-decode=', 'varinsnwidth=']
+                 'static-decode=', 'varinsnwidth=', 'table']
     try:
         (opts, args) = getopt.gnu_getopt(sys.argv[1:], 'o:vw:', long_opts)
     except getopt.GetoptError as err:
@@ -1306,6 +1432,8 @@ def main():
         elif o == '--translate':
             translate_prefix = a
             translate_scope = ''
+        elif o == '--table':
+            table_levels = TABLE_LEVELS
         elif o in ('-w', '--insnwidth', '--varinsnwidth'):
             if o == '--varinsnwidth':
                 variablewidth = True
@@ -1392,20 +1520,30 @@ def main():
         f = formats[n]
         f.output_extract()
 
-    output(decode_scope, 'bool ', decode_function,
-           '(DisasContext *ctx, ', insntype, ' insn)\n{\n')
-
-    i4 = str_indent(4)
-
+    # With tables, the subtree functions and their tables must precede
+    # the decoder, so generate its body first.
+    body = ''
     if len(allpatterns) != 0:
-        output(i4, 'union {\n')
-        for n in sorted(arguments.keys()):
-            f = arguments[n]
-            output(i4, i4, f.struct_name(), ' f_', f.name, ';\n')
-        output(i4, '} u;\n\n')
+        saved_fd = output_fd
+        output_fd = io.StringIO()
         toppat.output_code(4, False, 0, 0)
+        body = output_fd.getvalue()
+        if 'u.f_' in body:
+            output_fd = io.StringIO()
+            output_union(4)
+            body = output_fd.getvalue() + body
+        output_fd = saved_fd
+
+    if table_defs:
+        output('typedef bool ', decode_function, '_fn(DisasContext *ctx, ',
+               insntype, ' insn);\n\n')
+        for d in table_defs:
+            output(d)
 
-    output(i4, 'return false;\n')
+    output(decode_scope, 'bool ', decode_function,
+           '(DisasContext *ctx, ', insntype, ' insn)\n{\n')
+    output(body)
+    output('    return false;\n')
     output('}\n')
 
     if variablewidth:
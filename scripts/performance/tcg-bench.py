@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+
+#  Measure translation speed, TB lookup hit rates, helper calls and host
+#  instructions per guest instruction for a set of linux-user guest
+#  programs, and print the results as JSON.
+#
+#  Syntax:
+#  tcg-bench.py [-h] [--build-dir DIR] [--targets LIST] [--tests LIST]
+#               [--repeat N] [--no-perf] [--output FILE]
+#
+#  The guest programs are those built by "make build-tcg" under
+#  <build dir>/tests/tcg/<target>/.  Each program runs twice: once with
+#  -tcg-stats, under "perf stat" when perf is available, and once with
+#  the insn plugin to count the guest instructions it executes.
+#
+#  Example of usage:
+#  tcg-bench.py --build-dir build --targets aarch64-linux-user --tests sha1
+#
+#  This work is licensed under the terms of the GNU GPL, version 2 or later.
+#  See the COPYING file in the top-level directory.
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+
+DEFAULT_TESTS = "sha1,float_madds,test-mmap"
+
+
+def ratio(num, den):
+    """
+    Return num / den, or None when the denominator is zero.
+    """
+    if not den:
+        return None
+    return num / den
+
+
+def run_stats(qemu, test, tmpdir, use_perf):
+    """
+    Run the test with -tcg-stats, under perf if requested.
+
+    Returns:
+    (dict, float, int): TCG statistics, wall time in seconds and host
+                        instructions (None without perf)
+    """
+    stats_path = os.path.join(tmpdir, "tcg-stats.json")
+    perf_path = os.path.join(tmpdir, "perf.csv")
+    command = [qemu, "-tcg-stats", stats_path, test]
+    if use_perf:
+        command = ["perf", "stat", "-x,", "-e", "instructions:u",
+                   "-o", perf_path] + command
+
+    start = time.monotonic()
+    run = subprocess.run(command, stdout=subprocess.DEVNULL,
+                         stderr=subprocess.PIPE)
+    wall = time.monotonic() - start
+    if run.returncode:
+        sys.exit("%s failed:\n%s" % (" ".join(command),
+                                     run.stderr.decode("utf-8")))
+
+    with open(stats_path, "r") as stats_file:
+        stats = json.load(stats_file)
+
+    host_insns = None
+    if use_perf:
+        with open(perf_path, "r") as perf_file:
+            for line in perf_file:
+                fields = line.split(",")
+                if len(fields) > 2 and fields[2].startswith("instructions"):
+                    host_insns = int(fields[0])
+    return stats, wall, host_insns
+
+
+def run_guest_insns(qemu, plugin, test, tmpdir):
+    """
+    Count the guest instructions executed by the test with the insn plugin.
+    """
+    log_path = os.path.join(tmpdir, "insn.log")
+    command = [qemu, "-plugin", plugin + ",arg=inline", "-d", "plugin",
+               "-D", log_path, test]
+    run = subprocess.run(command, stdout=subprocess.DEVNULL,
+                         stderr=subprocess.PIPE)
+    if run.returncode:
+        sys.exit("%s failed:\n%s" % (" ".join(command),
+                                     run.stderr.decode("utf-8")))
+
+    with open(log_path, "r") as log:
+        match = re.search(r"insns: (\d+)", log.read())
+    return int(match.group(1)) if match else None
+
+
+def bench(qemu, plugin, target, test, use_perf):
+    """
+    Benchmark one guest program and return its result record.
+    """
+    with tempfile.TemporaryDirectory() as tmpdir:
+        stats, wall, host_insns = run_stats(qemu, test, tmpdir, use_perf)
+        guest_insns = None
+        if plugin:
+            guest_insns = run_guest_insns(qemu, plugin, test, tmpdir)
+
+    translate_s = stats["translate-ns"] / 1e9
+    jmp_misses = stats["tb-jmp-cache-misses"]
+    jmp_hit_rate = ratio(stats["tb-lookups"] - jmp_misses,
+                         stats["tb-lookups"])
+    # Hash table misses are the lookups that ended up translating
+    htable_hit_rate = ratio(max(jmp_misses - stats["tb-translations"], 0),
+                            jmp_misses)
+    host_per_guest = None
+    if host_insns is not None and guest_insns:
+        host_per_guest = host_insns / guest_insns
+
+    return {
+        "target": target,
+        "test": os.path.basename(test),
+        "wall-time-s": wall,
+        "tcg-stats": stats,
+        "translate-time-s": translate_s,
+        "tbs-per-second": ratio(stats["tb-translations"], translate_s),
+        "tb-jmp-cache-hit-rate": jmp_hit_rate,
+        "tb-htable-hit-rate": htable_hit_rate,
+        "helper-calls-per-tb": ratio(stats["helper-calls-translated"],
+                                     stats["tb-translations"]),
+        "host-bytes-per-guest-insn": ratio(stats["host-bytes"],
+                                           stats["guest-insns-translated"]),
+        "guest-insns-executed": guest_insns,
+        "host-insns": host_insns,
+        "host-insns-per-guest-insn": host_per_guest,
+    }
+
+
+def main():
+    # Parse the command line arguments
+    parser = argparse.ArgumentParser(
+        usage='tcg-bench.py [-h] [--build-dir DIR] [--targets LIST] '
+        '[--tests LIST] [--repeat N] [--no-perf] [--output FILE]')
+
+    parser.add_argument('--build-dir', dest='build_dir', default='.',
+                        help='QEMU build directory (default: current)')
+    parser.add_argument('--targets', dest='targets', default=None,
+                        help='comma or space separated linux-user targets '
+                        '(default: all with built TCG tests)')
+    parser.add_argument('--tests', dest='tests', default=DEFAULT_TESTS,
+                        help='comma-separated guest programs '
+                        '(default: %s)' % DEFAULT_TESTS)
+    parser.add_argument('--repeat', dest='repeat', default=1, type=int,
+                        help='runs of each program (default: 1)')
+    parser.add_argument('--no-perf', dest='perf', default=True,
+                        action='store_false',
+                        help='do not count host instructions with perf')
+    parser.add_argument('--output', dest='output', default=None,
+                        help='write the JSON results to a file')
+
+    args = parser.parse_args()
+
+    tcg_dir = os.path.join(args.build_dir, "tests", "tcg")
+    if args.targets and args.targets.strip():
+        targets = re.split(r"[,\s]+", args.targets.strip())
+    elif os.path.isdir(tcg_dir):
+        targets = sorted(d for d in os.listdir(tcg_dir)
+                         if d.endswith("-linux-user"))
+    else:
+        targets = []
+    if not targets:
+        sys.exit("No linux-user TCG tests found, run 'make build-tcg' first.")
+
+    use_perf = args.perf and shutil.which("perf") is not None
+    plugin = os.path.join(args.build_dir, "tests", "plugin", "libinsn.so")
+    if not os.path.exists(plugin):
+        plugin = None
+
+    results = []
+    for target in targets:
+        qemu = os.path.join(args.build_dir,
+                            "qemu-" + target[:-len("-linux-user")])
+        if not os.path.exists(qemu):
+            sys.exit("%s not found." % qemu)
+        for test in args.tests.split(","):
+            path = os.path.join(tcg_dir, target, test)
+            if not os.path.exists(path):
+                continue
+            for _ in range(args.repeat):
+                results.append(bench(qemu, plugin, target, path, use_perf))
+
+    output = json.dumps({"results": results}, indent=4)
+    if args.output:
+        with open(args.output, "w") as output_file:
+            print(output, file=output_file)
+    else:
+        print(output)
+
+
+if __name__ == "__main__":
+    main()
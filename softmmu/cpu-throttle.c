@@ -77,6 +77,9 @@ static void cpu_throttle_timer_tick(void *opaque)
         return;
     }
     CPU_FOREACH(cpu) {
+        if (qatomic_read(&cpu->throttle_exempt)) {
+            continue;
+        }
         if (!qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
             async_run_on_cpu(cpu, cpu_throttle_thread,
                              RUN_ON_CPU_NULL);
@@ -109,7 +112,17 @@ void cpu_throttle_set(int new_throttle_pct)
 
 void cpu_throttle_stop(void)
 {
+    CPUState *cpu;
+
     qatomic_set(&throttle_percentage, 0);
+    CPU_FOREACH(cpu) {
+        qatomic_set(&cpu->throttle_exempt, false);
+    }
+}
+
+void cpu_throttle_set_exempt(CPUState *cpu, bool exempt)
+{
+    qatomic_set(&cpu->throttle_exempt, exempt);
 }
 
 bool cpu_throttle_active(void)
@@ -35,7 +35,10 @@
 #include "exec/exec-all.h"
 #include "qemu/thread.h"
 #include "qemu/plugin.h"
+#include "qemu/processor.h"
+#include "qemu/accel.h"
 #include "sysemu/cpus.h"
+#include "sysemu/stats.h"
 #include "qemu/guest-random.h"
 #include "hw/nmi.h"
 #include "sysemu/replay.h"
@@ -372,6 +375,51 @@ static QemuCond qemu_cpu_cond;
 /* system init */
 static QemuCond qemu_pause_cond;
 
+static const StatsDescriptor halt_poll_stats[] = {
+    { "poll-ns", STATS_TYPE_INSTANT, true, STATS_UNIT_NANOSECONDS },
+    { "attempted-polls", STATS_TYPE_CUMULATIVE },
+    { "successful-polls", STATS_TYPE_CUMULATIVE },
+    { "poll-success-ns", STATS_TYPE_CUMULATIVE, true,
+      STATS_UNIT_NANOSECONDS },
+    { "poll-fail-ns", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_NANOSECONDS },
+};
+
+static void halt_poll_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *targets, strList *names,
+                               Error **errp)
+{
+    CPUState *cpu;
+
+    if (target != STATS_TARGET_VCPU) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        g_autofree char *path = object_get_canonical_path(OBJECT(cpu));
+        StatsList *stats = NULL;
+
+        if (!apply_str_list_filter(path, targets)) {
+            continue;
+        }
+        stats_add_value(&stats, names, "poll-ns", cpu->halt_poll_ns);
+        stats_add_value(&stats, names, "attempted-polls",
+                        cpu->halt_poll_attempts);
+        stats_add_value(&stats, names, "successful-polls",
+                        cpu->halt_poll_successes);
+        stats_add_value(&stats, names, "poll-success-ns",
+                        cpu->halt_poll_success_ns);
+        stats_add_value(&stats, names, "poll-fail-ns",
+                        cpu->halt_poll_fail_ns);
+        stats_add_result(result, STATS_PROVIDER_HALT_POLL, path, stats);
+    }
+}
+
+static void halt_poll_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    stats_add_schema(result, STATS_PROVIDER_HALT_POLL, STATS_TARGET_VCPU,
+                     halt_poll_stats, ARRAY_SIZE(halt_poll_stats));
+}
+
 void qemu_init_cpu_loop(void)
 {
     qemu_init_sigbus();
@@ -380,6 +428,8 @@ void qemu_init_cpu_loop(void)
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
+    add_stats_callbacks(STATS_PROVIDER_HALT_POLL, halt_poll_stats_cb,
+                        halt_poll_schemas_cb);
 }
 
 void run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data)
@@ -407,20 +457,111 @@ void qemu_wait_io_event_common(CPUState *cpu)
     process_queued_cpu_work(cpu);
 }
 
+/* Polling time after the first short halt, as in KVM */
+#define HALT_POLL_GROW_START_NS 10000
+
+static void cpu_halt_poll_grow(CPUState *cpu, AccelState *accel)
+{
+    int64_t grow = qatomic_read(&accel->halt_poll_grow) ?: 2;
+    int64_t val = cpu->halt_poll_ns * grow;
+
+    val = MAX(val, HALT_POLL_GROW_START_NS);
+    cpu->halt_poll_ns = MIN(val, qatomic_read(&accel->halt_poll_max_ns));
+}
+
+static void cpu_halt_poll_shrink(CPUState *cpu, AccelState *accel)
+{
+    int64_t shrink = qatomic_read(&accel->halt_poll_shrink);
+
+    cpu->halt_poll_ns = shrink ? cpu->halt_poll_ns / shrink : 0;
+}
+
+/*
+ * Adapt the polling time of @cpu to a halt that lasted @block_ns, with
+ * the same algorithm as KVM's halt_poll_ns: grow it after halts that
+ * ended soon after the poll did, reset or shrink it after halts that
+ * were too long to poll for.
+ */
+static void cpu_halt_poll_update(CPUState *cpu, AccelState *accel,
+                                 int64_t block_ns)
+{
+    int64_t max_ns = qatomic_read(&accel->halt_poll_max_ns);
+
+    if (block_ns <= cpu->halt_poll_ns) {
+        /* Woken up while polling */
+    } else if (cpu->halt_poll_ns && block_ns > max_ns) {
+        cpu_halt_poll_shrink(cpu, accel);
+    } else if (cpu->halt_poll_ns < max_ns && block_ns < max_ns) {
+        cpu_halt_poll_grow(cpu, accel);
+    }
+    cpu->halt_poll_ns = MIN(cpu->halt_poll_ns, max_ns);
+    trace_cpu_halt_poll_update(cpu->cpu_index, block_ns, cpu->halt_poll_ns);
+}
+
+/*
+ * Busy wait without the BQL for up to cpu->halt_poll_ns, or until
+ * qemu_cpu_kick() is called for @cpu.  Avoids the latency of a sleep on
+ * halt_cond for wakeups that come quickly, e.g. guest IPIs.
+ *
+ * Returns: true if @cpu was kicked while polling.
+ */
+static bool cpu_halt_poll(CPUState *cpu)
+{
+    unsigned int kicks = qatomic_read(&cpu->halt_poll_kicks);
+    int64_t start = get_clock();
+    int64_t elapsed;
+    bool kicked = false;
+
+    qemu_mutex_unlock_iothread();
+    do {
+        if (qatomic_read(&cpu->halt_poll_kicks) != kicks) {
+            kicked = true;
+            break;
+        }
+        cpu_relax();
+        elapsed = get_clock() - start;
+    } while (elapsed < cpu->halt_poll_ns);
+    elapsed = get_clock() - start;
+    qemu_mutex_lock_iothread();
+
+    cpu->halt_poll_attempts++;
+    if (kicked) {
+        cpu->halt_poll_successes++;
+        cpu->halt_poll_success_ns += elapsed;
+    } else {
+        cpu->halt_poll_fail_ns += elapsed;
+    }
+    return kicked;
+}
+
 void qemu_wait_io_event(CPUState *cpu)
 {
+    AccelState *accel = current_accel();
     bool slept = false;
+    int64_t halt_start = 0;
 
     while (cpu_thread_is_idle(cpu)) {
         if (!slept) {
             slept = true;
             qemu_plugin_vcpu_idle_cb(cpu);
+
+            /* Only guest halts are worth polling for, not pauses */
+            if (cpu->halted && !cpu_is_stopped(cpu) &&
+                qatomic_read(&accel->halt_poll_max_ns)) {
+                halt_start = get_clock();
+                if (cpu->halt_poll_ns && cpu_halt_poll(cpu)) {
+                    continue;
+                }
+            }
         }
         qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
     }
     if (slept) {
         qemu_plugin_vcpu_resume_cb(cpu);
     }
+    if (halt_start) {
+        cpu_halt_poll_update(cpu, accel, get_clock() - halt_start);
+    }
 
 #ifdef _WIN32
     /* Eat dummy APC queued by cpus_kick_thread. */
@@ -450,6 +591,7 @@ void cpus_kick_thread(CPUState *cpu)
 
 void qemu_cpu_kick(CPUState *cpu)
 {
+    qatomic_inc(&cpu->halt_poll_kicks);
     qemu_cond_broadcast(cpu->halt_cond);
     if (cpus_accel->kick_vcpu_thread) {
         cpus_accel->kick_vcpu_thread(cpu);
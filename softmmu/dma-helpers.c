@@ -15,6 +15,7 @@
 #include "qemu/main-loop.h"
 #include "sysemu/cpu-timers.h"
 #include "qemu/range.h"
+#include "qemu/units.h"
 
 /* #define DEBUG_IOMMU */
 
@@ -71,6 +72,20 @@ void qemu_sglist_destroy(QEMUSGList *qsg)
     memset(qsg, 0, sizeof(*qsg));
 }
 
+/*
+ * Private bounce buffers of a request, for the parts of the scatter/gather
+ * list that dma_memory_map() could not map.  This keeps a request that
+ * touches MMIO, or finds the address space's bounce buffer busy, from
+ * being split into many small I/Os.
+ */
+#define DMA_PRIVATE_BOUNCE_MAX (1 * MiB)
+
+typedef struct {
+    int index;              /* in the I/O vector */
+    dma_addr_t addr;
+    void *buf;
+} DMABounce;
+
 typedef struct {
     BlockAIOCB common;
     AioContext *ctx;
@@ -82,6 +97,8 @@ typedef struct {
     int sg_cur_index;
     dma_addr_t sg_cur_byte;
     QEMUIOVector iov;
+    GArray *bounce;
+    dma_addr_t bounce_size;
     QEMUBH *bh;
     DMAIOFunc *io_func;
     void *io_func_opaque;
@@ -99,16 +116,67 @@ static void reschedule_dma(void *opaque)
     dma_blk_cb(dbs, 0);
 }
 
+static void *dma_blk_bounce(DMAAIOCB *dbs, dma_addr_t addr, dma_addr_t *len)
+{
+    DMABounce b;
+
+    *len = MIN(*len, DMA_PRIVATE_BOUNCE_MAX - dbs->bounce_size);
+    if (*len == 0) {
+        return NULL;
+    }
+    b.buf = g_try_malloc(*len);
+    if (!b.buf) {
+        return NULL;
+    }
+    b.index = dbs->iov.niov;
+    b.addr = addr;
+    if (dbs->dir == DMA_DIRECTION_TO_DEVICE) {
+        dma_memory_read(dbs->sg->as, addr, b.buf, *len);
+    }
+
+    if (!dbs->bounce) {
+        dbs->bounce = g_array_new(false, false, sizeof(DMABounce));
+    }
+    g_array_append_val(dbs->bounce, b);
+    dbs->bounce_size += *len;
+    trace_dma_blk_bounce(dbs, addr, *len);
+    return b.buf;
+}
+
 static void dma_blk_unmap(DMAAIOCB *dbs)
 {
+    DMABounce *b = NULL;
+    guint nb = 0, j = 0;
     int i;
 
+    if (dbs->bounce) {
+        b = &g_array_index(dbs->bounce, DMABounce, 0);
+        nb = dbs->bounce->len;
+    }
+
     for (i = 0; i < dbs->iov.niov; ++i) {
+        if (j < nb && b[j].index == i) {
+            if (dbs->dir == DMA_DIRECTION_FROM_DEVICE) {
+                dma_memory_write(dbs->sg->as, b[j].addr, b[j].buf,
+                                 dbs->iov.iov[i].iov_len);
+            }
+            j++;
+            continue;
+        }
         dma_memory_unmap(dbs->sg->as, dbs->iov.iov[i].iov_base,
                          dbs->iov.iov[i].iov_len, dbs->dir,
                          dbs->iov.iov[i].iov_len);
     }
     qemu_iovec_reset(&dbs->iov);
+
+    /* Bounced parts past the end of the I/O vector were not used */
+    for (j = 0; j < nb; j++) {
+        g_free(b[j].buf);
+    }
+    if (dbs->bounce) {
+        g_array_set_size(dbs->bounce, 0);
+    }
+    dbs->bounce_size = 0;
 }
 
 static void dma_complete(DMAAIOCB *dbs, int ret)
@@ -121,6 +189,9 @@ static void dma_complete(DMAAIOCB *dbs, int ret)
         dbs->common.cb(dbs->common.opaque, ret);
     }
     qemu_iovec_destroy(&dbs->iov);
+    if (dbs->bounce) {
+        g_array_free(dbs->bounce, true);
+    }
     qemu_aio_unref(dbs);
 }
 
@@ -142,17 +213,27 @@ static void dma_blk_cb(void *opaque, int ret)
     dma_blk_unmap(dbs);
 
     while (dbs->sg_cur_index < dbs->sg->nsg) {
+        bool bounced = false;
+
         cur_addr = dbs->sg->sg[dbs->sg_cur_index].base + dbs->sg_cur_byte;
         cur_len = dbs->sg->sg[dbs->sg_cur_index].len - dbs->sg_cur_byte;
         mem = dma_memory_map(dbs->sg->as, cur_addr, &cur_len, dbs->dir);
+        if (!mem) {
+            /* Not RAM, or the address space's bounce buffer is in use */
+            cur_len = dbs->sg->sg[dbs->sg_cur_index].len - dbs->sg_cur_byte;
+            mem = dma_blk_bounce(dbs, cur_addr, &cur_len);
+            bounced = true;
+        }
         /*
          * Make reads deterministic in icount mode. Windows sometimes issues
          * disk read requests with overlapping SGs. It leads
          * to non-determinism, because resulting buffer contents may be mixed
          * from several sectors. This code splits all SGs into several
-         * groups. SGs in every group do not overlap.
+         * groups. SGs in every group do not overlap.  Private bounce
+         * buffers are copied back in order, so they need no check.
          */
-        if (mem && icount_enabled() && dbs->dir == DMA_DIRECTION_FROM_DEVICE) {
+        if (mem && !bounced && icount_enabled() &&
+            dbs->dir == DMA_DIRECTION_FROM_DEVICE) {
             int i;
             for (i = 0 ; i < dbs->iov.niov ; ++i) {
                 if (ranges_overlap((intptr_t)dbs->iov.iov[i].iov_base,
@@ -178,7 +259,7 @@ static void dma_blk_cb(void *opaque, int ret)
     if (dbs->iov.size == 0) {
         trace_dma_map_wait(dbs);
         dbs->bh = aio_bh_new(dbs->ctx, reschedule_dma, dbs);
-        cpu_register_map_client(dbs->bh);
+        address_space_register_map_client(dbs->sg->as, dbs->bh);
         return;
     }
 
@@ -208,7 +289,7 @@ static void dma_aio_cancel(BlockAIOCB *acb)
     }
 
     if (dbs->bh) {
-        cpu_unregister_map_client(dbs->bh);
+        address_space_unregister_map_client(dbs->sg->as, dbs->bh);
         qemu_bh_delete(dbs->bh);
         dbs->bh = NULL;
     }
@@ -251,6 +332,8 @@ BlockAIOCB *dma_blk_io(AioContext *ctx,
     dbs->io_func = io_func;
     dbs->io_func_opaque = io_func_opaque;
     dbs->bh = NULL;
+    dbs->bounce = NULL;
+    dbs->bounce_size = 0;
     qemu_iovec_init(&dbs->iov, sg->nsg);
     dma_blk_cb(dbs, 0);
     return &dbs->common;
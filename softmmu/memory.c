@@ -21,6 +21,7 @@
 #include "qemu/bitops.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "block/aio.h"
 #include "qemu/qemu-print.h"
 #include "qom/object.h"
 #include "trace.h"
@@ -39,7 +40,7 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
-bool global_dirty_log;
+unsigned int global_dirty_log;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
@@ -170,6 +171,18 @@ struct MemoryRegionIoeventfd {
     EventNotifier *e;
 };
 
+struct MemoryRegionDoorbell {
+    MemoryRegion *mr;
+    hwaddr addr;
+    unsigned size;
+    bool match_data;
+    uint64_t data;
+    AioContext *ctx;
+    MemoryRegionDoorbellFn *fn;
+    void *opaque;
+    EventNotifier e;
+};
+
 static bool memory_region_ioeventfd_before(MemoryRegionIoeventfd *a,
                                            MemoryRegionIoeventfd *b)
 {
@@ -252,6 +265,22 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
         && a->nonvolatile == b->nonvolatile;
 }
 
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static FlatView *flatview_new(MemoryRegion *mr_root)
 {
     FlatView *view;
@@ -720,8 +749,13 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/*
+ * Render a memory topology into a list of disjoint absolute ranges.
+ * If the result is the same as @old_view, @old_view is used again so that
+ * its dispatch tree need not be rebuilt.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr,
+                                          FlatView *old_view)
 {
     int i;
     FlatView *view;
@@ -735,6 +769,15 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old_view && flatview_equal(view, old_view)) {
+        /* Never published, so it can go right away */
+        flatview_destroy(view);
+        trace_flatview_reuse(old_view, mr);
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return old_view;
+    }
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -988,7 +1031,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -999,12 +1042,11 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    /* Keep the old views until the new ones have been compared to them */
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
@@ -1015,7 +1057,13 @@ static void flatviews_reset(void)
             continue;
         }
 
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, old_views ?
+                                 g_hash_table_lookup(old_views, physmr) :
+                                 NULL);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1028,6 +1076,10 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /* Nothing changed, but listeners rebuilding their state want nops */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, old_view, new_view, true);
+        }
         return;
     }
 
@@ -1070,7 +1122,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -1242,6 +1294,7 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
@@ -2071,7 +2124,10 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
-        if (listener->log_sync) {
+        if (!mr && listener->log_sync_global) {
+            /* A global sync is cheaper done at once, if possible */
+            listener->log_sync_global(listener);
+        } else if (listener->log_sync) {
             as = listener->address_space;
             view = address_space_get_flatview(as);
             FOR_EACH_FLAT_RANGE(fr, view) {
@@ -2346,6 +2402,16 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_set_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = true;
+}
+
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -2425,6 +2491,61 @@ void memory_region_del_eventfd(MemoryRegion *mr,
     memory_region_transaction_commit();
 }
 
+static void memory_region_doorbell_read(EventNotifier *e)
+{
+    MemoryRegionDoorbell *db = container_of(e, MemoryRegionDoorbell, e);
+
+    if (event_notifier_test_and_clear(e)) {
+        trace_memory_region_doorbell(db->mr, db->addr);
+        db->fn(db->opaque);
+    }
+}
+
+MemoryRegionDoorbell *memory_region_add_doorbell(MemoryRegion *mr,
+                                                 hwaddr addr,
+                                                 unsigned size,
+                                                 bool match_data,
+                                                 uint64_t data,
+                                                 AioContext *ctx,
+                                                 MemoryRegionDoorbellFn *fn,
+                                                 void *opaque,
+                                                 Error **errp)
+{
+    MemoryRegionDoorbell *db = g_new0(MemoryRegionDoorbell, 1);
+    int ret;
+
+    ret = event_notifier_init(&db->e, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to create doorbell eventfd");
+        g_free(db);
+        return NULL;
+    }
+
+    db->mr = mr;
+    db->addr = addr;
+    /* A zero size matches writes of any length */
+    db->size = !match_data && kvm_ioeventfd_any_length_enabled() ? 0 : size;
+    db->match_data = match_data;
+    db->data = data;
+    db->ctx = ctx;
+    db->fn = fn;
+    db->opaque = opaque;
+
+    aio_set_event_notifier(ctx, &db->e, true,
+                           memory_region_doorbell_read, NULL);
+    memory_region_add_eventfd(mr, addr, db->size, match_data, data, &db->e);
+    return db;
+}
+
+void memory_region_del_doorbell(MemoryRegionDoorbell *db)
+{
+    memory_region_del_eventfd(db->mr, db->addr, db->size, db->match_data,
+                              db->data, &db->e);
+    aio_set_event_notifier(db->ctx, &db->e, true, NULL, NULL);
+    event_notifier_cleanup(&db->e);
+    g_free(db);
+}
+
 static void memory_region_update_container_subregions(MemoryRegion *subregion)
 {
     MemoryRegion *mr = subregion->container;
@@ -2657,61 +2778,100 @@ void memory_global_after_dirty_log_sync(void)
 }
 
 static VMChangeStateEntry *vmstate_change;
+static unsigned int postponed_stop_flags;
 
-void memory_global_dirty_log_start(void)
+static void memory_global_dirty_log_do_stop(unsigned int flags)
 {
-    if (vmstate_change) {
-        qemu_del_vm_change_state_handler(vmstate_change);
-        vmstate_change = NULL;
+    assert(flags && !(flags & ~GLOBAL_DIRTY_MASK));
+
+    /* Stopping a user that never started is harmless, as it used to be */
+    flags &= global_dirty_log;
+    if (!flags) {
+        return;
     }
 
-    global_dirty_log = true;
+    global_dirty_log &= ~flags;
+    trace_global_dirty_changed(global_dirty_log);
 
-    MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
+    if (global_dirty_log) {
+        return;
+    }
 
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
     memory_region_transaction_commit();
+
+    MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
+}
+
+static void memory_global_dirty_log_stop_postponed_run(void)
+{
+    assert(vmstate_change);
+
+    if (postponed_stop_flags) {
+        memory_global_dirty_log_do_stop(postponed_stop_flags);
+        postponed_stop_flags = 0;
+    }
+
+    qemu_del_vm_change_state_handler(vmstate_change);
+    vmstate_change = NULL;
 }
 
-static void memory_global_dirty_log_do_stop(void)
+void memory_global_dirty_log_start(unsigned int flags)
 {
-    global_dirty_log = false;
+    unsigned int old_flags;
+
+    assert(flags && !(flags & ~GLOBAL_DIRTY_MASK));
+
+    if (vmstate_change) {
+        /* A postponed stop of the same users is simply cancelled */
+        postponed_stop_flags &= ~flags;
+        memory_global_dirty_log_stop_postponed_run();
+    }
+
+    flags &= ~global_dirty_log;
+    if (!flags) {
+        return;
+    }
+
+    old_flags = global_dirty_log;
+    global_dirty_log |= flags;
+    trace_global_dirty_changed(global_dirty_log);
+
+    if (old_flags) {
+        return;
+    }
+
+    MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
 
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
     memory_region_transaction_commit();
-
-    MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
 }
 
 static void memory_vm_change_state_handler(void *opaque, bool running,
                                            RunState state)
 {
     if (running) {
-        memory_global_dirty_log_do_stop();
-
-        if (vmstate_change) {
-            qemu_del_vm_change_state_handler(vmstate_change);
-            vmstate_change = NULL;
-        }
+        memory_global_dirty_log_stop_postponed_run();
     }
 }
 
-void memory_global_dirty_log_stop(void)
+void memory_global_dirty_log_stop(unsigned int flags)
 {
     if (!runstate_is_running()) {
-        if (vmstate_change) {
-            return;
+        /* Postpone the stop until the VM runs again, batching the users */
+        postponed_stop_flags |= flags;
+        if (!vmstate_change) {
+            vmstate_change = qemu_add_vm_change_state_handler(
+                                    memory_vm_change_state_handler, NULL);
         }
-        vmstate_change = qemu_add_vm_change_state_handler(
-                                memory_vm_change_state_handler, NULL);
         return;
     }
 
-    memory_global_dirty_log_do_stop();
+    memory_global_dirty_log_do_stop(flags);
 }
 
 static void listener_add_address_space(MemoryListener *listener,
@@ -2776,9 +2936,6 @@ void memory_listener_register(MemoryListener *listener, AddressSpace *as)
 {
     MemoryListener *other = NULL;
 
-    /* Only one of them can be defined for a listener */
-    assert(!(listener->log_sync && listener->log_sync_global));
-
     listener->address_space = as;
     if (QTAILQ_EMPTY(&memory_listeners)
         || listener->priority >= QTAILQ_LAST(&memory_listeners)->priority) {
@@ -2835,6 +2992,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    as->bounce_buffer_size = 0;
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -2842,6 +3003,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(qatomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -145,6 +145,7 @@ static const char *cpu_option;
 static const char *mem_path;
 static const char *incoming;
 static const char *loadvm;
+static const char *clone_template;
 static const char *accelerators;
 static QDict *machine_opts_dict;
 static QTAILQ_HEAD(, ObjectOption) object_opts = QTAILQ_HEAD_INITIALIZER(object_opts);
@@ -430,6 +431,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -2414,6 +2418,11 @@ static void qemu_validate_options(const QDict *machine_opts)
                      "mutually exclusive");
         exit(EXIT_FAILURE);
     }
+    if (clone_template && (preconfig_requested || loadvm || incoming)) {
+        error_report("'clone-template' cannot be used with 'preconfig', "
+                     "'loadvm' or 'incoming'");
+        exit(EXIT_FAILURE);
+    }
     if (incoming && preconfig_requested && strcmp(incoming, "defer") != 0) {
         error_report("'preconfig' supports '-incoming defer' only");
         exit(EXIT_FAILURE);
@@ -2623,6 +2632,9 @@ static void qemu_machine_creation_done(void)
 {
     MachineState *machine = MACHINE(qdev_get_machine());
 
+    /* Wait for the memory backends that are still being preallocated */
+    os_mem_prealloc_finish(&error_fatal);
+
     /* Did we create any drives that we failed to create a device for? */
     drive_check_orphaned();
 
@@ -2673,6 +2685,13 @@ void qmp_x_exit_preconfig(Error **errp)
             exit(1);
         }
     }
+    if (clone_template) {
+        Error *local_err = NULL;
+        if (!load_clone_template(clone_template, &local_err)) {
+            error_report_err(local_err);
+            exit(1);
+        }
+    }
     if (replay_mode != REPLAY_MODE_NONE) {
         replay_vmstate_init();
     }
@@ -2719,6 +2738,8 @@ void qemu_init(int argc, char **argv, char **envp)
     bool userconfig = true;
     FILE *vmstate_dump_file = NULL;
 
+    phase_start();
+
     qemu_add_opts(&qemu_drive_opts);
     qemu_add_drive_opts(&qemu_legacy_drive_opts);
     qemu_add_drive_opts(&qemu_common_drive_opts);
@@ -3222,6 +3243,9 @@ void qemu_init(int argc, char **argv, char **envp)
             case QEMU_OPTION_loadvm:
                 loadvm = optarg;
                 break;
+            case QEMU_OPTION_clone_template:
+                clone_template = optarg;
+                break;
             case QEMU_OPTION_full_screen:
                 dpy.has_full_screen = true;
                 dpy.full_screen = true;
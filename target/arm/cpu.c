@@ -1984,6 +1984,7 @@ static const struct TCGCPUOps arm_tcg_ops = {
     .do_unaligned_access = arm_cpu_do_unaligned_access,
     .adjust_watchpoint_address = arm_adjust_watchpoint_address,
     .debug_check_watchpoint = arm_debug_check_watchpoint,
+    .tlb_sync_at_barrier = true,
 #endif /* !CONFIG_USER_ONLY */
 };
 #endif /* CONFIG_TCG */
@@ -345,6 +345,16 @@ void HELPER(yield)(CPUARMState *env)
     cpu_loop_exit(cs);
 }
 
+/*
+ * Broadcast TLB maintenance is only guaranteed to be complete once a DSB
+ * has executed, so the TLBI helpers leave the wait for the other vCPUs
+ * to the DSB.  This restarts the DSB after the wait if needed.
+ */
+void HELPER(dsb_tlb_sync)(CPUARMState *env)
+{
+    tlb_flush_sync(env_cpu(env), GETPC());
+}
+
 /* Raise an internal-to-QEMU exception. This is limited to only
  * those EXCP values which are special cases for QEMU to interrupt
  * execution and not to be used for exceptions which are passed to
@@ -1570,6 +1570,11 @@ static void handle_sync(DisasContext *s, uint32_t insn,
             bar = TCG_BAR_SC | TCG_MO_ALL;
             break;
         }
+#ifndef CONFIG_USER_ONLY
+        if (op2 == 4) {
+            gen_helper_dsb_tlb_sync(cpu_env);
+        }
+#endif
         tcg_gen_mb(bar);
         return;
     case 6: /* ISB */
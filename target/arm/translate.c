@@ -8886,13 +8886,20 @@ static bool trans_DSB(DisasContext *s, arg_DSB *a)
     if (!ENABLE_ARCH_7 && !arm_dc_feature(s, ARM_FEATURE_M)) {
         return false;
     }
+#ifndef CONFIG_USER_ONLY
+    gen_helper_dsb_tlb_sync(cpu_env);
+#endif
     tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
     return true;
 }
 
 static bool trans_DMB(DisasContext *s, arg_DMB *a)
 {
-    return trans_DSB(s, NULL);
+    if (!ENABLE_ARCH_7 && !arm_dc_feature(s, ARM_FEATURE_M)) {
+        return false;
+    }
+    tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+    return true;
 }
 
 static bool trans_ISB(DisasContext *s, arg_ISB *a)
@@ -601,11 +601,190 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
 }
 
 /* Propagate constants and copies, fold constant expressions. */
+/*
+ * Values of CPUArchState fields that are known to be held in a temp,
+ * because the field was just loaded from or stored to by this basic
+ * block.  Only full-width accesses relative to cpu_env are tracked, and
+ * only at non-negative offsets: the fields before env (icount_decr in
+ * particular) may be written concurrently by other threads.
+ */
+#define ENV_MEM_ENTRIES 16
+
+typedef struct EnvMemEntry {
+    TCGTemp *ts;
+    intptr_t ofs;
+    TCGType type;
+} EnvMemEntry;
+
+typedef struct EnvMemState {
+    EnvMemEntry entries[ENV_MEM_ENTRIES];
+    int next;
+} EnvMemState;
+
+static inline int env_mem_type_size(TCGType type)
+{
+    return type == TCG_TYPE_I32 ? 4 : 8;
+}
+
+static void env_mem_reset(EnvMemState *ems)
+{
+    memset(ems, 0, sizeof(*ems));
+}
+
+/* Forget fields overlapping [ofs, ofs + size) */
+static void env_mem_clobber(EnvMemState *ems, intptr_t ofs, intptr_t size)
+{
+    int i;
+
+    for (i = 0; i < ENV_MEM_ENTRIES; i++) {
+        EnvMemEntry *e = &ems->entries[i];
+
+        if (e->ts && e->ofs < ofs + size &&
+            ofs < e->ofs + env_mem_type_size(e->type)) {
+            e->ts = NULL;
+        }
+    }
+}
+
+/* Forget fields whose value was held by @ts, which is being overwritten */
+static void env_mem_clobber_temp(EnvMemState *ems, TCGTemp *ts)
+{
+    int i;
+
+    for (i = 0; i < ENV_MEM_ENTRIES; i++) {
+        if (ems->entries[i].ts == ts) {
+            ems->entries[i].ts = NULL;
+        }
+    }
+}
+
+static TCGTemp *env_mem_find(EnvMemState *ems, intptr_t ofs, TCGType type)
+{
+    int i;
+
+    for (i = 0; i < ENV_MEM_ENTRIES; i++) {
+        EnvMemEntry *e = &ems->entries[i];
+
+        if (e->ts && e->ofs == ofs && e->type == type) {
+            return e->ts;
+        }
+    }
+    return NULL;
+}
+
+static void env_mem_record(EnvMemState *ems, intptr_t ofs, TCGType type,
+                           TCGTemp *ts)
+{
+    env_mem_clobber(ems, ofs, env_mem_type_size(type));
+    ems->entries[ems->next] = (EnvMemEntry) {
+        .ts = ts,
+        .ofs = ofs,
+        .type = type,
+    };
+    ems->next = (ems->next + 1) % ENV_MEM_ENTRIES;
+}
+
+/*
+ * Update @ems for @op, which has not been optimized yet.  Returns true if
+ * @op was a load from a field whose value is known, in which case it has
+ * been replaced by a move (or removed entirely).
+ */
+static bool env_mem_fold(TCGContext *s, EnvMemState *ems, TCGOp *op,
+                         int nb_oargs)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    TCGTemp *ts;
+    TCGType type;
+    intptr_t size;
+    int i;
+
+    if (op->opc == INDEX_op_call || (def->flags & TCG_OPF_BB_END)) {
+        /* Helpers may access env in any way they like */
+        env_mem_reset(ems);
+        return false;
+    }
+
+    switch (op->opc) {
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld_i64:
+        type = op->opc == INDEX_op_ld_i32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
+        if (arg_temp(op->args[1]) != env || (intptr_t)op->args[2] < 0) {
+            break;
+        }
+        ts = env_mem_find(ems, op->args[2], type);
+        if (ts) {
+            if (ts != arg_temp(op->args[0])) {
+                env_mem_clobber_temp(ems, arg_temp(op->args[0]));
+            }
+            tcg_opt_gen_mov(s, op, op->args[0], temp_arg(ts));
+            return true;
+        }
+        env_mem_clobber_temp(ems, arg_temp(op->args[0]));
+        env_mem_record(ems, op->args[2], type, arg_temp(op->args[0]));
+        return false;
+
+    case INDEX_op_st_i32:
+    case INDEX_op_st_i64:
+    case INDEX_op_st8_i32:
+    case INDEX_op_st8_i64:
+    case INDEX_op_st16_i32:
+    case INDEX_op_st16_i64:
+    case INDEX_op_st32_i64:
+    case INDEX_op_st_vec:
+        if (arg_temp(op->args[1]) != env) {
+            /* Might point into env, too */
+            env_mem_reset(ems);
+            return false;
+        }
+        switch (op->opc) {
+        case INDEX_op_st8_i32:
+        case INDEX_op_st8_i64:
+            size = 1;
+            break;
+        case INDEX_op_st16_i32:
+        case INDEX_op_st16_i64:
+            size = 2;
+            break;
+        case INDEX_op_st_i32:
+        case INDEX_op_st32_i64:
+            size = 4;
+            break;
+        case INDEX_op_st_i64:
+            size = 8;
+            break;
+        default:
+            size = 8 << TCGOP_VECL(op);
+            break;
+        }
+        if (op->opc == INDEX_op_st_i32 || op->opc == INDEX_op_st_i64) {
+            if ((intptr_t)op->args[2] >= 0) {
+                env_mem_record(ems, op->args[2],
+                               op->opc == INDEX_op_st_i32 ?
+                               TCG_TYPE_I32 : TCG_TYPE_I64,
+                               arg_temp(op->args[0]));
+                return false;
+            }
+        }
+        env_mem_clobber(ems, op->args[2], size);
+        return false;
+
+    default:
+        break;
+    }
+
+    for (i = 0; i < nb_oargs; i++) {
+        env_mem_clobber_temp(ems, arg_temp(op->args[i]));
+    }
+    return false;
+}
+
 void tcg_optimize(TCGContext *s)
 {
     int nb_temps, nb_globals, i;
     TCGOp *op, *op_next, *prev_mb = NULL;
     TCGTempSet temps_used;
+    EnvMemState env_mem;
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -616,6 +795,7 @@ void tcg_optimize(TCGContext *s)
     nb_globals = s->nb_globals;
 
     memset(&temps_used, 0, sizeof(temps_used));
+    env_mem_reset(&env_mem);
     for (i = 0; i < nb_temps; ++i) {
         s->temps[i].state_ptr = NULL;
     }
@@ -653,6 +833,11 @@ void tcg_optimize(TCGContext *s)
             }
         }
 
+        /* Replace loads of CPUArchState fields whose value is known */
+        if (env_mem_fold(s, &env_mem, op, nb_oargs)) {
+            continue;
+        }
+
         /* For commutative operations make constant second argument */
         switch (opc) {
         CASE_OP_32_64_VEC(add):
@@ -0,0 +1,253 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * Both files let perf attribute the samples that fall into the code
+ * cache to the guest code they were translated from.  The map is simpler
+ * but perf cannot tell apart two TBs that used the same host range
+ * before and after a tb_flush().  Each record of the jitdump has a
+ * timestamp, so "perf inject --jit" attributes every sample to the TB
+ * that occupied the range at that time; a newer record for the same
+ * range implicitly unloads the older one.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "elf.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "tcg/perf.h"
+
+static FILE *safe_fopen_w(const char *path)
+{
+    int saved_errno;
+    FILE *f;
+    int fd;
+
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    /* Convert fd to FILE*. */
+    f = fdopen(fd, "w+");
+    if (f == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return f;
+}
+
+static FILE *perfmap;
+static FILE *jitdump;
+static void *perf_marker = MAP_FAILED;
+static size_t perf_marker_size;
+static uint64_t jitdump_code_index;
+
+struct jitheader {
+    uint32_t magic;     /* characters "JiTD" */
+    uint32_t version;   /* header version */
+    uint32_t total_size;/* total size of header */
+    uint32_t elf_mach;  /* elf mach target */
+    uint32_t pad1;      /* reserved */
+    uint32_t pid;       /* JIT process id */
+    uint64_t timestamp; /* timestamp */
+    uint64_t flags;     /* flags */
+};
+
+enum jit_record_type {
+    JIT_CODE_LOAD = 0,
+};
+
+/* record prefix (mandatory in each record) */
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+static void perf_exit(void)
+{
+    if (perf_marker != MAP_FAILED) {
+        munmap(perf_marker, perf_marker_size);
+        perf_marker = MAP_FAILED;
+    }
+    if (jitdump) {
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+}
+
+static void perf_register_exit(void)
+{
+    static bool registered;
+
+    if (!registered) {
+        atexit(perf_exit);
+        registered = true;
+    }
+}
+
+void perf_enable_perfmap(void)
+{
+    char map_file[32];
+
+    snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+        return;
+    }
+    perf_register_exit();
+}
+
+/* perf needs the host machine to disassemble the code */
+static int get_e_machine(void)
+{
+    Elf64_Ehdr elf_header;
+    FILE *exe;
+    size_t n;
+
+    QEMU_BUILD_BUG_ON(offsetof(Elf32_Ehdr, e_machine) !=
+                      offsetof(Elf64_Ehdr, e_machine));
+
+    exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) {
+        return EM_NONE;
+    }
+
+    n = fread(&elf_header, sizeof(elf_header), 1, exe);
+    fclose(exe);
+    if (n != 1) {
+        return EM_NONE;
+    }
+
+    return elf_header.e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header;
+    char jitdump_file[32];
+
+    if (!use_rt_clock) {
+        warn_report("CLOCK_MONOTONIC is not available, proceeding without "
+                    "jitdump");
+        return;
+    }
+
+    snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /*
+     * "perf record" only looks at a jitdump that the process mapped as
+     * executable; the mapping itself is never accessed.
+     */
+    perf_marker_size = qemu_real_host_page_size;
+    perf_marker = mmap(NULL, perf_marker_size, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE, fileno(jitdump), 0);
+    if (perf_marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+
+    header.magic = 0x4A695444;
+    header.version = 1;
+    header.total_size = sizeof(header);
+    header.elf_mach = get_e_machine();
+    header.pad1 = 0;
+    header.pid = getpid();
+    header.timestamp = get_clock();
+    header.flags = 0;
+    fwrite(&header, sizeof(header), 1, jitdump);
+    perf_register_exit();
+}
+
+static void perf_report_range(const char *name, const void *start,
+                              size_t size)
+{
+    if (perfmap) {
+        fprintf(perfmap, "%"PRIxPTR" %zx %s\n",
+                (uintptr_t)start, size, name);
+    }
+
+    if (jitdump) {
+        size_t name_size = strlen(name) + 1;
+        struct jr_code_load load = {
+            .p.id = JIT_CODE_LOAD,
+            .p.total_size = sizeof(load) + name_size + size,
+            .p.timestamp = get_clock(),
+            .pid = getpid(),
+            .tid = qemu_get_thread_id(),
+            .vma = (uintptr_t)start,
+            .code_addr = (uintptr_t)start,
+            .code_size = size,
+        };
+
+        /* keep the record together when several vCPUs translate */
+        flockfile(jitdump);
+        load.code_index = jitdump_code_index++;
+        fwrite(&load, sizeof(load), 1, jitdump);
+        fwrite(name, name_size, 1, jitdump);
+        fwrite(start, size, 1, jitdump);
+        funlockfile(jitdump);
+    }
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    perf_report_range("tcg-prologue-buffer", start, size);
+}
+
+void perf_report_code(uint64_t guest_pc, const void *start, size_t size)
+{
+    const char *symbol;
+    char *name;
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    /* the guest ELF symbols are known in user mode or with -kernel */
+    symbol = lookup_symbol(guest_pc);
+    if (symbol[0]) {
+        name = g_strdup_printf("guest-0x%"PRIx64" [%s]", guest_pc, symbol);
+    } else {
+        name = g_strdup_printf("guest-0x%"PRIx64, guest_pc);
+    }
+    perf_report_range(name, start, size);
+    g_free(name);
+}
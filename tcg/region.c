@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "qemu/units.h"
 #include "qapi/error.h"
+#include "qemu/rcu.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
 #include "tcg-internal.h"
@@ -277,6 +278,7 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+#ifdef CONFIG_TSAN
 static gboolean tcg_region_tree_traverse(gpointer k, gpointer v, gpointer data)
 {
     TranslationBlock *tb = v;
@@ -284,21 +286,54 @@ static gboolean tcg_region_tree_traverse(gpointer k, gpointer v, gpointer data)
     tb_destroy(tb);
     return FALSE;
 }
+#endif
+
+/* The trees of all regions as they were before a reset */
+struct tcg_region_tree_reclaim {
+    struct rcu_head rcu;
+    size_t n;
+    GTree *trees[];
+};
+
+static void tcg_region_tree_reclaim(struct tcg_region_tree_reclaim *r)
+{
+    size_t i;
 
+    for (i = 0; i < r->n; i++) {
+        g_tree_destroy(r->trees[i]);
+    }
+    g_free(r);
+}
+
+/*
+ * Called from tb_flush(), while all vCPUs are stopped.  Freeing the nodes
+ * of all trees takes time proportional to the number of TBs, so this is
+ * done by the RCU thread, once the vCPUs are running again.  The old
+ * trees can no longer be reached at that point: they are only accessed
+ * under the tree locks, and they have been replaced by empty ones here.
+ */
 static void tcg_region_tree_reset_all(void)
 {
+    struct tcg_region_tree_reclaim *r;
     size_t i;
 
+    r = g_malloc(sizeof(*r) + region.n * sizeof(r->trees[0]));
+    r->n = region.n;
+
     tcg_region_tree_lock_all();
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
 
+#ifdef CONFIG_TSAN
+        /* tb_destroy() only has an effect with TSAN */
         g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
-        /* Increment the refcount first so that destroy acts as a reset */
-        g_tree_ref(rt->tree);
-        g_tree_destroy(rt->tree);
+#endif
+        r->trees[i] = rt->tree;
+        rt->tree = g_tree_new(tb_tc_cmp);
     }
     tcg_region_tree_unlock_all();
+
+    call_rcu(r, tcg_region_tree_reclaim, rcu);
 }
 
 static void tcg_region_bounds(size_t curr_region, void **pstart, void **pend)
@@ -997,3 +1032,22 @@ size_t tcg_tb_phys_invalidate_count(void)
     }
     return total;
 }
+
+void tcg_gen_stats(TCGGenStats *stats)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        const TCGGenStats *orig = &s->gen_stats;
+
+        stats->tb_count += qatomic_read(&orig->tb_count);
+        stats->guest_insns += qatomic_read(&orig->guest_insns);
+        stats->guest_bytes += qatomic_read(&orig->guest_bytes);
+        stats->host_bytes += qatomic_read(&orig->host_bytes);
+        stats->helper_calls += qatomic_read(&orig->helper_calls);
+        stats->gen_time_ns += qatomic_read_u64(&orig->gen_time_ns);
+    }
+}
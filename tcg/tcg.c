@@ -59,6 +59,7 @@
 #include "elf.h"
 #include "exec/log.h"
 #include "tcg-internal.h"
+#include "tcg/perf.h"
 
 #ifdef CONFIG_TCG_INTERPRETER
 #include <ffi.h>
@@ -753,6 +754,7 @@ void tcg_prologue_init(TCGContext *s)
 #endif
 
     tcg_region_prologue_set(s);
+    perf_report_prologue(tcg_splitwx_to_rx(s->code_buf), prologue_size);
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
@@ -4164,7 +4166,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &s->prof;
 #endif
-    int i, num_insns;
+    int i, num_insns, nb_calls = 0;
     TCGOp *op;
 
 #ifdef CONFIG_PROFILER
@@ -4325,6 +4327,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
             break;
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
+            nb_calls++;
             break;
         case INDEX_op_dup2_vec:
             if (tcg_reg_alloc_dup2(s, op)) {
@@ -4382,6 +4385,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
                         tcg_ptr_byte_diff(s->code_ptr, s->code_buf));
 #endif
 
+    s->gen_nb_calls = nb_calls;
     return tcg_current_code_size(s);
 }
 
@@ -0,0 +1,454 @@
+/*
+ * Block layer per-request overhead benchmark
+ *
+ * Drives blk_co_preadv()/blk_co_pwritev() against a set of block graphs
+ * and reports IOPS, CPU time per request and latency percentiles.  The
+ * graphs are exposed as separate test cases, so that "-p" can select
+ * them.  Queue depths, request sizes and iothread counts are set with
+ * --depth, --size and --iothreads, each taking a comma-separated list.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <sys/resource.h>
+#include "block/block.h"
+#include "crypto/pbkdf.h"
+#include "crypto/secret.h"
+#include "block/throttle-groups.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "../unit/iothread.h"
+
+#define BENCH_MAX_VALUES 16
+#define BENCH_NULL_SIZE (1 * GiB)
+#define BENCH_IMAGE_SIZE (64 * MiB)
+#define BENCH_SECRET "bench-secret"
+#define BENCH_THROTTLE_GROUP "bench-tg"
+
+typedef struct BenchValues {
+    uint64_t val[BENCH_MAX_VALUES];
+    int n;
+} BenchValues;
+
+typedef struct BenchGraph {
+    const char *name;
+    /* Image format to create for each worker, NULL for null-co graphs */
+    const char *fmt;
+    const char *create_opts;
+    void (*options)(QDict *opts, const char *image);
+} BenchGraph;
+
+typedef struct BenchWorker {
+    BlockBackend *blk;
+    IOThread *iothread;
+    AioContext *ctx;
+    GRand *rand;
+    QEMUIOVector qiov;
+    void *buf;
+    bool write;
+    int64_t size;
+    uint64_t request_size;
+    unsigned int submitted;
+    unsigned int running;
+    uint64_t *latency_ns;
+    QemuEvent done;
+} BenchWorker;
+
+static BenchValues depths = { { 1, 16 }, 2 };
+static BenchValues sizes = { { 4 * KiB, 64 * KiB }, 2 };
+static BenchValues iothreads = { { 0, 1 }, 2 };
+static bool rw_read = true;
+static bool rw_write = true;
+static unsigned int nr_requests = 64 * 1024;
+static char *image_dir;
+
+static void null_options(QDict *opts, const char *image)
+{
+    qdict_put_str(opts, "driver", "null-co");
+    qdict_put_int(opts, "size", BENCH_NULL_SIZE);
+}
+
+static void raw_null_options(QDict *opts, const char *image)
+{
+    qdict_put_str(opts, "driver", "raw");
+    qdict_put_str(opts, "file.driver", "null-co");
+    qdict_put_int(opts, "file.size", BENCH_NULL_SIZE);
+}
+
+static void throttle_null_options(QDict *opts, const char *image)
+{
+    qdict_put_str(opts, "driver", "throttle");
+    qdict_put_str(opts, "throttle-group", BENCH_THROTTLE_GROUP);
+    qdict_put_str(opts, "file.driver", "null-co");
+    qdict_put_int(opts, "file.size", BENCH_NULL_SIZE);
+}
+
+static void file_options(QDict *opts, const char *image)
+{
+    qdict_put_str(opts, "driver", "raw");
+    qdict_put_str(opts, "file.driver", "file");
+    qdict_put_str(opts, "file.filename", image);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static void io_uring_options(QDict *opts, const char *image)
+{
+    file_options(opts, image);
+    qdict_put_str(opts, "file.aio", "io_uring");
+}
+#endif
+
+static void qcow2_options(QDict *opts, const char *image)
+{
+    qdict_put_str(opts, "driver", "qcow2");
+    qdict_put_str(opts, "file.driver", "file");
+    qdict_put_str(opts, "file.filename", image);
+}
+
+static void luks_options(QDict *opts, const char *image)
+{
+    qdict_put_str(opts, "driver", "luks");
+    qdict_put_str(opts, "key-secret", BENCH_SECRET);
+    qdict_put_str(opts, "file.driver", "file");
+    qdict_put_str(opts, "file.filename", image);
+}
+
+/*
+ * The format drivers need real metadata, which null-co cannot store, so
+ * they sit on a sparse temporary file.  Reads of unallocated qcow2
+ * clusters never reach the file and measure the metadata lookup alone.
+ */
+static const BenchGraph graphs[] = {
+    { "null-co", NULL, NULL, null_options },
+    { "raw-null", NULL, NULL, raw_null_options },
+    { "throttle-null", NULL, NULL, throttle_null_options },
+    { "file", "raw", NULL, file_options },
+#ifdef CONFIG_LINUX_IO_URING
+    { "file-io_uring", "raw", NULL, io_uring_options },
+#endif
+    { "qcow2", "qcow2", NULL, qcow2_options },
+    { "luks", "luks", "key-secret=" BENCH_SECRET ",iter-time=10",
+      luks_options },
+};
+
+static void coroutine_fn bench_co(void *opaque)
+{
+    BenchWorker *w = opaque;
+    int64_t nr_blocks = w->size / w->request_size;
+
+    while (w->submitted < nr_requests) {
+        unsigned int i = w->submitted++;
+        int64_t offset = g_rand_int_range(w->rand, 0, nr_blocks) *
+                         w->request_size;
+        int64_t start = get_clock();
+        int ret;
+
+        if (w->write) {
+            ret = blk_co_pwritev(w->blk, offset, w->request_size, &w->qiov, 0);
+        } else {
+            ret = blk_co_preadv(w->blk, offset, w->request_size, &w->qiov, 0);
+        }
+        g_assert_cmpint(ret, ==, 0);
+        w->latency_ns[i] = get_clock() - start;
+    }
+
+    if (--w->running == 0) {
+        qemu_event_set(&w->done);
+    }
+}
+
+static char *image_path(const BenchGraph *g, int index)
+{
+    return g_strdup_printf("%s/%s-%d.img", image_dir, g->name, index);
+}
+
+static void worker_init(BenchWorker *w, const BenchGraph *g, int index,
+                        bool use_iothread, bool write, uint64_t request_size)
+{
+    g_autofree char *image = g->fmt ? image_path(g, index) : NULL;
+    QDict *opts = qdict_new();
+
+    g->options(opts, image);
+    w->blk = blk_new_open(NULL, NULL, opts, BDRV_O_RDWR, &error_abort);
+    w->size = blk_getlength(w->blk);
+    g_assert_cmpint(w->size, >=, request_size);
+
+    w->ctx = qemu_get_aio_context();
+    if (use_iothread) {
+        w->iothread = iothread_new();
+        w->ctx = iothread_get_aio_context(w->iothread);
+        blk_set_aio_context(w->blk, w->ctx, &error_abort);
+    }
+
+    w->rand = g_rand_new_with_seed(index);
+    w->buf = qemu_memalign(4096, request_size);
+    memset(w->buf, 0xa5, request_size);
+    qemu_iovec_init_buf(&w->qiov, w->buf, request_size);
+    w->write = write;
+    w->request_size = request_size;
+    w->submitted = 0;
+    w->latency_ns = g_new(uint64_t, nr_requests);
+    qemu_event_init(&w->done, false);
+}
+
+static void worker_cleanup(BenchWorker *w)
+{
+    if (w->iothread) {
+        aio_context_acquire(w->ctx);
+        blk_set_aio_context(w->blk, qemu_get_aio_context(), &error_abort);
+        aio_context_release(w->ctx);
+        iothread_join(w->iothread);
+    }
+    blk_unref(w->blk);
+    qemu_event_destroy(&w->done);
+    g_free(w->latency_ns);
+    qemu_vfree(w->buf);
+    g_rand_free(w->rand);
+    memset(w, 0, sizeof(*w));
+}
+
+static void worker_start(BenchWorker *w, unsigned int depth)
+{
+    unsigned int i;
+
+    w->running = depth;
+    for (i = 0; i < depth; i++) {
+        aio_co_enter(w->ctx, qemu_coroutine_create(bench_co, w));
+    }
+}
+
+static void worker_wait(BenchWorker *w)
+{
+    if (w->iothread) {
+        qemu_event_wait(&w->done);
+        return;
+    }
+    while (w->running) {
+        aio_poll(w->ctx, true);
+    }
+}
+
+static int64_t cpu_time_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * NANOSECONDS_PER_SECOND +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * SCALE_US;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* @permille-th latency of the sorted array @lat with @n entries */
+static uint64_t percentile(const uint64_t *lat, size_t n, unsigned permille)
+{
+    return lat[(n - 1) * permille / 1000];
+}
+
+static void bench_one(const BenchGraph *g, bool write, uint64_t request_size,
+                      unsigned int depth, unsigned int nr_iothreads)
+{
+    unsigned int nr_workers = MAX(nr_iothreads, 1);
+    g_autofree BenchWorker *workers = g_new0(BenchWorker, nr_workers);
+    g_autofree uint64_t *lat = NULL;
+    size_t total = (size_t)nr_workers * nr_requests;
+    int64_t cpu_ns;
+    unsigned int i;
+
+    for (i = 0; i < nr_workers; i++) {
+        worker_init(&workers[i], g, i, nr_iothreads > 0, write, request_size);
+    }
+
+    cpu_ns = cpu_time_ns();
+    g_test_timer_start();
+    for (i = 0; i < nr_workers; i++) {
+        worker_start(&workers[i], depth);
+    }
+    for (i = 0; i < nr_workers; i++) {
+        worker_wait(&workers[i]);
+    }
+    g_test_timer_elapsed();
+    cpu_ns = cpu_time_ns() - cpu_ns;
+
+    lat = g_new(uint64_t, total);
+    for (i = 0; i < nr_workers; i++) {
+        memcpy(lat + (size_t)i * nr_requests, workers[i].latency_ns,
+               nr_requests * sizeof(uint64_t));
+        worker_cleanup(&workers[i]);
+    }
+    qsort(lat, total, sizeof(uint64_t), cmp_u64);
+
+    g_test_message("%s %s %" PRIu64 "B depth %u iothreads %u: "
+                   "%.1f KIOPS, %.0f ns CPU/req, latency p50 %" PRIu64
+                   " ns p99 %" PRIu64 " ns p99.9 %" PRIu64 " ns",
+                   g->name, write ? "write" : "read", request_size, depth,
+                   nr_iothreads, total / g_test_timer_last() / 1e3,
+                   (double)cpu_ns / total, percentile(lat, total, 500),
+                   percentile(lat, total, 990), percentile(lat, total, 999));
+}
+
+static void bench_graph(const void *opaque)
+{
+    const BenchGraph *g = opaque;
+    unsigned int nr_images = 1;
+    int w, s, d, t, i;
+
+    if (!strcmp(g->name, "luks") &&
+        !qcrypto_pbkdf2_supports(QCRYPTO_HASH_ALG_SHA256)) {
+        g_test_skip("no PBKDF2 support");
+        return;
+    }
+
+    for (t = 0; t < iothreads.n; t++) {
+        nr_images = MAX(nr_images, iothreads.val[t]);
+    }
+    for (i = 0; g->fmt && i < nr_images; i++) {
+        g_autofree char *image = image_path(g, i);
+
+        bdrv_img_create(image, g->fmt, NULL, NULL, (char *)g->create_opts,
+                        BENCH_IMAGE_SIZE, 0, true, &error_abort);
+    }
+
+    for (w = 0; w < 2; w++) {
+        if (!(w ? rw_write : rw_read)) {
+            continue;
+        }
+        for (s = 0; s < sizes.n; s++) {
+            for (d = 0; d < depths.n; d++) {
+                for (t = 0; t < iothreads.n; t++) {
+                    bench_one(g, w, sizes.val[s], depths.val[d],
+                              iothreads.val[t]);
+                }
+            }
+        }
+    }
+
+    for (i = 0; g->fmt && i < nr_images; i++) {
+        g_autofree char *image = image_path(g, i);
+
+        unlink(image);
+    }
+}
+
+static bool parse_values(const char *str, BenchValues *v, bool is_size)
+{
+    g_auto(GStrv) items = g_strsplit(str, ",", 0);
+    int i;
+
+    for (i = 0; items[i]; i++) {
+        unsigned int val;
+
+        if (i == BENCH_MAX_VALUES) {
+            return false;
+        }
+        if (is_size) {
+            if (qemu_strtosz(items[i], NULL, &v->val[i]) < 0 ||
+                !v->val[i] || v->val[i] > BENCH_IMAGE_SIZE) {
+                return false;
+            }
+        } else {
+            if (qemu_strtoui(items[i], NULL, 0, &val) < 0) {
+                return false;
+            }
+            v->val[i] = val;
+        }
+    }
+    v->n = i;
+    return i > 0;
+}
+
+static void parse_args(int *argc, char ***argv)
+{
+    g_autofree char *depth_str = NULL;
+    g_autofree char *size_str = NULL;
+    g_autofree char *iothread_str = NULL;
+    g_autofree char *rw_str = NULL;
+    int requests = nr_requests;
+    GOptionEntry entries[] = {
+        { "depth", 0, 0, G_OPTION_ARG_STRING, &depth_str,
+          "Comma-separated queue depths per worker", "LIST" },
+        { "size", 0, 0, G_OPTION_ARG_STRING, &size_str,
+          "Comma-separated request sizes", "LIST" },
+        { "iothreads", 0, 0, G_OPTION_ARG_STRING, &iothread_str,
+          "Comma-separated iothread counts, 0 for the main loop", "LIST" },
+        { "rw", 0, 0, G_OPTION_ARG_STRING, &rw_str,
+          "read, write or read,write", "LIST" },
+        { "requests", 0, 0, G_OPTION_ARG_INT, &requests,
+          "Requests per worker and configuration", "N" },
+        { NULL }
+    };
+    g_autoptr(GOptionContext) context = g_option_context_new(NULL);
+    g_autoptr(GError) err = NULL;
+    GOptionGroup *group;
+
+    /* gtest options and --help are left for g_test_init() */
+    group = g_option_group_new("bench", "Benchmark options",
+                               "Show benchmark options", NULL, NULL);
+    g_option_group_add_entries(group, entries);
+    g_option_context_add_group(context, group);
+    g_option_context_set_help_enabled(context, false);
+    g_option_context_set_ignore_unknown_options(context, true);
+    if (!g_option_context_parse(context, argc, argv, &err)) {
+        g_printerr("%s\n", err->message);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((depth_str && !parse_values(depth_str, &depths, false)) ||
+        (size_str && !parse_values(size_str, &sizes, true)) ||
+        (iothread_str && !parse_values(iothread_str, &iothreads, false))) {
+        g_printerr("Invalid benchmark option value\n");
+        exit(EXIT_FAILURE);
+    }
+    if (rw_str) {
+        rw_read = strstr(rw_str, "read");
+        rw_write = strstr(rw_str, "write");
+    }
+    if (requests <= 0 || (!rw_read && !rw_write)) {
+        g_printerr("Invalid benchmark option value\n");
+        exit(EXIT_FAILURE);
+    }
+    nr_requests = requests;
+}
+
+int main(int argc, char **argv)
+{
+    int i, ret;
+
+    parse_args(&argc, &argv);
+
+    module_call_init(MODULE_INIT_QOM);
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    object_new_with_props(TYPE_QCRYPTO_SECRET, object_get_objects_root(),
+                          BENCH_SECRET, &error_abort,
+                          "data", "benchmark", NULL);
+    object_new_with_props(TYPE_THROTTLE_GROUP, object_get_objects_root(),
+                          BENCH_THROTTLE_GROUP, &error_abort, NULL);
+
+    image_dir = g_dir_make_tmp("qemu-block-bench-XXXXXX", NULL);
+    g_assert(image_dir);
+
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(graphs); i++) {
+        g_autofree char *path = g_strdup_printf("/block/benchmark/%s",
+                                                graphs[i].name);
+
+        g_test_add_data_func(path, &graphs[i], bench_graph);
+    }
+    ret = g_test_run();
+
+    rmdir(image_dir);
+    g_free(image_dir);
+    return ret;
+}
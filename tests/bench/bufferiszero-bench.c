@@ -0,0 +1,78 @@
+/*
+ * Zero buffer detection speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+#define BUFFER_SIZE (64 * MiB)
+
+static const size_t lengths[] = { 4 * KiB, 64 * KiB, 1 * MiB };
+
+/*
+ * Check all of a zero buffer in @len sized pieces, and return the speed
+ * in GB/s.
+ */
+static double zero_speed(const uint8_t *buf, size_t len, bool find)
+{
+    volatile bool sink;
+    bool zero = true;
+    size_t i;
+
+    g_test_timer_start();
+    for (i = 0; i + len <= BUFFER_SIZE; i += len) {
+        if (find) {
+            zero &= buffer_find_nonzero(buf + i, len, 512) == len;
+        } else {
+            zero &= buffer_is_zero(buf + i, len);
+        }
+    }
+    g_test_timer_elapsed();
+    sink = zero;
+    g_assert(sink);
+
+    return BUFFER_SIZE / g_test_timer_last() / 1e9;
+}
+
+static void test_buffer_is_zero(void)
+{
+    uint8_t *buf = g_malloc0(BUFFER_SIZE);
+    int accel = 0;
+    int i;
+
+    do {
+        for (i = 0; i < ARRAY_SIZE(lengths); i++) {
+            g_test_message("buffer_is_zero(accel %d, %zu bytes): %.2f GB/s",
+                           accel, lengths[i],
+                           zero_speed(buf, lengths[i], false));
+        }
+        accel++;
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(buf);
+}
+
+static void test_buffer_find_nonzero(void)
+{
+    uint8_t *buf = g_malloc0(BUFFER_SIZE);
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(lengths); i++) {
+        g_test_message("buffer_find_nonzero(%zu bytes): %.2f GB/s",
+                       lengths[i], zero_speed(buf, lengths[i], true));
+    }
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bufferiszero/benchmark/find-nonzero",
+                    test_buffer_find_nonzero);
+    g_test_add_func("/bufferiszero/benchmark/is-zero", test_buffer_is_zero);
+    return g_test_run();
+}
@@ -0,0 +1,68 @@
+/*
+ * Coroutine switch speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+
+#define COROUTINE_SWITCHES (16 * 1024 * 1024)
+#define COROUTINE_LIFECYCLES (1024 * 1024)
+
+static void coroutine_fn yield_loop(void *opaque)
+{
+    unsigned int *counter = opaque;
+
+    while (*counter > 0) {
+        (*counter)--;
+        qemu_coroutine_yield();
+    }
+}
+
+/* Each iteration enters the coroutine, then the coroutine yields back */
+static void bench_switch(void)
+{
+    unsigned int counter = COROUTINE_SWITCHES / 2;
+    Coroutine *co = qemu_coroutine_create(yield_loop, &counter);
+
+    g_test_timer_start();
+    while (counter > 0) {
+        qemu_coroutine_enter(co);
+    }
+    g_test_timer_elapsed();
+
+    /* let the coroutine terminate */
+    qemu_coroutine_enter(co);
+
+    g_test_message("coroutine switch: %.2f ns/switch, %.2f Mswitch/sec",
+                   g_test_timer_last() * 1e9 / COROUTINE_SWITCHES,
+                   COROUTINE_SWITCHES / g_test_timer_last() / 1e6);
+}
+
+static void coroutine_fn empty_coroutine(void *opaque)
+{
+}
+
+/* Create, enter and terminate coroutines, which the pool recycles */
+static void bench_lifecycle(void)
+{
+    unsigned int i;
+
+    g_test_timer_start();
+    for (i = 0; i < COROUTINE_LIFECYCLES; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(empty_coroutine, NULL));
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("coroutine lifecycle: %.2f ns/coroutine",
+                   g_test_timer_last() * 1e9 / COROUTINE_LIFECYCLES);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/coroutine/benchmark/switch", bench_switch);
+    g_test_add_func("/coroutine/benchmark/lifecycle", bench_lifecycle);
+    return g_test_run();
+}
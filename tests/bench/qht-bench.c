@@ -9,6 +9,7 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "qemu/xxhash.h"
 
 struct thread_stats {
@@ -20,6 +21,10 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    uint64_t rz_ns;
+    uint64_t rz_max_ns;
+    uint64_t rd_max_ns;
+    size_t rd_slow;
 };
 
 struct thread_info {
@@ -60,6 +65,10 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool track_latency;
+
+/* lookups slower than this are counted as stalls with -L */
+#define LOOKUP_SLOW_NS 10000
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -92,7 +101,9 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -L = track lookup latency, e.g. to see stalls while resizing";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -141,13 +152,18 @@ static void do_rz(struct thread_info *info)
 
     if (r < resize_threshold) {
         size_t size = info->resize_down ? resize_min : resize_max;
+        int64_t t0 = get_clock();
         bool resized;
 
         resized = qht_resize(&ht, size);
         info->resize_down = !info->resize_down;
 
         if (resized) {
+            uint64_t ns = get_clock() - t0;
+
             stats->rz++;
+            stats->rz_ns += ns;
+            stats->rz_max_ns = MAX(stats->rz_max_ns, ns);
         } else {
             stats->not_rz++;
         }
@@ -167,7 +183,19 @@ static void do_rw(struct thread_info *info)
 
         p = &keys[r & (lookup_range - 1)];
         hash = hfunc(*p);
-        read = qht_lookup(&ht, p, hash);
+        if (unlikely(track_latency)) {
+            int64_t t0 = get_clock();
+            uint64_t ns;
+
+            read = qht_lookup(&ht, p, hash);
+            ns = get_clock() - t0;
+            stats->rd_max_ns = MAX(stats->rd_max_ns, ns);
+            if (ns > LOOKUP_SLOW_NS) {
+                stats->rd_slow++;
+            }
+        } else {
+            read = qht_lookup(&ht, p, hash);
+        }
         if (read) {
             stats->rd++;
         } else {
@@ -383,6 +411,11 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+        s->rz_ns += stats->rz_ns;
+        s->rz_max_ns = MAX(s->rz_max_ns, stats->rz_max_ns);
+
+        s->rd_max_ns = MAX(s->rd_max_ns, stats->rd_max_ns);
+        s->rd_slow += stats->rd_slow;
     }
 }
 
@@ -399,6 +432,10 @@ static void pr_stats(void)
     if (resize_rate) {
         printf(" Resizes:           %zu (%.2f%% of %zu)\n",
                s.rz, (double)s.rz / (s.rz + s.not_rz) * 100, s.rz + s.not_rz);
+        if (s.rz) {
+            printf(" Resize time:       %.2f us avg, %.2f us max\n",
+                   (double)s.rz_ns / s.rz / 1e3, s.rz_max_ns / 1e3);
+        }
     }
 
     printf(" Read:              %.2f M (%.2f%% of %.2fM)\n",
@@ -417,6 +454,12 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    if (track_latency) {
+        printf(" Max lookup time:   %.2f us\n", s.rd_max_ns / 1e3);
+        printf(" Lookups > %d us:   %zu (%.4f%%)\n", LOOKUP_SLOW_NS / 1000,
+               s.rd_slow, (double)s.rd_slow / (s.rd + s.not_rd) * 100);
+    }
 }
 
 static void run_test(void)
@@ -444,7 +487,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:hLn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -474,6 +517,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            track_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -0,0 +1,83 @@
+/*
+ * Thread pool submission and completion speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+
+#define THREAD_POOL_REQUESTS (256 * 1024)
+
+static const int depths[] = { 1, 4, 16, 64 };
+
+static AioContext *ctx;
+static ThreadPool *pool;
+static int in_flight;
+static int submitted;
+
+static int noop_func(void *opaque)
+{
+    return 0;
+}
+
+static void done_cb(void *opaque, int ret)
+{
+    in_flight--;
+}
+
+/* Keep @depth requests in flight until THREAD_POOL_REQUESTS completed */
+static double run(int depth)
+{
+    submitted = 0;
+    g_test_timer_start();
+    while (submitted < THREAD_POOL_REQUESTS || in_flight) {
+        while (in_flight < depth && submitted < THREAD_POOL_REQUESTS) {
+            thread_pool_submit_aio(pool, noop_func, NULL, done_cb, NULL);
+            in_flight++;
+            submitted++;
+        }
+        aio_poll(ctx, true);
+    }
+    g_test_timer_elapsed();
+
+    return THREAD_POOL_REQUESTS / g_test_timer_last() / 1e3;
+}
+
+static void test_thread_pool(void)
+{
+    ThreadPoolStats stats;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(depths); i++) {
+        uint64_t requests, wait_ns;
+        double kreqs;
+
+        thread_pool_get_stats(pool, &stats);
+        requests = stats.requests;
+        wait_ns = stats.wait_ns;
+
+        kreqs = run(depths[i]);
+
+        thread_pool_get_stats(pool, &stats);
+        g_test_message("thread-pool(depth %d): %.2f Kreq/sec, %d threads, "
+                       "%.0f ns average wait", depths[i], kreqs,
+                       stats.threads,
+                       (double)(stats.wait_ns - wait_ns) /
+                       (stats.requests - requests));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_abort);
+    ctx = qemu_get_current_aio_context();
+    pool = aio_get_thread_pool(ctx);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/thread-pool/benchmark/submit", test_thread_pool);
+    return g_test_run();
+}
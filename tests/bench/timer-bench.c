@@ -0,0 +1,146 @@
+/*
+ * Timer list manipulation speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+
+#define TIMER_COUNT (10 * 1000)
+#define TIMER_OPS (1024 * 1024)
+
+/* Far enough in the future that no timer fires during the benchmark */
+#define TIMER_OFFSET_NS (3600 * NANOSECONDS_PER_SECOND)
+
+static QEMUTimer timers[TIMER_COUNT];
+static QEMUTimerList *timer_list;
+static unsigned int fired;
+
+static void timer_cb(void *opaque)
+{
+    fired++;
+}
+
+static int64_t random_expire_time(int64_t now)
+{
+    return now + TIMER_OFFSET_NS + g_test_rand_int_range(0, 1000 * 1000);
+}
+
+static void arm_all(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i;
+
+    for (i = 0; i < TIMER_COUNT; i++) {
+        timer_mod_ns(&timers[i], random_expire_time(now));
+    }
+}
+
+static void del_all(void)
+{
+    int i;
+
+    for (i = 0; i < TIMER_COUNT; i++) {
+        timer_del(&timers[i]);
+    }
+}
+
+/* Re-arm random timers while TIMER_COUNT of them are pending */
+static void bench_mod(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i;
+
+    arm_all();
+    g_test_timer_start();
+    for (i = 0; i < TIMER_OPS; i++) {
+        QEMUTimer *ts = &timers[g_test_rand_int_range(0, TIMER_COUNT)];
+
+        timer_mod_ns(ts, random_expire_time(now));
+    }
+    g_test_timer_elapsed();
+    del_all();
+
+    g_test_message("timer_mod(%d timers): %.2f ns/op", TIMER_COUNT,
+                   g_test_timer_last() * 1e9 / TIMER_OPS);
+}
+
+/* Delete and re-arm random timers, as timer_del() callers do */
+static void bench_del(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i;
+
+    arm_all();
+    g_test_timer_start();
+    for (i = 0; i < TIMER_OPS; i++) {
+        QEMUTimer *ts = &timers[g_test_rand_int_range(0, TIMER_COUNT)];
+
+        timer_del(ts);
+        timer_mod_ns(ts, random_expire_time(now));
+    }
+    g_test_timer_elapsed();
+    del_all();
+
+    g_test_message("timer_del+timer_mod(%d timers): %.2f ns/op", TIMER_COUNT,
+                   g_test_timer_last() * 1e9 / TIMER_OPS);
+}
+
+static void bench_deadline(void)
+{
+    int64_t deadline = 0;
+    int i;
+
+    arm_all();
+    g_test_timer_start();
+    for (i = 0; i < TIMER_OPS; i++) {
+        deadline |= timerlist_deadline_ns(timer_list);
+    }
+    g_test_timer_elapsed();
+    del_all();
+
+    g_assert_cmpint(deadline, >, 0);
+    g_test_message("timerlist_deadline_ns(%d timers): %.2f ns/op",
+                   TIMER_COUNT, g_test_timer_last() * 1e9 / TIMER_OPS);
+}
+
+/* Fire TIMER_COUNT expired timers in a single timerlist_run_timers() */
+static void bench_run(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i;
+
+    for (i = 0; i < TIMER_COUNT; i++) {
+        timer_mod_ns(&timers[i], now - g_test_rand_int_range(0, 1000 * 1000));
+    }
+
+    fired = 0;
+    g_test_timer_start();
+    timerlist_run_timers(timer_list);
+    g_test_timer_elapsed();
+
+    g_assert_cmpint(fired, ==, TIMER_COUNT);
+    g_test_message("timerlist_run_timers(%d timers): %.2f ns/timer",
+                   TIMER_COUNT, g_test_timer_last() * 1e9 / TIMER_COUNT);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    qemu_init_main_loop(&error_abort);
+    timer_list = main_loop_tlg.tl[QEMU_CLOCK_REALTIME];
+    for (i = 0; i < TIMER_COUNT; i++) {
+        timer_init_ns(&timers[i], QEMU_CLOCK_REALTIME, timer_cb, NULL);
+    }
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/timer/benchmark/mod", bench_mod);
+    g_test_add_func("/timer/benchmark/del", bench_del);
+    g_test_add_func("/timer/benchmark/deadline", bench_deadline);
+    g_test_add_func("/timer/benchmark/run", bench_run);
+    return g_test_run();
+}
@@ -0,0 +1,107 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define XBZRLE_PAGE_SIZE 4096
+#define XBZRLE_PAGES     256
+
+typedef struct XbzrleOpts {
+    const char *name;
+    /* percentage of bytes changed between the old and the new pages */
+    int dirty_pct;
+    /* average length of a run of changed bytes */
+    int run_len;
+} XbzrleOpts;
+
+static void fill_pages(const XbzrleOpts *opts, uint8_t *old, uint8_t *new)
+{
+    size_t size = XBZRLE_PAGES * XBZRLE_PAGE_SIZE;
+    size_t i, j;
+
+    for (i = 0; i < size; i++) {
+        old[i] = new[i] = g_test_rand_int();
+    }
+    if (!opts->dirty_pct) {
+        return;
+    }
+    for (i = 0; i < size; i += opts->run_len * 100 / opts->dirty_pct) {
+        for (j = i; j < MIN(i + opts->run_len, size); j++) {
+            new[j] = ~old[j];
+        }
+    }
+}
+
+static const XbzrleOpts opts[] = {
+    { .name = "unchanged", .dirty_pct = 0, .run_len = 0 },
+    { .name = "sparse", .dirty_pct = 1, .run_len = 8 },
+    { .name = "scattered", .dirty_pct = 10, .run_len = 4 },
+    { .name = "dense", .dirty_pct = 30, .run_len = 64 },
+};
+
+static double encode_speed(const uint8_t *old, const uint8_t *new,
+                           uint8_t *dst)
+{
+    const size_t total = 1 * GiB;
+    size_t remain = total;
+    int i;
+
+    g_test_timer_start();
+    while (remain) {
+        for (i = 0; i < XBZRLE_PAGES && remain; i++) {
+            xbzrle_encode_buffer((uint8_t *)old + i * XBZRLE_PAGE_SIZE,
+                                 (uint8_t *)new + i * XBZRLE_PAGE_SIZE,
+                                 XBZRLE_PAGE_SIZE, dst, XBZRLE_PAGE_SIZE);
+            remain -= XBZRLE_PAGE_SIZE;
+        }
+    }
+    g_test_timer_elapsed();
+
+    return total / MiB / g_test_timer_last();
+}
+
+/*
+ * Walk through the encoders from the fastest one supported by the host
+ * down to the plain C one, timing each of them on every page pattern.
+ */
+static void test_encode_speed(void)
+{
+    size_t size = XBZRLE_PAGES * XBZRLE_PAGE_SIZE;
+    uint8_t *old[ARRAY_SIZE(opts)], *new[ARRAY_SIZE(opts)];
+    uint8_t *dst = g_malloc(XBZRLE_PAGE_SIZE);
+    int accel = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(opts); i++) {
+        old[i] = g_malloc(size);
+        new[i] = g_malloc(size);
+        fill_pages(&opts[i], old[i], new[i]);
+    }
+
+    do {
+        for (i = 0; i < ARRAY_SIZE(opts); i++) {
+            g_test_message("xbzrle_encode(accel %d, %s): %.2f MB/sec",
+                           accel, opts[i].name,
+                           encode_speed(old[i], new[i], dst));
+        }
+        accel++;
+    } while (xbzrle_encode_next_accel());
+
+    for (i = 0; i < ARRAY_SIZE(opts); i++) {
+        g_free(old[i]);
+        g_free(new[i]);
+    }
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/xbzrle/benchmark/encode", test_encode_speed);
+    return g_test_run();
+}
@@ -19,6 +19,9 @@ for i in succ_*.decode; do
     if ! $PYTHON $DECODETREE $i > /dev/null 2> /dev/null; then
         echo FAIL:$i 1>&2
     fi
+    if ! $PYTHON $DECODETREE --table $i > /dev/null 2> /dev/null; then
+        echo FAIL:$i --table 1>&2
+    fi
 done
 
 exit $E
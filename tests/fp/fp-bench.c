@@ -34,6 +34,8 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_CVT,
+    OP_TOINT,
     OP_MAX_NR,
 };
 
@@ -45,6 +47,8 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_CVT] = "cvt",
+    [OP_TOINT] = "toint",
     [OP_MAX_NR] = NULL,
 };
 
@@ -52,9 +56,11 @@ enum precision {
     PREC_SINGLE,
     PREC_DOUBLE,
     PREC_QUAD,
+    PREC_EXTENDED,
     PREC_FLOAT32,
     PREC_FLOAT64,
     PREC_FLOAT128,
+    PREC_FLOATX80,
     PREC_MAX_NR,
 };
 
@@ -93,6 +99,7 @@ union fp {
     float32 f32;
     float64 f64;
     float128 f128;
+    floatx80 fx80;
     uint64_t u64;
 };
 
@@ -163,6 +170,8 @@ static void update_random_ops(int n_ops, enum precision prec)
         }
         case PREC_DOUBLE:
         case PREC_FLOAT64:
+        case PREC_EXTENDED:
+        case PREC_FLOATX80:
         {
             uint64_t r = random_ops[i];
             do {
@@ -191,8 +200,20 @@ static void update_random_ops(int n_ops, enum precision prec)
     }
 }
 
+/*
+ * Conversions are benchmarked on operands in [1, 2^31), so that they
+ * neither overflow the narrower float type nor the integer type.
+ */
+static uint64_t limit_exp(uint64_t r, int shift, int bias)
+{
+    uint64_t mask = (uint64_t)(2 * bias + 1) << shift;
+    uint64_t exp = (r & mask) >> shift;
+
+    return (r & ~mask) | ((bias + exp % 31) << shift);
+}
+
 static void fill_random(union fp *ops, int n_ops, enum precision prec,
-                        bool no_neg)
+                        bool no_neg, bool small)
 {
     int i;
 
@@ -201,6 +222,9 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
         case PREC_SINGLE:
         case PREC_FLOAT32:
             ops[i].f32 = make_float32(random_ops[i]);
+            if (small) {
+                ops[i].f32 = make_float32(limit_exp(random_ops[i], 23, 127));
+            }
             if (no_neg && float32_is_neg(ops[i].f32)) {
                 ops[i].f32 = float32_chs(ops[i].f32);
             }
@@ -208,6 +232,9 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
         case PREC_DOUBLE:
         case PREC_FLOAT64:
             ops[i].f64 = make_float64(random_ops[i]);
+            if (small) {
+                ops[i].f64 = make_float64(limit_exp(random_ops[i], 52, 1023));
+            }
             if (no_neg && float64_is_neg(ops[i].f64)) {
                 ops[i].f64 = float64_chs(ops[i].f64);
             }
@@ -215,10 +242,27 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
         case PREC_QUAD:
         case PREC_FLOAT128:
             ops[i].f128 = random_quad_ops[i];
+            if (small) {
+                ops[i].f128.high = limit_exp(ops[i].f128.high, 48, 16383);
+            }
             if (no_neg && float128_is_neg(ops[i].f128)) {
                 ops[i].f128 = float128_chs(ops[i].f128);
             }
             break;
+        case PREC_EXTENDED:
+        case PREC_FLOATX80:
+        {
+            float64 d = make_float64(random_ops[i]);
+
+            if (small) {
+                d = make_float64(limit_exp(random_ops[i], 52, 1023));
+            }
+            if (no_neg && float64_is_neg(d)) {
+                d = float64_chs(d);
+            }
+            ops[i].fx80 = float64_to_floatx80(d, &soft_status);
+            break;
+        }
         default:
             g_assert_not_reached();
         }
@@ -232,6 +276,7 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
 static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
 {
     int64_t tf = get_clock() + duration * 1000000000LL;
+    bool small = op == OP_CVT || op == OP_TOINT;
 
     while (get_clock() < tf) {
         union fp ops[MAX_OPERANDS];
@@ -241,7 +286,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
         update_random_ops(n_ops, prec);
         switch (prec) {
         case PREC_SINGLE:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, small);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float a = ops[0].f;
@@ -270,13 +315,19 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_CVT:
+                    res.d = a;
+                    break;
+                case OP_TOINT:
+                    res.u64 = (int32_t)a;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_DOUBLE:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, small);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 double a = ops[0].d;
@@ -305,13 +356,19 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_CVT:
+                    res.f = a;
+                    break;
+                case OP_TOINT:
+                    res.u64 = (int32_t)a;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT32:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, small);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float32 a = ops[0].f32;
@@ -340,13 +397,19 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_CVT:
+                    res.f64 = float32_to_float64(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = float32_to_int32_round_to_zero(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT64:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, small);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float64 a = ops[0].f64;
@@ -375,13 +438,19 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_CVT:
+                    res.f32 = float64_to_float32(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = float64_to_int32_round_to_zero(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT128:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, small);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float128 a = ops[0].f128;
@@ -410,6 +479,49 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float128_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_CVT:
+                    res.f64 = float128_to_float64(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = float128_to_int32_round_to_zero(a, &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+            }
+            break;
+        case PREC_FLOATX80:
+            fill_random(ops, n_ops, prec, no_neg, small);
+            t0 = get_clock();
+            for (i = 0; i < OPS_PER_ITER; i++) {
+                floatx80 a = ops[0].fx80;
+                floatx80 b = ops[1].fx80;
+
+                switch (op) {
+                case OP_ADD:
+                    res.fx80 = floatx80_add(a, b, &soft_status);
+                    break;
+                case OP_SUB:
+                    res.fx80 = floatx80_sub(a, b, &soft_status);
+                    break;
+                case OP_MUL:
+                    res.fx80 = floatx80_mul(a, b, &soft_status);
+                    break;
+                case OP_DIV:
+                    res.fx80 = floatx80_div(a, b, &soft_status);
+                    break;
+                case OP_SQRT:
+                    res.fx80 = floatx80_sqrt(a, &soft_status);
+                    break;
+                case OP_CMP:
+                    res.u64 = floatx80_compare_quiet(a, b, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = floatx80_to_float64(a, &soft_status);
+                    break;
+                case OP_TOINT:
+                    res.u64 = floatx80_to_int32_round_to_zero(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -448,8 +560,23 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(cvt, OP_CVT, 1)
+GEN_BENCH_ALL_TYPES(toint, OP_TOINT, 1)
 #undef GEN_BENCH_ALL_TYPES
 
+/* floatx80 has no fused multiply-add */
+#define GEN_BENCH_X80(opname, op, n_ops)                                \
+    GEN_BENCH(bench_ ## opname ## _floatx80, floatx80, PREC_FLOATX80, op, n_ops)
+
+GEN_BENCH_X80(add, OP_ADD, 2)
+GEN_BENCH_X80(sub, OP_SUB, 2)
+GEN_BENCH_X80(mul, OP_MUL, 2)
+GEN_BENCH_X80(div, OP_DIV, 2)
+GEN_BENCH_X80(cmp, OP_CMP, 2)
+GEN_BENCH_X80(cvt, OP_CVT, 1)
+GEN_BENCH_X80(toint, OP_TOINT, 1)
+#undef GEN_BENCH_X80
+
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
     GEN_BENCH_NO_NEG(bench_ ## name ## _float, float, PREC_SINGLE, op, n) \
     GEN_BENCH_NO_NEG(bench_ ## name ## _double, double, PREC_DOUBLE, op, n) \
@@ -458,6 +585,7 @@ GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
     GEN_BENCH_NO_NEG(bench_ ## name ## _float128, float128, PREC_FLOAT128, op, n)
 
 GEN_BENCH_ALL_TYPES_NO_NEG(sqrt, OP_SQRT, 1)
+GEN_BENCH_NO_NEG(bench_sqrt_floatx80, floatx80, PREC_FLOATX80, OP_SQRT, 1)
 #undef GEN_BENCH_ALL_TYPES_NO_NEG
 
 #undef GEN_BENCH_NO_NEG
@@ -472,16 +600,29 @@ GEN_BENCH_ALL_TYPES_NO_NEG(sqrt, OP_SQRT, 1)
         [PREC_FLOAT128]   = bench_ ## opname ## _float128,      \
     }
 
+#define GEN_BENCH_FUNCS_X80(opname, op)                         \
+    [op] = {                                                    \
+        [PREC_SINGLE]    = bench_ ## opname ## _float,          \
+        [PREC_DOUBLE]    = bench_ ## opname ## _double,         \
+        [PREC_FLOAT32]   = bench_ ## opname ## _float32,        \
+        [PREC_FLOAT64]   = bench_ ## opname ## _float64,        \
+        [PREC_FLOAT128]  = bench_ ## opname ## _float128,       \
+        [PREC_FLOATX80]  = bench_ ## opname ## _floatx80,       \
+    }
+
 static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
-    GEN_BENCH_FUNCS(add, OP_ADD),
-    GEN_BENCH_FUNCS(sub, OP_SUB),
-    GEN_BENCH_FUNCS(mul, OP_MUL),
-    GEN_BENCH_FUNCS(div, OP_DIV),
+    GEN_BENCH_FUNCS_X80(add, OP_ADD),
+    GEN_BENCH_FUNCS_X80(sub, OP_SUB),
+    GEN_BENCH_FUNCS_X80(mul, OP_MUL),
+    GEN_BENCH_FUNCS_X80(div, OP_DIV),
     GEN_BENCH_FUNCS(fma, OP_FMA),
-    GEN_BENCH_FUNCS(sqrt, OP_SQRT),
-    GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS_X80(sqrt, OP_SQRT),
+    GEN_BENCH_FUNCS_X80(cmp, OP_CMP),
+    GEN_BENCH_FUNCS_X80(cvt, OP_CVT),
+    GEN_BENCH_FUNCS_X80(toint, OP_TOINT),
 };
 
+#undef GEN_BENCH_FUNCS_X80
 #undef GEN_BENCH_FUNCS
 
 static void run_bench(void)
@@ -489,7 +630,11 @@ static void run_bench(void)
     bench_func_t f;
 
     f = bench_funcs[operation][precision];
-    g_assert(f);
+    if (!f) {
+        fprintf(stderr, "fatal: '%s' not supported for this precision\n",
+                op_names[operation]);
+        exit(EXIT_FAILURE);
+    }
     f();
 }
 
@@ -518,8 +663,10 @@ static void usage_complete(int argc, char *argv[])
     fprintf(stderr, " -h = show this help message.\n");
     fprintf(stderr, " -o = floating point operation (%s). Default: %s\n",
             op_list, op_names[0]);
-    fprintf(stderr, " -p = floating point precision (single, double, quad[soft only]). "
-            "Default: single\n");
+    fprintf(stderr, " -p = floating point precision (single, double, "
+            "quad[soft only], extended[soft only]). Default: single\n");
+    fprintf(stderr, "      cvt: single to double, double to single, "
+            "quad and extended to double\n");
     fprintf(stderr, " -r = rounding mode (even, zero, down, up, tieaway). "
             "Default: even\n");
     fprintf(stderr, " -t = tester (%s). Default: %s\n",
@@ -640,6 +787,8 @@ static void parse_args(int argc, char *argv[])
                 precision = PREC_DOUBLE;
             } else if (!strcmp(optarg, "quad")) {
                 precision = PREC_QUAD;
+            } else if (!strcmp(optarg, "extended")) {
+                precision = PREC_EXTENDED;
             } else {
                 fprintf(stderr, "Unsupported precision '%s'\n", optarg);
                 exit(EXIT_FAILURE);
@@ -686,6 +835,9 @@ static void parse_args(int argc, char *argv[])
         case PREC_QUAD:
             precision = PREC_FLOAT128;
             break;
+        case PREC_EXTENDED:
+            precision = PREC_FLOATX80;
+            break;
         default:
             g_assert_not_reached();
         }
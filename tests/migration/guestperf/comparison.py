@@ -135,4 +135,41 @@ def __init__(self, name, scenarios):
         Scenario("compr-multifd-channels-64",
                  multifd=True, multifd_channels=64),
     ]),
+
+
+    # Looking at effect of each multifd compression method
+    # on a guest whose pages do and do not compress
+    Comparison("compr-multifd-method", scenarios = [
+        Scenario("compr-multifd-method-%s-%s" % (method, pattern),
+                 multifd=True, multifd_channels=4,
+                 multifd_compression=method, dirty_pattern=pattern)
+        for method in ("none", "zlib", "zstd")
+        for pattern in ("uniform", "zero", "incompressible")
+    ]),
+
+
+    # Looking at how the way the guest dirties its RAM
+    # affects plain pre-copy convergence
+    Comparison("dirty-pattern", scenarios = [
+        Scenario("dirty-pattern-%s" % pattern, dirty_pattern=pattern)
+        for pattern in ("uniform", "hotspot", "zero", "incompressible")
+    ]),
+
+
+    # Looking at how well xbzrle copes with each dirtying pattern
+    Comparison("compr-xbzrle-pattern", scenarios = [
+        Scenario("compr-xbzrle-pattern-%s" % pattern,
+                 compression_xbzrle=True, compression_xbzrle_cache=10,
+                 dirty_pattern=pattern)
+        for pattern in ("uniform", "hotspot", "zero", "incompressible")
+    ]),
+
+
+    # Looking at post-copy with each dirtying pattern
+    Comparison("post-copy-pattern", scenarios = [
+        Scenario("post-copy-pattern-%s" % pattern,
+                 post_copy=True, post_copy_iters=1,
+                 dirty_pattern=pattern)
+        for pattern in ("uniform", "hotspot", "zero", "incompressible")
+    ]),
 ]
@@ -203,6 +203,18 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                                ])
             resp = dst.command("migrate-set-parameters",
                                multifd_channels=scenario._multifd_channels)
+            resp = src.command("migrate-set-parameters",
+                               multifd_compression=scenario._multifd_compression)
+            resp = dst.command("migrate-set-parameters",
+                               multifd_compression=scenario._multifd_compression)
+
+        # CPU time of the QEMU processes across the migration, the
+        # destination only when it is on this host
+        src_cpu_start = self._cpu_timing(src_pid)
+        dst_pid = None
+        if self._dst_host == "localhost":
+            dst_pid = dst.get_pid()
+            dst_cpu_start = self._cpu_timing(dst_pid)
 
         resp = src.command("migrate", uri=connect_uri)
 
@@ -228,6 +240,15 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 progress_history.append(progress)
 
             if progress._status in ("completed", "failed", "cancelled"):
+                migration_cpu = {
+                    "src": (self._cpu_timing(src_pid)._value -
+                            src_cpu_start._value),
+                    "dst": None,
+                }
+                if dst_pid is not None:
+                    migration_cpu["dst"] = (self._cpu_timing(dst_pid)._value -
+                                            dst_cpu_start._value)
+
                 if progress._status == "completed" and paused:
                     dst.command("cont")
                 if progress_history[-1] != progress:
@@ -243,7 +264,8 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                         src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
                         sleep_secs -= 1
 
-                return [progress_history, src_qemu_time, src_vcpu_time]
+                return [progress_history, src_qemu_time, src_vcpu_time,
+                        migration_cpu]
 
             if self._verbose and (loop % 20) == 0:
                 print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec)" % (
@@ -282,7 +304,7 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 resp = src.command("stop")
                 paused = True
 
-    def _get_common_args(self, hardware, tunnelled=False):
+    def _get_common_args(self, hardware, scenario, tunnelled=False):
         args = [
             "noapic",
             "edd=off",
@@ -298,6 +320,7 @@ def _get_common_args(self, hardware, tunnelled=False):
             args.append("quiet")
 
         args.append("ramsize=%s" % hardware._mem)
+        args.append("stresspattern=%s" % scenario._dirty_pattern)
 
         cmdline = " ".join(args)
         if tunnelled:
@@ -328,14 +351,14 @@ def _get_common_args(self, hardware, tunnelled=False):
 
         return argv
 
-    def _get_src_args(self, hardware):
-        return self._get_common_args(hardware)
+    def _get_src_args(self, hardware, scenario):
+        return self._get_common_args(hardware, scenario)
 
-    def _get_dst_args(self, hardware, uri):
+    def _get_dst_args(self, hardware, scenario, uri):
         tunnelled = False
         if self._dst_host != "localhost":
             tunnelled = True
-        argv = self._get_common_args(hardware, tunnelled)
+        argv = self._get_common_args(hardware, scenario, tunnelled)
         return argv + ["-incoming", uri]
 
     @staticmethod
@@ -404,13 +427,13 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
         srcmonaddr = "/var/tmp/qemu-src-%d-monitor.sock" % os.getpid()
 
         src = QEMUMachine(self._binary,
-                          args=self._get_src_args(hardware),
+                          args=self._get_src_args(hardware, scenario),
                           wrapper=self._get_src_wrapper(hardware),
                           name="qemu-src-%d" % os.getpid(),
                           monitor_address=srcmonaddr)
 
         dst = QEMUMachine(self._binary,
-                          args=self._get_dst_args(hardware, uri),
+                          args=self._get_dst_args(hardware, scenario, uri),
                           wrapper=self._get_dst_wrapper(hardware),
                           name="qemu-dst-%d" % os.getpid(),
                           monitor_address=dstmonaddr)
@@ -423,6 +446,7 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             progress_history = ret[0]
             qemu_timings = ret[1]
             vcpu_timings = ret[2]
+            migration_cpu = ret[3]
             if uri[0:5] == "unix:":
                 os.remove(uri[5:])
 
@@ -443,7 +467,8 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                           Timings(qemu_timings),
                           Timings(vcpu_timings),
                           self._binary, self._dst_host, self._kernel,
-                          self._initrd, self._transport, self._sleep)
+                          self._initrd, self._transport, self._sleep,
+                          migration_cpu)
         except Exception as e:
             if self._debug:
                 print("Failed: %s" % str(e))
@@ -38,7 +38,8 @@ def __init__(self,
                  kernel,
                  initrd,
                  transport,
-                 sleep):
+                 sleep,
+                 migration_cpu=None):
 
         self._hardware = hardware
         self._scenario = scenario
@@ -52,6 +53,9 @@ def __init__(self,
         self._initrd = initrd
         self._transport = transport
         self._sleep = sleep
+        # Milliseconds of QEMU process CPU time spent while migrating,
+        # keyed by "src" and "dst"
+        self._migration_cpu = migration_cpu or {"src": None, "dst": None}
 
     def serialize(self):
         return {
@@ -67,6 +71,7 @@ def serialize(self):
             "initrd": self._initrd,
             "transport": self._transport,
             "sleep": self._sleep,
+            "migration_cpu": self._migration_cpu,
         }
 
     @classmethod
@@ -83,7 +88,27 @@ def deserialize(cls, data):
             data["kernel"],
             data["initrd"],
             data["transport"],
-            data["sleep"])
+            data["sleep"],
+            data.get("migration_cpu"))
+
+    def summary(self):
+        last = self._progress_history[-1]
+        gib = last._ram._transferred_bytes / (1024 * 1024 * 1024)
+
+        def cpu_per_gib(side):
+            if self._migration_cpu[side] is None or gib == 0:
+                return None
+            return self._migration_cpu[side] / gib
+
+        return {
+            "status": last._status,
+            "total_time_ms": last._duration,
+            "downtime_ms": last._downtime,
+            "transferred_bytes": last._ram._transferred_bytes,
+            "iterations": last._ram._iterations,
+            "src_cpu_ms_per_gib": cpu_per_gib("src"),
+            "dst_cpu_ms_per_gib": cpu_per_gib("dst"),
+        }
 
     def to_json(self):
         return json.dumps(self.serialize(), indent=4)
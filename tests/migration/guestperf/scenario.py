@@ -30,7 +30,9 @@ def __init__(self, name,
                  auto_converge=False, auto_converge_step=10,
                  compression_mt=False, compression_mt_threads=1,
                  compression_xbzrle=False, compression_xbzrle_cache=10,
-                 multifd=False, multifd_channels=2):
+                 multifd=False, multifd_channels=2,
+                 multifd_compression="none",
+                 dirty_pattern="uniform"):
 
         self._name = name
 
@@ -59,6 +61,11 @@ def __init__(self, name,
 
         self._multifd = multifd
         self._multifd_channels = multifd_channels
+        self._multifd_compression = multifd_compression # none, zlib, zstd
+
+        # How the guest workload dirties its RAM: uniform, hotspot,
+        # zero or incompressible
+        self._dirty_pattern = dirty_pattern
 
     def serialize(self):
         return {
@@ -79,6 +86,8 @@ def serialize(self):
             "compression_xbzrle_cache": self._compression_xbzrle_cache,
             "multifd": self._multifd,
             "multifd_channels": self._multifd_channels,
+            "multifd_compression": self._multifd_compression,
+            "dirty_pattern": self._dirty_pattern,
         }
 
     @classmethod
@@ -100,4 +109,6 @@ def deserialize(cls, data):
             data["compression_xbzrle"],
             data["compression_xbzrle_cache"],
             data["multifd"],
-            data["multifd_channels"])
+            data["multifd_channels"],
+            data.get("multifd_compression", "none"),
+            data.get("dirty_pattern", "uniform"))
@@ -34,6 +34,24 @@
 from guestperf.report import Report
 
 
+def print_summary(name, report):
+    summary = report.summary()
+
+    def cpu(value):
+        if value is None:
+            return "n/a"
+        return "%.0fms" % value
+
+    print("%s: %s in %dms, downtime %dms, %d iterations, %.1f MiB sent, "
+          "CPU/GiB src %s dst %s" % (
+              name, summary["status"], summary["total_time_ms"],
+              summary["downtime_ms"], summary["iterations"],
+              summary["transferred_bytes"] / (1024 * 1024),
+              cpu(summary["src_cpu_ms_per_gib"]),
+              cpu(summary["dst_cpu_ms_per_gib"])),
+          file=sys.stderr)
+
+
 class BaseShell(object):
 
     def __init__(self):
@@ -48,6 +66,8 @@ def __init__(self):
         parser.add_argument("--kernel", dest="kernel", default="/boot/vmlinuz-%s" % platform.release())
         parser.add_argument("--initrd", dest="initrd", default="tests/migration/initrd-stress.img")
         parser.add_argument("--transport", dest="transport", default="unix")
+        parser.add_argument("--summary", dest="summary", default=False,
+                            action="store_true")
 
 
         # Hardware args
@@ -126,6 +146,14 @@ def __init__(self):
                             action="store_true")
         parser.add_argument("--multifd-channels", dest="multifd_channels",
                             default=2, type=int)
+        parser.add_argument("--multifd-compression",
+                            dest="multifd_compression", default="none",
+                            choices=["none", "zlib", "zstd"])
+
+        parser.add_argument("--dirty-pattern", dest="dirty_pattern",
+                            default="uniform",
+                            choices=["uniform", "hotspot", "zero",
+                                     "incompressible"])
 
     def get_scenario(self, args):
         return Scenario(name="perfreport",
@@ -150,7 +178,10 @@ def get_scenario(self, args):
                         compression_xbzrle_cache=args.compression_xbzrle_cache,
 
                         multifd=args.multifd,
-                        multifd_channels=args.multifd_channels)
+                        multifd_channels=args.multifd_channels,
+                        multifd_compression=args.multifd_compression,
+
+                        dirty_pattern=args.dirty_pattern)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -170,6 +201,8 @@ def run(self, argv):
             else:
                 with open(args.output, "w") as fh:
                     print(report.to_json(), file=fh)
+            if args.summary:
+                print_summary(scenario._name, report)
             return 0
         except Exception as e:
             print("Error: %s" % str(e), file=sys.stderr)
@@ -218,6 +251,8 @@ def run(self, argv):
                     report = engine.run(hardware, scenario)
                     with open(filename, "w") as fh:
                         print(report.to_json(), file=fh)
+                    if args.summary:
+                        print_summary(name, report)
         except Exception as e:
             print("Error: %s" % str(e), file=sys.stderr)
             if args.debug:
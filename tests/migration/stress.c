@@ -29,6 +29,27 @@ const char *argv0;
 
 #define RAM_PAGE_SIZE 4096
 
+/* How each pass over guest RAM dirties it */
+enum {
+    PATTERN_UNIFORM,        /* every page, XORed with a random page */
+    PATTERN_HOTSPOT,        /* 90% of writes go to 10% of RAM */
+    PATTERN_ZERO,           /* 7 of 8 pages rewritten with zeroes */
+    PATTERN_INCOMPRESSIBLE, /* fresh pseudo-random data every time */
+    PATTERN__MAX,
+};
+
+static const char *const pattern_names[PATTERN__MAX] = {
+    [PATTERN_UNIFORM] = "uniform",
+    [PATTERN_HOTSPOT] = "hotspot",
+    [PATTERN_ZERO] = "zero",
+    [PATTERN_INCOMPRESSIBLE] = "incompressible",
+};
+
+typedef struct {
+    unsigned long long ramsizeMB;
+    int pattern;
+} StressArgs;
+
 #ifndef CONFIG_GETTID
 static int gettid(void)
 {
@@ -147,6 +168,61 @@ static int random_bytes(char *buf, size_t len)
 }
 
 
+static int parse_pattern(const char *name)
+{
+    int i;
+
+    for (i = 0; i < PATTERN__MAX; i++) {
+        if (!strcmp(name, pattern_names[i])) {
+            return i;
+        }
+    }
+
+    fprintf(stderr, "%s (%05d): ERROR: unknown pattern %s\n",
+            argv0, gettid(), name);
+    return -1;
+}
+
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+
+static void dirty_page(char *page, const char *data, int pattern,
+                       size_t pageno, uint64_t *state)
+{
+    size_t k;
+
+    switch (pattern) {
+    case PATTERN_ZERO:
+        if (pageno % 8) {
+            memset(page, 0, RAM_PAGE_SIZE);
+            break;
+        }
+        /* fall through */
+    case PATTERN_UNIFORM:
+    case PATTERN_HOTSPOT:
+        for (k = 0; k < RAM_PAGE_SIZE; k += sizeof(long long)) {
+            *(unsigned long long *)(page + k) ^=
+                *(const unsigned long long *)(data + k);
+        }
+        break;
+    case PATTERN_INCOMPRESSIBLE:
+        for (k = 0; k < RAM_PAGE_SIZE; k += sizeof(uint64_t)) {
+            *(uint64_t *)(page + k) = xorshift64(state);
+        }
+        break;
+    }
+}
+
+
 static unsigned long long now(void)
 {
     struct timeval tv;
@@ -156,15 +232,18 @@ static unsigned long long now(void)
     return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
 }
 
-static void stressone(unsigned long long ramsizeMB)
+static void stressone(unsigned long long ramsizeMB, int pattern)
 {
     size_t pagesPerMB = 1024 * 1024 / RAM_PAGE_SIZE;
     g_autofree char *ram = g_malloc(ramsizeMB * 1024 * 1024);
     char *ramptr;
-    size_t i, j, k;
+    size_t i, j;
     g_autofree char *data = g_malloc(RAM_PAGE_SIZE);
-    char *dataptr;
     size_t nMB = 0;
+    size_t hotMB = MAX(ramsizeMB / 10, 1);
+    size_t coldMB = 0;
+    size_t mb;
+    uint64_t state = (uintptr_t)ram | 1;
     unsigned long long before, after;
 
     /* We don't care about initial state, but we do want
@@ -182,16 +261,21 @@ static void stressone(unsigned long long ramsizeMB)
 
     while (1) {
 
-        ramptr = ram;
         for (i = 0; i < ramsizeMB; i++, nMB++) {
-            for (j = 0; j < pagesPerMB; j++) {
-                dataptr = data;
-                for (k = 0; k < RAM_PAGE_SIZE; k += sizeof(long long)) {
-                    ramptr += sizeof(long long);
-                    dataptr += sizeof(long long);
-                    *(unsigned long long *)ramptr ^= *(unsigned long long *)dataptr;
+            mb = i;
+            if (pattern == PATTERN_HOTSPOT) {
+                /* Every tenth MB sweeps the rest of RAM, in order */
+                if (i % 10) {
+                    mb = xorshift64(&state) % hotMB;
+                } else {
+                    mb = coldMB++ % ramsizeMB;
                 }
             }
+            ramptr = ram + mb * 1024 * 1024;
+            for (j = 0; j < pagesPerMB; j++) {
+                dirty_page(ramptr + j * RAM_PAGE_SIZE, data, pattern,
+                           mb * pagesPerMB + j, &state);
+            }
 
             if (nMB == 1024) {
                 after = now();
@@ -207,26 +291,29 @@ static void stressone(unsigned long long ramsizeMB)
 
 static void *stressthread(void *arg)
 {
-    unsigned long long ramsizeMB = *(unsigned long long *)arg;
+    StressArgs *args = arg;
 
-    stressone(ramsizeMB);
+    stressone(args->ramsizeMB, args->pattern);
 
     return NULL;
 }
 
-static void stress(unsigned long long ramsizeGB, int ncpus)
+static void stress(unsigned long long ramsizeGB, int ncpus, int pattern)
 {
     size_t i;
-    unsigned long long ramsizeMB = ramsizeGB * 1024 / ncpus;
+    static StressArgs args;
+
+    args.ramsizeMB = ramsizeGB * 1024 / ncpus;
+    args.pattern = pattern;
     ncpus--;
 
     for (i = 0; i < ncpus; i++) {
         pthread_t thr;
         pthread_create(&thr, NULL,
-                       stressthread,   &ramsizeMB);
+                       stressthread,   &args);
     }
 
-    stressone(ramsizeMB);
+    stressone(args.ramsizeMB, args.pattern);
 }
 
 
@@ -266,15 +353,18 @@ int main(int argc, char **argv)
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:c:p:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "pattern", required_argument, NULL, 'p' },
         { NULL, 0, NULL, 0 }
     };
     int ret;
     int ncpus = 0;
+    int pattern = PATTERN_UNIFORM;
+    char *patternstr;
 
     argv0 = argv[0];
 
@@ -300,9 +390,18 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'p':
+            pattern = parse_pattern(optarg);
+            if (pattern < 0) {
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]"
+                    "[--pattern uniform|hotspot|zero|incompressible]\n",
+                    argv0);
             exit_failure();
         }
     }
@@ -314,15 +413,27 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+
+        ret = get_command_arg_str("stresspattern", &patternstr);
+        if (ret < 0)
+            exit_failure();
+        if (ret > 0) {
+            pattern = parse_pattern(patternstr);
+            g_free(patternstr);
+            if (pattern < 0) {
+                exit_failure();
+            }
+        }
     }
 
     if (ncpus == 0)
         ncpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-    fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
-            argv0, gettid(), ramsizeGB, ncpus);
+    fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs, "
+            "%s pattern\n",
+            argv0, gettid(), ramsizeGB, ncpus, pattern_names[pattern]);
 
-    stress(ramsizeGB, ncpus);
+    stress(ramsizeGB, ncpus, pattern);
 
     exit_failure();
 }
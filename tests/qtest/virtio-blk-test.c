@@ -766,6 +766,21 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/*
+ * Virtqueue 0 is handled in thread1 while the BlockBackend stays in
+ * thread0, so requests and completions run in different IOThreads.
+ */
+static void iothread_vq_mapping(void *obj, void *data,
+                                QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QVirtioDevice *dev = blk->blk.vdev;
+    QVirtQueue *vq;
+
+    vq = test_basic(dev, t_alloc);
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -780,6 +795,14 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_blk_test_setup_iothreads(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -object iothread,id=thread0"
+                    " -object iothread,id=thread1");
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -797,6 +820,14 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.before = virtio_blk_test_setup_iothreads;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "iothread=thread0,num-queues=2,"
+                             "iothread-vq-mapping=thread1:thread0",
+    };
+    qos_add_test("iothread-vq-mapping", "virtio-blk-pci",
+                 iothread_vq_mapping, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -593,6 +593,21 @@ static void test_dummy_class_iterator(void)
     test_dummy_prop_iterator(&iter, expected, ARRAY_SIZE(expected));
 }
 
+/* Properties added to a parent are seen by already looked up subclasses */
+static void test_dummy_class_late_prop(void)
+{
+    ObjectClass *klass = object_class_by_name(TYPE_DUMMY);
+    ObjectClass *parent = object_class_get_parent(klass);
+    ObjectProperty *prop;
+
+    g_assert(object_class_property_find(klass, "type"));
+    g_assert(!object_class_property_find(klass, "late"));
+
+    prop = object_class_property_add_bool(parent, "late", NULL, NULL);
+    g_assert(object_class_property_find(parent, "late") == prop);
+    g_assert(object_class_property_find(klass, "late") == prop);
+}
+
 static void test_dummy_delchild(void)
 {
     Object *parent = object_get_objects_root();
@@ -666,6 +681,8 @@ int main(int argc, char **argv)
     g_test_add_func("/qom/proplist/class_iterator", test_dummy_class_iterator);
     g_test_add_func("/qom/proplist/delchild", test_dummy_delchild);
     g_test_add_func("/qom/resolve/partial", test_qom_partial_path);
+    g_test_add_func("/qom/proplist/class_late_prop",
+                    test_dummy_class_late_prop);
 
     return g_test_run();
 }
@@ -172,6 +172,8 @@ static void perftestinit(void)
 
 static void perftestrun(int nthreads, int duration, int nreaders, int nupdaters)
 {
+    RCUStats stats;
+
     while (qatomic_read(&nthreadsrunning) < nthreads) {
         g_usleep(1000);
     }
@@ -186,6 +188,11 @@ static void perftestrun(int nthreads, int duration, int nreaders, int nupdaters)
         (double)n_reads),
            ((duration * 1000*1000*1000.*(double)nupdaters) /
         (double)n_updates));
+    rcu_get_stats(&stats);
+    printf("grace periods: %" PRIu64 "  ns/grace period: %g  max ns: %" PRIu64
+           "\n", stats.grace_periods,
+           (double)stats.grace_period_ns / MAX(stats.grace_periods, 1),
+           stats.max_grace_period_ns);
     exit(0);
 }
 
@@ -69,10 +69,34 @@ static void test_2(void)
     }
 }
 
+static void test_find_nonzero(void)
+{
+    size_t len = 1024 * 1024 + 100;
+    size_t g, o;
+
+    g_assert_cmpuint(buffer_find_nonzero(buffer, len, 512), ==, len);
+
+    for (g = 1; g <= 4096; g *= 8) {
+        for (o = 0; o < len; o += 4093) {
+            buffer[o] = 1;
+            g_assert_cmpuint(buffer_find_nonzero(buffer, len, g), ==,
+                             QEMU_ALIGN_DOWN(o, g));
+            buffer[o] = 0;
+        }
+    }
+
+    /* A marker in a short last block */
+    buffer[len - 1] = 1;
+    g_assert_cmpuint(buffer_find_nonzero(buffer, len, 512), ==,
+                     QEMU_ALIGN_DOWN(len - 1, 512));
+    buffer[len - 1] = 0;
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/cutils/bufferiszero", test_2);
+    g_test_add_func("/cutils/bufferiszero/find-nonzero", test_find_nonzero);
 
     return g_test_run();
 }
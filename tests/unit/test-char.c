@@ -129,6 +129,10 @@ static void char_stdio_test(void)
 
 static void char_ringbuf_test(void)
 {
+    struct iovec iov[] = {
+        { .iov_base = (void *)"fo", .iov_len = 2 },
+        { .iov_base = (void *)"ur", .iov_len = 2 },
+    };
     QemuOpts *opts;
     Chardev *chr;
     CharBackend be;
@@ -164,6 +168,14 @@ static void char_ringbuf_test(void)
     g_assert_cmpstr(data, ==, "");
     g_free(data);
 
+    /* gathered writes are flattened for backends without chr_writev */
+    ret = qemu_chr_fe_writev_all(&be, iov, ARRAY_SIZE(iov));
+    g_assert_cmpint(ret, ==, 4);
+
+    data = qmp_ringbuf_read("ringbuf-label", 4, false, 0, &error_abort);
+    g_assert_cmpstr(data, ==, "ur");
+    g_free(data);
+
     qemu_chr_fe_deinit(&be, true);
 
     /* check alias */
@@ -793,6 +793,82 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+static void test_hbitmap_serialize_runs(TestHBitmapData *data,
+                                        const void *unused)
+{
+    uint64_t positions[] = { 0, 1, L1 - 1, L1, L2 - 1, L2, L2 + 1, L3 - 1 };
+    int num_positions = ARRAY_SIZE(positions);
+    size_t buf_size, runs_size;
+    uint8_t *buf;
+    int i;
+
+    hbitmap_test_init(data, L3, 0);
+    buf_size = hbitmap_serialization_size(data->hb, 0, data->size);
+    buf = g_malloc0(buf_size);
+
+    /* An empty bitmap is a single clear run */
+    runs_size = hbitmap_serialize_runs(data->hb, buf, buf_size, 0, L3);
+    g_assert_cmpint(runs_size, >, 0);
+    g_assert_cmpint(runs_size, <=, 3);
+
+    for (i = 0; i < num_positions; i++) {
+        hbitmap_set(data->hb, positions[i], MIN(L1 + 3, L3 - positions[i]));
+    }
+    runs_size = hbitmap_serialize_runs(data->hb, buf, buf_size, 0, L3);
+    g_assert_cmpint(runs_size, >, 0);
+    g_assert_cmpint(runs_size, <, buf_size);
+
+    /* Too small a buffer */
+    g_assert_cmpint(hbitmap_serialize_runs(data->hb, buf, 2, 0, L3), ==, 0);
+
+    /* Deserializing overwrites the whole region */
+    hbitmap_reset_all(data->hb);
+    hbitmap_set(data->hb, L3 / 2, L1);
+    g_assert_cmpint(hbitmap_deserialize_runs(data->hb, buf, runs_size,
+                                             0, L3, true), ==, 0);
+    for (i = 0; i < num_positions; i++) {
+        bitmap_set(data->bits, positions[i], MIN(L1 + 3, L3 - positions[i]));
+    }
+    hbitmap_test_check(data, 0);
+
+    /* Runs that do not cover the region are rejected */
+    g_assert_cmpint(hbitmap_deserialize_runs(data->hb, buf, runs_size,
+                                             0, L2, true), ==, -EINVAL);
+
+    g_free(buf);
+}
+
+static void test_hbitmap_merge_sparse(TestHBitmapData *data,
+                                      const void *unused)
+{
+    HBitmap *src = hbitmap_alloc(L3, 0);
+    HBitmap *result = hbitmap_alloc(L3, 0);
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_test_set(data, 0, L1 + 1);
+    hbitmap_test_set(data, L2 + 5, 3);
+
+    hbitmap_set(src, L1, 2);
+    hbitmap_set(src, L3 - L1, L1);
+
+    /* Into a third bitmap, then in place */
+    g_assert(hbitmap_merge(data->hb, src, result));
+    g_assert(hbitmap_merge(data->hb, src, data->hb));
+    bitmap_set(data->bits, L1, 2);
+    bitmap_set(data->bits, L3 - L1, L1);
+    hbitmap_test_check(data, 0);
+    g_assert_cmpint(hbitmap_count(result), ==, hbitmap_count(data->hb));
+
+    /* Result aliasing the second operand */
+    hbitmap_reset_all(src);
+    g_assert(hbitmap_merge(data->hb, src, src));
+    g_assert_cmpint(hbitmap_count(src), ==, hbitmap_count(data->hb));
+    g_assert_cmpint(hbitmap_next_dirty(src, L2, L3), ==, L2 + 5);
+
+    hbitmap_free(src);
+    hbitmap_free(result);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -1093,6 +1169,10 @@ int main(int argc, char **argv)
                      test_hbitmap_serialize_part);
     hbitmap_test_add("/hbitmap/serialize/zeroes",
                      test_hbitmap_serialize_zeroes);
+    hbitmap_test_add("/hbitmap/serialize/runs",
+                     test_hbitmap_serialize_runs);
+
+    hbitmap_test_add("/hbitmap/merge/sparse", test_hbitmap_merge_sparse);
 
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
@@ -831,6 +831,53 @@ static void test_qga_guest_exec(gconstpointer fix)
     qobject_unref(ret);
 }
 
+static void test_qga_guest_exec_stream(gconstpointer fix)
+{
+    const TestFixture *fixture = fix;
+    QDict *ret, *val;
+    const gchar *out;
+    guchar *decoded;
+    int64_t pid, now;
+    gsize len, total = 0;
+    bool exited;
+
+    /* more output than the agent buffers, so that reading pauses */
+    ret = qmp_fd(fixture->fd, "{'execute': 'guest-exec', 'arguments': {"
+                 " 'path': '/bin/sh',"
+                 " 'arg': [ '-c', 'head -c 6000000 /dev/zero' ],"
+                 " 'stream-output': true } }");
+    g_assert_nonnull(ret);
+    qmp_assert_no_error(ret);
+    val = qdict_get_qdict(ret, "return");
+    pid = qdict_get_int(val, "pid");
+    g_assert_cmpint(pid, >, 0);
+    qobject_unref(ret);
+
+    now = g_get_monotonic_time();
+    do {
+        ret = qmp_fd(fixture->fd,
+                     "{'execute': 'guest-exec-status',"
+                     " 'arguments': { 'pid': %" PRId64 " } }", pid);
+        g_assert_nonnull(ret);
+        val = qdict_get_qdict(ret, "return");
+        exited = qdict_get_bool(val, "exited");
+        g_assert(!qdict_haskey(val, "out-truncated"));
+        if (qdict_haskey(val, "out-data")) {
+            out = qdict_get_str(val, "out-data");
+            decoded = g_base64_decode(out, &len);
+            total += len;
+            g_free(decoded);
+        }
+        if (exited) {
+            g_assert_cmpint(qdict_get_int(val, "exitcode"), ==, 0);
+        }
+        qobject_unref(ret);
+    } while (!exited &&
+             g_get_monotonic_time() < now + 10 * G_TIME_SPAN_SECOND);
+    g_assert(exited);
+    g_assert_cmpint(total, ==, 6000000);
+}
+
 static void test_qga_guest_exec_invalid(gconstpointer fix)
 {
     const TestFixture *fixture = fix;
@@ -1000,6 +1047,8 @@ int main(int argc, char **argv)
     g_test_add_data_func("/qga/blacklist", NULL, test_qga_blacklist);
     g_test_add_data_func("/qga/config", NULL, test_qga_config);
     g_test_add_data_func("/qga/guest-exec", &fix, test_qga_guest_exec);
+    g_test_add_data_func("/qga/guest-exec-stream", &fix,
+                         test_qga_guest_exec_stream);
     g_test_add_data_func("/qga/guest-exec-invalid", &fix,
                          test_qga_guest_exec_invalid);
     g_test_add_data_func("/qga/guest-get-osinfo", &fix,
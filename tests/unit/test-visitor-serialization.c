@@ -17,6 +17,8 @@
 #include "qemu-common.h"
 #include "test-qapi-visit.h"
 #include "qapi/error.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/qmp/json-writer.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qstring.h"
 #include "qapi/qobject-input-visitor.h"
@@ -981,6 +983,46 @@ static void qmp_cleanup(void *datap)
     g_free(d);
 }
 
+typedef struct JsonSerializeData {
+    JSONWriter *writer;
+    Visitor *jov;
+    Visitor *qiv;
+} JsonSerializeData;
+
+static void json_serialize(void *native_in, void **datap,
+                           VisitorFunc visit, Error **errp)
+{
+    JsonSerializeData *d = g_malloc0(sizeof(*d));
+
+    d->writer = json_writer_new(false);
+    d->jov = json_output_visitor_new(d->writer, NULL);
+    visit(d->jov, &native_in, errp);
+    *datap = d;
+}
+
+static void json_deserialize(void **native_out, void *datap,
+                             VisitorFunc visit, Error **errp)
+{
+    JsonSerializeData *d = datap;
+    QObject *obj;
+
+    visit_complete(d->jov, NULL);
+    obj = qobject_from_json(json_writer_get(d->writer), &error_abort);
+    d->qiv = qobject_input_visitor_new(obj);
+    qobject_unref(obj);
+    visit(d->qiv, native_out, errp);
+}
+
+static void json_cleanup(void *datap)
+{
+    JsonSerializeData *d = datap;
+
+    visit_free(d->jov);
+    visit_free(d->qiv);
+    json_writer_free(d->writer);
+    g_free(d);
+}
+
 typedef struct StringSerializeData {
     char *string;
     Visitor *sov;
@@ -1032,6 +1074,14 @@ static const SerializeOps visitors[] = {
         .caps = VCAP_PRIMITIVES | VCAP_STRUCTURES | VCAP_LISTS |
                 VCAP_PRIMITIVE_LISTS
     },
+    {
+        .type = "JSON",
+        .serialize = json_serialize,
+        .deserialize = json_deserialize,
+        .cleanup = json_cleanup,
+        .caps = VCAP_PRIMITIVES | VCAP_STRUCTURES | VCAP_LISTS |
+                VCAP_PRIMITIVE_LISTS
+    },
     {
         .type = "String",
         .serialize = string_serialize,
@@ -174,6 +174,57 @@ static void test_encode_decode(void)
     }
 }
 
+#define XBZRLE_ACCEL_PAGES 64
+
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(XBZRLE_ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *new = g_malloc(XBZRLE_ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *ref = g_malloc(XBZRLE_ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    int ref_len[XBZRLE_ACCEL_PAGES];
+    int i, j, dlen;
+    bool first = true;
+
+    /* Runs of every length, ending anywhere within a vector */
+    for (i = 0; i < XBZRLE_ACCEL_PAGES; i++) {
+        uint8_t *o = old + i * XBZRLE_PAGE_SIZE;
+        uint8_t *n = new + i * XBZRLE_PAGE_SIZE;
+
+        for (j = 0; j < XBZRLE_PAGE_SIZE; j++) {
+            o[j] = g_test_rand_int();
+            n[j] = g_test_rand_int_range(0, i + 2) ? o[j] : ~o[j];
+        }
+    }
+
+    do {
+        for (i = 0; i < XBZRLE_ACCEL_PAGES; i++) {
+            dlen = xbzrle_encode_buffer(old + i * XBZRLE_PAGE_SIZE,
+                                        new + i * XBZRLE_PAGE_SIZE,
+                                        XBZRLE_PAGE_SIZE, compressed,
+                                        XBZRLE_PAGE_SIZE);
+            if (first) {
+                ref_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(ref + i * XBZRLE_PAGE_SIZE, compressed, dlen);
+                }
+                continue;
+            }
+            g_assert_cmpint(dlen, ==, ref_len[i]);
+            if (dlen > 0) {
+                g_assert(memcmp(ref + i * XBZRLE_PAGE_SIZE, compressed,
+                                dlen) == 0);
+            }
+        }
+        first = false;
+    } while (xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(ref);
+    g_free(compressed);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +237,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -108,7 +108,7 @@ struct lo_inode {
      * Note that this value is untrusted because the client can manipulate
      * it arbitrarily using FUSE_FORGET requests.
      *
-     * Protected by lo->mutex.
+     * Protected by lo->lock.
      */
     uint64_t nlookup;
 
@@ -143,7 +143,11 @@ typedef struct xattr_map_entry {
 } XattrMapEntry;
 
 struct lo_data {
-    pthread_mutex_t mutex;
+    /*
+     * Taken for reading to look up inodes and file handles, and for writing
+     * to add or remove them, or to change an inode's nlookup.
+     */
+    pthread_rwlock_t lock;
     int sandbox;
     int debug;
     int writeback;
@@ -163,10 +167,10 @@ struct lo_data {
     int announce_submounts;
     bool use_statx;
     struct lo_inode root;
-    GHashTable *inodes; /* protected by lo->mutex */
-    struct lo_map ino_map; /* protected by lo->mutex */
-    struct lo_map dirp_map; /* protected by lo->mutex */
-    struct lo_map fd_map; /* protected by lo->mutex */
+    GHashTable *inodes; /* protected by lo->lock */
+    struct lo_map ino_map; /* protected by lo->lock */
+    struct lo_map dirp_map; /* protected by lo->lock */
+    struct lo_map fd_map; /* protected by lo->lock */
     XattrMapEntry *xattr_map_list;
     size_t xattr_map_nentries;
 
@@ -508,7 +512,7 @@ static void lo_map_remove(struct lo_map *map, size_t key)
     map->freelist = key;
 }
 
-/* Assumes lo->mutex is held */
+/* Assumes lo->lock is held for writing */
 static ssize_t lo_add_fd_mapping(struct lo_data *lo, int fd)
 {
     struct lo_map_elem *elem;
@@ -522,7 +526,7 @@ static ssize_t lo_add_fd_mapping(struct lo_data *lo, int fd)
     return elem - lo->fd_map.elems;
 }
 
-/* Assumes lo->mutex is held */
+/* Assumes lo->lock is held for writing */
 static ssize_t lo_add_dirp_mapping(fuse_req_t req, struct lo_dirp *dirp)
 {
     struct lo_map_elem *elem;
@@ -536,7 +540,7 @@ static ssize_t lo_add_dirp_mapping(fuse_req_t req, struct lo_dirp *dirp)
     return elem - lo_data(req)->dirp_map.elems;
 }
 
-/* Assumes lo->mutex is held */
+/* Assumes lo->lock is held for writing */
 static ssize_t lo_add_inode_mapping(fuse_req_t req, struct lo_inode *inode)
 {
     struct lo_map_elem *elem;
@@ -572,12 +576,12 @@ static struct lo_inode *lo_inode(fuse_req_t req, fuse_ino_t ino)
     struct lo_data *lo = lo_data(req);
     struct lo_map_elem *elem;
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_rdlock(&lo->lock);
     elem = lo_map_get(&lo->ino_map, ino);
     if (elem) {
         g_atomic_int_inc(&elem->inode->refcount);
     }
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 
     if (!elem) {
         return NULL;
@@ -759,9 +763,9 @@ static int lo_fi_fd(fuse_req_t req, struct fuse_file_info *fi)
     struct lo_data *lo = lo_data(req);
     struct lo_map_elem *elem;
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_rdlock(&lo->lock);
     elem = lo_map_get(&lo->fd_map, fi->fh);
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 
     if (!elem) {
         return -1;
@@ -921,14 +925,14 @@ static struct lo_inode *lo_find(struct lo_data *lo, struct stat *st,
         .mnt_id = mnt_id,
     };
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     p = g_hash_table_lookup(lo->inodes, &key);
     if (p) {
         assert(p->nlookup > 0);
         p->nlookup++;
         g_atomic_int_inc(&p->refcount);
     }
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 
     return p;
 }
@@ -1083,10 +1087,10 @@ static int lo_do_lookup(fuse_req_t req, fuse_ino_t parent, const char *name,
             inode->posix_locks = g_hash_table_new_full(
                 g_direct_hash, g_direct_equal, NULL, posix_locks_value_destroy);
         }
-        pthread_mutex_lock(&lo->mutex);
+        pthread_rwlock_wrlock(&lo->lock);
         inode->fuse_ino = lo_add_inode_mapping(req, inode);
         g_hash_table_insert(lo->inodes, &inode->key, inode);
-        pthread_mutex_unlock(&lo->mutex);
+        pthread_rwlock_unlock(&lo->lock);
     }
     e->ino = inode->fuse_ino;
 
@@ -1380,9 +1384,9 @@ static void lo_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t parent,
         goto out_err;
     }
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     inode->nlookup++;
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
     e.ino = inode->fuse_ino;
 
     fuse_log(FUSE_LOG_DEBUG, "  %lli/%s -> %lli\n", (unsigned long long)parent,
@@ -1544,7 +1548,7 @@ static void lo_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
     lo_inode_put(lo, &inode);
 }
 
-/* To be called with lo->mutex held */
+/* To be called with lo->lock held for writing */
 static void unref_inode(struct lo_data *lo, struct lo_inode *inode, uint64_t n)
 {
     if (!inode) {
@@ -1575,9 +1579,9 @@ static void unref_inode_lolocked(struct lo_data *lo, struct lo_inode *inode,
         return;
     }
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     unref_inode(lo, inode, n);
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 }
 
 static void lo_forget_one(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
@@ -1662,12 +1666,12 @@ static struct lo_dirp *lo_dirp(fuse_req_t req, struct fuse_file_info *fi)
     struct lo_data *lo = lo_data(req);
     struct lo_map_elem *elem;
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_rdlock(&lo->lock);
     elem = lo_map_get(&lo->dirp_map, fi->fh);
     if (elem) {
         g_atomic_int_inc(&elem->dirp->refcount);
     }
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
     if (!elem) {
         return NULL;
     }
@@ -1703,9 +1707,9 @@ static void lo_opendir(fuse_req_t req, fuse_ino_t ino,
     d->entry = NULL;
 
     g_atomic_int_set(&d->refcount, 1); /* paired with lo_releasedir() */
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     fh = lo_add_dirp_mapping(req, d);
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
     if (fh == -1) {
         goto out_err;
     }
@@ -1862,17 +1866,17 @@ static void lo_releasedir(fuse_req_t req, fuse_ino_t ino,
 
     (void)ino;
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     elem = lo_map_get(&lo->dirp_map, fi->fh);
     if (!elem) {
-        pthread_mutex_unlock(&lo->mutex);
+        pthread_rwlock_unlock(&lo->lock);
         fuse_reply_err(req, EBADF);
         return;
     }
 
     d = elem->dirp;
     lo_map_remove(&lo->dirp_map, fi->fh);
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 
     lo_dirp_put(&d); /* paired with lo_opendir() */
 
@@ -1959,9 +1963,9 @@ static int lo_do_open(struct lo_data *lo, struct lo_inode *inode,
         }
     }
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     fh = lo_add_fd_mapping(lo, fd);
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
     if (fh == -1) {
         close(fd);
         return ENOMEM;
@@ -2247,14 +2251,14 @@ static void lo_release(fuse_req_t req, fuse_ino_t ino,
 
     (void)ino;
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     elem = lo_map_get(&lo->fd_map, fi->fh);
     if (elem) {
         fd = elem->fd;
         elem = NULL;
         lo_map_remove(&lo->fd_map, fi->fh);
     }
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 
     close(fd);
     fuse_reply_err(req, 0);
@@ -3325,7 +3329,7 @@ static void lo_destroy(void *userdata)
 {
     struct lo_data *lo = (struct lo_data *)userdata;
 
-    pthread_mutex_lock(&lo->mutex);
+    pthread_rwlock_wrlock(&lo->lock);
     while (true) {
         GHashTableIter iter;
         gpointer key, value;
@@ -3338,7 +3342,7 @@ static void lo_destroy(void *userdata)
         struct lo_inode *inode = value;
         unref_inode(lo, inode, inode->nlookup);
     }
-    pthread_mutex_unlock(&lo->mutex);
+    pthread_rwlock_unlock(&lo->lock);
 }
 
 static struct fuse_lowlevel_ops lo_oper = {
@@ -3915,7 +3919,7 @@ int main(int argc, char *argv[])
 
     qemu_init_exec_dir(argv[0]);
 
-    pthread_mutex_init(&lo.mutex, NULL);
+    pthread_rwlock_init(&lo.lock, NULL);
     lo.inodes = g_hash_table_new(lo_key_hash, lo_key_equal);
     lo.root.fd = -1;
     lo.root.fuse_ino = FUSE_ROOT_ID;
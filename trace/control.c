@@ -41,6 +41,7 @@ static uint32_t next_id;
 static uint32_t next_vcpu_id;
 static bool init_trace_on_startup;
 static char *trace_opts_file;
+static uint64_t trace_opts_file_size;
 
 QemuOptsList qemu_trace_opts = {
     .name = "trace",
@@ -57,6 +58,9 @@ QemuOptsList qemu_trace_opts = {
         },{
             .name = "file",
             .type = QEMU_OPT_STRING,
+        },{
+            .name = "file-size",
+            .type = QEMU_OPT_SIZE,
         },
         { /* end of list */ }
     },
@@ -227,6 +231,7 @@ void trace_init_file(void)
 {
 #ifdef CONFIG_TRACE_SIMPLE
     st_set_trace_file(trace_opts_file);
+    st_set_trace_file_size(trace_opts_file_size);
     if (init_trace_on_startup) {
         st_set_trace_file_enabled(true);
     }
@@ -247,6 +252,13 @@ void trace_init_file(void)
         exit(1);
     }
 #endif
+#ifndef CONFIG_TRACE_SIMPLE
+    if (trace_opts_file_size) {
+        fprintf(stderr, "error: --trace file-size=...: "
+                "option not supported by the selected tracing backends\n");
+        exit(1);
+    }
+#endif
 }
 
 void trace_fini_vcpu(CPUState *vcpu)
@@ -304,6 +316,7 @@ void trace_opt_parse(const char *optarg)
     init_trace_on_startup = true;
     g_free(trace_opts_file);
     trace_opts_file = g_strdup(qemu_opt_get(opts, "file"));
+    trace_opts_file_size = qemu_opt_get_size(opts, "file-size", 0);
     qemu_opts_del(opts);
 }
 
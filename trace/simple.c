@@ -34,8 +34,11 @@
 #define TRACE_RECORD_VALID ((uint64_t)1 << 63)
 
 /*
- * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * Each thread writes its trace records to its own ring buffer, so that
+ * tracing from several threads does not bounce a cache line between
+ * them.  The buffers are written out by a dedicated thread, which waits
+ * for records to become available, merges them by timestamp, writes
+ * them out, and then waits again.
  */
 static GMutex trace_lock;
 static GCond trace_available_cond;
@@ -45,17 +48,47 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    /* per thread, must be a power of two */
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/*
+ * A single-producer, single-consumer ring buffer.  @head and @tail are
+ * free running; the owner thread only writes @head and the writeout
+ * thread only writes @tail.  A buffer is never freed: when its thread
+ * exits, it keeps its records until they are written out and is reused
+ * by the next thread that starts tracing.
+ */
+typedef struct TraceThreadBuf {
+    struct TraceThreadBuf *next;
+    int in_use;             /* owned by a thread */
+    bool busy;              /* a record is being written by the owner */
+    unsigned int head;
+    unsigned int tail;
+    unsigned int dropped;
+    unsigned int writeout_end; /* only used by the writeout thread */
+    uint8_t data[TRACE_BUF_LEN];
+} TraceThreadBuf;
+
+static TraceThreadBuf *trace_bufs;
+static __thread TraceThreadBuf *trace_thread_buf;
+
+static void trace_thread_buf_release(gpointer opaque)
+{
+    TraceThreadBuf *buf = opaque;
+
+    qatomic_store_release(&buf->in_use, false);
+}
+
+static GPrivate trace_thread_buf_key =
+    G_PRIVATE_INIT(trace_thread_buf_release);
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
+static uint64_t trace_file_size;
+static uint64_t trace_file_written;
 
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
@@ -76,53 +109,64 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuf *buf, unsigned int idx,
+                             void *dataptr, size_t size)
+{
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(dataptr, &buf->data[off], first);
+    memcpy((uint8_t *)dataptr + first, buf->data, size - first);
+}
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static unsigned int write_to_buffer(TraceThreadBuf *buf, unsigned int idx,
+                                    const void *dataptr, size_t size)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(&buf->data[off], dataptr, first);
+    memcpy(buf->data, (const uint8_t *)dataptr + first, size - first);
+    return idx + size; /* most callers wants to know where to write next */
 }
+
 /**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
+ * Get the trace buffer of the current thread, reusing the buffer of a
+ * thread that exited if possible
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static TraceThreadBuf *get_trace_thread_buf(void)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceThreadBuf *buf = trace_thread_buf;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    if (likely(buf)) {
+        return buf;
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    for (buf = qatomic_load_acquire(&trace_bufs); buf; buf = buf->next) {
+        if (!qatomic_read(&buf->in_use) &&
+            !qatomic_xchg(&buf->in_use, true)) {
+            break;
+        }
+    }
+
+    if (!buf) {
+        TraceThreadBuf *next;
+
+        /* don't use g_malloc, can deadlock when traced */
+        buf = calloc(1, sizeof(*buf));
+        if (!buf) {
+            return NULL;
+        }
+        buf->in_use = true;
+        do {
+            next = qatomic_read(&trace_bufs);
+            buf->next = next;
+        } while (qatomic_cmpxchg(&trace_bufs, next, buf) != next);
+    }
+
+    trace_thread_buf = buf;
+    g_private_set(&trace_thread_buf_key, buf);
+    return buf;
 }
 
 /**
@@ -154,128 +198,182 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+static void write_trace_data(const void *data, size_t size)
+{
+    size_t unused __attribute__ ((unused));
+
+    unused = fwrite(data, size, 1, trace_fp);
+    trace_file_written += size;
+}
+
+/**
+ * Write out the oldest record among those that were in the buffers
+ * when the writeout started
+ *
+ * Returns false if there are no such records left.
+ */
+static bool write_oldest_trace_record(void)
+{
+    TraceThreadBuf *buf, *oldest = NULL;
+    TraceRecord record, oldest_record;
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    unsigned int off, first;
+
+    for (buf = qatomic_load_acquire(&trace_bufs); buf; buf = buf->next) {
+        if (buf->tail == buf->writeout_end) {
+            continue;
+        }
+        read_from_buffer(buf, buf->tail, &record, sizeof(record));
+        if (!oldest || record.timestamp_ns < oldest_record.timestamp_ns) {
+            oldest = buf;
+            oldest_record = record;
+        }
+    }
+    if (!oldest) {
+        return false;
+    }
+
+    off = oldest->tail % TRACE_BUF_LEN;
+    first = MIN(oldest_record.length, TRACE_BUF_LEN - off);
+    write_trace_data(&type, sizeof(type));
+    write_trace_data(&oldest->data[off], first);
+    write_trace_data(oldest->data, oldest_record.length - first);
+    qatomic_store_release(&oldest->tail,
+                          oldest->tail + oldest_record.length);
+    return true;
+}
+
+static int st_open_trace_file(void);
+
+/**
+ * Start a new trace file once the current one reached @trace_file_size,
+ * keeping the current one as "<trace_file_name>.1"
+ */
+static void rotate_trace_file(void)
+{
+    g_autofree char *old_name = NULL;
+
+    if (!trace_file_size || trace_file_written < trace_file_size) {
+        return;
+    }
+
+    fclose(trace_fp);
+    trace_fp = NULL;
+    old_name = g_strdup_printf("%s.1", trace_file_name);
+    if (rename(trace_file_name, old_name) < 0 || st_open_trace_file() < 0) {
+        /* keep writing to the current file rather than losing records */
+        trace_fp = fopen(trace_file_name, "ab");
+        trace_file_written = 0;
+    }
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
+    TraceThreadBuf *buf;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
-    size_t unused __attribute__ ((unused));
+    unsigned int dropped_count;
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
     for (;;) {
         wait_for_trace_records_available();
+        if (!trace_fp) {
+            /* rotate_trace_file() failed */
+            continue;
+        }
 
-        if (g_atomic_int_get(&dropped_events)) {
+        dropped_count = 0;
+        for (buf = qatomic_load_acquire(&trace_bufs); buf; buf = buf->next) {
+            buf->writeout_end = qatomic_load_acquire(&buf->head);
+            if (qatomic_read(&buf->dropped)) {
+                dropped_count += qatomic_xchg(&buf->dropped, 0);
+            }
+        }
+
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID;
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+            write_trace_data(&type, sizeof(type));
+            write_trace_data(&dropped.rec, dropped.rec.length);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+        while (trace_fp && write_oldest_trace_record()) {
+            rotate_trace_file();
         }
 
-        fflush(trace_fp);
+        if (trace_fp) {
+            fflush(trace_fp);
+        }
     }
     return NULL;
 }
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, &val,
+                                   sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, &slen,
+                                   sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *buf = get_trace_thread_buf();
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
-
-    idx = old_idx % TRACE_BUF_LEN;
-
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
-
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
-    return 0;
-}
+    TraceRecord record;
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
+    if (!buf) {
+        return -ENOMEM;
     }
-}
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
+    /* An event traced from a signal handler while writing another one */
+    if (buf->busy) {
+        qatomic_inc(&buf->dropped);
+        return -EBUSY;
+    }
+    buf->busy = true;
+    barrier();
+
+    if (buf->head + rec_len - qatomic_load_acquire(&buf->tail) >
+        TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_inc(&buf->dropped);
+        buf->busy = false;
+        return -ENOSPC;
     }
-    return idx; /* most callers wants to know where to write next */
+
+    record.event = event;
+    record.timestamp_ns = get_clock();
+    record.length = rec_len;
+    record.pid = trace_pid;
+
+    rec->buf = buf;
+    rec->rec_off = write_to_buffer(buf, buf->head, &record, sizeof(record));
+    return 0;
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceThreadBuf *buf = rec->buf;
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    /* publish the record to the writeout thread */
+    qatomic_store_release(&buf->head, rec->rec_off);
+    barrier();
+    buf->busy = false;
+
+    if (rec->rec_off - qatomic_read(&buf->tail) > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
 }
@@ -302,6 +400,35 @@ static int st_write_event_mapping(void)
     return 0;
 }
 
+/**
+ * Create the trace file and write its header and event mapping
+ *
+ * Returns -1 if the file could not be created or written.
+ */
+static int st_open_trace_file(void)
+{
+    static const TraceLogHeader header = {
+        .header_event_id = HEADER_EVENT_ID,
+        .header_magic = HEADER_MAGIC,
+        /* Older log readers will check for version at next location */
+        .header_version = HEADER_VERSION,
+    };
+
+    trace_fp = fopen(trace_file_name, "wb");
+    if (!trace_fp) {
+        return -1;
+    }
+
+    if (fwrite(&header, sizeof header, 1, trace_fp) != 1 ||
+        st_write_event_mapping() < 0) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+        return -1;
+    }
+    trace_file_written = 0;
+    return 0;
+}
+
 /**
  * Enable / disable tracing, return whether it was enabled.
  *
@@ -321,22 +448,7 @@ bool st_set_trace_file_enabled(bool enable)
     flush_trace_file(true);
 
     if (enable) {
-        static const TraceLogHeader header = {
-            .header_event_id = HEADER_EVENT_ID,
-            .header_magic = HEADER_MAGIC,
-            /* Older log readers will check for version at next location */
-            .header_version = HEADER_VERSION,
-        };
-
-        trace_fp = fopen(trace_file_name, "wb");
-        if (!trace_fp) {
-            return was_enabled;
-        }
-
-        if (fwrite(&header, sizeof header, 1, trace_fp) != 1 ||
-            st_write_event_mapping() < 0) {
-            fclose(trace_fp);
-            trace_fp = NULL;
+        if (st_open_trace_file() < 0) {
             return was_enabled;
         }
 
@@ -372,6 +484,19 @@ void st_set_trace_file(const char *file)
     st_set_trace_file_enabled(saved_enable);
 }
 
+/**
+ * Set the size at which the trace file is rotated
+ *
+ * @size        The size in bytes, or 0 to never rotate the trace file
+ */
+void st_set_trace_file_size(uint64_t size)
+{
+    bool saved_enable = st_set_trace_file_enabled(false);
+
+    trace_file_size = size;
+    st_set_trace_file_enabled(saved_enable);
+}
+
 void st_print_trace_file_status(void)
 {
     qemu_printf("Trace file \"%s\" %s.\n",
@@ -14,11 +14,12 @@
 void st_print_trace_file_status(void);
 bool st_set_trace_file_enabled(bool enable);
 void st_set_trace_file(const char *file);
+void st_set_trace_file_size(uint64_t size);
 bool st_init(void);
 void st_flush_trace_buffer(void);
 
 typedef struct {
-    unsigned int tbuf_idx;
+    void *buf;
     unsigned int rec_off;
 } TraceBufferRecord;
 
@@ -677,25 +677,30 @@ check_solid_tile32(VncState *vs, int x, int y, int w, int h,
                    uint32_t *color, bool samecolor)
 {
     VncDisplay *vd = vs->vd;
-    uint32_t *fbptr;
+    uint32_t *fbptr, *row0;
     uint32_t c;
     int dx, dy;
 
-    fbptr = vnc_server_fb_ptr(vd, x, y);
+    row0 = fbptr = vnc_server_fb_ptr(vd, x, y);
 
     c = *fbptr;
     if (samecolor && (uint32_t)c != *color) {
         return false;
     }
 
-    for (dy = 0; dy < h; dy++) {
-        for (dx = 0; dx < w; dx++) {
-            if (c != fbptr[dx]) {
-                return false;
-            }
+    for (dx = 0; dx < w; dx++) {
+        if (c != fbptr[dx]) {
+            return false;
         }
+    }
+
+    /* the first row is solid, the others only need to match it */
+    for (dy = 1; dy < h; dy++) {
         fbptr = (uint32_t *)
             ((uint8_t *)fbptr + vnc_server_fb_stride(vd));
+        if (memcmp(fbptr, row0, w * sizeof(uint32_t))) {
+            return false;
+        }
     }
 
     *color = (uint32_t)c;
@@ -1173,14 +1178,32 @@ static void jpeg_term_destination(j_compress_ptr cinfo)
     buffer->offset = buffer->capacity - cinfo->dest->free_in_buffer;
 }
 
+/*
+ * libjpeg-turbo reads x8r8g8b8 directly (and converts it with SIMD code),
+ * so the server surface rows can be handed to it without a line buffer.
+ */
+#ifdef JCS_EXTENSIONS
+#ifdef HOST_WORDS_BIGENDIAN
+#define TIGHT_JPEG_SERVER_FB_CS JCS_EXT_XRGB
+#else
+#define TIGHT_JPEG_SERVER_FB_CS JCS_EXT_BGRX
+#endif
+#define TIGHT_JPEG_ROWS 16
+#endif
+
 static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
 {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
     struct jpeg_destination_mgr manager;
+#ifdef TIGHT_JPEG_SERVER_FB_CS
+    JSAMPROW rows[TIGHT_JPEG_ROWS];
+    int i, n;
+#else
     pixman_image_t *linebuf;
     JSAMPROW row[1];
     uint8_t *buf;
+#endif
     int dy;
 
     if (surface_bytes_per_pixel(vs->vd->ds) == 1) {
@@ -1195,8 +1218,14 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
     cinfo.client_data = vs;
     cinfo.image_width = w;
     cinfo.image_height = h;
+#ifdef TIGHT_JPEG_SERVER_FB_CS
+    QEMU_BUILD_BUG_ON(VNC_SERVER_FB_BYTES != 4);
+    cinfo.input_components = 4;
+    cinfo.in_color_space = TIGHT_JPEG_SERVER_FB_CS;
+#else
     cinfo.input_components = 3;
     cinfo.in_color_space = JCS_RGB;
+#endif
 
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, quality, true);
@@ -1208,6 +1237,15 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
 
     jpeg_start_compress(&cinfo, true);
 
+#ifdef TIGHT_JPEG_SERVER_FB_CS
+    for (dy = 0; dy < h; dy += n) {
+        n = MIN(h - dy, TIGHT_JPEG_ROWS);
+        for (i = 0; i < n; i++) {
+            rows[i] = vnc_server_fb_ptr(vs->vd, x, y + dy + i);
+        }
+        jpeg_write_scanlines(&cinfo, rows, n);
+    }
+#else
     linebuf = qemu_pixman_linebuf_create(PIXMAN_BE_r8g8b8, w);
     buf = (uint8_t *)pixman_image_get_data(linebuf);
     row[0] = buf;
@@ -1216,6 +1254,7 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
         jpeg_write_scanlines(&cinfo, row, 1);
     }
     qemu_pixman_image_unref(linebuf);
+#endif
 
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
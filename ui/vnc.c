@@ -3080,10 +3080,12 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int height = MIN(pixman_image_get_height(vd->guest.fb),
                      pixman_image_get_height(vd->server));
     int cmp_bytes, server_stride, line_bytes, guest_ll, guest_stride, y = 0;
+    int xmax = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
     uint8_t *guest_row0 = NULL, *server_row0;
     VncState *vs;
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
+    DECLARE_BITMAP(changed, VNC_DIRTY_BITS);
 
     struct timeval tv = { 0, 0 };
 
@@ -3116,7 +3118,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     line_bytes = MIN(server_stride, guest_ll);
 
     for (;;) {
-        int x;
+        int x, xend, row_dirty = 0;
         uint8_t *guest_ptr, *server_ptr;
         unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                              height * VNC_DIRTY_BPL(&vd->guest),
@@ -3128,7 +3130,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         y = offset / VNC_DIRTY_BPL(&vd->guest);
         x = offset % VNC_DIRTY_BPL(&vd->guest);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        server_ptr = server_row0 + y * server_stride;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
             qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
@@ -3136,30 +3138,57 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
         }
-        guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
-            }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+        /*
+         * Compare each run of dirty blocks with a single memcmp() first,
+         * a guest that marks a region dirty often did not change most of
+         * it.  Only runs that differ are compared block by block.
+         */
+        for (; x < xmax; x = find_next_bit(vd->guest.dirty[y], xmax, xend)) {
+            int start = x * cmp_bytes;
+            int end;
+
+            xend = find_next_zero_bit(vd->guest.dirty[y], xmax, x);
+            bitmap_clear(vd->guest.dirty[y], x, xend - x);
+
+            end = MIN(xend * cmp_bytes, line_bytes);
+            if (end <= start ||
+                memcmp(server_ptr + start, guest_ptr + start,
+                       end - start) == 0) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
-            if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
+
+            for (; x < xend; x++) {
+                int _cmp_bytes = cmp_bytes;
+
+                start = x * cmp_bytes;
+                if (start + cmp_bytes > line_bytes) {
+                    _cmp_bytes = line_bytes - start;
+                }
+                if (_cmp_bytes <= 0 ||
+                    memcmp(server_ptr + start, guest_ptr + start,
+                           _cmp_bytes) == 0) {
+                    continue;
+                }
+                memcpy(server_ptr + start, guest_ptr + start, _cmp_bytes);
+                if (!vd->non_adaptive) {
+                    vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
+                                     y, &tv);
+                }
+                if (!row_dirty) {
+                    bitmap_zero(changed, xmax);
+                }
+                set_bit(x, changed);
+                row_dirty++;
             }
+        }
+
+        /* hand the changed blocks of this line to all clients at once */
+        if (row_dirty) {
             QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+                bitmap_or(vs->dirty[y], vs->dirty[y], changed, xmax);
             }
-            has_dirty++;
+            has_dirty += row_dirty;
         }
 
         y++;
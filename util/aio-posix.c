@@ -26,6 +26,15 @@
 /* Stop userspace polling on a handler if it isn't active for some time */
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
+/*
+ * Stop polling a handler that made no progress in this many consecutive
+ * polling sessions, even before POLL_IDLE_INTERVAL_NS.  On a busy
+ * AioContext this drops idle handlers within milliseconds, so that the
+ * busy loop only spins on the handlers that actually receive events.  The
+ * handler is polled again as soon as its file descriptor becomes ready.
+ */
+#define POLL_IDLE_SESSIONS 1024
+
 bool aio_poll_disabled(AioContext *ctx)
 {
     return qatomic_read(&ctx->poll_disable_cnt);
@@ -134,6 +143,9 @@ void aio_set_fd_handler(AioContext *ctx,
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
+            new_node->poll_sessions = node->poll_sessions;
+            new_node->poll_successes = node->poll_successes;
+            new_node->poll_removals = node->poll_removals;
         }
         g_source_add_poll(&ctx->source, &new_node->pfd);
 
@@ -316,6 +328,7 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
         !QLIST_IS_INSERTED(node, node_poll) &&
         node->io_poll) {
         trace_poll_add(ctx, node, node->pfd.fd, revents);
+        node->poll_idle_sessions = 0;
         if (ctx->poll_started && node->io_poll_begin) {
             node->io_poll_begin(node->opaque);
         }
@@ -362,6 +375,28 @@ static bool aio_dispatch_ready_handlers(AioContext *ctx,
     return progress;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Call the handlers of the aio_add_sqe() requests that completed */
+static bool aio_dispatch_cqe_handlers(AioContext *ctx)
+{
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    while ((cqe_handler = QSIMPLEQ_FIRST(&ctx->cqe_handler_ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->cqe_handler_ready_list, next);
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    return progress;
+}
+#else
+static bool aio_dispatch_cqe_handlers(AioContext *ctx)
+{
+    return false;
+}
+#endif
+
 /* Slower than aio_dispatch_ready_handlers() but only used via glib */
 static bool aio_dispatch_handlers(AioContext *ctx)
 {
@@ -398,6 +433,8 @@ static bool run_poll_handlers_once(AioContext *ctx,
         if (aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll_idle_sessions = 0;
+            node->poll_successes++;
 
             /*
              * Polling was successful, exit try_poll_mode immediately
@@ -432,16 +469,23 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
      * because fds will not be processed in a timely fashion.  Don't remove
      * idle poll handlers.
      */
-    if (!fdmon_supports_polling(ctx)) {
-        return false;
-    }
+    bool can_remove = fdmon_supports_polling(ctx);
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
+        node->poll_sessions++;
+        node->poll_idle_sessions++;
+
+        if (!can_remove) {
+            continue;
+        }
+
         if (node->poll_idle_timeout == 0LL) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
-        } else if (now >= node->poll_idle_timeout) {
+        } else if (now >= node->poll_idle_timeout ||
+                   node->poll_idle_sessions > POLL_IDLE_SESSIONS) {
             trace_poll_remove(ctx, node, node->pfd.fd);
             node->poll_idle_timeout = 0LL;
+            node->poll_removals++;
             QLIST_SAFE_REMOVE(node, node_poll);
             if (ctx->poll_started && node->io_poll_end) {
                 node->io_poll_end(node->opaque);
@@ -660,6 +704,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     if (ret > 0) {
         progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
+        progress |= aio_dispatch_cqe_handlers(ctx);
     }
 
     aio_free_deleted_handlers(ctx);
@@ -703,6 +748,37 @@ void aio_context_use_g_source(AioContext *ctx)
     aio_free_deleted_handlers(ctx);
 }
 
+size_t aio_context_get_poll_stats(AioContext *ctx, AioPollStats **stats)
+{
+    AioHandler *node;
+    size_t n = 0, i = 0;
+
+    qemu_lockcnt_inc(&ctx->list_lock);
+
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (node->io_poll && !QLIST_IS_INSERTED(node, node_deleted)) {
+            n++;
+        }
+    }
+
+    *stats = g_new0(AioPollStats, n);
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (i < n && node->io_poll &&
+            !QLIST_IS_INSERTED(node, node_deleted)) {
+            (*stats)[i++] = (AioPollStats) {
+                .fd = node->pfd.fd,
+                .polling = QLIST_IS_INSERTED(node, node_poll),
+                .sessions = node->poll_sessions,
+                .successes = node->poll_successes,
+                .removals = node->poll_removals,
+            };
+        }
+    }
+
+    qemu_lockcnt_dec(&ctx->list_lock);
+    return i;
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
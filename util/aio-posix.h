@@ -36,6 +36,12 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    unsigned poll_idle_sessions; /* polling sessions since last progress */
+
+    /* Statistics for aio_context_get_poll_stats() */
+    uint64_t poll_sessions;
+    uint64_t poll_successes;
+    uint64_t poll_removals;
     bool is_external;
 };
 
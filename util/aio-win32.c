@@ -385,7 +385,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
         HANDLE event;
         int ret;
 
-        timeout = blocking && !have_select_revents
+        /* aio_notify() may not have set ctx->notifier, see there */
+        timeout = blocking && !have_select_revents &&
+                  !qatomic_read(&ctx->notified)
             ? qemu_timeout_ns_to_ms(aio_compute_timeout(ctx)) : 0;
         ret = WaitForMultipleObjects(count, events, FALSE, timeout);
         if (blocking) {
@@ -433,6 +435,12 @@ void aio_context_use_g_source(AioContext *ctx)
 {
 }
 
+size_t aio_context_get_poll_stats(AioContext *ctx, AioPollStats **stats)
+{
+    *stats = NULL;
+    return 0;
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
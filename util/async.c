@@ -77,10 +77,17 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
      *    could be freed.
      */
     old_flags = qatomic_fetch_or(&bh->flags, BH_PENDING | new_flags);
-    if (!(old_flags & BH_PENDING)) {
-        QSLIST_INSERT_HEAD_ATOMIC(&ctx->bh_list, bh, next);
+    if (old_flags & BH_PENDING) {
+        /*
+         * Whoever set BH_PENDING calls aio_notify() after it, and
+         * aio_bh_dequeue() will pick up new_flags together with theirs.
+         * This saves a notification when a BH is scheduled repeatedly,
+         * e.g. by several thread pool workers completing requests.
+         */
+        return;
     }
 
+    QSLIST_INSERT_HEAD_ATOMIC(&ctx->bh_list, bh, next);
     aio_notify(ctx);
 }
 
@@ -248,6 +255,7 @@ static gboolean
 aio_ctx_prepare(GSource *source, gint    *timeout)
 {
     AioContext *ctx = (AioContext *) source;
+    bool ready;
 
     qatomic_set(&ctx->notify_me, qatomic_read(&ctx->notify_me) | 1);
 
@@ -264,8 +272,17 @@ aio_ctx_prepare(GSource *source, gint    *timeout)
     if (aio_prepare(ctx)) {
         *timeout = 0;
     }
+    ready = *timeout == 0;
+
+    /*
+     * aio_notify() may not have set the EventNotifier, see there.  Do not
+     * block and let aio_ctx_check() look for whatever was notified.
+     */
+    if (qatomic_read(&ctx->notified)) {
+        *timeout = 0;
+    }
 
-    return *timeout == 0;
+    return ready;
 }
 
 static gboolean
@@ -420,17 +437,22 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
 void aio_notify(AioContext *ctx)
 {
     /*
-     * Write e.g. bh->flags before writing ctx->notified.  Pairs with smp_mb in
-     * aio_notify_accept.
+     * Write e.g. bh->flags before writing ctx->notified, which pairs with
+     * smp_mb in aio_notify_accept.  Write ctx->notified before reading
+     * ctx->notify_me, which pairs with smp_mb in aio_ctx_prepare or
+     * aio_poll.  qatomic_xchg() is a full barrier and does both.
      */
-    smp_wmb();
-    qatomic_set(&ctx->notified, true);
+    if (qatomic_xchg(&ctx->notified, true)) {
+        /*
+         * Another aio_notify() came first since the event loop last called
+         * aio_notify_accept().  Either it sets the EventNotifier, or it saw
+         * ctx->notify_me clear and the event loop has yet to read
+         * ctx->notified, which it does before blocking.  A burst of
+         * notifications thus costs at most one event_notifier_set().
+         */
+        return;
+    }
 
-    /*
-     * Write ctx->notified before reading ctx->notify_me.  Pairs
-     * with smp_mb in aio_ctx_prepare or aio_poll.
-     */
-    smp_mb();
     if (qatomic_read(&ctx->notify_me)) {
         event_notifier_set(&ctx->notifier);
     }
@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
+#include "qemu/units.h"
 
 static bool
 buffer_zero_int(const void *buf, size_t len)
@@ -329,6 +330,129 @@ static bool select_accel_fn(const void *buf, size_t len)
     return buffer_zero_int(buf, len);
 }
 
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+/* Note that these vectorized functions require len >= 64.  */
+
+static bool
+buffer_zero_neon(const void *buf, size_t len)
+{
+    uint8x16_t t = vld1q_u8(buf);
+    const uint8x16_t *p = (uint8x16_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint8x16_t *e = (uint8x16_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(vmaxvq_u32(vreinterpretq_u32_u8(t)))) {
+            return false;
+        }
+        t = vorrq_u8(vorrq_u8(p[-4], p[-3]), vorrq_u8(p[-2], p[-1]));
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t = vorrq_u8(t, e[-3]);
+    t = vorrq_u8(t, e[-2]);
+    t = vorrq_u8(t, e[-1]);
+
+    /* Finish the unaligned tail.  */
+    t = vorrq_u8(t, vld1q_u8(buf + len - 16));
+
+    return vmaxvq_u32(vreinterpretq_u32_u8(t)) == 0;
+}
+
+#ifdef CONFIG_SVE_OPT
+#pragma GCC push_options
+#pragma GCC target("+sve")
+#include <arm_sve.h>
+#include <sys/auxv.h>
+
+static bool
+buffer_zero_sve(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    svbool_t all = svptrue_b8();
+    uint64_t vl = svcntb();
+    uint64_t i;
+
+    /* Loop over blocks of four vectors, whatever the vector length.  */
+    for (i = 0; i + 4 * vl <= len; i += 4 * vl) {
+        svuint8_t t = svorr_u8_x(all, svld1_u8(all, p + i),
+                                 svld1_u8(all, p + i + vl));
+        t = svorr_u8_x(all, t, svld1_u8(all, p + i + 2 * vl));
+        t = svorr_u8_x(all, t, svld1_u8(all, p + i + 3 * vl));
+        if (unlikely(svptest_any(all, svcmpne_n_u8(all, t, 0)))) {
+            return false;
+        }
+    }
+
+    /* Finish the tail with partial vectors.  */
+    for (; i < len; i += vl) {
+        svbool_t pg = svwhilelt_b8_u64(i, len);
+        if (svptest_any(pg, svcmpne_n_u8(pg, svld1_u8(pg, p + i), 0))) {
+            return false;
+        }
+    }
+    return true;
+}
+#pragma GCC pop_options
+#endif /* CONFIG_SVE_OPT */
+
+/* As for x86, the most preferred ISA must have the least significant bit.  */
+#define CACHE_SVE     1
+#define CACHE_NEON    2
+
+/* NEON is part of the base aarch64 ISA.  */
+static unsigned cpuid_cache = CACHE_NEON;
+static bool (*buffer_accel)(const void *, size_t) = buffer_zero_neon;
+
+static void init_accel(unsigned cache)
+{
+    bool (*fn)(const void *, size_t) = buffer_zero_int;
+    if (cache & CACHE_NEON) {
+        fn = buffer_zero_neon;
+    }
+#ifdef CONFIG_SVE_OPT
+    if (cache & CACHE_SVE) {
+        fn = buffer_zero_sve;
+    }
+#endif
+    buffer_accel = fn;
+}
+
+#ifdef CONFIG_SVE_OPT
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned cache = CACHE_NEON;
+
+    if (getauxval(AT_HWCAP) & HWCAP_SVE) {
+        cache |= CACHE_SVE;
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_SVE_OPT */
+
+bool test_buffer_is_zero_next_accel(void)
+{
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+static bool select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= 64)) {
+        return buffer_accel(buf, len);
+    }
+    return buffer_zero_int(buf, len);
+}
+
 #else
 #define select_accel_fn  buffer_zero_int
 bool test_buffer_is_zero_next_accel(void)
@@ -353,3 +477,42 @@ bool buffer_is_zero(const void *buf, size_t len)
        includes a check for an unrolled loop over 64-bit integers.  */
     return select_accel_fn(buf, len);
 }
+
+/* Large buffers are scanned in chunks of this size */
+#define BUFFER_FIND_CHUNK (16 * KiB)
+
+/*
+ * Returns the offset of the first @granularity sized block of @buf that
+ * contains a non-zero byte, or @len if all of @buf is zero.  The last block
+ * may be shorter than @granularity.
+ *
+ * This is meant for callers that scan megabytes at a time, like qemu-img:
+ * the buffer is checked in large chunks, which exits at the first non-zero
+ * chunk, and the next chunk is already being fetched while the current one
+ * is checked.  Only a non-zero chunk is then checked block by block.
+ */
+size_t buffer_find_nonzero(const void *buf, size_t len, size_t granularity)
+{
+    size_t chunk = MAX(QEMU_ALIGN_DOWN(BUFFER_FIND_CHUNK, granularity),
+                       granularity);
+    size_t i, j, n;
+
+    assert(granularity);
+
+    for (i = 0; i < len; i += n) {
+        n = MIN(chunk, len - i);
+        if (i + n < len) {
+            __builtin_prefetch(buf + i + n);
+            __builtin_prefetch(buf + i + n + 64);
+        }
+        if (buffer_is_zero(buf + i, n)) {
+            continue;
+        }
+        for (j = i; j < i + n; j += granularity) {
+            if (!buffer_is_zero(buf + j, MIN(granularity, i + n - j))) {
+                return j;
+            }
+        }
+    }
+    return len;
+}
@@ -0,0 +1,314 @@
+/*
+ * Coroutine backend with assembly stack switching
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ * A switch only saves the stack pointer, plus the frame pointer and the
+ * resume address on the stack being left.  The other callee-saved
+ * registers are declared as clobbered by the switch, so the compiler
+ * saves and restores only those that qemu_coroutine_switch() needs, in
+ * its own frame.  Unlike sigsetjmp(), nothing is mangled and the signal
+ * mask is never looked at.
+ *
+ * The switch does not know about CET shadow stacks; configure refuses
+ * to build it when they are enabled.  Indirect branch tracking works
+ * because switches land with a return (x86) or a branch through x16 on
+ * a BTI landing pad (aarch64).
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine_int.h"
+
+#ifdef CONFIG_VALGRIND_H
+#include <valgrind/valgrind.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || __has_feature(address_sanitizer)
+#ifdef CONFIG_ASAN_IFACE_FIBER
+#define CONFIG_ASAN 1
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+#ifdef CONFIG_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#if defined(__CET__) && (__CET__ & 2)
+#error "the asm coroutine backend does not support CET shadow stacks"
+#endif
+
+typedef struct {
+    Coroutine base;
+    void *sp;
+#ifdef __aarch64__
+    void *pc;
+#endif
+    void *stack;
+    size_t stack_size;
+
+#ifdef CONFIG_TSAN
+    void *tsan_co_fiber;
+#endif
+
+#ifdef CONFIG_VALGRIND_H
+    unsigned int valgrind_stack_id;
+#endif
+} CoroutineAsm;
+
+/**
+ * Per-thread coroutine bookkeeping
+ */
+static __thread CoroutineAsm leader;
+static __thread Coroutine *current;
+
+#if defined(__x86_64__)
+/*
+ * The call/ret pair keeps the return stack predictor right: every switch
+ * returns to the instruction after the same call.  The red zone of the
+ * caller is skipped before anything is pushed.  A new coroutine starts
+ * with %rdi pointing to itself.
+ */
+#define CO_SWITCH(from, to, action) ({                                  \
+    long action_ = (action);                                            \
+    CoroutineAsm *from_ = (from);                                       \
+    CoroutineAsm *to_ = (to);                                           \
+    asm volatile(                                                       \
+        "leaq -128(%%rsp), %%rsp\n\t"                                   \
+        "pushq %%rbp\n\t"                                               \
+        "call 1f\n\t"                                                   \
+        "jmp 2f\n"                                                      \
+        "1:\n\t"                                                        \
+        "movq %%rsp, %c[SP](%[FROM])\n\t"                               \
+        "movq %c[SP](%[TO]), %%rsp\n\t"                                 \
+        "ret\n"                                                         \
+        "2:\n\t"                                                        \
+        "popq %%rbp\n\t"                                                \
+        "leaq 128(%%rsp), %%rsp\n\t"                                    \
+        : "+a" (action_), [FROM] "+b" (from_), [TO] "+D" (to_)          \
+        : [SP] "i" (offsetof(CoroutineAsm, sp))                         \
+        : "rcx", "rdx", "rsi", "r8", "r9", "r10", "r11",                \
+          "r12", "r13", "r14", "r15", "cc", "memory");                  \
+    action_;                                                            \
+})
+
+static void co_init_stack(CoroutineAsm *co, void (*entry)(CoroutineAsm *))
+{
+    void **sp = co->stack + co->stack_size;
+
+    /*
+     * ret pops the entry point, which then sees a zero return address,
+     * with the stack aligned as after a call.
+     */
+    *--sp = NULL;
+    *--sp = entry;
+    co->sp = sp;
+}
+#elif defined(__aarch64__)
+/*
+ * x16 is used for the branch so that both the "bti j" below and the
+ * "bti c" at the start of the entry point accept it.  A new coroutine
+ * starts with x0 pointing to itself.
+ */
+#define CO_SWITCH(from, to, action) ({                                  \
+    register long action_ asm("x2") = (action);                         \
+    register CoroutineAsm *from_ asm("x1") = (from);                    \
+    register CoroutineAsm *to_ asm("x0") = (to);                        \
+    asm volatile(                                                       \
+        "stp x29, x30, [sp, #-16]!\n\t"                                 \
+        "adr x30, 1f\n\t"                                               \
+        "mov x3, sp\n\t"                                                \
+        "str x3, [%[FROM], %[SP]]\n\t"                                  \
+        "str x30, [%[FROM], %[PC]]\n\t"                                 \
+        "ldr x3, [%[TO], %[SP]]\n\t"                                    \
+        "ldr x16, [%[TO], %[PC]]\n\t"                                   \
+        "mov sp, x3\n\t"                                                \
+        "br x16\n"                                                      \
+        "1:\n\t"                                                        \
+        "hint #36\n\t"                                                  \
+        "ldp x29, x30, [sp], #16\n\t"                                   \
+        : "+r" (action_), [FROM] "+r" (from_), [TO] "+r" (to_)          \
+        : [SP] "i" (offsetof(CoroutineAsm, sp)),                        \
+          [PC] "i" (offsetof(CoroutineAsm, pc))                         \
+        : "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",        \
+          "x12", "x13", "x14", "x15", "x16", "x17", "x18", "x19",       \
+          "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27",       \
+          "x28", "x30",                                                 \
+          "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",               \
+          "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",         \
+          "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23",       \
+          "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31",       \
+          "cc", "memory");                                              \
+    action_;                                                            \
+})
+
+static void co_init_stack(CoroutineAsm *co, void (*entry)(CoroutineAsm *))
+{
+    co->sp = co->stack + co->stack_size;
+    co->pc = entry;
+}
+#else
+#error "the asm coroutine backend only supports x86_64 and aarch64 hosts"
+#endif
+
+/*
+ * QEMU_ALWAYS_INLINE only does so if __OPTIMIZE__, so we cannot use it.
+ * always_inline is required to avoid TSan runtime fatal errors.
+ */
+static inline __attribute__((always_inline))
+void on_new_fiber(CoroutineAsm *co)
+{
+#ifdef CONFIG_TSAN
+    co->tsan_co_fiber = __tsan_create_fiber(0); /* flags: sync on switch */
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void finish_switch_fiber(void *fake_stack_save)
+{
+#ifdef CONFIG_ASAN
+    const void *bottom_old;
+    size_t size_old;
+
+    __sanitizer_finish_switch_fiber(fake_stack_save, &bottom_old, &size_old);
+
+    if (!leader.stack) {
+        leader.stack = (void *)bottom_old;
+        leader.stack_size = size_old;
+    }
+#endif
+#ifdef CONFIG_TSAN
+    if (fake_stack_save) {
+        __tsan_release(fake_stack_save);
+        __tsan_switch_to_fiber(fake_stack_save, 0);  /* 0=synchronize */
+    }
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void start_switch_fiber(CoroutineAction action, void **fake_stack_save,
+                        CoroutineAsm *co)
+{
+#ifdef CONFIG_ASAN
+    __sanitizer_start_switch_fiber(
+            action == COROUTINE_TERMINATE ? NULL : fake_stack_save,
+            co->stack, co->stack_size);
+#endif
+#ifdef CONFIG_TSAN
+    void *curr_fiber = __tsan_get_current_fiber();
+    __tsan_acquire(curr_fiber);
+
+    *fake_stack_save = curr_fiber;
+    __tsan_switch_to_fiber(co->tsan_co_fiber, 0);  /* 0=synchronize */
+#endif
+}
+
+static void __attribute__((noreturn)) coroutine_trampoline(CoroutineAsm *self)
+{
+    Coroutine *co = &self->base;
+
+    finish_switch_fiber(NULL);
+
+    while (true) {
+        co->entry(co->entry_arg);
+        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    }
+}
+
+Coroutine *qemu_coroutine_new(void)
+{
+    CoroutineAsm *co;
+
+    co = g_malloc0(sizeof(*co));
+    co->stack_size = COROUTINE_STACK_SIZE;
+    co->stack = qemu_alloc_stack(&co->stack_size);
+
+#ifdef CONFIG_VALGRIND_H
+    co->valgrind_stack_id =
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + co->stack_size);
+#endif
+
+    on_new_fiber(co);
+    co_init_stack(co, coroutine_trampoline);
+    return &co->base;
+}
+
+#ifdef CONFIG_VALGRIND_H
+/* Work around an unused variable in the valgrind.h macro... */
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+static inline void valgrind_stack_deregister(CoroutineAsm *co)
+{
+    VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+void qemu_coroutine_delete(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+    qemu_free_stack(co->stack, co->stack_size);
+    g_free(co);
+}
+
+void qemu_coroutine_discard_stack(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+    qemu_discard_stack(co->stack, co->stack_size, COROUTINE_STACK_KEEP);
+}
+
+/*
+ * This function is marked noinline so that all switches go through the
+ * same instructions, and so that the TLS variable "current" is not
+ * cached across a switch, which may resume in a different thread.
+ */
+CoroutineAction __attribute__((noinline))
+qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
+                      CoroutineAction action)
+{
+    CoroutineAsm *from = DO_UPCAST(CoroutineAsm, base, from_);
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, to_);
+    void *fake_stack_save = NULL;
+    CoroutineAction ret;
+
+    current = to_;
+
+    start_switch_fiber(action, &fake_stack_save, to);
+    ret = CO_SWITCH(from, to, action);
+    finish_switch_fiber(fake_stack_save);
+
+    return ret;
+}
+
+Coroutine *qemu_coroutine_self(void)
+{
+    if (!current) {
+        current = &leader.base;
+    }
+#ifdef CONFIG_TSAN
+    if (!leader.tsan_co_fiber) {
+        leader.tsan_co_fiber = __tsan_get_current_fiber();
+    }
+#endif
+    return current;
+}
+
+bool qemu_in_coroutine(void)
+{
+    return current && current->caller;
+}
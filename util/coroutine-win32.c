@@ -87,6 +87,11 @@ void qemu_coroutine_delete(Coroutine *co_)
     g_free(co);
 }
 
+void qemu_coroutine_discard_stack(Coroutine *co_)
+{
+    /* Fiber stacks are managed by Windows */
+}
+
 Coroutine *qemu_coroutine_self(void)
 {
     if (!current) {
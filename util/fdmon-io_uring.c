@@ -19,9 +19,12 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
+ * This code mostly monitors file descriptors and does not do asynchronous disk
  * I/O.  Implementing disk I/O efficiently has other requirements and should
  * use a separate io_uring so it does not make sense to unify the code.
+ * Other requests that complete when a file descriptor becomes ready, such as
+ * socket reads and writes, can be added to the ring with aio_add_sqe() so
+ * that they are submitted and reaped together with the rest.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -38,9 +41,10 @@
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
  * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * fdmon_io_uring_wait() and aio_add_sqe(), both in the AioContext's thread.
+ * Changes to AioHandlers are made by enqueuing them on ctx->submit_list so
+ * that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD and/or
+ * IORING_OP_POLL_REMOVE sqes for them.
  */
 
 #include "qemu/osdep.h"
@@ -55,6 +59,9 @@ enum {
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
     FDMON_IO_URING_REMOVE   = (1 << 2),
+
+    /* Low bit of the user_data of aio_add_sqe() requests */
+    FDMON_IO_URING_CQE_HANDLER = (1 << 0),
 };
 
 static inline int poll_events_from_pfd(int pfd_events)
@@ -75,7 +82,7 @@ static inline int pfd_events_from_poll(int poll_events)
 
 /*
  * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * fdmon_io_uring_wait() or aio_add_sqe().
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -221,6 +228,7 @@ static bool process_cqe(AioContext *ctx,
                         struct io_uring_cqe *cqe)
 {
     AioHandler *node = io_uring_cqe_get_data(cqe);
+    uintptr_t data = (uintptr_t)node;
     unsigned flags;
 
     /* poll_timeout and poll_remove have a zero user_data field */
@@ -228,6 +236,16 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /* aio_dispatch_cqe_handlers() calls the handler after the fd handlers */
+    if (data & FDMON_IO_URING_CQE_HANDLER) {
+        CqeHandler *cqe_handler =
+            (CqeHandler *)(data & ~(uintptr_t)FDMON_IO_URING_CQE_HANDLER);
+
+        cqe_handler->cqe = *cqe;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -321,6 +339,27 @@ static const FDMonOps fdmon_io_uring_ops = {
     .need_wait = fdmon_io_uring_need_wait,
 };
 
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    struct io_uring_sqe *sqe;
+
+    assert(aio_has_io_uring(ctx));
+    assert(!((uintptr_t)cqe_handler & FDMON_IO_URING_CQE_HANDLER));
+
+    /* fdmon_io_uring_need_wait() sees the sqe, aio_poll() submits it */
+    sqe = get_sqe(ctx);
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)cqe_handler |
+                                        FDMON_IO_URING_CQE_HANDLER));
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
     int ret;
@@ -331,6 +370,7 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
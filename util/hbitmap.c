@@ -11,6 +11,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
@@ -393,6 +395,20 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     return old != *elem;
 }
 
+/* Whether all @n words are full.  There is no early exit, so that the
+ * compiler can vectorize the loop.
+ */
+static inline bool hb_words_are_full(const unsigned long *words, size_t n)
+{
+    unsigned long acc = ~0UL;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        acc &= words[i];
+    }
+    return acc == ~0UL;
+}
+
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
  * Returns true if at least one bit is changed. */
 static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
@@ -406,16 +422,18 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
+        unsigned long *words = &hb->levels[level][i + 1];
+        size_t n = lastpos - i - 1;
+
         changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+
+        /* The words in between are filled as a whole */
+        if (n) {
+            changed |= !hb_words_are_full(words, n);
+            memset(words, 0xff, n * sizeof(unsigned long));
         }
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
+        i = lastpos;
     }
     changed |= hb_set_elem(&hb->levels[level][i], start, last);
 
@@ -484,6 +502,8 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
+        unsigned long *words = &hb->levels[level][i + 1];
+        size_t n = lastpos - i - 1;
 
         /* Here we need a more complex test than when setting bits.  Even if
          * something was changed, we must not blank bits in the upper level
@@ -496,15 +516,13 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             pos++;
         }
 
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+        /* The words in between are cleared as a whole */
+        if (n) {
+            changed |= !buffer_is_zero(words, n * sizeof(unsigned long));
+            memset(words, 0, n * sizeof(unsigned long));
         }
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
+        i = lastpos;
     }
 
     /* Same as above, this time for lastpos.  */
@@ -723,6 +741,116 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
     }
 }
 
+/* Append @n to @buf as ULEB128.  Returns the number of bytes written, or 0
+ * if they do not fit in @size.
+ */
+static size_t hb_put_uleb128(uint8_t *buf, size_t size, uint64_t n)
+{
+    size_t len = 0;
+
+    do {
+        if (len == size) {
+            return 0;
+        }
+        buf[len++] = (n & 0x7f) | (n > 0x7f ? 0x80 : 0);
+        n >>= 7;
+    } while (n);
+
+    return len;
+}
+
+/* Read a ULEB128 number from @buf.  Returns the number of bytes read, or 0
+ * if the number is truncated or too large.
+ */
+static size_t hb_get_uleb128(const uint8_t *buf, size_t size, uint64_t *n)
+{
+    size_t len = 0;
+    int shift = 0;
+
+    *n = 0;
+    do {
+        if (len == size || shift > 63) {
+            return 0;
+        }
+        *n |= (uint64_t)(buf[len] & 0x7f) << shift;
+        shift += 7;
+    } while (buf[len++] & 0x80);
+
+    return len;
+}
+
+size_t hbitmap_serialize_runs(const HBitmap *hb, uint8_t *buf, size_t size,
+                              uint64_t start, uint64_t count)
+{
+    const unsigned long *bits = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t pos, end, next;
+    size_t len = 0, n;
+    bool set = false;
+
+    if (!count) {
+        return 0;
+    }
+
+    pos = start >> hb->granularity;
+    end = ((start + count - 1) >> hb->granularity) + 1;
+    assert(end <= hb->size);
+
+    while (pos < end) {
+        next = set ? find_next_zero_bit(bits, end, pos) :
+                     find_next_bit(bits, end, pos);
+        n = hb_put_uleb128(buf + len, size - len, next - pos);
+        if (!n) {
+            return 0;
+        }
+        len += n;
+        pos = next;
+        set = !set;
+    }
+
+    return len;
+}
+
+int hbitmap_deserialize_runs(HBitmap *hb, const uint8_t *buf, size_t size,
+                             uint64_t start, uint64_t count, bool finish)
+{
+    unsigned long *bits = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t pos, end, run;
+    size_t len = 0, n;
+    bool set = false;
+
+    if (!count) {
+        return size ? -EINVAL : 0;
+    }
+
+    pos = start >> hb->granularity;
+    end = ((start + count - 1) >> hb->granularity) + 1;
+    assert(end <= hb->size);
+
+    while (len < size) {
+        n = hb_get_uleb128(buf + len, size - len, &run);
+        if (!n || run > end - pos) {
+            return -EINVAL;
+        }
+        if (set) {
+            bitmap_set(bits, pos, run);
+        } else {
+            bitmap_clear(bits, pos, run);
+        }
+        len += n;
+        pos += run;
+        set = !set;
+    }
+
+    if (pos != end) {
+        return -EINVAL;
+    }
+
+    if (finish) {
+        hbitmap_deserialize_finish(hb);
+    }
+    return 0;
+}
+
 void hbitmap_deserialize_finish(HBitmap *bitmap)
 {
     int64_t i, size, prev_size;
@@ -864,6 +992,36 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/**
+ * hb_merge_subtree: ORs the words of @src below word @pos of @level into
+ * @dst, and returns the number of bits that became set in the last level.
+ * The words that are empty in @src are never visited, so merging a sparse
+ * bitmap is cheap however large it is.
+ */
+static uint64_t hb_merge_subtree(HBitmap *dst, const HBitmap *src,
+                                 int level, uint64_t pos)
+{
+    unsigned long cur = src->levels[level][pos];
+    unsigned long old = dst->levels[level][pos];
+    uint64_t added = 0;
+
+    dst->levels[level][pos] = old | cur;
+    if (level == HBITMAP_LEVELS - 1) {
+        return ctpopl(old | cur) - ctpopl(old);
+    }
+
+    while (cur) {
+        uint64_t child = (pos << BITS_PER_LEVEL) + ctzl(cur);
+
+        cur &= cur - 1;
+        /* Skip the sentinel of level 0 */
+        if (child < src->sizes[level + 1]) {
+            added += hb_merge_subtree(dst, src, level + 1, child);
+        }
+    }
+    return added;
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -905,19 +1063,27 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return true;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* Start from a copy of one of the bitmaps, preferably the one that is
+     * already in place, and OR the other one into it.  The upper levels let
+     * hb_merge_subtree() skip the empty parts of the other bitmap, so merging
+     * a sparse bitmap is proportional to the number of its non-zero words.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+    if (result == b) {
+        b = a;
+        a = result;
+    }
+    if (result != a) {
+        for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+            memcpy(result->levels[i], a->levels[i],
+                   a->sizes[i] * sizeof(unsigned long));
         }
+        result->count = a->count;
     }
 
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    for (j = 0; j < b->sizes[0]; j++) {
+        result->count += hb_merge_subtree(result, b, 0, j);
+    }
 
     return true;
 }
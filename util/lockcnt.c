@@ -108,7 +108,7 @@ static void lockcnt_wake(QemuLockCnt *lockcnt)
     qemu_futex_wake(&lockcnt->count, 1);
 }
 
-void qemu_lockcnt_inc(QemuLockCnt *lockcnt)
+static void lockcnt_inc(QemuLockCnt *lockcnt)
 {
     int val = qatomic_read(&lockcnt->count);
     bool waited = false;
@@ -150,7 +150,7 @@ void qemu_lockcnt_dec(QemuLockCnt *lockcnt)
  * If the function returns true, it is impossible for the counter to
  * become nonzero until the next qemu_lockcnt_unlock.
  */
-bool qemu_lockcnt_dec_and_lock(QemuLockCnt *lockcnt)
+static bool lockcnt_dec_and_lock(QemuLockCnt *lockcnt)
 {
     int val = qatomic_read(&lockcnt->count);
     int locked_state = QEMU_LOCKCNT_STATE_LOCKED;
@@ -233,7 +233,7 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt)
     return false;
 }
 
-void qemu_lockcnt_lock(QemuLockCnt *lockcnt)
+static void lockcnt_lock(QemuLockCnt *lockcnt)
 {
     int val = qatomic_read(&lockcnt->count);
     int step = QEMU_LOCKCNT_STATE_LOCKED;
@@ -305,13 +305,13 @@ void qemu_lockcnt_destroy(QemuLockCnt *lockcnt)
     qemu_mutex_destroy(&lockcnt->mutex);
 }
 
-void qemu_lockcnt_inc(QemuLockCnt *lockcnt)
+static void lockcnt_inc(QemuLockCnt *lockcnt)
 {
     int old;
     for (;;) {
         old = qatomic_read(&lockcnt->count);
         if (old == 0) {
-            qemu_lockcnt_lock(lockcnt);
+            lockcnt_lock(lockcnt);
             qemu_lockcnt_inc_and_unlock(lockcnt);
             return;
         } else {
@@ -331,7 +331,7 @@ void qemu_lockcnt_dec(QemuLockCnt *lockcnt)
  * It is impossible for the counter to become nonzero while the mutex
  * is taken.
  */
-bool qemu_lockcnt_dec_and_lock(QemuLockCnt *lockcnt)
+static bool lockcnt_dec_and_lock(QemuLockCnt *lockcnt)
 {
     int val = qatomic_read(&lockcnt->count);
     while (val > 1) {
@@ -344,7 +344,7 @@ bool qemu_lockcnt_dec_and_lock(QemuLockCnt *lockcnt)
         return false;
     }
 
-    qemu_lockcnt_lock(lockcnt);
+    lockcnt_lock(lockcnt);
     if (qatomic_fetch_dec(&lockcnt->count) == 1) {
         return true;
     }
@@ -367,7 +367,7 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt)
         return false;
     }
 
-    qemu_lockcnt_lock(lockcnt);
+    lockcnt_lock(lockcnt);
     if (qatomic_fetch_dec(&lockcnt->count) == 1) {
         return true;
     }
@@ -376,9 +376,9 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt)
     return false;
 }
 
-void qemu_lockcnt_lock(QemuLockCnt *lockcnt)
+static void lockcnt_lock(QemuLockCnt *lockcnt)
 {
-    qemu_mutex_lock(&lockcnt->mutex);
+    qemu_mutex_lock__raw(&lockcnt->mutex);
 }
 
 void qemu_lockcnt_inc_and_unlock(QemuLockCnt *lockcnt)
@@ -397,3 +397,44 @@ unsigned qemu_lockcnt_count(QemuLockCnt *lockcnt)
     return qatomic_read(&lockcnt->count);
 }
 #endif
+
+/*
+ * Entry points that can wait, timed for QSP.  A lockcnt is not a mutex,
+ * so its mutex is always locked with qemu_mutex_lock__raw() above and
+ * is only accounted here.
+ */
+void qemu_lockcnt_inc_impl(QemuLockCnt *lockcnt, const char *file, int line)
+{
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
+
+    lockcnt_inc(lockcnt);
+    if (sampled) {
+        qsp_sample_end(&s, lockcnt, file, line, QSP_LOCKCNT);
+    }
+}
+
+bool qemu_lockcnt_dec_and_lock_impl(QemuLockCnt *lockcnt,
+                                    const char *file, int line)
+{
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
+    bool locked;
+
+    locked = lockcnt_dec_and_lock(lockcnt);
+    if (sampled) {
+        qsp_sample_end(&s, lockcnt, file, line, QSP_LOCKCNT);
+    }
+    return locked;
+}
+
+void qemu_lockcnt_lock_impl(QemuLockCnt *lockcnt, const char *file, int line)
+{
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
+
+    lockcnt_lock(lockcnt);
+    if (sampled) {
+        qsp_sample_end(&s, lockcnt, file, line, QSP_LOCKCNT);
+    }
+}
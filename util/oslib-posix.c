@@ -40,9 +40,11 @@
 #include <libgen.h>
 #include "qemu/cutils.h"
 #include "qemu/compiler.h"
+#include "qemu/bitmap.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -73,22 +75,37 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+struct MemsetThread;
+
+typedef struct MemsetContext {
+    bool all_threads_created;
+    bool any_thread_failed;
+    struct MemsetThread *threads;
+    int num_threads;
+    /* Host CPUs to run the threads on, or NULL */
+    unsigned long *affinity;
+    unsigned long affinity_bits;
+    QSLIST_ENTRY(MemsetContext) next;
+} MemsetContext;
+
 struct MemsetThread {
     char *addr;
     size_t numpages;
     size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
+    MemsetContext *context;
 };
 typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+/* The preallocation whose threads sigbus_handler() looks after */
+static MemsetContext *sigbus_memset_context;
+/* Preallocations left running until os_mem_prealloc_finish() */
+static QSLIST_HEAD(, MemsetContext) memset_contexts =
+    QSLIST_HEAD_INITIALIZER(memset_contexts);
 
 static QemuMutex page_mutex;
 static QemuCond page_cond;
-static bool threads_created_flag;
 
 int qemu_get_thread_id(void)
 {
@@ -439,38 +456,66 @@ const char *qemu_get_exec_dir(void)
 static void sigbus_handler(int signal)
 {
     int i;
-    if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
+
+    if (sigbus_memset_context) {
+        for (i = 0; i < sigbus_memset_context->num_threads; i++) {
+            MemsetThread *thread = &sigbus_memset_context->threads[i];
+
+            if (qemu_thread_is_self(&thread->pgthread)) {
+                siglongjmp(thread->env, 1);
             }
         }
     }
 }
 
-static void *do_touch_pages(void *arg)
+/*
+ * On Linux, the page faults of the touch threads can cause mmap_sem
+ * contention with allocation of the thread stacks.  Do not start
+ * touching pages until all threads have been created.
+ */
+static void memset_thread_wait_start(MemsetThread *thread)
 {
-    MemsetThread *memset_args = (MemsetThread *)arg;
-    sigset_t set, oldset;
-
-    /*
-     * On Linux, the page faults from the loop below can cause mmap_sem
-     * contention with allocation of the thread stacks.  Do not start
-     * clearing until all threads have been created.
-     */
     qemu_mutex_lock(&page_mutex);
-    while(!threads_created_flag){
+    while (!thread->context->all_threads_created) {
         qemu_cond_wait(&page_cond, &page_mutex);
     }
     qemu_mutex_unlock(&page_mutex);
 
+#ifdef CONFIG_LINUX
+    if (thread->context->affinity) {
+        unsigned long naffinity = thread->context->affinity_bits;
+        size_t size = CPU_ALLOC_SIZE(naffinity);
+        cpu_set_t *set = CPU_ALLOC(naffinity);
+        unsigned long cpu;
+
+        CPU_ZERO_S(size, set);
+        for (cpu = find_first_bit(thread->context->affinity, naffinity);
+             cpu < naffinity;
+             cpu = find_next_bit(thread->context->affinity, naffinity,
+                                 cpu + 1)) {
+            CPU_SET_S(cpu, size, set);
+        }
+        /* Only a hint: the pages get populated wherever the thread runs */
+        sched_setaffinity(0, size, set);
+        CPU_FREE(set);
+    }
+#endif
+}
+
+static void *do_touch_pages(void *arg)
+{
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    sigset_t set, oldset;
+
+    memset_thread_wait_start(memset_args);
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
     if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
+        memset_args->context->any_thread_failed = true;
     } else {
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
@@ -497,9 +542,27 @@ static void *do_touch_pages(void *arg)
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+static void *do_madv_populate_write_pages(void *arg)
 {
-    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    size_t size = memset_args->numpages * memset_args->hpagesize;
+
+    memset_thread_wait_start(memset_args);
+
+    /* Fault in the pages without touching their contents */
+    if (size && qemu_madvise(memset_args->addr, size,
+                             QEMU_MADV_POPULATE_WRITE)) {
+        qatomic_set(&memset_args->context->any_thread_failed, true);
+    }
+    return NULL;
+}
+
+static inline int get_memset_num_threads(int smp_cpus,
+                                         const unsigned long *affinity,
+                                         unsigned long naffinity)
+{
+    long host_procs = affinity ? bitmap_count_one(affinity, naffinity) :
+                                 sysconf(_SC_NPROCESSORS_ONLN);
     int ret = 1;
 
     if (host_procs > 0) {
@@ -509,10 +572,35 @@ static inline int get_memset_num_threads(int smp_cpus)
     return ret;
 }
 
+static void memset_context_free(MemsetContext *context)
+{
+    g_free(context->threads);
+    g_free(context->affinity);
+    g_free(context);
+}
+
+/* Join the threads of @context and free it; returns true if one failed */
+static bool memset_context_join(MemsetContext *context)
+{
+    bool failed;
+    int i;
+
+    for (i = 0; i < context->num_threads; i++) {
+        qemu_thread_join(&context->threads[i].pgthread);
+    }
+    failed = context->any_thread_failed;
+    memset_context_free(context);
+    return failed;
+}
+
 static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+                            int smp_cpus, const unsigned long *affinity,
+                            unsigned long naffinity, bool async,
+                            bool use_madv_populate_write)
 {
     static gsize initialized = 0;
+    MemsetContext *context = g_new0(MemsetContext, 1);
+    void *(*touch_fn)(void *);
     size_t numpages_per_thread, leftover;
     char *addr = area;
     int i = 0;
@@ -523,66 +611,113 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
         g_once_init_leave(&initialized, 1);
     }
 
-    memset_thread_failed = false;
-    threads_created_flag = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = numpages / memset_num_threads;
-    leftover = numpages % memset_num_threads;
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = numpages_per_thread + (i < leftover);
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
+    if (affinity) {
+        context->affinity = bitmap_new(naffinity);
+        bitmap_copy(context->affinity, affinity, naffinity);
+        context->affinity_bits = naffinity;
+    }
+    touch_fn = use_madv_populate_write ? do_madv_populate_write_pages :
+                                         do_touch_pages;
+
+    context->num_threads = get_memset_num_threads(smp_cpus, affinity,
+                                                  naffinity);
+    context->threads = g_new0(MemsetThread, context->num_threads);
+    numpages_per_thread = numpages / context->num_threads;
+    leftover = numpages % context->num_threads;
+    for (i = 0; i < context->num_threads; i++) {
+        context->threads[i].addr = addr;
+        context->threads[i].numpages = numpages_per_thread + (i < leftover);
+        context->threads[i].hpagesize = hpagesize;
+        context->threads[i].context = context;
+        qemu_thread_create(&context->threads[i].pgthread, "touch_pages",
+                           touch_fn, &context->threads[i],
                            QEMU_THREAD_JOINABLE);
-        addr += memset_thread[i].numpages * hpagesize;
+        addr += context->threads[i].numpages * hpagesize;
+    }
+
+    if (!use_madv_populate_write) {
+        sigbus_memset_context = context;
     }
 
     qemu_mutex_lock(&page_mutex);
-    threads_created_flag = true;
+    context->all_threads_created = true;
     qemu_cond_broadcast(&page_cond);
     qemu_mutex_unlock(&page_mutex);
 
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
+    if (async) {
+        QSLIST_INSERT_HEAD(&memset_contexts, context, next);
+        return false;
     }
-    g_free(memset_thread);
-    memset_thread = NULL;
 
-    return memset_thread_failed;
+    sigbus_memset_context = NULL;
+    return memset_context_join(context);
+}
+
+static bool madv_populate_write_possible(char *area, size_t pagesize)
+{
+    return !qemu_madvise(area, pagesize, QEMU_MADV_POPULATE_WRITE) ||
+           errno != EINVAL;
 }
 
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+                     const unsigned long *affinity, unsigned long naffinity,
+                     bool async, Error **errp)
 {
     int ret;
     struct sigaction act, oldact;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    bool use_madv_populate_write;
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
+    use_madv_populate_write = madv_populate_write_possible(area, hpagesize);
 
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
-        return;
+    if (!use_madv_populate_write) {
+        /* Touching pages reports errors via SIGBUS, one caller at a time */
+        async = false;
+
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = &sigbus_handler;
+        act.sa_flags = 0;
+
+        ret = sigaction(SIGBUS, &act, &oldact);
+        if (ret) {
+            error_setg_errno(errp, errno,
+                "os_mem_prealloc: failed to install signal handler");
+            return;
+        }
     }
 
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    if (touch_all_pages(area, hpagesize, numpages, smp_cpus, affinity,
+                        naffinity, async, use_madv_populate_write)) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+    if (!use_madv_populate_write) {
+        ret = sigaction(SIGBUS, &oldact, NULL);
+        if (ret) {
+            /* Terminate QEMU since it can't recover from error */
+            perror("os_mem_prealloc: failed to reinstall signal handler");
+            exit(1);
+        }
+    }
+}
+
+void os_mem_prealloc_finish(Error **errp)
+{
+    bool failed = false;
+
+    while (!QSLIST_EMPTY(&memset_contexts)) {
+        MemsetContext *context = QSLIST_FIRST(&memset_contexts);
+
+        QSLIST_REMOVE_HEAD(&memset_contexts, next);
+        failed |= memset_context_join(context);
+    }
+
+    if (failed) {
+        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
+            "pages available to allocate guest RAM");
     }
 }
 
@@ -741,6 +876,21 @@ void *qemu_alloc_stack(size_t *sz)
     return ptr;
 }
 
+void qemu_discard_stack(void *stack, size_t sz, size_t keep)
+{
+    /*
+     * Only when the stack grows down from its end, and not when the pages
+     * are filled with a pattern to measure how much of them is used.
+     */
+#if !defined(HOST_IA64) && !defined(HOST_HPPA) && \
+    !defined(CONFIG_DEBUG_STACK_USAGE)
+    if (sz > keep) {
+        qemu_madvise(stack, ROUND_DOWN(sz - keep, qemu_real_host_page_size),
+                     QEMU_MADV_DONTNEED);
+    }
+#endif
+}
+
 #ifdef CONFIG_DEBUG_STACK_USAGE
 static __thread unsigned int max_stack_usage;
 #endif
@@ -371,7 +371,8 @@ int getpagesize(void)
 }
 
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+                     const unsigned long *affinity, unsigned long naffinity,
+                     bool async, Error **errp)
 {
     int i;
     size_t pagesize = qemu_real_host_page_size;
@@ -382,6 +383,10 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+void os_mem_prealloc_finish(Error **errp)
+{
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
@@ -31,6 +31,7 @@
 #include "qemu/coroutine_int.h"
 #include "qemu/processor.h"
 #include "qemu/queue.h"
+#include "qemu/thread.h"
 #include "block/aio.h"
 #include "trace.h"
 
@@ -232,7 +233,7 @@ static void coroutine_fn qemu_co_mutex_lock_slowpath(AioContext *ctx,
     trace_qemu_co_mutex_lock_return(mutex, self);
 }
 
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex)
+static void coroutine_fn do_co_mutex_lock(CoMutex *mutex)
 {
     AioContext *ctx = qemu_get_current_aio_context();
     Coroutine *self = qemu_coroutine_self();
@@ -272,6 +273,18 @@ retry_fast_path:
     self->locks_held++;
 }
 
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex,
+                                          const char *file, int line)
+{
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
+
+    do_co_mutex_lock(mutex);
+    if (sampled) {
+        qsp_sample_end(&s, mutex, file, line, QSP_CO_MUTEX);
+    }
+}
+
 void coroutine_fn qemu_co_mutex_unlock(CoMutex *mutex)
 {
     Coroutine *self = qemu_coroutine_self();
@@ -374,11 +387,13 @@ static void qemu_co_rwlock_maybe_wake_one(CoRwlock *lock)
     }
 }
 
-void qemu_co_rwlock_rdlock(CoRwlock *lock)
+void qemu_co_rwlock_rdlock_impl(CoRwlock *lock, const char *file, int line)
 {
     Coroutine *self = qemu_coroutine_self();
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
 
-    qemu_co_mutex_lock(&lock->mutex);
+    do_co_mutex_lock(&lock->mutex);
     /* For fairness, wait if a writer is in line.  */
     if (lock->owners == 0 || (lock->owners > 0 && QSIMPLEQ_EMPTY(&lock->tickets))) {
         lock->owners++;
@@ -392,11 +407,14 @@ void qemu_co_rwlock_rdlock(CoRwlock *lock)
         assert(lock->owners >= 1);
 
         /* Possibly wake another reader, which will wake the next in line.  */
-        qemu_co_mutex_lock(&lock->mutex);
+        do_co_mutex_lock(&lock->mutex);
         qemu_co_rwlock_maybe_wake_one(lock);
     }
 
     self->locks_held++;
+    if (sampled) {
+        qsp_sample_end(&s, lock, file, line, QSP_CO_RWLOCK_RD);
+    }
 }
 
 void qemu_co_rwlock_unlock(CoRwlock *lock)
@@ -406,7 +424,7 @@ void qemu_co_rwlock_unlock(CoRwlock *lock)
     assert(qemu_in_coroutine());
     self->locks_held--;
 
-    qemu_co_mutex_lock(&lock->mutex);
+    do_co_mutex_lock(&lock->mutex);
     if (lock->owners > 0) {
         lock->owners--;
     } else {
@@ -419,7 +437,7 @@ void qemu_co_rwlock_unlock(CoRwlock *lock)
 
 void qemu_co_rwlock_downgrade(CoRwlock *lock)
 {
-    qemu_co_mutex_lock(&lock->mutex);
+    do_co_mutex_lock(&lock->mutex);
     assert(lock->owners == -1);
     lock->owners = 1;
 
@@ -427,11 +445,13 @@ void qemu_co_rwlock_downgrade(CoRwlock *lock)
     qemu_co_rwlock_maybe_wake_one(lock);
 }
 
-void qemu_co_rwlock_wrlock(CoRwlock *lock)
+void qemu_co_rwlock_wrlock_impl(CoRwlock *lock, const char *file, int line)
 {
     Coroutine *self = qemu_coroutine_self();
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
 
-    qemu_co_mutex_lock(&lock->mutex);
+    do_co_mutex_lock(&lock->mutex);
     if (lock->owners == 0) {
         lock->owners = -1;
         qemu_co_mutex_unlock(&lock->mutex);
@@ -445,11 +465,17 @@ void qemu_co_rwlock_wrlock(CoRwlock *lock)
     }
 
     self->locks_held++;
+    if (sampled) {
+        qsp_sample_end(&s, lock, file, line, QSP_CO_RWLOCK_WR);
+    }
 }
 
-void qemu_co_rwlock_upgrade(CoRwlock *lock)
+void qemu_co_rwlock_upgrade_impl(CoRwlock *lock, const char *file, int line)
 {
-    qemu_co_mutex_lock(&lock->mutex);
+    QSPSample s;
+    bool sampled = qsp_sample_start(&s);
+
+    do_co_mutex_lock(&lock->mutex);
     assert(lock->owners > 0);
     /* For fairness, wait if a writer is in line.  */
     if (lock->owners == 1 && QSIMPLEQ_EMPTY(&lock->tickets)) {
@@ -464,4 +490,8 @@ void qemu_co_rwlock_upgrade(CoRwlock *lock)
         qemu_coroutine_yield();
         assert(lock->owners == -1);
     }
+
+    if (sampled) {
+        qsp_sample_end(&s, lock, file, line, QSP_CO_RWLOCK_WR);
+    }
 }
@@ -22,6 +22,10 @@
 
 enum {
     POOL_BATCH_SIZE = 64,
+    /* Upper bound for alloc_pool_max; each stack is two host mappings */
+    POOL_MAX_SIZE = 4096,
+    /* Number of creations after which alloc_pool_max is recomputed */
+    POOL_PERIOD = 16384,
 };
 
 /** Free list to speed up creation */
@@ -31,6 +35,53 @@ static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(po
 static __thread unsigned int alloc_pool_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
 
+/*
+ * The per-thread pool keeps up to alloc_pool_max coroutines, so that a
+ * thread that had that many in flight does not go through mmap/munmap to
+ * get back there.  It grows with the peak number of coroutines in flight
+ * in this thread, and shrinks back to the peak of the last period every
+ * POOL_PERIOD creations.  The coroutines at the bottom of the pool that
+ * were not used during a period have their stacks discarded.
+ */
+static __thread unsigned int alloc_pool_max = POOL_BATCH_SIZE;
+static __thread unsigned int alloc_pool_min; /* low mark for this period */
+static __thread unsigned int in_flight;
+static __thread unsigned int in_flight_peak;
+static __thread unsigned int period_creations;
+
+static void coroutine_pool_adapt(void)
+{
+    unsigned int hot = alloc_pool_size - MIN(alloc_pool_min, alloc_pool_size);
+    unsigned int i = 0;
+    Coroutine *co, *prev = NULL, *next;
+
+    alloc_pool_max = MIN(MAX(in_flight_peak, POOL_BATCH_SIZE), POOL_MAX_SIZE);
+    trace_qemu_coroutine_pool_adapt(alloc_pool_max, alloc_pool_size, hot);
+
+    for (co = QSLIST_FIRST(&alloc_pool); co; co = next) {
+        next = QSLIST_NEXT(co, pool_next);
+        if (i >= alloc_pool_max) {
+            if (prev) {
+                QSLIST_REMOVE_AFTER(prev, pool_next);
+            } else {
+                QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
+            }
+            alloc_pool_size--;
+            qemu_coroutine_delete(co);
+            continue;
+        }
+        if (i >= hot) {
+            qemu_coroutine_discard_stack(co);
+        }
+        prev = co;
+        i++;
+    }
+
+    alloc_pool_min = alloc_pool_size;
+    in_flight_peak = in_flight;
+    period_creations = 0;
+}
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
@@ -68,6 +119,17 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
         if (co) {
             QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
             alloc_pool_size--;
+            alloc_pool_min = MIN(alloc_pool_min, alloc_pool_size);
+        }
+
+        if (++in_flight > in_flight_peak) {
+            in_flight_peak = in_flight;
+            if (in_flight_peak > alloc_pool_max) {
+                alloc_pool_max = MIN(in_flight_peak, POOL_MAX_SIZE);
+            }
+        }
+        if (++period_creations == POOL_PERIOD) {
+            coroutine_pool_adapt();
         }
     }
 
@@ -86,12 +148,16 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
+        /* Coroutines may terminate in a different thread */
+        if (in_flight) {
+            in_flight--;
+        }
         if (release_pool_size < POOL_BATCH_SIZE * 2) {
             QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
             qatomic_inc(&release_pool_size);
             return;
         }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
+        if (alloc_pool_size < alloc_pool_max) {
             QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
             alloc_pool_size++;
             return;
@@ -14,6 +14,7 @@
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
 #include "qemu/notify.h"
+#include "qemu/bitops.h"
 #include "qemu-thread-common.h"
 #include "qemu/tsan.h"
 
@@ -601,6 +602,32 @@ void qemu_thread_exit(void *retval)
     pthread_exit(retval);
 }
 
+int qemu_thread_set_affinity(QemuThread *thread, unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+#ifdef CONFIG_PTHREAD_AFFINITY_NP
+    const size_t setsize = CPU_ALLOC_SIZE(nbits);
+    unsigned long value;
+    cpu_set_t *cpuset;
+    int err;
+
+    cpuset = CPU_ALLOC(nbits);
+    g_assert(cpuset);
+
+    CPU_ZERO_S(setsize, cpuset);
+    for (value = find_first_bit(host_cpus, nbits); value < nbits;
+         value = find_next_bit(host_cpus, nbits, value + 1)) {
+        CPU_SET_S(value, setsize, cpuset);
+    }
+
+    err = pthread_setaffinity_np(thread->thread, setsize, cpuset);
+    CPU_FREE(cpuset);
+    return -err;
+#else
+    return -ENOSYS;
+#endif
+}
+
 void *qemu_thread_join(QemuThread *thread)
 {
     int err;
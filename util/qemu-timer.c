@@ -51,6 +51,9 @@ typedef struct QEMUClock {
 
     QEMUClockType type;
     bool enabled;
+
+    /* bumped when the soonest deadline may have moved earlier */
+    unsigned deadline_gen;
 } QEMUClock;
 
 QEMUTimerListGroup main_loop_tlg;
@@ -61,12 +64,20 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The active timers are kept in a binary min-heap, so that arming and
+ * deleting a timer is O(log n) and the soonest one is always at the
+ * root.  nr_active_timers may be read without the lock to check for
+ * an empty list.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimer **active_timers;
+    size_t nr_active_timers;
+    size_t active_timers_size;
+    uint64_t timer_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -93,6 +104,87 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+/* Timers with the same expiry time fire in the order they were armed */
+static inline bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+static inline void timerlist_heap_set(QEMUTimerList *timer_list, size_t i,
+                                      QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timerlist_sift_up(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
+            break;
+        }
+        timerlist_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
+    }
+    timerlist_heap_set(timer_list, i, ts);
+}
+
+static void timerlist_sift_down(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+    size_t n = timer_list->nr_active_timers;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timerlist_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
+    }
+    timerlist_heap_set(timer_list, i, ts);
+}
+
+/*
+ * Return the soonest timer in the subtree rooted at @i whose attributes
+ * are all in @attr_mask, or @best if none expires before it.  Only the
+ * timers that are filtered out are visited, because a subtree can be
+ * skipped as soon as its root is eligible.
+ */
+static QEMUTimer *timerlist_first_in_mask(QEMUTimerList *timer_list,
+                                          size_t i, int attr_mask,
+                                          QEMUTimer *best)
+{
+    QEMUTimer *ts;
+
+    if (i >= timer_list->nr_active_timers) {
+        return best;
+    }
+    ts = timer_list->active_timers[i];
+    if (best && !timer_before(ts, best)) {
+        return best;
+    }
+    if (!(ts->attributes & ~attr_mask)) {
+        return ts;
+    }
+    best = timerlist_first_in_mask(timer_list, 2 * i + 1, attr_mask, best);
+    return timerlist_first_in_mask(timer_list, 2 * i + 2, attr_mask, best);
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -117,6 +209,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -161,6 +254,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
     bool old = clock->enabled;
     clock->enabled = enabled;
     if (enabled && !old) {
+        qatomic_inc(&clock->deadline_gen);
         qemu_clock_notify(type);
     } else if (!enabled && old) {
         QLIST_FOREACH(tl, &clock->timerlists, list) {
@@ -171,7 +265,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!qatomic_read(&timer_list->active_timers);
+    return !!qatomic_read(&timer_list->nr_active_timers);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -184,15 +278,15 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nr_active_timers) {
             return false;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timer_list->active_timers[0]->expire_time;
     }
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -214,7 +308,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return -1;
     }
 
@@ -227,10 +321,10 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nr_active_timers) {
             return -1;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timer_list->active_timers[0]->expire_time;
     }
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -262,11 +356,8 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = timerlist_first_in_mask(timer_list, 0, attr_mask, NULL);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -283,6 +374,11 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     return deadline;
 }
 
+unsigned qemu_clock_deadline_gen(QEMUClockType type)
+{
+    return qatomic_read(&qemu_clock_ptr(type)->deadline_gen);
+}
+
 QEMUClockType timerlist_get_clock(QEMUTimerList *timer_list)
 {
     return timer_list->clock->type;
@@ -377,45 +473,55 @@ void timer_deinit(QEMUTimer *ts)
 
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    size_t i = ts->heap_index;
+    size_t n;
+    QEMUTimer *last;
 
+    if (ts->expire_time == -1) {
+        return;
+    }
     ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
-            break;
-        }
-        pt = &t->next;
+
+    n = timer_list->nr_active_timers - 1;
+    last = timer_list->active_timers[n];
+    qatomic_set(&timer_list->nr_active_timers, n);
+    if (last != ts) {
+        timerlist_heap_set(timer_list, i, last);
+        timerlist_sift_down(timer_list, i);
+        timerlist_sift_up(timer_list, last->heap_index);
     }
 }
 
+/* Arm or re-arm the timer, returning true if it became the soonest one */
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    size_t n = timer_list->nr_active_timers;
+    bool pending = ts->expire_time != -1;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
+    ts->expire_time = MAX(expire_time, 0);
+    ts->seq = timer_list->timer_seq++;
+    if (pending) {
+        timerlist_sift_up(timer_list, ts->heap_index);
+        timerlist_sift_down(timer_list, ts->heap_index);
+    } else {
+        if (n == timer_list->active_timers_size) {
+            timer_list->active_timers_size = MAX(16, n * 2);
+            timer_list->active_timers =
+                g_renew(QEMUTimer *, timer_list->active_timers,
+                        timer_list->active_timers_size);
         }
-        pt = &t->next;
+        timerlist_heap_set(timer_list, n, ts);
+        qatomic_set(&timer_list->nr_active_timers, n + 1);
+        timerlist_sift_up(timer_list, n);
     }
-    ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
 
-    return pt == &timer_list->active_timers;
+    return timer_list->active_timers[0] == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
 {
+    qatomic_inc(&timer_list->clock->deadline_gen);
     /* Interrupt execution to force deadline recalculation.  */
     if (icount_enabled() && timer_list->clock->type == QEMU_CLOCK_VIRTUAL) {
         icount_start_warp_timer();
@@ -443,7 +549,6 @@ void timer_mod_ns(QEMUTimer *ts, int64_t expire_time)
     bool rearm;
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    timer_del_locked(timer_list, ts);
     rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
@@ -462,9 +567,6 @@ void timer_mod_anticipate_ns(QEMUTimer *ts, int64_t expire_time)
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
         if (ts->expire_time == -1 || ts->expire_time > expire_time) {
-            if (ts->expire_time != -1) {
-                timer_del_locked(timer_list, ts);
-            }
             rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
         } else {
             rearm = false;
@@ -503,7 +605,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
@@ -542,7 +644,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while (timer_list->nr_active_timers) {
+        ts = timer_list->active_timers[0];
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -562,9 +665,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
@@ -22,8 +22,8 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and
+ *   writers; a writer only waits for the bucket it updates to be migrated.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,15 +43,25 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Resizing is incremental. A new map is allocated and published as ht->map,
+ * with a pointer to the old one. The head buckets of the old map are then
+ * migrated one at a time: with the old bucket locked, its entries are copied
+ * into the new map and the bucket is marked as migrated. Until then, the
+ * entries of an old bucket stay where they are, so lookups and writers
+ * look at the old bucket first and only use the new map once it has been
+ * migrated. Migration is done a few buckets at a time by writers after
+ * their own update, and qht_resize() migrates whatever is left on its own;
+ * the old map is freed once every bucket is migrated and no RCU readers can
+ * see it anymore. Readers and writers thus never wait for the whole table to
+ * be copied, only for the bucket they need.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
- * acquiring their bucket lock. If they don't match, a resize has occurred
+ * acquiring their bucket lock. If they don't match, a resize has started
  * while the bucket spinlock was being acquired.
  *
+ * Resets (and the resizes that come with them) are not incremental: they take
+ * all bucket spinlocks of the map, after waiting for any migration to end.
+ *
  * Related Work:
  * - Idea of cacheline-sized buckets with full hashes taken from:
  *   David, Guerraoui & Trigonakis, "Asynchronized Concurrency:
@@ -68,6 +78,7 @@
 #include "qemu/osdep.h"
 #include "qemu/qht.h"
 #include "qemu/atomic.h"
+#include "qemu/bitmap.h"
 #include "qemu/rcu.h"
 
 //#define QHT_DEBUG
@@ -150,6 +161,18 @@ struct qht_bucket {
 
 QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
 
+/*
+ * Buckets are only reached through the chain, so fetch the next one while
+ * the current one is being scanned. This is only a hint: a stale pointer is
+ * never dereferenced because of it.
+ */
+static inline void qht_bucket_prefetch(const struct qht_bucket *b)
+{
+    if (b) {
+        __builtin_prefetch(b);
+    }
+}
+
 /**
  * struct qht_map - structure to track an array of buckets
  * @rcu: used by RCU. Keep it as the top field in the struct to help valgrind
@@ -159,6 +182,12 @@ QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map that is being migrated into this one, or NULL. It is cleared,
+ *       with ht->lock held, once all of its head buckets have been migrated.
+ * @migrated: bitmap of the head buckets that have been migrated to the next
+ *            map. Allocated when a resize starts out of this map; bits are
+ *            only set with the bucket lock and seqlock held.
+ * @resize_cursor: next head bucket of @old to be migrated by a writer.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
  */
@@ -168,14 +197,21 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    unsigned long *migrated;
+    size_t resize_cursor;
 };
 
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
+/* number of head buckets migrated by a writer after each update */
+#define QHT_MIGRATE_BATCH 8
+
 static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
                                 bool reset);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_resize_finish__locked(struct qht *ht);
 
 #ifdef QHT_DEBUG
 
@@ -241,6 +277,15 @@ struct qht_bucket *qht_map_to_bucket(const struct qht_map *map, uint32_t hash)
     return &map->buckets[hash & (map->n_buckets - 1)];
 }
 
+/*
+ * Pairs with the qatomic_or() in qht_map_migrate_bucket(): once the bit is
+ * seen, so are the entries copied to the new map.
+ */
+static inline bool qht_map_bucket_migrated(const struct qht_map *map, size_t i)
+{
+    return qatomic_load_acquire(&map->migrated[BIT_WORD(i)]) & BIT_MASK(i);
+}
+
 /* acquire all bucket locks from a map */
 static void qht_map_lock_buckets(struct qht_map *map)
 {
@@ -287,15 +332,21 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
     struct qht_map *map;
 
     map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
+    if (likely(!qatomic_read(&map->old))) {
+        qht_map_lock_buckets(map);
+        if (likely(!qht_map_is_stale__locked(ht, map))) {
+            *pmap = map;
+            return;
+        }
+        qht_map_unlock_buckets(map);
     }
-    qht_map_unlock_buckets(map);
 
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
+    /*
+     * We raced with a resize, or one is in progress; acquire ht->lock to
+     * finish it and see the updated ht->map.
+     */
     qht_lock(ht);
+    qht_resize_finish__locked(ht);
     map = ht->map;
     qht_map_lock_buckets(map);
     qht_unlock(ht);
@@ -304,23 +355,46 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
 }
 
 /*
- * Get a head bucket and lock it, making sure its parent map is not stale.
- * @pmap is filled with a pointer to the bucket's parent map.
- *
- * Unlock with qemu_spin_unlock(&b->lock).
- *
- * Note: callers cannot have ht->lock held.
+ * Lock the head bucket of @old for @hash if it has not been migrated yet,
+ * and return it; return NULL otherwise.
+ * Call within an RCU read-critical section.
  */
-static inline
-struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
+static struct qht_bucket *qht_bucket_lock__unmigrated(struct qht_map *old,
+                                                      uint32_t hash)
+{
+    size_t i = hash & (old->n_buckets - 1);
+    struct qht_bucket *b = &old->buckets[i];
+
+    qemu_spin_lock(&b->lock);
+    if (likely(!qht_map_bucket_migrated(old, i))) {
+        return b;
+    }
+    qemu_spin_unlock(&b->lock);
+    return NULL;
+}
+
+static __attribute__((noinline))
+struct qht_bucket *qht_bucket_lock__slowpath(struct qht *ht, uint32_t hash,
                                              struct qht_map **pmap)
 {
     struct qht_bucket *b;
     struct qht_map *map;
+    struct qht_map *old;
 
+    /*
+     * A resize is in progress. A map with an unmigrated bucket cannot be
+     * stale, because a new resize only starts once the previous one is done.
+     */
     map = qatomic_rcu_read(&ht->map);
+    old = qatomic_rcu_read(&map->old);
+    if (old) {
+        b = qht_bucket_lock__unmigrated(old, hash);
+        if (b) {
+            *pmap = old;
+            return b;
+        }
+    }
     b = qht_map_to_bucket(map, hash);
-
     qemu_spin_lock(&b->lock);
     if (likely(!qht_map_is_stale__locked(ht, map))) {
         *pmap = map;
@@ -328,9 +402,21 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     }
     qemu_spin_unlock(&b->lock);
 
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
+    /*
+     * We raced with a resize; acquire ht->lock to see the updated ht->map.
+     * No resize can start or finish while ht->lock is held.
+     */
     qht_lock(ht);
     map = ht->map;
+    old = map->old;
+    if (old) {
+        b = qht_bucket_lock__unmigrated(old, hash);
+        if (b) {
+            qht_unlock(ht);
+            *pmap = old;
+            return b;
+        }
+    }
     b = qht_map_to_bucket(map, hash);
     qemu_spin_lock(&b->lock);
     qht_unlock(ht);
@@ -338,6 +424,38 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     return b;
 }
 
+/*
+ * Get a head bucket and lock it, making sure its parent map is not stale.
+ * While a resize is in progress, this is the head bucket of the old map
+ * unless it has already been migrated.
+ * @pmap is filled with a pointer to the bucket's parent map.
+ *
+ * Unlock with qemu_spin_unlock(&b->lock).
+ *
+ * Note: callers cannot have ht->lock held, and must be within an RCU
+ * read-critical section.
+ */
+static inline
+struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
+                                             struct qht_map **pmap)
+{
+    struct qht_bucket *b;
+    struct qht_map *map;
+
+    map = qatomic_rcu_read(&ht->map);
+    if (likely(!qatomic_read(&map->old))) {
+        b = qht_map_to_bucket(map, hash);
+
+        qemu_spin_lock(&b->lock);
+        if (likely(!qht_map_is_stale__locked(ht, map))) {
+            *pmap = map;
+            return b;
+        }
+        qemu_spin_unlock(&b->lock);
+    }
+    return qht_bucket_lock__slowpath(ht, hash, pmap);
+}
+
 static inline bool qht_map_needs_resize(const struct qht_map *map)
 {
     return qatomic_read(&map->n_added_buckets) >
@@ -366,6 +484,7 @@ static void qht_map_destroy(struct qht_map *map)
         qht_chain_destroy(&map->buckets[i]);
     }
     qemu_vfree(map->buckets);
+    g_free(map->migrated);
     g_free(map);
 }
 
@@ -376,6 +495,9 @@ static struct qht_map *qht_map_create(size_t n_buckets)
 
     map = g_malloc(sizeof(*map));
     map->n_buckets = n_buckets;
+    map->old = NULL;
+    map->migrated = NULL;
+    map->resize_cursor = 0;
 
     map->n_added_buckets = 0;
     map->n_added_buckets_threshold = n_buckets /
@@ -411,6 +533,9 @@ void qht_init(struct qht *ht, qht_cmp_func_t cmp, size_t n_elems,
 /* call only when there are no readers/writers left */
 void qht_destroy(struct qht *ht)
 {
+    if (ht->map->old) {
+        qht_map_destroy(ht->map->old);
+    }
     qht_map_destroy(ht->map);
     memset(ht, 0, sizeof(*ht));
 }
@@ -455,11 +580,6 @@ void qht_reset(struct qht *ht)
     qht_map_unlock_buckets(map);
 }
 
-static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, false);
-}
-
 static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
 {
     qht_do_resize_reset(ht, new, true);
@@ -489,9 +609,12 @@ void *qht_do_lookup(const struct qht_bucket *head, qht_lookup_func_t func,
                     const void *userp, uint32_t hash)
 {
     const struct qht_bucket *b = head;
+    const struct qht_bucket *next;
     int i;
 
     do {
+        next = qatomic_rcu_read(&b->next);
+        qht_bucket_prefetch(next);
         for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
             if (qatomic_read(&b->hashes[i]) == hash) {
                 /* The pointer is dereferenced before seqlock_read_retry,
@@ -505,7 +628,7 @@ void *qht_do_lookup(const struct qht_bucket *head, qht_lookup_func_t func,
                 }
             }
         }
-        b = qatomic_rcu_read(&b->next);
+        b = next;
     } while (b);
 
     return NULL;
@@ -525,15 +648,47 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
+/*
+ * Look up the head bucket of @old first, since its entries stay there until
+ * it is migrated. Migration happens with the bucket's seqlock held for
+ * writing, so a lookup that raced with it retries and sees the bucket as
+ * migrated.
+ */
+static __attribute__((noinline))
+void *qht_lookup__resizing(const struct qht_map *map,
+                           const struct qht_map *old, qht_lookup_func_t func,
+                           const void *userp, uint32_t hash)
+{
+    size_t i = hash & (old->n_buckets - 1);
+    const struct qht_bucket *b = &old->buckets[i];
+    unsigned int version;
+    void *ret;
+
+    do {
+        version = seqlock_read_begin(&b->sequence);
+        if (qht_map_bucket_migrated(old, i)) {
+            return qht_lookup__slowpath(qht_map_to_bucket(map, hash), func,
+                                        userp, hash);
+        }
+        ret = qht_do_lookup(b, func, userp, hash);
+    } while (seqlock_read_retry(&b->sequence, version));
+    return ret;
+}
+
 void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
                         qht_lookup_func_t func)
 {
     const struct qht_bucket *b;
     const struct qht_map *map;
+    const struct qht_map *old;
     unsigned int version;
     void *ret;
 
     map = qatomic_rcu_read(&ht->map);
+    old = qatomic_rcu_read(&map->old);
+    if (unlikely(old)) {
+        return qht_lookup__resizing(map, old, func, userp, hash);
+    }
     b = qht_map_to_bucket(map, hash);
 
     version = seqlock_read_begin(&b->sequence);
@@ -567,6 +722,7 @@ static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
     int i;
 
     do {
+        qht_bucket_prefetch(b->next);
         for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
             if (b->pointers[i]) {
                 if (unlikely(b->hashes[i] == hash &&
@@ -603,6 +759,92 @@ static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
     return NULL;
 }
 
+/*
+ * Copy the entries of head bucket @i of @old into @map, the map that
+ * replaces it, unless another thread already did so.
+ *
+ * The old bucket is locked and its seqlock held for writing until the bucket
+ * is marked as migrated, so that writers and lookups can tell in which map
+ * its entries live. Lock order is old bucket, then new bucket.
+ */
+static void qht_map_migrate_bucket(struct qht *ht, struct qht_map *map,
+                                   struct qht_map *old, size_t i)
+{
+    struct qht_bucket *head = &old->buckets[i];
+    struct qht_bucket *b = head;
+    int j;
+
+    qemu_spin_lock(&head->lock);
+    if (qht_map_bucket_migrated(old, i)) {
+        qemu_spin_unlock(&head->lock);
+        return;
+    }
+    if (i + 1 < old->n_buckets) {
+        qht_bucket_prefetch(&old->buckets[i + 1]);
+    }
+
+    seqlock_write_begin(&head->sequence);
+    do {
+        qht_bucket_prefetch(b->next);
+        for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+            struct qht_bucket *new;
+
+            if (b->pointers[j] == NULL) {
+                goto done;
+            }
+            new = qht_map_to_bucket(map, b->hashes[j]);
+            qemu_spin_lock(&new->lock);
+            qht_insert__locked(ht, map, new, b->pointers[j], b->hashes[j],
+                               NULL);
+            qht_bucket_debug__locked(new);
+            qemu_spin_unlock(&new->lock);
+        }
+        b = b->next;
+    } while (b);
+ done:
+    qatomic_or(&old->migrated[BIT_WORD(i)], BIT_MASK(i));
+    seqlock_write_end(&head->sequence);
+    qemu_spin_unlock(&head->lock);
+}
+
+/*
+ * Publish @new as the map that replaces ht->map. Its buckets are filled by
+ * qht_map_migrate_bucket(); until then, readers and writers keep using the
+ * buckets of the old map.
+ * Call with ht->lock held and no resize in progress.
+ */
+static void qht_resize_start__locked(struct qht *ht, struct qht_map *new)
+{
+    struct qht_map *old = ht->map;
+
+    g_assert(!old->old);
+    g_assert(new->n_buckets != old->n_buckets);
+    old->migrated = bitmap_new(old->n_buckets);
+    new->old = old;
+    qatomic_rcu_set(&ht->map, new);
+}
+
+/*
+ * Migrate all the buckets of the resize in progress, if any, that have not
+ * been migrated yet; then retire the old map.
+ * Call with ht->lock held.
+ */
+static void qht_resize_finish__locked(struct qht *ht)
+{
+    struct qht_map *map = ht->map;
+    struct qht_map *old = map->old;
+    size_t i;
+
+    if (!old) {
+        return;
+    }
+    for (i = 0; i < old->n_buckets; i++) {
+        qht_map_migrate_bucket(ht, map, old, i);
+    }
+    qatomic_set(&map->old, NULL);
+    call_rcu(old, qht_map_destroy, rcu);
+}
+
 static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
 {
     struct qht_map *map;
@@ -615,15 +857,60 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
         return;
     }
     map = ht->map;
-    /* another thread might have just performed the resize we were after */
-    if (qht_map_needs_resize(map)) {
-        struct qht_map *new = qht_map_create(map->n_buckets * 2);
+    /*
+     * Another thread might have just started the resize we were after.
+     * If a resize is still in progress, the next insertion that needs it
+     * will try again.
+     */
+    if (!map->old && qht_map_needs_resize(map)) {
+        qht_resize_start__locked(ht, qht_map_create(map->n_buckets * 2));
+    }
+    qht_unlock(ht);
+}
 
-        qht_do_resize(ht, new);
+static __attribute__((noinline)) void qht_resize_step(struct qht *ht)
+{
+    struct qht_map *map = qatomic_rcu_read(&ht->map);
+    struct qht_map *old = qatomic_rcu_read(&map->old);
+    size_t start, end, i;
+
+    if (!old) {
+        return;
+    }
+    start = qatomic_fetch_add(&map->resize_cursor, QHT_MIGRATE_BATCH);
+    if (start < old->n_buckets) {
+        end = MIN(start + QHT_MIGRATE_BATCH, old->n_buckets);
+        for (i = start; i < end; i++) {
+            qht_map_migrate_bucket(ht, map, old, i);
+        }
+        if (end < old->n_buckets) {
+            return;
+        }
+    }
+    /*
+     * All buckets have been claimed. If the lock is taken, whoever holds it
+     * will finish the resize, or a later writer will.
+     */
+    if (qht_trylock(ht)) {
+        return;
+    }
+    /* do not end up migrating all of a resize started meanwhile */
+    if (!qht_map_is_stale__locked(ht, map)) {
+        qht_resize_finish__locked(ht);
     }
     qht_unlock(ht);
 }
 
+/* help an ongoing resize, if any */
+static inline void qht_resize_maybe_step(struct qht *ht)
+{
+    struct qht_map *map = qatomic_rcu_read(&ht->map);
+
+    if (unlikely(qatomic_read(&map->old))) {
+        qht_resize_step(ht);
+    }
+}
+
 bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
 {
     struct qht_bucket *b;
@@ -634,6 +921,7 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     /* NULL pointers are not supported */
     qht_debug_assert(p);
 
+    RCU_READ_LOCK_GUARD();
     b = qht_bucket_lock__no_stale(ht, hash, &map);
     prev = qht_insert__locked(ht, map, b, p, hash, &needs_resize);
     qht_bucket_debug__locked(b);
@@ -642,6 +930,7 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     if (unlikely(needs_resize) && ht->mode & QHT_MODE_AUTO_RESIZE) {
         qht_grow_maybe(ht);
     }
+    qht_resize_maybe_step(ht);
     if (likely(prev == NULL)) {
         return true;
     }
@@ -745,10 +1034,12 @@ bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
     /* NULL pointers are not supported */
     qht_debug_assert(p);
 
+    RCU_READ_LOCK_GUARD();
     b = qht_bucket_lock__no_stale(ht, hash, &map);
     ret = qht_remove__locked(b, p, hash);
     qht_bucket_debug__locked(b);
     qemu_spin_unlock(&b->lock);
+    qht_resize_maybe_step(ht);
     return ret;
 }
 
@@ -804,8 +1095,7 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
+    qht_map_lock_buckets__no_stale(ht, &map);
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
 }
@@ -859,6 +1149,7 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     };
     struct qht_map_copy_data data;
 
+    qht_resize_finish__locked(ht);
     old = ht->map;
     qht_map_lock_buckets(old);
 
@@ -888,11 +1179,10 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     size_t ret = false;
 
     qht_lock(ht);
+    qht_resize_finish__locked(ht);
     if (n_buckets != ht->map->n_buckets) {
-        struct qht_map *new;
-
-        new = qht_map_create(n_buckets);
-        qht_do_resize(ht, new);
+        qht_resize_start__locked(ht, qht_map_create(n_buckets));
+        qht_resize_finish__locked(ht);
         ret = true;
     }
     qht_unlock(ht);
@@ -900,10 +1190,48 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     return ret;
 }
 
-/* pass @stats to qht_statistics_destroy() when done */
+static void qht_chain_count(const struct qht_bucket *head, size_t *pbuckets,
+                            size_t *pentries)
+{
+    const struct qht_bucket *b;
+    unsigned int version;
+    size_t buckets;
+    size_t entries;
+    int j;
+
+    do {
+        version = seqlock_read_begin(&head->sequence);
+        buckets = 0;
+        entries = 0;
+        b = head;
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (qatomic_read(&b->pointers[j]) == NULL) {
+                    break;
+                }
+                entries++;
+            }
+            buckets++;
+            b = qatomic_rcu_read(&b->next);
+        } while (b);
+    } while (seqlock_read_retry(&head->sequence, version));
+
+    *pbuckets = buckets;
+    *pentries = entries;
+}
+
+/*
+ * pass @stats to qht_statistics_destroy() when done
+ *
+ * While a resize is in progress, the distributions only cover the new map,
+ * but @entries also counts those that have not been migrated yet.
+ */
 void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
 {
     const struct qht_map *map;
+    const struct qht_map *old;
+    size_t buckets;
+    size_t entries;
     int i;
 
     map = qatomic_rcu_read(&ht->map);
@@ -919,31 +1247,22 @@ void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
     }
     stats->head_buckets = map->n_buckets;
 
-    for (i = 0; i < map->n_buckets; i++) {
-        const struct qht_bucket *head = &map->buckets[i];
-        const struct qht_bucket *b;
-        unsigned int version;
-        size_t buckets;
-        size_t entries;
-        int j;
-
-        do {
-            version = seqlock_read_begin(&head->sequence);
-            buckets = 0;
-            entries = 0;
-            b = head;
-            do {
-                for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
-                    if (qatomic_read(&b->pointers[j]) == NULL) {
-                        break;
-                    }
-                    entries++;
-                }
-                buckets++;
-                b = qatomic_rcu_read(&b->next);
-            } while (b);
-        } while (seqlock_read_retry(&head->sequence, version));
+    /*
+     * Count the old buckets first: an entry migrated meanwhile may be
+     * counted twice, but none is missed.
+     */
+    old = qatomic_rcu_read(&map->old);
+    if (old) {
+        for (i = 0; i < old->n_buckets; i++) {
+            if (!qht_map_bucket_migrated(old, i)) {
+                qht_chain_count(&old->buckets[i], &buckets, &entries);
+                stats->entries += entries;
+            }
+        }
+    }
 
+    for (i = 0; i < map->n_buckets; i++) {
+        qht_chain_count(&map->buckets[i], &buckets, &entries);
         if (entries) {
             qdist_inc(&stats->chain, buckets);
             qdist_inc(&stats->occupancy,
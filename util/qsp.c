@@ -10,11 +10,22 @@
  * help diagnose performance problems, e.g. scalability issues when
  * contention is high.
  *
- * The primitives currently supported are mutexes, recursive mutexes and
- * condition variables. Note that not all related functions are intercepted;
- * instead we profile only those functions that can have a performance impact,
- * either due to blocking (e.g. cond_wait, mutex_lock) or cache line
- * contention (e.g. mutex_lock, mutex_trylock).
+ * The primitives currently supported are mutexes, recursive mutexes,
+ * condition variables, coroutine mutexes and rwlocks, and QemuLockCnt. Note
+ * that not all related functions are intercepted; instead we profile only
+ * those functions that can have a performance impact, either due to blocking
+ * (e.g. cond_wait, mutex_lock) or cache line contention (e.g. mutex_lock,
+ * mutex_trylock). Coroutine locks and lockcnts are timed from their own
+ * implementation, see qsp_sample_start(); the others are wrapped here, by
+ * swapping the function pointers that thread.h calls through.
+ *
+ * Besides the total wait time and the number of acquisitions, each call site
+ * keeps a log2 histogram of its wait times, so that a few long waits can be
+ * told apart from many short ones.
+ *
+ * To keep the overhead down on busy locks, a sample period can be set; only
+ * one in that many operations of each thread is then timed, and the results
+ * are scaled by the period.
  *
  * QSP's design focuses on speed and scalability. This is achieved
  * by having threads do their profiling entirely on thread-local data.
@@ -58,6 +69,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/host-utils.h"
 #include "qemu/qemu-print.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
@@ -65,13 +77,6 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 
-enum QSPType {
-    QSP_MUTEX,
-    QSP_BQL_MUTEX,
-    QSP_REC_MUTEX,
-    QSP_CONDVAR,
-};
-
 struct QSPCallSite {
     const void *obj;
     const char *file; /* i.e. __FILE__; shortened later */
@@ -85,6 +90,7 @@ struct QSPEntry {
     const QSPCallSite *callsite;
     uint64_t n_acqs;
     uint64_t ns;
+    uint64_t hist[QSP_HIST_BUCKETS];
     unsigned int n_objs; /* count of coalesced objs; only used for reporting */
 };
 typedef struct QSPEntry QSPEntry;
@@ -107,6 +113,12 @@ static size_t qsp_qemu_path_len;
 /* the address of qsp_thread gives us a unique 'thread ID' */
 static __thread int qsp_thread;
 
+/* operations left until the current thread times one; see qsp_sample_start */
+static __thread unsigned int qsp_sample_countdown;
+
+bool qsp_enabled;
+static unsigned int qsp_sample_period = 1;
+
 /*
  * Call sites are the same for all threads, so we track them in a separate hash
  * table to save memory.
@@ -122,7 +134,12 @@ static const char * const qsp_typenames[] = {
     [QSP_BQL_MUTEX] = "BQL mutex",
     [QSP_REC_MUTEX] = "rec_mutex",
     [QSP_CONDVAR]   = "condvar",
+    [QSP_CO_MUTEX]  = "co_mutex",
+    [QSP_CO_RWLOCK_RD] = "co_rwlock_rd",
+    [QSP_CO_RWLOCK_WR] = "co_rwlock_wr",
+    [QSP_LOCKCNT]   = "lockcnt",
 };
+QEMU_BUILD_BUG_ON(ARRAY_SIZE(qsp_typenames) != QSP_TYPE__MAX);
 
 QemuMutexLockFunc qemu_bql_mutex_lock_func = qemu_mutex_lock_impl;
 QemuMutexLockFunc qemu_mutex_lock_func = qemu_mutex_lock_impl;
@@ -340,50 +357,93 @@ static QSPEntry *qsp_entry_get(const void *obj, const char *file, int line,
     return qsp_entry_find(&qsp_ht, &orig, hash);
 }
 
+static inline unsigned int qsp_hist_bucket(int64_t ns)
+{
+    unsigned int b;
+
+    if (ns < (1 << QSP_HIST_SHIFT)) {
+        return 0;
+    }
+    b = 64 - clz64(ns) - QSP_HIST_SHIFT;
+    return MIN(b, QSP_HIST_BUCKETS - 1);
+}
+
 /*
  * @e is in the global hash table; it is only written to by the current thread,
  * so we write to it atomically (as in "write once") to prevent torn reads.
  */
-static inline void do_qsp_entry_record(QSPEntry *e, int64_t delta, bool acq)
+static inline void do_qsp_entry_record(QSPEntry *e, int64_t delta, bool acq,
+                                       unsigned int weight)
 {
-    qatomic_set_u64(&e->ns, e->ns + delta);
+    qatomic_set_u64(&e->ns, e->ns + delta * weight);
     if (acq) {
-        qatomic_set_u64(&e->n_acqs, e->n_acqs + 1);
+        unsigned int b = qsp_hist_bucket(delta);
+
+        qatomic_set_u64(&e->n_acqs, e->n_acqs + weight);
+        qatomic_set_u64(&e->hist[b], e->hist[b] + weight);
+    }
+}
+
+bool qsp_sample_start__slowpath(QSPSample *s)
+{
+    unsigned int period = qatomic_read(&qsp_sample_period);
+
+    if (period > 1) {
+        if (qsp_sample_countdown > 1 && qsp_sample_countdown <= period) {
+            qsp_sample_countdown--;
+            return false;
+        }
+        qsp_sample_countdown = period;
     }
+    s->weight = period;
+    s->t0 = get_clock();
+    return true;
 }
 
-static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
+static void qsp_sample_record(QSPSample *s, const void *obj, const char *file,
+                              int line, enum QSPType type, bool acq)
 {
-    do_qsp_entry_record(e, delta, true);
+    int64_t t1 = get_clock();
+    QSPEntry *e;
+
+    e = qsp_entry_get(obj, file, line, type);
+    do_qsp_entry_record(e, t1 - s->t0, acq, s->weight);
+}
+
+/*
+ * Not inline: in a coroutine, this may run in a different thread than
+ * qsp_sample_start(), and the entry must be looked up for the current one.
+ */
+void qsp_sample_end(QSPSample *s, const void *obj, const char *file, int line,
+                    enum QSPType type)
+{
+    qsp_sample_record(s, obj, file, line, type, true);
 }
 
 #define QSP_GEN_VOID(type_, qsp_t_, func_, impl_)                       \
     static void func_(type_ *obj, const char *file, int line)           \
     {                                                                   \
-        QSPEntry *e;                                                    \
-        int64_t t0, t1;                                                 \
+        QSPSample s;                                                    \
                                                                         \
-        t0 = get_clock();                                               \
+        if (!qsp_sample_start__slowpath(&s)) {                          \
+            impl_(obj, file, line);                                     \
+            return;                                                     \
+        }                                                               \
         impl_(obj, file, line);                                         \
-        t1 = get_clock();                                               \
-                                                                        \
-        e = qsp_entry_get(obj, file, line, qsp_t_);                     \
-        qsp_entry_record(e, t1 - t0);                                   \
+        qsp_sample_record(&s, obj, file, line, qsp_t_, true);           \
     }
 
 #define QSP_GEN_RET1(type_, qsp_t_, func_, impl_)                       \
     static int func_(type_ *obj, const char *file, int line)            \
     {                                                                   \
-        QSPEntry *e;                                                    \
-        int64_t t0, t1;                                                 \
+        QSPSample s;                                                    \
         int err;                                                        \
                                                                         \
-        t0 = get_clock();                                               \
+        if (!qsp_sample_start__slowpath(&s)) {                          \
+            return impl_(obj, file, line);                              \
+        }                                                               \
         err = impl_(obj, file, line);                                   \
-        t1 = get_clock();                                               \
-                                                                        \
-        e = qsp_entry_get(obj, file, line, qsp_t_);                     \
-        do_qsp_entry_record(e, t1 - t0, !err);                          \
+        qsp_sample_record(&s, obj, file, line, qsp_t_, !err);           \
         return err;                                                     \
     }
 
@@ -402,31 +462,28 @@ QSP_GEN_RET1(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_trylock,
 static void
 qsp_cond_wait(QemuCond *cond, QemuMutex *mutex, const char *file, int line)
 {
-    QSPEntry *e;
-    int64_t t0, t1;
+    QSPSample s;
 
-    t0 = get_clock();
+    if (!qsp_sample_start__slowpath(&s)) {
+        qemu_cond_wait_impl(cond, mutex, file, line);
+        return;
+    }
     qemu_cond_wait_impl(cond, mutex, file, line);
-    t1 = get_clock();
-
-    e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
-    qsp_entry_record(e, t1 - t0);
+    qsp_sample_record(&s, cond, file, line, QSP_CONDVAR, true);
 }
 
 static bool
 qsp_cond_timedwait(QemuCond *cond, QemuMutex *mutex, int ms,
                    const char *file, int line)
 {
-    QSPEntry *e;
-    int64_t t0, t1;
+    QSPSample s;
     bool ret;
 
-    t0 = get_clock();
+    if (!qsp_sample_start__slowpath(&s)) {
+        return qemu_cond_timedwait_impl(cond, mutex, ms, file, line);
+    }
     ret = qemu_cond_timedwait_impl(cond, mutex, ms, file, line);
-    t1 = get_clock();
-
-    e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
-    qsp_entry_record(e, t1 - t0);
+    qsp_sample_record(&s, cond, file, line, QSP_CONDVAR, true);
     return ret;
 }
 
@@ -435,8 +492,19 @@ bool qsp_is_enabled(void)
     return qatomic_read(&qemu_mutex_lock_func) == qsp_mutex_lock;
 }
 
+void qsp_set_sample_period(unsigned int period)
+{
+    qatomic_set(&qsp_sample_period, MAX(period, 1));
+}
+
+unsigned int qsp_get_sample_period(void)
+{
+    return qatomic_read(&qsp_sample_period);
+}
+
 void qsp_enable(void)
 {
+    qatomic_set(&qsp_enabled, true);
     qatomic_set(&qemu_mutex_lock_func, qsp_mutex_lock);
     qatomic_set(&qemu_mutex_trylock_func, qsp_mutex_trylock);
     qatomic_set(&qemu_bql_mutex_lock_func, qsp_bql_mutex_lock);
@@ -448,6 +516,7 @@ void qsp_enable(void)
 
 void qsp_disable(void)
 {
+    qatomic_set(&qsp_enabled, false);
     qatomic_set(&qemu_mutex_lock_func, qemu_mutex_lock_impl);
     qatomic_set(&qemu_mutex_trylock_func, qemu_mutex_trylock_impl);
     qatomic_set(&qemu_bql_mutex_lock_func, qemu_mutex_lock_impl);
@@ -531,6 +600,7 @@ static void qsp_aggregate(void *p, uint32_t h, void *up)
     const QSPEntry *e = p;
     QSPEntry *agg;
     uint32_t hash;
+    int i;
 
     hash = qsp_entry_no_thread_hash(e);
     agg = qsp_entry_find(ht, e, hash);
@@ -540,6 +610,9 @@ static void qsp_aggregate(void *p, uint32_t h, void *up)
      */
     agg->ns += qatomic_read_u64(&e->ns);
     agg->n_acqs += qatomic_read_u64(&e->n_acqs);
+    for (i = 0; i < QSP_HIST_BUCKETS; i++) {
+        agg->hist[i] += qatomic_read_u64(&e->hist[i]);
+    }
 }
 
 static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
@@ -547,6 +620,7 @@ static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
     struct qht *ht = htp;
     QSPEntry *old = p;
     QSPEntry *new;
+    int i;
 
     new = qht_lookup(ht, old, hash);
     /* entries are never deleted, so we must have this one */
@@ -557,6 +631,10 @@ static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
 
     new->n_acqs -= old->n_acqs;
     new->ns -= old->ns;
+    for (i = 0; i < QSP_HIST_BUCKETS; i++) {
+        g_assert(new->hist[i] >= old->hist[i]);
+        new->hist[i] -= old->hist[i];
+    }
 
     /* No point in reporting an empty entry */
     if (new->n_acqs == 0 && new->ns == 0) {
@@ -578,6 +656,7 @@ static void qsp_iter_callsite_coalesce(void *p, uint32_t h, void *htp)
     QSPEntry *old = p;
     QSPEntry *e;
     uint32_t hash;
+    int i;
 
     hash = qsp_entry_no_thread_obj_hash(old);
     e = qht_lookup(ht, old, hash);
@@ -589,6 +668,9 @@ static void qsp_iter_callsite_coalesce(void *p, uint32_t h, void *htp)
     }
     e->ns += old->ns;
     e->n_acqs += old->n_acqs;
+    for (i = 0; i < QSP_HIST_BUCKETS; i++) {
+        e->hist[i] += old->hist[i];
+    }
 }
 
 static void qsp_ht_delete(void *p, uint32_t h, void *htp)
@@ -658,17 +740,6 @@ static char *qsp_at(const QSPCallSite *callsite)
     return g_string_free(s, FALSE);
 }
 
-struct QSPReportEntry {
-    const void *obj;
-    char *callsite_at;
-    const char *typename;
-    double time_s;
-    double ns_avg;
-    uint64_t n_acqs;
-    unsigned int n_objs;
-};
-typedef struct QSPReportEntry QSPReportEntry;
-
 struct QSPReport {
     QSPReportEntry *entries;
     size_t n_entries;
@@ -691,10 +762,10 @@ static gboolean qsp_tree_report(gpointer key, gpointer value, gpointer udata)
     entry->obj = e->callsite->obj;
     entry->n_objs = e->n_objs;
     entry->callsite_at = qsp_at(e->callsite);
-    entry->typename = qsp_typenames[e->callsite->type];
-    entry->time_s = e->ns * 1e-9;
+    entry->type = e->callsite->type;
+    entry->ns = e->ns;
     entry->n_acqs = e->n_acqs;
-    entry->ns_avg = e->n_acqs ? e->ns / e->n_acqs : 0;
+    memcpy(entry->hist, e->hist, sizeof(entry->hist));
     return FALSE;
 }
 
@@ -721,11 +792,11 @@ static void pr_report(const QSPReport *rep)
     /* white space to leave to the right of "Call site" */
     callsite_rspace = callsite_len - strlen("Call site");
 
-    qemu_printf("Type               Object  Call site%*s  Wait Time (s)  "
+    qemu_printf("Type                  Object  Call site%*s  Wait Time (s)  "
                 "       Count  Average (us)\n", callsite_rspace, "");
 
     /* build a horizontal rule with dashes */
-    n_dashes = 79 + callsite_rspace;
+    n_dashes = 82 + callsite_rspace;
     dashes = g_malloc(n_dashes + 1);
     memset(dashes, '-', n_dashes);
     dashes[n_dashes] = '\0';
@@ -734,8 +805,9 @@ static void pr_report(const QSPReport *rep)
     for (i = 0; i < rep->n_entries; i++) {
         const QSPReportEntry *e = &rep->entries[i];
         GString *s = g_string_new(NULL);
+        double ns_avg = e->n_acqs ? (double)e->ns / e->n_acqs : 0;
 
-        g_string_append_printf(s, "%-9s  ", e->typename);
+        g_string_append_printf(s, "%-12s  ", qsp_typenames[e->type]);
         if (e->n_objs > 1) {
             g_string_append_printf(s, "[%12u]", e->n_objs);
         } else {
@@ -744,29 +816,32 @@ static void pr_report(const QSPReport *rep)
         g_string_append_printf(s, "  %s%*s  %13.5f  %12" PRIu64 "  %12.2f\n",
                                e->callsite_at,
                                callsite_len - (int)strlen(e->callsite_at), "",
-                               e->time_s, e->n_acqs, e->ns_avg * 1e-3);
+                               e->ns * 1e-9, e->n_acqs, ns_avg * 1e-3);
         qemu_printf("%s", s->str);
         g_string_free(s, TRUE);
     }
 
     qemu_printf("%s\n", dashes);
     g_free(dashes);
+
+    if (qsp_get_sample_period() > 1) {
+        qemu_printf("Sampling 1 in %u operations; counts and times are "
+                    "estimates\n", qsp_get_sample_period());
+    }
 }
 
-static void report_destroy(QSPReport *rep)
+void qsp_report_free(QSPReportEntry *entries, size_t n_entries)
 {
     size_t i;
 
-    for (i = 0; i < rep->n_entries; i++) {
-        QSPReportEntry *e = &rep->entries[i];
-
-        g_free(e->callsite_at);
+    for (i = 0; i < n_entries; i++) {
+        g_free(entries[i].callsite_at);
     }
-    g_free(rep->entries);
+    g_free(entries);
 }
 
-void qsp_report(size_t max, enum QSPSortBy sort_by,
-                bool callsite_coalesce)
+size_t qsp_get_report(size_t max, enum QSPSortBy sort_by,
+                      bool callsite_coalesce, QSPReportEntry **entries)
 {
     GTree *tree = g_tree_new_full(qsp_tree_cmp, &sort_by, g_free, NULL);
     QSPReport rep;
@@ -781,8 +856,19 @@ void qsp_report(size_t max, enum QSPSortBy sort_by,
     g_tree_foreach(tree, qsp_tree_report, &rep);
     g_tree_destroy(tree);
 
+    *entries = rep.entries;
+    return rep.n_entries;
+}
+
+void qsp_report(size_t max, enum QSPSortBy sort_by,
+                bool callsite_coalesce)
+{
+    QSPReport rep;
+
+    rep.n_entries = qsp_get_report(max, sort_by, callsite_coalesce,
+                                   &rep.entries);
     pr_report(&rep);
-    report_destroy(&rep);
+    qsp_report_free(rep.entries, rep.n_entries);
 }
 
 static void qsp_snapshot_destroy(QSPSnapshot *snap)
@@ -32,6 +32,7 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/timer.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -49,6 +50,10 @@ QemuEvent rcu_gp_event;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/* Protects rcu_stats, which is updated once per grace period */
+static QemuSpin rcu_stats_lock;
+static RCUStats rcu_stats;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -142,6 +147,9 @@ static void wait_for_readers(void)
 
 void synchronize_rcu(void)
 {
+    int64_t start = get_clock();
+    int64_t ns;
+
     QEMU_LOCK_GUARD(&rcu_sync_lock);
 
     /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
@@ -170,66 +178,90 @@ void synchronize_rcu(void)
 
         wait_for_readers();
     }
+
+    ns = get_clock() - start;
+    qemu_spin_lock(&rcu_stats_lock);
+    rcu_stats.grace_periods++;
+    rcu_stats.grace_period_ns += ns;
+    rcu_stats.max_grace_period_ns = MAX(rcu_stats.max_grace_period_ns, ns);
+    qemu_spin_unlock(&rcu_stats_lock);
 }
 
 
 #define RCU_CALL_MIN_SIZE        30
 
-/* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
- * from liburcu.  Note that head is only used by the consumer.
+/*
+ * call_rcu1() pushes callbacks on a list owned by the calling thread, or
+ * on a global list if the thread is not registered.  Producers therefore
+ * only touch their own cache line, and only wake up the call_rcu thread
+ * when their list was empty.  The call_rcu thread takes each list as a
+ * whole, which needs no ABA protection, and restores the order in which
+ * the callbacks were queued.
  */
-static struct rcu_head dummy;
-static struct rcu_head *head = &dummy, **tail = &dummy.next;
-static int rcu_call_count;
+static struct rcu_head *global_callbacks;
 static QemuEvent rcu_call_ready_event;
 
-static void enqueue(struct rcu_head *node)
+/* Push first...last on *list.  Returns true if the list was empty. */
+static bool push_callbacks(struct rcu_head **list, struct rcu_head *first,
+                           struct rcu_head *last)
 {
-    struct rcu_head **old_tail;
+    struct rcu_head *old, *cmp;
+
+    old = qatomic_read(list);
+    do {
+        cmp = old;
+        last->next = old;
+        old = qatomic_cmpxchg(list, cmp, first);
+    } while (old != cmp);
 
-    node->next = NULL;
-    old_tail = qatomic_xchg(&tail, &node->next);
-    qatomic_mb_set(old_tail, node);
+    return !old;
 }
 
-static struct rcu_head *try_dequeue(void)
+/* Callbacks taken from the lists, oldest first */
+typedef struct {
+    struct rcu_head *head;
+    struct rcu_head **tail;
+    int n;
+} RCUCallBatch;
+
+static void take_callbacks(RCUCallBatch *batch, struct rcu_head **list)
 {
-    struct rcu_head *node, *next;
-
-retry:
-    /* Test for an empty list, which we do not expect.  Note that for
-     * the consumer head and tail are always consistent.  The head
-     * is consistent because only the consumer reads/writes it.
-     * The tail, because it is the first step in the enqueuing.
-     * It is only the next pointers that might be inconsistent.
-     */
-    if (head == &dummy && qatomic_mb_read(&tail) == &dummy.next) {
-        abort();
+    struct rcu_head *node = qatomic_xchg(list, NULL);
+    struct rcu_head *last = node;
+    struct rcu_head *first = NULL;
+
+    if (!node) {
+        return;
     }
 
-    /* If the head node has NULL in its next pointer, the value is
-     * wrong and we need to wait until its enqueuer finishes the update.
-     */
-    node = head;
-    next = qatomic_mb_read(&head->next);
-    if (!next) {
-        return NULL;
+    while (node) {
+        struct rcu_head *next = node->next;
+
+        node->next = first;
+        first = node;
+        node = next;
+        batch->n++;
     }
 
-    /* Since we are the sole consumer, and we excluded the empty case
-     * above, the queue will always have at least two nodes: the
-     * dummy node, and the one being removed.  So we do not need to update
-     * the tail pointer.
+    *batch->tail = first;
+    batch->tail = &last->next;
+}
+
+static void collect_callbacks(RCUCallBatch *batch)
+{
+    struct rcu_reader_data *index;
+
+    /*
+     * wait_for_readers() moves threads out of the registry while it waits,
+     * so exclude it to be sure that every list is looked at.
      */
-    head = next;
+    QEMU_LOCK_GUARD(&rcu_sync_lock);
+    QEMU_LOCK_GUARD(&rcu_registry_lock);
 
-    /* If we dequeued the dummy node, add it back at the end and retry.  */
-    if (node == &dummy) {
-        enqueue(node);
-        goto retry;
+    take_callbacks(batch, &global_callbacks);
+    QLIST_FOREACH(index, &registry, node) {
+        take_callbacks(batch, &index->callbacks);
     }
-
-    return node;
 }
 
 static void *call_rcu_thread(void *opaque)
@@ -239,58 +271,63 @@ static void *call_rcu_thread(void *opaque)
     rcu_register_thread();
 
     for (;;) {
+        RCUCallBatch batch = { .tail = &batch.head };
         int tries = 0;
-        int n = qatomic_read(&rcu_call_count);
+
+        collect_callbacks(&batch);
 
         /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
+         * Only the callbacks collected before synchronize_rcu() starts may
+         * be processed after it.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (batch.n == 0 ||
+               (batch.n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
             g_usleep(10000);
-            if (n == 0) {
+            if (batch.n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
-                n = qatomic_read(&rcu_call_count);
-                if (n == 0) {
+                collect_callbacks(&batch);
+                if (batch.n == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
                     malloc_trim(4 * 1024 * 1024);
 #endif
                     qemu_event_wait(&rcu_call_ready_event);
                 }
             }
-            n = qatomic_read(&rcu_call_count);
+            collect_callbacks(&batch);
         }
 
-        qatomic_sub(&rcu_call_count, n);
         synchronize_rcu();
         qemu_mutex_lock_iothread();
-        while (n > 0) {
-            node = try_dequeue();
-            while (!node) {
-                qemu_mutex_unlock_iothread();
-                qemu_event_reset(&rcu_call_ready_event);
-                node = try_dequeue();
-                if (!node) {
-                    qemu_event_wait(&rcu_call_ready_event);
-                    node = try_dequeue();
-                }
-                qemu_mutex_lock_iothread();
-            }
-
-            n--;
+        while ((node = batch.head)) {
+            batch.head = node->next;
             node->func(node);
         }
         qemu_mutex_unlock_iothread();
+
+        qemu_spin_lock(&rcu_stats_lock);
+        rcu_stats.callbacks += batch.n;
+        rcu_stats.callback_batches++;
+        qemu_spin_unlock(&rcu_stats_lock);
     }
     abort();
 }
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_head **list;
+
+    list = rcu_reader.registered ? &rcu_reader.callbacks : &global_callbacks;
     node->func = func;
-    enqueue(node);
-    qatomic_inc(&rcu_call_count);
-    qemu_event_set(&rcu_call_ready_event);
+    if (push_callbacks(list, node, node)) {
+        qemu_event_set(&rcu_call_ready_event);
+    }
+}
+
+void rcu_get_stats(RCUStats *stats)
+{
+    qemu_spin_lock(&rcu_stats_lock);
+    *stats = rcu_stats;
+    qemu_spin_unlock(&rcu_stats_lock);
 }
 
 
@@ -333,9 +370,8 @@ void drain_call_rcu(void)
      * is called, all RCU callbacks that were registered on this thread
      * prior to calling this function are completed.
      *
-     * Note that since we have only one global queue of the RCU callbacks,
-     * we also end up waiting for most of RCU callbacks that were registered
-     * on the other threads, but this is a side effect that shoudn't be
+     * Callbacks registered on other threads are usually taken in the same
+     * batch and are done too, but this is a side effect that shouldn't be
      * assumed.
      */
 
@@ -353,14 +389,29 @@ void rcu_register_thread(void)
     assert(rcu_reader.ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_INSERT_HEAD(&registry, &rcu_reader, node);
+    rcu_reader.registered = true;
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
 void rcu_unregister_thread(void)
 {
+    struct rcu_head *first, *last;
+
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_REMOVE(&rcu_reader, node);
+    rcu_reader.registered = false;
     qemu_mutex_unlock(&rcu_registry_lock);
+
+    /* The call_rcu thread cannot see our list anymore, hand it over */
+    first = qatomic_xchg(&rcu_reader.callbacks, NULL);
+    if (first) {
+        for (last = first; last->next; last = last->next) {
+            continue;
+        }
+        if (push_callbacks(&global_callbacks, first, last)) {
+            qemu_event_set(&rcu_call_ready_event);
+        }
+    }
 }
 
 static void rcu_init_complete(void)
@@ -372,6 +423,7 @@ static void rcu_init_complete(void)
     qemu_event_init(&rcu_gp_event, true);
 
     qemu_event_init(&rcu_call_ready_event, false);
+    qemu_spin_init(&rcu_stats_lock);
 
     /* The caller is assumed to have iothread lock, so the call_rcu thread
      * must have been quiescent even after forking, just recreate it.
@@ -421,6 +473,10 @@ static void rcu_init_child(void)
         return;
     }
 
+    /*
+     * Callbacks queued on the lists of other threads are lost, like the
+     * rest of the state of those threads.
+     */
     memset(&registry, 0, sizeof(registry));
     rcu_init_complete();
 }
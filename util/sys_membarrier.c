@@ -14,11 +14,30 @@
 #include <linux/membarrier.h>
 #include <sys/syscall.h>
 
+/*
+ * Linux 4.14 and newer.  These are enum constants in linux/membarrier.h,
+ * so older headers cannot be detected with #ifdef.
+ */
+#define QEMU_MEMBARRIER_CMD_PRIVATE_EXPEDITED           (1 << 3)
+#define QEMU_MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED  (1 << 4)
+
 static int
 membarrier(int cmd, int flags)
 {
     return syscall(__NR_membarrier, cmd, flags);
 }
+
+/*
+ * MEMBARRIER_CMD_SHARED waits for a grace period of the kernel's RCU, which
+ * takes milliseconds and dominates synchronize_rcu().  The private expedited
+ * command instead interrupts the CPUs that run threads of this process.
+ */
+static bool membarrier_expedited;
+
+static bool membarrier_register_expedited(void)
+{
+    return membarrier(QEMU_MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+}
 #endif
 
 void smp_mb_global(void)
@@ -26,6 +45,17 @@ void smp_mb_global(void)
 #if defined CONFIG_WIN32
     FlushProcessWriteBuffers();
 #elif defined CONFIG_LINUX
+    if (membarrier_expedited) {
+        if (membarrier(QEMU_MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0) {
+            return;
+        }
+
+        /* The registration is not inherited by the child of a fork() */
+        if (membarrier_register_expedited() &&
+            membarrier(QEMU_MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0) {
+            return;
+        }
+    }
     membarrier(MEMBARRIER_CMD_SHARED, 0);
 #else
 #error --enable-membarrier is not supported on this operating system.
@@ -41,6 +71,11 @@ void smp_mb_global_init(void)
         error_report("Please upgrade your system to a newer version of Linux");
         exit(1);
     }
+    if ((ret & QEMU_MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        membarrier_register_expedited()) {
+        membarrier_expedited = true;
+        return;
+    }
     if (!(ret & MEMBARRIER_CMD_SHARED)) {
         error_report("This QEMU binary requires MEMBARRIER_CMD_SHARED support.");
         error_report("Please upgrade your system to a newer version of Linux");
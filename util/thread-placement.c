@@ -0,0 +1,67 @@
+/*
+ * Host CPU placement of QEMU threads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread-placement.h"
+#include "qemu/lockable.h"
+#include "trace.h"
+
+typedef struct ThreadPlacementPolicy {
+    QemuThreadPlacementFunc *fn;
+    void *opaque;
+} ThreadPlacementPolicy;
+
+static QemuMutex placement_lock;
+static ThreadPlacementPolicy placement_policies[THREAD_PLACEMENT_ROLE__MAX];
+
+static void __attribute__((__constructor__)) thread_placement_init(void)
+{
+    qemu_mutex_init(&placement_lock);
+}
+
+bool qemu_thread_placement_register(ThreadPlacementRole role,
+                                    QemuThreadPlacementFunc *fn,
+                                    void *opaque)
+{
+    ThreadPlacementPolicy *p = &placement_policies[role];
+
+    QEMU_LOCK_GUARD(&placement_lock);
+    if (p->fn) {
+        return false;
+    }
+    p->opaque = opaque;
+    qatomic_set(&p->fn, fn);
+    return true;
+}
+
+void qemu_thread_placement_unregister(ThreadPlacementRole role,
+                                      void *opaque)
+{
+    ThreadPlacementPolicy *p = &placement_policies[role];
+
+    QEMU_LOCK_GUARD(&placement_lock);
+    if (p->opaque == opaque) {
+        qatomic_set(&p->fn, NULL);
+        p->opaque = NULL;
+    }
+}
+
+void qemu_thread_place(QemuThread *thread, ThreadPlacementRole role)
+{
+    ThreadPlacementPolicy *p = &placement_policies[role];
+
+    /* Unlocked check: most configurations never install a policy */
+    if (!qatomic_read(&p->fn)) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&placement_lock);
+    if (p->fn) {
+        trace_qemu_thread_place(thread, ThreadPlacementRole_str(role));
+        p->fn(thread, p->opaque);
+    }
+}
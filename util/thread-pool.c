@@ -17,11 +17,21 @@
 #include "qemu/osdep.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/thread-placement.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
+#include "qemu/processor.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
+/*
+ * How long a worker that ran out of requests keeps polling for a new one
+ * before it goes to sleep.  Requests often come in bursts, and picking
+ * one up this way costs neither the submitter nor the worker a wakeup.
+ */
+#define THREAD_POOL_SPIN_NS (20 * SCALE_US)
+
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
@@ -45,6 +55,9 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
+    /* When the request was submitted, for the pool statistics.  */
+    int64_t submit_time;
+
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
@@ -57,7 +70,7 @@ struct ThreadPool {
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuSemaphore sem;
+    QemuCond request_cond;
     int max_threads;
     QEMUBH *new_thread_bh;
 
@@ -66,39 +79,78 @@ struct ThreadPool {
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int queue_depth;     /* requests in request_list, also read by spinners */
     int cur_threads;
-    int idle_threads;
+    int idle_threads;    /* threads waiting on request_cond */
+    int spinning_threads; /* threads polling queue_depth */
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     bool stopping;
+    uint64_t requests;   /* requests taken by a worker */
+    uint64_t wait_ns;    /* time these waited in request_list */
 };
 
+/*
+ * Take the next request, or return NULL if the thread should exit.
+ * Called with lock taken.
+ */
+static ThreadPoolElement *worker_get_request(ThreadPool *pool)
+{
+    ThreadPoolElement *req;
+
+    if (QTAILQ_EMPTY(&pool->request_list) && !pool->stopping) {
+        int64_t deadline = get_clock() + THREAD_POOL_SPIN_NS;
+
+        /* thread_pool_submit_aio() does not wake us up while we spin */
+        pool->spinning_threads++;
+        qemu_mutex_unlock(&pool->lock);
+        while (!qatomic_read(&pool->queue_depth) && get_clock() < deadline) {
+            cpu_relax();
+        }
+        qemu_mutex_lock(&pool->lock);
+        pool->spinning_threads--;
+    }
+
+    while (QTAILQ_EMPTY(&pool->request_list) && !pool->stopping) {
+        bool woken;
+
+        pool->idle_threads++;
+        woken = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
+        pool->idle_threads--;
+        if (!woken && QTAILQ_EMPTY(&pool->request_list)) {
+            return NULL;
+        }
+    }
+    if (pool->stopping) {
+        return NULL;
+    }
+
+    req = QTAILQ_FIRST(&pool->request_list);
+    QTAILQ_REMOVE(&pool->request_list, req, reqs);
+    qatomic_set(&pool->queue_depth, pool->queue_depth - 1);
+    req->state = THREAD_ACTIVE;
+    pool->requests++;
+    pool->wait_ns += get_clock() - req->submit_time;
+    return req;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    ThreadPoolElement *req;
+    QemuThread self;
+
+    /* Workers are detached, so only the worker itself can safely pin it */
+    qemu_thread_get_self(&self);
+    qemu_thread_place(&self, THREAD_PLACEMENT_ROLE_WORKER);
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
     do_spawn_thread(pool);
 
-    while (!pool->stopping) {
-        ThreadPoolElement *req;
+    while ((req = worker_get_request(pool))) {
         int ret;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
-        }
-
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
         ret = req->func(req->arg);
@@ -108,9 +160,14 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
+        /*
+         * While the BH is pending, this does not notify the AioContext
+         * again, so the completions of a burst of requests are reported
+         * together.
+         */
         qemu_bh_schedule(pool->completion_bh);
+
+        qemu_mutex_lock(&pool->lock);
     }
 
     pool->cur_threads--;
@@ -211,14 +268,10 @@ static void thread_pool_cancel(BlockAIOCB *acb)
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
     QEMU_LOCK_GUARD(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
-         */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
+    if (elem->state == THREAD_QUEUED) {
+        /* No thread has yet started working on elem, so take it back */
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        qatomic_set(&pool->queue_depth, pool->queue_depth - 1);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -251,18 +304,28 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->submit_time = get_clock();
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
     qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
+    if (pool->idle_threads + pool->spinning_threads == 0 &&
+        pool->cur_threads < pool->max_threads) {
         spawn_thread(pool);
     }
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    qatomic_set(&pool->queue_depth, pool->queue_depth + 1);
+    /*
+     * A spinning thread takes the request without a wakeup.  It checks
+     * request_list again with lock taken before it goes to sleep, so the
+     * request cannot be missed.
+     */
+    if (pool->queue_depth > pool->spinning_threads) {
+        qemu_cond_signal(&pool->request_cond);
+    }
     qemu_mutex_unlock(&pool->lock);
-    qemu_sem_post(&pool->sem);
     return &req->common;
 }
 
@@ -294,6 +357,16 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+    stats->threads = pool->cur_threads;
+    stats->idle_threads = pool->idle_threads + pool->spinning_threads;
+    stats->queue_depth = pool->queue_depth;
+    stats->requests = pool->requests;
+    stats->wait_ns = pool->wait_ns;
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
     if (!ctx) {
@@ -305,7 +378,7 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_sem_init(&pool->sem, 0);
+    qemu_cond_init(&pool->request_cond);
     pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
@@ -338,14 +411,14 @@ void thread_pool_free(ThreadPool *pool)
     /* Wait for worker threads to terminate */
     pool->stopping = true;
     while (pool->cur_threads > 0) {
-        qemu_sem_post(&pool->sem);
+        qemu_cond_broadcast(&pool->request_cond);
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
-    qemu_sem_destroy(&pool->sem);
+    qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
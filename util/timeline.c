@@ -0,0 +1,136 @@
+/*
+ * Startup timeline recorder
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/timeline.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qlist.h"
+
+static QemuMutex timeline_lock;
+static GArray *timeline_events;
+static uint64_t timeline_n_dropped;
+
+static void __attribute__((constructor)) timeline_init(void)
+{
+    qemu_mutex_init(&timeline_lock);
+    timeline_events = g_array_new(false, false, sizeof(TimelineEvent));
+}
+
+int64_t timeline_start(void)
+{
+    return get_clock();
+}
+
+void timeline_record(const char *category, const char *name,
+                     int64_t start_ns)
+{
+    TimelineEvent ev = {
+        .category = category,
+        .start_ns = start_ns,
+        .duration_ns = get_clock() - start_ns,
+        .thread_id = qemu_get_thread_id(),
+    };
+
+    qemu_mutex_lock(&timeline_lock);
+    if (timeline_events->len < TIMELINE_MAX_EVENTS) {
+        ev.name = g_strdup(name);
+        g_array_append_val(timeline_events, ev);
+    } else {
+        timeline_n_dropped++;
+    }
+    qemu_mutex_unlock(&timeline_lock);
+}
+
+static gint timeline_event_cmp(gconstpointer a, gconstpointer b)
+{
+    const TimelineEvent *ea = a;
+    const TimelineEvent *eb = b;
+
+    return ea->start_ns < eb->start_ns ? -1 : ea->start_ns > eb->start_ns;
+}
+
+size_t timeline_get(TimelineEvent **events)
+{
+    size_t i, n;
+
+    qemu_mutex_lock(&timeline_lock);
+    n = timeline_events->len;
+    *events = g_memdup(timeline_events->data, n * sizeof(TimelineEvent));
+    qemu_mutex_unlock(&timeline_lock);
+
+    for (i = 0; i < n; i++) {
+        (*events)[i].name = g_strdup((*events)[i].name);
+    }
+    /* Spans are recorded when they end, and they can be nested */
+    qsort(*events, n, sizeof(TimelineEvent), timeline_event_cmp);
+    return n;
+}
+
+void timeline_free(TimelineEvent *events, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        g_free(events[i].name);
+    }
+    g_free(events);
+}
+
+uint64_t timeline_dropped(void)
+{
+    uint64_t ret;
+
+    qemu_mutex_lock(&timeline_lock);
+    ret = timeline_n_dropped;
+    qemu_mutex_unlock(&timeline_lock);
+    return ret;
+}
+
+/*
+ * Complete ("X") events of the Chrome trace event format, loadable in
+ * chrome://tracing or Perfetto.  Timestamps are in microseconds.
+ */
+bool timeline_dump_chrome(const char *filename, Error **errp)
+{
+    g_autoptr(GError) gerr = NULL;
+    TimelineEvent *events;
+    QDict *root = qdict_new();
+    QList *list = qlist_new();
+    GString *json;
+    size_t i, n;
+    bool ret;
+
+    n = timeline_get(&events);
+    for (i = 0; i < n; i++) {
+        QDict *ev = qdict_new();
+
+        qdict_put_str(ev, "name", events[i].name);
+        qdict_put_str(ev, "cat", events[i].category);
+        qdict_put_str(ev, "ph", "X");
+        qdict_put_int(ev, "ts", events[i].start_ns / SCALE_US);
+        qdict_put_int(ev, "dur", events[i].duration_ns / SCALE_US);
+        qdict_put_int(ev, "pid", getpid());
+        qdict_put_int(ev, "tid", events[i].thread_id);
+        qlist_append(list, ev);
+    }
+    timeline_free(events, n);
+    qdict_put(root, "traceEvents", list);
+
+    json = qobject_to_json(QOBJECT(root));
+    qobject_unref(root);
+
+    ret = g_file_set_contents(filename, json->str, json->len, &gerr);
+    if (!ret) {
+        error_setg(errp, "Cannot write timeline to '%s': %s",
+                   filename, gerr->message);
+    }
+    g_string_free(json, true);
+    return ret;
+}